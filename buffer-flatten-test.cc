@@ -0,0 +1,107 @@
+// buffer-flatten-test.cc
+// Tests for `buffer-flatten` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "buffer-flatten.h"            // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/exc.h"                // smbase::XFormat
+#include "smbase/flatutil.h"           // xferVectorBytewise
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, DIAG
+#include "smbase/xassert.h"            // xassert, xfailure
+
+#include <vector>                      // std::vector
+
+#include <stdint.h>                    // int32_t, int64_t
+
+using namespace smbase;
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+void testRoundTrip()
+{
+  std::vector<unsigned char> buffer;
+
+  // Pretend to reserve space for a header, which the writer must leave
+  // alone.
+  buffer.push_back(0xAA);
+  buffer.push_back(0xBB);
+
+  {
+    BufferFlatten flat(buffer);
+    xassert(flat.writing());
+
+    int32_t i = -5;
+    int64_t j = 0x123456789ABCLL;
+    bool b = true;
+    std::vector<unsigned char> v{1, 2, 3, 250};
+    flat.xfer_int32_t(i);
+    flat.xfer_int64_t(j);
+    flat.xferBool(b);
+    xferVectorBytewise(flat, v);
+  }
+
+  EXPECT_EQ((int)buffer[0], 0xAA);
+  EXPECT_EQ((int)buffer[1], 0xBB);
+  DIAG("serialized size: " << buffer.size());
+
+  {
+    BufferFlatten flat(buffer.data()+2, buffer.size()-2);
+    xassert(flat.reading());
+
+    int32_t i = 0;
+    int64_t j = 0;
+    bool b = false;
+    std::vector<unsigned char> v;
+    flat.xfer_int32_t(i);
+    flat.xfer_int64_t(j);
+    flat.xferBool(b);
+    xferVectorBytewise(flat, v);
+
+    EXPECT_EQ(i, -5);
+    EXPECT_EQ(j, 0x123456789ABCLL);
+    EXPECT_EQ(b, true);
+    EXPECT_EQ(v.size(), 4);
+    EXPECT_EQ((int)v[3], 250);
+    EXPECT_EQ(flat.remaining(), 0);
+  }
+}
+
+
+void testTruncated()
+{
+  std::vector<unsigned char> buffer;
+  {
+    BufferFlatten flat(buffer);
+    int64_t j = 7;
+    flat.xfer_int64_t(j);
+  }
+
+  BufferFlatten flat(buffer.data(), buffer.size()-1);
+  try {
+    int64_t j;
+    flat.xfer_int64_t(j);
+    xfailure("should have failed");
+  }
+  catch (XFormat &x) {
+    DIAG("as expected: " << x.why());
+  }
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_buffer_flatten(CmdlineArgsSpan args)
+{
+  testRoundTrip();
+  testTruncated();
+}
+
+
+// EOF
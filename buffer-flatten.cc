@@ -0,0 +1,78 @@
+// buffer-flatten.cc
+// Code for buffer-flatten.h.
+
+#include "buffer-flatten.h"                      // this module
+
+// smbase
+#include "smbase/exc.h"                          // smbase::xformatsb
+#include "smbase/xassert.h"                      // xassert, xfailure
+
+// libc
+#include <string.h>                              // memcpy
+
+using namespace smbase;
+
+
+BufferFlatten::BufferFlatten(unsigned char const *data, std::size_t size)
+  : Flatten(),
+    m_readCur(data),
+    m_readEnd(data + size),
+    m_writeBuffer(nullptr)
+{}
+
+
+BufferFlatten::BufferFlatten(std::vector<unsigned char> &buffer)
+  : Flatten(),
+    m_readCur(nullptr),
+    m_readEnd(nullptr),
+    m_writeBuffer(&buffer)
+{}
+
+
+BufferFlatten::~BufferFlatten()
+{}
+
+
+std::size_t BufferFlatten::remaining() const
+{
+  return m_readEnd - m_readCur;
+}
+
+
+bool BufferFlatten::reading() const
+{
+  return m_writeBuffer == nullptr;
+}
+
+
+void BufferFlatten::xferSimple(void *var, unsigned len)
+{
+  if (reading()) {
+    if (len > remaining()) {
+      xformatsb("Serialized data is truncated: needed " << len <<
+                " bytes but only " << remaining() << " remain.");
+    }
+    memcpy(var, m_readCur, len);
+    m_readCur += len;
+  }
+  else {
+    std::size_t oldSize = m_writeBuffer->size();
+    m_writeBuffer->resize(oldSize + len);
+    memcpy(m_writeBuffer->data() + oldSize, var, len);
+  }
+}
+
+
+void BufferFlatten::noteOwner(void *)
+{
+  xfailure("BufferFlatten does not support owner pointers.");
+}
+
+
+void BufferFlatten::xferSerf(void *&, bool)
+{
+  xfailure("BufferFlatten does not support serf pointers.");
+}
+
+
+// EOF
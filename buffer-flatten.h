@@ -0,0 +1,67 @@
+// buffer-flatten.h
+// `BufferFlatten`, a `Flatten` that reads from or writes to memory.
+
+// See license.txt for copyright and terms of use.
+
+// This module is used by both the editor and `editor-fs-server`, so it
+// must not depend on Qt.
+
+#ifndef EDITOR_BUFFER_FLATTEN_H
+#define EDITOR_BUFFER_FLATTEN_H
+
+// smbase
+#include "smbase/flatten.h"                      // Flatten
+#include "smbase/sm-macros.h"                    // NO_OBJECT_COPIES
+
+// libc++
+#include <cstddef>                               // std::size_t
+#include <vector>                                // std::vector
+
+
+// Serialize into, or deserialize out of, a contiguous memory buffer.
+//
+// Compared to `StreamFlatten` over a string stream, this avoids copying
+// the data into and out of the stream: a reader decodes directly from
+// the bytes that arrived on the wire, and a writer appends to a vector
+// that the caller can reuse across messages, so its capacity is only
+// allocated once.
+//
+// This does not support the owner/serf pointer mechanism; the VFS
+// messages do not use it.
+class BufferFlatten : public Flatten {
+  NO_OBJECT_COPIES(BufferFlatten);
+
+private:     // data
+  // When reading: the next byte to read, and one past the last byte.
+  // Both are null when writing.
+  unsigned char const *m_readCur;
+  unsigned char const *m_readEnd;
+
+  // When writing: the buffer to append to.  Not owned.  Null when
+  // reading.
+  std::vector<unsigned char> *m_writeBuffer;
+
+public:      // methods
+  // Read from the `size` bytes at `data`, which must remain valid for
+  // the lifetime of this object.
+  BufferFlatten(unsigned char const *data, std::size_t size);
+
+  // Write by appending to `buffer`.  Existing contents are left alone,
+  // which lets the caller reserve space for a header in front of the
+  // serialized data.
+  explicit BufferFlatten(std::vector<unsigned char> &buffer);
+
+  virtual ~BufferFlatten() override;
+
+  // When reading, the number of bytes not yet consumed.
+  std::size_t remaining() const;
+
+  // Flatten methods.
+  virtual bool reading() const override;
+  virtual void xferSimple(void *var, unsigned len) override;
+  virtual void noteOwner(void *ownerPtr) override;
+  virtual void xferSerf(void *&serfPtr, bool nullable=false) override;
+};
+
+
+#endif // EDITOR_BUFFER_FLATTEN_H
@@ -0,0 +1,297 @@
+// byte-search-test.cc
+// Tests for `byte-search` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "byte-search.h"               // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/nonport.h"            // getMilliseconds
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, DIAG
+#include "smbase/strutil.h"            // stringTolower
+#include "smbase/xassert.h"            // xassert
+
+#include <cctype>                      // std::toupper
+#include <cstdlib>                     // std::atoi
+#include <cstring>                     // std::strcmp, std::strstr, std::memcpy
+#include <iostream>                    // std::cout
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+using namespace smbase;
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Straightforward reference implementation.
+std::ptrdiff_t naiveFind(std::string const &hay, std::string const &needle,
+                         bool caseInsensitive)
+{
+  if (needle.size() > hay.size()) {
+    return -1;
+  }
+  for (std::size_t i=0; i + needle.size() <= hay.size(); i++) {
+    std::size_t j = 0;
+    for (; j < needle.size(); j++) {
+      char c = hay[i+j];
+      if (caseInsensitive && 'A' <= c && c <= 'Z') {
+        c += 'a' - 'A';
+      }
+      if (c != needle[j]) {
+        break;
+      }
+    }
+    if (j == needle.size()) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+// Check every available implementation against `naiveFind`.
+void checkAllImpls(std::string const &hay, std::string const &needle,
+                   bool caseInsensitive)
+{
+  std::ptrdiff_t expect = naiveFind(hay, needle, caseInsensitive);
+
+  for (int i=0; i < NUM_BYTE_SEARCH_IMPLS; i++) {
+    ByteSearchImpl impl = (ByteSearchImpl)i;
+    if (!byteSearchImplAvailable(impl)) {
+      continue;
+    }
+
+    // Copy the haystack into an exactly-sized heap block so that tools
+    // like ASan and Valgrind can catch reads past the end.
+    std::vector<char> hayCopy(hay.begin(), hay.end());
+
+    std::ptrdiff_t actual = findBytesWithImpl(impl,
+      hayCopy.data(), hayCopy.size(),
+      needle.data(), needle.size(), caseInsensitive);
+    if (actual != expect) {
+      DIAG("impl=" << toString(impl) <<
+           " hay=" << hay << " needle=" << needle <<
+           " ci=" << caseInsensitive);
+    }
+    EXPECT_EQ(actual, expect);
+  }
+}
+
+
+void testSimple()
+{
+  checkAllImpls("", "", false);
+  checkAllImpls("abc", "", false);
+  checkAllImpls("", "a", false);
+  checkAllImpls("abc", "a", false);
+  checkAllImpls("abc", "c", false);
+  checkAllImpls("abc", "abc", false);
+  checkAllImpls("abc", "abcd", false);
+  checkAllImpls("xxABCxx", "abc", false);
+  checkAllImpls("xxABCxx", "abc", true);
+  checkAllImpls("xxAbCxx", "abc", true);
+
+  // Letters adjacent to the folded range.
+  checkAllImpls("@[`{", "`{", true);
+  checkAllImpls("@[`{", "@[", true);
+
+  // NUL and high bytes are ordinary.
+  checkAllImpls(std::string("a\0b\xC3\xA9z", 6), std::string("\0b\xC3", 3),
+                false);
+  checkAllImpls("\xC3\x89\xC3\xA9", "\xC3\xA9", true);
+}
+
+
+// Exercise the vector loops and their tails with matches at every
+// position in haystacks of many lengths.
+void testPositions()
+{
+  char const *needles[] = { "q", "qz", "qrz", "quiz", "q_u_i_z_q_u_i_z_q_u" };
+  for (char const *n : needles) {
+    std::string needle(n);
+    for (int len=0; len < 80; len++) {
+      for (int pos=-1; pos + (int)needle.size() <= len; pos++) {
+        std::string hay(len, 'q');
+        if (pos >= 0) {
+          hay.replace(pos, needle.size(), needle);
+        }
+        checkAllImpls(hay, needle, false);
+
+        std::string upper(hay);
+        for (char &c : upper) {
+          c = std::toupper((unsigned char)c);
+        }
+        checkAllImpls(upper, needle, true);
+        checkAllImpls(upper, needle, false);
+      }
+    }
+  }
+}
+
+
+// Pseudo-random haystacks over a small alphabet so that partial matches
+// are frequent.
+void testRandom()
+{
+  unsigned state = 12345;
+  auto rand = [&state]() {
+    state = state * 1103515245 + 12345;
+    return (state >> 16) & 0x7FFF;
+  };
+
+  char const alphabet[] = "abAB\xC3\xA9";
+  for (int iter=0; iter < 2000; iter++) {
+    std::string hay;
+    int hayLen = rand() % 100;
+    for (int i=0; i < hayLen; i++) {
+      hay.push_back(alphabet[rand() % 6]);
+    }
+
+    std::string needle;
+    int needleLen = 1 + rand() % 5;
+    for (int i=0; i < needleLen; i++) {
+      needle.push_back(alphabet[rand() % 6]);
+    }
+
+    checkAllImpls(hay, needle, false);
+    checkAllImpls(hay, stringTolower(needle), true);
+  }
+}
+
+
+// ---------------------------- benchmark ------------------------------
+// Count the matches in `lines` the way `TextSearch` did before this
+// module existed: copy each line into a NUL-terminated buffer,
+// lowercase it if needed, then call `strstr` repeatedly.
+long countWithStrstr(std::vector<std::string> const &lines,
+                     std::string const &needle, bool caseInsensitive)
+{
+  long count = 0;
+  std::vector<char> buffer;
+  for (std::string const &line : lines) {
+    buffer.resize(line.size() + 1);
+    std::memcpy(buffer.data(), line.data(), line.size());
+    buffer[line.size()] = 0;
+
+    if (caseInsensitive) {
+      for (char &c : buffer) {
+        if ('A' <= c && c <= 'Z') {
+          c += 'a' - 'A';
+        }
+      }
+    }
+
+    std::size_t offset = 0;
+    while (offset + needle.size() <= line.size()) {
+      char const *p = std::strstr(buffer.data() + offset, needle.c_str());
+      if (!p) {
+        break;
+      }
+      count++;
+      offset = (p - buffer.data()) + needle.size() + 1;
+    }
+  }
+  return count;
+}
+
+
+// Count the matches by searching each line in place.
+long countWithImpl(ByteSearchImpl impl,
+                   std::vector<std::string> const &lines,
+                   std::string const &needle, bool caseInsensitive)
+{
+  long count = 0;
+  for (std::string const &line : lines) {
+    std::size_t offset = 0;
+    while (offset + needle.size() <= line.size()) {
+      std::ptrdiff_t i = findBytesWithImpl(impl,
+        line.data() + offset, line.size() - offset,
+        needle.data(), needle.size(), caseInsensitive);
+      if (i < 0) {
+        break;
+      }
+      count++;
+      offset += i + needle.size() + 1;
+    }
+  }
+  return count;
+}
+
+
+// Compare the search kernels on a synthetic document.  This is not
+// part of the normal test run; it is invoked as:
+//
+//   ./unit-tests.exe byte_search bench [<megabytes> [<needle>]]
+//
+void perfByteSearch(CmdlineArgsSpan args)
+{
+  int megabytes = args.size() >= 1? std::atoi(args[0]) : 300;
+  std::string needle = args.size() >= 2? args[1] : "needle";
+
+  // Source-code-like lines with an occasional hit.
+  std::vector<std::string> lines;
+  std::size_t totalBytes = 0;
+  for (long i=0; totalBytes < (std::size_t)megabytes * 1000000; i++) {
+    std::string line = "  int variable_" + std::to_string(i) +
+                       " = compute(Value, Other + 3);  // Needs work";
+    if (i % 97 == 0) {
+      line += " NEEDLE needle";
+    }
+    totalBytes += line.size() + 1;
+    lines.push_back(line);
+  }
+  std::cout << "lines=" << lines.size()
+            << " bytes=" << totalBytes
+            << " best=" << toString(bestByteSearchImpl())
+            << std::endl;
+
+  for (bool ci : {false, true}) {
+    std::string n = ci? stringTolower(needle) : needle;
+
+    long start = getMilliseconds();
+    long expect = countWithStrstr(lines, n, ci);
+    long baselineMS = getMilliseconds() - start;
+    std::cout << "  ci=" << ci << " strstr: matches=" << expect
+              << " ms=" << baselineMS << std::endl;
+
+    for (int i=0; i < NUM_BYTE_SEARCH_IMPLS; i++) {
+      ByteSearchImpl impl = (ByteSearchImpl)i;
+      if (!byteSearchImplAvailable(impl)) {
+        continue;
+      }
+
+      start = getMilliseconds();
+      long count = countWithImpl(impl, lines, n, ci);
+      long ms = getMilliseconds() - start;
+      xassert(count == expect);
+
+      std::cout << "  ci=" << ci << " " << toString(impl)
+                << ": ms=" << ms
+                << " MBPerSec=" << (totalBytes / ((ms>0? ms : 1) / 1000.0) / 1.0e6)
+                << std::endl;
+    }
+  }
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_byte_search(CmdlineArgsSpan args)
+{
+  if (!args.empty() && 0==std::strcmp(args[0], "bench")) {
+    perfByteSearch(args.subspan(1));
+    return;
+  }
+
+  DIAG("best byte search impl: " << toString(bestByteSearchImpl()));
+  testSimple();
+  testPositions();
+  testRandom();
+}
+
+
+// EOF
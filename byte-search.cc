@@ -0,0 +1,370 @@
+// byte-search.cc
+// Code for `byte-search` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "byte-search.h"               // this module
+
+#include "smbase/xassert.h"            // xassertPrecondition, xfailure
+
+#include <cstring>                     // std::memchr, std::memcmp
+
+// The SIMD kernels rely on GCC/Clang vector intrinsics and the
+// `target` attribute, so they are only built with those compilers.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#  define BYTE_SEARCH_X86 1
+#  include <immintrin.h>               // _mm_*, _mm256_*
+#else
+#  define BYTE_SEARCH_X86 0
+#endif
+
+#if BYTE_SEARCH_X86 && defined(__SSE2__)
+#  define BYTE_SEARCH_SSE2 1
+#else
+#  define BYTE_SEARCH_SSE2 0
+#endif
+
+#define BYTE_SEARCH_AVX2 BYTE_SEARCH_X86
+
+
+// ---------------------------- ByteSearchImpl ---------------------------
+char const *toString(ByteSearchImpl impl)
+{
+  switch (impl) {
+    case BSI_SCALAR: return "scalar";
+    case BSI_SSE2:   return "SSE2";
+    case BSI_AVX2:   return "AVX2";
+    default:         return "invalid";
+  }
+}
+
+
+bool byteSearchImplAvailable(ByteSearchImpl impl)
+{
+  switch (impl) {
+    case BSI_SCALAR:
+      return true;
+
+    case BSI_SSE2:
+      return BYTE_SEARCH_SSE2;
+
+    case BSI_AVX2:
+      #if BYTE_SEARCH_AVX2
+        return __builtin_cpu_supports("avx2");
+      #else
+        return false;
+      #endif
+
+    default:
+      return false;
+  }
+}
+
+
+ByteSearchImpl bestByteSearchImpl()
+{
+  // Probing the CPU is cheap but not free, so do it once.
+  static ByteSearchImpl const best =
+    byteSearchImplAvailable(BSI_AVX2)? BSI_AVX2 :
+    byteSearchImplAvailable(BSI_SSE2)? BSI_SSE2 :
+                                       BSI_SCALAR;
+  return best;
+}
+
+
+// ------------------------------ scalar ---------------------------------
+// Map 'A'-'Z' to 'a'-'z', leaving all other bytes alone.
+static inline char foldByte(char c)
+{
+  return ('A' <= c && c <= 'Z')? (char)(c + ('a' - 'A')) : c;
+}
+
+
+// True if the `len` bytes at `hay` match those at `needle`.  The
+// haystack bytes are case-folded first if `caseInsensitive`.
+static inline bool bytesMatch(char const *hay, char const *needle,
+                              std::size_t len, bool caseInsensitive)
+{
+  if (!caseInsensitive) {
+    return std::memcmp(hay, needle, len) == 0;
+  }
+
+  for (std::size_t i=0; i < len; i++) {
+    if (foldByte(hay[i]) != needle[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// Check candidate positions in [start, hayLen-needleLen] one at a
+// time.  This is used on its own, and by the SIMD kernels for
+// haystacks that are too short for a full vector.
+static std::ptrdiff_t scalarFindFrom(
+  std::size_t start,
+  char const *hay, std::size_t hayLen,
+  char const *needle, std::size_t needleLen,
+  bool caseInsensitive)
+{
+  if (hayLen < needleLen) {
+    return -1;
+  }
+  std::size_t const lastStart = hayLen - needleLen;
+
+  if (!caseInsensitive) {
+    // `memchr` is already heavily optimized by the C library, so let it
+    // find candidates for the first byte.
+    std::size_t i = start;
+    while (i <= lastStart) {
+      void const *p = std::memchr(hay+i, needle[0], lastStart+1 - i);
+      if (!p) {
+        return -1;
+      }
+      i = (char const *)p - hay;
+      if (std::memcmp(hay+i+1, needle+1, needleLen-1) == 0) {
+        return i;
+      }
+      i++;
+    }
+    return -1;
+  }
+
+  for (std::size_t i = start; i <= lastStart; i++) {
+    if (foldByte(hay[i]) == needle[0] &&
+        bytesMatch(hay+i+1, needle+1, needleLen-1, true)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+// Given `mask`, a bit set of the candidate positions `i + b` where the
+// first and last needle bytes match, return the first candidate where
+// the middle bytes match too, or -1 if none does.
+static inline std::ptrdiff_t verifyCandidates(
+  unsigned mask, std::size_t i,
+  char const *hay, char const *needle, std::size_t needleLen,
+  bool caseInsensitive)
+{
+  while (mask) {
+    std::size_t pos = i + __builtin_ctz(mask);
+    if (needleLen <= 2 ||
+        bytesMatch(hay+pos+1, needle+1, needleLen-2, caseInsensitive)) {
+      return pos;
+    }
+    mask &= mask - 1;
+  }
+  return -1;
+}
+
+
+// The SIMD kernels below each examine `W` candidate start positions
+// [i, i+W) at once.  The load for the last needle byte of the final
+// candidate reads up to `hay[i+k-1+W-1]`, so a block at `i` is only in
+// bounds if `i+k-1+W <= hayLen`.  After the main loop, the remaining
+// candidates are covered by one more block that ends exactly at the
+// end of the haystack, overlapping the previous one, with the bits for
+// the already-rejected positions masked off.  That way the slow scalar
+// code only runs on haystacks shorter than one block.
+
+
+// ------------------------------- SSE2 ----------------------------------
+#if BYTE_SEARCH_SSE2
+
+// Lowercase the ASCII letters in `v`.  Adding 0x80-'A' moves 'A'-'Z'
+// to the bottom 26 values of the signed byte range, where a single
+// signed comparison can identify them.
+static inline __m128i foldSSE2(__m128i v)
+{
+  __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A')));
+  __m128i isUpper = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + 26)));
+  return _mm_or_si128(v, _mm_and_si128(isUpper, _mm_set1_epi8(0x20)));
+}
+
+
+// Bit set of positions in [i, i+16) where the first and last bytes of
+// a `k`-byte needle match.
+static inline unsigned sse2CandidateMask(
+  char const *hay, std::size_t i, std::size_t k,
+  __m128i first, __m128i last, bool caseInsensitive)
+{
+  __m128i blockFirst = _mm_loadu_si128((__m128i const *)(hay + i));
+  __m128i blockLast = _mm_loadu_si128((__m128i const *)(hay + i + k-1));
+  if (caseInsensitive) {
+    blockFirst = foldSSE2(blockFirst);
+    blockLast = foldSSE2(blockLast);
+  }
+
+  return (unsigned)_mm_movemask_epi8(_mm_and_si128(
+    _mm_cmpeq_epi8(blockFirst, first),
+    _mm_cmpeq_epi8(blockLast, last)));
+}
+
+
+static std::ptrdiff_t sse2Find(
+  char const *hay, std::size_t hayLen,
+  char const *needle, std::size_t needleLen,
+  bool caseInsensitive)
+{
+  std::size_t const k = needleLen;
+  if (hayLen < k-1 + 16) {
+    return scalarFindFrom(0, hay, hayLen, needle, needleLen,
+                          caseInsensitive);
+  }
+
+  __m128i const first = _mm_set1_epi8(needle[0]);
+  __m128i const last = _mm_set1_epi8(needle[k-1]);
+
+  std::size_t i = 0;
+  for (; i + k-1 + 16 <= hayLen; i += 16) {
+    unsigned mask =
+      sse2CandidateMask(hay, i, k, first, last, caseInsensitive);
+    std::ptrdiff_t pos =
+      verifyCandidates(mask, i, hay, needle, k, caseInsensitive);
+    if (pos >= 0) {
+      return pos;
+    }
+  }
+
+  if (i + k <= hayLen) {
+    std::size_t j = hayLen - (k-1) - 16;
+    unsigned mask =
+      sse2CandidateMask(hay, j, k, first, last, caseInsensitive);
+    mask &= ~0u << (i - j);
+    return verifyCandidates(mask, j, hay, needle, k, caseInsensitive);
+  }
+
+  return -1;
+}
+
+#endif // BYTE_SEARCH_SSE2
+
+
+// ------------------------------- AVX2 ----------------------------------
+#if BYTE_SEARCH_AVX2
+
+// Same as `foldSSE2`, 32 bytes at a time.
+__attribute__((target("avx2")))
+static inline __m256i foldAVX2(__m256i v)
+{
+  // AVX2 only has a signed "greater than" compare, so swap operands.
+  __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'A')));
+  __m256i isUpper = _mm256_cmpgt_epi8(
+    _mm256_set1_epi8((char)(-128 + 26)), shifted);
+  return _mm256_or_si256(v, _mm256_and_si256(isUpper, _mm256_set1_epi8(0x20)));
+}
+
+
+// Same as `sse2CandidateMask`, for [i, i+32).
+__attribute__((target("avx2")))
+static inline unsigned avx2CandidateMask(
+  char const *hay, std::size_t i, std::size_t k,
+  __m256i first, __m256i last, bool caseInsensitive)
+{
+  __m256i blockFirst = _mm256_loadu_si256((__m256i const *)(hay + i));
+  __m256i blockLast = _mm256_loadu_si256((__m256i const *)(hay + i + k-1));
+  if (caseInsensitive) {
+    blockFirst = foldAVX2(blockFirst);
+    blockLast = foldAVX2(blockLast);
+  }
+
+  return (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+    _mm256_cmpeq_epi8(blockFirst, first),
+    _mm256_cmpeq_epi8(blockLast, last)));
+}
+
+
+__attribute__((target("avx2")))
+static std::ptrdiff_t avx2Find(
+  char const *hay, std::size_t hayLen,
+  char const *needle, std::size_t needleLen,
+  bool caseInsensitive)
+{
+  std::size_t const k = needleLen;
+  if (hayLen < k-1 + 32) {
+    // Too short for even one block; let the narrower kernel try.
+    #if BYTE_SEARCH_SSE2
+      return sse2Find(hay, hayLen, needle, needleLen, caseInsensitive);
+    #else
+      return scalarFindFrom(0, hay, hayLen, needle, needleLen,
+                            caseInsensitive);
+    #endif
+  }
+
+  __m256i const first = _mm256_set1_epi8(needle[0]);
+  __m256i const last = _mm256_set1_epi8(needle[k-1]);
+
+  std::size_t i = 0;
+  for (; i + k-1 + 32 <= hayLen; i += 32) {
+    unsigned mask =
+      avx2CandidateMask(hay, i, k, first, last, caseInsensitive);
+    std::ptrdiff_t pos =
+      verifyCandidates(mask, i, hay, needle, k, caseInsensitive);
+    if (pos >= 0) {
+      return pos;
+    }
+  }
+
+  if (i + k <= hayLen) {
+    std::size_t j = hayLen - (k-1) - 32;
+    unsigned mask =
+      avx2CandidateMask(hay, j, k, first, last, caseInsensitive);
+    mask &= ~0u << (i - j);
+    return verifyCandidates(mask, j, hay, needle, k, caseInsensitive);
+  }
+
+  return -1;
+}
+
+#endif // BYTE_SEARCH_AVX2
+
+
+// ----------------------------- findBytes -------------------------------
+std::ptrdiff_t findBytesWithImpl(
+  ByteSearchImpl impl,
+  char const *hay, std::size_t hayLen,
+  char const *needle, std::size_t needleLen,
+  bool caseInsensitive)
+{
+  if (needleLen == 0) {
+    return 0;
+  }
+  if (hayLen < needleLen) {
+    return -1;
+  }
+
+  switch (impl) {
+    case BSI_SCALAR:
+      return scalarFindFrom(0, hay, hayLen, needle, needleLen,
+                            caseInsensitive);
+
+    #if BYTE_SEARCH_SSE2
+      case BSI_SSE2:
+        return sse2Find(hay, hayLen, needle, needleLen, caseInsensitive);
+    #endif
+
+    #if BYTE_SEARCH_AVX2
+      case BSI_AVX2:
+        xassertPrecondition(byteSearchImplAvailable(BSI_AVX2));
+        return avx2Find(hay, hayLen, needle, needleLen, caseInsensitive);
+    #endif
+
+    default:
+      xfailure("unavailable ByteSearchImpl");
+  }
+}
+
+
+std::ptrdiff_t findBytes(
+  char const *hay, std::size_t hayLen,
+  char const *needle, std::size_t needleLen,
+  bool caseInsensitive)
+{
+  return findBytesWithImpl(bestByteSearchImpl(),
+    hay, hayLen, needle, needleLen, caseInsensitive);
+}
+
+
+// EOF
@@ -0,0 +1,69 @@
+// byte-search.h
+// `findBytes`, substring search over raw byte ranges.
+
+// See license.txt for copyright and terms of use.
+
+// This module exists so that `TextSearch` can scan document lines in
+// place, without first copying each line into a NUL-terminated buffer
+// for `strstr`, and without lowercasing a copy of the line in order to
+// do a case-insensitive search.
+//
+// On x86, the search uses SIMD instructions to test 16 (SSE2) or 32
+// (AVX2) candidate positions at once by comparing the first and last
+// bytes of the needle, only examining the middle bytes at positions
+// where both of those match.  Case folding of the haystack is done in
+// registers.  AVX2 is chosen at run time if the CPU supports it.
+
+#ifndef EDITOR_BYTE_SEARCH_H
+#define EDITOR_BYTE_SEARCH_H
+
+#include <cstddef>                     // std::size_t, std::ptrdiff_t
+
+
+// Available implementations of the search kernel.
+enum ByteSearchImpl {
+  // Portable code, available everywhere.
+  BSI_SCALAR,
+
+  // 16 bytes at a time.  Available when compiled for x86 with SSE2.
+  BSI_SSE2,
+
+  // 32 bytes at a time.  Requires x86 and CPU support at run time.
+  BSI_AVX2,
+
+  NUM_BYTE_SEARCH_IMPLS
+};
+
+// Return a short name like "SSE2".
+char const *toString(ByteSearchImpl impl);
+
+// True if `impl` can be used in this build on this machine.
+bool byteSearchImplAvailable(ByteSearchImpl impl);
+
+// The fastest available implementation.
+ByteSearchImpl bestByteSearchImpl();
+
+
+// Return the offset within `hay` of the first occurrence of `needle`,
+// or -1 if there is none.  Neither array needs to be NUL-terminated,
+// and both can contain NUL bytes.  An empty needle matches at offset 0.
+//
+// If `caseInsensitive`, ASCII letters in `hay` are treated as if they
+// were lowercase.  In that case, `needle` must already be lowercase
+// (otherwise an uppercase letter in it will never match anything).
+// Non-ASCII bytes are compared exactly.
+std::ptrdiff_t findBytes(
+  char const *hay, std::size_t hayLen,
+  char const *needle, std::size_t needleLen,
+  bool caseInsensitive);
+
+// Same, but using a specific implementation, which must be available.
+// This is for testing and benchmarking.
+std::ptrdiff_t findBytesWithImpl(
+  ByteSearchImpl impl,
+  char const *hay, std::size_t hayLen,
+  char const *needle, std::size_t needleLen,
+  bool caseInsensitive);
+
+
+#endif // EDITOR_BYTE_SEARCH_H
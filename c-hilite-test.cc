@@ -5,6 +5,14 @@
 
 #include "c_hilite.h"                  // module to test
 #include "comment.h"                   // another module to test
+#include "textcategory.h"              // LineCategoryAOAs
+
+#include "smbase/sm-test.h"            // EXPECT_EQ
+#include "smbase/xassert.h"            // xassert
+
+// libc++
+#include <cstdlib>                     // std::atoi
+#include <cstring>                     // std::strcmp
 
 
 LexHighlighter * /*owner*/ makeC_Highlighter(TextDocumentCore const &buf)
@@ -18,11 +26,170 @@ LexHighlighter * /*owner*/ makeCommentHighlighter(TextDocumentCore const &buf)
 }
 
 
+// Highlight `line` with `hi`, limiting synchronous lexing to
+// `lexLimit` lines.  Check that the result is provisional iff
+// `expectExact` is false, and return it rendered as a string.
+static string limitedHighlight(C_Highlighter &hi,
+                               TextDocumentAndEditor &tde,
+                               int line, int lexLimit, bool expectExact)
+{
+  LineCategoryAOAs categories(TC_NORMAL);
+  bool exact = hi.highlightTDEWithinLimit(&tde, LineIndex(line),
+                                          LineCount(lexLimit), categories);
+  EXPECT_EQ(exact, expectExact);
+  return categories.asUnaryString();
+}
+
+
+// Exact highlighting of `line`, from a fresh highlighter.
+static string batchHighlight(TextDocumentAndEditor &tde, int line)
+{
+  C_Highlighter batch(tde.getDocument()->getCore());
+  LineCategoryAOAs categories(TC_NORMAL);
+  batch.highlightTDE(&tde, LineIndex(line), categories);
+  return categories.asUnaryString();
+}
+
+
+// Exercise provisional highlighting and background lexing.
+static void testBackgroundHighlight()
+{
+  TextDocumentAndEditor tde;
+  C_Highlighter hi(tde.getDocument()->getCore());
+
+  string text = "/""* start of a comment\n";
+  for (int i=0; i < 1000; ++i) {
+    text += "int x = 5;\n";
+  }
+  tde.writableDoc().replaceWholeFileString(text);
+
+  // Far from the top, the result is a guess that does not know about
+  // the comment.
+  string provisional = limitedHighlight(hi, tde, 500, 100, false);
+  xassert(provisional != batchHighlight(tde, 500));
+  xassert(!hi.lineIsReady(LineIndex(500)));
+
+  // Near the top, it is exact.
+  EXPECT_EQ(limitedHighlight(hi, tde, 50, 100, true),
+            batchHighlight(tde, 50));
+  xassert(hi.lineIsReady(LineIndex(50)));
+
+  // Background work eventually makes every line ready.
+  int iters = 0;
+  while (hi.hasBackgroundWork()) {
+    hi.highlightInBackground(1 /*ms*/);
+    ++iters;
+  }
+  xassert(iters > 0);
+  xassert(hi.lineIsReady(LineIndex(1000)));
+  EXPECT_EQ(limitedHighlight(hi, tde, 500, 0, true),
+            batchHighlight(tde, 500));
+
+  // Commenting out the comment start invalidates everything below.
+  tde.setCursor(TextLCoord(LineIndex(0), ColumnIndex(0)));
+  tde.insertNulTermText("// ");
+  limitedHighlight(hi, tde, 500, 100, false);
+  while (hi.hasBackgroundWork()) {
+    hi.highlightInBackground(1 /*ms*/);
+  }
+  EXPECT_EQ(limitedHighlight(hi, tde, 500, 0, true),
+            batchHighlight(tde, 500));
+}
+
+
+// Exercise convergence of separate changed regions.
+static void testConvergence()
+{
+  TextDocumentAndEditor tde;
+  C_Highlighter hi(tde.getDocument()->getCore());
+
+  string text;
+  for (int i=0; i < 1000; ++i) {
+    text += "int x = 5;\n";
+  }
+  tde.writableDoc().replaceWholeFileString(text);
+  limitedHighlight(hi, tde, 1000, 2000, true);
+  xassert(!hi.hasBackgroundWork());
+
+  // Edit near the bottom, then near the top.  Neither changes the
+  // state at the end of its line, so only those lines get re-lexed,
+  // rather than everything from the top edit down.
+  tde.setCursor(TextLCoord(LineIndex(900), ColumnIndex(0)));
+  tde.insertNulTermText("y");
+  tde.setCursor(TextLCoord(LineIndex(100), ColumnIndex(0)));
+  tde.insertNulTermText("z");
+
+  long before = hi.getLinesLexed();
+  EXPECT_EQ(limitedHighlight(hi, tde, 999, 1000, true),
+            batchHighlight(tde, 999));
+  EXPECT_EQ(hi.getLinesLexed() - before, 3);
+  EXPECT_EQ(limitedHighlight(hi, tde, 900, 0, true),
+            batchHighlight(tde, 900));
+
+  // Open a comment at the top and look a short way down, leaving the
+  // effect of that change partly propagated.
+  tde.setCursor(TextLCoord(LineIndex(0), ColumnIndex(0)));
+  tde.insertNulTermText("/""*");
+  EXPECT_EQ(limitedHighlight(hi, tde, 10, 100, true),
+            batchHighlight(tde, 10));
+
+  // Now close it.  Re-lexing stops where the lines regain their
+  // original states, instead of going to the end of the file.
+  tde.setCursor(TextLCoord(LineIndex(0), ColumnIndex(2)));
+  tde.insertNulTermText("*""/");
+  before = hi.getLinesLexed();
+  EXPECT_EQ(limitedHighlight(hi, tde, 999, 1000, true),
+            batchHighlight(tde, 999));
+  xassert(hi.getLinesLexed() - before < 20);
+  EXPECT_EQ(limitedHighlight(hi, tde, 500, 0, true),
+            batchHighlight(tde, 500));
+
+  // Splitting and joining lines in two places.
+  tde.setCursor(TextLCoord(LineIndex(700), ColumnIndex(3)));
+  tde.insertNewline();
+  tde.setCursor(TextLCoord(LineIndex(200), ColumnIndex(3)));
+  tde.insertNewline();
+  tde.setCursor(TextLCoord(LineIndex(200), ColumnIndex(3)));
+  tde.deleteTextBytes(ByteCount(1));
+  before = hi.getLinesLexed();
+  EXPECT_EQ(limitedHighlight(hi, tde, 1000, 1000, true),
+            batchHighlight(tde, 1000));
+  xassert(hi.getLinesLexed() - before < 10);
+  EXPECT_EQ(limitedHighlight(hi, tde, 701, 0, true),
+            batchHighlight(tde, 701));
+}
+
+
+// Time keystrokes in a large C++ file.  This is not part of the normal
+// test run; it is invoked as:
+//
+//   ./unit-tests.exe c_hilite keystroke [<file> [<numLines> [<lexLimit>]]]
+//
+static void perfKeystrokes(CmdlineArgsSpan args)
+{
+  char const *fname =
+    args.size() >= 1? args[0] : "test/highlight/c-fesvr-syscall.cc";
+  int numLines = args.size() >= 2? std::atoi(args[1]) : 200000;
+  int lexLimit = args.size() >= 3? std::atoi(args[2]) : 2000;
+
+  TextDocumentAndEditor tde;
+  C_Highlighter hi(tde.getDocument()->getCore());
+  perfHighlighterKeystrokes(hi, tde, fname, numLines, lexLimit, "/""*");
+}
+
+
 // Called from unit-tests.cc.
 void test_c_hilite(CmdlineArgsSpan args)
 {
+  if (!args.empty() && 0==std::strcmp(args[0], "keystroke")) {
+    perfKeystrokes(args.subspan(1));
+    return;
+  }
+
   exerciseHighlighter(&makeC_Highlighter);
   exerciseHighlighter(&makeCommentHighlighter);
+  testBackgroundHighlight();
+  testConvergence();
 
   TextDocumentAndEditor tde;
   C_Highlighter hi(tde.getDocument()->getCore());
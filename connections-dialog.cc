@@ -6,6 +6,7 @@
 // editor
 #include "pixmaps.h"                   // g_editorPixmaps
 #include "vfs-connections.h"           // VFS_Connections
+#include "vfs-query.h"                 // VFS_TransferStats
 
 // smqtutil
 #include "smqtutil/qtguiutil.h"        // keysString
@@ -15,6 +16,7 @@
 // smbase
 #include "smbase/container-util.h"     // smbase::contains
 #include "smbase/exc.h"                // GENERIC_CATCH_BEGIN/END
+#include "smbase/sm-macros.h"          // TABLESIZE
 #include "smbase/sm-trace.h"           // INIT_TRACE, etc.
 
 // qt
@@ -24,14 +26,39 @@
 #include <QPushButton>
 #include <QVBoxLayout>
 
+// libc++
+#include <iomanip>                     // std::setprecision
+#include <sstream>                     // std::ostringstream
+
 using namespace smbase;
 
 
 INIT_TRACE("connections-dialog");
 
 
+// Render `n` bytes approximately, like "12.3 KiB".
+static string approxBytesString(double n)
+{
+  static char const * const units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+  int u = 0;
+  while (n >= 1024.0 && u < (int)TABLESIZE(units)-1) {
+    n /= 1024.0;
+    ++u;
+  }
+
+  std::ostringstream oss;
+  if (u == 0) {
+    oss << (long long)n << " B";
+  }
+  else {
+    oss << std::fixed << std::setprecision(1) << n << " " << units[u];
+  }
+  return oss.str();
+}
+
+
 // Initial dialog dimensions in pixels.
-static int const INIT_DIALOG_WIDTH = 500;
+static int const INIT_DIALOG_WIDTH = 800;
 static int const INIT_DIALOG_HEIGHT = 400;
 
 
@@ -66,9 +93,14 @@ ConnectionsDialog::ConnectionsDialog(VFS_Connections *vfsConnections)
   m_tableWidget->setColumnsFillWidth(true);
 
   std::vector<SMTableWidget::ColumnInfo> columnInfo = {
-    //name        init  min           max  prio
-    { "Host name", 350, 100, std::nullopt, 1 },
-    { "Status",    100,  50, std::nullopt, 0 },
+    //name         init  min           max  prio
+    { "Host name",  250, 100, std::nullopt, 1 },
+    { "Status",     100,  50, std::nullopt, 0 },
+    { "Codec",       90,  50, std::nullopt, 0 },
+    { "Sent",        80,  50, std::nullopt, 0 },
+    { "Received",    80,  50, std::nullopt, 0 },
+    { "Ratio",       60,  40, std::nullopt, 0 },
+    { "Throughput",  90,  50, std::nullopt, 0 },
   };
   m_tableWidget->setColumnInfo(columnInfo);
 
@@ -180,6 +212,29 @@ void ConnectionsDialog::repopulateTable()
       m_tableWidget->setItem(r, c++, item /*transfer*/);
     }
 
+    // Traffic.  The byte counts are what actually crossed the wire,
+    // and the ratio compares them to the uncompressed sizes.
+    {
+      VFS_TransferStats stats = m_vfsConnections->transferStats(hostName);
+
+      std::ostringstream ratio;
+      ratio << std::fixed << std::setprecision(2)
+            << stats.compressionRatio();
+
+      string cells[] = {
+        toString(m_vfsConnections->connectionCodec(hostName)),
+        approxBytesString(stats.m_wireBytesSent),
+        approxBytesString(stats.m_wireBytesReceived),
+        ratio.str(),
+        approxBytesString(stats.throughputBytesPerSecond()) + "/s",
+      };
+      for (string const &cell : cells) {
+        QTableWidgetItem *item = new QTableWidgetItem(toQString(cell));
+        item->setFlags(itemFlags);
+        m_tableWidget->setItem(r, c++, item /*transfer*/);
+      }
+    }
+
     // Apparently I have to set every row's height manually.
     m_tableWidget->setNaturalTextRowHeight(r);
   }
@@ -0,0 +1,136 @@
+// content-digest-test.cc
+// Tests for `content-digest` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "content-digest.h"            // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, EXPECT_TRUE
+#include "smbase/xassert.h"            // xassert
+
+#include <algorithm>                   // std::min
+#include <cstdint>                     // std::uint64_t
+#include <set>                         // std::set
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+std::uint64_t lineHash(std::string const &s)
+{
+  return lineContentHash(s.data(), s.size());
+}
+
+
+std::uint64_t textDigest(std::string const &s)
+{
+  return textContentDigest(s.data(), s.size());
+}
+
+
+// Compute the digest of `lines` from its definition.
+std::uint64_t digestOfLines(std::vector<std::string> const &lines)
+{
+  std::uint64_t sum = 0;
+  for (std::size_t i=0; i < lines.size(); ++i) {
+    sum += lineHash(lines[i]) * digestPower(i);
+  }
+  return finishContentDigest(sum, lines.size());
+}
+
+
+void testLineHash()
+{
+  // Hashes of distinct short strings, including ones that differ only
+  // in length or in a byte past the first eight, are distinct.
+  std::vector<std::string> strings{
+    "", "a", "b", "ab", "ba", std::string(1, '\0'), std::string(2, '\0'),
+    "12345678", "123456789", "123456780", "abcdefghijklmnopq",
+    "abcdefghijklmnopr",
+  };
+  std::set<std::uint64_t> hashes;
+  for (std::string const &s : strings) {
+    std::uint64_t h = lineHash(s);
+    EXPECT_TRUE(h != 0);
+    hashes.insert(h);
+  }
+  EXPECT_EQ(hashes.size(), strings.size());
+
+  // The hash depends only on the contents.
+  EXPECT_EQ(lineHash(std::string("xyz")), lineHash(std::string("wxyz").substr(1)));
+}
+
+
+void testPower()
+{
+  EXPECT_EQ(digestPower(0), (std::uint64_t)1);
+
+  std::uint64_t const base = digestPower(1);
+  std::uint64_t p = 1;
+  for (std::size_t i=0; i < 100; ++i) {
+    EXPECT_EQ(digestPower(i), p);
+    p *= base;
+  }
+}
+
+
+void testTextDigest()
+{
+  EXPECT_EQ(textDigest(""), digestOfLines({""}));
+  EXPECT_EQ(textDigest("a"), digestOfLines({"a"}));
+  EXPECT_EQ(textDigest("\n"), digestOfLines({"", ""}));
+  EXPECT_EQ(textDigest("one\ntwo\n"), digestOfLines({"one", "two", ""}));
+
+  // Line order, line count, and trailing newlines all matter.
+  std::vector<std::string> texts{
+    "", "\n", "\n\n", "a", "a\n", "a\nb", "b\na", "ab", "a\n\nb",
+  };
+  std::set<std::uint64_t> digests;
+  for (std::string const &t : texts) {
+    digests.insert(textDigest(t));
+  }
+  EXPECT_EQ(digests.size(), texts.size());
+}
+
+
+// Feeding the text in pieces, split anywhere, gives the same digest.
+void testDigester()
+{
+  std::string const text = "one\ntwo\n\nthree and more\nfour";
+  for (std::size_t pieceSize=1; pieceSize <= text.size(); ++pieceSize) {
+    TextContentDigester digester;
+    for (std::size_t i=0; i < text.size(); i += pieceSize) {
+      digester.add(text.data() + i,
+                   std::min(pieceSize, text.size() - i));
+    }
+    EXPECT_EQ(digester.digest(), textDigest(text));
+  }
+
+  // Empty pieces change nothing.
+  TextContentDigester digester;
+  digester.add("a\n", 2);
+  digester.add("", 0);
+  digester.add("b", 1);
+  EXPECT_EQ(digester.digest(), textDigest("a\nb"));
+  EXPECT_EQ(TextContentDigester().digest(), textDigest(""));
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_content_digest(CmdlineArgsSpan args)
+{
+  testLineHash();
+  testPower();
+  testTextDigest();
+  testDigester();
+}
+
+
+// EOF
@@ -0,0 +1,151 @@
+// content-digest.cc
+// Code for `content-digest` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "content-digest.h"            // this module
+
+#include <cstring>                     // std::memchr
+
+
+// Multiplier B for the weighted sum of line hashes.  It is odd, so
+// every power of it is invertible modulo 2^64.
+static std::uint64_t const DIGEST_BASE = 0x100000001b3ULL;
+
+// Multipliers used while hashing the bytes of a line.
+static std::uint64_t const HASH_K1 = 0x9e3779b97f4a7c15ULL;
+static std::uint64_t const HASH_K2 = 0xc2b2ae3d27d4eb4fULL;
+
+
+// Final mixing function of "splitmix64", which is a bijection that
+// spreads every input bit over the output.
+static std::uint64_t mix64(std::uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+
+static std::uint64_t rotateLeft(std::uint64_t x, int n)
+{
+  return (x << n) | (x >> (64-n));
+}
+
+
+std::uint64_t lineContentHash(char const *bytes, std::size_t len)
+{
+  unsigned char const *p = reinterpret_cast<unsigned char const *>(bytes);
+  std::uint64_t h = mix64(len ^ HASH_K2);
+
+  // Take eight bytes at a time, assembled in little-endian order
+  // regardless of the host's.
+  while (len >= 8) {
+    std::uint64_t w = 0;
+    for (int i=0; i < 8; ++i) {
+      w |= static_cast<std::uint64_t>(p[i]) << (8*i);
+    }
+    h = rotateLeft(h ^ (w * HASH_K1), 29) * HASH_K2;
+    p += 8;
+    len -= 8;
+  }
+
+  // Remaining bytes.
+  if (len > 0) {
+    std::uint64_t w = 0;
+    for (std::size_t i=0; i < len; ++i) {
+      w |= static_cast<std::uint64_t>(p[i]) << (8*i);
+    }
+    h = rotateLeft(h ^ (w * HASH_K1), 29) * HASH_K2;
+  }
+
+  h = mix64(h);
+  return h == 0? 1 : h;
+}
+
+
+std::uint64_t digestPower(std::size_t i)
+{
+  std::uint64_t ret = 1;
+  std::uint64_t base = DIGEST_BASE;
+  while (i > 0) {
+    if (i & 1) {
+      ret *= base;
+    }
+    base *= base;
+    i >>= 1;
+  }
+  return ret;
+}
+
+
+std::uint64_t finishContentDigest(std::uint64_t sum, std::size_t numLines)
+{
+  return mix64(sum ^ mix64(numLines));
+}
+
+
+std::uint64_t textContentDigest(char const *data, std::size_t size)
+{
+  TextContentDigester digester;
+  digester.add(data, size);
+  return digester.digest();
+}
+
+
+TextContentDigester::TextContentDigester()
+  : m_partialLine(),
+    m_sum(0),
+    m_power(1),
+    m_numLines(0)
+{}
+
+
+void TextContentDigester::addLine(char const *bytes, std::size_t len)
+{
+  m_sum += lineContentHash(bytes, len) * m_power;
+  m_power *= DIGEST_BASE;
+  ++m_numLines;
+}
+
+
+void TextContentDigester::add(char const *data, std::size_t size)
+{
+  char const *p = data;
+  char const *end = data + size;
+
+  while (p < end) {
+    char const *nl = static_cast<char const *>(
+      std::memchr(p, '\n', end-p));
+    if (!nl) {
+      // The line continues in the next piece.
+      m_partialLine.append(p, end-p);
+      return;
+    }
+
+    if (m_partialLine.empty()) {
+      addLine(p, nl-p);
+    }
+    else {
+      m_partialLine.append(p, nl-p);
+      addLine(m_partialLine.data(), m_partialLine.size());
+      m_partialLine.clear();
+    }
+    p = nl+1;
+  }
+}
+
+
+std::uint64_t TextContentDigester::digest() const
+{
+  std::uint64_t const sum =
+    m_sum + lineContentHash(m_partialLine.data(), m_partialLine.size()) *
+            m_power;
+  return finishContentDigest(sum, m_numLines + 1);
+}
+
+
+// EOF
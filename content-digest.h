@@ -0,0 +1,90 @@
+// content-digest.h
+// `textContentDigest`, a 64-bit digest of text built from line hashes.
+
+// See license.txt for copyright and terms of use.
+
+// This module exists so that two copies of a text, such as a document
+// and the file it was loaded from, or a document and the copy last
+// sent to an LSP server, can be compared by comparing digests, and so
+// that a document can maintain its digest incrementally as it is
+// edited.
+//
+// The digest of a sequence of lines L_0, ..., L_{n-1} is computed from
+// the sum
+//
+//   S = lineContentHash(L_0) * B^0 + ... + lineContentHash(L_{n-1}) * B^{n-1}
+//
+// modulo 2^64, where B is `digestPower(1)`, by `finishContentDigest(S,
+// n)`.  Since each line contributes a separate term, a change to one
+// line only requires updating that term.
+//
+// The results do not depend on the host byte order, so a digest
+// computed by `editor-fs-server` can be compared to one computed by
+// the editor.  This module is used by both, so it must not depend on
+// Qt.
+//
+// The hashes are not cryptographic.  Two different texts have the same
+// digest with probability about 2^-64, which is acceptable for
+// avoiding redundant work, but not for defending against an adversary.
+
+#ifndef EDITOR_CONTENT_DIGEST_H
+#define EDITOR_CONTENT_DIGEST_H
+
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint64_t
+#include <string>                      // std::string
+
+
+// Hash of the `len` bytes at `bytes`, which do not include a newline.
+// This never returns 0, so callers can use 0 to mean "not known".
+std::uint64_t lineContentHash(char const *bytes, std::size_t len);
+
+// B^`i` modulo 2^64, the weight of the hash of line `i` in the sum.
+std::uint64_t digestPower(std::size_t i);
+
+// Digest of a text with `numLines` lines whose weighted line hash sum
+// is `sum`.
+std::uint64_t finishContentDigest(std::uint64_t sum, std::size_t numLines);
+
+// Digest of the `size` bytes at `data`, split into lines at newline
+// characters as `TextDocumentCore` does, so that this equals
+// `TextDocumentCore::contentDigest()` for a document whose
+// `getWholeFile()` is the same bytes.
+std::uint64_t textContentDigest(char const *data, std::size_t size);
+
+
+// Computes `textContentDigest` of a text supplied in pieces, such as
+// successive reads of a file, without holding all of it at once.  The
+// pieces can split lines anywhere.
+class TextContentDigester {
+private:     // data
+  // Bytes of the current line received so far, when it started in an
+  // earlier piece.  Only lines that cross a piece boundary are copied.
+  std::string m_partialLine;
+
+  // Weighted sum of the hashes of the lines completed so far.
+  std::uint64_t m_sum;
+
+  // Weight of the next line's hash.
+  std::uint64_t m_power;
+
+  // Number of lines completed so far.
+  std::size_t m_numLines;
+
+private:     // funcs
+  // Add the hash of the line whose bytes are `bytes` and `len`.
+  void addLine(char const *bytes, std::size_t len);
+
+public:      // funcs
+  TextContentDigester();
+
+  // Append the `size` bytes at `data` to the text.
+  void add(char const *data, std::size_t size);
+
+  // Digest of the text added so far.  The last line is the bytes after
+  // the last newline, possibly none.
+  std::uint64_t digest() const;
+};
+
+
+#endif // EDITOR_CONTENT_DIGEST_H
@@ -0,0 +1,136 @@
+// doc-file-watcher-test.cc
+// Tests for `doc-file-watcher` module.
+
+#include "unit-tests.h"                // decl for my entry point
+#include "doc-file-watcher.h"          // module under test
+
+#include "doc-name.h"                  // DocumentName
+#include "named-td.h"                  // NamedTextDocument
+#include "named-td-list.h"             // NamedTextDocumentList
+#include "vfs-test-connections.h"      // VFS_TestConnections
+
+#include "smqtutil/qtutil.h"           // waitForQtEvent
+
+#include "smbase/map-util.h"           // smbase::mapInsertUnique
+#include "smbase/sm-file-util.h"       // SMFileUtil
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, EXPECT_{TRUE,FALSE}
+
+#include <functional>                  // std::function
+#include <memory>                      // std::unique_ptr
+#include <string>                      // std::string
+
+using namespace smbase;
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+void waitUntil(char const *desc, std::function<bool()> condition)
+{
+  DIAG("Waiting until: " << desc);
+  while (!condition()) {
+    waitForQtEvent();
+  }
+  DIAG("Finished waiting until: " << desc);
+}
+
+
+/* Watch the file of one document:
+
+     - Open a document; its file gets watched.
+     - Report a change during a save; it is ignored.
+     - Report a change; the document is marked as modified on disk.
+     - Close the document; the watch is removed.
+*/
+void test_basics()
+{
+  NamedTextDocumentList documentList;
+  VFS_TestConnections vfsConnections;
+  vfsConnections.m_hosts[HostName::asLocal()] =
+    VFS_AbstractConnections::CS_READY;
+
+  std::string const fname = "/home/user/foo.txt";
+  mapInsertUnique(vfsConnections.m_files, fname,
+    VFS_TestConnections::FileReplyData(std::string("one\ntwo\n")));
+
+  DocumentFileWatcher watcher(&documentList, &vfsConnections);
+  watcher.selfCheck();
+
+  // Make a document for the file.
+  NamedTextDocument *ntd = new NamedTextDocument;
+  ntd->setDocumentName(DocumentName::fromLocalFilename(fname));
+  ntd->replaceWholeFileString("one\ntwo\n");
+  documentList.addDocument(ntd);       // Ownership transfer.
+  HostAndResourceName harn = ntd->harn();
+
+  // The watch request is outstanding.
+  watcher.selfCheck();
+  EXPECT_FALSE(watcher.isWatching(harn));
+  EXPECT_FALSE(ntd->m_fileIsWatched);
+
+  waitUntil("file is watched",
+            [&watcher, &harn]() -> bool {
+    return watcher.isWatching(harn);
+  });
+  watcher.selfCheck();
+  EXPECT_TRUE(ntd->m_fileIsWatched);
+
+  // The mock server reports the same modification time the document
+  // has, so the document is not modified on disk.
+  EXPECT_FALSE(ntd->m_modifiedOnDisk);
+
+  // A change to some other file does nothing.
+  Q_EMIT vfsConnections.signal_vfsFileChanged(
+    HostName::asLocal(), "/home/user/bar.txt",
+    SMFileUtil::FK_REGULAR, 100);
+  EXPECT_FALSE(ntd->m_modifiedOnDisk);
+
+  // Neither does the file being deleted.
+  Q_EMIT vfsConnections.signal_vfsFileChanged(
+    HostName::asLocal(), harn.resourceName(),
+    SMFileUtil::FK_NONE, 0);
+  EXPECT_FALSE(ntd->m_modifiedOnDisk);
+
+  // Nor does a change reported while the document is being saved,
+  // since that is normally the save itself.
+  ntd->m_saveInProgress = true;
+  Q_EMIT vfsConnections.signal_vfsFileChanged(
+    HostName::asLocal(), harn.resourceName(),
+    SMFileUtil::FK_REGULAR, 100);
+  EXPECT_FALSE(ntd->m_modifiedOnDisk);
+  ntd->m_saveInProgress = false;
+
+  // Changing the file does.
+  Q_EMIT vfsConnections.signal_vfsFileChanged(
+    HostName::asLocal(), harn.resourceName(),
+    SMFileUtil::FK_REGULAR, 100);
+  EXPECT_TRUE(ntd->m_modifiedOnDisk);
+
+  // Close the document.  The watch goes away immediately, and the
+  // unwatch reply is consumed when it arrives.
+  documentList.removeDocument(ntd);
+  std::unique_ptr<NamedTextDocument> ntdOwner(ntd);
+  watcher.selfCheck();
+  EXPECT_FALSE(watcher.isWatching(harn));
+
+  waitUntil("unwatch reply consumed",
+            [&vfsConnections]() -> bool {
+    return vfsConnections.numOutstandingRequests() == 0 &&
+           vfsConnections.numAvailableReplies() == 0;
+  });
+  watcher.selfCheck();
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_doc_file_watcher(CmdlineArgsSpan args)
+{
+  test_basics();
+}
+
+
+// EOF
@@ -0,0 +1,338 @@
+// doc-file-watcher.cc
+// Code for `doc-file-watcher` module.
+
+#include "doc-file-watcher.h"                    // this module
+
+#include "doc-name.h"                            // DocumentName
+#include "named-td.h"                            // NamedTextDocument
+#include "vfs-msg.h"                             // VFS_{Watch,Unwatch}File{Request,Reply}
+
+#include "smbase/exc.h"                          // GENERIC_CATCH_{BEGIN,END}
+#include "smbase/map-util.h"                     // smbase::mapInsertUnique
+#include "smbase/sm-macros.h"                    // IMEMBFP
+#include "smbase/sm-trace.h"                     // INIT_TRACE, etc.
+#include "smbase/xassert.h"                      // xassert
+
+#include <memory>                                // std::unique_ptr
+#include <set>                                   // std::set
+#include <utility>                               // std::{move, make_pair}
+
+using namespace smbase;
+
+
+INIT_TRACE("doc-file-watcher");
+
+
+DocumentFileWatcher::DocumentFileWatcher(
+  NNRCSerf<NamedTextDocumentList> documentList,
+  NNRCSerf<VFS_AbstractConnections> vfsConnections)
+:
+  QObject(),
+  NamedTextDocumentListObserver(),
+  IMEMBFP(documentList),
+  IMEMBFP(vfsConnections),
+  m_watches(),
+  m_requests()
+{
+  m_documentList->addObserver(this);
+
+  QObject::connect(m_vfsConnections, &VFS_AbstractConnections::signal_vfsConnected,
+                   this, &DocumentFileWatcher::on_vfsConnected);
+  QObject::connect(m_vfsConnections, &VFS_AbstractConnections::signal_vfsReplyAvailable,
+                   this, &DocumentFileWatcher::on_vfsReplyAvailable);
+  QObject::connect(m_vfsConnections, &VFS_AbstractConnections::signal_vfsFailed,
+                   this, &DocumentFileWatcher::on_vfsFailed);
+  QObject::connect(m_vfsConnections, &VFS_AbstractConnections::signal_vfsFileChanged,
+                   this, &DocumentFileWatcher::on_vfsFileChanged);
+
+  synchronize();
+}
+
+
+DocumentFileWatcher::~DocumentFileWatcher()
+{
+  // See doc/signals-and-dtors.txt.
+  QObject::disconnect(m_vfsConnections, nullptr, this, nullptr);
+
+  m_documentList->removeObserver(this);
+
+  for (auto const &kv : m_requests) {
+    m_vfsConnections->cancelRequest(kv.first);
+  }
+}
+
+
+void DocumentFileWatcher::selfCheck() const
+{
+  for (auto const &kv : m_watches) {
+    Watch const &watch = kv.second;
+    if (watch.m_state == WS_REQUESTED) {
+      auto it = m_requests.find(watch.m_requestID);
+      xassert(it != m_requests.end());
+      xassert((*it).second.m_harn == kv.first);
+      xassert((*it).second.m_isWatch);
+    }
+  }
+}
+
+
+bool DocumentFileWatcher::isWatching(HostAndResourceName const &harn) const
+{
+  auto it = m_watches.find(harn);
+  return it != m_watches.end() && (*it).second.m_state == WS_WATCHING;
+}
+
+
+DocumentFileWatcher::RequestID DocumentFileWatcher::sendRequest(
+  HostAndResourceName const &harn, bool isWatch)
+{
+  std::unique_ptr<VFS_PathRequest> req;
+  if (isWatch) {
+    req.reset(new VFS_WatchFileRequest);
+  }
+  else {
+    req.reset(new VFS_UnwatchFileRequest);
+  }
+  req->m_path = harn.resourceName();
+
+  RequestID requestID = 0;
+  m_vfsConnections->issueRequest(requestID, harn.hostName(), std::move(req));
+  mapInsertUnique(m_requests, requestID, Request(harn, isWatch));
+
+  TRACE1((isWatch? "watch " : "unwatch ") << harn <<
+         ": request " << requestID);
+  return requestID;
+}
+
+
+void DocumentFileWatcher::synchronize()
+{
+  // Files that should be watched.
+  std::set<HostAndResourceName> wanted;
+  for (int i=0; i < m_documentList->numDocuments(); ++i) {
+    NamedTextDocument const *doc = m_documentList->getDocumentAtC(i);
+    if (doc->hasFilename() && m_vfsConnections->isReady(doc->hostName())) {
+      wanted.insert(doc->harn());
+    }
+  }
+
+  // Stop watching files no longer wanted.  A watch that is still being
+  // requested is undone when its reply arrives.
+  for (auto it = m_watches.begin(); it != m_watches.end(); ) {
+    if (wanted.count((*it).first)) {
+      ++it;
+    }
+    else {
+      if ((*it).second.m_state == WS_WATCHING) {
+        sendRequest((*it).first, false /*isWatch*/);
+      }
+      it = m_watches.erase(it);
+    }
+  }
+
+  // Start watching new ones.
+  for (HostAndResourceName const &harn : wanted) {
+    if (!m_watches.count(harn)) {
+      m_watches.insert(std::make_pair(harn,
+        Watch(sendRequest(harn, true /*isWatch*/))));
+    }
+  }
+
+  for (int i=0; i < m_documentList->numDocuments(); ++i) {
+    NamedTextDocument *doc = m_documentList->getDocumentAt(i);
+    doc->m_fileIsWatched = doc->hasFilename() && isWatching(doc->harn());
+  }
+}
+
+
+NamedTextDocument * NULLABLE DocumentFileWatcher::findDocument(
+  HostAndResourceName const &harn)
+{
+  return m_documentList->findDocumentByName(
+    DocumentName::fromFilenameHarn(harn));
+}
+
+
+void DocumentFileWatcher::updateFromFileState(
+  NamedTextDocument *doc,
+  SMFileUtil::FileKind fileKind,
+  std::int64_t modTime)
+{
+  if (doc->m_saveInProgress) {
+    // Most likely this is our own write, which the writer will
+    // account for when the server replies.
+    TRACE1("Document " << doc->documentName() <<
+           " is being saved; ignoring reported modTime " << modTime);
+    return;
+  }
+
+  // Like the file status check, this ignores a file that has been
+  // deleted; the problem is reported when the user tries to save.
+  if (fileKind == SMFileUtil::FK_REGULAR &&
+      modTime != doc->m_lastFileTimestamp &&
+      !doc->m_modifiedOnDisk &&
+      !doc->remapChangedFile(modTime)) {
+    TRACE1("Document " << doc->documentName() <<
+           " modTime " << doc->m_lastFileTimestamp <<
+           " differs from server modTime " << modTime <<
+           ", marking as modified on disk.");
+    doc->m_modifiedOnDisk = true;
+
+    // Let widgets showing it redraw the indicator.
+    doc->notifyMetadataChange();
+  }
+}
+
+
+void DocumentFileWatcher::namedTextDocumentAdded(
+  NamedTextDocumentList const *, NamedTextDocument *) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+  synchronize();
+  GENERIC_CATCH_END
+}
+
+
+void DocumentFileWatcher::namedTextDocumentRemoved(
+  NamedTextDocumentList const *, NamedTextDocument *) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+  synchronize();
+  GENERIC_CATCH_END
+}
+
+
+void DocumentFileWatcher::namedTextDocumentAttributeChanged(
+  NamedTextDocumentList const *, NamedTextDocument *) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  // The document may have been given a new name.
+  synchronize();
+
+  GENERIC_CATCH_END
+}
+
+
+void DocumentFileWatcher::on_vfsConnected(HostName hostName) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  // Watch the files of documents already open on `hostName`.
+  synchronize();
+
+  GENERIC_CATCH_END
+}
+
+
+void DocumentFileWatcher::on_vfsReplyAvailable(
+  VFS_AbstractConnections::RequestID requestID) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  auto reqIt = m_requests.find(requestID);
+  if (reqIt == m_requests.end()) {
+    // Not one of mine.
+    return;
+  }
+  Request req((*reqIt).second);
+  m_requests.erase(reqIt);
+
+  std::unique_ptr<VFS_Message> genericReply(
+    m_vfsConnections->takeReply(requestID));
+  if (!req.m_isWatch) {
+    return;
+  }
+  VFS_WatchFileReply const *reply = genericReply->asWatchFileReplyC();
+
+  auto watchIt = m_watches.find(req.m_harn);
+  if (watchIt == m_watches.end() ||
+      (*watchIt).second.m_state != WS_REQUESTED ||
+      (*watchIt).second.m_requestID != requestID) {
+    // The document went away while the request was outstanding.  If
+    // it came back, a newer request is outstanding, and the server
+    // does not count watches, so leave it alone.
+    if (watchIt == m_watches.end() && reply->m_success) {
+      sendRequest(req.m_harn, false /*isWatch*/);
+    }
+    return;
+  }
+
+  Watch &watch = (*watchIt).second;
+  if (!reply->m_success) {
+    TRACE1("cannot watch " << req.m_harn << ": " <<
+           reply->m_failureReasonString);
+    watch.m_state = WS_FAILED;
+    return;
+  }
+
+  watch.m_state = WS_WATCHING;
+  if (NamedTextDocument *doc = findDocument(req.m_harn)) {
+    doc->m_fileIsWatched = true;
+
+    // The file could have changed between when the document was
+    // loaded and when the watch started.
+    updateFromFileState(doc, reply->m_fileKind,
+                        reply->m_fileModificationTime);
+  }
+
+  GENERIC_CATCH_END
+}
+
+
+void DocumentFileWatcher::on_vfsFailed(
+  HostName hostName, std::string reason) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  // The watches went away with the server.  Any replies will never
+  // arrive.
+  for (auto it = m_requests.begin(); it != m_requests.end(); ) {
+    if ((*it).second.m_harn.hostName() == hostName) {
+      m_vfsConnections->cancelRequest((*it).first);
+      it = m_requests.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  for (auto it = m_watches.begin(); it != m_watches.end(); ) {
+    if ((*it).first.hostName() == hostName) {
+      it = m_watches.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+
+  for (int i=0; i < m_documentList->numDocuments(); ++i) {
+    NamedTextDocument *doc = m_documentList->getDocumentAt(i);
+    if (doc->hostName() == hostName) {
+      doc->m_fileIsWatched = false;
+    }
+  }
+
+  GENERIC_CATCH_END
+}
+
+
+void DocumentFileWatcher::on_vfsFileChanged(
+  HostName hostName,
+  std::string path,
+  SMFileUtil::FileKind fileKind,
+  std::int64_t modificationTime) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  HostAndResourceName harn(hostName, path);
+  TRACE2("file changed: " << harn << " modTime=" << modificationTime);
+
+  if (NamedTextDocument *doc = findDocument(harn)) {
+    updateFromFileState(doc, fileKind, modificationTime);
+  }
+
+  GENERIC_CATCH_END
+}
+
+
+// EOF
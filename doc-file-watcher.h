@@ -0,0 +1,157 @@
+// doc-file-watcher.h
+// `DocumentFileWatcher`, which learns about on-disk changes to the
+// files of open documents from the VFS servers.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_DOC_FILE_WATCHER_H
+#define EDITOR_DOC_FILE_WATCHER_H
+
+#include "host-and-resource-name.h"    // HostAndResourceName
+#include "host-name.h"                 // HostName
+#include "named-td-fwd.h"              // NamedTextDocument [n]
+#include "named-td-list.h"             // NamedTextDocumentList, NamedTextDocumentListObserver
+#include "vfs-connections.h"           // VFS_AbstractConnections
+
+#include "smbase/refct-serf.h"         // NNRCSerf
+#include "smbase/sm-file-util.h"       // SMFileUtil
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES, NULLABLE
+
+#include <QObject>
+
+#include <cstdint>                     // std::int64_t
+#include <map>                         // std::map
+#include <string>                      // std::string
+
+
+// Asks the VFS servers to watch the files of the documents in a
+// document list, and sets `m_modifiedOnDisk` on a document as soon as
+// its server reports a change, so nothing has to ask the server
+// whether a file has changed.
+//
+// While a document's file is being watched, its `m_fileIsWatched` is
+// true.  Otherwise, for example because the server cannot watch files
+// or the watch request is still outstanding, it is false, and clients
+// have to fall back on querying the file status.
+class DocumentFileWatcher : public QObject,
+                            public NamedTextDocumentListObserver {
+  Q_OBJECT
+  NO_OBJECT_COPIES(DocumentFileWatcher);
+
+private:     // types
+  typedef VFS_AbstractConnections::RequestID RequestID;
+
+  // Progress of the watch for one file.
+  enum WatchState {
+    WS_REQUESTED,              // Request sent, no reply yet.
+    WS_WATCHING,               // The server is watching the file.
+    WS_FAILED,                 // The server could not watch it.
+  };
+
+  // A file we want watched.
+  class Watch {
+  public:      // data
+    WatchState m_state;
+
+    // If `m_state` is `WS_REQUESTED`, the watch request.
+    RequestID m_requestID;
+
+  public:      // methods
+    explicit Watch(RequestID requestID)
+      : m_state(WS_REQUESTED),
+        m_requestID(requestID)
+    {}
+  };
+
+  // A request whose reply has not been taken.
+  class Request {
+  public:      // data
+    // File the request is about.
+    HostAndResourceName m_harn;
+
+    // True for a watch request, false for an unwatch request.
+    bool m_isWatch;
+
+  public:      // methods
+    Request(HostAndResourceName const &harn, bool isWatch)
+      : m_harn(harn),
+        m_isWatch(isWatch)
+    {}
+  };
+
+private:     // data
+  // Documents whose files are watched.
+  NNRCSerf<NamedTextDocumentList> const m_documentList;
+
+  // Connections to the servers that do the watching.
+  NNRCSerf<VFS_AbstractConnections> const m_vfsConnections;
+
+  // Files we want watched.  After `synchronize`, these are the files of
+  // the documents in `m_documentList` whose host is ready.
+  std::map<HostAndResourceName, Watch> m_watches;
+
+  // Outstanding requests.  Replies to unwatch requests are only taken
+  // so they do not accumulate.
+  std::map<RequestID, Request> m_requests;
+
+private:     // methods
+  // Issue a watch or unwatch request for `harn`, returning its ID.
+  RequestID sendRequest(HostAndResourceName const &harn, bool isWatch);
+
+  // Request watches for files that need one, unwatch files that no
+  // longer have a document, and update `m_fileIsWatched` on every
+  // document.
+  void synchronize();
+
+  // Return the document for `harn`, if there is one.
+  NamedTextDocument * NULLABLE findDocument(
+    HostAndResourceName const &harn);
+
+  // Record that the file of `doc` now has `fileKind` and `modTime`,
+  // marking `doc` as modified on disk if that differs from what it
+  // last loaded or saved.  Does nothing while `doc` is being saved.
+  void updateFromFileState(
+    NamedTextDocument *doc,
+    SMFileUtil::FileKind fileKind,
+    std::int64_t modTime);
+
+public:      // methods
+  // Start watching the files of `documentList`.
+  DocumentFileWatcher(
+    NNRCSerf<NamedTextDocumentList> documentList,
+    NNRCSerf<VFS_AbstractConnections> vfsConnections);
+
+  virtual ~DocumentFileWatcher() override;
+
+  // Assert invariants.
+  void selfCheck() const;
+
+  // True if the server is watching `harn`.
+  bool isWatching(HostAndResourceName const &harn) const;
+
+  // NamedTextDocumentListObserver methods.
+  virtual void namedTextDocumentAdded(
+    NamedTextDocumentList const *documentList,
+    NamedTextDocument *doc) NOEXCEPT override;
+  virtual void namedTextDocumentRemoved(
+    NamedTextDocumentList const *documentList,
+    NamedTextDocument *doc) NOEXCEPT override;
+  virtual void namedTextDocumentAttributeChanged(
+    NamedTextDocumentList const *documentList,
+    NamedTextDocument *doc) NOEXCEPT override;
+
+private Q_SLOTS:
+  // Handlers for VFS_AbstractConnections signals.
+  void on_vfsConnected(HostName hostName) NOEXCEPT;
+  void on_vfsReplyAvailable(
+    VFS_AbstractConnections::RequestID requestID) NOEXCEPT;
+  void on_vfsFailed(HostName hostName, std::string reason) NOEXCEPT;
+  void on_vfsFileChanged(
+    HostName hostName,
+    std::string path,
+    SMFileUtil::FileKind fileKind,
+    std::int64_t modificationTime) NOEXCEPT;
+};
+
+
+#endif // EDITOR_DOC_FILE_WATCHER_H
@@ -4,15 +4,39 @@
 #include "editor-fs-server-test.h"               // this module
 #include "unit-tests.h"                          // decl for my entry point
 
+#include "content-digest.h"                      // textContentDigest
+
 // smqtutil
 #include "smqtutil/qtutil.h"                     // toString(QString)
 
 // smbase
 #include "smbase/exc.h"                          // smbase::XBase
+#include "smbase/map-util.h"                     // mapInsertUnique
+#include "smbase/nonport.h"                      // getMilliseconds
 #include "smbase/portable-error-code.h"          // smbase::PortableErrorCode
-#include "smbase/sm-test.h"                      // DIAG, VPVAL
+#include "smbase/sm-file-util.h"                 // SMFileUtil
+#include "smbase/sm-test.h"                      // DIAG, VPVAL, EXPECT_EQ
 #include "smbase/string-util.h"                  // doubleQuote
 
+// qt
+#include <QByteArray>
+
+// libc++
+#include <algorithm>                             // std::min
+#include <cstring>                               // std::strcmp
+#include <iostream>                              // std::cout
+#include <map>                                   // std::map
+#include <string>                                // std::string
+#include <vector>                                // std::vector
+
+// libc
+#include <stdio.h>                               // remove
+
+#ifndef __WIN32__
+#  include <sys/stat.h>                          // lstat, S_ISLNK
+#  include <unistd.h>                            // symlink, link
+#endif
+
 using namespace smbase;
 
 
@@ -41,9 +65,12 @@ std::unique_ptr<VFS_Message> FSServerTest::getNextReply()
 {
   DIAG("getNextReply");
 
-  // Wait for something to happen.
-  DIAG("  waiting ...");
-  m_eventLoop.exec();
+  // Wait for something to happen.  A previous signal may have
+  // announced more than one reply, in which case there is no need.
+  if (!m_fsQuery.hasReply()) {
+    DIAG("  waiting ...");
+    m_eventLoop.exec();
+  }
 
   if (m_fsQuery.hasFailed()) {
     xfatal(m_fsQuery.getFailureReason());
@@ -63,7 +90,22 @@ void FSServerTest::runTests(HostName const &hostName)
   runPathQuery("Makefile");
   runEchoTests();
   runFileReadWriteTests();
+  runFileRangeTests();
+  if (hostName.isLocal()) {
+    // The links are made directly, so need the same file system.
+    runFileRangeLinkTests();
+  }
+  runFileLinesTest();
   runGetDirEntriesTest();
+  runFileWatchTest();
+
+  VFS_TransferStats const &stats = m_fsQuery.transferStats();
+  DIAG("codec: " << toString(m_fsQuery.codec()));
+  VPVAL(stats.m_rawBytesSent);
+  VPVAL(stats.m_wireBytesSent);
+  VPVAL(stats.m_rawBytesReceived);
+  VPVAL(stats.m_wireBytesReceived);
+  VPVAL(stats.compressionRatio());
 
   m_fsQuery.shutdown();
 }
@@ -171,6 +213,82 @@ void FSServerTest::runEchoTests()
 }
 
 
+void FSServerTest::runPipelineTest(int numRequests, int delayMS)
+{
+  DIAG("runPipelineTest(" << numRequests << ", " << delayMS << ")");
+
+  long start = getMilliseconds();
+
+  // Send all of the requests before waiting for any replies.  Map
+  // from wire ID to the byte that request carries.
+  std::map<VFS_WireID, unsigned char> expect;
+  for (int i=0; i < numRequests; i++) {
+    VFS_Echo req;
+    req.m_data.push_back((unsigned char)i);
+    mapInsertUnique(expect, m_fsQuery.sendRequest(req), (unsigned char)i);
+  }
+  EXPECT_EQ(m_fsQuery.numOutstandingRequests(), numRequests);
+
+  // Replies can come back in any order.
+  while (!expect.empty()) {
+    if (!m_fsQuery.hasReply()) {
+      m_eventLoop.exec();
+    }
+    if (m_fsQuery.hasFailed()) {
+      xfatal(m_fsQuery.getFailureReason());
+    }
+    xassert(m_fsQuery.hasReply());
+
+    VFS_WireID id = m_fsQuery.nextReplyID();
+    std::unique_ptr<VFS_Message> replyMsg(m_fsQuery.takeReply());
+    VFS_Echo const *reply = replyMsg->asEchoC();
+
+    auto it = expect.find(id);
+    xassert(it != expect.end());
+    xassert(reply->m_data == std::vector<unsigned char>{it->second});
+    expect.erase(it);
+  }
+  xassert(m_fsQuery.isReady());
+
+  long elapsed = getMilliseconds() - start;
+  VPVAL(elapsed);
+
+  // If the server handled these one at a time, it would take at least
+  // `numRequests * delayMS`.  Allow plenty of slack for a busy machine
+  // while still detecting serialization.
+  xassert(elapsed < numRequests * delayMS / 2);
+}
+
+
+void FSServerTest::runEchoBenchmark(std::size_t payloadSize,
+                                    int iterations)
+{
+  VFS_Echo request;
+  request.m_data.resize(payloadSize);
+  for (std::size_t i=0; i < payloadSize; ++i) {
+    request.m_data[i] = (unsigned char)(i ^ (i >> 8));
+  }
+
+  long start = getMilliseconds();
+  for (int i=0; i < iterations; ++i) {
+    m_fsQuery.sendRequest(request);
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    xassert(replyMsg->asEchoC()->m_data.size() == payloadSize);
+  }
+  long elapsedMS = getMilliseconds() - start;
+  double seconds = (elapsedMS > 0? elapsedMS : 1) / 1000.0;
+
+  // Each round trip carries the payload both ways.
+  std::cout << "echo: bytes=" << payloadSize
+            << " iterations=" << iterations
+            << " ms=" << elapsedMS
+            << " roundTripsPerSec=" << (long)(iterations / seconds)
+            << " MBPerSec="
+            << (2.0 * payloadSize * iterations / seconds / 1.0e6)
+            << std::endl;
+}
+
+
 void FSServerTest::runFileReadWriteTests()
 {
   DIAG("runFileReadWriteTests");
@@ -253,6 +371,389 @@ void FSServerTest::runFileReadWriteTests()
 }
 
 
+void FSServerTest::runFileRangeTests()
+{
+  DIAG("runFileRangeTests");
+
+  std::vector<unsigned char> data(allBytes());
+  string fname = "efst.tmp";
+
+  // True if `fname` can be read.
+  auto fileExists = [this, &fname]() -> bool {
+    VFS_ReadFileRangeRequest req;
+    req.m_path = fname;
+    req.m_maxLength = 0;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    return replyMsg->asReadFileRangeReplyC()->m_success;
+  };
+
+  // Write in three ranges.  The file only appears once the last one
+  // has been written.
+  string tempPath;
+  for (int64_t offset : {0, 100, 200}) {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = fname;
+    req.m_offset = offset;
+    req.m_tempPath = tempPath;
+    req.m_contents.assign(data.begin() + offset,
+                          data.begin() + std::min<int64_t>(offset+100, 256));
+    req.m_lastRange = (offset == 200);
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_WriteFileRangeReply const *reply =
+      replyMsg->asWriteFileRangeReplyC();
+    if (!reply->m_success) {
+      xfatal(reply->m_failureReasonString);
+    }
+    tempPath = reply->m_tempPath;
+
+    EXPECT_EQ(fileExists(), req.m_lastRange);
+  }
+
+  // Read it back in ranges of 99, so the last is short.
+  std::vector<unsigned char> readBack;
+  while (true) {
+    VFS_ReadFileRangeRequest req;
+    req.m_path = fname;
+    req.m_offset = (int64_t)readBack.size();
+    req.m_maxLength = 99;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_ReadFileRangeReply const *reply =
+      replyMsg->asReadFileRangeReplyC();
+    if (!reply->m_success) {
+      xfatal(reply->m_failureReasonString);
+    }
+    xassert(reply->m_offset == req.m_offset);
+    xassert(reply->m_fileSize == 256);
+    if (reply->m_contents.empty()) {
+      break;
+    }
+    readBack.insert(readBack.end(),
+      reply->m_contents.begin(), reply->m_contents.end());
+  }
+  xassert(readBack == data);
+
+  // Writing past the end is rejected.
+  {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = fname;
+    req.m_offset = 1000;
+    req.m_contents = data;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    xassert(!replyMsg->asWriteFileRangeReplyC()->m_success);
+  }
+
+  // Size of the file according to the server.
+  auto getFileSize = [this, &fname]() -> int64_t {
+    VFS_ReadFileRangeRequest req;
+    req.m_path = fname;
+    req.m_maxLength = 0;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_ReadFileRangeReply const *reply =
+      replyMsg->asReadFileRangeReplyC();
+    xassert(reply->m_success);
+    return reply->m_fileSize;
+  };
+
+  // A write that expects different contents is refused, leaving the
+  // file alone.
+  uint64_t const digest =
+    textContentDigest((char const *)data.data(), data.size());
+  {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = fname;
+    req.m_contents = std::vector<unsigned char>{'x'};
+    req.m_checkDigest = true;
+    req.m_expectedDigest = digest + 1;
+    req.m_lastRange = true;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_WriteFileRangeReply const *reply =
+      replyMsg->asWriteFileRangeReplyC();
+    xassert(!reply->m_success);
+    xassert(reply->m_digestMismatch);
+    EXPECT_EQ(getFileSize(), 256);
+  }
+
+  // With the right digest, the write happens.
+  {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = fname;
+    req.m_contents = std::vector<unsigned char>{'x'};
+    req.m_checkDigest = true;
+    req.m_expectedDigest = digest;
+    req.m_lastRange = true;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_WriteFileRangeReply const *reply =
+      replyMsg->asWriteFileRangeReplyC();
+    if (!reply->m_success) {
+      xfatal(reply->m_failureReasonString);
+    }
+    xassert(!reply->m_digestMismatch);
+    EXPECT_EQ(getFileSize(), 1);
+  }
+
+  // A transfer that is abandoned before its last range leaves the
+  // file alone.
+  {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = fname;
+    req.m_contents = data;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_WriteFileRangeReply const *reply =
+      replyMsg->asWriteFileRangeReplyC();
+    xassert(reply->m_success);
+    tempPath = reply->m_tempPath;
+    EXPECT_EQ(getFileSize(), 1);
+  }
+
+  // A later range must name a temporary file made for the target.
+  {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = fname;
+    req.m_offset = 1;
+    req.m_tempPath = "efst-other.tmp";
+    req.m_contents = data;
+    req.m_lastRange = true;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    xassert(!replyMsg->asWriteFileRangeReplyC()->m_success);
+    EXPECT_EQ(getFileSize(), 1);
+  }
+
+  // Remove the partial temporary file.
+  {
+    VFS_DeleteFileRequest req;
+    req.m_path = tempPath;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    xassert(replyMsg->asDeleteFileReplyC()->m_success);
+  }
+
+  // Delete.
+  {
+    VFS_DeleteFileRequest req;
+    req.m_path = fname;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    xassert(replyMsg->asDeleteFileReplyC()->m_success);
+  }
+
+  // Read non-existent.
+  {
+    VFS_ReadFileRangeRequest req;
+    req.m_path = fname;
+    req.m_maxLength = 10;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_ReadFileRangeReply const *reply =
+      replyMsg->asReadFileRangeReplyC();
+    xassert(!reply->m_success);
+    xassert(reply->m_failureReasonCode == PortableErrorCode::PEC_FILE_NOT_FOUND);
+  }
+}
+
+
+void FSServerTest::runFileRangeLinkTests()
+{
+  DIAG("runFileRangeLinkTests");
+
+#ifndef __WIN32__
+  SMFileUtil sfu;
+  string const target = "efst-target.tmp";
+  string const symLink = "efst-symlink.tmp";
+  string const hardLink = "efst-hardlink.tmp";
+
+  // Send the first range of writing `contents` to `path`, returning
+  // the temporary file for the rest.
+  auto startWrite = [this](string const &path,
+                           std::vector<unsigned char> const &contents)
+                           -> string {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = path;
+    req.m_contents.assign(contents.begin(),
+                          contents.begin() + contents.size()/2);
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_WriteFileRangeReply const *reply =
+      replyMsg->asWriteFileRangeReplyC();
+    if (!reply->m_success) {
+      xfatal(reply->m_failureReasonString);
+    }
+    return reply->m_tempPath;
+  };
+
+  // Send the rest of `contents`, replacing the file.
+  auto finishWrite = [this](string const &path,
+                            std::vector<unsigned char> const &contents,
+                            string const &tempPath) -> void {
+    VFS_WriteFileRangeRequest req;
+    req.m_path = path;
+    req.m_offset = (int64_t)(contents.size()/2);
+    req.m_tempPath = tempPath;
+    req.m_contents.assign(contents.begin() + contents.size()/2,
+                          contents.end());
+    req.m_lastRange = true;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_WriteFileRangeReply const *reply =
+      replyMsg->asWriteFileRangeReplyC();
+    if (!reply->m_success) {
+      xfatal(reply->m_failureReasonString);
+    }
+  };
+
+  auto writeFile = [&](string const &path, std::string const &contents) {
+    std::vector<unsigned char> bytes(contents.begin(), contents.end());
+    finishWrite(path, bytes, startWrite(path, bytes));
+  };
+
+  auto readFile = [&sfu](string const &path) -> std::string {
+    std::vector<unsigned char> bytes(sfu.readFile(path));
+    return std::string(bytes.begin(), bytes.end());
+  };
+
+  auto isSymlink = [](string const &path) -> bool {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+  };
+
+  writeFile(target, "one\n");
+
+  // Saving through a symbolic link replaces the file it refers to,
+  // leaving the link in place.
+  xassert(symlink(target.c_str(), symLink.c_str()) == 0);
+  writeFile(symLink, "two\n");
+  EXPECT_TRUE(isSymlink(symLink));
+  EXPECT_EQ(readFile(target), std::string("two\n"));
+
+  // Saving a file with another hard link changes what both names
+  // refer to.
+  xassert(link(target.c_str(), hardLink.c_str()) == 0);
+  writeFile(target, "three\n");
+  EXPECT_EQ(readFile(hardLink), std::string("three\n"));
+  (void)remove(hardLink.c_str());
+
+  // Overlapping transfers to the same file use separate temporary
+  // files, so the one that finishes last wins intact.
+  {
+    std::vector<unsigned char> first{'f', 'i', 'r', 's', 't', '\n'};
+    std::vector<unsigned char> second{'s', 'e', 'c', 'o', 'n', 'd', '\n'};
+    string firstTemp = startWrite(target, first);
+    string secondTemp = startWrite(symLink, second);
+    EXPECT_TRUE(firstTemp != secondTemp);
+
+    finishWrite(target, first, firstTemp);
+    finishWrite(symLink, second, secondTemp);
+    EXPECT_EQ(readFile(target), std::string("second\n"));
+    EXPECT_TRUE(isSymlink(symLink));
+  }
+
+  (void)remove(symLink.c_str());
+  (void)remove(target.c_str());
+#endif
+}
+
+
+void FSServerTest::runFileLinesTest()
+{
+  DIAG("runFileLinesTest");
+
+  // Line 2 is long enough to span pieces of the server's scan buffer,
+  // and the last line has no newline.
+  std::string const longLine(200000, 'x');
+  std::string const text =
+    "zero\n"
+    "one\n" +
+    longLine + "\n"
+    "\n"
+    "four";
+  string fname = "efst.tmp";
+
+  {
+    VFS_WriteFileRequest req;
+    req.m_path = fname;
+    req.m_contents.assign(text.begin(), text.end());
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    xassert(replyMsg->asWriteFileReplyC()->m_success);
+  }
+
+  {
+    VFS_ReadFileLinesRequest req;
+
+    // Lines out of order, with a duplicate.
+    req.m_files.push_back(VFS_ReadFileLinesRequest::FileLines());
+    req.m_files.back().m_path = fname;
+    req.m_files.back().m_lineIndices = {4, 2, 0, 2, 3};
+
+    // A line past the end.
+    req.m_files.push_back(VFS_ReadFileLinesRequest::FileLines());
+    req.m_files.back().m_path = fname;
+    req.m_files.back().m_lineIndices = {1, 7};
+
+    // A file that does not exist.
+    req.m_files.push_back(VFS_ReadFileLinesRequest::FileLines());
+    req.m_files.back().m_path = "nonexistent.tmp";
+    req.m_files.back().m_lineIndices = {0};
+
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    VFS_ReadFileLinesReply const *reply =
+      replyMsg->asReadFileLinesReplyC();
+    EXPECT_EQ(reply->m_files.size(), 3);
+
+    VFS_ReadFileLinesReply::FileLines const &f0 = reply->m_files.at(0);
+    xassert(f0.m_success);
+    EXPECT_EQ(f0.m_numLines, -1);
+    xassert(f0.m_lines ==
+      (std::vector<string>{"four", longLine, "zero", longLine, ""}));
+
+    VFS_ReadFileLinesReply::FileLines const &f1 = reply->m_files.at(1);
+    xassert(f1.m_success);
+    EXPECT_EQ(f1.m_numLines, 5);
+    xassert(f1.hasLine(1));
+    xassert(!f1.hasLine(7));
+    EXPECT_EQ(f1.m_lines.at(0), "one");
+
+    VFS_ReadFileLinesReply::FileLines const &f2 = reply->m_files.at(2);
+    xassert(!f2.m_success);
+    xassert(f2.m_failureReasonCode == PortableErrorCode::PEC_FILE_NOT_FOUND);
+  }
+
+  {
+    VFS_DeleteFileRequest req;
+    req.m_path = fname;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextReply());
+    xassert(replyMsg->asDeleteFileReplyC()->m_success);
+  }
+}
+
+
 void FSServerTest::runGetDirEntriesTest()
 {
   VFS_GetDirEntriesRequest req;
@@ -273,6 +774,114 @@ void FSServerTest::runGetDirEntriesTest()
 }
 
 
+void FSServerTest::runFileWatchTest()
+{
+  DIAG("runFileWatchTest");
+
+  // A file that does not exist yet, so creating it is a change even if
+  // it happens within the same second as the watch.
+  string fname = "efst-watch.tmp";
+
+  // Wait for the next reply that answers a request, discarding any
+  // change notifications that arrive first.
+  auto getNextRequestReply = [this]() -> std::unique_ptr<VFS_Message> {
+    while (true) {
+      if (!m_fsQuery.hasReply()) {
+        m_eventLoop.exec();
+      }
+      if (m_fsQuery.hasFailed()) {
+        xfatal(m_fsQuery.getFailureReason());
+      }
+      xassert(m_fsQuery.hasReply());
+
+      if (m_fsQuery.nextReplyID() != VFS_notificationWireID) {
+        return m_fsQuery.takeReply();
+      }
+      std::unique_ptr<VFS_Message> n(m_fsQuery.takeReply());
+      DIAG("discarding: " << n->description());
+    }
+  };
+
+  // Watch.
+  {
+    VFS_WatchFileRequest req;
+    req.m_path = fname;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextRequestReply());
+    VFS_WatchFileReply const *reply = replyMsg->asWatchFileReplyC();
+    if (!reply->m_success) {
+      // Not every platform can watch files.
+      DIAG("cannot watch: " << reply->m_failureReasonString);
+      return;
+    }
+    EXPECT_EQ(reply->m_fileKind, SMFileUtil::FK_NONE);
+  }
+
+  // Create the file.  Its reply and the notification can arrive in
+  // either order.
+  {
+    VFS_WriteFileRequest req;
+    req.m_path = fname;
+    req.m_contents = {'h', 'i', '\n'};
+    VFS_WireID writeID = m_fsQuery.sendRequest(req);
+
+    bool gotReply = false;
+    bool gotNotification = false;
+    int64_t modTime = 0;
+    while (!gotReply || !gotNotification) {
+      if (!m_fsQuery.hasReply()) {
+        m_eventLoop.exec();
+      }
+      if (m_fsQuery.hasFailed()) {
+        xfatal(m_fsQuery.getFailureReason());
+      }
+      xassert(m_fsQuery.hasReply());
+
+      VFS_WireID id = m_fsQuery.nextReplyID();
+      std::unique_ptr<VFS_Message> msg(m_fsQuery.takeReply());
+      if (id == writeID) {
+        VFS_WriteFileReply const *reply = msg->asWriteFileReplyC();
+        xassert(reply->m_success);
+        modTime = reply->m_fileModificationTime;
+        gotReply = true;
+      }
+      else {
+        EXPECT_EQ(id, VFS_notificationWireID);
+        VFS_FileChangeNotification const *n =
+          msg->asFileChangeNotificationC();
+        EXPECT_EQ(n->m_path, fname);
+        if (n->m_fileKind == SMFileUtil::FK_REGULAR) {
+          VPVAL(n->m_fileModificationTime);
+          gotNotification = true;
+        }
+      }
+    }
+    VPVAL(modTime);
+  }
+
+  // Unwatch.
+  {
+    VFS_UnwatchFileRequest req;
+    req.m_path = fname;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextRequestReply());
+    xassert(replyMsg->asUnwatchFileReplyC()->m_success);
+  }
+
+  // Delete.
+  {
+    VFS_DeleteFileRequest req;
+    req.m_path = fname;
+    m_fsQuery.sendRequest(req);
+
+    std::unique_ptr<VFS_Message> replyMsg(getNextRequestReply());
+    xassert(replyMsg->asDeleteFileReplyC()->m_success);
+  }
+}
+
+
 void FSServerTest::on_vfsConnected() NOEXCEPT
 {
   m_eventLoop.exit();
@@ -289,9 +898,40 @@ void FSServerTest::on_vfsFailureAvailable() NOEXCEPT
 }
 
 
+// Measure round-trip Echo throughput at several payload sizes.  This
+// is not part of the normal test run; it is invoked as:
+//
+//   ./unit-tests.exe editor_fs_server echo-bench [<host>]
+//
+static void perfEcho(CmdlineArgsSpan args)
+{
+  HostName hostname(HostName::asLocal());
+  if (!args.empty()) {
+    hostname = HostName::asSSH(args[0]);
+  }
+
+  FSServerTest benchTest;
+  benchTest.connect(hostname);
+  std::cout << "host: " << hostname
+            << " codec: " << toString(benchTest.m_fsQuery.codec())
+            << std::endl;
+
+  benchTest.runEchoBenchmark(1 << 10, 2000);
+  benchTest.runEchoBenchmark(1 << 20, 50);
+  benchTest.runEchoBenchmark(100 << 20, 2);
+
+  benchTest.m_fsQuery.shutdown();
+}
+
+
 // Called from unit-tests.cc.
 void test_editor_fs_server(CmdlineArgsSpan args)
 {
+  if (!args.empty() && 0==std::strcmp(args[0], "echo-bench")) {
+    perfEcho(args.subspan(1));
+    return;
+  }
+
   FSServerTest fsServerTest;
 
   HostName hostname(HostName::asLocal());
@@ -310,6 +950,28 @@ void test_editor_fs_server(CmdlineArgsSpan args)
   }
 
   fsServerTest.runTests(hostname);
+
+  // Repeat with compression forced on, since by default it is only
+  // used for remote hosts.
+  FSServerTest compressedTest;
+  compressedTest.m_fsQuery.setRequestedCodec(VFS_CC_LZ);
+  compressedTest.runTests(hostname);
+  xassert(compressedTest.m_fsQuery.codec() == VFS_CC_LZ);
+
+  // Inject latency with the server's delay hook, then confirm that
+  // pipelined requests overlap.  The variable only reaches a local
+  // server.
+  if (hostname.isLocal()) {
+    int const delayMS = 200;
+    qputenv("EDITOR_FS_SERVER_DELAY", QByteArray::number(delayMS));
+
+    FSServerTest pipelineTest;
+    pipelineTest.connect(hostname);
+    pipelineTest.runPipelineTest(8 /*numRequests*/, delayMS);
+    pipelineTest.m_fsQuery.shutdown();
+
+    qunsetenv("EDITOR_FS_SERVER_DELAY");
+  }
 }
 
 
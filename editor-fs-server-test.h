@@ -17,6 +17,7 @@
 #include <QObject>
 
 // libc++
+#include <cstddef>                     // std::size_t
 #include <memory>                      // std::unique_ptr
 
 
@@ -55,12 +56,35 @@ public:      // methods
   // various patterns of data.
   void runEchoTests();
 
+  // Send `numRequests` Echo requests at once to a server that delays
+  // each by `delayMS`, and check that they are processed concurrently.
+  void runPipelineTest(int numRequests, int delayMS);
+
+  // Time `iterations` round trips of an Echo carrying `payloadSize`
+  // bytes, and print the rate.
+  void runEchoBenchmark(std::size_t payloadSize, int iterations);
+
   // Run tests related to reading and writing file contents.
   void runFileReadWriteTests();
 
+  // Write and read a file in ranges.
+  void runFileRangeTests();
+
+  // Write in ranges to a file through a symbolic link and with another
+  // hard link, and with overlapping transfers.  The server must share
+  // our file system.
+  void runFileRangeLinkTests();
+
+  // Read selected lines from files with ReadFileLines.
+  void runFileLinesTest();
+
   // Test the GetDirEntries request and reply.
   void runGetDirEntriesTest();
 
+  // Watch a file, see the notification when it is created, and unwatch
+  // it.
+  void runFileWatchTest();
+
 public Q_SLOTS:
   // Handlers for VFS_FileSystemQuery signals.
   void on_vfsConnected() NOEXCEPT;
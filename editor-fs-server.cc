@@ -2,11 +2,13 @@
 // Program to serve virtual file system requests.
 
 #include "vfs-local.h"                           // VFS_LocalImpl
+#include "vfs-watcher.h"                         // VFS_FileWatcher
 
+#include "buffer-flatten.h"                      // BufferFlatten
 #include "editor-version.h"                      // getEditorVersionString
+#include "vfs-compress.h"                        // vfsCompressMessageBody, vfsDecodeMessageBodyView
 
 // smbase
-#include "smbase/bflatten.h"                     // StreamFlatten
 #include "smbase/binary-stdin.h"                 // setStdinToBinary, setStdoutToBinary
 #include "smbase/datetime.h"                     // DateTimeSeconds
 #include "smbase/exc.h"                          // xfatal, smbase::XBase
@@ -16,19 +18,32 @@
 #include "smbase/overflow.h"                     // writeConvertedNumber
 #include "smbase/sm-env.h"                       // smbase::{getXDGStateHome, envAsIntOr}
 #include "smbase/sm-file-util.h"                 // SMFileUtil
-#include "smbase/sm-macros.h"                    // NULLABLE, OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-macros.h"                    // NULLABLE, OPEN_ANONYMOUS_NAMESPACE, NO_OBJECT_COPIES
 #include "smbase/string-util.h"                  // doubleQuote
 #include "smbase/syserr.h"                       // smbase::xsyserror
+#include "smbase/xassert.h"                      // xassertPrecondition
 
 // libc++
-#include <cstdlib>                               // std::min
+#include <algorithm>                             // std::max
+#include <condition_variable>                    // std::condition_variable
+#include <cstdlib>                               // std::min, std::_Exit
 #include <cstring>                               // std::strcmp
+#include <deque>                                 // std::deque
 #include <fstream>                               // std::ofstream
-#include <memory>                                // std::unique_ptr
-#include <sstream>                               // std::i/ostringstream
+#include <functional>                            // std::function
+#include <memory>                                // std::unique_ptr, std::shared_ptr
+#include <mutex>                                 // std::mutex, std::lock_guard
 #include <string>                                // std::string
+#include <thread>                                // std::thread
 #include <vector>                                // std::vector
 
+// libc
+#include <errno.h>                               // errno, EINTR
+#ifndef __WIN32__
+#  include <sys/uio.h>                           // writev, struct iovec
+#  include <unistd.h>                            // STDOUT_FILENO
+#endif
+
 using namespace smbase;
 
 
@@ -47,10 +62,15 @@ OPEN_ANONYMOUS_NAMESPACE
 // exists while handling exceptions, etc.
 ExclusiveWriteFile * NULLABLE logStream = nullptr;
 
+// Serializes writes to `logStream`, since requests are processed on
+// multiple threads.
+std::mutex logMutex;
+
 // Normal logging.
-#define LOG(stuff)                             \
-  if (logStream) {                             \
-    logStream->stream() << stuff << std::endl; \
+#define LOG(stuff)                                 \
+  if (logStream) {                                 \
+    std::lock_guard<std::mutex> logLock(logMutex); \
+    logStream->stream() << stuff << std::endl;     \
   }
 
 // Verbose logging, normally disabled.
@@ -61,6 +81,160 @@ ExclusiveWriteFile * NULLABLE logStream = nullptr;
 #endif
 
 
+// True once the version exchange has happened, after which every
+// message in both directions is a 4-byte NBO request ID followed by a
+// body wrapped by `vfsEncodeMessageBody`.
+//
+// This and `connectionCodec` are only written while no worker threads
+// are processing requests, and before any file is watched.
+bool useEnvelopes = false;
+
+// Codec negotiated during the version exchange.
+VFS_CompressionCodec connectionCodec = VFS_CC_NONE;
+
+// Serializes writes to stdout so replies from different threads do not
+// interleave.
+std::mutex outputMutex;
+
+
+// Pool of threads that process requests concurrently.
+class RequestPool {
+  NO_OBJECT_COPIES(RequestPool);
+
+private:     // data
+  // Protects all of the following.
+  std::mutex m_mutex;
+
+  // Signaled when a job is added or the pool is stopping.
+  std::condition_variable m_jobAvailable;
+
+  // Signaled when `m_numUnfinished` drops to zero.
+  std::condition_variable m_allFinished;
+
+  // Jobs not yet started, in submission order.
+  std::deque<std::function<void()>> m_jobs;
+
+  // Jobs submitted but not yet finished, whether queued or running.
+  int m_numUnfinished;
+
+  // Set by the destructor to make the workers exit.
+  bool m_stopping;
+
+  // The worker threads.
+  std::vector<std::thread> m_threads;
+
+private:     // methods
+  // Body of each worker thread.
+  void workerLoop();
+
+public:      // methods
+  // Start `numThreads` workers.
+  //
+  // Requires: numThreads >= 1
+  explicit RequestPool(int numThreads);
+
+  // Finish all submitted jobs, then stop the workers.
+  ~RequestPool();
+
+  // Queue `job` to run on some worker.
+  void submit(std::function<void()> job);
+
+  // Block until every submitted job has finished.
+  void waitUntilIdle();
+};
+
+
+RequestPool::RequestPool(int numThreads)
+  : m_mutex(),
+    m_jobAvailable(),
+    m_allFinished(),
+    m_jobs(),
+    m_numUnfinished(0),
+    m_stopping(false),
+    m_threads()
+{
+  xassertPrecondition(numThreads >= 1);
+  for (int i=0; i < numThreads; ++i) {
+    m_threads.emplace_back(&RequestPool::workerLoop, this);
+  }
+}
+
+
+RequestPool::~RequestPool()
+{
+  waitUntilIdle();
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_jobAvailable.notify_all();
+
+  for (std::thread &t : m_threads) {
+    t.join();
+  }
+}
+
+
+void RequestPool::submit(std::function<void()> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back(std::move(job));
+    ++m_numUnfinished;
+  }
+  m_jobAvailable.notify_one();
+}
+
+
+void RequestPool::waitUntilIdle()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_allFinished.wait(lock, [this] { return m_numUnfinished == 0; });
+}
+
+
+void RequestPool::workerLoop()
+{
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_jobAvailable.wait(lock,
+        [this] { return m_stopping || !m_jobs.empty(); });
+      if (m_jobs.empty()) {
+        // Stopping.
+        return;
+      }
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+
+    try {
+      job();
+    }
+    catch (XBase &x) {
+      // There is no way to hand this to the main thread, which is
+      // probably blocked reading stdin, so terminate here the same way
+      // `main` would.  The client sees the message on stderr.
+      LOG("editor-fs-server worker terminating with exception: " <<
+          x.why());
+      cerr << x.why() << endl;
+      std::_Exit(2);
+    }
+
+    bool nowIdle;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      nowIdle = (--m_numUnfinished == 0);
+    }
+    if (nowIdle) {
+      m_allFinished.notify_all();
+    }
+  }
+}
+
+
 // Read 'size' bytes from 'stream'.  Return false on EOF.  If we do not
 // get an immediate EOF, but still fail to read 'size' bytes, throw.
 bool freadAll(unsigned char *ptr, size_t size, FILE *stream)
@@ -122,64 +296,276 @@ void fwriteAll(void const *ptr, size_t size, FILE *stream)
 }
 
 
-// Read the next request from 'stream'.  A request consists of a 4-byte
-// length in network byte order, followed by that many bytes of message
-// contents, which are returned from this function as a string.
+// Read the next message from 'stream' into 'message', replacing its
+// contents.  A message consists of a 4-byte length in network byte
+// order, followed by that many bytes of message contents.
 //
-// If there are no more requests (the stream has been closed), return an
-// empty string.
-std::string receiveMessage(FILE *stream)
+// The caller passes the same vector each time so its capacity is
+// reused, and the contents can be deserialized in place.
+//
+// If there are no more messages (the stream has been closed), return
+// false.
+bool receiveMessage(FILE *stream, std::vector<unsigned char> &message)
 {
   // Read the message length.
   unsigned char buf[4];
   if (!freadAll(buf, 4, stream)) {
-    return "";
+    return false;
   }
   uint32_t len;
   deserializeIntNBO(buf, len);
 
   // Read the message contents.
-  std::vector<unsigned char> message(len);
-  if (!freadAll(message.data(), len, stream)) {
+  message.resize(len);
+  if (len > 0 && !freadAll(message.data(), len, stream)) {
     xfatal(stringb(
       "Got EOF when trying to read message with length " << len << "."));
   }
 
-  // In C++17, it is possible to write directly into string data, but I
-  // am currently targeting C++14, so I have to construct the string
-  // object as a separate step.
-  return std::string((char const *)(message.data()), len);
+  return true;
+}
+
+
+// One piece of an outgoing message.
+struct OutputPart {
+  void const *m_data;
+  size_t m_size;
+};
+
+
+// Write 'parts', in order, to stdout.  On POSIX this is a single
+// `writev` call (repeated if the write is partial), so a header and a
+// separately-allocated payload can be sent without first copying them
+// into one buffer.
+void writeParts(OutputPart const *parts, int numParts)
+{
+#ifdef __WIN32__
+  for (int i=0; i < numParts; ++i) {
+    fwriteAll(parts[i].m_data, parts[i].m_size, stdout);
+  }
+#else
+  enum { MAX_PARTS = 4 };
+  xassertPrecondition(numParts <= MAX_PARTS);
+
+  struct iovec iov[MAX_PARTS];
+  for (int i=0; i < numParts; ++i) {
+    iov[i].iov_base = const_cast<void*>(parts[i].m_data);
+    iov[i].iov_len = parts[i].m_size;
+  }
+
+  struct iovec *cur = iov;
+  int remaining = numParts;
+  while (remaining > 0) {
+    ssize_t res = writev(STDOUT_FILENO, cur, remaining);
+    LOG("writev returned " << res);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      xsyserror("writev");
+    }
+
+    // Skip what was written.
+    size_t written = static_cast<size_t>(res);
+    while (remaining > 0 && written >= cur->iov_len) {
+      written -= cur->iov_len;
+      ++cur;
+      --remaining;
+    }
+    if (remaining > 0) {
+      cur->iov_base = static_cast<char*>(cur->iov_base) + written;
+      cur->iov_len -= written;
+    }
+  }
+#endif
 }
 
 
-// Write the given reply to stdout.  The syntax is the same as for
-// requests: 4-byte NBO length, then that many bytes of message data.
-void sendMessage(FILE *stream, std::string const &reply)
+// Replies are serialized here.  Each thread has its own so they can
+// serialize concurrently, and the capacity is reused across replies.
+thread_local std::vector<unsigned char> replyBuffer;
+
+// If `replyBuffer` grows beyond this many bytes, its memory is released
+// after the reply is sent, so one huge reply does not pin that much
+// memory in every worker thread.
+size_t const MAX_RETAINED_REPLY_BUFFER = 16 << 20;
+
+
+// Send 'msg' as a message on stdout, as the reply to 'wireID'.
+//
+// The message is serialized directly after space reserved for the
+// header (length, and when using envelopes, the wire ID and codec
+// byte), so an uncompressed reply goes out with one write and no
+// copies.
+void sendReply(VFS_WireID wireID, VFS_Message const &msg)
 {
-  // Send length.
+  size_t const headerLen = useEnvelopes? 4+4+1 : 4;
+
+  std::vector<unsigned char> &buf = replyBuffer;
+  buf.clear();
+  buf.resize(headerLen);
+  {
+    BufferFlatten flatOutput(buf);
+    msg.serialize(flatOutput);
+  }
+  char const *body = reinterpret_cast<char const *>(buf.data()) + headerLen;
+  size_t const bodyLen = buf.size() - headerLen;
+  LOG_VERBOSE("reply body: " << bodyLen << " bytes");
+
+  OutputPart parts[2];
+  int numParts = 1;
+  std::string compressed;
+  if (useEnvelopes &&
+      vfsCompressMessageBody(connectionCodec, body, bodyLen, compressed)) {
+    // The serialized body is no longer needed; its first four bytes
+    // become the uncompressed length, and the compressed data follows
+    // as a separate part.
+    uint32_t rawLen;
+    writeConvertedNumber(rawLen, bodyLen);
+    buf.resize(headerLen + 4);
+    serializeIntNBO(buf.data() + headerLen, rawLen);
+    buf[headerLen-1] = static_cast<unsigned char>(VFS_CC_LZ);
+
+    parts[1] = OutputPart{compressed.data(), compressed.size()};
+    numParts = 2;
+  }
+  else if (useEnvelopes) {
+    buf[headerLen-1] = static_cast<unsigned char>(VFS_CC_NONE);
+  }
+  parts[0] = OutputPart{buf.data(), buf.size()};
+
+  // Fill in the rest of the header.
+  size_t totalSize = buf.size();
+  if (numParts == 2) {
+    totalSize += compressed.size();
+  }
   uint32_t len;
-  writeConvertedNumber(len, reply.size());
-  unsigned char buf[4];
-  serializeIntNBO(buf, len);
-  fwriteAll(buf, 4, stream);
+  writeConvertedNumber(len, totalSize - 4);
+  serializeIntNBO(buf.data(), len);
+  if (useEnvelopes) {
+    serializeIntNBO(buf.data() + 4, wireID);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    writeParts(parts, numParts);
+  }
 
-  // Send contents.
-  fwriteAll(reply.data(), len, stream);
+  if (buf.capacity() > MAX_RETAINED_REPLY_BUFFER) {
+    std::vector<unsigned char>().swap(buf);
+  }
 }
 
 
-// Send 'msg' as a message on stdout.
-void sendReply(VFS_Message const &msg)
+// True if requests of type `mt` must be processed in order relative to
+// all other requests.  These modify the file system or the connection,
+// so overlapping them with other requests could let a read observe the
+// state from before an earlier write, or after a later one.
+bool requiresExclusiveProcessing(VFS_MessageType mt)
 {
-  // Serialize the reply.
-  std::ostringstream oss;
-  StreamFlatten flatOutput(&oss);
-  msg.serialize(flatOutput);
-
-  // Send it.
-  std::string replyData = oss.str();
-  LOG_VERBOSE("replyData: " << doubleQuote(replyData));
-  sendMessage(stdout, replyData);
+  switch (mt) {
+    case VFS_MT_GetVersion:
+    case VFS_MT_WriteFileRequest:
+    case VFS_MT_DeleteFileRequest:
+    case VFS_MT_MakeDirectoryRequest:
+    case VFS_MT_WriteFileRangeRequest:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+
+// Compute and send the reply to `message`, which arrived as `wireID`.
+// This may run on a worker thread.
+void processRequest(VFS_LocalImpl &localImpl,
+                    VFS_FileWatcher &fileWatcher,
+                    unsigned artificialDelay,
+                    VFS_WireID wireID,
+                    VFS_Message const *message)
+{
+  if (artificialDelay) {
+    LOG("sleeping for " << artificialDelay << " ms");
+    sleepForMilliseconds(artificialDelay);
+  }
+
+  switch (message->messageType()) {
+    default:
+      xformat(stringb("Bad message type: " << message->messageType()));
+
+    case VFS_MT_GetVersion: {
+      // For now, have the server just ignore the incoming version
+      // number, and let the client diagnose mismatches.  But do honor
+      // its compression request, falling back to what we support.
+      VFS_GetVersion const *request = message->asGetVersionC();
+      VFS_GetVersion reply;
+      reply.m_compressionCodec =
+        vfsNegotiateCodec(request->m_compressionCodec);
+      sendReply(wireID, reply);
+
+      // The reply itself goes out without an envelope since the client
+      // does not know the codec until it reads it.
+      connectionCodec =
+        static_cast<VFS_CompressionCodec>(reply.m_compressionCodec);
+      useEnvelopes = true;
+      LOG("using codec " << toString(connectionCodec));
+      break;
+    }
+
+    case VFS_MT_Echo: {
+      VFS_Echo const *echo = message->asEchoC();
+      sendReply(wireID, *echo);
+      break;
+    }
+
+    case VFS_MT_FileStatusRequest: {
+      VFS_FileStatusRequest const *pathRequest = message->asFileStatusRequestC();
+      VFS_FileStatusReply pathReply(localImpl.queryPath(*pathRequest));
+      sendReply(wireID, pathReply);
+      break;
+    }
+
+    case VFS_MT_ReadFileRequest:
+      sendReply(wireID, localImpl.readFile(*(message->asReadFileRequestC())));
+      break;
+
+    case VFS_MT_WriteFileRequest:
+      sendReply(wireID, localImpl.writeFile(*(message->asWriteFileRequestC())));
+      break;
+
+    case VFS_MT_DeleteFileRequest:
+      sendReply(wireID, localImpl.deleteFile(*(message->asDeleteFileRequestC())));
+      break;
+
+    case VFS_MT_GetDirEntriesRequest:
+      sendReply(wireID, localImpl.getDirEntries(*(message->asGetDirEntriesRequestC())));
+      break;
+
+    case VFS_MT_MakeDirectoryRequest:
+      sendReply(wireID, localImpl.makeDirectory(*(message->asMakeDirectoryRequestC())));
+      break;
+
+    case VFS_MT_ReadFileRangeRequest:
+      sendReply(wireID, localImpl.readFileRange(*(message->asReadFileRangeRequestC())));
+      break;
+
+    case VFS_MT_WriteFileRangeRequest:
+      sendReply(wireID, localImpl.writeFileRange(*(message->asWriteFileRangeRequestC())));
+      break;
+
+    case VFS_MT_ReadFileLinesRequest:
+      sendReply(wireID, localImpl.readFileLines(*(message->asReadFileLinesRequestC())));
+      break;
+
+    case VFS_MT_WatchFileRequest:
+      sendReply(wireID, fileWatcher.watchFile(*(message->asWatchFileRequestC())));
+      break;
+
+    case VFS_MT_UnwatchFileRequest:
+      sendReply(wireID, fileWatcher.unwatchFile(*(message->asUnwatchFileRequestC())));
+      break;
+  }
 }
 
 
@@ -187,6 +573,15 @@ int innerMain()
 {
   VFS_LocalImpl localImpl;
 
+  // Changes to watched files are pushed to the client as they happen,
+  // interleaved with the replies.  This must outlive `pool`, whose
+  // workers can use it.
+  VFS_FileWatcher fileWatcher(
+    [](VFS_FileChangeNotification const &notification) {
+      LOG_VERBOSE("notification: " << notification.description());
+      sendReply(VFS_notificationWireID, notification);
+    });
+
   // Allow an artificial delay to be inserted into message processing
   // for testing purposes.
   unsigned artificialDelay = 0;
@@ -194,69 +589,56 @@ int innerMain()
     artificialDelay = (unsigned)atoi(d);
   }
 
-  while (true) {
-    // Get the next serialized request.
-    std::string requestData = receiveMessage(stdin);
-    if (requestData.empty()) {
-      // No more requests.
-      break;
+  // Requests that only read are handed to these threads, so a slow one
+  // (say, a large directory on a network mount) does not hold up the
+  // others behind it.
+  RequestPool pool(std::max(1, envAsIntOr(4, "EDITOR_FS_SERVER_THREADS")));
+
+  // Requests are read into this buffer, which is reused so its
+  // capacity only has to be allocated once, and deserialized from it in
+  // place.
+  std::vector<unsigned char> requestData;
+
+  // Holds the decompressed body of a compressed request.
+  std::string decompressed;
+
+  // Get the next serialized request, until there are no more.
+  while (receiveMessage(stdin, requestData)) {
+    char const *body = reinterpret_cast<char const *>(requestData.data());
+    size_t bodyLen = requestData.size();
+
+    VFS_WireID wireID = 0;
+    if (useEnvelopes) {
+      if (bodyLen < 4) {
+        xformat(stringb(
+          "Request of " << bodyLen <<
+          " bytes is too short to have an ID."));
+      }
+      deserializeIntNBO(requestData.data(), wireID);
+      body = vfsDecodeMessageBodyView(body+4, bodyLen-4,
+                                      decompressed, bodyLen /*OUT*/);
     }
-    LOG_VERBOSE("requestData: " << doubleQuote(requestData));
+    LOG_VERBOSE("request body: " << bodyLen << " bytes");
 
-    // Deserialize the request.
-    std::istringstream iss(requestData);
-    StreamFlatten flatInput(&iss);
-    std::unique_ptr<VFS_Message> message(
+    // Deserialize the request.  This copies what it needs out of the
+    // buffer, so the buffer can be reused for the next request.
+    BufferFlatten flatInput(reinterpret_cast<unsigned char const *>(body),
+                            bodyLen);
+    std::shared_ptr<VFS_Message> message(
       VFS_Message::deserialize(flatInput));
 
-    if (artificialDelay) {
-      LOG("sleeping for " << artificialDelay << " ms");
-      sleepForMilliseconds(artificialDelay);
-    }
-
     // Process it.
-    switch (message->messageType()) {
-      default:
-        xformat(stringb("Bad message type: " << message->messageType()));
-
-      case VFS_MT_GetVersion:
-        // For now, have the server just ignore the incoming version
-        // number, and let the client diagnose mismatches.
-        sendReply(VFS_GetVersion());
-        break;
-
-      case VFS_MT_Echo: {
-        VFS_Echo const *echo = message->asEchoC();
-        sendReply(*echo);
-        break;
-      }
-
-      case VFS_MT_FileStatusRequest: {
-        VFS_FileStatusRequest const *pathRequest = message->asFileStatusRequestC();
-        VFS_FileStatusReply pathReply(localImpl.queryPath(*pathRequest));
-        sendReply(pathReply);
-        break;
-      }
-
-      case VFS_MT_ReadFileRequest:
-        sendReply(localImpl.readFile(*(message->asReadFileRequestC())));
-        break;
-
-      case VFS_MT_WriteFileRequest:
-        sendReply(localImpl.writeFile(*(message->asWriteFileRequestC())));
-        break;
-
-      case VFS_MT_DeleteFileRequest:
-        sendReply(localImpl.deleteFile(*(message->asDeleteFileRequestC())));
-        break;
-
-      case VFS_MT_GetDirEntriesRequest:
-        sendReply(localImpl.getDirEntries(*(message->asGetDirEntriesRequestC())));
-        break;
-
-      case VFS_MT_MakeDirectoryRequest:
-        sendReply(localImpl.makeDirectory(*(message->asMakeDirectoryRequestC())));
-        break;
+    if (requiresExclusiveProcessing(message->messageType())) {
+      pool.waitUntilIdle();
+      processRequest(localImpl, fileWatcher, artificialDelay, wireID,
+                     message.get());
+    }
+    else {
+      pool.submit([&localImpl, &fileWatcher, artificialDelay, wireID,
+                   message]() {
+        processRequest(localImpl, fileWatcher, artificialDelay, wireID,
+                       message.get());
+      });
     }
   }
 
@@ -19,7 +19,10 @@
 #include "fail-reason-opt.h"                     // FailReasonOpt
 #include "json-rpc-reply.h"                      // JSON_RPC_Reply
 #include "keybindings.doc.gen.h"                 // doc_keybindings
+#include "line-count.h"                          // LineCount
 #include "line-index.h"                          // LineIndex
+#include "line-spine.h"                          // LineSpineKind
+#include "mapped-file.h"                         // MappedFile
 #include "lsp-client-manager.h"                  // LSPClientScope
 #include "lsp-client.h"                          // LSPClient, LSPDocumentInfo
 #include "lsp-conv.h"                            // convertLSPDiagsToTDD, toLSP_VersionNumber, lspSendUpdatedContents
@@ -29,6 +32,7 @@
 #include "open-files-dialog.h"                   // OpenFilesDialog
 #include "process-watcher.h"                     // ProcessWatcher
 #include "recent-items-list.h"                   // RecentItemsList
+#include "td-core.h"                             // TextDocumentCore
 #include "td-diagnostics.h"                      // TextDocumentDiagnostics (implicit)
 #include "textinput.h"                           // TextInputDialog
 #include "uri-util.h"                            // getFileURIPath
@@ -55,6 +59,7 @@
 #include "smbase/gdvalue-set.h"                  // gdv::toGDValue(std::set)
 #include "smbase/gdvalue-vector.h"               // gdv::toGDValue(std::vector)
 #include "smbase/gdvalue.h"                      // gdv::toGDValue
+#include "smbase/nonport.h"                      // getFileModificationTime, getMilliseconds
 #include "smbase/objcount.h"                     // CheckObjectCount
 #include "smbase/save-restore.h"                 // SET_RESTORE, SetRestore
 #include "smbase/set-util.h"                     // smbase::{setInsertUnique, setContains}
@@ -64,6 +69,7 @@
 #include "smbase/string-util.h"                  // beginsWith, shellDoubleQuoteCommand
 #include "smbase/stringb.h"                      // stringb
 #include "smbase/strtokp.h"                      // StrtokParse
+#include "smbase/syserr.h"                       // smbase::XSysError
 #include "smbase/sm-trace.h"                     // INIT_TRACE, etc.
 
 // Qt
@@ -72,9 +78,12 @@
 #include <QMessageBox>
 #include <QShortcutEvent>
 #include <QStyleFactory>
+#include <QTimerEvent>
 
 // libc++
 #include <algorithm>                             // std::max
+#include <cstddef>                               // std::size_t
+#include <cstdint>                               // std::int64_t
 #include <cstring>                               // std::{strlen, memcpy}
 #include <deque>                                 // std::deque
 #include <exception>                             // std::exception
@@ -102,6 +111,16 @@ char const EditorGlobal::appName[] = "Editor";
 
 int const EditorGlobal::MAX_NUM_RECENT_COMMANDS = 100;
 
+int const EditorGlobal::IDLE_MAINTENANCE_INTERVAL_MS = 500;
+
+int const EditorGlobal::IDLE_MAINTENANCE_DELAY_MS = 5000;
+
+int const EditorGlobal::IDLE_MAINTENANCE_BUDGET_MS = 20;
+
+int const EditorGlobal::IDLE_COMPACTION_SLICE_LINES = 10000;
+
+std::size_t const EditorGlobal::LINE_INDEX_SLICE_BYTES = 0x100000;
+
 
 EditorGlobal::EditorGlobal(int argc, char **argv)
   : QApplication(argc, argv),
@@ -117,6 +136,7 @@ EditorGlobal::EditorGlobal(int argc, char **argv)
     m_windowCounter(1),
     m_editorBuiltinFont(BF_EDITOR14),
     m_vfsConnections(),
+    m_documentFileWatcher(&m_documentList, &m_vfsConnections),
     m_processes(),
     m_openFilesDialog(),
     m_applyCommandDialogs(),
@@ -126,6 +146,12 @@ EditorGlobal::EditorGlobal(int argc, char **argv)
     m_recentCommands(),
     m_settings(),
     m_useUserSettingsFile(true),
+    m_idleMaintenanceTimerId(-1),
+    m_lineIndexTimerId(-1),
+    m_lastInputMS(getMilliseconds()),
+    m_mapFileThresholdBytes(
+      (std::size_t)std::max(0, envAsIntOr(0, "EDITOR_MAP_FILE_THRESHOLD_MB"))
+        * 1024 * 1024),
     m_filenameInputDialogHistory(),
     m_recordInputEvents(false),
     m_eventTestFileName(),
@@ -165,6 +191,11 @@ EditorGlobal::EditorGlobal(int argc, char **argv)
     m_editorBuiltinFont = BF_COURIER24;
   }
 
+  // Optionally store document lines in a tree rather than a gap array.
+  if (envAsBool("EDITOR_TREE_LINE_SPINE")) {
+    TextDocumentCore::s_defaultSpineKind = LineSpineKind::LSK_TREE;
+  }
+
   // Processing the command line.  Do this relatively early so it can
   // influence how `m_lspClient` is created.
   std::vector<std::string> filesToOpen;
@@ -183,6 +214,9 @@ EditorGlobal::EditorGlobal(int argc, char **argv)
   // Do this after setting the font since it depends on it.
   installEditorStyleSheet(*this);
 
+  m_idleMaintenanceTimerId =
+    this->startTimer(IDLE_MAINTENANCE_INTERVAL_MS);
+
   // Establish the initial VFS connection before creating the first
   // EditorWindow, since the EW can issue VFS requests.
   QObject::connect(&m_vfsConnections, &VFS_Connections::signal_vfsFailed,
@@ -246,6 +280,15 @@ EditorGlobal::EditorGlobal(int argc, char **argv)
 
 EditorGlobal::~EditorGlobal()
 {
+  if (m_idleMaintenanceTimerId != -1) {
+    this->killTimer(m_idleMaintenanceTimerId);
+    m_idleMaintenanceTimerId = -1;
+  }
+  if (m_lineIndexTimerId != -1) {
+    this->killTimer(m_lineIndexTimerId);
+    m_lineIndexTimerId = -1;
+  }
+
   // Destroy auxiliary dialogs.
   //
   // TODO: Destroy the others too.
@@ -662,6 +705,22 @@ bool EditorGlobal::reloadDocumentFile(QWidget *parentWidget,
                                       NamedTextDocument *doc)
 {
   if (doc->hasFilename()) {
+    // Huge local files are mapped rather than read.
+    bool mapped = false;
+    try {
+      SET_RESTORE(EditorWidget::s_ignoreTextDocumentNotificationsGlobally,
+        true);
+      mapped = replaceWithMappedFileIfLarge(doc, doc->harn());
+    }
+    catch (XSysError &x) {
+      messageBox(parentWidget, "Error", toQString(x.why()));
+      return false;
+    }
+    if (mapped) {
+      doc->notifyMetadataChange();
+      return true;
+    }
+
     SynchronousWaiter waiter(parentWidget);
     auto replyOrError(
       readFileSynchronously(&m_vfsConnections, waiter, doc->harn()));
@@ -681,16 +740,12 @@ bool EditorGlobal::reloadDocumentFile(QWidget *parentWidget,
     // The error case should have been handled above.
     xassert(rfr->m_success);
 
-    {
-      // Have widgets ignore the notifications arising from the refresh
-      // so their cursor position is not affected.
-      SET_RESTORE(EditorWidget::s_ignoreTextDocumentNotificationsGlobally,
-        true);
-
-      doc->replaceFileAndStats(rfr->m_contents,
-                               rfr->m_fileModificationTime,
-                               rfr->m_readOnly);
-    }
+    // Only the lines that changed are edited, and widgets follow those
+    // edits like any others, so a cursor on an unchanged line stays
+    // with its text.  The reload can be undone.
+    doc->updateFileAndStats(rfr->m_contents,
+                            rfr->m_fileModificationTime,
+                            rfr->m_readOnly);
 
     // Among other things, we want to let the LSP status indicator
     // update itself to show that the file contents have changed since
@@ -702,6 +757,33 @@ bool EditorGlobal::reloadDocumentFile(QWidget *parentWidget,
 }
 
 
+bool EditorGlobal::replaceWithMappedFileIfLarge(
+  NamedTextDocument *doc, HostAndResourceName const &harn)
+{
+  // The VFS server runs in a separate process, so its memory cannot be
+  // shared with ours.  Hence, only local files can be mapped, and they
+  // bypass the VFS.
+  if (!harn.isLocal() || m_mapFileThresholdBytes == 0) {
+    return false;
+  }
+
+  std::string fname = harn.resourceName();
+  std::optional<std::size_t> size = MappedFile::fileSizeOpt(fname);
+  if (!size || *size < m_mapFileThresholdBytes) {
+    return false;
+  }
+
+  std::int64_t modTime = 0;
+  (void)getFileModificationTime(fname.c_str(), modTime);
+
+  TRACE1("mapping " << doubleQuote(fname) << ", size " << *size);
+  doc->replaceFileAndStatsMapped(fname, modTime,
+                                 SMFileUtil().isReadOnly(fname));
+  startLineIndexing();
+  return true;
+}
+
+
 // ------------------------- Special documents -------------------------
 NamedTextDocument * NULLABLE
 EditorGlobal::findUntitledUnmodifiedDocument()
@@ -1574,8 +1656,118 @@ static std::string objectDesc(QObject const *obj)
 }
 
 
-// For debugging, this function allows me to inspect certain events as
-// they are dispatched.
+void EditorGlobal::performIdleMaintenance()
+{
+  // A document remapped after its file changed needs indexing too.
+  startLineIndexing();
+
+  long const startMS = getMilliseconds();
+  if (startMS - m_lastInputMS < IDLE_MAINTENANCE_DELAY_MS) {
+    // The user is active, so stay out of the way.
+    return;
+  }
+
+  for (int i=0; i < m_documentList.numDocuments(); i++) {
+    NamedTextDocument *doc = m_documentList.getDocumentAt(i);
+    while (doc->getCore().lineStorageNeedsCompaction()) {
+      if (getMilliseconds() - startMS >= IDLE_MAINTENANCE_BUDGET_MS) {
+        // Continue on the next tick.
+        return;
+      }
+
+      if (doc->compactLineStorageSlice(
+            LineCount(IDLE_COMPACTION_SLICE_LINES))) {
+        TRACE1("compacted line storage of " << doc->documentName());
+        break;
+      }
+    }
+  }
+}
+
+
+void EditorGlobal::startLineIndexing()
+{
+  if (m_lineIndexTimerId != -1) {
+    return;
+  }
+
+  for (int i=0; i < m_documentList.numDocuments(); i++) {
+    if (m_documentList.getDocumentAt(i)->lineIndexIsProvisional()) {
+      m_lineIndexTimerId = this->startTimer(0);
+      return;
+    }
+  }
+}
+
+
+void EditorGlobal::extendLineIndexes()
+{
+  long const startMS = getMilliseconds();
+
+  for (int i=0; i < m_documentList.numDocuments(); i++) {
+    NamedTextDocument *doc = m_documentList.getDocumentAt(i);
+    while (doc->lineIndexIsProvisional()) {
+      if (getMilliseconds() - startMS >= IDLE_MAINTENANCE_BUDGET_MS) {
+        // Continue on the next tick.
+        return;
+      }
+
+      if (doc->extendLineIndex(LINE_INDEX_SLICE_BYTES)) {
+        TRACE1("completed line index of " << doc->documentName());
+
+        // Remove the "[INDEXING]" indicator.
+        doc->notifyMetadataChange();
+      }
+    }
+  }
+
+  this->killTimer(m_lineIndexTimerId);
+  m_lineIndexTimerId = -1;
+}
+
+
+// True if `type` is a kind of event that means the user is actively
+// using the application.
+static bool isUserInputEvent(QEvent::Type type)
+{
+  switch (type) {
+    case QEvent::KeyPress:
+    case QEvent::KeyRelease:
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::MouseMove:
+    case QEvent::Wheel:
+    case QEvent::InputMethod:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+
+void EditorGlobal::timerEvent(QTimerEvent *event)
+{
+  if (event->timerId() == m_idleMaintenanceTimerId) {
+    GENERIC_CATCH_BEGIN
+    performIdleMaintenance();
+    GENERIC_CATCH_END
+  }
+  else if (event->timerId() == m_lineIndexTimerId) {
+    GENERIC_CATCH_BEGIN
+    extendLineIndexes();
+    GENERIC_CATCH_END
+  }
+  else {
+    this->QApplication::timerEvent(event);
+  }
+}
+
+
+// This records when the user last provided input, for
+// `performIdleMaintenance`.  Also, for debugging, this function allows
+// me to inspect certain events as they are dispatched.
 bool EditorGlobal::notify(QObject *receiver, QEvent *event)
 {
   static int s_eventCounter=0;
@@ -1583,6 +1775,10 @@ bool EditorGlobal::notify(QObject *receiver, QEvent *event)
 
   QEvent::Type const type = event->type();
 
+  if (isUserInputEvent(type)) {
+    m_lastInputMS = getMilliseconds();
+  }
+
   if (type == QEvent::KeyPress) {
     if (QKeyEvent const *keyEvent =
           dynamic_cast<QKeyEvent const *>(event)) {
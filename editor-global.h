@@ -12,6 +12,7 @@
 #include "command-runner-fwd.h"                  // CommandRunner [n]
 #include "connections-dialog-fwd.h"              // ConnectionsDialog [n]
 #include "diagnostic-details-dialog-fwd.h"       // DiagnosticDetailsDialog [n]
+#include "doc-file-watcher.h"                    // DocumentFileWatcher
 #include "doc-type.h"                            // DocumentType
 #include "eclf.h"                                // EditorCommandLineFunction, NUM_EDITOR_COMMAND_LINE_FUNCTIONS
 #include "editor-command.ast.gen.fwd.h"          // EditorCommand [n]
@@ -53,6 +54,7 @@
 #include <QApplication>
 
 // libc++
+#include <cstddef>                               // std::size_t
 #include <deque>                                 // std::deque
 #include <list>                                  // std::list
 #include <memory>                                // std::unique_ptr
@@ -76,6 +78,26 @@ public:      // class data
   // Maximum size of `m_recentCommand`.
   static int const MAX_NUM_RECENT_COMMANDS;
 
+  // Interval between runs of `performIdleMaintenance`.
+  static int const IDLE_MAINTENANCE_INTERVAL_MS;
+
+  // Time without user input after which the user is considered idle,
+  // so `performIdleMaintenance` does its work.
+  static int const IDLE_MAINTENANCE_DELAY_MS;
+
+  // Maximum time one run of `performIdleMaintenance` keeps working,
+  // so input that arrives meanwhile is not noticeably delayed.
+  static int const IDLE_MAINTENANCE_BUDGET_MS;
+
+  // Number of lines one compaction slice examines.  Between slices,
+  // `performIdleMaintenance` checks its time budget.
+  static int const IDLE_COMPACTION_SLICE_LINES;
+
+  // Number of bytes of a mapped file whose lines one slice of
+  // `extendLineIndexes` finds.  Between slices, it checks its time
+  // budget, which is `IDLE_MAINTENANCE_BUDGET_MS`.
+  static std::size_t const LINE_INDEX_SLICE_BYTES;
+
 private:     // instance data
   // Pixmap set.  This appears unused at first, but creating it sets a
   // global pointer that allows other classes to use it.
@@ -133,6 +155,10 @@ private:     // instance data
   // Connections to local and remote file systems.
   VFS_Connections m_vfsConnections;
 
+  // Keeps `m_modifiedOnDisk` of the documents in `m_documentList`
+  // current using notifications from the file system servers.
+  DocumentFileWatcher m_documentFileWatcher;
+
   // Running child processes.
   ObjList<ProcessWatcher> m_processes;
 
@@ -171,6 +197,25 @@ private:     // instance data
   // the real settings as a result of test behavior.
   bool m_useUserSettingsFile;
 
+  // Qt timer ID of the periodic timer that drives
+  // `performIdleMaintenance`.
+  int m_idleMaintenanceTimerId;
+
+  // Qt timer ID of the zero-interval timer that drives
+  // `extendLineIndexes` while some document's line index is
+  // provisional, or -1 if it is not running.
+  int m_lineIndexTimerId;
+
+  // Value of `getMilliseconds()` when the most recent user input event
+  // was dispatched, as recorded by `notify`.
+  long m_lastInputMS;
+
+  // Local files at least this large are opened by mapping them into
+  // memory rather than reading them through the VFS.  If zero, which
+  // is the default, files are never mapped.  Set, in megabytes, by
+  // envvar EDITOR_MAP_FILE_THRESHOLD_MB.
+  std::size_t m_mapFileThresholdBytes;
+
 public:      // data
   // Shared history for a dialog.
   FilenameInputDialog::History m_filenameInputDialogHistory;
@@ -188,6 +233,27 @@ public:      // data
   std::vector<gdv::GDValue> m_eventTestCommands;
 
 private:     // methods
+  // Do housekeeping that is not urgent, such as compacting the line
+  // storage of documents that have been heavily edited.  This is called
+  // periodically from the event loop, but only does anything once
+  // there has been no user input for `IDLE_MAINTENANCE_DELAY_MS`, and
+  // then only for `IDLE_MAINTENANCE_BUDGET_MS`, resuming on later
+  // calls where it left off.
+  void performIdleMaintenance();
+
+  // If some document's line index is provisional, and the timer that
+  // extends it is not running, start it.
+  void startLineIndexing();
+
+  // Extend the provisional line indexes of documents that map large
+  // files, for up to `IDLE_MAINTENANCE_BUDGET_MS`.  Unlike
+  // `performIdleMaintenance`, this runs whether or not the user is
+  // idle, since the documents are incomplete until it finishes, but
+  // being driven by a zero-interval timer, it only runs when there are
+  // no other events to process.  Stops the timer once every index is
+  // complete.
+  void extendLineIndexes();
+
   // Treat `fname` like a file specified on the command line, adding it
   // to `filesToOpen`.
   void addFileToOpenInitially(
@@ -303,6 +369,14 @@ public:       // funcs
   bool reloadDocumentFile(QWidget *parentWidget,
                           NamedTextDocument *f);
 
+  // If `harn` names a local file that is at least
+  // `m_mapFileThresholdBytes` long, replace the contents of `doc` with
+  // a mapping of it and return true.  Otherwise return false
+  // without changing `doc`.  Throws `XSysError` if the file cannot be
+  // mapped.
+  bool replaceWithMappedFileIfLarge(NamedTextDocument *doc,
+                                    HostAndResourceName const &harn);
+
   // ------------------------ Special documents ------------------------
   // Find a document that is untitled and has no modifications if one
   // exists.
@@ -562,6 +636,9 @@ public:       // funcs
   // QCoreApplication methods.
   virtual bool notify(QObject *receiver, QEvent *event) OVERRIDE;
 
+  // QObject methods.
+  virtual void timerEvent(QTimerEvent *event) OVERRIDE;
+
 Q_SIGNALS:
   // Emitted when `m_editorBuiltinFont` changes.
   void signal_editorFontChanged();
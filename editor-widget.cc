@@ -67,6 +67,7 @@
 #include "smbase/nonport.h"                      // getMilliseconds
 #include "smbase/objcount.h"                     // CHECK_OBJECT_COUNT
 #include "smbase/save-restore.h"                 // SetRestore
+#include "smbase/sm-env.h"                       // smbase::envAsIntOr
 #include "smbase/sm-file-util.h"                 // SMFileUtil
 #include "smbase/sm-trace.h"                     // INIT_TRACE, etc.
 #include "smbase/stringb.h"                      // stringb
@@ -89,9 +90,10 @@
 #include <QPoint>
 #include <QProgressDialog>
 #include <QRect>
+#include <QTimerEvent>
 
 // libc++
-#include <algorithm>                             // std::min
+#include <algorithm>                             // std::max, std::min
 #include <functional>                            // std::function
 #include <memory>                                // std::shared_ptr
 #include <optional>                              // std::{nullopt, optional}
@@ -173,6 +175,20 @@ EditorWidget::EditorWidget(NamedTextDocument *tdf,
     m_hitText(""),
     m_hitTextFlags(TextSearch::SS_CASE_INSENSITIVE),
     m_textSearch(),
+    m_lineCacheParams(),
+    m_lineCache(),
+    m_lineRenderCache(),
+    m_searchGeneration(0),
+    m_highlightSyncLineLimit(
+      std::max(0, envAsIntOr(2000, "EDITOR_HIGHLIGHT_SYNC_LINE_LIMIT"))),
+    m_highlightBudgetMS(
+      std::max(1, envAsIntOr(10, "EDITOR_HIGHLIGHT_BUDGET_MS"))),
+    m_highlightTimerId(-1),
+    m_provisionalHighlightLine(),
+    m_searchBackgroundLineThreshold(
+      std::max(0, envAsIntOr(100000, "EDITOR_SEARCH_BACKGROUND_LINES"))),
+    m_searchScanTimerId(-1),
+    m_scrollToHitWhenFound(false),
     m_topMargin(1),
     m_leftMargin(1),
     m_interLineSpace(0),
@@ -240,6 +256,8 @@ EditorWidget::~EditorWidget()
   EditorWidget::s_objectCount--;
 
   this->stopListening();
+  this->stopBackgroundHighlight();
+  this->stopSearchScanPoll();
 
   editorGlobal()->removeDocumentListObserver(this);
   editorGlobal()->removeRecentEditorWidget(this);
@@ -297,6 +315,23 @@ void EditorWidget::selfCheck() const
   xassert(m_textSearch->document() == m_editor->getDocumentCore());
   m_textSearch->selfCheck();
 
+  // Every cached line image shows the current search hits.
+  for (auto const &kv : m_lineCache) {
+    xassert(kv.second.m_searchGeneration == m_searchGeneration);
+
+    std::vector<TextSearch::MatchExtent> const &cachedHits =
+      kv.second.m_searchHits;
+    int const numHits = m_textSearch->countLineMatches(kv.first);
+    xassert(cachedHits.size() == (std::size_t)numHits);
+    if (numHits) {
+      ArrayStack<TextSearch::MatchExtent> const &hits =
+        m_textSearch->getLineMatches(kv.first);
+      for (int i=0; i < numHits; i++) {
+        xassert(cachedHits[i] == hits[i]);
+      }
+    }
+  }
+
   m_fontSet.selfCheck();
 }
 
@@ -397,6 +432,8 @@ void EditorWidget::setFonts(char const *normal, char const *italic, char const *
   m_fontHeight = m_fontAscent + m_fontDescent;
   xassert(m_fontHeight == bbox.height());    // check my assumptions
   m_fontWidth = bbox.width();
+
+  invalidateLineCache();
 }
 
 
@@ -423,6 +460,10 @@ void EditorWidget::setDocumentFile(NamedTextDocument *file)
   m_textSearch.reset(new TextSearch(m_editor->getDocumentCore()));
   this->setTextSearchParameters();
 
+  // The cached categories are for the previous document's lines.
+  m_lineRenderCache.clear();
+  m_provisionalHighlightLine.reset();
+
   // Move the chosen file to the top of the document list since it is
   // now the most recently used.
   editorGlobal()->makeDocumentTopmost(file);
@@ -432,8 +473,11 @@ void EditorWidget::setDocumentFile(NamedTextDocument *file)
   // Draw the current contents.
   this->redrawAfterContentChange();
 
-  // Then, issue a request to refresh those contents.
-  this->requestFileStatus();
+  // Then, issue a request to refresh those contents, unless the server
+  // is already telling us about changes to the file.
+  if (!file->m_fileIsWatched) {
+    this->requestFileStatus();
+  }
 }
 
 
@@ -539,7 +583,10 @@ void EditorWidget::on_vfsReplyAvailable(
           "Document modTime " << getDocument()->m_lastFileTimestamp <<
           " differs from reply modTime " << reply->m_fileModificationTime <<
           ", marking as modified on disk.");
-        getDocument()->m_modifiedOnDisk = true;
+        if (!getDocument()->remapChangedFile(
+               reply->m_fileModificationTime)) {
+          getDocument()->m_modifiedOnDisk = true;
+        }
         this->redraw();
       }
       else {
@@ -757,7 +804,7 @@ QImage EditorWidget::getScreenshot()
   QImage image(this->size(), QImage::Format_RGB32);
   {
     QPainter paint(&image);
-    this->paintFrame(paint);
+    this->paintFrame(paint, this->rect());
   }
   return image;
 }
@@ -976,50 +1023,194 @@ void EditorWidget::updateFrame(QPaintEvent *ev)
   // avoid flickering.
   QPainter winPaint(this);
 
-  this->paintFrame(winPaint);
+  this->paintFrame(winPaint, ev? ev->rect() : this->rect());
 }
 
-void EditorWidget::paintFrame(QPainter &winPaint)
+
+EditorWidget::LinePaintParams::LinePaintParams()
+  : m_width(0),
+    m_fullLineHeight(0),
+    m_firstCol(0),
+    m_visibleCols(0),
+    m_visibleWhitespace(false),
+    m_whitespaceOpacity(0),
+    m_highlightTrailingWhitespace(false),
+    m_softMarginColumn(0),
+    m_visibleSoftMargin(false),
+    m_tabWidth(0),
+    m_editor(nullptr),
+    m_highlighter(nullptr),
+    m_diagnostics(nullptr)
+{}
+
+
+bool EditorWidget::LinePaintParams::operator==(
+  LinePaintParams const &obj) const
 {
-  // ---- setup painters ----
-  // make a pixmap, so as to avoid flickering by double-buffering; the
-  // pixmap is the entire width of the window, but only one line high,
-  // so as to improve drawing locality and avoid excessive allocation
-  // in the server
-  int const lineWidth = width();
-  int const fullLineHeight = getFullLineHeight();
-  QPixmap pixmap(lineWidth, fullLineHeight);
+  return m_width == obj.m_width &&
+         m_fullLineHeight == obj.m_fullLineHeight &&
+         m_firstCol == obj.m_firstCol &&
+         m_visibleCols == obj.m_visibleCols &&
+         m_visibleWhitespace == obj.m_visibleWhitespace &&
+         m_whitespaceOpacity == obj.m_whitespaceOpacity &&
+         m_highlightTrailingWhitespace == obj.m_highlightTrailingWhitespace &&
+         m_softMarginColumn == obj.m_softMarginColumn &&
+         m_visibleSoftMargin == obj.m_visibleSoftMargin &&
+         m_tabWidth == obj.m_tabWidth &&
+         m_editor == obj.m_editor &&
+         m_highlighter == obj.m_highlighter &&
+         m_diagnostics == obj.m_diagnostics;
+}
 
-  // NOTE: This does not preclude drawing objects that span multiple
-  // lines, it just means that those objects need to be drawn one line
-  // segment at a time.  i.e., the interface must have clients insert
-  // objects into a display list, rather than drawing arbitrary things
-  // on a canvas.
 
-  // make the main painter, which will draw on the line pixmap; the
-  // font setting must be copied over manually
-  QPainter paint(&pixmap);
-  paint.setFont(font());
+EditorWidget::CachedLineImage::CachedLineImage()
+  : m_selStart(-1),
+    m_selLength(0),
+    m_showsNewline(false),
+    m_searchGeneration(0),
+    m_searchHits(),
+    m_pixmap()
+{}
 
-  // ---- setup style info ----
-  // when drawing text, erase background automatically
-  paint.setBackgroundMode(Qt::OpaqueMode);
 
-  // Character style info.  This gets updated as we paint each line.
-  LineCategoryAOAs modelCategories(TC_NORMAL);
+EditorWidget::LinePaintParams EditorWidget::getLinePaintParams() const
+{
+  LinePaintParams params;
+  params.m_width = width();
+  params.m_fullLineHeight = getFullLineHeight();
+  params.m_firstCol = firstVisibleCol();
+  params.m_visibleCols = visColsPlusPartial();
+  params.m_visibleWhitespace = m_visibleWhitespace;
+  params.m_whitespaceOpacity = m_whitespaceOpacity;
+  params.m_highlightTrailingWhitespace =
+    m_editor->m_namedDoc->highlightTrailingWhitespace();
+  params.m_softMarginColumn = m_softMarginColumn;
+  params.m_visibleSoftMargin = m_visibleSoftMargin;
+  params.m_tabWidth = m_editor->tabWidth();
+  params.m_editor = m_editor;
+  params.m_highlighter = m_editor->m_namedDoc->highlighter();
+  params.m_diagnostics = m_editor->m_namedDoc->getDiagnostics();
+  return params;
+}
 
-  // The style info, but expressed in layout coordinates.  For each
-  // line, we first compute 'modelCategories', then 'layoutCategories'
-  // is computed from the former.
-  LineCategoryAOAs layoutCategories(TC_NORMAL);
 
-  // Currently selected category and style (so we can avoid possibly
-  // expensive calls to change styles).
+void EditorWidget::invalidateLineCache()
+{
+  m_lineCache.clear();
+  m_lineRenderCache.clear();
+}
+
+
+void EditorWidget::invalidateLineCacheRange(
+  LineIndex changedFirst, LineIndex changedLast)
+{
+  LineIndex first = changedFirst;
+  LineIndex last = changedLast;
+  if (m_textSearch->matchesCanSpanLines()) {
+    int const reach = TextSearch::MAX_MATCH_LINES - 1;
+    first = LineIndex(std::max(0, changedFirst.get() - reach));
+    last = LineIndex(changedLast.get() + reach);
+  }
+
+  if (m_editor->m_namedDoc->highlighter()) {
+    m_lineCache.erase(m_lineCache.lower_bound(first), m_lineCache.end());
+    m_lineRenderCache.invalidateFrom(first);
+  }
+  else {
+    m_lineCache.erase(m_lineCache.lower_bound(first),
+                      m_lineCache.upper_bound(last));
+    m_lineRenderCache.invalidateRange(first, last);
+  }
+}
+
+
+void EditorWidget::shiftLineCache(LineIndex line, LineDifference delta)
+{
+  m_lineRenderCache.shiftLines(line, delta);
+
+  if (m_provisionalHighlightLine && *m_provisionalHighlightLine > line) {
+    // A line that was deleted is treated as if it were at `line`.
+    *m_provisionalHighlightLine = std::max(
+      line, *m_provisionalHighlightLine + delta);
+  }
+
+  if (m_lineCache.empty() || m_lineCache.rbegin()->first < line) {
+    return;
+  }
+
+  std::map<LineIndex, CachedLineImage> shifted;
+  for (auto &kv : m_lineCache) {
+    if (kv.first < line) {
+      shifted.emplace(kv.first, std::move(kv.second));
+    }
+    else if (delta.isNegative() && kv.first < line - delta) {
+      // This line was deleted.
+    }
+    else {
+      shifted.emplace(kv.first + delta, std::move(kv.second));
+    }
+  }
+  m_lineCache.swap(shifted);
+}
+
+
+std::optional<std::pair<int,int>> EditorWidget::selectionOverlayOnLine(
+  TextLCoordRange const &selRange, LineIndex line) const
+{
+  if (!( this->selectEnabled() &&
+         selRange.m_start.m_line <= line && line <= selRange.m_end.m_line )) {
+    return std::nullopt;
+  }
+
+  if (selRange.m_start.m_line < line && line < selRange.m_end.m_line) {
+    // entire line is selected
+    return std::make_pair(0, 0 /*infinite*/);
+  }
+  else if (selRange.m_start.m_line < line && line == selRange.m_end.m_line) {
+    // Left half of line is selected.
+    if (selRange.m_end.m_column) {
+      return std::make_pair(0, selRange.m_end.m_column.get());
+    }
+  }
+  else if (selRange.m_start.m_line == line && line < selRange.m_end.m_line) {
+    // Right half of line is selected.
+    return std::make_pair(selRange.m_start.m_column.get(), 0 /*infinite*/);
+  }
+  else if (selRange.m_start.m_line == line && line == selRange.m_end.m_line) {
+    // Middle part of line is selected.
+    if (selRange.m_end.m_column != selRange.m_start.m_column) {
+      return std::make_pair(
+        selRange.m_start.m_column.get(),
+        (selRange.m_end.m_column - selRange.m_start.m_column).get());
+    }
+  }
+  else {
+    xfailure("messed up my logic");
+  }
+
+  return std::nullopt;
+}
+
+
+void EditorWidget::paintFrame(QPainter &winPaint, QRect const &clipRect)
+{
+  int const lineWidth = width();
+  int const fullLineHeight = getFullLineHeight();
+
+  // If anything that affects every line changed, none of the cached
+  // images can be used.
+  {
+    LinePaintParams params(getLinePaintParams());
+    if (params != m_lineCacheParams) {
+      TRACE3("paintFrame: line paint parameters changed");
+      invalidateLineCache();
+      m_lineCacheParams = params;
+    }
+  }
+
+  // Set the background color for the margin.
   TextCategoryAndStyle textCategoryAndStyle(
     getTextCategoryAndStyle(TC_NORMAL));
-  textCategoryAndStyle.setDrawStyle(paint);
-
-  // do same for 'winPaint', just to set the background color
   textCategoryAndStyle.setDrawStyle(winPaint);
 
   // ---- margins ----
@@ -1032,188 +1223,404 @@ void EditorWidget::paintFrame(QPainter &winPaint)
   }
 
   // ---- remaining setup ----
-  // Visible area info.  The +1 here is to include the column after
-  // the last fully visible column, which might be partially visible.
-  ColumnCount const visibleCols = this->visColsPlusPartial();
-  ColumnIndex const firstCol = this->firstVisibleCol();
   LineIndex const firstLine = this->firstVisibleLine();
+  LineIndex const cursorLine = m_editor->cursor().m_line;
 
   // I think it might be useful to support negative values for these
   // variables, but the code below is not prepared to deal with such
   // values at this time
-  xassert(firstCol >= 0);
+  xassert(this->firstVisibleCol() >= 0);
 
   // another sanity check
   xassert(lineHeight() > 0);
 
-  // Buffer that will be used for each visible line of text.
-  ArrayStack<char> visibleText(visibleCols.get());
-
   // Get region of selected text.
   TextLCoordRange selRange = m_editor->getSelectLayoutRange();
 
+  // The cache as it will be after this frame: the entries for lines
+  // that are still visible.
+  std::map<LineIndex, CachedLineImage> newCache;
+
   // Paint the window, one line at a time.  Both 'line' and 'y' act
   // as loop control variables.
+  int numDrawn = 0;
   for (LineIndex line = firstLine;
        y < this->height();
        ++line, y += fullLineHeight)
   {
-    // ---- compute style segments ----
-    // Number of columns from this line that are visible.
-    ColumnCount visibleLineCols(0);
-
-    // nominally the entire line is normal text
-    modelCategories.clear(TC_NORMAL);
-    layoutCategories.clear(TC_NORMAL);
-
-    // This is 1 if we will behave as though a newline character is
-    // at the end of this line, 0 otherwise.
-    ColumnDifference newlineAdjust(0);
-    if (m_visibleWhitespace && line < m_editor->numLines().pred()) {
-      ++newlineAdjust;
+    bool const inClip =
+      clipRect.intersects(QRect(0, y, lineWidth, fullLineHeight));
+
+    // Per-line view state that determines whether a cached image can
+    // be used.
+    CachedLineImage key;
+    if (std::optional<std::pair<int,int>> sel =
+          selectionOverlayOnLine(selRange, line)) {
+      key.m_selStart = sel->first;
+      key.m_selLength = sel->second;
     }
-
-    // True if the cursor is on `line`.
-    bool const cursorOnCurrentLine =
-      (line == m_editor->cursor().m_line);
-
-    // Number of cells in the line, excluding newline.
-    ColumnCount const lineLengthColumns =
-      m_editor->lineLengthColumns(line);
-
-    // How many columns of trailing whitespace does this line have?
-    ColumnCount const lineTrailingWhitespaceCols =
-      cursorOnCurrentLine?
-        ColumnCount(0) :     // Don't highlight trailing WS on the cursor line.
-        m_editor->countTrailingSpacesTabsColumns(line);
-
-    // Column number within the visible window of the first trailing
-    // whitespace character.  All characters in the line at or beyond
-    // this value will be printed with a different background color.
-    ColumnDifference const startOfTrailingWhitespaceVisibleCol =
-      lineLengthColumns - lineTrailingWhitespaceCols - firstCol;
-
-    // Number of columns with glyphs on this line, including possible
-    // synthesized newline for 'visibleWhitespace'.  This value is
-    // independent of the window size or scroll position.
-    ColumnCount const lineGlyphColumns =
-      lineLengthColumns + newlineAdjust;
-
-    // fill with text from the file
-    visibleText.clear();
-    if (line < m_editor->numLines()) {
-      if (firstCol < lineGlyphColumns) {
-        // First get the text without any extra newline.
-        ColumnCount const visibleLengthColumns(lineLengthColumns - firstCol);
-        ColumnCount const amt = std::min(visibleLengthColumns, visibleCols);
-        m_editor->getLineLayout(TextLCoord(line, firstCol), visibleText, amt);
-        visibleLineCols = amt;
-
-        // Now possibly add the newline.
-        if (visibleLineCols < visibleCols && newlineAdjust != 0) {
-          visibleText.push('\n');
-          ++visibleLineCols;
-        }
-      }
-
-      // Apply syntax highlighting.
-      if (m_editor->m_namedDoc->highlighter()) {
-        m_editor->m_namedDoc->highlighter()
-          ->highlightTDE(m_editor, line, /*OUT*/ modelCategories);
-        m_editor->modelToLayoutSpans(line,
-          /*OUT*/ layoutCategories, /*IN*/ modelCategories);
+    key.m_showsNewline =
+      m_visibleWhitespace && line < m_editor->numLines().pred();
+
+    bool const cursorOnLine = (line == cursorLine);
+
+    auto it = m_lineCache.find(line);
+    if (!cursorOnLine &&
+        it != m_lineCache.end() &&
+        it->second.m_selStart == key.m_selStart &&
+        it->second.m_selLength == key.m_selLength &&
+        it->second.m_showsNewline == key.m_showsNewline) {
+      // Reuse the cached image.
+      if (inClip) {
+        winPaint.drawPixmap(0,y, it->second.m_pixmap);
       }
+      newCache.emplace(line, std::move(it->second));
+      continue;
+    }
 
-      // Show search hits.
-      this->addSearchMatchesToLineCategories(layoutCategories, line);
+    if (!inClip) {
+      // The image is missing or stale, but this line is not being
+      // painted now anyway.  It will be drawn when its area is.
+      continue;
     }
-    xassert(visibleLineCols <= visibleCols);
-    xassert(visibleText.length() == visibleLineCols);
 
-    // Fill the remainder of 'visibleText' with spaces.  These
-    // characters will only be used if there is style information out
-    // beyond the actual line character data.
+    // Draw the line to a pixmap, so as to avoid flickering by
+    // double-buffering.  The pixmap is the entire width of the window,
+    // but only one line high.
+    //
+    // NOTE: This does not preclude drawing objects that span multiple
+    // lines, it just means that those objects need to be drawn one line
+    // segment at a time.  i.e., the interface must have clients insert
+    // objects into a display list, rather than drawing arbitrary things
+    // on a canvas.
+    key.m_searchGeneration = m_searchGeneration;
+    if (m_textSearch->countLineMatches(line)) {
+      ArrayStack<TextSearch::MatchExtent> const &hits =
+        m_textSearch->getLineMatches(line);
+      key.m_searchHits.assign(hits.getArray(),
+                              hits.getArray() + hits.length());
+    }
+    key.m_pixmap = QPixmap(lineWidth, fullLineHeight);
     {
-      ColumnCount remainderLen(visibleCols - visibleLineCols);
-      memset(visibleText.ptrToPushedMultipleAlt(remainderLen.get()),
-             ' ', remainderLen.get());
+      QPainter paint(&key.m_pixmap);
+      paintLineImage(paint, line, selRange);
     }
-    xassert(visibleText.length() == visibleCols);
+    ++numDrawn;
 
-    // incorporate effect of selection
-    if (this->selectEnabled() &&
-        selRange.m_start.m_line <= line && line <= selRange.m_end.m_line)
-    {
-      if (selRange.m_start.m_line < line && line < selRange.m_end.m_line) {
-        // entire line is selected
-        layoutCategories.overlay(0, 0 /*infinite*/,
-          TOA_SELECTION);
-      }
-      else if (selRange.m_start.m_line < line && line == selRange.m_end.m_line) {
-        // Left half of line is selected.
-        if (selRange.m_end.m_column) {
-          layoutCategories.overlay(0, selRange.m_end.m_column.get(),
-            TOA_SELECTION);
-        }
-      }
-      else if (selRange.m_start.m_line == line && line < selRange.m_end.m_line) {
-        // Right half of line is selected.
-        layoutCategories.overlay(selRange.m_start.m_column.get(), 0 /*infinite*/,
-          TOA_SELECTION);
-      }
-      else if (selRange.m_start.m_line == line && line == selRange.m_end.m_line) {
-        // Middle part of line is selected.
-        if (selRange.m_end.m_column != selRange.m_start.m_column) {
-          layoutCategories.overlay(
-            selRange.m_start.m_column.get(),
-            (selRange.m_end.m_column - selRange.m_start.m_column).get(),
-            TOA_SELECTION);
-        }
-      }
-      else {
-        xfailure("messed up my logic");
-      }
+    // draw the line buffer to the window
+    winPaint.drawPixmap(0,y, key.m_pixmap);
+
+    if (!cursorOnLine) {
+      newCache.emplace(line, std::move(key));
     }
+  }
+  TRACE3("paintFrame: drew " << numDrawn << " lines, cached " <<
+         newCache.size());
+
+  m_lineCache.swap(newCache);
+
+  // Also draw indicators of number of matches offscreen.
+  this->drawOffscreenMatchIndicators(winPaint);
+
+  // If drawing left the highlighter with lines to catch up on,
+  // continue with that while idle.
+  this->startBackgroundHighlightIfNeeded();
+
+  // Likewise, if the search is still scanning (for example, because
+  // the document was reloaded), keep collecting its results.
+  this->startSearchScanPollIfNeeded();
+}
+
+
+void EditorWidget::paintLineImage(
+  QPainter &paint,
+  LineIndex line,
+  TextLCoordRange const &selRange)
+{
+  // The font setting must be copied over manually.
+  paint.setFont(font());
+
+  // ---- setup style info ----
+  // when drawing text, erase background automatically
+  paint.setBackgroundMode(Qt::OpaqueMode);
+
+  // Currently selected category and style (so we can avoid possibly
+  // expensive calls to change styles).
+  TextCategoryAndStyle textCategoryAndStyle(
+    getTextCategoryAndStyle(TC_NORMAL));
+  textCategoryAndStyle.setDrawStyle(paint);
 
-    // Iterator over line contents.  This is partially redundant with
-    // what is in 'visibleText', but needed to handle glyphs that span
-    // columns.  Perhaps I should remove 'visibleText' at some point.
-    TextDocumentEditor::LineIterator lineIter(*m_editor, line);
-    while (lineIter.has() && lineIter.columnOffset() < firstCol) {
-      lineIter.advByte();
+  // Visible area info.  The +1 here is to include the column after
+  // the last fully visible column, which might be partially visible.
+  ColumnCount const visibleCols = this->visColsPlusPartial();
+  ColumnIndex const firstCol = this->firstVisibleCol();
+
+  // Characters that will be drawn.
+  ArrayStack<char> visibleText(visibleCols.get());
+
+  // Character style info, expressed in layout coordinates.
+  LineCategoryAOAs layoutCategories(TC_NORMAL);
+
+  // ---- compute style segments ----
+  // Number of columns from this line that are visible.
+  ColumnCount visibleLineCols(0);
+
+  // This is 1 if we will behave as though a newline character is
+  // at the end of this line, 0 otherwise.
+  ColumnDifference newlineAdjust(0);
+  if (m_visibleWhitespace && line < m_editor->numLines().pred()) {
+    ++newlineAdjust;
+  }
+
+  // True if the cursor is on `line`.
+  bool const cursorOnCurrentLine =
+    (line == m_editor->cursor().m_line);
+
+  // Number of cells in the line, excluding newline.
+  ColumnCount const lineLengthColumns =
+    m_editor->lineLengthColumns(line);
+
+  // How many columns of trailing whitespace does this line have?
+  ColumnCount const lineTrailingWhitespaceCols =
+    cursorOnCurrentLine?
+      ColumnCount(0) :     // Don't highlight trailing WS on the cursor line.
+      m_editor->countTrailingSpacesTabsColumns(line);
+
+  // Column number within the visible window of the first trailing
+  // whitespace character.  All characters in the line at or beyond
+  // this value will be printed with a different background color.
+  ColumnDifference const startOfTrailingWhitespaceVisibleCol =
+    lineLengthColumns - lineTrailingWhitespaceCols - firstCol;
+
+  // Number of columns with glyphs on this line, including possible
+  // synthesized newline for 'visibleWhitespace'.  This value is
+  // independent of the window size or scroll position.
+  ColumnCount const lineGlyphColumns =
+    lineLengthColumns + newlineAdjust;
+
+  // fill with text from the file
+  if (line < m_editor->numLines()) {
+    if (firstCol < lineGlyphColumns) {
+      // First get the text without any extra newline.
+      ColumnCount const visibleLengthColumns(lineLengthColumns - firstCol);
+      ColumnCount const amt = std::min(visibleLengthColumns, visibleCols);
+      m_editor->getLineLayout(TextLCoord(line, firstCol), visibleText, amt);
+      visibleLineCols = amt;
+
+      // Now possibly add the newline.
+      if (visibleLineCols < visibleCols && newlineAdjust != 0) {
+        visibleText.push('\n');
+        ++visibleLineCols;
+      }
     }
 
-    // Given that we have chosen how to render the line, storing that
-    // information primarily into `visibleText` (chars to draw) and
-    // `layoutCategories` (how to draw them), draw the line to `paint`.
-    paintOneLine(
+    // Apply syntax highlighting and show search hits.
+    this->getLayoutCategories(line, /*OUT*/ layoutCategories);
+  }
+  xassert(visibleLineCols <= visibleCols);
+  xassert(visibleText.length() == visibleLineCols);
+
+  // Fill the remainder of 'visibleText' with spaces.  These
+  // characters will only be used if there is style information out
+  // beyond the actual line character data.
+  {
+    ColumnCount remainderLen(visibleCols - visibleLineCols);
+    memset(visibleText.ptrToPushedMultipleAlt(remainderLen.get()),
+           ' ', remainderLen.get());
+  }
+  xassert(visibleText.length() == visibleCols);
+
+  // incorporate effect of selection
+  if (std::optional<std::pair<int,int>> sel =
+        selectionOverlayOnLine(selRange, line)) {
+    layoutCategories.overlay(sel->first, sel->second, TOA_SELECTION);
+  }
+
+  // Iterator over line contents.  This is partially redundant with
+  // what is in 'visibleText', but needed to handle glyphs that span
+  // columns.  Perhaps I should remove 'visibleText' at some point.
+  TextDocumentEditor::LineIterator lineIter(*m_editor, line);
+  while (lineIter.has() && lineIter.columnOffset() < firstCol) {
+    lineIter.advByte();
+  }
+
+  // Given that we have chosen how to render the line, storing that
+  // information primarily into `visibleText` (chars to draw) and
+  // `layoutCategories` (how to draw them), draw the line to `paint`.
+  paintOneLine(
+    paint,
+    visibleLineCols,
+    startOfTrailingWhitespaceVisibleCol,
+    layoutCategories,
+    visibleText,
+    std::move(lineIter),
+    /*INOUT*/ textCategoryAndStyle);
+
+  drawDiagnosticBoxes(paint, line);
+
+  // Draw the cursor on the line it is on.
+  if (cursorOnCurrentLine) {
+    drawCursorOnLine(
       paint,
-      visibleLineCols,
-      startOfTrailingWhitespaceVisibleCol,
       layoutCategories,
       visibleText,
-      std::move(lineIter),
-      /*INOUT*/ textCategoryAndStyle);
-
-    drawDiagnosticBoxes(paint, line);
-
-    // Draw the cursor on the line it is on.
-    if (cursorOnCurrentLine) {
-      drawCursorOnLine(
-        paint,
-        layoutCategories,
-        visibleText,
-        lineGlyphColumns);
+      lineGlyphColumns);
+  }
+
+  drawSoftMarginIndicator(paint);
+}
+
+
+void EditorWidget::getLayoutCategories(
+  LineIndex line,
+  LineCategoryAOAs /*OUT*/ &layoutCategories)
+{
+  TD_VersionNumber const version =
+    m_editor->getDocumentCore()->getVersionNumber();
+  ColumnCount const tabWidth = m_editor->tabWidth();
+
+  if (LineCategoryAOAs const *cached = m_lineRenderCache.find(
+        line, version, tabWidth, m_searchGeneration)) {
+    layoutCategories = *cached;
+    return;
+  }
+
+  bool exact = true;
+  layoutCategories = LineCategoryAOAs(TC_NORMAL);
+  if (Highlighter *highlighter = m_editor->m_namedDoc->highlighter()) {
+    LineCategoryAOAs modelCategories(TC_NORMAL);
+    exact = highlighter->highlightTDEWithinLimit(m_editor, line,
+      m_highlightSyncLineLimit, /*OUT*/ modelCategories);
+    m_editor->modelToLayoutSpans(line,
+      /*OUT*/ layoutCategories, /*IN*/ modelCategories);
+  }
+  this->addSearchMatchesToLineCategories(layoutCategories, line);
+
+  if (exact) {
+    m_lineRenderCache.insert(
+      line, version, tabWidth, m_searchGeneration, layoutCategories);
+  }
+  else {
+    // Remember to redraw this line when the real highlighting is
+    // known.  The image cache will still hold the provisional
+    // drawing, but `backgroundHighlightStep` invalidates it.
+    if (!m_provisionalHighlightLine || line < *m_provisionalHighlightLine) {
+      m_provisionalHighlightLine = line;
     }
+  }
+}
 
-    drawSoftMarginIndicator(paint);
 
-    // draw the line buffer to the window
-    winPaint.drawPixmap(0,y, pixmap);    // draw it
+void EditorWidget::startBackgroundHighlightIfNeeded()
+{
+  Highlighter *highlighter = m_editor->m_namedDoc->highlighter();
+  if (m_highlightTimerId == -1 &&
+      highlighter && highlighter->hasBackgroundWork()) {
+    TRACE2("starting background highlighting");
+
+    // A zero interval means the timer fires whenever the event queue
+    // is otherwise empty, so this only uses idle time.
+    m_highlightTimerId = this->startTimer(0);
   }
+}
 
-  // Also draw indicators of number of matches offscreen.
-  this->drawOffscreenMatchIndicators(winPaint);
+
+void EditorWidget::stopBackgroundHighlight()
+{
+  if (m_highlightTimerId != -1) {
+    this->killTimer(m_highlightTimerId);
+    m_highlightTimerId = -1;
+  }
+}
+
+
+void EditorWidget::backgroundHighlightStep()
+{
+  Highlighter *highlighter = m_editor->m_namedDoc->highlighter();
+  if (!highlighter || !highlighter->hasBackgroundWork()) {
+    // Another widget on the same document may have finished the job.
+    stopBackgroundHighlight();
+  }
+  else {
+    highlighter->highlightInBackground(m_highlightBudgetMS);
+    if (!highlighter->hasBackgroundWork()) {
+      TRACE2("background highlighting finished");
+      stopBackgroundHighlight();
+    }
+  }
+
+  if (m_provisionalHighlightLine &&
+      (!highlighter || highlighter->lineIsReady(*m_provisionalHighlightLine))) {
+    TRACE2("redrawing provisionally highlighted lines starting at " <<
+           *m_provisionalHighlightLine);
+    invalidateLineCacheFrom(*m_provisionalHighlightLine);
+    m_provisionalHighlightLine.reset();
+    update();
+  }
+}
+
+
+void EditorWidget::startSearchScanPollIfNeeded()
+{
+  if (m_searchScanTimerId == -1 && m_textSearch->isScanning()) {
+    TRACE2("polling for background search results");
+
+    // Unlike highlighting, the work happens on other threads, so
+    // there is no need to poll whenever idle.
+    m_searchScanTimerId = this->startTimer(50 /*ms*/);
+  }
+}
+
+
+void EditorWidget::stopSearchScanPoll()
+{
+  if (m_searchScanTimerId != -1) {
+    this->killTimer(m_searchScanTimerId);
+    m_searchScanTimerId = -1;
+  }
+}
+
+
+void EditorWidget::searchScanPollStep()
+{
+  if (m_textSearch->mergeBackgroundResults()) {
+    // Hits may have appeared on visible lines.
+    ++m_searchGeneration;
+    invalidateLineCache();
+
+    if (m_scrollToHitWhenFound &&
+        (this->scrollToNextSearchHit(false /*reverse*/, false /*select*/) ||
+         this->scrollToNextSearchHit(true /*reverse*/, false /*select*/))) {
+      m_scrollToHitWhenFound = false;
+    }
+  }
+
+  if (!m_textSearch->isScanning()) {
+    TRACE2("background search finished");
+    stopSearchScanPoll();
+    m_scrollToHitWhenFound = false;
+  }
+
+  // Update the match counts.
+  redraw();
+}
+
+
+void EditorWidget::timerEvent(QTimerEvent *event) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  if (event->timerId() == m_highlightTimerId) {
+    backgroundHighlightStep();
+  }
+  else if (event->timerId() == m_searchScanTimerId) {
+    searchScanPollStep();
+  }
+  else {
+    this->QWidget::timerEvent(event);
+  }
+
+  GENERIC_CATCH_END
 }
 
 
@@ -1263,8 +1670,8 @@ void EditorWidget::paintOneLine(
   // that is unfinished.
   TextDocumentEditor::LineIterator &&lineIter,
 
-  // Current text styling details, carried forward from line to line as
-  // we work our way down the widget area.
+  // Current text styling details for `paint`, updated as the style
+  // changes along the line.
   TextCategoryAndStyle /*INOUT*/ &textCategoryAndStyle)
 {
   xassert(visibleLineCols <= visibleText.length());
@@ -1741,11 +2148,15 @@ void EditorWidget::addSearchMatchesToLineCategories(
     for (int i=0; i < matches.length(); i++) {
       TextSearch::MatchExtent const &m = matches[i];
       if (m.m_lengthBytes) {
+        // A match that spans lines is only shown on its first line.
+        ByteIndex endByte(m.m_startByte + m.m_lengthBytes);
+        endByte = std::min(endByte, m_editor->lineLengthByteIndex(line));
+
         // Convert match extent to layout coordinates since
         // 'categories' is indexed by column, not byte.
         TextMCoordRange mrange(
           TextMCoord(line, m.m_startByte),
-          TextMCoord(line, m.m_startByte + m.m_lengthBytes));
+          TextMCoord(line, endByte));
         TextLCoordRange lrange(m_editor->toLCoordRange(mrange));
         ColumnCount columns(lrange.m_end.m_column - lrange.m_start.m_column);
 
@@ -2505,7 +2916,16 @@ std::string EditorWidget::markPositionUIString() const
 
 void EditorWidget::setTextSearchParameters()
 {
+  m_textSearch->setBackgroundScanLineThreshold(
+    m_searchBackgroundLineThreshold);
   m_textSearch->setSearchStringAndFlags(m_hitText, m_hitTextFlags);
+  ++m_searchGeneration;
+
+  // The cached line images show the old hits.
+  invalidateLineCache();
+
+  m_scrollToHitWhenFound = false;
+  this->startSearchScanPollIfNeeded();
 }
 
 
@@ -2523,8 +2943,12 @@ void EditorWidget::setSearchStringParams(string const &searchString,
   if (scrollToHit) {
     // Find the first occurrence on or after the cursor; or, failing
     // that, first occurrence before it.
-    this->scrollToNextSearchHit(false /*reverse*/, false /*select*/) ||
-      this->scrollToNextSearchHit(true /*reverse*/, false /*select*/);
+    if (!this->scrollToNextSearchHit(false /*reverse*/, false /*select*/) &&
+        !this->scrollToNextSearchHit(true /*reverse*/, false /*select*/)) {
+      // If the search is running in the background, try again when
+      // it finds something.
+      m_scrollToHitWhenFound = m_textSearch->isScanning();
+    }
   }
 
   redraw();
@@ -3543,6 +3967,13 @@ void EditorWidget::startListening()
 void EditorWidget::observeInsertLine(TextDocumentCore const &buf, LineIndex line) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
+
+  // The cached line images have to follow the document even when the
+  // change is one that we initiated.
+  shiftLineCache(line, LineDifference(+1));
+  invalidateLineCacheFrom(line);
+  m_lineRenderCache.setVersion(buf.getVersionNumber());
+
   if (ignoringChangeNotifications()) {
     TRACE2("IGNORING: observeInsertLine line=" << line);
     return;
@@ -3557,13 +3988,12 @@ void EditorWidget::observeInsertLine(TextDocumentCore const &buf, LineIndex line
   bool keepCursorStationary =
     (m_editor->documentProcessStatus() != DPS_RUNNING);
 
-  // Internally inside HE_text::insert(), the routine that actually
-  // inserts text, inserting "line N" works by removing the text on
-  // line N, inserting a new line N+1, then putting that text back on
-  // line N+1.  It's sort of weird, and calls into question how much
-  // observers ought to know about the mechanism.  But for now at least
-  // I will compensate here by changing the line number to match what I
-  // think of as the conceptually inserted line.
+  // Inserting "line N" as a sequence of core operations works by
+  // removing the text on line N, inserting a new line N+1, then
+  // putting that text back on line N+1.  (HE_text::insert() used to do
+  // exactly that; it now makes one `replaceRange` call, which arrives
+  // as `observeReplaceRange`.)  Compensate here by changing the line
+  // number to match what I think of as the conceptually inserted line.
   line.clampIncrease(LineDifference(-1));
 
   if (line <= m_editor->cursor().m_line) {
@@ -3587,6 +4017,10 @@ void EditorWidget::observeInsertLine(TextDocumentCore const &buf, LineIndex line
 void EditorWidget::observeDeleteLine(TextDocumentCore const &buf, LineIndex line) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
+  shiftLineCache(line, LineDifference(-1));
+  invalidateLineCacheFrom(line);
+  m_lineRenderCache.setVersion(buf.getVersionNumber());
+
   if (ignoringChangeNotifications()) {
     TRACE2("IGNORING: observeDeleteLine line=" << line);
     return;
@@ -3611,9 +4045,11 @@ void EditorWidget::observeDeleteLine(TextDocumentCore const &buf, LineIndex line
 // For inserted characters, I don't do anything special, so
 // the cursor says in the same column of text.
 
-void EditorWidget::observeInsertText(TextDocumentCore const &, TextMCoord, char const *, ByteCount) NOEXCEPT
+void EditorWidget::observeInsertText(TextDocumentCore const &buf, TextMCoord tc, char const *, ByteCount) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
+  invalidateLineCacheFrom(tc.m_line);
+  m_lineRenderCache.setVersion(buf.getVersionNumber());
   if (ignoringChangeNotifications()) {
     return;
   }
@@ -3621,9 +4057,11 @@ void EditorWidget::observeInsertText(TextDocumentCore const &, TextMCoord, char
   GENERIC_CATCH_END
 }
 
-void EditorWidget::observeDeleteText(TextDocumentCore const &, TextMCoord, ByteCount) NOEXCEPT
+void EditorWidget::observeDeleteText(TextDocumentCore const &buf, TextMCoord tc, ByteCount) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
+  invalidateLineCacheFrom(tc.m_line);
+  m_lineRenderCache.setVersion(buf.getVersionNumber());
   if (ignoringChangeNotifications()) {
     return;
   }
@@ -3631,9 +4069,72 @@ void EditorWidget::observeDeleteText(TextDocumentCore const &, TextMCoord, ByteC
   GENERIC_CATCH_END
 }
 
+void EditorWidget::observeReplaceRange(TextDocumentCore const &buf, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *, ByteCount) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  // Lines are added or removed just below the first line of the range,
+  // and all of the lines of the new text have changed.
+  LineIndex const first = oldRange.m_start.m_line;
+  LineDifference const delta =
+    (newEnd.m_line - first) - (oldRange.m_end.m_line - first);
+  shiftLineCache(first.succ(), delta);
+  invalidateLineCacheRange(first, newEnd.m_line);
+  m_lineRenderCache.setVersion(buf.getVersionNumber());
+
+  if (ignoringChangeNotifications()) {
+    TRACE2("IGNORING: observeReplaceRange range=" << oldRange);
+    return;
+  }
+  TRACE2("observeReplaceRange range=" << oldRange <<
+         " newEnd=" << newEnd);
+  INITIATING_DOCUMENT_CHANGE();
+
+  // Same policies as `observeInsertLine` and `observeDeleteLine`, but
+  // moving by all of the lines at once.
+  if (delta.isPositive()) {
+    bool keepCursorStationary =
+      (m_editor->documentProcessStatus() != DPS_RUNNING);
+
+    if (first <= m_editor->cursor().m_line) {
+      m_editor->moveCursorBy(delta, ColumnDifference(0));
+      if (keepCursorStationary) {
+        m_editor->moveFirstVisibleBy(delta, ColumnDifference(0));
+      }
+      else {
+        m_editor->scrollToCursor();
+      }
+    }
+
+    if (m_editor->markActive() && first <= m_editor->mark().m_line) {
+      m_editor->moveMarkBy(delta, ColumnDifference(0));
+    }
+  }
+
+  else if (delta.isNegative()) {
+    // A cursor or mark on a deleted line ends up on `first`.
+    LineIndex const cursorLine = m_editor->cursor().m_line;
+    if (first < cursorLine) {
+      LineDifference up = std::max(delta, first - cursorLine);
+      m_editor->moveCursorBy(up, ColumnDifference(0));
+      m_editor->moveFirstVisibleBy(up, ColumnDifference(0));
+    }
+
+    if (m_editor->markActive() && first < m_editor->mark().m_line) {
+      m_editor->moveMarkBy(
+        std::max(delta, first - m_editor->mark().m_line),
+        ColumnDifference(0));
+    }
+  }
+
+  redrawAfterContentChange();
+  GENERIC_CATCH_END
+}
+
 void EditorWidget::observeTotalChange(TextDocumentCore const &buf) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
+  invalidateLineCache();
   if (ignoringChangeNotifications()) {
     return;
   }
@@ -3645,6 +4146,9 @@ void EditorWidget::observeMetadataChange(TextDocumentCore const &buf) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
 
+  // This can signal new diagnostics, which are drawn on the lines.
+  invalidateLineCache();
+
   if (ignoringChangeNotifications()) {
     return;
   }
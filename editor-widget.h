@@ -19,9 +19,12 @@
 #include "editor-window-fwd.h"                   // EditorWindow [n]
 #include "event-replay.h"                        // EventReplayQueryable
 #include "fail-reason-opt.h"                     // FailReasonOpt
+#include "hilite-fwd.h"                          // Highlighter [n]
 #include "host-file-olb.h"                       // HostFile_OptLineByte
+#include "line-count.h"                          // LineCount
 #include "line-difference.h"                     // LineDifference
 #include "line-index.h"                          // LineIndex
+#include "line-render-cache.h"                   // LineRenderCache
 #include "lsp-client-fwd.h"                      // LSPClient [n]
 #include "lsp-client-manager-fwd.h"              // LSPClientManager [n]
 #include "lsp-symbol-request-kind.h"             // LSPSymbolRequestKind
@@ -53,15 +56,21 @@
 #include "smbase/std-string-view-fwd.h"          // std::string_view [n]
 
 // Qt
+#include <QPixmap>
 #include <QRect>
 #include <QWidget>
 
 // libc++
+#include <map>                                   // std::map
 #include <memory>                                // std::unique_ptr
+#include <optional>                              // std::optional
+#include <utility>                               // std::pair
+#include <vector>                                // std::vector
 
 class QImage;
 class QLabel;
 class QRangeControl;
+class QTimerEvent;
 
 
 // Widget to edit the contents of text files.  The widget shows and
@@ -100,6 +109,74 @@ public:      // types
   using DiagnosticOrError =
     smbase::Either<TDD_DocEntry, std::string>;
 
+private:     // types
+  // Widget-wide parameters that affect how every line is drawn.  If
+  // any of these change, every cached line image is stale.
+  class LinePaintParams {
+  public:      // data
+    // Size of one line image.
+    int m_width;
+    int m_fullLineHeight;
+
+    // Horizontal scroll position and visible width.
+    ColumnIndex m_firstCol;
+    ColumnCount m_visibleCols;
+
+    // Rendering options.  Changing fonts clears the cache directly.
+    bool m_visibleWhitespace;
+    int m_whitespaceOpacity;
+    bool m_highlightTrailingWhitespace;
+    ColumnIndex m_softMarginColumn;
+    bool m_visibleSoftMargin;
+
+    // Columns per tab stop, which affects layout.
+    ColumnCount m_tabWidth;
+
+    // Objects consulted while drawing.  Comparing their identities
+    // catches switching documents, highlighters, or diagnostic sets.
+    NamedTextDocumentEditor const *m_editor;
+    Highlighter const *m_highlighter;
+    TextDocumentDiagnostics const *m_diagnostics;
+
+  public:      // methods
+    LinePaintParams();
+
+    bool operator==(LinePaintParams const &obj) const;
+    bool operator!=(LinePaintParams const &obj) const
+      { return !operator==(obj); }
+  };
+
+  // An image of one line, as kept in `m_lineCache`.
+  class CachedLineImage {
+  public:      // data
+    // Per-line view state the image was drawn with.  The entry can
+    // only be reused if these still match.
+    //
+    // Selected columns as returned by `selectionOverlayOnLine`, or
+    // -1 for `m_selStart` if none.
+    int m_selStart;
+    int m_selLength;
+
+    // True if a newline glyph was drawn at the end.
+    bool m_showsNewline;
+
+    // Value of `m_searchGeneration` when the image was drawn.  The
+    // search hits are part of the image, so this must be current for
+    // the entry to be in `m_lineCache`.
+    int m_searchGeneration;
+
+    // The search hits on the line when the image was drawn, so that
+    // `selfCheck` can confirm that an edit that changes them also
+    // discards the image.
+    std::vector<TextSearch::MatchExtent> m_searchHits;
+
+    // The pixels.
+    QPixmap m_pixmap;
+
+  public:      // methods
+    CachedLineImage();
+  };
+
 public:     // static data
   // Instances created minus instances destroyed.
   static int s_objectCount;
@@ -174,6 +251,70 @@ private:     // data
   // 'm_editor->getDocumentCore()'.
   std::unique_ptr<TextSearch> m_textSearch;
 
+  // ------ line image cache ------
+  // Parameters with which the images in `m_lineCache` were drawn.
+  LinePaintParams m_lineCacheParams;
+
+  // Map from line index to the image last drawn for that line, for
+  // the lines visible in the most recent frame.  `paintFrame` blits a
+  // cached image rather than laying out, highlighting, and drawing the
+  // line again when nothing affecting it has changed.
+  //
+  // The document change notifications remove entries for lines whose
+  // contents or highlighting may have changed, and shift entries when
+  // lines are inserted or deleted.  The cursor line is never cached.
+  std::map<LineIndex, CachedLineImage> m_lineCache;
+
+  // Layout categories (highlighting plus search hits) for recently
+  // drawn lines.  Unlike `m_lineCache`, this is independent of the
+  // scroll position, window size, and cursor, so it lets scrolling
+  // back over lines skip the lexing and layout.  It is maintained by
+  // the same code that maintains `m_lineCache`.
+  LineRenderCache m_lineRenderCache;
+
+  // Incremented whenever the search string, flags, or search object
+  // change, since those determine the search hits in `m_lineCache`
+  // and `m_lineRenderCache`.  The former is discarded at the same
+  // time; entries of the latter record the generation they were
+  // computed with.
+  int m_searchGeneration;
+
+  // ------ background highlighting ------
+  // Maximum number of lines the highlighter may lex before it can draw
+  // a given line.  Lines farther than this below the highlighter's
+  // frontier are drawn provisionally, and redrawn once the background
+  // highlighting reaches them.  Set from
+  // EDITOR_HIGHLIGHT_SYNC_LINE_LIMIT.
+  LineCount m_highlightSyncLineLimit;
+
+  // Time to spend on background highlighting each time the timer
+  // fires.  Set from EDITOR_HIGHLIGHT_BUDGET_MS.
+  int m_highlightBudgetMS;
+
+  // Qt timer ID of the zero-interval timer that drives background
+  // highlighting while the highlighter has work to do, or -1 if it is
+  // not running.
+  int m_highlightTimerId;
+
+  // If set, the first line drawn with provisional highlighting since
+  // the highlighter last caught up to the provisional lines.
+  std::optional<LineIndex> m_provisionalHighlightLine;
+
+  // ------ background search ------
+  // Documents with at least this many lines have their search hits
+  // found on worker threads.  0 disables that.  Set from
+  // EDITOR_SEARCH_BACKGROUND_LINES.
+  int m_searchBackgroundLineThreshold;
+
+  // Qt timer ID of the timer that collects results from the background
+  // search while `m_textSearch` is scanning, or -1 if it is not
+  // running.
+  int m_searchScanTimerId;
+
+  // True if `setSearchStringParams` was asked to scroll to a hit, but
+  // could not find one because the scan had not reached any yet.
+  bool m_scrollToHitWhenFound;
+
 public:      // data
   // ------ rendering options ------
   // amount of blank space at top/left edge of widget
@@ -343,6 +484,9 @@ protected:   // funcs
   virtual void focusInEvent(QFocusEvent *e) NOEXCEPT OVERRIDE;
   virtual void focusOutEvent(QFocusEvent *e) NOEXCEPT OVERRIDE;
 
+  // QObject funcs
+  virtual void timerEvent(QTimerEvent *event) NOEXCEPT OVERRIDE;
+
 public:      // funcs
   EditorWidget(NamedTextDocument *docFile,
                EditorWindow *editorWindow);
@@ -618,6 +762,9 @@ public:      // funcs
 
   // Asynchronously issue a request for the file status if the file
   // being edited in order to get an updated file modification time.
+  //
+  // This is unnecessary when the document's `m_fileIsWatched` is true,
+  // but is still done on explicit request.
   void requestFileStatus();
 
   // Cancel any outstanding file status request.
@@ -698,6 +845,7 @@ public:      // funcs
   virtual void observeInsertText(TextDocumentCore const &buf, TextMCoord tc, char const *text, ByteCount length) NOEXCEPT OVERRIDE;
   virtual void observeDeleteText(TextDocumentCore const &buf, TextMCoord tc, ByteCount length) NOEXCEPT OVERRIDE;
   virtual void observeTotalChange(TextDocumentCore const &buf) NOEXCEPT OVERRIDE;
+  virtual void observeReplaceRange(TextDocumentCore const &buf, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount length) NOEXCEPT OVERRIDE;
   virtual void observeMetadataChange(TextDocumentCore const &buf) NOEXCEPT OVERRIDE;
 
   // This is the same as 'keyPressEvent', but is meant to be callable by
@@ -723,7 +871,76 @@ public:      // funcs
   // -------------------------- output ----------------------------
   // intermediate paint steps
   void updateFrame(QPaintEvent *ev);
-  void paintFrame(QPainter &winPaint);
+
+  // Paint the lines that intersect `clipRect` onto `winPaint`, reusing
+  // cached line images where possible.
+  void paintFrame(QPainter &winPaint, QRect const &clipRect);
+
+  // Get the current widget-wide parameters for drawing lines.
+  LinePaintParams getLinePaintParams() const;
+
+  // If `selRange` covers part of `line`, return the starting layout
+  // column and number of columns, where 0 means through the end of the
+  // line.  If it covers nothing on `line`, or the selection is not
+  // active, return nullopt.
+  std::optional<std::pair<int,int>> selectionOverlayOnLine(
+    TextLCoordRange const &selRange, LineIndex line) const;
+
+  // Lay out and draw `line` onto `paint`, a canvas for one line, with
+  // `selRange` as the selection.
+  void paintLineImage(
+    QPainter &paint,
+    LineIndex line,
+    TextLCoordRange const &selRange);
+
+  // Set `layoutCategories` to the highlighting and search hits for
+  // `line`, in layout coordinates, using `m_lineRenderCache` when
+  // possible.
+  void getLayoutCategories(
+    LineIndex line,
+    LineCategoryAOAs /*OUT*/ &layoutCategories);
+
+  // Start the background highlighting timer if the highlighter has
+  // work to do and it is not already running.
+  void startBackgroundHighlightIfNeeded();
+
+  // Stop the background highlighting timer if it is running.
+  void stopBackgroundHighlight();
+
+  // Do one slice of background highlighting.  If that finalizes lines
+  // that were drawn provisionally, redraw them.
+  void backgroundHighlightStep();
+
+  // Start the timer that polls for background search results if a
+  // scan is running and the timer is not.
+  void startSearchScanPollIfNeeded();
+
+  // Stop the background search polling timer if it is running.
+  void stopSearchScanPoll();
+
+  // Merge the search results found since the last poll and redraw to
+  // show them and the updated match counts.
+  void searchScanPollStep();
+
+  // Discard all cached line images and categories.
+  void invalidateLineCache();
+
+  // Discard the cached image and categories for `line`, which has
+  // changed, and if the document is highlighted, all lines after it
+  // too, since a change to one line can alter the highlighting of the
+  // lines below it.  If search matches can span lines, this also
+  // covers the `TextSearch::MAX_MATCH_LINES-1` lines on either side,
+  // whose hits can start above the change and reach below it.
+  void invalidateLineCacheFrom(LineIndex line)
+    { invalidateLineCacheRange(line, line); }
+
+  // Same, for all of the changed lines in [first,last], in one pass.
+  void invalidateLineCacheRange(LineIndex first, LineIndex last);
+
+  // Adjust the cache keys of the lines at or after `line` by `delta`
+  // to follow an insertion (positive) or deletion (negative) of that
+  // many lines there.
+  void shiftLineCache(LineIndex line, LineDifference delta);
 
   // Paint a single line of text.  The parameters are documented in
   // detail at the implementation site.
@@ -28,7 +28,7 @@
 #include "td-diagnostics.h"                      // TextDocumentDiagnostics
 #include "td-editor.h"                           // TextDocumentEditor
 #include "textinput.h"                           // TextInputDialog
-#include "vfs-query-sync.h"                      // VFS_QuerySync
+#include "vfs-query-sync.h"                      // VFS_QuerySync, readFileSynchronously, writeFileSynchronously
 #include "vfs-msg.h"                             // VFS_ReadFileRequest
 #include "waiting-counter.h"                     // IncDecWaitingCounter
 
@@ -49,11 +49,13 @@
 #include "smbase/nonport.h"                      // fileOrDirectoryExists
 #include "smbase/objcount.h"                     // CHECK_OBJECT_COUNT
 #include "smbase/portable-error-code.h"          // smbase::PortableErrorCode
+#include "smbase/save-restore.h"                 // SetRestore
 #include "smbase/sm-file-util.h"                 // SMFileUtil
 #include "smbase/sm-test.h"                      // PVAL
 #include "smbase/string-util.h"                  // endsWith, vectorOfUCharToString
 #include "smbase/stringb.h"                      // stringbc
 #include "smbase/strutil.h"                      // dirname
+#include "smbase/syserr.h"                       // smbase::XSysError
 #include "smbase/sm-macros.h"                    // ASSERT_TABLESIZE
 #include "smbase/sm-trace.h"                     // INIT_TRACE, etc.
 #include "smbase/xassert.h"                      // xassert
@@ -75,6 +77,7 @@
 #include <QInputDialog>
 
 // libc++
+#include <cstdint>                               // std::uint64_t
 #include <exception>                             // std::exception
 #include <optional>                              // std::optional
 #include <string_view>                           // std::string_view
@@ -810,42 +813,57 @@ void EditorWindow::openOrSwitchToFile(HostAndResourceName const &harn)
     return;
   }
 
-  // Load the file contents.
-  SynchronousWaiter waiter(this);
-  auto replyOrError(
-    readFileSynchronously(vfsConnections(), waiter, harn));
+  NamedTextDocument *file = new NamedTextDocument();
+  file->setDocumentName(docName);
+  file->m_title = m_editorGlobal->uniqueTitleFor(docName);
 
-  if (replyOrError.isRight()) {
-    this->complain(replyOrError.right());
-    return;
+  // Huge local files are mapped rather than read.
+  bool mapped = false;
+  try {
+    mapped = m_editorGlobal->replaceWithMappedFileIfLarge(file, harn);
   }
-
-  std::unique_ptr<VFS_ReadFileReply> &rfr = replyOrError.left();
-  if (!rfr) {
-    // The request was canceled.
+  catch (XSysError &x) {
+    this->complain(x.why());
+    delete file;
     return;
   }
 
-  NamedTextDocument *file = new NamedTextDocument();
-  file->setDocumentName(docName);
-  file->m_title = m_editorGlobal->uniqueTitleFor(docName);
+  if (!mapped) {
+    // Load the file contents.
+    SynchronousWaiter waiter(this);
+    auto replyOrError(
+      readFileSynchronously(vfsConnections(), waiter, harn));
 
-  if (rfr->m_success) {
-    file->replaceFileAndStats(rfr->m_contents,
-                              rfr->m_fileModificationTime,
-                              rfr->m_readOnly);
-  }
-  else {
-    if (rfr->m_failureReasonCode == PortableErrorCode::PEC_FILE_NOT_FOUND) {
-      // Just have the file open with its name set but no content.
+    if (replyOrError.isRight()) {
+      this->complain(replyOrError.right());
+      delete file;
+      return;
     }
-    else {
-      this->complain(stringbc(
-        rfr->m_failureReasonString <<
-        " (code " << rfr->m_failureReasonCode << ")"));
+
+    std::unique_ptr<VFS_ReadFileReply> &rfr = replyOrError.left();
+    if (!rfr) {
+      // The request was canceled.
       delete file;
       return;
     }
+
+    if (rfr->m_success) {
+      file->replaceFileAndStats(rfr->m_contents,
+                                rfr->m_fileModificationTime,
+                                rfr->m_readOnly);
+    }
+    else {
+      if (rfr->m_failureReasonCode == PortableErrorCode::PEC_FILE_NOT_FOUND) {
+        // Just have the file open with its name set but no content.
+      }
+      else {
+        this->complain(stringbc(
+          rfr->m_failureReasonString <<
+          " (code " << rfr->m_failureReasonCode << ")"));
+        delete file;
+        return;
+      }
+    }
   }
 
   this->useDefaultHighlighter(file);
@@ -959,36 +977,79 @@ void EditorWindow::writeTheFile()
 {
   RCSerf<NamedTextDocument> file = this->currentDocument();
 
-  std::unique_ptr<VFS_WriteFileRequest> req(new VFS_WriteFileRequest);
-  req->m_path = file->filename();
-  req->m_contents = file->getWholeFile();
-  std::unique_ptr<VFS_WriteFileReply> reply(
-    vfsQuerySynchronously<VFS_WriteFileReply>(file->hostName(),
-                                              std::move(req)));
+  // The document must have all of a mapped file's lines, or writing
+  // it would drop the ones not yet found.
+  file->completeLineIndex();
 
-  if (reply) {
-    if (reply->m_success) {
-      file->m_lastFileTimestamp = reply->m_fileModificationTime;
-      file->m_modifiedOnDisk = false;
-      file->noUnsavedChanges();
-
-      // Remove the asterisk indicating unsaved changes in the title bar
-      // and status bar.  (But this is unrelated to the asterisk in the
-      // LSP status box.)
-      editorViewChanged();
-
-      if (!editorWidget()->getLSPUpdateContinuously()) {
-        editorWidget()->lspDoFileOperation(
-          EditorWidget::LSPFO_UPDATE_IF_OPEN);
-      }
+  // If the edits since the file was last loaded or saved cancel out,
+  // the file already has these contents, and writing it would only
+  // change its timestamp.  (Without unsaved changes, the user has
+  // confirmed they want it written anyway.)
+  if (file->unsavedChanges() && file->contentsMatchFile()) {
+    TRACE1("writeTheFile: " << file->documentName() <<
+           " already has these contents; not writing it.");
+  }
+  else {
+    std::uint64_t const digest = file->getCore().contentDigest();
+
+    // Unless the user has agreed to overwrite changes made on disk,
+    // have the server refuse if the file is not as we last saw it.
+    std::optional<std::uint64_t> expectedDigest;
+    if (!file->m_modifiedOnDisk) {
+      expectedDigest = file->m_lastFileDigest;
     }
-    else {
+
+    // The server may report the change this write makes while we
+    // wait for its reply; that must not mark the file as modified on
+    // disk, or detach the document from it, midway through the save.
+    SetRestore<bool> savingRestorer(file->m_saveInProgress, true);
+
+    SynchronousWaiter waiter(this);
+    auto replyOrError(
+      writeFileSynchronously(vfsConnections(), waiter, file->harn(),
+                             file->getWholeFile(), expectedDigest));
+
+    if (replyOrError.isRight()) {
+      this->complain(replyOrError.right());
+      return;
+    }
+
+    std::unique_ptr<VFS_WriteFileReply> &reply = replyOrError.left();
+    if (!reply) {
+      // Canceled.
+      return;
+    }
+
+    if (!reply->m_success) {
+      if (reply->m_digestMismatch) {
+        // Another save will ask to confirm overwriting.
+        file->m_modifiedOnDisk = true;
+        file->notifyMetadataChange();
+      }
+
       // There is not a severity between "warning" and "critical",
       // and "critical" is a bit obnoxious.
       QMessageBox::warning(this, "Write Error", qstringb(
         "Failed to save file " << file->documentName() <<
         ": " << reply->m_failureReasonString));
+      return;
     }
+
+    file->m_lastFileTimestamp = reply->m_fileModificationTime;
+    file->m_lastFileDigest = digest;
+  }
+
+  file->m_modifiedOnDisk = false;
+  file->noUnsavedChanges();
+
+  // Remove the asterisk indicating unsaved changes in the title bar
+  // and status bar.  (But this is unrelated to the asterisk in the
+  // LSP status box.)
+  editorViewChanged();
+
+  if (!editorWidget()->getLSPUpdateContinuously()) {
+    editorWidget()->lspDoFileOperation(
+      EditorWidget::LSPFO_UPDATE_IF_OPEN);
   }
 }
 
@@ -1110,7 +1171,20 @@ bool EditorWindow::reloadCurrentDocumentIfChanged()
 {
   NamedTextDocument *doc = this->currentDocument();
 
-  if (doc->hasFilename() && !doc->unsavedChanges()) {
+  if (doc->hasFilename() && !doc->unsavedChanges() &&
+      doc->m_fileIsWatched) {
+    // The server reports changes as they happen, so there is no need
+    // to ask it.
+    if (doc->m_modifiedOnDisk) {
+      TRACE1(
+        "File " << doc->documentName() << " has changed on disk "
+        "and has no unsaved changes; reloading it.");
+
+      return reloadCurrentDocument();
+    }
+  }
+
+  else if (doc->hasFilename() && !doc->unsavedChanges()) {
     // Query the file modification time.
     SynchronousWaiter waiter(this);
     auto replyOrError(
@@ -194,6 +194,9 @@ public:      // funcs
   // Reload if the document has no unsaved changes and the on-disk
   // timestamp is different from what it was before.  Return true if we
   // reloaded.
+  //
+  // If the file is watched, this uses what the server has already
+  // reported rather than asking it.
   bool reloadCurrentDocumentIfChanged();
 
   // Return true if either there are no unsaved changes or the user
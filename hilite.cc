@@ -18,4 +18,29 @@ Highlighter::operator gdv::GDValue() const
 }
 
 
+bool Highlighter::highlightWithinLimit(
+  TextDocumentCore const &doc, LineIndex line, LineCount,
+  LineCategoryAOAs &categories)
+{
+  this->highlight(doc, line, categories);
+  return true;
+}
+
+
+bool Highlighter::lineIsReady(LineIndex) const
+{
+  return true;
+}
+
+
+bool Highlighter::hasBackgroundWork() const
+{
+  return false;
+}
+
+
+void Highlighter::highlightInBackground(long)
+{}
+
+
 // EOF
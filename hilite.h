@@ -6,6 +6,7 @@
 
 #include "hilite-fwd.h"                // fwds for this module
 
+#include "line-count.h"                // LineCount
 #include "line-index.h"                // LineIndex
 #include "td-core.h"                   // TextDocumentCore, TextDocumentObserver
 #include "td-editor.h"                 // TextDocumentEditor
@@ -47,6 +48,44 @@ public:
   void highlightTDE(TextDocumentEditor const *tde, LineIndex line,
                     LineCategoryAOAs &categories)
     { this->highlight(tde->getDocument()->getCore(), line, categories); }
+
+  // ---- incremental operation ----
+  // The methods below let a highlighter whose results for one line
+  // depend on the lines above it spread that work out over time
+  // rather than doing it all when a far-down line is first drawn.
+  // The defaults are for a highlighter with no such dependency.
+
+  // Like `highlight`, except that if an exact result would require
+  // analyzing more than `lexLimit` lines above `line` first, instead
+  // produce a provisional result for `line` based on a guess about
+  // the preceding context, and return false.  Otherwise return true.
+  //
+  // The default implementation calls `highlight` and returns true.
+  virtual bool highlightWithinLimit(
+    TextDocumentCore const &doc, LineIndex line, LineCount lexLimit,
+    LineCategoryAOAs &categories);
+
+  // True if `highlight` can produce an exact result for `line` without
+  // analyzing any other lines first.  The default returns true.
+  virtual bool lineIsReady(LineIndex line) const;
+
+  // True if there is analysis that `highlightInBackground` could
+  // usefully do.  The default returns false.
+  virtual bool hasBackgroundWork() const;
+
+  // Spend roughly `budgetMS` milliseconds on analysis that makes
+  // later calls to `highlight` faster or exact.  The default does
+  // nothing.
+  virtual void highlightInBackground(long budgetMS);
+
+  // Convenience method.
+  bool highlightTDEWithinLimit(TextDocumentEditor const *tde,
+                               LineIndex line, LineCount lexLimit,
+                               LineCategoryAOAs &categories)
+  {
+    return this->highlightWithinLimit(tde->getDocument()->getCore(),
+                                      line, lexLimit, categories);
+  }
 };
 
 
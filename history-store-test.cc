@@ -0,0 +1,205 @@
+// history-store-test.cc
+// Tests for `history-store` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "history-store.h"             // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "td.h"                        // TextDocument
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ
+#include "smbase/xassert.h"            // xassert
+
+#include <sstream>                     // std::ostringstream
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Insert `text` at the end of `core`, recording it in `store`.
+void appendEdit(TextDocumentCore &core, HistoryStore &store,
+                std::string const &text)
+{
+  HE_text *e = new HE_text(core.endCoord(), true /*insertion*/,
+                           text.data(), ByteCount(text.size()));
+  e->apply(core, false /*reverse*/);
+  store.append(e);
+  store.selfCheck();
+}
+
+
+// Text of edit `i` in the tests below.  The text is repetitive so it
+// compresses well.
+std::string editText(int i)
+{
+  return std::string(40, 'a' + (i % 26)) + "\n";
+}
+
+
+// Undo everything in `store`, checking the document along the way
+// against `snapshots`, then redo everything.
+void undoAndRedoAll(TextDocumentCore &core, HistoryStore &store,
+                    std::vector<std::string> const &snapshots)
+{
+  int n = store.seqLength();
+  xassert((int)snapshots.size() == n+1);
+
+  for (int i = n-1; i >= 0; i--) {
+    store.applyOne(core, i, true /*reverse*/);
+    EXPECT_EQ(core.getWholeFileString(), snapshots[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    store.applyOne(core, i, false /*reverse*/);
+    EXPECT_EQ(core.getWholeFileString(), snapshots[i+1]);
+  }
+  store.selfCheck();
+}
+
+
+// Many small elements are gathered into cold blocks even with no
+// budget.
+void testFreezeWithoutBudget()
+{
+  TextDocumentCore core;
+  HistoryStore store;
+  store.setMemoryBudget(0);
+
+  std::vector<std::string> snapshots;
+  snapshots.push_back(core.getWholeFileString());
+
+  int const n = HistoryStore::MAX_HOT_ELEMENTS * 3;
+  for (int i=0; i < n; i++) {
+    appendEdit(core, store, editText(i));
+    snapshots.push_back(core.getWholeFileString());
+  }
+  EXPECT_EQ(store.seqLength(), n);
+
+  HistoryStats stats;
+  store.stats(stats);
+  EXPECT_EQ(stats.records, n);
+  xassert(stats.compressedBytes > 0);
+  xassert(stats.spilledBytes == 0);
+
+  undoAndRedoAll(core, store, snapshots);
+}
+
+
+// With a small budget, cold blocks are spilled, and can be read back.
+void testSpill()
+{
+  TextDocumentCore core;
+  HistoryStore store;
+  store.setMemoryBudget(4096);
+
+  std::vector<std::string> snapshots;
+  snapshots.push_back(core.getWholeFileString());
+
+  int const n = 2000;
+  for (int i=0; i < n; i++) {
+    appendEdit(core, store, editText(i));
+    snapshots.push_back(core.getWholeFileString());
+  }
+
+  HistoryStats stats;
+  store.stats(stats);
+  EXPECT_EQ(stats.records, n);
+  xassert(stats.spilledBytes > 0);
+
+  undoAndRedoAll(core, store, snapshots);
+
+  // Truncate back into the spilled blocks.
+  int const mid = HistoryStore::BLOCK_ELEMENTS / 2;
+  for (int i = n-1; i >= mid; i--) {
+    store.applyOne(core, i, true /*reverse*/);
+  }
+  store.truncate(mid);
+  store.selfCheck();
+  EXPECT_EQ(store.seqLength(), mid);
+  snapshots.resize(mid+1);
+  EXPECT_EQ(core.getWholeFileString(), snapshots[mid]);
+
+  for (int i=mid; i < n; i++) {
+    appendEdit(core, store, editText(i+7));
+    snapshots.push_back(core.getWholeFileString());
+  }
+  undoAndRedoAll(core, store, snapshots);
+
+  store.clear();
+  store.selfCheck();
+  EXPECT_EQ(store.seqLength(), 0);
+}
+
+
+// Truncating back into cold blocks leaves the kept elements usable.
+void testTruncateSplitsBlock()
+{
+  TextDocumentCore core;
+  HistoryStore store;
+  store.setMemoryBudget(0);
+
+  std::vector<std::string> snapshots;
+  snapshots.push_back(core.getWholeFileString());
+  for (int i=0; i < HistoryStore::MAX_HOT_ELEMENTS+1; i++) {
+    appendEdit(core, store, editText(i));
+    snapshots.push_back(core.getWholeFileString());
+  }
+
+  int const keep = 10;
+  for (int i = store.seqLength()-1; i >= keep; i--) {
+    store.applyOne(core, i, true /*reverse*/);
+  }
+  store.truncate(keep);
+  store.selfCheck();
+  snapshots.resize(keep+1);
+  undoAndRedoAll(core, store, snapshots);
+
+  // The printed form marks the requested element.
+  std::ostringstream oss;
+  store.printWithMark(oss, 0 /*indent*/, 3);
+  xassert(oss.str().find("--->") != std::string::npos);
+}
+
+
+// Typing inside an undo group is recorded as one element, but still
+// undoes in one step to the state before the group.
+void testCoalesceInGroup()
+{
+  TextDocument doc;
+  doc.appendString("x\n");
+
+  doc.beginUndoGroup();
+  for (char const *p = "hello\nworld"; *p; p++) {
+    doc.insertAt(doc.endCoord(), p, ByteCount(1));
+  }
+  doc.endUndoGroup();
+  EXPECT_EQ(doc.getWholeFileString(), "x\nhello\nworld");
+
+  HistoryStats stats;
+  doc.historyStats(stats);
+  EXPECT_EQ(stats.records, 2);
+
+  doc.undo();
+  EXPECT_EQ(doc.getWholeFileString(), "x\n");
+  doc.redo();
+  EXPECT_EQ(doc.getWholeFileString(), "x\nhello\nworld");
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_history_store(CmdlineArgsSpan args)
+{
+  testFreezeWithoutBudget();
+  testSpill();
+  testTruncateSplitsBlock();
+  testCoalesceInGroup();
+}
+
+
+// EOF
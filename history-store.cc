@@ -0,0 +1,689 @@
+// history-store.cc
+// Code for history-store.h.
+
+// See license.txt for copyright and terms of use.
+
+#include "history-store.h"             // this module
+
+// editor
+#include "byte-count.h"                // ByteCount
+#include "byte-index.h"                // ByteIndex
+#include "line-index.h"                // LineIndex
+#include "vfs-compress.h"              // vfsLZCompress, vfsLZDecompress
+
+// smbase
+#include "smbase/exc.h"                // smbase::XFormat, THROW
+#include "smbase/sm-env.h"             // smbase::envAsIntOr
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/trace.h"              // TRACE
+#include "smbase/xassert.h"            // xassert, xfailure
+
+// libc++
+#include <algorithm>                   // std::max
+#include <climits>                     // LONG_MAX
+#include <string>                      // std::string
+#include <utility>                     // std::move
+
+// libc
+#include <stdio.h>                     // FILE, tmpfile, fseek, etc.
+
+using namespace smbase;
+
+
+// ---------------------------- serialization ----------------------------
+// Each element is a tag byte followed by its fields.  Integers are
+// written as LEB128 varints, which keeps the records for small
+// typing edits to a handful of bytes.
+//
+//   HE_TEXT:  line, byteIndex, insertion (one byte), length, bytes
+//   HE_GROUP: count, elements
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+void writeVarint(std::string &dest, unsigned long long v)
+{
+  while (v >= 0x80) {
+    dest.push_back(static_cast<char>((v & 0x7F) | 0x80));
+    v >>= 7;
+  }
+  dest.push_back(static_cast<char>(v));
+}
+
+
+void serializeElt(std::string &dest, HistoryElt const *e)
+{
+  switch (e->getTag()) {
+    case HistoryElt::HE_TEXT: {
+      HE_text const *t = static_cast<HE_text const *>(e);
+      dest.push_back(static_cast<char>(HistoryElt::HE_TEXT));
+      writeVarint(dest, t->tc.m_line.get());
+      writeVarint(dest, t->tc.m_byteIndex.get());
+      dest.push_back(t->insertion? 1 : 0);
+      writeVarint(dest, t->text.length());
+      dest.append(t->text.getArray(), t->text.length());
+      break;
+    }
+
+    case HistoryElt::HE_GROUP: {
+      HE_group const *g = static_cast<HE_group const *>(e);
+      dest.push_back(static_cast<char>(HistoryElt::HE_GROUP));
+      writeVarint(dest, g->seqLength());
+      for (int i=0; i < g->seqLength(); i++) {
+        serializeElt(dest, g->getElement(i));
+      }
+      break;
+    }
+
+    default:
+      xfailure("bad history element tag");
+  }
+}
+
+
+// Reads serialized elements.
+class BlockReader {
+public:      // data
+  unsigned char const *m_cur;
+  unsigned char const *m_end;
+
+public:      // methods
+  BlockReader(char const *src, std::size_t len)
+    : m_cur(reinterpret_cast<unsigned char const *>(src)),
+      m_end(m_cur + len)
+  {}
+
+  bool atEnd() const { return m_cur == m_end; }
+
+  static void corrupt()
+  {
+    THROW(XHistory("stored history is corrupt"));
+  }
+
+  unsigned char readByte()
+  {
+    if (atEnd()) {
+      corrupt();
+    }
+    return *(m_cur++);
+  }
+
+  // Read a varint that must fit in an 'int'.
+  int readInt()
+  {
+    unsigned long long v = 0;
+    for (int shift = 0; ; shift += 7) {
+      unsigned char b = readByte();
+      v |= (unsigned long long)(b & 0x7F) << shift;
+      if (!(b & 0x80)) {
+        break;
+      }
+      if (shift > 28) {
+        corrupt();
+      }
+    }
+    if (v > INT_MAX) {
+      corrupt();
+    }
+    return static_cast<int>(v);
+  }
+
+  char const *readBytes(int n)
+  {
+    if ((std::size_t)(m_end - m_cur) < (std::size_t)n) {
+      corrupt();
+    }
+    char const *ret = reinterpret_cast<char const *>(m_cur);
+    m_cur += n;
+    return ret;
+  }
+};
+
+
+// Read one element, returning an owner pointer.
+HistoryElt *deserializeElt(BlockReader &r)
+{
+  switch (r.readByte()) {
+    case HistoryElt::HE_TEXT: {
+      int line = r.readInt();
+      int byteIndex = r.readInt();
+      bool insertion = (r.readByte() != 0);
+      int len = r.readInt();
+      char const *bytes = r.readBytes(len);
+      return new HE_text(TextMCoord(LineIndex(line), ByteIndex(byteIndex)),
+                         insertion, bytes, ByteCount(len));
+    }
+
+    case HistoryElt::HE_GROUP: {
+      int count = r.readInt();
+      std::unique_ptr<HE_group> g(new HE_group);
+      for (int i=0; i < count; i++) {
+        g->append(deserializeElt(r));
+      }
+      return g.release();
+    }
+
+    default:
+      BlockReader::corrupt();
+      return nullptr;        // not reached
+  }
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// ------------------------------ ColdBlock ------------------------------
+class HistoryStore::ColdBlock {
+public:      // data
+  // Index in the store of the first element in this block.
+  int m_firstElement;
+
+  // Number of elements in the block.
+  int m_numElements;
+
+  // Statistics about the elements, so 'HistoryStore::stats' does not
+  // have to decode them.
+  int m_records;
+  int m_groups;
+
+  // Size of the serialized elements.
+  std::size_t m_rawSize;
+
+  // True if the stored bytes are compressed with 'vfsLZCompress'.
+  // Otherwise they are the serialized elements, which happens when
+  // compression does not make them smaller.
+  bool m_compressed;
+
+  // The stored bytes, if the block is in memory.
+  std::string m_data;
+
+  // Offset of the stored bytes in the spill file, or -1 if the block
+  // is in memory.
+  long m_spillOffset;
+
+  // Number of stored bytes, wherever they are.
+  std::size_t m_storedSize;
+
+public:      // methods
+  ColdBlock()
+    : m_firstElement(0),
+      m_numElements(0),
+      m_records(0),
+      m_groups(0),
+      m_rawSize(0),
+      m_compressed(false),
+      m_data(),
+      m_spillOffset(-1),
+      m_storedSize(0)
+  {}
+
+  bool isSpilled() const { return m_spillOffset >= 0; }
+};
+
+
+// ------------------------------ SpillFile ------------------------------
+class HistoryStore::SpillFile {
+  NO_OBJECT_COPIES(SpillFile);
+
+private:     // data
+  // The open file, which the C library deletes when it is closed.
+  FILE *m_fp;
+
+  // Number of bytes written so far.
+  long m_size;
+
+public:      // methods
+  // Take ownership of 'fp'.
+  explicit SpillFile(FILE *fp)
+    : m_fp(fp),
+      m_size(0)
+  {}
+
+  ~SpillFile()
+  {
+    fclose(m_fp);
+  }
+
+  // Append 'data' and return its offset, or -1 on failure.
+  long write(std::string const &data)
+  {
+    if ((std::size_t)(LONG_MAX - m_size) < data.size()) {
+      // 'fseek' cannot address it.
+      return -1;
+    }
+    if (fseek(m_fp, m_size, SEEK_SET) != 0 ||
+        fwrite(data.data(), 1, data.size(), m_fp) != data.size() ||
+        fflush(m_fp) != 0) {
+      return -1;
+    }
+
+    long ret = m_size;
+    m_size += (long)data.size();
+    return ret;
+  }
+
+  // Read 'len' bytes at 'offset' into 'dest'.  Return false on failure.
+  bool read(long offset, std::size_t len, std::string &dest) const
+  {
+    dest.resize(len);
+    return fseek(m_fp, offset, SEEK_SET) == 0 &&
+           fread(&dest[0], 1, len, m_fp) == len;
+  }
+};
+
+
+// ----------------------------- HistoryStore ----------------------------
+STATICDEF std::size_t HistoryStore::defaultMemoryBudget()
+{
+  static std::size_t const budget =
+    (std::size_t)std::max(0, envAsIntOr(64, "EDITOR_HISTORY_BUDGET_MB"))
+      << 20;
+  return budget;
+}
+
+
+HistoryStore::HistoryStore()
+  : m_coldBlocks(),
+    m_numColdElements(0),
+    m_numSpilledBlocks(0),
+    m_hot(),
+    m_hotBytes(0),
+    m_coldMemoryBytes(0),
+    m_memoryBudget(defaultMemoryBudget()),
+    m_spillFile(),
+    m_spillFileFailed(false),
+    m_decodedBlock(-1),
+    m_decodedElements()
+{}
+
+
+HistoryStore::~HistoryStore()
+{}
+
+
+void HistoryStore::selfCheck() const
+{
+  int numElements = 0;
+  std::size_t memoryBytes = 0;
+  for (int b=0; b < (int)m_coldBlocks.size(); b++) {
+    ColdBlock const &block = *m_coldBlocks[b];
+    xassert(block.m_firstElement == numElements);
+    xassert(block.m_numElements > 0);
+    numElements += block.m_numElements;
+
+    xassert(block.isSpilled() == (b < m_numSpilledBlocks));
+    if (!block.isSpilled()) {
+      xassert(block.m_data.size() == block.m_storedSize);
+      memoryBytes += block.m_storedSize;
+    }
+  }
+  xassert(numElements == m_numColdElements);
+  xassert(memoryBytes == m_coldMemoryBytes);
+
+  std::size_t hotBytes = 0;
+  for (HotElement const &h : m_hot) {
+    hotBytes += h.m_bytes;
+  }
+  xassert(hotBytes == m_hotBytes);
+}
+
+
+STATICDEF std::size_t HistoryStore::estimateBytes(HistoryElt const *e)
+{
+  HistoryStats stats;
+  e->stats(stats);
+  return stats.totalUsage();
+}
+
+
+int HistoryStore::blockContaining(int index) const
+{
+  xassert(0 <= index && index < m_numColdElements);
+
+  // Find the last block that starts at or before 'index'.
+  int lo = 0;
+  int hi = (int)m_coldBlocks.size() - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo + 1) / 2;
+    if (m_coldBlocks[mid]->m_firstElement <= index) {
+      lo = mid;
+    }
+    else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+
+void HistoryStore::decodeBlock(int b,
+  std::vector<std::unique_ptr<HistoryElt>> &dest) const
+{
+  ColdBlock const &block = *m_coldBlocks[b];
+
+  std::string spilled;
+  std::string const *stored = &block.m_data;
+  if (block.isSpilled()) {
+    if (!m_spillFile->read(block.m_spillOffset, block.m_storedSize,
+                           spilled)) {
+      THROW(XHistory("failed to read spilled history"));
+    }
+    stored = &spilled;
+  }
+
+  std::string raw;
+  std::string const *serialized = stored;
+  if (block.m_compressed) {
+    try {
+      raw = vfsLZDecompress(stored->data(), stored->size(),
+                            block.m_rawSize);
+    }
+    catch (XFormat &) {
+      BlockReader::corrupt();
+    }
+    serialized = &raw;
+  }
+
+  BlockReader reader(serialized->data(), serialized->size());
+  dest.clear();
+  for (int i=0; i < block.m_numElements; i++) {
+    dest.push_back(std::unique_ptr<HistoryElt>(deserializeElt(reader)));
+  }
+  if (!reader.atEnd()) {
+    BlockReader::corrupt();
+  }
+}
+
+
+HistoryElt const *HistoryStore::getColdElement(int b, int index)
+{
+  if (m_decodedBlock != b) {
+    m_decodedBlock = -1;
+    decodeBlock(b, m_decodedElements);
+    m_decodedBlock = b;
+  }
+
+  return m_decodedElements[index - m_coldBlocks[b]->m_firstElement].get();
+}
+
+
+void HistoryStore::freezeOldestHot(int maxElements)
+{
+  xassert(!m_hot.empty() && maxElements > 0);
+
+  std::unique_ptr<ColdBlock> block(new ColdBlock);
+  block->m_firstElement = m_numColdElements;
+
+  std::string raw;
+  HistoryStats stats;
+  while (block->m_numElements < maxElements &&
+         !m_hot.empty() &&
+         (block->m_numElements == 0 || raw.size() < BLOCK_BYTES)) {
+    HotElement &h = m_hot.front();
+    serializeElt(raw, h.m_elt.get());
+    h.m_elt->stats(stats);
+    m_hotBytes -= h.m_bytes;
+    m_hot.pop_front();
+    block->m_numElements++;
+  }
+  block->m_records = stats.records;
+  block->m_groups = stats.groups;
+  block->m_rawSize = raw.size();
+
+  std::string compressed = vfsLZCompress(raw.data(), raw.size());
+  if (compressed.size() < raw.size()) {
+    block->m_compressed = true;
+    block->m_data.swap(compressed);
+  }
+  else {
+    block->m_data.swap(raw);
+  }
+  block->m_data.shrink_to_fit();
+  block->m_storedSize = block->m_data.size();
+
+  TRACE("history", "froze " << block->m_numElements << " elements: " <<
+    block->m_rawSize << " bytes serialized, " <<
+    block->m_storedSize << " stored");
+
+  m_numColdElements += block->m_numElements;
+  m_coldMemoryBytes += block->m_storedSize;
+  m_coldBlocks.push_back(std::move(block));
+}
+
+
+bool HistoryStore::spillOldestBlock()
+{
+  if (m_spillFileFailed ||
+      m_numSpilledBlocks == (int)m_coldBlocks.size()) {
+    return false;
+  }
+
+  if (!m_spillFile) {
+    FILE *fp = tmpfile();
+    if (!fp) {
+      TRACE("history", "cannot create spill file; keeping history in memory");
+      m_spillFileFailed = true;
+      return false;
+    }
+    m_spillFile.reset(new SpillFile(fp));
+  }
+
+  ColdBlock &block = *m_coldBlocks[m_numSpilledBlocks];
+  long offset = m_spillFile->write(block.m_data);
+  if (offset < 0) {
+    TRACE("history", "cannot write spill file; keeping history in memory");
+    m_spillFileFailed = true;
+    return false;
+  }
+
+  block.m_spillOffset = offset;
+  m_coldMemoryBytes -= block.m_storedSize;
+  std::string().swap(block.m_data);
+  m_numSpilledBlocks++;
+  return true;
+}
+
+
+void HistoryStore::enforceBudget()
+{
+  // Gather runs of small records, like those made by typing, into
+  // blocks even when memory is not tight, since each one costs a
+  // couple of allocations while hot.
+  while ((int)m_hot.size() > MAX_HOT_ELEMENTS) {
+    freezeOldestHot(BLOCK_ELEMENTS);
+  }
+
+  if (m_memoryBudget == 0) {
+    return;
+  }
+
+  // Keep the most recent element hot, since that is what the next
+  // undo will apply.
+  while (m_hotBytes > m_memoryBudget/2 && m_hot.size() > 1) {
+    int available = (int)m_hot.size() - 1;
+    freezeOldestHot(available < BLOCK_ELEMENTS? available : BLOCK_ELEMENTS);
+  }
+
+  while (m_coldMemoryBytes > m_memoryBudget/2) {
+    if (!spillOldestBlock()) {
+      break;
+    }
+  }
+}
+
+
+void HistoryStore::append(HistoryElt *e)
+{
+  // A new element means the user is no longer stepping through old
+  // history, so the decoded block is unlikely to be needed.
+  m_decodedBlock = -1;
+  m_decodedElements.clear();
+
+  std::size_t bytes = estimateBytes(e);
+  m_hot.push_back(HotElement(e, bytes));
+  m_hotBytes += bytes;
+
+  this->enforceBudget();
+}
+
+
+void HistoryStore::truncate(int newLength)
+{
+  xassert(0 <= newLength && newLength <= seqLength());
+
+  while (seqLength() > newLength && !m_hot.empty()) {
+    m_hotBytes -= m_hot.back().m_bytes;
+    m_hot.pop_back();
+  }
+
+  if (seqLength() == newLength) {
+    return;
+  }
+
+  // The remaining elements to remove are cold.
+  m_decodedBlock = -1;
+  m_decodedElements.clear();
+
+  while (seqLength() > newLength) {
+    int b = (int)m_coldBlocks.size() - 1;
+    ColdBlock const &block = *m_coldBlocks[b];
+
+    // If the block has elements to keep, decode them so they can
+    // become hot elements.
+    std::vector<std::unique_ptr<HistoryElt>> kept;
+    if (block.m_firstElement < newLength) {
+      decodeBlock(b, kept);
+      kept.resize(newLength - block.m_firstElement);
+    }
+
+    m_numColdElements -= block.m_numElements;
+    if (block.isSpilled()) {
+      // The file space is not reclaimed until 'clear'.
+      m_numSpilledBlocks--;
+    }
+    else {
+      m_coldMemoryBytes -= block.m_storedSize;
+    }
+    m_coldBlocks.pop_back();
+
+    // Since 'm_hot' is empty, these go at its start.
+    for (std::unique_ptr<HistoryElt> &e : kept) {
+      std::size_t bytes = estimateBytes(e.get());
+      m_hot.push_back(HotElement(e.release(), bytes));
+      m_hotBytes += bytes;
+    }
+  }
+}
+
+
+void HistoryStore::clear()
+{
+  m_decodedBlock = -1;
+  m_decodedElements.clear();
+
+  m_coldBlocks.clear();
+  m_numColdElements = 0;
+  m_numSpilledBlocks = 0;
+  m_coldMemoryBytes = 0;
+
+  m_hot.clear();
+  m_hotBytes = 0;
+
+  m_spillFile.reset();
+  m_spillFileFailed = false;
+}
+
+
+TextMCoord HistoryStore::applyOne(TextDocumentCore &doc, int index,
+                                  bool reverse)
+{
+  xassert(0 <= index && index < seqLength());
+
+  if (index >= m_numColdElements) {
+    return m_hot[index - m_numColdElements].m_elt->apply(doc, reverse);
+  }
+
+  int b = blockContaining(index);
+  return getColdElement(b, index)->apply(doc, reverse);
+}
+
+
+void HistoryStore::setMemoryBudget(std::size_t bytes)
+{
+  m_memoryBudget = bytes;
+  this->enforceBudget();
+}
+
+
+void HistoryStore::printWithMark(std::ostream &sb, int indent, int n) const
+{
+  sb << std::string(indent, ' ') << "group {\n";
+
+  int i = 0;
+  auto printElt = [&](HistoryElt const *e) {
+    if (i==n) {
+      // print mark
+      sb << "--->\n";
+    }
+    e->print(sb, indent+2);
+    i++;
+  };
+
+  std::vector<std::unique_ptr<HistoryElt>> decoded;
+  for (int b=0; b < (int)m_coldBlocks.size(); b++) {
+    decodeBlock(b, decoded);
+    for (std::unique_ptr<HistoryElt> const &e : decoded) {
+      printElt(e.get());
+    }
+  }
+  for (HotElement const &h : m_hot) {
+    printElt(h.m_elt.get());
+  }
+
+  if (i==n) {
+    // print mark
+    sb << "--->\n";
+  }
+
+  sb << std::string(indent, ' ') << "}\n";
+}
+
+
+void HistoryStore::stats(HistoryStats &stats) const
+{
+  // The store is the outermost group.
+  stats.groups++;
+  stats.memUsage += sizeof(*this);
+
+  for (HotElement const &h : m_hot) {
+    h.m_elt->stats(stats);
+  }
+
+  for (std::unique_ptr<ColdBlock> const &block : m_coldBlocks) {
+    stats.records += block->m_records;
+    stats.groups += block->m_groups;
+    stats.memUsage += sizeof(ColdBlock);
+    stats.mallocObjects++;
+
+    if (block->isSpilled()) {
+      stats.spilledBytes += block->m_storedSize;
+    }
+    else {
+      stats.memUsage += block->m_storedSize;
+      stats.compressedBytes += block->m_storedSize;
+      stats.mallocObjects++;
+    }
+  }
+
+  // The decoded block is a cache, so only count its memory.
+  HistoryStats decoded;
+  for (std::unique_ptr<HistoryElt> const &e : m_decodedElements) {
+    e->stats(decoded);
+  }
+  stats.memUsage += decoded.memUsage;
+  stats.mallocObjects += decoded.mallocObjects;
+}
+
+
+// EOF
@@ -0,0 +1,185 @@
+// history-store.h
+// HistoryStore, the undo/redo sequence of a document, kept within a
+// memory budget.
+
+// See license.txt for copyright and terms of use.
+
+// The history of a document grows with every edit, and each record
+// holds a copy of the text it inserted or deleted.  Over a long session
+// with big documents, that can add up to far more memory than the
+// documents themselves.
+//
+// `HistoryStore` keeps the most recent elements as ordinary
+// `HistoryElt` objects, since those are the ones that undo and redo
+// usually touch.  Older elements are serialized in runs of consecutive
+// elements ("cold blocks") and compressed, which also removes the
+// per-object overhead of the many small records created by typing.
+// When the compressed blocks exceed their share of the budget, the
+// oldest are written to a temporary file.  Any element can still be
+// undone or redone; cold ones are decoded on demand.
+
+#ifndef EDITOR_HISTORY_STORE_H
+#define EDITOR_HISTORY_STORE_H
+
+// editor
+#include "history.h"                   // HistoryElt, HistoryStats
+#include "td-core.h"                   // TextDocumentCore
+#include "textmcoord.h"                // TextMCoord
+
+// smbase
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+
+// libc++
+#include <cstddef>                     // std::size_t
+#include <deque>                       // std::deque
+#include <iosfwd>                      // std::ostream
+#include <memory>                      // std::unique_ptr
+#include <vector>                      // std::vector
+
+
+// Sequence of history elements that can be applied by index.
+class HistoryStore {
+  NO_OBJECT_COPIES(HistoryStore);
+
+private:     // types
+  // A run of consecutive elements, serialized and compressed.  Defined
+  // in history-store.cc.
+  class ColdBlock;
+
+  // Temporary file holding spilled blocks.  Defined in
+  // history-store.cc.
+  class SpillFile;
+
+  // An element kept in memory, with its estimated memory usage.
+  class HotElement {
+  public:
+    std::unique_ptr<HistoryElt> m_elt;
+    std::size_t m_bytes;
+
+  public:
+    HotElement(HistoryElt *elt, std::size_t bytes)
+      : m_elt(elt), m_bytes(bytes) {}
+  };
+
+public:      // class data
+  // Maximum number of elements in one cold block.
+  static int const BLOCK_ELEMENTS = 256;
+
+  // When there are more than this many hot elements, the oldest
+  // 'BLOCK_ELEMENTS' are moved into a cold block even if the budget
+  // has not been reached.
+  static int const MAX_HOT_ELEMENTS = 2 * BLOCK_ELEMENTS;
+
+  // A cold block stops growing once its serialized size reaches this
+  // many bytes, unless it has only one element.
+  static std::size_t const BLOCK_BYTES = 1 << 20;
+
+  // Default for 'm_memoryBudget'.  It is 64 MiB unless overridden by
+  // the envvar EDITOR_HISTORY_BUDGET_MB.
+  static std::size_t defaultMemoryBudget();
+
+private:     // data
+  // The oldest elements, in order, in cold blocks.  The first
+  // 'm_numSpilledBlocks' have been written to 'm_spillFile'.
+  std::vector<std::unique_ptr<ColdBlock>> m_coldBlocks;
+
+  // Number of elements in 'm_coldBlocks'.
+  int m_numColdElements;
+
+  // Number of leading blocks in 'm_coldBlocks' that are spilled.
+  int m_numSpilledBlocks;
+
+  // The remaining elements, in order.
+  std::deque<HotElement> m_hot;
+
+  // Sum of 'm_bytes' for 'm_hot'.
+  std::size_t m_hotBytes;
+
+  // Bytes of compressed data held in memory by 'm_coldBlocks'.
+  std::size_t m_coldMemoryBytes;
+
+  // Maximum memory to use for the history before spilling compressed
+  // blocks to disk.  Half of it is for hot elements, and half for
+  // compressed blocks.  0 means unlimited, in which case elements are
+  // still compressed when there are too many hot elements, but never
+  // spilled.
+  std::size_t m_memoryBudget;
+
+  // The spill file, or NULL if nothing has been spilled since the
+  // last 'clear'.
+  std::unique_ptr<SpillFile> m_spillFile;
+
+  // True if we tried to create a spill file and failed, in which case
+  // we do not try again.
+  bool m_spillFileFailed;
+
+  // Index of the cold block decoded into 'm_decodedElements', or -1.
+  // Undo and redo usually step through consecutive elements, so this
+  // avoids decoding a block for each one.
+  int m_decodedBlock;
+  std::vector<std::unique_ptr<HistoryElt>> m_decodedElements;
+
+private:     // funcs
+  // Estimate the memory used by 'e'.
+  static std::size_t estimateBytes(HistoryElt const *e);
+
+  // Index of the block containing element 'index', which is cold.
+  int blockContaining(int index) const;
+
+  // Decode block 'b' into 'dest'.
+  void decodeBlock(int b,
+    std::vector<std::unique_ptr<HistoryElt>> &dest /*OUT*/) const;
+
+  // Make 'b' the decoded block, and return its element at 'index'.
+  HistoryElt const *getColdElement(int b, int index);
+
+  // Move up to 'maxElements' of the oldest hot elements into a new
+  // cold block.
+  void freezeOldestHot(int maxElements);
+
+  // Write the oldest in-memory cold block to the spill file.  Return
+  // false if that is not possible.
+  bool spillOldestBlock();
+
+  // Freeze and spill as needed to stay within the budget.
+  void enforceBudget();
+
+public:      // funcs
+  HistoryStore();
+  ~HistoryStore();
+
+  void selfCheck() const;
+
+  // Number of elements in the sequence.
+  int seqLength() const { return m_numColdElements + (int)m_hot.size(); }
+
+  // Add 'e' to the end, taking ownership of it.  This may compress or
+  // spill older elements.
+  void append(HistoryElt *e);
+
+  // Remove all elements with index 'newLength' or greater.  Requires
+  // 0 <= newLength <= seqLength().
+  void truncate(int newLength);
+
+  // Remove all elements, and discard the spill file.
+  void clear();
+
+  // Apply the element at 'index', possibly in reverse.  Throws
+  // XHistory if it does not match the document, or if a spilled
+  // element cannot be read back.
+  TextMCoord applyOne(TextDocumentCore &doc, int index, bool reverse);
+
+  // Get/set 'm_memoryBudget'.  Setting it enforces the new value.
+  std::size_t memoryBudget() const { return m_memoryBudget; }
+  void setMemoryBudget(std::size_t bytes);
+
+  // Print as a group, marking element 'n' like
+  // 'HE_group::printWithMark'.
+  void printWithMark(std::ostream &sb, int indent, int n) const;
+
+  // Account for all elements.
+  void stats(HistoryStats &stats) const;
+};
+
+
+#endif // EDITOR_HISTORY_STORE_H
@@ -76,6 +76,9 @@ static void deletionMismatch()
 }
 
 // Insert (=forward) or delete (=reverse) some text at 'tc'.
+//
+// Either way, this is one `replaceRange`, so a multi-line change
+// reaches the observers as a single notification.
 STATICDEF void HE_text::insert(
   TextDocumentCore &buf, TextMCoord tc, ArrayStack<char> const &text,
   bool reverse)
@@ -87,76 +90,13 @@ STATICDEF void HE_text::insert(
   if (!reverse) {
     // insertion
     // ==> committed
-
-    // Left edge of the inserted text.
-    TextMCoord begin = tc;
-
-    // excess text on the original line that gets floated down
-    // to after the cursor on the last line
-    ArrayStack<char> excess(0);
-
-    char const *p = text.getArray();
-    char const *end = p + text.length();
-    while (p < end) {
-      // find next newline, or 'end'
-      char const *nl = p;
-      while (nl < end && *nl!='\n') {
-        nl++;
-      }
-
-      // length of this segment
-      ByteCount len(nl - p);
-
-      // insert this text at line/col
-      buf.insertText(tc, p, len);
-      tc.m_byteIndex += len;
-
-      // insert newline
-      if (nl < end) {
-        // if there is text beyond 'col' on 'line-1', then that text
-        // gets floated down to the end of the insertion
-        if (tc.m_line==begin.m_line &&     // optimization: can only happen on first line
-            tc.m_byteIndex < buf.lineLengthByteIndex(tc.m_line)) {
-          // this can only happen on the first line of the insertion
-          // procedure, so check that we don't already have excess
-          xassert(excess.length() == 0);
-
-          // get the excess
-          ByteCount excessLength(
-            buf.lineLengthByteIndex(tc.m_line) - tc.m_byteIndex);
-          buf.getPartialLine(tc, excess, excessLength);
-          xassert(excess.length() == excessLength);
-
-          // remove it from the buffer
-          buf.deleteTextBytes(tc, excessLength);
-        }
-
-        ++tc.m_line;
-        buf.insertLine(tc.m_line);
-        tc.m_byteIndex.set(0);
-        len++;   // so we skip '\n' too
-      }
-
-      // skip consumed text
-      p += len;
-    }
-    xassert(p == end);
-
-    // insert the floated excess text, if any
-    if (excess.allocatedSize() > 0) {
-      buf.insertText(tc, excess.getArray(), ByteCount(excess.length()));
-    }
+    buf.replaceRange(TextMCoordRange(tc, tc),
+                     text.getArray(), ByteCount(text.length()));
   }
 
   else {
     // deletion
 
-    // location of the left edge of the text to delete
-    TextMCoord begin = tc;
-
-    // splice to perform at end?
-    int pendingSplice = 0;
-
     // check correspondence between the text in the event record and
     // what's in the buffer, without modifying the buffer yet
     ArrayStack<char> actualText(text.length());
@@ -171,67 +111,9 @@ STATICDEF void HE_text::insert(
     // ==> committed
 
     // contents are known to match, so delete the text
-    tc = begin;
-    char const *p = text.getArray();
-    char const *end = p + text.length();
-    while (p < end) {
-      // find next newline, or 'end'
-      char const *nl = p;
-      while (nl < end && *nl!='\n') {
-        nl++;
-      }
-
-      // length of this segment
-      ByteCount len(nl - p);
-
-      // delete the segment
-      buf.deleteTextBytes(tc, len);
-
-      // bypass newline
-      if (nl < end) {
-        // we deleted all text on this line after 'col'
-        xassert(buf.lineLengthBytes(tc.m_line) == tc.m_byteIndex);
-
-        if (tc.m_byteIndex == 0) {
-          // we're at the beginning of a line, and it is now empty,
-          // so just delete this line
-          buf.deleteLine(tc.m_line);
-        }
-        else {
-          // move line/col to beginning of next line, so that from
-          // now on we can work with whole deleted lines, but remember
-          // that there's a pending line splice
-          ++tc.m_line;
-          tc.m_byteIndex.set(0);
-          pendingSplice++;
-        }
-        len++;   // so we skip '\n' too
-      }
-
-      // skip consumed text
-      p += len;
-    }
-
-    if (pendingSplice) {
-      xassert(pendingSplice == 1);    // should only have one splice
-      xassert(tc.m_byteIndex == 0);   // it's this entire line that goes
-
-      // grab this line's contents
-      ByteCount spliceLen = buf.lineLengthBytes(tc.m_line);
-      ArrayStack<char> splice(spliceLen.get());
-      buf.getPartialLine(tc, splice, spliceLen);
-
-      // blow it away
-      buf.deleteTextBytes(tc, spliceLen);
-      buf.deleteLine(tc.m_line);
-
-      // move up to end of previous line
-      --tc.m_line;
-      tc.m_byteIndex = buf.lineLengthByteIndex(tc.m_line);
-
-      // append splice text
-      buf.insertText(tc, splice.getArray(), spliceLen);
-    }
+    TextMCoord end =
+      tc.plusText(text.getArray(), ByteCount(text.length()));
+    buf.replaceRange(TextMCoordRange(tc, end), "", ByteCount(0));
   }
 }
 
@@ -249,6 +131,27 @@ void HE_text::computeText(TextDocumentCore const &buf, ByteCount count)
 }
 
 
+TextMCoord HE_text::insertionEnd() const
+{
+  xassert(insertion);
+
+  return tc.plusText(text.getArray(), ByteCount(text.length()));
+}
+
+
+bool HE_text::tryCoalesce(HE_text const &obj)
+{
+  if (!insertion || !obj.insertion || obj.tc != insertionEnd()) {
+    return false;
+  }
+
+  for (int i=0; i < obj.text.length(); i++) {
+    text.push(obj.text[i]);
+  }
+  return true;
+}
+
+
 void HE_text::print(std::ostream &sb, int indent) const
 {
   sb << std::string(indent, ' ')
@@ -284,6 +187,16 @@ HE_group::~HE_group()
 
 void HE_group::append(HistoryElt *e)
 {
+  if (seqLength() > 0 &&
+      e->getTag() == HE_TEXT &&
+      seq[seqLength()-1]->getTag() == HE_TEXT) {
+    HE_text *prev = static_cast<HE_text*>(seq[seqLength()-1]);
+    if (prev->tryCoalesce(*static_cast<HE_text const*>(e))) {
+      delete e;
+      return;
+    }
+  }
+
   seq.push(e);
 }
 
@@ -424,7 +337,9 @@ HistoryStats::HistoryStats()
     groups(0),
     memUsage(0),
     mallocObjects(0),
-    reservedSpace(0)
+    reservedSpace(0),
+    compressedBytes(0),
+    spilledBytes(0)
 {}
 
 
@@ -443,6 +358,8 @@ void HistoryStats::printInfo() const
   printf("  mallocObjects: %d\n", mallocObjects);
   printf("  reservedSpace: %d\n", reservedSpace);
   printf("  totalUsage() : %d\n", totalUsage());
+  printf("  compressed   : %lld\n", compressedBytes);
+  printf("  spilled      : %lld\n", spilledBytes);
   fflush(stdout);
 }
 
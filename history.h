@@ -100,6 +100,15 @@ public:      // funcs
   // bytes; i.e., get the text that is deleted.  The entire span of
   // deleted text must be inside the document boundaries.
   void computeText(TextDocumentCore const &buf, ByteCount count);
+
+  // For an insertion, the coordinate just past the inserted text after
+  // it has been applied.
+  TextMCoord insertionEnd() const;
+
+  // If `obj` is an insertion that starts where this insertion ends,
+  // append its text to this one and return true.  Applying the result
+  // is then equivalent to applying the two in sequence.
+  bool tryCoalesce(HE_text const &obj);
 };
 
 
@@ -128,9 +137,14 @@ public:      // funcs
   // Number of elements in this group.
   int seqLength() const         { return seq.length(); }
 
-  // Add 'e' to the end of this group, taking ownership of it.
+  // Add 'e' to the end of this group, taking ownership of it.  If it
+  // is an insertion that continues the previous element, which is
+  // common while typing, it is merged into that element and deleted.
   void append(HistoryElt *e);
 
+  // Get the element at 'index'.
+  HistoryElt const *getElement(int index) const { return seq[index]; }
+
   // Pull the last element out of the sequence, returning an owner
   // pointer.  The sequence must be non-empty.
   HistoryElt *popLastElement();
@@ -192,6 +206,13 @@ public:
   // for example the space in the gap for HE_group
   int reservedSpace;
 
+  // bytes of compressed history held in memory; these are also
+  // included in 'memUsage'
+  long long compressedBytes;
+
+  // bytes of history moved out of memory into a temporary file
+  long long spilledBytes;
+
 public:
   HistoryStats();
 
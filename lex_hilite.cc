@@ -5,12 +5,14 @@
 
 // editor
 #include "inclexer.h"                  // IncLexer
+#include "line-difference.h"           // LineDifference
 #include "td-core.h"                   // TextDocumentCore
 #include "td-editor.h"                 // TextDocument[And]Editor
 #include "textcategory.h"              // LineCategoryAOAs
 
 // smbase
 #include "smbase/exc.h"                // GENERIC_CATCH_BEGIN/END
+#include "smbase/nonport.h"            // getMilliseconds
 #include "smbase/sm-file-util.h"       // SMFileUtil
 #include "smbase/sm-fstream.h"         // ofstream
 #include "smbase/sm-test.h"            // DIAG, EXPECT_EQ
@@ -20,7 +22,11 @@
 #include "smbase/xassert.h"            // xfailure_stringbc
 
 // libc++
+#include <algorithm>                   // std::count, std::max
+#include <cstring>                     // std::strlen
+#include <iostream>                    // std::cout
 #include <memory>                      // std::unique_ptr
+#include <string>                      // std::string
 
 // libc
 #include <stdlib.h>                    // exit
@@ -30,9 +36,9 @@ LexHighlighter::LexHighlighter(TextDocumentCore const &buf, IncLexer &L)
   : buffer(&buf),
     lexer(L),
     savedState(),
-    changedBegin(0),
-    changedEnd(0),
-    waterline(0)
+    changedRegions(),
+    waterline(0),
+    linesLexed(0)
 {
   buffer->addObserver(this);
 
@@ -51,54 +57,112 @@ LexHighlighter::~LexHighlighter()
 void LexHighlighter::checkInvar() const
 {
   xassert(waterline <= buffer->numLines());
+  xassert((int)changedRegions.size() <= MAX_CHANGED_REGIONS);
+
+  for (size_t i=0; i < changedRegions.size(); i++) {
+    ChangedRegion const &r = changedRegions[i];
+    xassert(r.begin < r.end);
+    xassert(r.end <= waterline);
+    if (i > 0) {
+      // disjoint and not adjacent
+      xassert(changedRegions[i-1].end < r.begin);
+    }
+  }
+}
 
-  if (!changedIsEmpty()) {
-    xassert(changedBegin < changedEnd);
-    xassert(waterline >= changedEnd);
 
-    xassert(changedEnd <= buffer->numLines());
+void LexHighlighter::mergeWithNextIfAdjacent(int index)
+{
+  if (index+1 < (int)changedRegions.size() &&
+      changedRegions[index].end == changedRegions[index+1].begin) {
+    changedRegions[index].end = changedRegions[index+1].end;
+    changedRegions.erase(changedRegions.begin() + index+1);
   }
 }
 
 
-void LexHighlighter::addToChanged(LineIndex line)
+void LexHighlighter::removeEmptyAndMergeAdjacentRegions()
 {
-  // invariant: considering the actual set of changed lines (not the
-  // conservative overapproximation I store), the 'changed' region is
-  // the topmost contiguous subset of actual changed lines, and the
-  // water begins at the next actual changed line after that
+  std::vector<ChangedRegion> orig;
+  orig.swap(changedRegions);
 
-  if (line >= waterline) {
-    // do nothing, it's in the water
-  }
-  else if (changedIsEmpty()) {
-    changedBegin = line;
-    changedEnd = line.succ();
+  for (ChangedRegion const &r : orig) {
+    if (r.begin == r.end) {
+      // drop it
+    }
+    else if (!changedRegions.empty() &&
+             changedRegions.back().end == r.begin) {
+      changedRegions.back().end = r.end;
+    }
+    else {
+      changedRegions.push_back(r);
+    }
   }
-  else if (line.succ() == changedBegin) {
-    // extend changed region up by 1
-    --changedBegin;
+}
+
+
+void LexHighlighter::mergeClosestRegions()
+{
+  xassert(changedRegions.size() >= 2);
+
+  int best = 0;
+  for (int i=1; i+1 < (int)changedRegions.size(); i++) {
+    if (changedRegions[i+1].begin - changedRegions[i].end <
+        changedRegions[best+1].begin - changedRegions[best].end) {
+      best = i;
+    }
   }
-  else if (line == changedEnd) {
-    // extend changed region down by 1
-    ++changedEnd;
+
+  // the lines in between are unchanged, but including them is
+  // conservative; re-lexing them just reproduces their saved states
+  changedRegions[best].end = changedRegions[best+1].end;
+  changedRegions.erase(changedRegions.begin() + best+1);
+}
+
+
+void LexHighlighter::addToChanged(LineIndex line)
+{
+  if (line >= waterline) {
+    // do nothing, it's in the water
+    return;
   }
-  else if (line < changedBegin) {
-    // line is discontiguous with existing changed region, so absorb
-    // the current region into the water and set the new changed region
-    // to contain just this line
-    waterline = changedBegin;
-    changedBegin = line;
-    changedEnd = line.succ();
+
+  // find the first region that ends at or after 'line'
+  int i = 0;
+  while (i < (int)changedRegions.size() &&
+         changedRegions[i].end < line) {
+    i++;
   }
-  else if (line > changedEnd) {
-    // line is below changed region, move the water up to absorb it
-    waterline = line;
+
+  if (i < (int)changedRegions.size()) {
+    ChangedRegion &r = changedRegions[i];
+    if (r.begin <= line && line < r.end) {
+      // line is in changed region already, nothing to do
+      return;
+    }
+    else if (line == r.end) {
+      // extend region down by 1, possibly meeting the next one
+      ++r.end;
+      mergeWithNextIfAdjacent(i);
+      checkInvar();
+      return;
+    }
+    else if (line.succ() == r.begin) {
+      // extend region up by 1; the previous region, if any, ends
+      // before 'line', so they cannot become adjacent
+      --r.begin;
+      checkInvar();
+      return;
+    }
   }
-  else {
-    // line must be in changed region already, nothing to do
-    xassert(changedBegin <= line &&
-                            line < changedEnd);
+
+  // line is discontiguous with the existing regions, so it gets its
+  // own, leaving the others intact so their saved states can still
+  // be used to detect convergence
+  changedRegions.insert(changedRegions.begin() + i,
+                        ChangedRegion{line, line.succ()});
+  if ((int)changedRegions.size() > MAX_CHANGED_REGIONS) {
+    mergeClosestRegions();
   }
 
   checkInvar();
@@ -120,10 +184,16 @@ void LexHighlighter::observeInsertLine(TextDocumentCore const &, LineIndex line)
 {
   GENERIC_CATCH_BEGIN
 
-  // if region ends after 'line', then now it ends one line later
-  if (!changedIsEmpty() &&
-      changedEnd >= line.succ()) {
-    ++changedEnd;
+  // regions at or after 'line' move down; a region containing it
+  // gets one line longer
+  for (ChangedRegion &r : changedRegions) {
+    if (r.begin >= line) {
+      ++r.begin;
+      ++r.end;
+    }
+    else if (r.end > line) {
+      ++r.end;
+    }
   }
 
   // similarly for the waterline
@@ -134,7 +204,9 @@ void LexHighlighter::observeInsertLine(TextDocumentCore const &, LineIndex line)
   addToChanged(line);
 
   // insert a new saved state, initialized to the state of the
-  // line above it
+  // line above it; that is the state the line below was lexed with,
+  // so if lexing the new line yields it again, the change has
+  // converged
   savedState.insert(line, getPreviousLineSavedState(line));
 
   GENERIC_CATCH_END
@@ -145,17 +217,27 @@ void LexHighlighter::observeDeleteLine(TextDocumentCore const &, LineIndex line)
 {
   GENERIC_CATCH_BEGIN
 
-  // if region ends after 'line', then now it ends one line earlier
-  if (!changedIsEmpty() &&
-      changedEnd > line) {
-    --changedEnd;
+  // regions after 'line' move up; a region containing it gets one
+  // line shorter
+  for (ChangedRegion &r : changedRegions) {
+    if (r.begin > line) {
+      --r.begin;
+      --r.end;
+    }
+    else if (r.end > line) {
+      --r.end;
+    }
   }
+  removeEmptyAndMergeAdjacentRegions();
 
   // similarly for waterline
   if (waterline > line) {
     --waterline;
   }
 
+  // the line that moved up into 'line' was lexed starting in the
+  // state of the deleted line, which may differ from its new
+  // predecessor's
   addToChanged(line);
 
   // remove a saved state
@@ -184,8 +266,7 @@ void LexHighlighter::observeTotalChange(TextDocumentCore const &doc) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
 
-  changedBegin = LineIndex(0);
-  changedEnd = LineIndex(0);
+  changedRegions.clear();
   waterline = LineIndex(0);
 
   // all of the saved state is stale
@@ -196,6 +277,85 @@ void LexHighlighter::observeTotalChange(TextDocumentCore const &doc) NOEXCEPT
 }
 
 
+// Map 'line' across the deletion of 'count' lines starting at
+// 'start': lines after them move up, and lines within them go to
+// 'start'.
+static LineIndex lineAfterDeletion(LineIndex line, LineIndex start,
+                                   int count)
+{
+  if (line <= start) {
+    return line;
+  }
+  return LineIndex(std::max(start.get(), line.get() - count));
+}
+
+
+void LexHighlighter::observeReplaceRange(TextDocumentCore const &, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *, ByteCount) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+
+  // The lines after the first one of the range were replaced by those
+  // after the first one of the new text.  Handle any difference in
+  // their number just below the first line, like a run of
+  // 'observeInsertLine' or 'observeDeleteLine' calls there; all of the
+  // lines in the new text are marked changed below anyway.
+  LineIndex const first = oldRange.m_start.m_line;
+  int const oldExtra = (oldRange.m_end.m_line - first).get();
+  int const newExtra = (newEnd.m_line - first).get();
+  LineIndex const splice = first.succ();
+
+  if (newExtra > oldExtra) {
+    LineDifference const n(newExtra - oldExtra);
+
+    for (ChangedRegion &r : changedRegions) {
+      if (r.begin >= splice) {
+        r.begin += n;
+        r.end += n;
+      }
+      else if (r.end > splice) {
+        r.end += n;
+      }
+    }
+
+    if (waterline >= splice) {
+      waterline += n;
+    }
+
+    // as in 'observeInsertLine', the new saved states start out as the
+    // state of the line above
+    for (int i=0; i < n.get(); i++) {
+      savedState.insert(splice, getPreviousLineSavedState(splice));
+    }
+  }
+
+  else if (newExtra < oldExtra) {
+    int const n = oldExtra - newExtra;
+
+    for (ChangedRegion &r : changedRegions) {
+      r.begin = lineAfterDeletion(r.begin, splice, n);
+      r.end = lineAfterDeletion(r.end, splice, n);
+    }
+    removeEmptyAndMergeAdjacentRegions();
+
+    waterline = lineAfterDeletion(waterline, splice, n);
+
+    savedState.removeMany(splice, LineCount(n));
+  }
+
+  // every line of the new text has changed, and if the number of
+  // lines changed, so may the starting state of the line after them
+  LineIndex last = newEnd.m_line;
+  if (newExtra != oldExtra) {
+    ++last;
+  }
+  for (LineIndex line = first; line <= last; ++line) {
+    addToChanged(line);
+  }
+
+  GENERIC_CATCH_END
+}
+
+
 void LexHighlighter::saveLineState(LineIndex line, LexerState _state)
 {
   LineState state = (LineState)_state;
@@ -203,71 +363,83 @@ void LexHighlighter::saveLineState(LineIndex line, LexerState _state)
 
   LineState prev = savedState.get(line);
 
-  if (line >= waterline) {
-    savedState.set(line, state);
-    if (line == waterline) {
-      // push down waterline by 1
-      ++waterline;
-    }
+  LineIndex const first = firstUnreadyLine();
+  xassert(line <= first);
+
+  if (line < first) {
+    // already up to date
+    xassert(prev == state);
   }
   else if (changedIsEmpty()) {
-    xassert(prev == state);
+    // push down waterline by 1
+    xassert(line == waterline);
+    savedState.set(line, state);
+    ++waterline;
   }
   else {
-    if (line == changedBegin) {
-      ++changedBegin;
-      savedState.set(line, state);
-    }
+    ChangedRegion &r = changedRegions.front();
+    xassert(line == r.begin);
+    savedState.set(line, state);
+    ++r.begin;
 
-    if (line.succ() == changedEnd && prev != state) {
+    if (r.begin == r.end && prev != state) {
       // the state has changed, so we need to re-eval the next line
-      if (changedEnd < waterline) {
-        ++changedEnd;
+      if (r.end < waterline) {
+        ++r.end;
+        mergeWithNextIfAdjacent(0);
       }
       else {
-        // no need to keep moving the 'changed' region, the waterline
-        // has responsibility for marking 'line+1' and beyond as "changed"
-        xassert(changedEnd == waterline);
+        // no need to keep moving the region, the waterline has
+        // responsibility for marking 'line+1' and beyond as "changed"
+        xassert(r.end == waterline);
       }
     }
+
+    if (r.begin == r.end) {
+      // Either the state converged to what it was before, so all of
+      // the lines down to the next region are still valid, or the
+      // region reached the waterline.
+      changedRegions.erase(changedRegions.begin());
+    }
   }
 
   checkInvar();
 }
 
 
-void LexHighlighter::highlight(
-  TextDocumentCore const &buf,
-  LineIndex line,
-  LineCategoryAOAs &categories)
+LineIndex LexHighlighter::firstUnreadyLine() const
 {
-  xassert(&buf == buffer);
+  return changedIsEmpty()? waterline : changedRegions.front().begin;
+}
 
-  // push the changed region down to the line of interest
-  LexerState prevState = getPreviousLineSavedState(changedBegin);
-  while (!changedIsEmpty() && changedBegin < line) {
-    TRACE("highlight", "push changed: scanning line " << changedBegin);
-    lexer.beginScan(&buf, changedBegin, prevState);
+
+void LexHighlighter::advanceFrontier(LineIndex line)
+{
+  // push the changed regions down to the line of interest
+  while (!changedIsEmpty() && changedRegions.front().begin < line) {
+    LineIndex cur = changedRegions.front().begin;
+    TRACE("highlight", "push changed: scanning line " << cur);
+    lexer.beginScan(buffer, cur, getPreviousLineSavedState(cur));
+    ++linesLexed;
 
     TextCategoryAOA code;
     while (lexer.getNextToken(code))
       {}
 
-    prevState = lexer.getState();
-
-    // this increments 'changedBegin', and if the state doesn't change
-    // then it won't increment 'changedEnd', so we might exit the loop
-    // due to changedIsEmpty() becoming true
-    saveLineState(changedBegin, prevState);
+    // this advances the first region, and if the state doesn't change
+    // then that region ends, so we might exit the loop due to
+    // changedIsEmpty() becoming true, or skip to the next region
+    saveLineState(cur, lexer.getState());
   }
 
   // push the waterline down also; do this after moving 'changed'
   // because 'changes' is above and we need those highlighting actions
   // to have completed so we're not working with stale saved stages
-  prevState = getPreviousLineSavedState(waterline);
+  LexerState prevState = getPreviousLineSavedState(waterline);
   while (waterline < line) {
     TRACE("highlight", "push waterline: scanning line " << waterline);
-    lexer.beginScan(&buf, waterline, prevState);
+    lexer.beginScan(buffer, waterline, prevState);
+    ++linesLexed;
 
     TextCategoryAOA code;
     while (lexer.getNextToken(code))
@@ -278,11 +450,17 @@ void LexHighlighter::highlight(
     // this increments 'waterline'
     saveLineState(waterline, prevState);
   }
+}
 
-  // recall the saved state for the line of interest
-  TRACE("highlight", "at requested: scanning line " << line);
-  prevState = getPreviousLineSavedState(line);
-  lexer.beginScan(&buf, line, prevState);
+
+LexerState LexHighlighter::lexLine(
+  TextDocumentCore const &buf,
+  LineIndex line,
+  LexerState state,
+  LineCategoryAOAs &categories)
+{
+  lexer.beginScan(&buf, line, state);
+  ++linesLexed;
 
   // Append each categorized segment.
   TextCategoryAOA code;
@@ -294,7 +472,81 @@ void LexHighlighter::highlight(
   }
   categories.setTailValue(code);    // line trails off with the final code
 
-  saveLineState(line, lexer.getState());
+  return lexer.getState();
+}
+
+
+void LexHighlighter::highlight(
+  TextDocumentCore const &buf,
+  LineIndex line,
+  LineCategoryAOAs &categories)
+{
+  xassert(&buf == buffer);
+
+  advanceFrontier(line);
+
+  // recall the saved state for the line of interest
+  TRACE("highlight", "at requested: scanning line " << line);
+  LexerState state =
+    lexLine(buf, line, getPreviousLineSavedState(line), categories);
+
+  saveLineState(line, state);
+}
+
+
+bool LexHighlighter::highlightWithinLimit(
+  TextDocumentCore const &buf,
+  LineIndex line,
+  LineCount lexLimit,
+  LineCategoryAOAs &categories)
+{
+  xassert(&buf == buffer);
+
+  LineIndex const first = firstUnreadyLine();
+  if (first < line && line - first > LineDifference(lexLimit)) {
+    // Use the stale saved state as a guess, and do not save the
+    // result, since it is not reliable.
+    TRACE("highlight", "provisional: scanning line " << line <<
+                       ", first unready is " << first);
+    lexLine(buf, line, getPreviousLineSavedState(line), categories);
+    return false;
+  }
+
+  highlight(buf, line, categories);
+  return true;
+}
+
+
+bool LexHighlighter::lineIsReady(LineIndex line) const
+{
+  return line <= firstUnreadyLine();
+}
+
+
+bool LexHighlighter::hasBackgroundWork() const
+{
+  return firstUnreadyLine() < buffer->numLines();
+}
+
+
+void LexHighlighter::highlightInBackground(long budgetMS)
+{
+  // Number of lines to lex between checks of the clock.
+  LineDifference const chunkLines(256);
+
+  long const startMS = getMilliseconds();
+  do {
+    LineIndex target = firstUnreadyLine() + chunkLines;
+    if (target > buffer->numLines()) {
+      target = LineIndex(buffer->numLines());
+    }
+    advanceFrontier(target);
+  } while (hasBackgroundWork() &&
+           getMilliseconds() - startMS < budgetMS);
+
+  TRACE("highlight", "background: first unready line is now " <<
+                     firstUnreadyLine() << " after " <<
+                     (getMilliseconds() - startMS) << " ms");
 }
 
 
@@ -396,6 +648,132 @@ void testHighlighter(LexHighlighter &hi, TextDocumentAndEditor &tde,
 }
 
 
+// Highlight the 'numLines' lines starting at 'top' as a repaint would.
+// Return the number of lines whose result was provisional.
+static int paintWindow(LexHighlighter &hi, TextDocumentAndEditor &tde,
+                       LineIndex top, int numLines, int lexLimit)
+{
+  int provisional = 0;
+  for (int i=0; i < numLines; i++) {
+    LineIndex line = top + LineDifference(i);
+    if (line >= tde.numLines()) {
+      break;
+    }
+
+    LineCategoryAOAs categories(TC_NORMAL);
+    if (!hi.highlightTDEWithinLimit(&tde, line, LineCount(lexLimit),
+                                    categories)) {
+      provisional++;
+    }
+  }
+  return provisional;
+}
+
+
+void perfHighlighterKeystrokes(LexHighlighter &hi,
+                               TextDocumentAndEditor &tde,
+                               string inputFname, int numLines,
+                               int lexLimit, char const *blockOpener)
+{
+  // Lines in a screenful.
+  int const windowLines = 60;
+
+  // Build the document.
+  std::string chunk = SMFileUtil().readFileAsString(inputFname);
+  if (chunk.empty() || chunk.back() != '\n') {
+    chunk += '\n';
+  }
+  std::string contents;
+  int chunkLines = std::count(chunk.begin(), chunk.end(), '\n');
+  for (int n=0; n < numLines; n += chunkLines) {
+    contents += chunk;
+  }
+  tde.writableDoc().replaceWholeFileString(contents);
+
+  // Initial highlighting of the whole file.
+  long start = getMilliseconds();
+  while (hi.hasBackgroundWork()) {
+    hi.highlightInBackground(1000 /*ms*/);
+  }
+  long initialMS = getMilliseconds() - start;
+
+  std::cout << inputFname << ": lines=" << tde.numLines()
+            << " lexLimit=" << lexLimit
+            << " initialMS=" << initialMS
+            << std::endl;
+
+  // Type in the middle of the document, one character per keystroke,
+  // starting a new line now and then.
+  {
+    int const keystrokes = 2000;
+    LineIndex top(tde.numLines().get() / 2);
+    tde.setCursor(TextLCoord(top + LineDifference(windowLines/2),
+                             ColumnIndex(0)));
+
+    long lexedBefore = hi.getLinesLexed();
+    start = getMilliseconds();
+    for (int i=0; i < keystrokes; i++) {
+      if (i % 40 == 39) {
+        tde.insertNewline();
+      }
+      else {
+        tde.insertNulTermText("x");
+      }
+      paintWindow(hi, tde, top, windowLines, lexLimit);
+    }
+    long typingMS = getMilliseconds() - start;
+
+    std::cout << "  typing: keystrokes=" << keystrokes
+              << " totalMS=" << typingMS
+              << " usPerKeystroke=" << (typingMS * 1000 / keystrokes)
+              << " linesLexedPerKeystroke="
+              << ((hi.getLinesLexed() - lexedBefore) / keystrokes)
+              << std::endl;
+  }
+
+  // Toggle a construct that changes the state of every following line,
+  // while looking at the top of the file.
+  {
+    int const toggles = 200;
+    ByteCount const openerLen(std::strlen(blockOpener));
+    TextLCoord const where(LineIndex(1), ColumnIndex(0));
+
+    long lexedBefore = hi.getLinesLexed();
+    int provisional = 0;
+    start = getMilliseconds();
+    for (int i=0; i < toggles; i++) {
+      tde.setCursor(where);
+      if (i % 2 == 0) {
+        tde.insertNulTermText(blockOpener);
+      }
+      else {
+        tde.deleteTextBytes(openerLen);
+      }
+      provisional +=
+        paintWindow(hi, tde, LineIndex(0), windowLines, lexLimit);
+    }
+    long toggleMS = getMilliseconds() - start;
+    long toggleLexed = hi.getLinesLexed() - lexedBefore;
+
+    // Then let the background work finish.
+    start = getMilliseconds();
+    while (hi.hasBackgroundWork()) {
+      hi.highlightInBackground(1000 /*ms*/);
+    }
+    long catchUpMS = getMilliseconds() - start;
+
+    std::cout << "  toggle " << doubleQuote(blockOpener)
+              << ": keystrokes=" << toggles
+              << " totalMS=" << toggleMS
+              << " usPerKeystroke=" << (toggleMS * 1000 / toggles)
+              << " linesLexedPerKeystroke=" << (toggleLexed / toggles)
+              << " provisionalLines=" << provisional
+              << " catchUpMS=" << catchUpMS
+              << std::endl;
+  }
+}
+
+
 // ---------------------- test code -------------------------
 static MakeHighlighterFunc makeHigh;
 static TextDocumentEditor *tde;
@@ -15,6 +15,9 @@
 #include "smbase/sm-noexcept.h"        // NOEXCEPT
 #include "smbase/sm-override.h"        // OVERRIDE
 
+// libc++
+#include <vector>                      // std::vector
+
 
 // the highlighter
 class LexHighlighter : public Highlighter {
@@ -29,51 +32,119 @@ private:     // data
   typedef char LineState;
   LineGapArray<LineState> savedState;
 
-  // range of lines whose contents have changed since the last time
-  // their 'savedState' was computed; changedEnd is the first line
-  // after the changed region that is *not* changed, so if
-  // changedBegin==changedEnd then nothing has changed
-  LineIndex changedBegin, changedEnd;
-
-  // in addition the the changed region above, we maintain a line
+  // A contiguous range of lines whose saved states may be stale,
+  // `[begin,end)`.  Never empty.
+  struct ChangedRegion {
+    LineIndex begin;
+    LineIndex end;
+  };
+
+  // Regions of lines whose contents (or starting state) have changed
+  // since the last time their 'savedState' was computed, in increasing
+  // order.  Regions are disjoint and not adjacent.
+  //
+  // The lines between regions have saved states that are still valid,
+  // so they act as checkpoints: when re-lexing the last line of a
+  // region produces the same state that was saved for it before, the
+  // region is done, and lexing resumes at the next region.  Keeping
+  // more than one region means that an edit above an earlier,
+  // unfinished one does not discard the latter's convergence point.
+  std::vector<ChangedRegion> changedRegions;
+
+  // Maximum number of elements in 'changedRegions'.  When exceeded,
+  // the two regions closest together are merged.
+  static int const MAX_CHANGED_REGIONS = 32;
+
+  // in addition the the changed regions above, we maintain a line
   // for which no highlighting has been done at or below it (the
   // "water" metaphor is meant to suggest that we can't see below it);
-  // invariant: if !changedIsEmpty() then waterline >= changedEnd
+  // invariant: every changed region ends at or above the waterline
   LineIndex waterline;
 
+  // Total number of lines passed to the lexer, for tests and
+  // performance measurement.
+  long linesLexed;
+
 private:     // funcs
   // check local invariants, fail assertion if they don't hold
   void checkInvar() const;
 
-  // true if changed region is empty
-  bool changedIsEmpty() const { return changedBegin == changedEnd; }
+  // true if there are no changed regions
+  bool changedIsEmpty() const { return changedRegions.empty(); }
 
-  // expand changed region to include at least 'line'
+  // expand the changed regions to include at least 'line'
   void addToChanged(LineIndex line);
 
+  // If the region at 'index' is adjacent to the one after it, merge
+  // the two.
+  void mergeWithNextIfAdjacent(int index);
+
+  // After shifting region boundaries, discard empty regions and merge
+  // those that now touch.
+  void removeEmptyAndMergeAdjacentRegions();
+
+  // Merge the two adjacent elements of 'changedRegions' that have the
+  // fewest lines between them.
+  void mergeClosestRegions();
+
   // Get the saved state for the end of the line before `line`.  Returns
   // LS_INITIAL if `line.isZero()`.
   LexerState getPreviousLineSavedState(LineIndex line) const;
 
   // set the saved state for 'line' to 'state', adjusting the changed
-  // regions to exclude 'line'; the expectation is we're doing this
-  // to one of the lines at the top edge of a contiguous changed region
+  // regions to exclude 'line'; 'line' must be at or above
+  // firstUnreadyLine()
   void saveLineState(LineIndex line, LexerState state);
 
+  // First line whose starting state might be wrong: the top of the
+  // first changed region if there is one, otherwise the waterline.
+  // Every line at or above this one can be highlighted exactly without
+  // scanning any others.
+  LineIndex firstUnreadyLine() const;
+
+  // Lex the lines needed to make every line above `line` have an
+  // up to date saved state, by pushing the changed regions and then
+  // the waterline down to `line`.
+  void advanceFrontier(LineIndex line);
+
+  // Lex `line` starting in `state` and append the resulting segments
+  // to `categories`.  Return the state at the end of the line.
+  LexerState lexLine(TextDocumentCore const &buf, LineIndex line,
+                     LexerState state, LineCategoryAOAs &categories);
+
 public:      // funcs
   LexHighlighter(TextDocumentCore const &buf, IncLexer &lex);
   virtual ~LexHighlighter();
 
+  // Number of lines lexed so far.
+  long getLinesLexed() const { return linesLexed; }
+
   // TextDocumentObserver funcs
   virtual void observeInsertLine(TextDocumentCore const &buf, LineIndex line) NOEXCEPT OVERRIDE;
   virtual void observeDeleteLine(TextDocumentCore const &buf, LineIndex line) NOEXCEPT OVERRIDE;
   virtual void observeInsertText(TextDocumentCore const &buf, TextMCoord tc, char const *text, ByteCount length) NOEXCEPT OVERRIDE;
   virtual void observeDeleteText(TextDocumentCore const &buf, TextMCoord tc, ByteCount length) NOEXCEPT OVERRIDE;
   virtual void observeTotalChange(TextDocumentCore const &doc) NOEXCEPT OVERRIDE;
+  virtual void observeReplaceRange(TextDocumentCore const &buf, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount length) NOEXCEPT OVERRIDE;
 
   // Highlighter funcs
   virtual void highlight(TextDocumentCore const &buf, LineIndex line,
                          LineCategoryAOAs &categories) OVERRIDE;
+
+  // When the previous line's state is not up to date, the provisional
+  // result uses the state saved for it anyway, which is what it was
+  // before the most recent edits, or `LS_INITIAL` if it was never
+  // computed.
+  virtual bool highlightWithinLimit(
+    TextDocumentCore const &buf, LineIndex line, LineCount lexLimit,
+    LineCategoryAOAs &categories) OVERRIDE;
+
+  virtual bool lineIsReady(LineIndex line) const OVERRIDE;
+  virtual bool hasBackgroundWork() const OVERRIDE;
+
+  // Advance the changed regions and waterline toward the end of the
+  // document, checking the clock every so many lines.
+  virtual void highlightInBackground(long budgetMS) OVERRIDE;
 };
 
 
@@ -104,5 +175,21 @@ void printHighlightedLines(TextDocumentCore const &tdc,
 void testHighlighter(LexHighlighter &hi, TextDocumentAndEditor &tde,
                      string inputFname);
 
+// Measure how long 'hi' takes to respond to keystrokes in a large
+// document made by repeating the contents of 'inputFname' until it has
+// at least 'numLines' lines, and print the results to stdout.
+//
+// Each keystroke is followed by highlighting a screenful of lines
+// around the cursor the way EditorWidget does, with lexing limited to
+// 'lexLimit' lines.  One pass types ordinary text in the middle of the
+// document; another repeatedly inserts and removes 'blockOpener' (such
+// as "/*") at the top, which changes the state of every line below.
+//
+// 'tde' is as for 'testHighlighter'.
+void perfHighlighterKeystrokes(LexHighlighter &hi,
+                               TextDocumentAndEditor &tde,
+                               string inputFname, int numLines,
+                               int lexLimit, char const *blockOpener);
+
 
 #endif // LEX_HILITE_H
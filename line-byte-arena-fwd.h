@@ -0,0 +1,12 @@
+// line-byte-arena-fwd.h
+// Forward decls for `line-byte-arena.h`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_BYTE_ARENA_FWD_H
+#define EDITOR_LINE_BYTE_ARENA_FWD_H
+
+class LineByteArena;
+class LineByteArenaStats;
+
+#endif // EDITOR_LINE_BYTE_ARENA_FWD_H
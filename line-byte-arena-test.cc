@@ -0,0 +1,237 @@
+// line-byte-arena-test.cc
+// Tests for `line-byte-arena` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-byte-arena.h"           // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ
+#include "smbase/xassert.h"            // xassert
+
+#include <cstddef>                     // std::size_t
+#include <cstring>                     // std::memset
+#include <memory>                      // std::shared_ptr
+#include <vector>                      // std::vector
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+void testBasics()
+{
+  LineByteArena arena;
+  EXPECT_EQ(arena.getStats().m_numChunks, (std::size_t)0);
+
+  char *a = arena.allocate(ByteCount(10));
+  char *b = arena.allocate(ByteCount(20));
+  std::memset(a, 'a', 10);
+  std::memset(b, 'b', 20);
+
+  // Small allocations share a chunk.
+  EXPECT_EQ(arena.getStats().m_numChunks, (std::size_t)1);
+  EXPECT_EQ(arena.liveBytes(), (std::size_t)30);
+  xassert(b == a + 10);
+  arena.selfCheck();
+
+  // Freeing the most recent allocation makes its space reusable.
+  arena.deallocate(b, ByteCount(20));
+  EXPECT_EQ(arena.getStats().m_deadBytes, (std::size_t)0);
+  char *c = arena.allocate(ByteCount(5));
+  xassert(c == b);
+
+  // Freeing an older allocation leaves dead space.
+  arena.deallocate(a, ByteCount(10));
+  EXPECT_EQ(arena.getStats().m_deadBytes, (std::size_t)10);
+  arena.selfCheck();
+
+  // A large allocation gets its own chunk, which is released when
+  // freed.
+  ByteCount bigLen(LineByteArena::LARGE_ALLOCATION_BYTES);
+  char *big = arena.allocate(bigLen);
+  EXPECT_EQ(arena.getStats().m_numChunks, (std::size_t)2);
+  arena.deallocate(big, bigLen);
+  EXPECT_EQ(arena.getStats().m_numChunks, (std::size_t)1);
+
+  arena.deallocate(c, ByteCount(5));
+  EXPECT_EQ(arena.liveBytes(), (std::size_t)0);
+  arena.selfCheck();
+
+  arena.clear();
+  EXPECT_EQ(arena.getStats().m_numChunks, (std::size_t)0);
+}
+
+
+void testCompaction()
+{
+  LineByteArena arena;
+
+  // Fill several chunks with 100-byte allocations.
+  int const N = 5000;
+  std::vector<char*> ptrs;
+  for (int i=0; i < N; i++) {
+    char *p = arena.allocate(ByteCount(100));
+    p[0] = (char)i;
+    ptrs.push_back(p);
+  }
+  std::size_t origChunks = arena.getStats().m_numChunks;
+  xassert(origChunks > 4);
+  xassert(!arena.shouldCompact());
+
+  // Free three out of every four.
+  for (int i=0; i < N; i++) {
+    if (i % 4 != 0) {
+      arena.deallocate(ptrs[i], ByteCount(100));
+      ptrs[i] = nullptr;
+    }
+  }
+  xassert(arena.shouldCompact());
+  xassert(arena.getStats().fragmentation() > 0.5);
+  EXPECT_EQ(arena.deadBytes(), arena.getStats().m_deadBytes);
+
+  // Relocate the survivors.
+  xassert(arena.beginCompaction() > 0);
+  for (int i=0; i < N; i++) {
+    if (ptrs[i] && arena.inRetiringChunk(ptrs[i])) {
+      char *p = arena.allocate(ByteCount(100));
+      p[0] = ptrs[i][0];
+      arena.deallocate(ptrs[i], ByteCount(100));
+      ptrs[i] = p;
+    }
+  }
+  EXPECT_EQ(arena.endCompaction(), 0);
+  arena.selfCheck();
+
+  EXPECT_EQ(arena.getStats().m_deadBytes, (std::size_t)0);
+  EXPECT_EQ(arena.deadBytes(), (std::size_t)0);
+  xassert(arena.getStats().m_numChunks < origChunks / 2);
+  xassert(!arena.shouldCompact());
+
+  // Contents survived.
+  for (int i=0; i < N; i++) {
+    if (ptrs[i]) {
+      EXPECT_EQ(ptrs[i][0], (char)i);
+    }
+  }
+}
+
+
+// Compaction spread over several steps with other activity in
+// between, where some allocations are missed.
+void testIncrementalCompaction()
+{
+  LineByteArena arena;
+
+  int const N = 5000;
+  std::vector<char*> ptrs;
+  for (int i=0; i < N; i++) {
+    char *p = arena.allocate(ByteCount(100));
+    p[0] = (char)i;
+    ptrs.push_back(p);
+  }
+  for (int i=0; i < N; i++) {
+    if (i % 4 != 0) {
+      arena.deallocate(ptrs[i], ByteCount(100));
+      ptrs[i] = nullptr;
+    }
+  }
+  xassert(arena.shouldCompact());
+
+  xassert(arena.beginCompaction() > 0);
+  xassert(arena.isCompacting());
+
+  // Relocate in slices, interleaved with new allocations, and skip the
+  // last survivor.
+  std::vector<char*> extra;
+  for (int i=0; i < N-4; i++) {
+    if (ptrs[i] && arena.inRetiringChunk(ptrs[i])) {
+      char *p = arena.allocate(ByteCount(100));
+      p[0] = ptrs[i][0];
+      arena.deallocate(ptrs[i], ByteCount(100));
+      ptrs[i] = p;
+    }
+    if (i % 500 == 0) {
+      char *p = arena.allocate(ByteCount(50));
+      xassert(!arena.inRetiringChunk(p));
+      extra.push_back(p);
+      arena.selfCheck();
+    }
+  }
+
+  // The chunk with the missed survivor is kept.
+  EXPECT_EQ(arena.endCompaction(), 1);
+  xassert(!arena.isCompacting());
+  arena.selfCheck();
+  EXPECT_EQ(arena.deadBytes(), arena.getStats().m_deadBytes);
+
+  // Its dead space is not enough to prompt another pass.
+  xassert(!arena.shouldCompact());
+
+  for (int i=0; i < N; i++) {
+    if (ptrs[i]) {
+      EXPECT_EQ(ptrs[i][0], (char)i);
+    }
+  }
+
+  // Clearing abandons a pass in progress.
+  arena.beginCompaction();
+  arena.clear();
+  xassert(!arena.isCompacting());
+  EXPECT_EQ(arena.deadBytes(), (std::size_t)0);
+  arena.selfCheck();
+}
+
+
+void testSharedBlocks()
+{
+  LineByteArena arena;
+
+  char *a = arena.allocate(ByteCount(10));
+  char *b = arena.allocate(ByteCount(10));
+  std::memset(a, 'a', 10);
+  std::memset(b, 'b', 10);
+
+  std::shared_ptr<char const> block = arena.blockContaining(b);
+  xassert(block.get() == a);
+
+  // While the block is held, freed space is not handed out again, even
+  // when the chunk becomes empty.
+  arena.deallocate(b, ByteCount(10));
+  char *c = arena.allocate(ByteCount(10));
+  xassert(c != b);
+  arena.deallocate(c, ByteCount(10));
+  arena.deallocate(a, ByteCount(10));
+  char *d = arena.allocate(ByteCount(10));
+  xassert(d != a);
+  std::memset(d, 'd', 10);
+  arena.selfCheck();
+
+  // The held bytes outlive the arena's use of them.
+  arena.clear();
+  EXPECT_EQ(arena.getStats().m_numChunks, (std::size_t)0);
+  EXPECT_EQ(block.get()[0], 'a');
+  EXPECT_EQ(block.get()[10], 'b');
+
+  // Once let go, space is reused as usual.
+  block.reset();
+  a = arena.allocate(ByteCount(10));
+  arena.deallocate(a, ByteCount(10));
+  xassert(arena.allocate(ByteCount(10)) == a);
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_line_byte_arena(CmdlineArgsSpan args)
+{
+  testBasics();
+  testCompaction();
+  testIncrementalCompaction();
+  testSharedBlocks();
+}
+
+
+// EOF
@@ -0,0 +1,313 @@
+// line-byte-arena.cc
+// Code for `line-byte-arena` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-byte-arena.h"           // this module
+
+#include "smbase/sm-macros.h"          // STATICDEF
+#include "smbase/xassert.h"            // xassert, xassertPrecondition
+
+#include <utility>                     // std::make_pair, std::move
+
+
+// ------------------------ LineByteArenaStats -------------------------
+LineByteArenaStats::LineByteArenaStats()
+  : m_numChunks(0),
+    m_chunkBytes(0),
+    m_liveBytes(0),
+    m_deadBytes(0),
+    m_unusedBytes(0),
+    m_overheadBytes(0)
+{}
+
+
+double LineByteArenaStats::fragmentation() const
+{
+  std::size_t used = m_liveBytes + m_deadBytes;
+  if (used == 0) {
+    return 0.0;
+  }
+  return (double)m_deadBytes / (double)used;
+}
+
+
+std::size_t LineByteArenaStats::totalBytes() const
+{
+  return m_chunkBytes + m_overheadBytes;
+}
+
+
+// --------------------------- LineByteArena ---------------------------
+LineByteArena::LineByteArena()
+  : m_chunks(),
+    m_current(m_chunks.end()),
+    m_liveBytes(0),
+    m_usedBytes(0),
+    m_deadBytesAfterCompaction(0),
+    m_compacting(false)
+{}
+
+
+LineByteArena::~LineByteArena()
+{
+  clear();
+}
+
+
+void LineByteArena::selfCheck() const
+{
+  std::size_t live = 0;
+  std::size_t used = 0;
+  for (auto const &kv : m_chunks) {
+    Chunk const &c = kv.second;
+    xassert(0 <= c.m_liveBytes);
+    xassert(c.m_liveBytes <= c.m_used);
+    xassert(c.m_used <= c.m_size);
+    live += c.m_liveBytes;
+    used += c.m_used;
+
+    if (c.m_retiring) {
+      xassert(m_compacting);
+    }
+  }
+  xassert(live == m_liveBytes);
+  xassert(used == m_usedBytes);
+
+  if (m_current != m_chunks.end()) {
+    xassert(!m_current->second.m_retiring);
+  }
+}
+
+
+auto LineByteArena::findChunk(char const *p) -> ChunkMap::iterator
+{
+  // Find the first chunk that starts after `p`; the one before it is
+  // the chunk that contains `p`.
+  ChunkMap::iterator it = m_chunks.upper_bound(const_cast<char*>(p));
+  xassert(it != m_chunks.begin());
+  --it;
+  xassert(p < it->first + it->second.m_size);
+  return it;
+}
+
+
+auto LineByteArena::findChunkC(char const *p) const
+  -> ChunkMap::const_iterator
+{
+  return const_cast<LineByteArena*>(this)->findChunk(p);
+}
+
+
+auto LineByteArena::newChunk(int size) -> ChunkMap::iterator
+{
+  std::shared_ptr<char> block(new char[size], std::default_delete<char[]>());
+  char *start = block.get();
+  return m_chunks.insert(
+    std::make_pair(start, Chunk(std::move(block), size))).first;
+}
+
+
+void LineByteArena::releaseChunk(ChunkMap::iterator it)
+{
+  if (it == m_current) {
+    m_current = m_chunks.end();
+  }
+
+  m_liveBytes -= it->second.m_liveBytes;
+  m_usedBytes -= it->second.m_used;
+
+  // This frees the block unless a client holds it.
+  m_chunks.erase(it);
+}
+
+
+STATICDEF bool LineByteArena::isShared(Chunk const &c)
+{
+  // Only the arena's own thread can add holders, so if this says there
+  // are none, that remains true.  A holder that lets go concurrently
+  // just means some space is not reused.
+  return c.m_block.use_count() > 1;
+}
+
+
+STATICDEF bool LineByteArena::isSparse(Chunk const &c)
+{
+  return c.m_liveBytes * 100 < c.m_used * SPARSE_CHUNK_PERCENT;
+}
+
+
+char *LineByteArena::allocate(ByteCount len)
+{
+  xassertPrecondition(len > 0);
+  int n = len.get();
+
+  if (n >= LARGE_ALLOCATION_BYTES) {
+    // Dedicated chunk.  It does not become current because there is
+    // no room left in it anyway.
+    ChunkMap::iterator it = newChunk(n);
+    it->second.m_used = n;
+    it->second.m_liveBytes = n;
+    m_liveBytes += n;
+    m_usedBytes += n;
+    return it->first;
+  }
+
+  if (m_current == m_chunks.end() ||
+      m_current->second.m_size - m_current->second.m_used < n) {
+    // The remainder of the current chunk, if any, is simply abandoned.
+    // It is accounted as unused space until the chunk is released.
+    m_current = newChunk(CHUNK_BYTES);
+  }
+
+  Chunk &c = m_current->second;
+  char *ret = m_current->first + c.m_used;
+  c.m_used += n;
+  c.m_liveBytes += n;
+  m_liveBytes += n;
+  m_usedBytes += n;
+  return ret;
+}
+
+
+void LineByteArena::deallocate(char *p, ByteCount len)
+{
+  xassertPrecondition(len > 0);
+  int n = len.get();
+
+  ChunkMap::iterator it = findChunk(p);
+  Chunk &c = it->second;
+  xassert(c.m_liveBytes >= n);
+  c.m_liveBytes -= n;
+  m_liveBytes -= n;
+
+  if (p + n == it->first + c.m_used && !isShared(c)) {
+    // This was the most recent allocation from the chunk, so its space
+    // can be handed out again right away.  This is what happens when
+    // the same line is repeatedly edited.  (While a client holds the
+    // chunk, it may still be reading the freed bytes.)
+    c.m_used -= n;
+    m_usedBytes -= n;
+  }
+
+  if (c.m_liveBytes == 0) {
+    if (it == m_current && !isShared(c)) {
+      // Keep the current chunk, but start over at its beginning.
+      m_usedBytes -= c.m_used;
+      c.m_used = 0;
+    }
+    else {
+      releaseChunk(it);
+    }
+  }
+}
+
+
+std::shared_ptr<char const> LineByteArena::blockContaining(
+  char const *p) const
+{
+  return findChunkC(p)->second.m_block;
+}
+
+
+void LineByteArena::clear()
+{
+  m_chunks.clear();
+  m_current = m_chunks.end();
+  m_liveBytes = 0;
+  m_usedBytes = 0;
+  m_deadBytesAfterCompaction = 0;
+  m_compacting = false;
+}
+
+
+LineByteArenaStats LineByteArena::getStats() const
+{
+  LineByteArenaStats stats;
+
+  for (auto const &kv : m_chunks) {
+    Chunk const &c = kv.second;
+    stats.m_numChunks++;
+    stats.m_chunkBytes += c.m_size;
+    stats.m_liveBytes += c.m_liveBytes;
+    stats.m_deadBytes += c.m_used - c.m_liveBytes;
+    stats.m_unusedBytes += c.m_size - c.m_used;
+  }
+
+  // A map node holds the key/value pair plus (typically) three
+  // pointers and a color; the block also has a malloc header.
+  stats.m_overheadBytes = stats.m_numChunks *
+    (sizeof(ChunkMap::value_type) + 4*sizeof(void*) + sizeof(std::size_t));
+
+  return stats;
+}
+
+
+bool LineByteArena::shouldCompact() const
+{
+  std::size_t const dead = deadBytes();
+  std::size_t const newDead = (dead > m_deadBytesAfterCompaction)?
+    dead - m_deadBytesAfterCompaction : 0;
+
+  // Do not bother unless there are several chunks' worth of dead space
+  // that the last pass did not already fail to reclaim, and it is a
+  // significant fraction of what is live.
+  return newDead >= 4 * (std::size_t)CHUNK_BYTES &&
+         dead >= m_liveBytes / 4;
+}
+
+
+int LineByteArena::beginCompaction()
+{
+  xassert(!m_compacting);
+  m_compacting = true;
+
+  int marked = 0;
+  for (auto &kv : m_chunks) {
+    Chunk &c = kv.second;
+
+    // Evacuating a shared chunk would not free it, so leave it until
+    // its holders let go.
+    if (isSparse(c) && !isShared(c)) {
+      c.m_retiring = true;
+      marked++;
+    }
+  }
+
+  if (m_current != m_chunks.end() && m_current->second.m_retiring) {
+    // Relocated allocations must go somewhere else.
+    m_current = m_chunks.end();
+  }
+
+  return marked;
+}
+
+
+bool LineByteArena::inRetiringChunk(char const *p) const
+{
+  return findChunkC(p)->second.m_retiring;
+}
+
+
+int LineByteArena::endCompaction()
+{
+  xassert(m_compacting);
+  m_compacting = false;
+
+  // Retiring chunks were released when their last allocation was
+  // freed, so any that remain still hold allocations the owner did not
+  // relocate.
+  int kept = 0;
+  for (auto &kv : m_chunks) {
+    if (kv.second.m_retiring) {
+      kv.second.m_retiring = false;
+      kept++;
+    }
+  }
+
+  m_deadBytesAfterCompaction = deadBytes();
+  return kept;
+}
+
+
+// EOF
@@ -0,0 +1,255 @@
+// line-byte-arena.h
+// `LineByteArena`, chunked storage for the bytes of document lines.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_BYTE_ARENA_H
+#define EDITOR_LINE_BYTE_ARENA_H
+
+#include "line-byte-arena-fwd.h"       // fwds for this module
+
+#include "byte-count.h"                // ByteCount
+
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+
+#include <cstddef>                     // std::size_t
+#include <map>                         // std::map
+#include <memory>                      // std::shared_ptr
+
+
+// Memory usage statistics for a `LineByteArena`.
+class LineByteArenaStats {
+public:      // data
+  // Number of chunks currently allocated.
+  std::size_t m_numChunks;
+
+  // Total bytes in all chunks.
+  std::size_t m_chunkBytes;
+
+  // Bytes occupied by allocations that have not been freed.
+  std::size_t m_liveBytes;
+
+  // Bytes that were allocated and then freed, but cannot be reused
+  // until the chunk containing them is compacted or released.  This is
+  // the fragmentation.
+  std::size_t m_deadBytes;
+
+  // Bytes at the ends of chunks that have never been allocated.
+  std::size_t m_unusedBytes;
+
+  // Estimated bookkeeping overhead: chunk descriptors, map nodes, and
+  // the malloc header of each chunk.
+  std::size_t m_overheadBytes;
+
+public:      // methods
+  LineByteArenaStats();
+
+  // Fraction of the allocated-from portion of the chunks that is dead,
+  // in [0,1].
+  double fragmentation() const;
+
+  // Total bytes consumed from the heap, including overhead.
+  std::size_t totalBytes() const;
+};
+
+
+/* Allocator for the byte arrays of `TextDocumentLine`.
+
+   Allocating each line separately with `new[]` costs a malloc header
+   and a heap call per line, which dominates the memory and load time
+   for documents with tens of millions of short lines.  Instead, this
+   class carves lines out of large chunks with a bump pointer.
+
+   Freed space inside a chunk is only reclaimed immediately if it is at
+   the end of the chunk's allocated region (which is the common case for
+   a line that was just allocated and is then edited again), or when
+   every allocation in the chunk has been freed, in which case the chunk
+   itself is released.  Otherwise the space is "dead" until the owner
+   compacts the arena by relocating the survivors of sparse chunks; see
+   `beginCompaction`.
+
+   Lines longer than `LARGE_ALLOCATION_BYTES` get a chunk of their own,
+   so they are returned to the heap as soon as they are freed.
+
+   The bytes of an allocation are never changed by the arena while it
+   is live, and its owner only writes them right after `allocate`.  A
+   client that wants to refer to them beyond the lifetime of the
+   allocation, such as a `TextDocumentSnapshot`, can hold the chunk
+   containing them with `blockContaining`.  While a chunk is held that
+   way, the space of freed allocations in it is not reused, and when
+   the arena releases the chunk, the memory stays valid until the last
+   holder lets go.
+*/
+class LineByteArena {
+  NO_OBJECT_COPIES(LineByteArena);
+
+public:      // constants
+  // Size of an ordinary chunk.
+  static int const CHUNK_BYTES = 64 * 1024;
+
+  // Allocations at least this large get a dedicated chunk.
+  static int const LARGE_ALLOCATION_BYTES = CHUNK_BYTES / 4;
+
+  // A chunk whose live bytes are less than this percentage of its
+  // allocated-from bytes is considered sparse, and hence is evacuated
+  // during compaction.
+  static int const SPARSE_CHUNK_PERCENT = 50;
+
+private:     // types
+  // One contiguous block from which allocations are carved.
+  struct Chunk {
+    // The block.  Its address is the key of its `m_chunks` entry.
+    // Clients may share ownership; see `blockContaining`.
+    std::shared_ptr<char> m_block;
+
+    // Size of the block.
+    int m_size;
+
+    // Number of bytes, starting at the beginning of the block, that
+    // have been handed out (some of which may since have been freed).
+    int m_used;
+
+    // Number of bytes in allocations that have not been freed.
+    //
+    // Invariant: 0 <= m_liveBytes <= m_used <= m_size
+    int m_liveBytes;
+
+    // True if this chunk is being evacuated by a compaction pass.
+    bool m_retiring;
+
+    Chunk(std::shared_ptr<char> block, int size)
+      : m_block(std::move(block)),
+        m_size(size),
+        m_used(0),
+        m_liveBytes(0),
+        m_retiring(false)
+    {}
+  };
+
+  // Map from the start address of each block to its descriptor.  The
+  // ordering lets us find the chunk containing a pointer with
+  // `upper_bound`.
+  typedef std::map<char*, Chunk> ChunkMap;
+
+private:     // data
+  // All chunks.
+  ChunkMap m_chunks;
+
+  // The chunk that ordinary allocations are currently carved from, or
+  // `m_chunks.end()` if there is none.
+  ChunkMap::iterator m_current;
+
+  // Sum of `m_liveBytes` across all chunks.
+  std::size_t m_liveBytes;
+
+  // Sum of `m_used` across all chunks.  The difference between this
+  // and `m_liveBytes` is the dead space.
+  std::size_t m_usedBytes;
+
+  // Dead bytes that remained when the last compaction pass ended.
+  // They are in chunks that were shared or not sparse, so another pass
+  // would likely leave them too; `shouldCompact` only counts dead
+  // space beyond this.
+  std::size_t m_deadBytesAfterCompaction;
+
+  // True between `beginCompaction` and `endCompaction`.
+  bool m_compacting;
+
+private:     // methods
+  // Find the chunk containing `p`, which must be in some chunk.
+  ChunkMap::iterator findChunk(char const *p);
+  ChunkMap::const_iterator findChunkC(char const *p) const;
+
+  // Allocate a new block of `size` bytes and add it to `m_chunks`.
+  ChunkMap::iterator newChunk(int size);
+
+  // Release the block of `it` and remove it from `m_chunks`.
+  void releaseChunk(ChunkMap::iterator it);
+
+  // True if a client holds the block of `c`, so the space of its freed
+  // allocations must not be handed out again.
+  static bool isShared(Chunk const &c);
+
+  // True if the chunk `c` should be evacuated during compaction.
+  static bool isSparse(Chunk const &c);
+
+public:      // methods
+  // Initially, no chunks.
+  LineByteArena();
+
+  // Releases all chunks.  Any outstanding allocations are invalidated.
+  ~LineByteArena();
+
+  // Assert invariants.
+  void selfCheck() const;
+
+  // Return a pointer to `len` bytes of uninitialized storage.
+  //
+  // Requires: len > 0
+  char *allocate(ByteCount len);
+
+  // Free storage previously returned by `allocate(len)`.
+  void deallocate(char *p, ByteCount len);
+
+  // Return shared ownership of the block containing `p`, which must be
+  // in a live allocation.  The bytes of that allocation remain valid
+  // and unchanged for as long as the returned pointer is held, even
+  // after they are deallocated or the arena is cleared or destroyed.
+  std::shared_ptr<char const> blockContaining(char const *p) const;
+
+  // Free all allocations and release all chunks.
+  void clear();
+
+  // Number of bytes in allocations that have not been freed.
+  std::size_t liveBytes() const { return m_liveBytes; }
+
+  // Number of bytes that were allocated and then freed but not yet
+  // reclaimed.  Unlike `getStats`, this is O(1).
+  std::size_t deadBytes() const { return m_usedBytes - m_liveBytes; }
+
+  // Compute memory usage statistics.  This takes time proportional to
+  // the number of chunks.
+  LineByteArenaStats getStats() const;
+
+  // ---------------------------- Compaction ---------------------------
+  // Compaction is driven by the owner of the allocations, since only it
+  // knows where the pointers are.  The protocol is:
+  //
+  //   1. Call `beginCompaction()`.
+  //
+  //   2. For every outstanding allocation `p` for which
+  //      `inRetiringChunk(p)` is true, `allocate` a replacement, copy
+  //      the bytes, update the owning pointer, and `deallocate(p)`.
+  //
+  //   3. Call `endCompaction()`.
+  //
+  // Retiring chunks are released as soon as their last allocation is
+  // freed in step 2.  Step 2 can be spread over time, with other
+  // allocations and deallocations in between.  If the owner misses
+  // some allocations, for example because its own data moved in the
+  // meantime, their chunks are simply kept by `endCompaction`.
+
+  // True if a compaction pass would be likely to release a useful
+  // amount of memory.  This is O(1).
+  bool shouldCompact() const;
+
+  // True if a compaction pass has begun and not yet ended.  `clear`
+  // abandons any pass.
+  bool isCompacting() const { return m_compacting; }
+
+  // Mark the sparse chunks as retiring, and arrange for subsequent
+  // allocations to come from other chunks.  Returns the number of
+  // chunks marked.
+  int beginCompaction();
+
+  // True if `p`, which must be a live allocation, is in a retiring
+  // chunk.
+  bool inRetiringChunk(char const *p) const;
+
+  // Finish the compaction pass.  Any retiring chunk that has not been
+  // released is kept, and the number of such chunks is returned.
+  int endCompaction();
+};
+
+
+#endif // EDITOR_LINE_BYTE_ARENA_H
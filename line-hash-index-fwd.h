@@ -0,0 +1,11 @@
+// line-hash-index-fwd.h
+// Forward decls for `line-hash-index.h`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_HASH_INDEX_FWD_H
+#define EDITOR_LINE_HASH_INDEX_FWD_H
+
+class LineHashIndex;
+
+#endif // EDITOR_LINE_HASH_INDEX_FWD_H
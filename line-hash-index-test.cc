@@ -0,0 +1,174 @@
+// line-hash-index-test.cc
+// Tests for `line-hash-index` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-hash-index.h"           // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "content-digest.h"            // lineContentHash
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, EXPECT_{TRUE,FALSE}
+#include "smbase/stringb.h"            // stringb
+#include "smbase/xassert.h"            // xassert
+
+#include <cstdint>                     // std::uint64_t
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+#include <stdlib.h>                    // rand
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Reference lines, kept in sync with the index under test.
+typedef std::vector<std::string> Lines;
+
+
+// Get the digest from `index`, counting the lines it hashes.
+std::uint64_t getDigest(LineHashIndex &index, Lines const &lines,
+                        int &numHashed /*OUT*/)
+{
+  numHashed = 0;
+  return index.digest(
+    [&lines, &numHashed](LineIndex i) -> std::uint64_t {
+      ++numHashed;
+      std::string const &s = lines.at(i.get());
+      return lineContentHash(s.data(), s.size());
+    });
+}
+
+
+// Check the digest against `lines`, and return the number of lines
+// that were hashed to get it.
+int checkDigest(LineHashIndex &index, Lines const &lines)
+{
+  index.selfCheck();
+  EXPECT_EQ(index.numLines(), LineCount((int)lines.size()));
+
+  std::string text;
+  for (std::size_t i=0; i < lines.size(); ++i) {
+    if (i > 0) {
+      text += '\n';
+    }
+    text += lines[i];
+  }
+
+  int numHashed;
+  EXPECT_EQ(getDigest(index, lines, numHashed),
+            textContentDigest(text.data(), text.size()));
+  index.selfCheck();
+  EXPECT_TRUE(index.sumIsValid());
+
+  // Nothing more is needed the second time.
+  int numHashedAgain;
+  EXPECT_EQ(getDigest(index, lines, numHashedAgain),
+            textContentDigest(text.data(), text.size()));
+  EXPECT_EQ(numHashedAgain, 0);
+
+  return numHashed;
+}
+
+
+void testBasics()
+{
+  LineHashIndex index;
+  index.reset(LineCount(3));
+  Lines lines{"one", "two", "three"};
+  EXPECT_FALSE(index.sumIsValid());
+  EXPECT_EQ(checkDigest(index, lines), 3);
+
+  // Changing a line keeps the sum, and only that line is rehashed.
+  index.lineChanged(LineIndex(1));
+  lines[1] = "TWO";
+  EXPECT_TRUE(index.sumIsValid());
+  EXPECT_EQ(index.knownHash(LineIndex(1)), (std::uint64_t)0);
+  EXPECT_EQ(checkDigest(index, lines), 1);
+
+  // Repeated changes to one line are hashed once.
+  index.lineChanged(LineIndex(2));
+  index.lineChanged(LineIndex(2));
+  lines[2] = "3";
+  EXPECT_EQ(checkDigest(index, lines), 1);
+
+  // Inserting keeps the sum, and only the new line is hashed.
+  index.insertLine(LineIndex(1));
+  lines.insert(lines.begin()+1, "");
+  EXPECT_TRUE(index.sumIsValid());
+  EXPECT_EQ(checkDigest(index, lines), 1);
+
+  // Deleting needs no hashing at all.
+  index.deleteLine(LineIndex(0));
+  lines.erase(lines.begin());
+  EXPECT_TRUE(index.sumIsValid());
+  EXPECT_EQ(checkDigest(index, lines), 0);
+
+  // A change followed by a deletion.
+  index.lineChanged(LineIndex(0));
+  index.deleteLine(LineIndex(1));
+  lines[0] = "x";
+  lines.erase(lines.begin()+1);
+  EXPECT_EQ(checkDigest(index, lines), 1);
+
+  // Edits before the first digest after a reset just track the line
+  // count, and every line is then hashed once.
+  index.reset(LineCount(2));
+  lines = Lines{"a", "b"};
+  index.insertLine(LineIndex(2));
+  index.lineChanged(LineIndex(0));
+  lines.push_back("c");
+  EXPECT_FALSE(index.sumIsValid());
+  EXPECT_EQ(checkDigest(index, lines), 3);
+}
+
+
+// Random interleaving of edits and checks, across many lines so that
+// the tree has several levels.
+void testRandom()
+{
+  LineHashIndex index;
+  index.reset(LineCount(1));
+  Lines lines{""};
+
+  for (int iter=0; iter < 20000; iter++) {
+    int choice = rand() % 100;
+    int n = (int)lines.size();
+
+    if (choice < 35) {
+      int line = rand() % (n+1);
+      index.insertLine(LineIndex(line));
+      lines.insert(lines.begin()+line, "");
+    }
+    else if (choice < 50 && n > 1) {
+      int line = rand() % n;
+      index.deleteLine(LineIndex(line));
+      lines.erase(lines.begin()+line);
+    }
+    else if (choice < 97) {
+      int line = rand() % n;
+      index.lineChanged(LineIndex(line));
+      lines[line] = stringb(rand() % 50);
+    }
+    else {
+      checkDigest(index, lines);
+    }
+  }
+
+  checkDigest(index, lines);
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_line_hash_index(CmdlineArgsSpan args)
+{
+  testBasics();
+  testRandom();
+}
+
+
+// EOF
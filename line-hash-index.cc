@@ -0,0 +1,122 @@
+// line-hash-index.cc
+// Code for `line-hash-index` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-hash-index.h"           // this module
+
+#include "content-digest.h"            // digestPower
+
+#include "smbase/sm-macros.h"          // STATICDEF
+#include "smbase/xassert.h"            // xassert, xassertPrecondition
+
+
+// ------------------------ HashSummarizer -------------------------
+bool LineHashIndex::HashSummarizer::Summary::operator==(
+  Summary const &obj) const
+{
+  return m_sum == obj.m_sum &&
+         m_power == obj.m_power &&
+         m_numUnknown == obj.m_numUnknown;
+}
+
+
+STATICDEF LineHashIndex::HashSummarizer::Summary
+LineHashIndex::HashSummarizer::identity()
+{
+  return Summary{0, 1, 0};
+}
+
+
+STATICDEF LineHashIndex::HashSummarizer::Summary
+LineHashIndex::HashSummarizer::ofElement(std::uint64_t hash)
+{
+  static std::uint64_t const base = digestPower(1);
+  return Summary{hash, base, hash==0? 1 : 0};
+}
+
+
+STATICDEF LineHashIndex::HashSummarizer::Summary
+LineHashIndex::HashSummarizer::combine(Summary const &a, Summary const &b)
+{
+  // The lines of `b` follow those of `a`, so their powers of the base
+  // are larger by the number of lines in `a`.
+  return Summary{
+    a.m_sum + b.m_sum * a.m_power,
+    a.m_power * b.m_power,
+    a.m_numUnknown + b.m_numUnknown
+  };
+}
+
+
+// ------------------------ LineHashIndex --------------------------
+LineHashIndex::LineHashIndex()
+  : m_numLines(0),
+    m_built(false),
+    m_hashes()
+{}
+
+
+LineHashIndex::~LineHashIndex()
+{}
+
+
+void LineHashIndex::selfCheck() const
+{
+  xassert(0 <= m_numLines);
+
+  m_hashes.selfCheck();
+  xassert(m_hashes.length() == (m_built? m_numLines : 0));
+}
+
+
+std::uint64_t LineHashIndex::knownHash(LineIndex line) const
+{
+  xassertPrecondition(line < m_numLines);
+  return m_built? m_hashes.get(line.get()) : 0;
+}
+
+
+void LineHashIndex::reset(LineCount numLines)
+{
+  m_numLines = numLines.get();
+  m_built = false;
+  m_hashes.clear();
+}
+
+
+void LineHashIndex::insertLine(LineIndex line)
+{
+  xassertPrecondition(line <= m_numLines);
+
+  if (m_built) {
+    m_hashes.insert(line.get(), 0);
+  }
+  m_numLines++;
+}
+
+
+void LineHashIndex::deleteLine(LineIndex line)
+{
+  xassertPrecondition(line < m_numLines);
+
+  if (m_built) {
+    m_hashes.remove(line.get());
+  }
+  m_numLines--;
+}
+
+
+void LineHashIndex::lineChanged(LineIndex line)
+{
+  xassertPrecondition(line < m_numLines);
+
+  // Nothing to do if the hash is already unknown.
+  int const i = line.get();
+  if (m_built && m_hashes.get(i) != 0) {
+    m_hashes.set(i, 0);
+  }
+}
+
+
+// EOF
@@ -0,0 +1,169 @@
+// line-hash-index.h
+// `LineHashIndex`, per-line hashes and a whole-text digest.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_HASH_INDEX_H
+#define EDITOR_LINE_HASH_INDEX_H
+
+#include "line-hash-index-fwd.h"       // fwds for this module
+
+#include "content-digest.h"            // finishContentDigest
+#include "line-count.h"                // LineCount
+#include "line-index.h"                // LineIndex
+#include "tree-array.h"                // TreeArray
+
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+#include "smbase/xassert.h"            // xassertPrecondition
+
+#include <cstdint>                     // std::uint64_t
+#include <vector>                      // std::vector
+
+
+/* The `lineContentHash` of each line of a sequence, and the digest of
+   the whole sequence as defined in `content-digest.h`.
+
+   The hashes are stored in a `TreeArray` whose branches record, for
+   the lines under each child, their weighted sum of hashes counting
+   from the first of them, and `B^k` for their number `k`.  The
+   summaries of adjacent runs of lines combine as
+
+     sum(left + right) = sum(left) + sum(right) * B^k(left)
+
+   so the root yields the sum the digest is made from.  Hence changing,
+   inserting, or deleting a line anywhere only updates the summaries
+   on one path, costing O(log n).
+
+   Hashes are computed lazily.  A line that is inserted or whose
+   contents change just has its hash forgotten, which the summaries
+   also count, and when the digest is next requested, those lines are
+   found by descending the tree and hashed.  Consequently, after any
+   edit, getting the digest takes time proportional to the length of
+   the edited lines times log n, without examining unchanged lines.
+
+   The tree is only built when the digest is first requested, and
+   again after `reset`; until then, edits just track the number of
+   lines.
+
+   The object does not know the line contents itself; `digest` takes a
+   function that hashes a line.
+*/
+class LineHashIndex {
+  NO_OBJECT_COPIES(LineHashIndex);
+
+private:     // types
+  // `TreeArray` summarizer for the hashes of a run of lines.
+  struct HashSummarizer {
+    struct Summary {
+      // Sum of `hash(i) * B^i` over the lines of the run, with `i`
+      // counted from its start.  A line whose hash is not known
+      // contributes nothing.
+      std::uint64_t m_sum;
+
+      // `B^k`, where `k` is the number of lines in the run.
+      std::uint64_t m_power;
+
+      // Number of lines in the run whose hash is not known.
+      int m_numUnknown;
+
+      bool operator==(Summary const &obj) const;
+    };
+
+    static Summary identity();
+    static Summary ofElement(std::uint64_t hash);
+    static Summary combine(Summary const &a, Summary const &b);
+  };
+
+private:     // data
+  // Number of lines in the sequence.
+  int m_numLines;
+
+  // True if `m_hashes` has been built.
+  bool m_built;
+
+  // When `m_built`, for each line, its hash, or 0 if it is not known.
+  // Otherwise empty.
+  TreeArray<std::uint64_t, HashSummarizer> m_hashes;
+
+public:      // methods
+  // Initially, the sequence is empty.
+  LineHashIndex();
+  ~LineHashIndex();
+
+  // Assert invariants.
+  void selfCheck() const;
+
+  // Number of lines in the sequence.
+  LineCount numLines() const
+    { return LineCount(m_numLines); }
+
+  // Hash of `line` if known, otherwise 0.
+  //
+  // Requires: line < numLines()
+  std::uint64_t knownHash(LineIndex line) const;
+
+  // True if `digest` can be computed without rebuilding the sum.
+  bool sumIsValid() const
+    { return m_built; }
+
+  // Discard all hashes and set the number of lines.
+  void reset(LineCount numLines);
+
+  // Record that a line has been inserted so that it has index `line`.
+  //
+  // Requires: line <= numLines()
+  void insertLine(LineIndex line);
+
+  // Record that line `line` has been removed.
+  //
+  // Requires: line < numLines()
+  void deleteLine(LineIndex line);
+
+  // Record that the contents of `line` have changed.
+  //
+  // Requires: line < numLines()
+  void lineChanged(LineIndex line);
+
+  // Return the digest of the sequence, calling `hashOf(LineIndex)` to
+  // get `lineContentHash` of the current contents of each line whose
+  // hash is not known.
+  //
+  // Requires: numLines() > 0
+  template <class HashFunc>
+  std::uint64_t digest(HashFunc const &hashOf);
+};
+
+
+template <class HashFunc>
+std::uint64_t LineHashIndex::digest(HashFunc const &hashOf)
+{
+  int const n = m_numLines;
+  xassertPrecondition(n > 0);
+
+  if (!m_built) {
+    std::vector<std::uint64_t> hashes;
+    hashes.reserve(n);
+    for (int i=0; i < n; ++i) {
+      hashes.push_back(hashOf(LineIndex(i)));
+    }
+    m_hashes.fillFromArray(hashes.data(), n);
+    m_built = true;
+  }
+
+  // Hash the lines whose hash is not known, finding each by descending
+  // to the first run that has one.
+  while (m_hashes.totalSummary().m_numUnknown > 0) {
+    HashSummarizer::Summary before;
+    int i = m_hashes.findFirst(
+      [](HashSummarizer::Summary const &s) -> bool {
+        return s.m_numUnknown > 0;
+      },
+      before /*OUT*/);
+    m_hashes.set(i, hashOf(LineIndex(i)));
+  }
+
+  return finishContentDigest(m_hashes.totalSummary().m_sum, n);
+}
+
+
+#endif // EDITOR_LINE_HASH_INDEX_H
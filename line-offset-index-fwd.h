@@ -0,0 +1,11 @@
+// line-offset-index-fwd.h
+// Forward decls for `line-offset-index.h`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_OFFSET_INDEX_FWD_H
+#define EDITOR_LINE_OFFSET_INDEX_FWD_H
+
+class LineOffsetIndex;
+
+#endif // EDITOR_LINE_OFFSET_INDEX_FWD_H
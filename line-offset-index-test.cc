@@ -0,0 +1,171 @@
+// line-offset-index-test.cc
+// Tests for `line-offset-index` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-offset-index.h"         // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, EXPECT_{TRUE,FALSE}
+#include "smbase/xassert.h"            // xassert
+
+#include <cstddef>                     // std::ptrdiff_t
+#include <vector>                      // std::vector
+
+#include <stdlib.h>                    // rand
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Reference weights, kept in sync with the index under test.
+typedef std::vector<std::ptrdiff_t> Weights;
+
+
+void validateFrom(LineOffsetIndex &index, Weights const &weights)
+{
+  index.validate(
+    [&weights](LineIndex i) -> std::ptrdiff_t {
+      return weights.at(i.get());
+    });
+}
+
+
+// Check every prefix sum and the inverse mapping against `weights`.
+void checkAll(LineOffsetIndex &index, Weights const &weights)
+{
+  index.selfCheck();
+  EXPECT_EQ(index.numLines(), LineCount((int)weights.size()));
+
+  validateFrom(index, weights);
+  EXPECT_TRUE(index.isBuilt());
+  index.selfCheck();
+
+  std::ptrdiff_t sum = 0;
+  for (int i=0; i < (int)weights.size(); i++) {
+    EXPECT_EQ(index.prefixSum(LineCount(i)), sum);
+
+    // The first and last offsets within each line map back to it.
+    std::ptrdiff_t remainder;
+    EXPECT_EQ(index.findLine(sum, remainder), LineIndex(i));
+    EXPECT_EQ(remainder, (std::ptrdiff_t)0);
+    EXPECT_EQ(index.findLine(sum + weights[i] - 1, remainder),
+              LineIndex(i));
+    EXPECT_EQ(remainder, weights[i] - 1);
+
+    sum += weights[i];
+  }
+  EXPECT_EQ(index.prefixSum(index.numLines()), sum);
+}
+
+
+void testBasics()
+{
+  LineOffsetIndex index;
+  Weights weights;
+  checkAll(index, weights);
+
+  for (int i=0; i < 10; i++) {
+    index.insertLine(LineIndex(i), i+1);
+    weights.push_back(i+1);
+  }
+  checkAll(index, weights);
+
+  // Changing a weight updates the tree in place.
+  index.adjustWeight(LineIndex(3), +5);
+  weights[3] += 5;
+  EXPECT_TRUE(index.isBuilt());
+  checkAll(index, weights);
+
+  // So do insertion and deletion.
+  index.insertLine(LineIndex(6), 1);
+  weights.insert(weights.begin()+6, 1);
+  EXPECT_TRUE(index.isBuilt());
+  EXPECT_EQ(index.prefixSum(LineCount(4)), (std::ptrdiff_t)(1+2+3+9));
+  EXPECT_EQ(index.prefixSum(LineCount(8)),
+            (std::ptrdiff_t)(1+2+3+9+5+6+1+7));
+  checkAll(index, weights);
+
+  index.deleteLine(LineIndex(0));
+  weights.erase(weights.begin());
+  EXPECT_TRUE(index.isBuilt());
+  checkAll(index, weights);
+
+  // After a reset, the tree is not built until needed, and edits
+  // before then just track the number of lines.
+  index.reset(LineCount(3));
+  weights = Weights{4, 1, 7};
+  EXPECT_FALSE(index.isBuilt());
+  index.insertLine(LineIndex(1), 99 /*ignored*/);
+  index.adjustWeight(LineIndex(0), 99 /*ignored*/);
+  weights.insert(weights.begin()+1, 2);
+  EXPECT_FALSE(index.isBuilt());
+  checkAll(index, weights);
+}
+
+
+// Random interleaving of edits and checks, across many lines so that
+// the tree has several levels.
+void testRandom()
+{
+  LineOffsetIndex index;
+  Weights weights;
+
+  for (int iter=0; iter < 20000; iter++) {
+    int choice = rand() % 100;
+    int n = (int)weights.size();
+
+    if (choice < 45 || n == 0) {
+      int line = rand() % (n+1);
+      std::ptrdiff_t weight = 1 + rand()%20;
+      index.insertLine(LineIndex(line), weight);
+      weights.insert(weights.begin()+line, weight);
+    }
+    else if (choice < 60) {
+      int line = rand() % n;
+      index.deleteLine(LineIndex(line));
+      weights.erase(weights.begin()+line);
+    }
+    else if (choice < 90) {
+      int line = rand() % n;
+      std::ptrdiff_t delta = rand()%10;
+      if (rand()%2 && weights[line] > delta) {
+        delta = -delta;
+      }
+      index.adjustWeight(LineIndex(line), delta);
+      weights[line] += delta;
+    }
+    else if (choice < 99) {
+      // Spot check one line.
+      validateFrom(index, weights);
+      int line = rand() % n;
+      std::ptrdiff_t sum = 0;
+      for (int i=0; i < line; i++) {
+        sum += weights[i];
+      }
+      EXPECT_EQ(index.prefixSum(LineCount(line)), sum);
+      std::ptrdiff_t remainder;
+      EXPECT_EQ(index.findLine(sum, remainder), LineIndex(line));
+    }
+    else if (iter % 10 == 0) {
+      checkAll(index, weights);
+    }
+  }
+
+  checkAll(index, weights);
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_line_offset_index(CmdlineArgsSpan args)
+{
+  testBasics();
+  testRandom();
+}
+
+
+// EOF
@@ -0,0 +1,105 @@
+// line-offset-index.cc
+// Code for `line-offset-index` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-offset-index.h"         // this module
+
+#include "smbase/xassert.h"            // xassert, xassertPrecondition
+
+
+LineOffsetIndex::LineOffsetIndex()
+  : m_numLines(0),
+    m_built(false),
+    m_weights()
+{}
+
+
+LineOffsetIndex::~LineOffsetIndex()
+{}
+
+
+void LineOffsetIndex::selfCheck() const
+{
+  xassert(0 <= m_numLines);
+
+  m_weights.selfCheck();
+  xassert(m_weights.length() == (m_built? m_numLines : 0));
+}
+
+
+void LineOffsetIndex::reset(LineCount numLines)
+{
+  m_numLines = numLines.get();
+  m_built = false;
+
+  // Release the storage; the new sequence may be much shorter.
+  m_weights.clear();
+}
+
+
+void LineOffsetIndex::insertLine(LineIndex line, std::ptrdiff_t weight)
+{
+  xassertPrecondition(line <= m_numLines);
+
+  if (m_built) {
+    m_weights.insert(line.get(), weight);
+  }
+  m_numLines++;
+}
+
+
+void LineOffsetIndex::deleteLine(LineIndex line)
+{
+  xassertPrecondition(line < m_numLines);
+
+  if (m_built) {
+    m_weights.remove(line.get());
+  }
+  m_numLines--;
+}
+
+
+void LineOffsetIndex::adjustWeight(LineIndex line, std::ptrdiff_t delta)
+{
+  xassertPrecondition(line < m_numLines);
+
+  if (m_built && delta != 0) {
+    int const i = line.get();
+    m_weights.set(i, m_weights.get(i) + delta);
+  }
+}
+
+
+std::ptrdiff_t LineOffsetIndex::prefixSum(LineCount count) const
+{
+  xassertPrecondition(m_built);
+  xassertPrecondition(count <= m_numLines);
+
+  return m_weights.prefixSummary(count.get());
+}
+
+
+LineIndex LineOffsetIndex::findLine(
+  std::ptrdiff_t offset, std::ptrdiff_t &remainder /*OUT*/) const
+{
+  xassertPrecondition(m_built);
+  xassertPrecondition(offset >= 0);
+
+  // Find the first line whose end lies beyond `offset`.
+  std::ptrdiff_t before;
+  int line = m_weights.findFirst(
+    [offset](std::ptrdiff_t sum) -> bool {
+      return sum > offset;
+    },
+    before /*OUT*/);
+
+  // Every weight is positive, so this means `offset` was too large.
+  xassertPrecondition(line < m_numLines);
+
+  remainder = offset - before;
+  return LineIndex(line);
+}
+
+
+// EOF
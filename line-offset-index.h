@@ -0,0 +1,144 @@
+// line-offset-index.h
+// `LineOffsetIndex`, prefix sums over a sequence of line sizes.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_OFFSET_INDEX_H
+#define EDITOR_LINE_OFFSET_INDEX_H
+
+#include "line-offset-index-fwd.h"     // fwds for this module
+
+#include "line-count.h"                // LineCount
+#include "line-index.h"                // LineIndex
+#include "tree-array.h"                // TreeArray
+
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+#include "smbase/xassert.h"            // xassertPrecondition
+
+#include <cstddef>                     // std::ptrdiff_t, std::size_t
+#include <vector>                      // std::vector
+
+
+/* Map from a line index to the sum of the "weights" of all preceding
+   lines, and back.  For a document, a line's weight is its length plus
+   one for the newline separator, so the sum is the byte offset of the
+   start of the line.
+
+   The weights are stored in a `TreeArray` whose branches record the
+   sum of the weights under each child.  Once built, inserting or
+   deleting a line, changing one weight, or mapping in either
+   direction, each take O(log n) time, wherever in the sequence they
+   happen.
+
+   The tree is only built when first needed.  Until then, and again
+   after `reset`, edits just track the number of lines, and `validate`
+   builds the tree in linear time, calling a function that supplies
+   the weights.  Thus a document whose offsets are never queried pays
+   nothing for them.
+*/
+class LineOffsetIndex {
+  NO_OBJECT_COPIES(LineOffsetIndex);
+
+private:     // types
+  // `TreeArray` summarizer that adds the weights.
+  struct WeightSummarizer {
+    typedef std::ptrdiff_t Summary;
+
+    static Summary identity()
+      { return 0; }
+    static Summary ofElement(std::ptrdiff_t weight)
+      { return weight; }
+    static Summary combine(Summary a, Summary b)
+      { return a + b; }
+  };
+
+private:     // data
+  // Number of lines in the indexed sequence.
+  int m_numLines;
+
+  // True if `m_weights` has been built.
+  bool m_built;
+
+  // When `m_built`, the weight of each line.  Otherwise empty.
+  TreeArray<std::ptrdiff_t, WeightSummarizer> m_weights;
+
+public:      // methods
+  // Initially, the sequence is empty.
+  LineOffsetIndex();
+  ~LineOffsetIndex();
+
+  // Assert invariants.
+  void selfCheck() const;
+
+  // Number of lines in the sequence.
+  LineCount numLines() const
+    { return LineCount(m_numLines); }
+
+  // True if the prefix sums are available without any recomputation.
+  bool isBuilt() const
+    { return m_built; }
+
+  // Heap bytes used by the tree.
+  std::size_t allocatedBytes() const
+    { return m_weights.allocatedBytes(); }
+
+  // Discard all weights and set the number of lines.
+  void reset(LineCount numLines);
+
+  // Record that a line of `weight` has been inserted so that it has
+  // index `line`.
+  //
+  // Requires: line <= numLines()
+  void insertLine(LineIndex line, std::ptrdiff_t weight);
+
+  // Record that line `line` has been removed.
+  //
+  // Requires: line < numLines()
+  void deleteLine(LineIndex line);
+
+  // Record that the weight of `line` has changed by `delta`.
+  //
+  // Requires: line < numLines()
+  void adjustWeight(LineIndex line, std::ptrdiff_t delta);
+
+  // Ensure the prefix sums are available, calling
+  // `weightOf(LineIndex)` to get the weight of every line if the tree
+  // has to be built.  Each weight must be positive.
+  template <class WeightFunc>
+  void validate(WeightFunc const &weightOf);
+
+  // Sum of the weights of lines in [0,count-1].
+  //
+  // Requires: isBuilt(), and count <= numLines()
+  std::ptrdiff_t prefixSum(LineCount count) const;
+
+  // Return the line `L` such that `prefixSum(L) <= offset` and
+  // `offset < prefixSum(L+1)`, and set `remainder` to
+  // `offset - prefixSum(L)`.
+  //
+  // Requires: isBuilt(), and `offset` is in
+  // [0,prefixSum(numLines())-1].
+  LineIndex findLine(
+    std::ptrdiff_t offset, std::ptrdiff_t &remainder /*OUT*/) const;
+};
+
+
+template <class WeightFunc>
+void LineOffsetIndex::validate(WeightFunc const &weightOf)
+{
+  if (m_built) {
+    return;
+  }
+
+  std::vector<std::ptrdiff_t> weights;
+  weights.reserve(m_numLines);
+  for (int i=0; i < m_numLines; i++) {
+    weights.push_back(weightOf(LineIndex(i)));
+  }
+
+  m_weights.fillFromArray(weights.data(), m_numLines);
+  m_built = true;
+}
+
+
+#endif // EDITOR_LINE_OFFSET_INDEX_H
@@ -0,0 +1,11 @@
+// line-render-cache-fwd.h
+// Forward decls for `line-render-cache.h`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_RENDER_CACHE_FWD_H
+#define EDITOR_LINE_RENDER_CACHE_FWD_H
+
+class LineRenderCache;
+
+#endif // EDITOR_LINE_RENDER_CACHE_FWD_H
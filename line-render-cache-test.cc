@@ -0,0 +1,197 @@
+// line-render-cache-test.cc
+// Tests for `line-render-cache` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-render-cache.h"         // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ
+#include "smbase/xassert.h"            // xassert
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Categories that identify line `n`: normal text, then a keyword
+// starting at column `n`.
+LineCategoryAOAs categoriesFor(int n)
+{
+  LineCategoryAOAs ret(TC_NORMAL);
+  ret.overwrite(n, 1, TC_KEYWORD);
+  return ret;
+}
+
+
+TD_VersionNumber const V1(1);
+ColumnCount const TAB8(8);
+
+
+// Check that `line` is cached with the categories made for `n`.
+void expectEntry(LineRenderCache &cache, int line, int n,
+                 TD_VersionNumber version = V1)
+{
+  LineCategoryAOAs const *cats =
+    cache.find(LineIndex(line), version, TAB8, 0 /*searchGeneration*/);
+  xassert(cats);
+  xassert(*cats == categoriesFor(n));
+}
+
+
+void expectNoEntry(LineRenderCache &cache, int line,
+                   TD_VersionNumber version = V1)
+{
+  xassert(!cache.find(LineIndex(line), version, TAB8, 0));
+}
+
+
+// Cache lines 0 through 9 at version 1.
+void fillTen(LineRenderCache &cache)
+{
+  cache.clear();
+  for (int i=0; i < 10; ++i) {
+    cache.insert(LineIndex(i), V1, TAB8, 0, categoriesFor(i));
+  }
+  EXPECT_EQ(cache.size(), 10);
+}
+
+
+void testFindAndParameters()
+{
+  LineRenderCache cache;
+  fillTen(cache);
+  expectEntry(cache, 3, 3);
+  expectNoEntry(cache, 10);
+  EXPECT_EQ(cache.numHits(), 1);
+  EXPECT_EQ(cache.numMisses(), 1);
+
+  // Any parameter change empties the cache.
+  xassert(!cache.find(LineIndex(3), V1, ColumnCount(4), 0));
+  EXPECT_EQ(cache.size(), 0);
+
+  fillTen(cache);
+  xassert(!cache.find(LineIndex(3), V1, TAB8, 1));
+  EXPECT_EQ(cache.size(), 0);
+
+  fillTen(cache);
+  expectNoEntry(cache, 3, TD_VersionNumber(2));
+  EXPECT_EQ(cache.size(), 0);
+
+  // But not if the client says the entries are still good.
+  fillTen(cache);
+  cache.setVersion(TD_VersionNumber(2));
+  expectEntry(cache, 3, 3, TD_VersionNumber(2));
+  cache.selfCheck();
+}
+
+
+void testInvalidate()
+{
+  LineRenderCache cache;
+  fillTen(cache);
+
+  cache.invalidateLine(LineIndex(4));
+  expectNoEntry(cache, 4);
+  expectEntry(cache, 5, 5);
+
+  cache.invalidateFrom(LineIndex(7));
+  EXPECT_EQ(cache.size(), 6);
+  expectEntry(cache, 6, 6);
+  expectNoEntry(cache, 7);
+  expectNoEntry(cache, 9);
+
+  fillTen(cache);
+  cache.invalidateRange(LineIndex(2), LineIndex(5));
+  EXPECT_EQ(cache.size(), 6);
+  expectEntry(cache, 1, 1);
+  expectNoEntry(cache, 2);
+  expectNoEntry(cache, 5);
+  expectEntry(cache, 6, 6);
+
+  // The range can extend past the entries.
+  cache.invalidateRange(LineIndex(8), LineIndex(40));
+  EXPECT_EQ(cache.size(), 4);
+  expectEntry(cache, 7, 7);
+  expectNoEntry(cache, 8);
+}
+
+
+void testShift()
+{
+  LineRenderCache cache;
+  fillTen(cache);
+
+  // Insert a line at 3.
+  cache.shiftLines(LineIndex(3), LineDifference(+1));
+  EXPECT_EQ(cache.size(), 10);
+  expectEntry(cache, 2, 2);
+  expectNoEntry(cache, 3);
+  expectEntry(cache, 4, 3);
+  expectEntry(cache, 10, 9);
+
+  // Delete it again.
+  cache.shiftLines(LineIndex(3), LineDifference(-1));
+  for (int i=0; i < 10; ++i) {
+    expectEntry(cache, i, i);
+  }
+
+  // Delete line 0.
+  cache.shiftLines(LineIndex(0), LineDifference(-1));
+  EXPECT_EQ(cache.size(), 9);
+  expectEntry(cache, 0, 1);
+  expectEntry(cache, 8, 9);
+  expectNoEntry(cache, 9);
+
+  // Insert three lines at 2, then delete four lines at 1.
+  cache.shiftLines(LineIndex(2), LineDifference(+3));
+  EXPECT_EQ(cache.size(), 9);
+  expectEntry(cache, 1, 2);
+  expectNoEntry(cache, 2);
+  expectNoEntry(cache, 4);
+  expectEntry(cache, 5, 3);
+  expectEntry(cache, 11, 9);
+  cache.shiftLines(LineIndex(1), LineDifference(-4));
+  EXPECT_EQ(cache.size(), 8);
+  expectEntry(cache, 0, 1);
+  expectEntry(cache, 1, 3);
+  expectEntry(cache, 7, 9);
+  expectNoEntry(cache, 8);
+}
+
+
+void testCapacity()
+{
+  LineRenderCache cache(4 /*maxEntries*/);
+  for (int i=0; i < 4; ++i) {
+    cache.insert(LineIndex(i), V1, TAB8, 0, categoriesFor(i));
+  }
+  EXPECT_EQ(cache.size(), 4);
+
+  // Replacing an existing entry does not evict anything.
+  cache.insert(LineIndex(2), V1, TAB8, 0, categoriesFor(7));
+  EXPECT_EQ(cache.size(), 4);
+  expectEntry(cache, 2, 7);
+
+  // A new entry beyond the limit starts over.
+  cache.insert(LineIndex(4), V1, TAB8, 0, categoriesFor(4));
+  EXPECT_EQ(cache.size(), 1);
+  expectEntry(cache, 4, 4);
+  cache.selfCheck();
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_line_render_cache(CmdlineArgsSpan args)
+{
+  testFindAndParameters();
+  testInvalidate();
+  testShift();
+  testCapacity();
+}
+
+
+// EOF
@@ -0,0 +1,145 @@
+// line-render-cache.cc
+// Code for `line-render-cache` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-render-cache.h"         // this module
+
+#include "smbase/xassert.h"            // xassert, xassertPrecondition
+
+#include <utility>                     // std::move
+
+
+LineRenderCache::LineRenderCache(std::size_t maxEntries)
+  : m_entries(),
+    m_version(0),
+    m_tabWidth(0),
+    m_searchGeneration(0),
+    m_maxEntries(maxEntries),
+    m_hits(0),
+    m_misses(0)
+{
+  xassertPrecondition(maxEntries > 0);
+}
+
+
+LineRenderCache::~LineRenderCache()
+{}
+
+
+void LineRenderCache::selfCheck() const
+{
+  xassert(m_entries.size() <= m_maxEntries);
+}
+
+
+void LineRenderCache::checkParameters(
+  TD_VersionNumber version,
+  ColumnCount tabWidth,
+  int searchGeneration)
+{
+  if (version != m_version ||
+      tabWidth != m_tabWidth ||
+      searchGeneration != m_searchGeneration) {
+    m_entries.clear();
+    m_version = version;
+    m_tabWidth = tabWidth;
+    m_searchGeneration = searchGeneration;
+  }
+}
+
+
+LineCategoryAOAs const *LineRenderCache::find(
+  LineIndex line,
+  TD_VersionNumber version,
+  ColumnCount tabWidth,
+  int searchGeneration)
+{
+  checkParameters(version, tabWidth, searchGeneration);
+
+  auto it = m_entries.find(line);
+  if (it == m_entries.end()) {
+    ++m_misses;
+    return nullptr;
+  }
+
+  ++m_hits;
+  return &(it->second);
+}
+
+
+void LineRenderCache::insert(
+  LineIndex line,
+  TD_VersionNumber version,
+  ColumnCount tabWidth,
+  int searchGeneration,
+  LineCategoryAOAs const &categories)
+{
+  checkParameters(version, tabWidth, searchGeneration);
+
+  if (m_entries.size() >= m_maxEntries &&
+      m_entries.find(line) == m_entries.end()) {
+    // Something more discriminating is possible, but the cache only
+    // gets this big when the user looks at a lot of lines, and the
+    // cost of starting over is just recomputing what is on screen.
+    m_entries.clear();
+  }
+
+  m_entries.insert_or_assign(line, categories);
+}
+
+
+void LineRenderCache::setVersion(TD_VersionNumber version)
+{
+  m_version = version;
+}
+
+
+void LineRenderCache::invalidateLine(LineIndex line)
+{
+  m_entries.erase(line);
+}
+
+
+void LineRenderCache::invalidateFrom(LineIndex line)
+{
+  m_entries.erase(m_entries.lower_bound(line), m_entries.end());
+}
+
+
+void LineRenderCache::invalidateRange(LineIndex first, LineIndex last)
+{
+  m_entries.erase(m_entries.lower_bound(first),
+                  m_entries.upper_bound(last));
+}
+
+
+void LineRenderCache::shiftLines(LineIndex line, LineDifference delta)
+{
+  if (delta.isNegative()) {
+    m_entries.erase(m_entries.lower_bound(line),
+                    m_entries.lower_bound(line - delta));
+  }
+  else if (delta.isZero()) {
+    return;
+  }
+
+  // Move the affected nodes out, then back in with new keys.  Working
+  // with nodes avoids copying the category sequences.
+  std::map<LineIndex, LineCategoryAOAs> moved;
+  for (auto it = m_entries.lower_bound(line); it != m_entries.end(); ) {
+    auto node = m_entries.extract(it++);
+    node.key() = node.key() + delta;
+    moved.insert(std::move(node));
+  }
+  m_entries.merge(moved);
+}
+
+
+void LineRenderCache::clear()
+{
+  m_entries.clear();
+}
+
+
+// EOF
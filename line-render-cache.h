@@ -0,0 +1,127 @@
+// line-render-cache.h
+// `LineRenderCache`, per-line layout categories reused across paints.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_RENDER_CACHE_H
+#define EDITOR_LINE_RENDER_CACHE_H
+
+#include "line-render-cache-fwd.h"     // fwds for this module
+
+#include "column-count.h"              // ColumnCount
+#include "line-difference.h"           // LineDifference
+#include "line-index.h"                // LineIndex
+#include "td-version-number.h"         // TD_VersionNumber
+#include "textcategory.h"              // LineCategoryAOAs
+
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES, NULLABLE
+
+#include <cstddef>                     // std::size_t
+#include <map>                         // std::map
+
+
+// For each recently drawn line, the categories to draw it with, in
+// layout coordinates: the highlighter's output mapped through
+// `TextDocumentEditor::modelToLayoutSpans`, plus search hits.
+// Computing those requires lexing the line, laying it out, and
+// converting every search match, so keeping them lets the painter
+// scroll back and forth over the same lines without redoing that work.
+//
+// The client is responsible for removing entries as the document
+// changes, normally from its `TextDocumentObserver` methods, and for
+// recording the resulting document version with `setVersion`.  Lookup
+// then checks that the version, tab width, and search generation are
+// all still what the entries were computed with; if any differs, the
+// cache empties itself, so a missed notification costs time, not
+// correctness.
+//
+// The selection is not included since it changes far more often than
+// the underlying categories; the client overlays it on a copy.
+class LineRenderCache {
+  NO_OBJECT_COPIES(LineRenderCache);
+
+private:     // data
+  // Map from line to its layout categories.
+  std::map<LineIndex, LineCategoryAOAs> m_entries;
+
+  // Document version that `m_entries` reflects.
+  TD_VersionNumber m_version;
+
+  // Tab width the entries were laid out with.
+  ColumnCount m_tabWidth;
+
+  // Client-defined counter that changes whenever the search string or
+  // flags do.
+  int m_searchGeneration;
+
+  // Maximum size of `m_entries`.  When an insertion would exceed this,
+  // the cache is emptied first.
+  std::size_t m_maxEntries;
+
+  // Counts of `find` outcomes, for tests and tracing.
+  std::size_t m_hits;
+  std::size_t m_misses;
+
+private:     // methods
+  // If any of the parameters differs from what the entries were
+  // computed with, discard the entries and record the new values.
+  void checkParameters(
+    TD_VersionNumber version,
+    ColumnCount tabWidth,
+    int searchGeneration);
+
+public:      // methods
+  explicit LineRenderCache(std::size_t maxEntries = 10000);
+  ~LineRenderCache();
+
+  // Assert invariants.
+  void selfCheck() const;
+
+  // Number of lines with entries.
+  std::size_t size() const { return m_entries.size(); }
+
+  std::size_t numHits() const { return m_hits; }
+  std::size_t numMisses() const { return m_misses; }
+
+  // Return the categories for `line` if they are cached and were
+  // computed with the given parameters, otherwise nullptr.  The
+  // pointer is invalidated by any non-const method.
+  LineCategoryAOAs const * NULLABLE find(
+    LineIndex line,
+    TD_VersionNumber version,
+    ColumnCount tabWidth,
+    int searchGeneration);
+
+  // Store `categories` for `line`, computed with the given parameters.
+  void insert(
+    LineIndex line,
+    TD_VersionNumber version,
+    ColumnCount tabWidth,
+    int searchGeneration,
+    LineCategoryAOAs const &categories);
+
+  // Record that the entries are up to date with respect to document
+  // version `version`, having been adjusted for all changes up to it.
+  void setVersion(TD_VersionNumber version);
+
+  // Remove the entry for `line`.
+  void invalidateLine(LineIndex line);
+
+  // Remove the entries for `line` and every line after it.
+  void invalidateFrom(LineIndex line);
+
+  // Remove the entries for the lines in [first,last].
+  void invalidateRange(LineIndex first, LineIndex last);
+
+  // Adjust the keys of the entries at or after `line` by `delta`.  A
+  // positive `delta` is for inserting that many lines at `line`, and a
+  // negative one for deleting `-delta` lines there, whose entries are
+  // removed.
+  void shiftLines(LineIndex line, LineDifference delta);
+
+  // Remove all entries.
+  void clear();
+};
+
+
+#endif // EDITOR_LINE_RENDER_CACHE_H
@@ -0,0 +1,13 @@
+// line-spine-fwd.h
+// Forward decls for `line-spine.h`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_SPINE_FWD_H
+#define EDITOR_LINE_SPINE_FWD_H
+
+enum class LineSpineKind : int;
+
+class LineSpine;
+
+#endif // EDITOR_LINE_SPINE_FWD_H
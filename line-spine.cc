@@ -0,0 +1,141 @@
+// line-spine.cc
+// Code for `line-spine` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "line-spine.h"                // this module
+
+#include "smbase/gdvalue.h"            // gdv::GDValue
+#include "smbase/sm-macros.h"          // DEFINE_ENUMERATION_TO_STRING_OR
+#include "smbase/stringb.h"            // stringb
+#include "smbase/xassert.h"            // xassert
+
+#include <iostream>                    // std::ostream
+#include <string>                      // std::string
+
+using namespace gdv;
+
+
+// --------------------------- LineSpineKind ---------------------------
+DEFINE_ENUMERATION_TO_STRING_OR(
+  LineSpineKind,
+  LineSpineKind::NUM_LINE_SPINE_KINDS,
+  (
+    "LSK_GAP_ARRAY",
+    "LSK_TREE",
+  ),
+  "LSK_invalid"
+)
+
+
+std::ostream &operator<<(std::ostream &os, LineSpineKind kind)
+{
+  return os << toString(kind);
+}
+
+
+// ----------------------------- LineSpine -----------------------------
+LineSpine::LineSpine(LineSpineKind kind)
+  : m_kind(kind),
+    m_gapArray(),
+    m_tree()
+{
+  xassert(LineSpineKind::LSK_GAP_ARRAY <= kind &&
+          kind < LineSpineKind::NUM_LINE_SPINE_KINDS);
+}
+
+
+LineSpine::~LineSpine()
+{}
+
+
+void LineSpine::selfCheck() const
+{
+  if (isTree()) {
+    m_tree.selfCheck();
+    xassert(m_gapArray.length().isZero());
+  }
+  else {
+    xassert(m_tree.length() == 0);
+  }
+}
+
+
+void LineSpine::insert(LineIndex line, TextDocumentLine const &value)
+{
+  if (isTree()) {
+    m_tree.insert(line.get(), value);
+  }
+  else {
+    m_gapArray.insert(line, value);
+  }
+}
+
+
+void LineSpine::remove(LineIndex line)
+{
+  if (isTree()) {
+    m_tree.remove(line.get());
+  }
+  else {
+    m_gapArray.remove(line);
+  }
+}
+
+
+void LineSpine::fillFromArray(TextDocumentLine const *src,
+                              LineCount srcLen,
+                              LineIndex gapLocation)
+{
+  if (isTree()) {
+    m_tree.fillFromArray(src, srcLen.get());
+  }
+  else {
+    m_gapArray.fillFromArray(src, srcLen, gapLocation);
+  }
+}
+
+
+std::string LineSpine::internalsString() const
+{
+  if (isTree()) {
+    int leaves, branches;
+    m_tree.getNodeCounts(leaves, branches);
+    return stringb("tree: height=" << m_tree.height() <<
+                   " leaves=" << leaves <<
+                   " branches=" << branches);
+  }
+  else {
+    int L, G, R;
+    m_gapArray.getInternals(L, G, R);
+    return stringb("gap: L=" << L << " G=" << G << " R=" << R);
+  }
+}
+
+
+std::size_t LineSpine::allocatedBytes() const
+{
+  if (isTree()) {
+    return m_tree.allocatedBytes();
+  }
+  else {
+    int L, G, R;
+    m_gapArray.getInternals(L, G, R);
+    return (L+G+R) * sizeof(TextDocumentLine);
+  }
+}
+
+
+LineSpine::operator gdv::GDValue() const
+{
+  GDValue seq(GDVK_SEQUENCE);
+
+  for (LineIndex i(0); i < length(); ++i) {
+    seq.sequenceAppend(GDValue(get(i)));
+  }
+
+  return seq;
+}
+
+
+// EOF
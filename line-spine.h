@@ -0,0 +1,122 @@
+// line-spine.h
+// `LineSpine`, the sequence of lines in a `TextDocumentCore`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_LINE_SPINE_H
+#define EDITOR_LINE_SPINE_H
+
+#include "line-spine-fwd.h"            // fwds for this module
+
+#include "line-count.h"                // LineCount
+#include "line-gap-array.h"            // LineGapArray
+#include "line-index.h"                // LineIndex
+#include "td-line.h"                   // TextDocumentLine
+#include "tree-array.h"                // TreeArray
+
+#include "smbase/gdvalue-fwd.h"        // gdv::GDValue [n]
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+#include "smbase/std-string-fwd.h"     // std::string [n]
+
+#include <cstddef>                     // std::size_t
+#include <iosfwd>                      // std::ostream [n]
+
+
+// Data structure used to hold the sequence of lines.
+enum class LineSpineKind : int {
+  // `LineGapArray`.  Access is O(1), and edits near the previous edit
+  // are cheap, but an edit far from it moves every line in between.
+  LSK_GAP_ARRAY,
+
+  // `TreeArray`.  Access and edits anywhere are O(log n).
+  LSK_TREE,
+
+  NUM_LINE_SPINE_KINDS
+};
+
+// Return a string like "LSK_TREE".
+char const *toString(LineSpineKind kind);
+
+// Write like `toString` does.
+std::ostream &operator<<(std::ostream &os, LineSpineKind kind);
+
+// Iterate with `kind` over all `LineSpineKind`s.
+#define FOR_EACH_LINE_SPINE_KIND(kind)                \
+  for (LineSpineKind kind = LineSpineKind::LSK_GAP_ARRAY; \
+       kind < LineSpineKind::NUM_LINE_SPINE_KINDS;     \
+       kind = LineSpineKind(int(kind) + 1))
+
+
+// Sequence of `TextDocumentLine`, stored in the data structure chosen
+// at construction time.  This only stores the elements; the client is
+// responsible for the memory they point to.
+class LineSpine {
+  NO_OBJECT_COPIES(LineSpine);
+
+private:     // data
+  // Which of the following is in use.  The other is always empty.
+  LineSpineKind const m_kind;
+
+  // Storage when `m_kind` is `LSK_GAP_ARRAY`.
+  LineGapArray<TextDocumentLine> m_gapArray;
+
+  // Storage when `m_kind` is `LSK_TREE`.
+  TreeArray<TextDocumentLine> m_tree;
+
+private:     // methods
+  bool isTree() const
+    { return m_kind == LineSpineKind::LSK_TREE; }
+
+public:      // methods
+  // Initially empty.
+  explicit LineSpine(LineSpineKind kind);
+  ~LineSpine();
+
+  // Assert invariants.
+  void selfCheck() const;
+
+  LineSpineKind kind() const { return m_kind; }
+
+  LineCount length() const
+  {
+    return isTree()? LineCount(m_tree.length()) : m_gapArray.length();
+  }
+
+  TextDocumentLine const &get(LineIndex line) const
+  {
+    return isTree()? m_tree.get(line.get()) : m_gapArray.get(line);
+  }
+
+  void set(LineIndex line, TextDocumentLine const &value)
+  {
+    if (isTree()) {
+      m_tree.set(line.get(), value);
+    }
+    else {
+      m_gapArray.set(line, value);
+    }
+  }
+
+  // Insert `value` so it has index `line`.
+  void insert(LineIndex line, TextDocumentLine const &value);
+
+  // Remove the element at `line`.
+  void remove(LineIndex line);
+
+  // Replace the contents with `srcLen` elements from `src`.  For a gap
+  // array, put the gap at `gapLocation`.
+  void fillFromArray(TextDocumentLine const *src, LineCount srcLen,
+                     LineIndex gapLocation);
+
+  // Describe the internal layout, for debugging.
+  std::string internalsString() const;
+
+  // Bytes of heap storage used by the spine itself.
+  std::size_t allocatedBytes() const;
+
+  // Yield the lines as a sequence.
+  operator gdv::GDValue() const;
+};
+
+
+#endif // EDITOR_LINE_SPINE_H
@@ -15,6 +15,7 @@
 #include "lsp-get-code-lines.h"                  // lspGetCodeLinesFunction
 #include "named-td-list.h"                       // NamedTextDocumentList
 #include "named-td.h"                            // NamedTextDocument
+#include "td-core.h"                             // TextDocumentCore::snapshot
 #include "td-diagnostics.h"                      // TextDocumentDiagnostics
 #include "vfs-connections.h"                     // VFS_AbstractConnections
 
@@ -691,7 +692,7 @@ void LSPClientManager::openFile(
     ntd->filename(),
     languageId,
     version,
-    ntd->getWholeFileString());
+    ntd->getCore().snapshot());
 
   ntd->beginTrackingChanges();
 
@@ -12,6 +12,7 @@
 #include "lsp-client-scope.h"                    // LSPClientScope
 #include "lsp-data.h"                            // LSP_PublishDiagnosticsParams
 #include "lsp-symbol-request-kind.h"             // LSPSymbolRequestKind
+#include "td-core.h"                             // TextDocumentCore::snapshot
 #include "td-diagnostics.h"                      // TextDocumentDiagnostics
 #include "td-obs-recorder.h"                     // TextDocumentObservationRecorder
 #include "uri-util.h"                            // makeFileURI
@@ -135,7 +136,7 @@ void LSPClientTester::sendDidOpen()
     m_params.m_fname,
     "cpp",
     LSP_VersionNumber::fromTDVN(m_doc.getVersionNumber()),
-    m_doc.getWholeFileString());
+    m_doc.getCore().snapshot());
   DIAG("Status: " << m_lspClient.checkStatus());
   m_lspClient.selfCheck();
 
@@ -10,9 +10,10 @@
 #include "line-index.h"                          // LineIndex
 #include "line-number.h"                         // LineNumber
 #include "lsp-client-scope.h"                    // LSPClientScope
-#include "lsp-conv.h"                            // applyLSPDocumentChanges, toLSP_Position
+#include "lsp-conv.h"                            // toLSP_Position
 #include "lsp-data.h"                            // LSP_PublishDiagnosticsParams
 #include "td-core.h"                             // TextDocumentCore
+#include "td-snapshot.h"                         // TextDocumentSnapshot
 #include "uri-util.h"                            // makeFileURI, getFileURIPath
 
 #include "smqtutil/gdvalue-qt.h"                 // toGDValue(QString)
@@ -88,15 +89,13 @@ LSPDocumentInfo::~LSPDocumentInfo()
 LSPDocumentInfo::LSPDocumentInfo(
   std::string const &fname,
   LSP_VersionNumber lastSentVersion,
-  std::string const &lastSentContentsString)
+  std::shared_ptr<TextDocumentSnapshot const> lastSentContents)
   : IMEMBFP(fname),
     IMEMBFP(lastSentVersion),
-    m_lastSentContents(new TextDocumentCore),
+    m_lastSentContents(std::move(lastSentContents)),
     m_waitingForDiagnostics(false),
     m_pendingDiagnostics()
 {
-  m_lastSentContents->replaceWholeFileString(lastSentContentsString);
-
   selfCheck();
 }
 
@@ -145,15 +144,18 @@ std::string LSPDocumentInfo::getLastSentContentsString() const
 
 bool LSPDocumentInfo::lastContentsEquals(TextDocumentCore const &doc) const
 {
-  return *m_lastSentContents == doc;
+  // The snapshot's digest is computed when it is made, and the
+  // document's is maintained incrementally as it is edited, so this
+  // avoids comparing every line.
+  return m_lastSentContents->contentDigest() == doc.contentDigest();
 }
 
 
 std::string LSPDocumentInfo::getLastContentsCodeLine(
   LineIndex lineIndex) const
 {
-  TextDocumentCore const *td = m_lastSentContents.get();
-  return td->getWholeLineStringOrRangeErrorMessage(lineIndex, m_fname);
+  return m_lastSentContents->getWholeLineStringOrRangeErrorMessage(
+    lineIndex, m_fname);
 }
 
 
@@ -1104,11 +1106,12 @@ void LSPClient::notify_textDocument_didOpen(
   std::string const &fname,
   std::string const &languageId,
   LSP_VersionNumber version,
-  std::string &&contents)
+  std::shared_ptr<TextDocumentSnapshot const> contents)
 {
   xassertPrecondition(isRunningNormally());
   xassertPrecondition(isValidLSPPath(fname));
   xassertPrecondition(!isFileOpen(fname));
+  xassertPrecondition(contents != nullptr);
 
   TRACE1("Sending didOpen for " << doubleQuote(fname) <<
          " with initial version " << version << ".");
@@ -1120,14 +1123,14 @@ void LSPClient::notify_textDocument_didOpen(
         { "uri", makeFileURI(fname) },
         { "languageId", languageId },
         { "version", version },
-        { "text", GDValue(contents /*copy*/) },
+        { "text", GDValue(contents->getWholeFileString()) },
       }
     }
   });
 
   // `emplace` would be better here, but GCC rejects (Clang accepts).
   m_documentInfo.insert(std::make_pair(fname,
-    LSPDocumentInfo(fname, version, contents)));
+    LSPDocumentInfo(fname, version, std::move(contents))));
 
   //m_documentInfo.emplace(fname,
   //  fname, version, std::move(contents));
@@ -1140,9 +1143,11 @@ void LSPClient::notify_textDocument_didOpen(
 
 
 void LSPClient::notify_textDocument_didChange(
-  LSP_DidChangeTextDocumentParams const &params)
+  LSP_DidChangeTextDocumentParams const &params,
+  std::shared_ptr<TextDocumentSnapshot const> newContents)
 {
   xassertPrecondition(isRunningNormally());
+  xassertPrecondition(newContents != nullptr);
 
   std::string fname = params.getFname(uriPathSemantics());
   xassertPrecondition(isFileOpen(fname));
@@ -1153,7 +1158,9 @@ void LSPClient::notify_textDocument_didChange(
 
   LSPDocumentInfo &docInfo = mapGetValueAt(m_documentInfo, fname);
 
-  applyLSPDocumentChanges(params, *docInfo.m_lastSentContents);
+  // Rather than replaying `params` onto a copy of the document, just
+  // keep the snapshot of the result.
+  docInfo.m_lastSentContents = std::move(newContents);
 
   docInfo.m_lastSentVersion = params.m_textDocument.m_version;
   docInfo.m_waitingForDiagnostics = true;
@@ -1163,13 +1170,13 @@ void LSPClient::notify_textDocument_didChange(
 void LSPClient::notify_textDocument_didChange_all(
   std::string const &fname,
   LSP_VersionNumber version,
-  std::string &&contents)
+  std::shared_ptr<TextDocumentSnapshot const> contents)
 {
   std::list<LSP_TextDocumentContentChangeEvent> changes;
   std::optional<LSP_Range> noRange;
   changes.push_back(LSP_TextDocumentContentChangeEvent(
     std::move(noRange),
-    std::move(contents)));
+    contents->getWholeFileString()));
 
   LSP_DidChangeTextDocumentParams params(
     LSP_VersionedTextDocumentIdentifier::fromFname(
@@ -1178,7 +1185,7 @@ void LSPClient::notify_textDocument_didChange_all(
       version),
     std::move(changes));
 
-  notify_textDocument_didChange(std::move(params));
+  notify_textDocument_didChange(std::move(params), std::move(contents));
 }
 
 
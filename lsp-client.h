@@ -17,6 +17,7 @@
 #include "lsp-symbol-request-kind.h"             // LSPSymbolRequestKind
 #include "lsp-version-number.h"                  // LSP_VersionNumber
 #include "td-core-fwd.h"                         // TextDocumentCore [n]
+#include "td-snapshot-fwd.h"                     // TextDocumentSnapshot [n]
 #include "textmcoord.h"                          // TextMCoord
 #include "uri-util.h"                            // URIPathSemantics
 
@@ -32,7 +33,7 @@
 
 #include <iosfwd>                                // std::ostream
 #include <list>                                  // std::list
-#include <memory>                                // std::unique_ptr
+#include <memory>                                // std::unique_ptr, std::shared_ptr
 #include <set>                                   // std::set
 #include <string>                                // std::string
 
@@ -70,9 +71,13 @@ public:      // data
   // file contents agrees with the client object's after potentially
   // many incremental updates.
   //
+  // This is a snapshot supplied by the sender rather than a replica
+  // that the client edits, so it shares the storage of unchanged lines
+  // with the document's other snapshots.
+  //
   // Never null.
   //
-  std::unique_ptr<TextDocumentCore> m_lastSentContents;
+  std::shared_ptr<TextDocumentSnapshot const> m_lastSentContents;
 
   // True when we have sent updated contents but not received the
   // associated diagnostics.  Initially false.
@@ -88,7 +93,7 @@ public:      // methods
   LSPDocumentInfo(
     std::string const &fname,
     LSP_VersionNumber lastSentVersion,
-    std::string const &lastSentContentsString);
+    std::shared_ptr<TextDocumentSnapshot const> lastSentContents);
 
   // I only want to use the move ctor.
   LSPDocumentInfo(LSPDocumentInfo const &obj) = delete;
@@ -107,7 +112,8 @@ public:      // methods
   // Get `m_lastSentContents` as a string.
   std::string getLastSentContentsString() const;
 
-  // True if `m_lastSentContents` equals `doc`.
+  // True if `m_lastSentContents` equals `doc`, as determined by
+  // comparing their content digests.
   bool lastContentsEquals(TextDocumentCore const &doc) const;
 
   // Return the text of the line at (0-based) `lineIndex` in the last
@@ -374,29 +380,34 @@ public:      // methods
   gdv::GDValue getServerCapabilities() const
     { return m_serverCapabilities; }
 
-  // Send the "textDocument/didOpen" notification.
+  // Send the "textDocument/didOpen" notification with `contents`.
   //
   // Requires: isRunningNormally()
   // Requires: isValidLSPPath(fname)
   // Requires: !isFileOpen(fname)
+  // Requires: contents != nullptr
   void notify_textDocument_didOpen(
     std::string const &fname,
     std::string const &languageId,
     LSP_VersionNumber version,
-    std::string &&contents);
+    std::shared_ptr<TextDocumentSnapshot const> contents);
 
-  // Send the "textDocument/didChange" notification.
+  // Send the "textDocument/didChange" notification.  `newContents` is
+  // what the document contains after applying `params`, which becomes
+  // the document's `m_lastSentContents`.
   //
   // Requires: isRunningNormally()
   // Requires: isFileOpen(params.getFname())
+  // Requires: newContents != nullptr
   void notify_textDocument_didChange(
-    LSP_DidChangeTextDocumentParams const &params);
+    LSP_DidChangeTextDocumentParams const &params,
+    std::shared_ptr<TextDocumentSnapshot const> newContents);
 
   // Convenience method for updating the entire document.
   void notify_textDocument_didChange_all(
     std::string const &fname,
     LSP_VersionNumber version,
-    std::string &&contents);
+    std::shared_ptr<TextDocumentSnapshot const> contents);
 
   // Send the "textDocument/didClose" notification.
   //
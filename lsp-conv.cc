@@ -13,6 +13,7 @@
 #include "td-change.h"                 // TextDocumentChange
 #include "td-core.h"                   // TextDocumentCore
 #include "td-diagnostics.h"            // TextDocumentDiagnostics
+#include "td-snapshot.h"               // TextDocumentSnapshot
 #include "tdd-proposed-fix.h"          // TDD_ProposedFix
 #include "textmcoord.h"                // TextMCoord[Range]
 #include "uri-util.h"                  // getFileURIPath
@@ -26,7 +27,7 @@
 #include "smbase/xassert.h"            // xassertPrecondition
 
 #include <list>                        // std::list
-#include <memory>                      // std::unique_ptr
+#include <memory>                      // std::unique_ptr, std::shared_ptr
 #include <optional>                    // std::{nullopt, optional}
 #include <string>                      // std::string
 #include <utility>                     // std::move
@@ -220,12 +221,14 @@ void applyLSPDocumentChanges(
 
 
 // As part of a `clangd` workaround, send a single change notification.
+// `newContents` is what the server's copy contains afterward.
 static void lspSendOneChange(
   LSPClient &lspClient,
   NamedTextDocument &doc,
   TextMCoord start,
   TextMCoord end,
   char const *newText,
+  std::shared_ptr<TextDocumentSnapshot const> newContents,
   std::optional<bool> wantDiagnostics,
   char const *traceLabel)
 {
@@ -246,7 +249,8 @@ static void lspSendOneChange(
 
   TRACE1(traceLabel << ": " <<
          toGDValue(changeParams).asIndentedString());
-  lspClient.notify_textDocument_didChange(changeParams);
+  lspClient.notify_textDocument_didChange(changeParams,
+                                          std::move(newContents));
   doc.beginTrackingChanges();
 }
 
@@ -272,6 +276,11 @@ static void lspSendNoOpChangeWorkaround(
 
   TextMCoord endPos = doc.endCoord();
 
+  // The document itself is not modified, so the server's copy after
+  // each change is derived from a snapshot of it.
+  std::shared_ptr<TextDocumentSnapshot const> contents =
+    doc.getCore().snapshot();
+
   // Change 1: Append "//", which should have minimal adverse impact, at
   // least for C/C++.
   lspSendOneChange(
@@ -280,6 +289,8 @@ static void lspSendNoOpChangeWorkaround(
     endPos,
     endPos,
     "//",
+    contents->withLineReplaced(endPos.m_line,
+      contents->getWholeLineString(endPos.m_line) + "//"),
     true /*wantDiagnostics*/,
     "Sending no-op change part 1");
 
@@ -292,6 +303,7 @@ static void lspSendNoOpChangeWorkaround(
     endPos,
     newEndPos,
     "",
+    contents,
     std::nullopt /*wantDiagnostics*/,
     "Sending no-op change part 2");
 }
@@ -352,11 +364,12 @@ void lspSendUpdatedContents(
   // Done with these.
   recordedChanges.reset();
 
-  // Send them to the server, and have the client object update its
-  // copy.
+  // Send them to the server, and give the client object a snapshot of
+  // the resulting contents.
   TRACE2("Sending incremental changes: " <<
          toGDValue(changeParams).asIndentedString());
-  lspClient.notify_textDocument_didChange(changeParams);
+  lspClient.notify_textDocument_didChange(changeParams,
+                                          doc.getCore().snapshot());
 
   // The document's change recorder must also know this was sent.
   doc.beginTrackingChanges();
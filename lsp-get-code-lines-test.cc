@@ -7,6 +7,7 @@
 #include "host-file-line.h"                      // HostFileLine
 #include "line-number.h"                         // LineNumber
 #include "lsp-client.h"                          // LSPClientDocumentState
+#include "td-core.h"                             // TextDocumentCore
 #include "vfs-test-connections.h"                // VFS_TestConnections
 
 #include "smqtutil/sync-wait.h"                  // SynchronousWaiter
@@ -160,10 +161,12 @@ public:      // methods
   void addFileToLSP(int fileIndex)
   {
     xassert(cc::z_le_lt(fileIndex, TABLESIZE(fname)));
+    TextDocumentCore contents;
+    contents.replaceWholeFileString(fnameData[fileIndex]);
     lspClient.addDoc(LSPDocumentInfo(
       fname[fileIndex],
       LSP_VersionNumber(1),
-      fnameData[fileIndex]));
+      contents.snapshot()));
   }
 
   // Add `fileIndex` to VFS.
@@ -248,16 +251,17 @@ public:      // methods
   }
 
 
-  // Two VFS lookups, and the second gets canceled.
-  void test_cancelSecondVFSLookup()
+  // Two VFS lookups, which are batched into one request, and the user
+  // cancels it.
+  void test_cancelBatchedVFSLookup()
   {
-    TEST_CASE("test_cancelSecondVFSLookup");
+    TEST_CASE("test_cancelBatchedVFSLookup");
 
     locAddFileLine(0, 2);
     locAddFileLine(1, 3);
 
-    // Cancel the second wait attempt.
-    waiter.m_cancelCountdown = 1;
+    // Cancel the first wait attempt.
+    waiter.m_cancelCountdown = 0;
 
     // Serve both files from VFS.
     addFileToVFS(0);
@@ -267,7 +271,42 @@ public:      // methods
       callLspGetCodeLinesFunction();
 
     EXPECT_FALSE(linesOpt.has_value());
-    EXPECT_EQ(waiter.m_waitUntilCount, 2);
+    EXPECT_EQ(waiter.m_waitUntilCount, 1);
+  }
+
+
+  // Several lines from several files, plus one file with an error, all
+  // come back from one VFS request.
+  void test_batchedVFSLookup()
+  {
+    TEST_CASE("test_batchedVFSLookup");
+
+    locAddFileLine(1, 3);
+    locAddFileLine(0, 2);
+    locAddErrFileLine(0, 1);
+    locAddFileLine(1, 1);
+    locAddFileLine(0, 2);
+    locAddFileLine(0, 9);
+
+    addFileToVFS(0);
+    addFileToVFS(1);
+    addErrFileToVFS(0);
+
+    std::optional<std::vector<std::string>> linesOpt =
+      callLspGetCodeLinesFunction();
+
+    EXPECT_TRUE(linesOpt.has_value());
+    EXPECT_EQ(linesOpt->size(), 6);
+    EXPECT_EQ(linesOpt->at(0), "THREE");
+    EXPECT_EQ(linesOpt->at(1), "two");
+    EXPECT_EQ(linesOpt->at(2),
+      "<Error: File not found (code PEC_FILE_NOT_FOUND)>");
+    EXPECT_EQ(linesOpt->at(3), "ONE");
+    EXPECT_EQ(linesOpt->at(4), "two");
+    EXPECT_EQ(linesOpt->at(5),
+      "<Line number 9 is out of range for \"/home/user/file0.cc\", "
+      "which has 4 lines.>");
+    EXPECT_EQ(waiter.m_waitUntilCount, 1);
   }
 
 
@@ -400,7 +439,8 @@ void test_lsp_get_code_lines(CmdlineArgsSpan args)
   Tester().test_oneLSPLookup();
   Tester().test_oneVFSLookup();
   Tester().test_cancelVFSLookup();
-  Tester().test_cancelSecondVFSLookup();
+  Tester().test_cancelBatchedVFSLookup();
+  Tester().test_batchedVFSLookup();
   Tester().test_oneLSP_oneVFS(true /*lspFirst*/);
   Tester().test_oneLSP_oneVFS(false /*lspFirst*/);
   Tester().test_largeLineNumberLSP();
@@ -3,34 +3,35 @@
 
 #include "lsp-get-code-lines.h"                  // this module
 
-#include "fail-reason-opt.h"                     // FailReasonOpt
 #include "host-file-line.h"                      // HostFileLine
+#include "host-name.h"                           // HostName
+#include "line-count.h"                          // LineCount
 #include "lsp-client.h"                          // LSPClientDocumentState
-#include "td-core.h"                             // TextDocumentCore
+#include "td-core.h"                             // TextDocumentCore::lineRangeErrorMessage
 #include "vfs-connections.h"                     // VFS_AbstractConnections
-#include "vfs-query-sync.h"                      // readFileSynchronously
+#include "vfs-msg.h"                             // VFS_ReadFileLines{Request,Reply}
+#include "vfs-query-sync.h"                      // readFileLinesSynchronously
 
 #include "smqtutil/sync-wait.h"                  // SynchronousWaiter
 
-// This has to come before gdvalue-map.
-#include "smbase/gdvalue-unique-ptr-fwd.h"       // gdv::toGDValue(std::unique_ptr)
-
 #include "smbase/either.h"                       // smbase::Either
 #include "smbase/gdvalue-either.h"               // gdv::toGDValue(smbase::Either)
 #include "smbase/gdvalue-map.h"                  // gdv::toGDValue(std::map)
 #include "smbase/gdvalue-optional.h"             // gdv::toGDValue(std::optional)
 #include "smbase/gdvalue-set.h"                  // gdv::toGDValue(std::set)
-#include "smbase/gdvalue-unique-ptr.h"           // gdv::toGDValue(std::unique_ptr)
 #include "smbase/gdvalue-vector.h"               // gdv::toGDValue(std::vector)
 #include "smbase/gdvalue.h"                      // gdv::GDValue
-#include "smbase/map-util.h"                     // smbase::mapInsertUniqueMove
+#include "smbase/map-util.h"                     // smbase::{mapInsertUniqueMove, mapGetValueAtC}
 #include "smbase/sm-env.h"                       // smbase::envAsIntOr
 #include "smbase/sm-trace.h"                     // INIT_TRACE, etc.
 #include "smbase/xassert.h"                      // xassertPostcondition
 
-#include <memory>                                // std::make_unique
+#include <map>                                   // std::map
+#include <memory>                                // std::unique_ptr
 #include <optional>                              // std::optional
+#include <set>                                   // std::set
 #include <string>                                // std::string
+#include <utility>                               // std::move
 #include <vector>                                // std::vector
 
 using namespace gdv;
@@ -70,74 +71,104 @@ std::optional<std::vector<std::string>> lspGetCodeLinesFunction(
 {
   TRACE2_GDVN_EXPRS("lspGetCodeLines", locations);
 
-  // First, get the set of files that require a VFS query.
-  std::set<HostAndResourceName> filesToQuery;
+  // Allow injecting an offset to test handling of invalid (too large)
+  // line indices.
+  static LineCount const offsetForTesting(
+    envAsIntOr(0, "EDITOR_GLOBAL_GET_CODE_LINE_OFFSET"));
+
+  // First, get the set of lines, grouped by file, that require a VFS
+  // query.
+  std::map<HostAndResourceName, std::set<LineIndex>> linesToQuery;
   for (HostFileLine const &hfal : locations) {
     HostAndResourceName const &harn = hfal.getHarn();
     if (harn.isLocal() &&
         !lspClient.isFileOpen(harn.resourceName())) {
       // It is a local file, but it is not open with the LSP client, so
       // we will need to query for it.
-      filesToQuery.insert(harn);
+      linesToQuery[harn].insert(hfal.getLineIndex() + offsetForTesting);
     }
   }
-  TRACE2_GDVN_EXPRS("lspGetCodeLines", filesToQuery);
-
-  // Either a parsed (into lines of text) document, or an error message
-  // explaining why the contents could not be read.
-  using DocOrError =
-    Either<std::unique_ptr<TextDocumentCore>, std::string>;
-
-  // Map holding the result of the queries.
-  std::map<HostAndResourceName, DocOrError> nameToDocOrError;
-
-  // Issue a query for each of those files.
-  for (HostAndResourceName const &harn : filesToQuery) {
-    // Issue a request and synchronously wait for the reply.
-    //
-    // TODO: This queries one file at a time.  I want to batch all of
-    // the requests into a single message.
-    TRACE2("lspGetCodeLines: querying: " << toGDValue(harn));
-    auto replyOrError(
-      readFileSynchronously(&vfsConnections, waiter, harn));
-
-    if (FailReasonOpt errorMsg =
-          getROEErrorMessage(replyOrError)) {
-      // Store the error message.
-      TRACE2("lspGetCodeLines: got error for " << toGDValue(harn) <<
-             ": " << *errorMsg);
-      mapInsertUniqueMove(nameToDocOrError, harn,
-        DocOrError(*errorMsg));
+  TRACE2_GDVN_EXPRS("lspGetCodeLines", linesToQuery);
+
+  // Either a map from line index to the text to show for it, or an
+  // error message explaining why the file could not be read.
+  using LinesOrError =
+    Either<std::map<LineIndex, std::string>, std::string>;
+
+  // Map holding the result of the query.
+  std::map<HostAndResourceName, LinesOrError> nameToLinesOrError;
+
+  if (!linesToQuery.empty()) {
+    // Issue one request for all of the files and synchronously wait
+    // for the reply.  The files are all local, so they are all on the
+    // same host.
+    std::unique_ptr<VFS_ReadFileLinesRequest> request(
+      new VFS_ReadFileLinesRequest);
+    for (auto const &kv : linesToQuery) {
+      request->m_files.push_back(VFS_ReadFileLinesRequest::FileLines());
+      VFS_ReadFileLinesRequest::FileLines &fl = request->m_files.back();
+      fl.m_path = kv.first.resourceName();
+      for (LineIndex const &li : kv.second) {
+        fl.m_lineIndices.push_back(li.get());
+      }
     }
-    else {
-      std::unique_ptr<VFS_ReadFileReply> &rfr = replyOrError.left();
-      if (rfr) {
-        // Error would be handled above.
-        xassert(rfr->m_success);
-
-        // Copy the contents into a `TextDocumentCore` for easy line
-        // querying later.
-        auto doc = std::make_unique<TextDocumentCore>();
-        doc->replaceWholeFile(rfr->m_contents);
-
-        // Store the contents in the map.
-        mapInsertUniqueMove(nameToDocOrError, harn,
-          DocOrError(std::move(doc)));
+
+    TRACE2("lspGetCodeLines: querying " << linesToQuery.size() <<
+           " files");
+    auto replyOrError(readFileLinesSynchronously(
+      &vfsConnections, waiter, HostName::asLocal(), std::move(request)));
+
+    if (replyOrError.isRight()) {
+      // Communication failed, so every file gets the same message.
+      TRACE2("lspGetCodeLines: got error: " << replyOrError.right());
+      for (auto const &kv : linesToQuery) {
+        mapInsertUniqueMove(nameToLinesOrError, kv.first,
+          LinesOrError(replyOrError.right()));
       }
-      else {
-        // User canceled the wait, bail out entirely.
-        TRACE2("lspGetCodeLines: while querying " << toGDValue(harn) <<
-               ", user canceled");
-        return std::nullopt;
+    }
+    else if (!replyOrError.left()) {
+      // User canceled the wait, bail out entirely.
+      TRACE2("lspGetCodeLines: user canceled");
+      return std::nullopt;
+    }
+    else {
+      VFS_ReadFileLinesReply const &reply = *(replyOrError.left());
+      xassert(reply.m_files.size() == linesToQuery.size());
+
+      // The reply is parallel to the request, which was built in
+      // `linesToQuery` order.
+      auto replyIt = reply.m_files.begin();
+      for (auto const &kv : linesToQuery) {
+        HostAndResourceName const &harn = kv.first;
+        VFS_ReadFileLinesReply::FileLines const &fl = *(replyIt++);
+
+        if (!fl.m_success) {
+          mapInsertUniqueMove(nameToLinesOrError, harn,
+            LinesOrError(stringb(
+              fl.m_failureReasonString <<
+              " (code " << fl.m_failureReasonCode << ")")));
+          continue;
+        }
+
+        xassert(fl.m_lines.size() == kv.second.size());
+        std::map<LineIndex, std::string> lines;
+        auto lineIt = fl.m_lines.begin();
+        for (LineIndex const &li : kv.second) {
+          std::string const &text = *(lineIt++);
+          if (fl.hasLine(li.get())) {
+            lines.insert({li, text});
+          }
+          else {
+            lines.insert({li, TextDocumentCore::lineRangeErrorMessage(
+              li, harn.resourceName(), LineCount(fl.m_numLines))});
+          }
+        }
+        mapInsertUniqueMove(nameToLinesOrError, harn,
+          LinesOrError(std::move(lines)));
       }
     }
   }
-  TRACE2_GDVN_EXPRS("lspGetCodeLines", nameToDocOrError);
-
-  // Allow injecting an offset to test handling of invalid (too large)
-  // line indices.
-  static LineCount const offsetForTesting(
-    envAsIntOr(0, "EDITOR_GLOBAL_GET_CODE_LINE_OFFSET"));
+  TRACE2_GDVN_EXPRS("lspGetCodeLines", nameToLinesOrError);
 
   // Now go over the original set of locations again, populating the
   // sequence to return.
@@ -160,16 +191,15 @@ std::optional<std::vector<std::string>> lspGetCodeLinesFunction(
         ret.push_back(docInfo->getLastContentsCodeLine(lineIndex));
       }
       else /*not LSP*/ {
-        // We should have queried this file's details via VFS.
-        auto const &docOrError = mapGetValueAtC(nameToDocOrError, harn);
-        if (docOrError.isLeft()) {
-          ret.push_back(
-            docOrError.leftC()->getWholeLineStringOrRangeErrorMessage(
-              lineIndex, fname));
+        // We should have queried this file's lines via VFS.
+        auto const &linesOrError =
+          mapGetValueAtC(nameToLinesOrError, harn);
+        if (linesOrError.isLeft()) {
+          ret.push_back(mapGetValueAtC(linesOrError.leftC(), lineIndex));
         }
         else {
           ret.push_back(
-            stringb("<Error: " << docOrError.rightC() << ">"));
+            stringb("<Error: " << linesOrError.rightC() << ">"));
         }
       }
     }
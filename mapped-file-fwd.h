@@ -0,0 +1,11 @@
+// mapped-file-fwd.h
+// Forward decls for `mapped-file.h`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_MAPPED_FILE_FWD_H
+#define EDITOR_MAPPED_FILE_FWD_H
+
+class MappedFile;
+
+#endif // EDITOR_MAPPED_FILE_FWD_H
@@ -0,0 +1,178 @@
+// mapped-file-test.cc
+// Tests for `mapped-file` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "mapped-file.h"               // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/autofile.h"           // AutoFILE
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, DIAG
+#include "smbase/syserr.h"             // smbase::XSysError
+#include "smbase/xassert.h"            // xassert, xfailure
+
+#include <cstddef>                     // std::size_t
+#include <string>                      // std::string
+
+#include <stdio.h>                     // fputs, remove
+#ifndef __WIN32__
+#  include <unistd.h>                  // sysconf
+#  include <utime.h>                   // utime
+#endif
+
+using namespace smbase;
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+char const *const TMP_FNAME = "mapped-file.tmp";
+
+
+void writeTmpFile(std::string const &contents)
+{
+  AutoFILE fp(TMP_FNAME, "wb");
+  fputs(contents.c_str(), fp);
+}
+
+
+void testContents()
+{
+  std::string contents("one\ntwo\nthree\n");
+  writeTmpFile(contents);
+
+  xassert(MappedFile::fileSizeOpt(TMP_FNAME) == contents.size());
+
+  {
+    MappedFile mf(TMP_FNAME);
+    mf.adviseSequential();
+    EXPECT_EQ(mf.size(), contents.size());
+    EXPECT_EQ(std::string(mf.data(), mf.size()), contents);
+    mf.adviseRandom();
+  }
+
+  remove(TMP_FNAME);
+}
+
+
+void testEmpty()
+{
+  writeTmpFile("");
+
+  MappedFile mf(TMP_FNAME);
+  EXPECT_EQ(mf.size(), (std::size_t)0);
+  xassert(mf.data() == nullptr);
+
+  remove(TMP_FNAME);
+}
+
+
+void testUnchanged()
+{
+  writeTmpFile("one\ntwo\n");
+
+  {
+    MappedFile mf(TMP_FNAME);
+    xassert(mf.isUnchanged());
+    xassert(!mf.isDamaged());
+
+#ifndef __WIN32__
+    // Rewriting in place with the same size changes the mapped bytes.
+    // Set the modification time explicitly, since the rewrite can be
+    // too quick for the clock to advance.
+    writeTmpFile("ONE\nTWO\n");
+    struct utimbuf times;
+    times.actime = times.modtime = 1;
+    EXPECT_EQ(utime(TMP_FNAME, &times), 0);
+    xassert(!mf.isUnchanged());
+#endif
+  }
+
+  {
+    MappedFile mf(TMP_FNAME);
+    xassert(mf.isUnchanged());
+
+#ifndef __WIN32__
+    // So does appending.
+    {
+      AutoFILE fp(TMP_FNAME, "ab");
+      fputs("three\n", fp);
+    }
+    xassert(!mf.isUnchanged());
+#endif
+  }
+
+  remove(TMP_FNAME);
+}
+
+
+#ifndef __WIN32__
+// Reading pages removed by truncation yields zeroes rather than
+// `SIGBUS`.
+void testTruncatedRead()
+{
+  std::size_t const size = (std::size_t)sysconf(_SC_PAGESIZE) * 3;
+  writeTmpFile(std::string(size, 'x'));
+
+  {
+    MappedFile mf(TMP_FNAME);
+    EXPECT_EQ(mf.data()[size-1], 'x');
+
+    writeTmpFile("");
+    xassert(!mf.isUnchanged());
+    xassert(!mf.isDamaged());
+
+    char volatile const *p = mf.data();
+    EXPECT_EQ(p[size-1], 0);
+    xassert(mf.isDamaged());
+
+    // Other pages are replaced as they are touched.
+    EXPECT_EQ(p[0], 0);
+  }
+
+  // A new mapping starts out undamaged.
+  writeTmpFile("abc");
+  {
+    MappedFile mf(TMP_FNAME);
+    EXPECT_EQ(std::string(mf.data(), mf.size()), "abc");
+    xassert(!mf.isDamaged());
+    xassert(mf.isUnchanged());
+  }
+
+  remove(TMP_FNAME);
+}
+#endif // __WIN32__
+
+
+void testMissing()
+{
+  xassert(!MappedFile::fileSizeOpt("mapped-file.nonexistent.tmp"));
+
+  try {
+    MappedFile mf("mapped-file.nonexistent.tmp");
+    xfailure("should have failed");
+  }
+  catch (XSysError &x) {
+    DIAG("as expected: " << x.why());
+  }
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_mapped_file(CmdlineArgsSpan args)
+{
+  testContents();
+  testEmpty();
+  testUnchanged();
+#ifndef __WIN32__
+  testTruncatedRead();
+#endif
+  testMissing();
+}
+
+
+// EOF
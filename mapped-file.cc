@@ -0,0 +1,281 @@
+// mapped-file.cc
+// Code for `mapped-file` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "mapped-file.h"               // this module
+
+// smbase
+#include "smbase/sm-file-util.h"       // SMFileUtil
+#include "smbase/syserr.h"             // smbase::xsyserror
+
+// libc++
+#include <atomic>                      // std::atomic
+#include <cstdint>                     // std::uintptr_t
+#include <cstring>                     // std::memset
+#include <mutex>                       // std::call_once, std::once_flag
+
+// libc
+#include <sys/stat.h>                  // stat, fstat
+#ifndef __WIN32__
+#  include <fcntl.h>                   // open
+#  include <signal.h>                  // sigaction
+#  include <sys/mman.h>                // mmap, munmap, posix_madvise
+#  include <unistd.h>                  // close, sysconf
+#endif
+
+using namespace smbase;
+
+
+#ifndef __WIN32__
+
+// ------------------------- SIGBUS handling -------------------------
+// A mapping registered with the `SIGBUS` handler.  The handler runs
+// asynchronously, so it only reads these atomics.  An entry is in use
+// when `m_start` is not zero, and `m_size` is cleared before `m_start`
+// when it is released, so the handler never matches a stale range.
+struct MappedFileGuardSlot {
+  std::atomic<std::uintptr_t> m_start;
+  std::atomic<std::size_t> m_size;
+  std::atomic<bool> m_damaged;
+};
+
+// Maximum number of mappings that are protected at once.  A mapping
+// made when the table is full is not protected, and a truncation
+// under it crashes as it would without the handler.
+static int const NUM_GUARD_SLOTS = 256;
+
+// Table of protected mappings.  Static storage is zero-initialized,
+// so every entry starts out unused.
+static MappedFileGuardSlot s_guardSlots[NUM_GUARD_SLOTS];
+
+// Size of a page, read before the handler is installed since
+// `sysconf` cannot be called from a signal handler.
+static std::uintptr_t s_pageSize = 0;
+
+// Disposition of `SIGBUS` before ours, for faults we do not handle.
+static struct sigaction s_previousBusAction;
+
+static std::once_flag s_installBusHandlerOnce;
+
+
+static void busHandler(int /*sig*/, siginfo_t *info, void * /*context*/)
+{
+  std::uintptr_t const addr = reinterpret_cast<std::uintptr_t>(info->si_addr);
+  for (MappedFileGuardSlot &slot : s_guardSlots) {
+    std::uintptr_t const start = slot.m_start.load();
+    std::size_t const size = slot.m_size.load();
+    if (start != 0 && start <= addr && addr - start < size) {
+      // Replace the page that is no longer backed by the file with
+      // zeroes, after which the faulting read can be retried.
+      void *page = reinterpret_cast<void*>(addr & ~(s_pageSize - 1));
+      void *p = ::mmap(page, s_pageSize, PROT_READ,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+      if (p != MAP_FAILED) {
+        slot.m_damaged.store(true);
+        return;
+      }
+    }
+  }
+
+  // Not ours.  Restore the previous disposition; returning retries the
+  // faulting access, which then gets it.
+  ::sigaction(SIGBUS, &s_previousBusAction, nullptr);
+}
+
+
+static void installBusHandler()
+{
+  s_pageSize = (std::uintptr_t)::sysconf(_SC_PAGESIZE);
+
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = &busHandler;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  if (::sigaction(SIGBUS, &sa, &s_previousBusAction) < 0) {
+    xsyserror("sigaction", "SIGBUS");
+  }
+}
+
+
+// Register the `size` bytes at `data` with the handler, returning the
+// slot used, or -1 if the table is full.
+static int registerGuardSlot(char const *data, std::size_t size)
+{
+  std::call_once(s_installBusHandlerOnce, &installBusHandler);
+
+  std::uintptr_t const start = reinterpret_cast<std::uintptr_t>(data);
+  for (int i=0; i < NUM_GUARD_SLOTS; i++) {
+    MappedFileGuardSlot &slot = s_guardSlots[i];
+    std::uintptr_t expected = 0;
+    if (slot.m_start.compare_exchange_strong(expected, start)) {
+      slot.m_damaged.store(false);
+      slot.m_size.store(size);
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+static void releaseGuardSlot(int i)
+{
+  s_guardSlots[i].m_size.store(0);
+  s_guardSlots[i].m_start.store(0);
+}
+
+
+// Modification time recorded in `st`, in nanoseconds.
+static std::int64_t modTimeNS(struct stat const &st)
+{
+#ifdef __APPLE__
+  struct timespec const &ts = st.st_mtimespec;
+#else
+  struct timespec const &ts = st.st_mtim;
+#endif
+  return (std::int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// --------------------------- MappedFile ----------------------------
+MappedFile::MappedFile(std::string const &fname)
+  : m_fname(fname),
+    m_data(nullptr),
+    m_size(0),
+    m_fd(-1),
+    m_modTimeNS(0),
+    m_guardSlot(-1),
+    m_buffer()
+{
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    xsyserror("open", fname);
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    ::close(fd);
+    xsyserror("fstat", fname);
+  }
+  m_size = (std::size_t)st.st_size;
+  m_modTimeNS = modTimeNS(st);
+
+  if (m_size > 0) {
+    void *p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      xsyserror("mmap", fname);
+    }
+    m_data = static_cast<char const *>(p);
+    m_guardSlot = registerGuardSlot(m_data, m_size);
+  }
+
+  m_fd = fd;
+}
+
+
+MappedFile::~MappedFile()
+{
+  // Stop matching faults before the range can be reused.
+  if (m_guardSlot >= 0) {
+    releaseGuardSlot(m_guardSlot);
+  }
+  if (m_data) {
+    ::munmap(const_cast<char*>(m_data), m_size);
+  }
+  ::close(m_fd);
+}
+
+
+void MappedFile::adviseSequential()
+{
+  if (m_data) {
+    (void)::posix_madvise(const_cast<char*>(m_data), m_size,
+                          POSIX_MADV_SEQUENTIAL);
+  }
+}
+
+
+void MappedFile::adviseRandom()
+{
+  if (m_data) {
+    (void)::posix_madvise(const_cast<char*>(m_data), m_size,
+                          POSIX_MADV_RANDOM);
+  }
+}
+
+
+bool MappedFile::isUnchanged() const
+{
+  struct stat st;
+  return ::fstat(m_fd, &st) == 0 &&
+         (std::size_t)st.st_size == m_size &&
+         modTimeNS(st) == m_modTimeNS &&
+         !isDamaged();
+}
+
+
+bool MappedFile::isDamaged() const
+{
+  return m_guardSlot >= 0 && s_guardSlots[m_guardSlot].m_damaged.load();
+}
+
+#else // __WIN32__
+
+MappedFile::MappedFile(std::string const &fname)
+  : m_fname(fname),
+    m_data(nullptr),
+    m_size(0),
+    m_fd(-1),
+    m_modTimeNS(0),
+    m_guardSlot(-1),
+    m_buffer()
+{
+  std::vector<unsigned char> bytes(SMFileUtil().readFile(fname));
+  m_buffer.assign(bytes.begin(), bytes.end());
+  m_size = m_buffer.size();
+  if (m_size > 0) {
+    m_data = m_buffer.data();
+  }
+}
+
+
+MappedFile::~MappedFile()
+{}
+
+
+void MappedFile::adviseSequential()
+{}
+
+
+void MappedFile::adviseRandom()
+{}
+
+
+bool MappedFile::isUnchanged() const
+{
+  return true;
+}
+
+
+bool MappedFile::isDamaged() const
+{
+  return false;
+}
+
+#endif // __WIN32__
+
+
+STATICDEF std::optional<std::size_t> MappedFile::fileSizeOpt(
+  std::string const &fname)
+{
+  struct stat st;
+  if (::stat(fname.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+    return std::nullopt;
+  }
+  return (std::size_t)st.st_size;
+}
+
+
+// EOF
@@ -0,0 +1,105 @@
+// mapped-file.h
+// `MappedFile`, read-only view of a file's contents in memory.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_MAPPED_FILE_H
+#define EDITOR_MAPPED_FILE_H
+
+#include "mapped-file-fwd.h"           // fwds for this module
+
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::int64_t
+#include <optional>                    // std::optional
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+// The contents of a file, mapped read-only into the address space so
+// that pages are only read from disk when touched, and can be discarded
+// by the OS under memory pressure since they are never dirty.
+//
+// On platforms without `mmap`, the contents are simply read into a heap
+// buffer, so clients see the same interface either way.
+//
+// If another process truncates the file while it is mapped, touching
+// the pages that were removed raises `SIGBUS`.  To keep that from
+// crashing the program before the client learns of the change, the
+// first `MappedFile` installs a handler that, for a fault in a mapping,
+// puts a page of zeroes in place of the missing one, so the read
+// yields zeroes, and marks the mapping as damaged.  A faulting address
+// outside every mapping gets the previous handling.
+//
+// Either way, the mapped bytes no longer reflect the file once it has
+// been written in place, so clients must check `isUnchanged()` when
+// they learn that the file has changed, and stop using the mapping if
+// it is not.  Replacing the file by renaming another over it, as the
+// VFS does when saving, does not affect the mapping.
+class MappedFile {
+  NO_OBJECT_COPIES(MappedFile);
+
+private:     // data
+  // Name of the file, for diagnostics.
+  std::string m_fname;
+
+  // Start of the mapped contents, or null if the file is empty.
+  char const *m_data;
+
+  // Number of bytes in the file.
+  std::size_t m_size;
+
+  // When using `mmap`, the open descriptor of the mapped file, kept so
+  // `isUnchanged` can check the file that is mapped rather than
+  // whatever now has its name.  Otherwise -1.
+  int m_fd;
+
+  // Modification time of the file when it was mapped, in nanoseconds,
+  // or 0 when not using `mmap`.
+  std::int64_t m_modTimeNS;
+
+  // Index of the entry describing this mapping in the table consulted
+  // by the `SIGBUS` handler, or -1 if it does not have one, because it
+  // is empty, not using `mmap`, or the table was full.
+  int m_guardSlot;
+
+  // When not using `mmap`, the buffer that `m_data` points into.
+  std::vector<char> m_buffer;
+
+public:      // methods
+  // Map `fname`.  Throws `XSysError` if it cannot be opened or mapped.
+  explicit MappedFile(std::string const &fname);
+
+  ~MappedFile();
+
+  std::string const &fname() const { return m_fname; }
+
+  // Contents.  `data()` is null when `size()` is zero.
+  char const *data() const { return m_data; }
+  std::size_t size() const { return m_size; }
+
+  // Hint to the OS that the contents are about to be read
+  // sequentially, or that the access pattern is now unpredictable.
+  // These have no effect when not using `mmap`.
+  void adviseSequential();
+  void adviseRandom();
+
+  // True if the file still has the size and modification time it had
+  // when mapped, and no page of the mapping has been replaced after a
+  // fault, so `data()` still holds the file's contents.  A file
+  // rewritten in place, even at the same size, is not unchanged.
+  // Always true when not using `mmap`.
+  bool isUnchanged() const;
+
+  // True if a read of the mapping faulted because the file had been
+  // truncated, and the missing page was replaced with zeroes.
+  bool isDamaged() const;
+
+  // If `fname` names an existing file, return its size in bytes.
+  // Otherwise return `nullopt`.
+  static std::optional<std::size_t> fileSizeOpt(std::string const &fname);
+};
+
+
+#endif // EDITOR_MAPPED_FILE_H
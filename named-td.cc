@@ -22,6 +22,7 @@
 #include "smbase/sm-macros.h"          // CMEMB
 #include "smbase/sm-trace.h"           // INIT_TRACE, etc.
 #include "smbase/string-util.h"        // replaceAll
+#include "smbase/syserr.h"             // smbase::XSysError
 #include "smbase/xassert.h"            // xassertPrecondition
 
 #include <cstdint>                     // std::int64_t
@@ -50,6 +51,9 @@ NamedTextDocument::NamedTextDocument()
     m_highlightTrailingWhitespace(true),
     m_lastFileTimestamp(0),
     m_modifiedOnDisk(false),
+    m_lastFileDigest(),
+    m_fileIsWatched(false),
+    m_saveInProgress(false),
     m_title(),
     m_lspUpdateContinuously(true)
 {
@@ -114,6 +118,7 @@ NamedTextDocument::operator gdv::GDValue() const
   GDV_WRITE_MEMBER_SYM(m_observationRecorder);
   GDV_WRITE_MEMBER_SYM(m_lastFileTimestamp);
   GDV_WRITE_MEMBER_SYM(m_modifiedOnDisk);
+  GDV_WRITE_MEMBER_SYM(m_fileIsWatched);
   GDV_WRITE_MEMBER_SYM(m_title);
   GDV_WRITE_MEMBER_SYM(m_highlighter);
   GDV_WRITE_MEMBER_SYM(m_highlightTrailingWhitespace);
@@ -135,6 +140,9 @@ void NamedTextDocument::setDocumentType(DocumentType dt)
 
   m_documentType = dt;
   m_highlighter = makeHighlighterForLanguage(dt, getCore());
+
+  // Views need to redraw with the new highlighting.
+  notifyMetadataChange();
 }
 
 
@@ -215,6 +223,9 @@ string NamedTextDocument::fileStatusString() const
   if (m_modifiedOnDisk) {
     sb << " [DISKMOD]";
   }
+  if (lineIndexIsProvisional()) {
+    sb << " [INDEXING]";
+  }
   return sb.str();
 }
 
@@ -233,10 +244,85 @@ void NamedTextDocument::replaceFileAndStats(
   this->replaceWholeFile(contents);
   this->m_lastFileTimestamp = fileModificationTime;
   this->m_modifiedOnDisk = false;
+  this->m_lastFileDigest = getCore().contentDigest();
   this->setReadOnly(readOnly);
 }
 
 
+void NamedTextDocument::updateFileAndStats(
+  std::vector<unsigned char> const &contents,
+  std::int64_t fileModificationTime,
+  bool readOnly)
+{
+  TRACE1(
+    "updateFileAndStats: docName=" << documentName() <<
+    " contents.size()=" << contents.size() <<
+    " modTime=" << fileModificationTime <<
+    " readOnly=" << readOnly);
+
+  this->updateWholeFile(contents);
+  this->m_lastFileTimestamp = fileModificationTime;
+  this->m_modifiedOnDisk = false;
+  this->m_lastFileDigest = getCore().contentDigest();
+  this->setReadOnly(readOnly);
+}
+
+
+void NamedTextDocument::replaceFileAndStatsMapped(
+  string const &fname,
+  std::int64_t fileModificationTime,
+  bool readOnly)
+{
+  TRACE1(
+    "replaceFileAndStatsMapped: docName=" << documentName() <<
+    " fname=" << fname <<
+    " modTime=" << fileModificationTime <<
+    " readOnly=" << readOnly);
+
+  this->replaceWithMappedFile(fname);
+  this->m_lastFileTimestamp = fileModificationTime;
+  this->m_modifiedOnDisk = false;
+
+  // Computing the digest would read the entire mapping, which is what
+  // mapping is meant to avoid.  Without it, saving just cannot tell
+  // that the contents are unchanged.
+  this->m_lastFileDigest.reset();
+
+  this->setReadOnly(readOnly);
+}
+
+
+bool NamedTextDocument::remapChangedFile(std::int64_t fileModificationTime)
+{
+  if (!isMapped()) {
+    return false;
+  }
+
+  TRACE1("remapChangedFile: " << documentName() <<
+         " has changed, mapping it again");
+  try {
+    this->replaceFileAndStatsMapped(harn().resourceName(),
+      fileModificationTime, isReadOnly());
+  }
+  catch (XSysError &x) {
+    // Show nothing rather than keep reading the old mapping, and let
+    // the caller report the change.
+    TRACE1("remapChangedFile: " << x.why());
+    this->replaceWholeFileString("");
+    return false;
+  }
+  return true;
+}
+
+
+bool NamedTextDocument::contentsMatchFile() const
+{
+  return !m_modifiedOnDisk &&
+         m_lastFileDigest.has_value() &&
+         *m_lastFileDigest == getCore().contentDigest();
+}
+
+
 bool NamedTextDocument::isCompatibleWithLSP() const
 {
   return !isIncompatibleWithLSP().has_value();
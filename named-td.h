@@ -18,7 +18,7 @@
 #include "smbase/refct-serf.h"         // RCSerf
 #include "smbase/str.h"                // string
 
-#include <cstdint>                     // std::int64_t
+#include <cstdint>                     // std::{int64_t, uint64_t}
 #include <map>                         // std::map
 #include <memory>                      // std::unique_ptr
 #include <optional>                    // std::optional
@@ -111,6 +111,23 @@ public:      // data
   // saved or loaded the file.
   bool m_modifiedOnDisk;
 
+  // `contentDigest()` of the file contents the last time we saved or
+  // loaded the file, if known.  It is forgotten when the document is
+  // renamed, since it then refers to a different file.
+  std::optional<std::uint64_t> m_lastFileDigest;
+
+  // If true, the VFS server is watching the file and pushes changes to
+  // it, so 'm_modifiedOnDisk' is kept up to date without asking.  This
+  // is maintained by DocumentFileWatcher.
+  bool m_fileIsWatched;
+
+  // True while the document is being written to its file.  The
+  // server can report the change made by the write before it replies
+  // to the write, and at that point 'm_lastFileTimestamp' still has
+  // the old time, so DocumentFileWatcher ignores changes reported
+  // while this is set; the reply supplies the new time.
+  bool m_saveInProgress;
+
   // Title of the document.  Must be unique within the containing
   // NamedTextDocumentList.  This will usually be similar to the name,
   // but perhaps shortened so long as it remains unique.
@@ -135,7 +152,7 @@ public:      // funcs
   DocumentName const &documentName() const
     { return m_documentName; }
   void setDocumentName(DocumentName const &docName)
-    { m_documentName = docName; }
+    { m_documentName = docName; m_lastFileDigest.reset(); }
 
   HostAndResourceName const &harn() const { return m_documentName.harn(); }
 
@@ -191,7 +208,8 @@ public:      // funcs
   string nameWithStatusIndicators() const;
 
   // Empty string, plus " *" if the file has been modified in memory,
-  // plus " [DISKMOD]" if the contents on disk have been modified.
+  // plus " [DISKMOD]" if the contents on disk have been modified, plus
+  // " [INDEXING]" if the lines of a mapped file are still being found.
   string fileStatusString() const;
 
   // ------------------------- file contents ---------------------------
@@ -200,6 +218,39 @@ public:      // funcs
                            std::int64_t fileModificationTime,
                            bool readOnly);
 
+  // Same, but change only the lines that differ from `contents`, using
+  // `updateWholeFile`.  This is meant for reloading a file that was
+  // changed on disk, since it preserves the undo history as well as
+  // the highlighting, diagnostics, and other state attached to the
+  // unchanged lines.
+  void updateFileAndStats(std::vector<unsigned char> const &contents,
+                          std::int64_t fileModificationTime,
+                          bool readOnly);
+
+  // Like `replaceFileAndStats`, but map the local file `fname` into
+  // memory instead of getting its contents from the caller.  The
+  // document can still be edited; the first edit copies the contents
+  // out of the mapping.
+  void replaceFileAndStatsMapped(string const &fname,
+                                 std::int64_t fileModificationTime,
+                                 bool readOnly);
+
+  // Called when the file has been found to have modification time
+  // `fileModificationTime` on disk, different from the one we last
+  // saw.  If the contents are still mapped from it, the mapping no
+  // longer matches the file, and since a mapped document has no
+  // unsaved changes, map the file again to show what it has now, and
+  // return true.  Otherwise return false, leaving the caller to report
+  // the change.
+  bool remapChangedFile(std::int64_t fileModificationTime);
+
+  // True if the file is known to have the same contents as the
+  // document: it has not changed on disk since we last saved or loaded
+  // it, and the document's digest is the same as it was then.  This
+  // can be true even if `unsavedChanges()`, when the edits made since
+  // then cancel out.
+  bool contentsMatchFile() const;
+
   // --------------------------- diagnostics ---------------------------
   // True if we could open this file with the LSP server, just based on
   // where it is stored, not its document type.
@@ -7,10 +7,38 @@
 
 #include "td-editor.h"                 // TextDocumentAndEditor
 
+// libc++
+#include <cstdlib>                     // std::atoi
+#include <cstring>                     // std::strcmp
+
+
+// Time keystrokes in a large Python file.  This is not part of the
+// normal test run; it is invoked as:
+//
+//   ./unit-tests.exe python_hilite keystroke [<file> [<numLines> [<lexLimit>]]]
+//
+static void perfKeystrokes(CmdlineArgsSpan args)
+{
+  char const *fname =
+    args.size() >= 1? args[0] : "test/highlight/python1.py";
+  int numLines = args.size() >= 2? std::atoi(args[1]) : 200000;
+  int lexLimit = args.size() >= 3? std::atoi(args[2]) : 2000;
+
+  TextDocumentAndEditor tde;
+  Python_Highlighter hi(tde.getDocument()->getCore());
+  perfHighlighterKeystrokes(hi, tde, fname, numLines, lexLimit,
+                            "\"\"\"");
+}
+
 
 // Called from unit-tests.cc.
 void test_python_hilite(CmdlineArgsSpan args)
 {
+  if (!args.empty() && 0==std::strcmp(args[0], "keystroke")) {
+    perfKeystrokes(args.subspan(1));
+    return;
+  }
+
   TextDocumentAndEditor tde;
   Python_Highlighter hi(tde.getDocument()->getCore());
   testHighlighter(hi, tde, "test/highlight/python1.py");
@@ -12,5 +12,6 @@ class TDC_DeleteLine;
 class TDC_InsertText;
 class TDC_DeleteText;
 class TDC_TotalChange;
+class TDC_ReplaceRange;
 
 #endif // EDITOR_TD_CHANGE_FWD_H
@@ -115,7 +115,7 @@ TextDocumentChangeSequence makeRandomChange(
 {
   TextDocumentChangeSequence seq;
 
-  RandomChoice c(81);
+  RandomChoice c(101);
 
   if (c.check(1)) {
     std::string newContents = randomStringWithNL(100);
@@ -188,6 +188,20 @@ TextDocumentChangeSequence makeRandomChange(
       ByteCount(endByteIndex - startByteIndex)));
   }
 
+  else if (c.check(20)) {
+    // Replace a range that can span lines.
+    TextMCoord start(randomLine(doc.numLines()), ByteIndex(0));
+    start.m_byteIndex =
+      randomByteIndexUpTo(doc.lineLengthByteIndex(start.m_line));
+    TextMCoord end(randomLine(doc.numLines()), ByteIndex(0));
+    end.m_byteIndex =
+      randomByteIndexUpTo(doc.lineLengthByteIndex(end.m_line));
+    swapIfGreaterThan(start, end);
+
+    seq.append(std::make_unique<TDC_ReplaceRange>(
+      TextMCoordRange(start, end), randomStringWithNL(20)));
+  }
+
   else {
     xfailure("impossible");
   }
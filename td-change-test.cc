@@ -50,6 +50,16 @@ void test_1()
     change.applyToDoc(doc);
     EXPECT_EQ(doc.getWholeFileString(), "zero\noXe\ntwo\n");
   }
+
+  {
+    TDC_ReplaceRange change(
+      TextMCoordRange(TextMCoord(LineIndex(0), ByteIndex(2)),
+                      TextMCoord(LineIndex(2), ByteIndex(1))),
+      "A\nB");
+    EXPECT_EQ(change.newEnd(), TextMCoord(LineIndex(1), ByteIndex(1)));
+    change.applyToDoc(doc);
+    EXPECT_EQ(doc.getWholeFileString(), "zeA\nBwo\n");
+  }
 }
 
 
@@ -3,7 +3,7 @@
 
 #include "td-change.h"                 // this module
 
-#include "byte-count.h"                // ByteCount, stringBC
+#include "byte-count.h"                // ByteCount, sizeBC, stringBC
 #include "td-core.h"                   // TextDocumentCore
 #include "textmcoord.h"                // TextMCoord, TextMCoordRange
 #include "range-text-repl.h"           // RangeTextReplacement
@@ -42,6 +42,7 @@ DEFN_AST_DOWNCASTS(TextDocumentChange, TDC_DeleteLine, K_DELETE_LINE)
 DEFN_AST_DOWNCASTS(TextDocumentChange, TDC_InsertText, K_INSERT_TEXT)
 DEFN_AST_DOWNCASTS(TextDocumentChange, TDC_DeleteText, K_DELETE_TEXT)
 DEFN_AST_DOWNCASTS(TextDocumentChange, TDC_TotalChange, K_TOTAL_CHANGE)
+DEFN_AST_DOWNCASTS(TextDocumentChange, TDC_ReplaceRange, K_REPLACE_RANGE)
 
 
 // -------------------------- TDC_InsertLine ---------------------------
@@ -246,4 +247,50 @@ TDC_TotalChange::operator gdv::GDValue() const
 }
 
 
+// ------------------------- TDC_ReplaceRange --------------------------
+TDC_ReplaceRange::~TDC_ReplaceRange()
+{}
+
+
+TDC_ReplaceRange::TDC_ReplaceRange(
+  TextMCoordRange const &range, char const *text, ByteCount lengthBytes)
+  : IMEMBFP(range),
+    m_text(stringBC(text, lengthBytes))
+{}
+
+
+TDC_ReplaceRange::TDC_ReplaceRange(
+  TextMCoordRange const &range, std::string &&text)
+  : IMEMBFP(range),
+    IMEMBMFP(text)
+{}
+
+
+TextMCoord TDC_ReplaceRange::newEnd() const
+{
+  return m_range.m_start.plusText(m_text.data(), sizeBC(m_text));
+}
+
+
+void TDC_ReplaceRange::applyToDoc(TextDocumentCore &doc) const
+{
+  doc.replaceMultilineRange(m_range, m_text);
+}
+
+
+RangeTextReplacement TDC_ReplaceRange::getRangeTextReplacement() const
+{
+  return RangeTextReplacement(m_range, m_text);
+}
+
+
+TDC_ReplaceRange::operator gdv::GDValue() const
+{
+  GDValue m(GDVK_TAGGED_ORDERED_MAP, "ReplaceRange"_sym);
+  GDV_WRITE_MEMBER_SYM(m_range);
+  GDV_WRITE_MEMBER_SYM(m_text);
+  return m;
+}
+
+
 // EOF
@@ -14,7 +14,7 @@
 #include "positive-line-count.h"       // PositiveLineCount
 #include "range-text-repl-fwd.h"       // RangeTextReplacement [n]
 #include "td-core-fwd.h"               // TextDocumentCore [n]
-#include "textmcoord.h"                // TextMCoord
+#include "textmcoord.h"                // TextMCoord, TextMCoordRange
 
 #include "smbase/ast-switch.h"         // DECL_AST_DOWNCASTS
 #include "smbase/gdvalue-fwd.h"        // gdv::GDValue
@@ -34,7 +34,8 @@ public:      // types
     K_DELETE_LINE,
     K_INSERT_TEXT,
     K_DELETE_TEXT,
-    K_TOTAL_CHANGE
+    K_TOTAL_CHANGE,
+    K_REPLACE_RANGE
   };
 
 public:      // methods
@@ -50,6 +51,7 @@ public:      // methods
   DECL_AST_DOWNCASTS(TDC_InsertText, K_INSERT_TEXT)
   DECL_AST_DOWNCASTS(TDC_DeleteText, K_DELETE_TEXT)
   DECL_AST_DOWNCASTS(TDC_TotalChange, K_TOTAL_CHANGE)
+  DECL_AST_DOWNCASTS(TDC_ReplaceRange, K_REPLACE_RANGE)
 
   // Apply this change to `doc`.
   virtual void applyToDoc(TextDocumentCore &doc) const = 0;
@@ -187,4 +189,34 @@ public:      // methods
 };
 
 
+// Records `observeReplaceRange`.
+class TDC_ReplaceRange : public TextDocumentChange {
+public:      // data
+  // The range that was replaced, in the coordinates of the document
+  // before the change.
+  TextMCoordRange m_range;
+
+  // The replacement text, which can contain newlines.
+  std::string m_text;
+
+public:      // methods
+  virtual ~TDC_ReplaceRange() override;
+
+  explicit TDC_ReplaceRange(
+    TextMCoordRange const &range, char const *text, ByteCount lengthBytes);
+  explicit TDC_ReplaceRange(
+    TextMCoordRange const &range, std::string &&text);
+
+  // The end of `m_text` after the change.
+  TextMCoord newEnd() const;
+
+  static Kind constexpr TYPE_TAG = K_REPLACE_RANGE;
+  virtual Kind kind() const override { return TYPE_TAG; }
+
+  virtual void applyToDoc(TextDocumentCore &doc) const override;
+  virtual RangeTextReplacement getRangeTextReplacement() const override;
+  virtual operator gdv::GDValue() const override;
+};
+
+
 #endif // EDITOR_TD_CHANGE_H
@@ -5,21 +5,40 @@
 
 #include "td-core.h"                   // module to test
 
+#include "content-digest.h"            // textContentDigest
+
 // smbase
 #include "smbase/autofile.h"           // AutoFILE
 #include "smbase/exc.h"                // smbase::xmessage
 #include "smbase/gdvalue.h"            // gdv::GDValue
+#include "smbase/nonport.h"            // getMilliseconds
+#include "smbase/save-restore.h"       // SetRestore
 #include "smbase/sm-file-util.h"       // SMFileUtil
 #include "smbase/sm-macros.h"          // IGNORE_RESULT, OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-noexcept.h"        // NOEXCEPT
+#include "smbase/sm-override.h"        // OVERRIDE
 #include "smbase/sm-test.h"            // DIAG, EXPECT_EQ[_GDV], op_eq
 #include "smbase/string-util.h"        // vectorOfUCharToString
+#include "smbase/syserr.h"             // smbase::XSysError
+#include "smbase/xassert.h"            // xfailure
 
 // libc++
-#include <algorithm>                   // std::max
+#include <algorithm>                   // std::{max, min, replace}
+#include <cstdint>                     // std::uint64_t
+#include <cstdlib>                     // std::atoi
+#include <cstring>                     // std::strcmp
+#include <iostream>                    // std::cout
+#include <memory>                      // std::shared_ptr
+#include <string>                      // std::string
+#include <utility>                     // std::swap
+#include <vector>                      // std::vector
 
 // libc
 #include <assert.h>                    // assert
-#include <stdlib.h>                    // system
+#include <stdlib.h>                    // rand, srand, system
+#ifndef __WIN32__
+#  include <utime.h>                   // utime
+#endif
 
 using namespace gdv;
 using namespace smbase;
@@ -281,7 +300,7 @@ void testVarious()
         "     "
         ""]
       recentIndex: 5
-      longestLengthSoFar: 13
+      lineLengthCounts: {3:1 5:2 6:1 8:1 12:1}
       recentLine: "      "
       versionNumber: 28
       numObservers: 0
@@ -617,6 +636,600 @@ void test_wholeFileString()
 }
 
 
+// Observer that counts the notifications it receives.
+class CountingObserver : public TextDocumentObserver {
+public:      // data
+  // Number of calls to each kind of notification.
+  int m_incrementalChanges;
+  int m_totalChanges;
+  int m_rangeReplacements;
+
+  // The `newEnd` of the most recent `observeReplaceRange`.
+  TextMCoord m_lastNewEnd;
+
+public:      // methods
+  CountingObserver()
+    : TextDocumentObserver(),
+      m_incrementalChanges(0),
+      m_totalChanges(0),
+      m_rangeReplacements(0),
+      m_lastNewEnd()
+  {}
+
+  virtual void observeInsertLine(TextDocumentCore const &, LineIndex) NOEXCEPT OVERRIDE
+    { m_incrementalChanges++; }
+  virtual void observeDeleteLine(TextDocumentCore const &, LineIndex) NOEXCEPT OVERRIDE
+    { m_incrementalChanges++; }
+  virtual void observeInsertText(TextDocumentCore const &, TextMCoord, char const *, ByteCount) NOEXCEPT OVERRIDE
+    { m_incrementalChanges++; }
+  virtual void observeDeleteText(TextDocumentCore const &, TextMCoord, ByteCount) NOEXCEPT OVERRIDE
+    { m_incrementalChanges++; }
+  virtual void observeTotalChange(TextDocumentCore const &) NOEXCEPT OVERRIDE
+    { m_totalChanges++; }
+  virtual void observeReplaceRange(TextDocumentCore const &, TextMCoordRange const &, TextMCoord newEnd, char const *, ByteCount) NOEXCEPT OVERRIDE
+    { m_rangeReplacements++; m_lastNewEnd = newEnd; }
+};
+
+
+// Check that `replaceWholeFile` builds the document in one step.
+void test_replaceWholeFile()
+{
+  TextDocumentCore doc;
+  doc.replaceWholeFileString("a long first line\nb\n");
+
+  // Make a line recent so we check that it gets discarded properly.
+  insText(doc, 1,1, "bb");
+  EXPECT_EQ(doc.maxLineLengthBytes(), 17);
+
+  CountingObserver obs;
+  doc.addObserver(&obs);
+
+  TD_VersionNumber vnum = doc.getVersionNumber();
+  doc.replaceWholeFileString("zero\n\ntwo22\nthree");
+  EXPECT_EQ(doc.getVersionNumber(), vnum.succ());
+
+  EXPECT_EQ(obs.m_incrementalChanges, 0);
+  EXPECT_EQ(obs.m_totalChanges, 1);
+
+  doc.removeObserver(&obs);
+
+  EXPECT_EQ(doc.numLines(), 4);
+  EXPECT_EQ(doc.getWholeFileString(), "zero\n\ntwo22\nthree");
+  EXPECT_EQ(doc.maxLineLengthBytes(), 5);
+  fullSelfCheck(doc);
+
+  // Edits after the bulk load work normally.
+  insLine(doc, 1,0, "one");
+  EXPECT_EQ(doc.getWholeFileString(), "zero\none\n\ntwo22\nthree");
+  fullSelfCheck(doc);
+
+  // Loading nothing yields one empty line.
+  doc.replaceWholeFileString("");
+  xassert(doc.numLines() == 1);
+  EXPECT_EQ(doc.maxLineLengthBytes(), 0);
+  fullSelfCheck(doc);
+}
+
+
+// Check `byteOffsetOf`, `coordAtByteOffset`, `countBytesInRange`, and
+// long walks against the whole-file string.
+void checkByteOffsets(TextDocumentCore const &doc)
+{
+  std::string contents = doc.getWholeFileString();
+  EXPECT_EQ(doc.totalBytes(), ByteCount(contents.size()));
+
+  // Map from offset to coordinate, computed naively.
+  std::vector<TextMCoord> coords;
+  FOR_EACH_LINE_INDEX_IN(i, doc) {
+    for (int b=0; b <= doc.lineLengthBytes(i).get(); b++) {
+      coords.push_back(TextMCoord(i, ByteIndex(b)));
+    }
+  }
+  EXPECT_EQ(coords.size(), contents.size() + 1);
+
+  for (std::size_t offset=0; offset < coords.size(); offset++) {
+    TextMCoord tc = coords[offset];
+    EXPECT_EQ(doc.byteOffsetOf(tc), ByteCount(offset));
+    EXPECT_EQ(doc.coordAtByteOffset(ByteCount(offset)), tc);
+  }
+
+  // Ranges and walks, including ones long enough to use the index.
+  for (std::size_t start=0; start < coords.size(); start += 7) {
+    for (std::size_t end=start; end < coords.size(); end += 13) {
+      TextMCoordRange range(coords[start], coords[end]);
+      EXPECT_EQ(doc.countBytesInRange(range), ByteCount(end - start));
+
+      TextMCoord tc = coords[start];
+      xassert(doc.walkCoordBytes(tc, ByteDifference((int)(end - start))));
+      EXPECT_EQ(tc, coords[end]);
+
+      tc = coords[end];
+      xassert(doc.walkCoordBytes(tc, ByteDifference(-(int)(end - start))));
+      EXPECT_EQ(tc, coords[start]);
+    }
+
+    TextMCoord tc = coords[start];
+    xassert(!doc.walkCoordBytes(tc, ByteDifference((int)coords.size())));
+    EXPECT_EQ(tc.m_line, LineIndex(doc.numLines()));
+
+    tc = coords[start];
+    xassert(!doc.walkCoordBytes(tc, ByteDifference(-(int)start - 1)));
+    EXPECT_EQ(tc, doc.beginCoord());
+  }
+}
+
+
+void test_byteOffsets()
+{
+  TextDocumentCore doc;
+  checkByteOffsets(doc);
+
+  std::string contents;
+  for (int i=0; i < 60; i++) {
+    contents += std::string(i % 7, 'a' + (i%26)) + "\n";
+  }
+  doc.replaceWholeFileString(contents);
+  checkByteOffsets(doc);
+
+  // Mix of edits that change line lengths and line counts, at various
+  // positions relative to the last query.
+  insText(doc, 50, 0, "hello");
+  checkByteOffsets(doc);
+  insLine(doc, 5, 0, "new line");
+  insText(doc, 40, 0, "xyz");
+  checkByteOffsets(doc);
+  doc.deleteTextBytes(TextMCoord(LineIndex(5), ByteIndex(0)),
+                      doc.lineLengthBytes(LineIndex(5)));
+  doc.deleteLine(LineIndex(5));
+  doc.deleteTextBytes(TextMCoord(LineIndex(50), ByteIndex(1)),
+                      ByteCount(3));
+  checkByteOffsets(doc);
+
+  doc.clear();
+  checkByteOffsets(doc);
+  fullSelfCheck(doc);
+}
+
+
+// Check that `maxLineLengthBytes` goes down when long lines are
+// shortened or removed.
+void test_maxLineLengthBytes()
+{
+  TextDocumentCore doc;
+  doc.replaceWholeFileString("a\nbbbbbb\ncc\nbbbbbb\n");
+  EXPECT_EQ(doc.maxLineLengthBytes(), 6);
+
+  // One of two longest lines shrinks; the other remains.
+  doc.deleteTextBytes(tmc(1,0), ByteCount(3));
+  EXPECT_EQ(doc.maxLineLengthBytes(), 6);
+
+  // Now neither is the longest.
+  doc.deleteTextBytes(tmc(3,2), ByteCount(4));
+  EXPECT_EQ(doc.maxLineLengthBytes(), 3);
+
+  // Grow a line, then shrink it back through the recent line.
+  insText(doc, 0, 1, "0123456789");
+  EXPECT_EQ(doc.maxLineLengthBytes(), 11);
+  doc.deleteTextBytes(tmc(0,1), ByteCount(10));
+  EXPECT_EQ(doc.maxLineLengthBytes(), 3);
+
+  // Remove lines entirely.
+  doc.deleteTextBytes(tmc(1,0), ByteCount(3));
+  doc.deleteLine(LineIndex(1));
+  EXPECT_EQ(doc.maxLineLengthBytes(), 2);
+  fullSelfCheck(doc);
+
+  doc.clear();
+  EXPECT_EQ(doc.maxLineLengthBytes(), 0);
+  fullSelfCheck(doc);
+}
+
+
+// Fragment the line storage, then compact it.
+void test_compactLineStorage()
+{
+  TextDocumentCore doc;
+
+  std::string contents;
+  for (int i=0; i < 5000; i++) {
+    contents += std::string(99, 'a' + (i%26)) + "\n";
+  }
+  doc.replaceWholeFileString(contents);
+  xassert(!doc.lineStorageNeedsCompaction());
+
+  // Editing a line moves its bytes, leaving behind a hole.  Edit three
+  // out of every four so the original chunks are sparse but not empty
+  // (an empty chunk is released immediately).
+  FOR_EACH_LINE_INDEX_IN(i, doc) {
+    if (i.get() % 4 != 0) {
+      insText(doc, i.get(), 0, "x");
+    }
+  }
+  xassert(doc.lineStorageNeedsCompaction());
+  if (verbose) {
+    doc.printMemStats();
+  }
+
+  std::string before = doc.getWholeFileString();
+  TD_VersionNumber vnum = doc.getVersionNumber();
+
+  doc.compactLineStorage();
+  xassert(!doc.lineStorageNeedsCompaction());
+  if (verbose) {
+    doc.printMemStats();
+  }
+
+  EXPECT_EQ(doc.getWholeFileString(), before);
+  EXPECT_EQ(doc.getVersionNumber(), vnum);
+  fullSelfCheck(doc);
+}
+
+
+// Compact in slices, editing the document in between.
+void test_compactLineStorageSlice()
+{
+  TextDocumentCore doc;
+
+  std::string contents;
+  for (int i=0; i < 5000; i++) {
+    contents += std::string(99, 'a' + (i%26)) + "\n";
+  }
+  doc.replaceWholeFileString(contents);
+  FOR_EACH_LINE_INDEX_IN(i, doc) {
+    if (i.get() % 4 != 0) {
+      insText(doc, i.get(), 0, "x");
+    }
+  }
+  xassert(doc.lineStorageNeedsCompaction());
+
+  TD_VersionNumber vnum = doc.getVersionNumber();
+  std::string before = doc.getWholeFileString();
+
+  int numSlices = 0;
+  while (!doc.compactLineStorageSlice(LineCount(700))) {
+    numSlices++;
+
+    // A pass in progress still needs to be finished.
+    xassert(doc.lineStorageNeedsCompaction());
+    EXPECT_EQ(doc.getWholeFileString(), before);
+    EXPECT_EQ(doc.getVersionNumber(), vnum);
+  }
+  EXPECT_EQ(numSlices, 7);
+  xassert(!doc.lineStorageNeedsCompaction());
+  EXPECT_EQ(doc.getWholeFileString(), before);
+  fullSelfCheck(doc);
+
+  // Fragment it again, then edit between slices, including inserting
+  // and deleting lines ahead of where the pass is.
+  FOR_EACH_LINE_INDEX_IN(i, doc) {
+    if (i.get() % 4 != 0) {
+      insText(doc, i.get(), 0, "y");
+    }
+  }
+  xassert(doc.lineStorageNeedsCompaction());
+  while (!doc.compactLineStorageSlice(LineCount(1000))) {
+    doc.insertLine(LineIndex(0));
+    insText(doc, 0, 0, "new");
+    insText(doc, 3000, 5, "mid");
+    fullSelfCheck(doc);
+  }
+  fullSelfCheck(doc);
+  EXPECT_EQ(doc.getWholeLineString(LineIndex(0)), "new");
+
+  // Replacing the contents abandons a pass in progress.
+  FOR_EACH_LINE_INDEX_IN(i, doc) {
+    if (i.get() % 4 != 0) {
+      insText(doc, i.get(), 0, "z");
+    }
+  }
+  xassert(!doc.compactLineStorageSlice(LineCount(10)));
+  doc.replaceWholeFileString("short");
+  xassert(!doc.lineStorageNeedsCompaction());
+  xassert(doc.compactLineStorageSlice(LineCount(10)));
+  EXPECT_EQ(doc.getWholeFileString(), "short");
+  fullSelfCheck(doc);
+}
+
+
+// Map a file, check it matches reading it, then edit to promote it.
+void test_replaceWithMappedFile()
+{
+  std::string contents;
+  for (int i=0; i < 1000; i++) {
+    contents += std::string(i % 300, 'a' + (i%26)) + "\n";
+  }
+  contents += "last";
+  {
+    AutoFILE fp("td-core.tmp", "wb");
+    fputs(contents.c_str(), fp);
+  }
+
+  TextDocumentCore expect;
+  expect.replaceWholeFileString(contents);
+
+  TextDocumentCore doc;
+  TD_VersionNumber vnum = doc.getVersionNumber();
+  doc.replaceWithMappedFile("td-core.tmp");
+  xassert(doc.isMapped());
+  xassert(doc.getVersionNumber() > vnum);
+  fullSelfCheck(doc);
+  xassert(doc == expect);
+  EXPECT_EQ(doc.maxLineLengthBytes(), expect.maxLineLengthBytes());
+  EXPECT_EQ(doc.totalBytes(), sizeBC(contents));
+
+  // Compaction leaves the mapped lines alone.
+  doc.compactLineStorage();
+  xassert(doc.isMapped());
+
+  // The first edit copies the lines out of the mapping, which is no
+  // longer needed, so the file can be removed.
+  insText(doc, 3, 0, "x");
+  xassert(!doc.isMapped());
+  remove("td-core.tmp");
+  fullSelfCheck(doc);
+  insText(expect, 3, 0, "x");
+  xassert(doc == expect);
+
+  // Detaching copies the lines out of a file that is intact.
+  {
+    AutoFILE fp("td-core.tmp", "wb");
+    fputs(contents.c_str(), fp);
+  }
+  doc.replaceWithMappedFile("td-core.tmp");
+  xassert(doc.detachMappedFile());
+  xassert(!doc.isMapped());
+  fullSelfCheck(doc);
+  EXPECT_EQ(doc.getWholeFileString(), contents);
+
+#ifndef __WIN32__
+  // But not out of one that has been rewritten in place, even at the
+  // same size, since the line boundaries no longer match the bytes.
+  doc.replaceWithMappedFile("td-core.tmp");
+  {
+    std::string rewritten(contents);
+    std::replace(rewritten.begin(), rewritten.end(), '\n', ' ');
+    AutoFILE fp("td-core.tmp", "wb");
+    fputs(rewritten.c_str(), fp);
+  }
+  {
+    // The rewrite may be too quick for the clock to advance.
+    struct utimbuf times;
+    times.actime = times.modtime = 1;
+    xassert(utime("td-core.tmp", &times) == 0);
+  }
+  xassert(!doc.detachMappedFile());
+  xassert(doc.isMapped());
+
+  // Nor out of one that has been truncated.
+  doc.replaceWithMappedFile("td-core.tmp");
+  {
+    AutoFILE fp("td-core.tmp", "wb");
+  }
+  xassert(!doc.detachMappedFile());
+  xassert(doc.isMapped());
+#endif
+
+  // Mapping an empty file yields one empty line.
+  {
+    AutoFILE fp("td-core.tmp", "wb");
+  }
+  doc.replaceWithMappedFile("td-core.tmp");
+  xassert(doc.isMapped());
+  xassert(doc.numLines() == 1);
+  fullSelfCheck(doc);
+
+  // Replacing the contents normally drops the mapping.
+  doc.replaceWholeFileString("a\nb\n");
+  xassert(!doc.isMapped());
+  remove("td-core.tmp");
+
+  // Failure leaves the document unchanged.
+  try {
+    doc.replaceWithMappedFile("td-core.nonexistent.tmp");
+    xfailure("should have failed");
+  }
+  catch (XSysError &x) {
+    DIAG("as expected: " << x.why());
+  }
+  EXPECT_EQ(doc.getWholeFileString(), "a\nb\n");
+  fullSelfCheck(doc);
+}
+
+
+// Map a file in slices, checking that the document always has the
+// lines found so far.
+void test_provisionalLineIndex()
+{
+  std::string contents;
+  for (int i=0; i < 1000; i++) {
+    contents += std::string(i % 300, 'a' + (i%26)) + "\n";
+  }
+  contents += std::string(5000, 'z') + "\nlast";
+  {
+    AutoFILE fp("td-core.tmp", "wb");
+    fputs(contents.c_str(), fp);
+  }
+
+  TextDocumentCore expect;
+  expect.replaceWholeFileString(contents);
+
+  SetRestore<std::size_t> restorer(
+    TextDocumentCore::s_mappedIndexInitialBytes, 1000);
+
+  // Check that `doc` has a prefix of `contents` ending with a newline,
+  // followed by the empty placeholder line.
+  auto checkProvisional = [&](TextDocumentCore const &doc) -> void {
+    fullSelfCheck(doc);
+    xassert(doc.lineIndexIsProvisional());
+    std::string text = doc.getWholeFileString();
+    xassert(!text.empty());
+    xassert(text.back() == '\n');
+    EXPECT_EQ(contents.substr(0, text.size()), text);
+  };
+
+  TextDocumentCore doc;
+  doc.replaceWithMappedFile("td-core.tmp");
+  checkProvisional(doc);
+  xassert(doc.numLines() < expect.numLines());
+
+  CountingObserver obs;
+  doc.addObserver(&obs);
+
+  // Each slice appends at least one line, even if asked for nothing.
+  {
+    std::shared_ptr<TextDocumentSnapshot const> snap = doc.snapshot();
+    LineCount const before = doc.numLines();
+    TD_VersionNumber vnum = doc.getVersionNumber();
+    xassert(!doc.extendLineIndex(0));
+    checkProvisional(doc);
+    xassert(doc.numLines() > before);
+    xassert(doc.getVersionNumber() > vnum);
+    EXPECT_EQ(obs.m_rangeReplacements, 1);
+    EXPECT_EQ(obs.m_lastNewEnd, doc.endCoord());
+  }
+
+  // A one-byte slice finds one line.
+  while (doc.numLines() < 1001) {
+    int const before = doc.numLines().get();
+    xassert(!doc.extendLineIndex(1));
+    xassert(doc.numLines() == before + 1);
+  }
+  checkProvisional(doc);
+
+  // A slice that ends inside a long line runs to its end.
+  xassert(!doc.extendLineIndex(10));
+  checkProvisional(doc);
+  xassert(doc.numLines() == 1002);
+  xassert(doc.extendLineIndex(10));
+  xassert(!doc.lineIndexIsProvisional());
+  xassert(doc.isMapped());
+  fullSelfCheck(doc);
+  xassert(doc == expect);
+  EXPECT_EQ(obs.m_lastNewEnd, expect.endCoord());
+  EXPECT_EQ(obs.m_totalChanges, 0);
+  EXPECT_EQ(obs.m_incrementalChanges, 0);
+
+  // Once complete, extending does nothing.
+  {
+    TD_VersionNumber vnum = doc.getVersionNumber();
+    xassert(doc.extendLineIndex(10));
+    xassert(doc.getVersionNumber() == vnum);
+  }
+  doc.removeObserver(&obs);
+
+  // Editing completes the index before copying the lines out.
+  doc.replaceWithMappedFile("td-core.tmp");
+  checkProvisional(doc);
+  insText(doc, 3, 0, "x");
+  xassert(!doc.isMapped());
+  fullSelfCheck(doc);
+  insText(expect, 3, 0, "x");
+  xassert(doc == expect);
+
+  // So does `completeLineIndex`, without copying them.
+  doc.replaceWithMappedFile("td-core.tmp");
+  checkProvisional(doc);
+  doc.completeLineIndex();
+  xassert(!doc.lineIndexIsProvisional());
+  xassert(doc.isMapped());
+  fullSelfCheck(doc);
+  EXPECT_EQ(doc.getWholeFileString(), contents);
+
+  doc.replaceWholeFileString("");
+  remove("td-core.tmp");
+}
+
+
+// Load each file named in `args` and report the rate.  This is not
+// part of the normal test run; it is invoked as:
+//
+//   ./unit-tests.exe td_core load <file>...
+//
+void perfLoadFiles(CmdlineArgsSpan args)
+{
+  for (char const *fname : args) {
+    long start = getMilliseconds();
+    std::vector<unsigned char> bytes(SMFileUtil().readFile(fname));
+    long readMS = getMilliseconds() - start;
+
+    TextDocumentCore doc;
+    start = getMilliseconds();
+    doc.replaceWholeFile(bytes);
+    long loadMS = getMilliseconds() - start;
+
+    int lines = doc.numLines().get();
+    double seconds = (loadMS > 0? loadMS : 1) / 1000.0;
+
+    std::cout << fname << ": bytes=" << bytes.size()
+              << " lines=" << lines
+              << " readMS=" << readMS
+              << " loadMS=" << loadMS
+              << " linesPerSec=" << (long)(lines / seconds)
+              << " MBPerSec=" << (bytes.size() / seconds / 1.0e6)
+              << std::endl;
+  }
+}
+
+// Compare the line spine kinds on random-position and sequential
+// edits.  This is not part of the normal test run; it is invoked as:
+//
+//   ./unit-tests.exe td_core spine [<numLines> [<numEdits>]]
+//
+void perfSpineKinds(CmdlineArgsSpan args)
+{
+  int numLines = args.size() >= 1? std::atoi(args[0]) : 100000;
+  int numEdits = args.size() >= 2? std::atoi(args[1]) : 100000;
+
+  std::string contents;
+  for (int i=0; i < numLines; i++) {
+    contents += "line of moderate length for the benchmark\n";
+  }
+
+  FOR_EACH_LINE_SPINE_KIND(kind) {
+    TextDocumentCore doc(kind);
+    doc.replaceWholeFileString(contents);
+
+    // Edits at random places, such as a replace-all would do.  Each
+    // splits a line, then joins it back.
+    srand(1);
+    long start = getMilliseconds();
+    for (int i=0; i < numEdits; i++) {
+      int line = rand() % (doc.numLines().get() - 1);
+      doc.insertLine(LineIndex(line));
+      insText(doc, line, 0, "x");
+      doc.deleteTextBytes(tmc(line, 0), ByteCount(1));
+      doc.deleteLine(LineIndex(line));
+    }
+    long randomMS = getMilliseconds() - start;
+
+    // Sequential typing in the middle of the document, with a new
+    // line every 40 characters.
+    int line = doc.numLines().get() / 2;
+    int col = 0;
+    start = getMilliseconds();
+    for (int i=0; i < numEdits; i++) {
+      if (col == 40) {
+        ++line;
+        doc.insertLine(LineIndex(line));
+        col = 0;
+      }
+      insText(doc, line, col, "y");
+      ++col;
+    }
+    long typingMS = getMilliseconds() - start;
+
+    std::cout << toString(kind) << ": lines=" << numLines
+              << " edits=" << numEdits
+              << " randomMS=" << randomMS
+              << " typingMS=" << typingMS
+              << std::endl;
+    if (verbose) {
+      doc.printMemStats();
+    }
+  }
+}
+
+
 void replaceRange(
   TextDocumentCore &doc,
   int startLine,
@@ -695,6 +1308,85 @@ void test_replaceMultilineRange()
 }
 
 
+// Return a random coordinate in `doc`.
+TextMCoord randomCoord(TextDocumentCore const &doc)
+{
+  LineIndex line(rand() % doc.numLines().get());
+  return TextMCoord(line,
+    ByteIndex(rand() % (doc.lineLengthBytes(line).get() + 1)));
+}
+
+
+// Check that `replaceRange` makes multi-line changes in one step, and
+// that the result agrees with splicing a string.
+void test_replaceRange()
+{
+  TextDocumentCore doc;
+  doc.replaceWholeFileString("zero\none\ntwo\nthree\nfour");
+  std::string model = doc.getWholeFileString();
+
+  CountingObserver obs;
+  doc.addObserver(&obs);
+
+  srand(2);
+  for (int iter=0; iter < 300; iter++) {
+    TextMCoord start = randomCoord(doc);
+    TextMCoord end = randomCoord(doc);
+    if (end < start) {
+      std::swap(start, end);
+    }
+
+    std::string text;
+    for (int n = rand() % 12; n > 0; n--) {
+      text += "ab\nc"[rand() % 4];
+    }
+
+    if (iter % 3 == 0) {
+      // Make the first line the recent one, without changing it.
+      doc.insertText(start, "x", ByteCount(1));
+      doc.deleteTextBytes(start, ByteCount(1));
+    }
+
+    std::size_t startOffset = doc.byteOffsetOf(start).get();
+    std::size_t endOffset = doc.byteOffsetOf(end).get();
+    model.replace(startOffset, endOffset - startOffset, text);
+
+    TD_VersionNumber vnum = doc.getVersionNumber();
+    int incrementalChanges = obs.m_incrementalChanges;
+    int rangeReplacements = obs.m_rangeReplacements;
+
+    doc.replaceRange(TextMCoordRange(start, end),
+                     text.data(), sizeBC(text));
+    EXPECT_EQ(doc.getWholeFileString(), model);
+    fullSelfCheck(doc);
+
+    if (start.m_line == end.m_line &&
+        text.find('\n') == std::string::npos) {
+      // Single-line edits use the ordinary notifications.
+      EXPECT_EQ(obs.m_rangeReplacements, rangeReplacements);
+    }
+    else {
+      EXPECT_EQ(doc.getVersionNumber(), vnum.succ());
+      EXPECT_EQ(obs.m_incrementalChanges, incrementalChanges);
+      EXPECT_EQ(obs.m_rangeReplacements, rangeReplacements+1);
+      EXPECT_EQ(obs.m_lastNewEnd,
+                start.plusText(text.data(), sizeBC(text)));
+    }
+  }
+
+  doc.removeObserver(&obs);
+  EXPECT_EQ(obs.m_totalChanges, 0);
+
+  // The line length histogram and offset index were kept up to date.
+  int maxLength = 0;
+  FOR_EACH_LINE_INDEX_IN(i, doc) {
+    maxLength = std::max(maxLength, doc.lineLengthBytes(i).get());
+  }
+  EXPECT_EQ(doc.maxLineLengthBytes(), maxLength);
+  checkByteOffsets(doc);
+}
+
+
 void test_equals()
 {
   TextDocumentCore doc1, doc2;
@@ -755,6 +1447,90 @@ void test_equals()
 }
 
 
+// Digest of the contents of `doc`, computed from scratch.
+std::uint64_t wholeFileDigest(TextDocumentCore const &doc)
+{
+  std::vector<unsigned char> bytes = doc.getWholeFile();
+  return textContentDigest((char const *)bytes.data(), bytes.size());
+}
+
+
+// Check that `contentDigest` tracks the contents through every kind of
+// edit, and that documents with the same contents reached by different
+// edits have the same digest.
+void test_contentDigest()
+{
+  TextDocumentCore doc;
+  EXPECT_EQ(doc.contentDigest(), wholeFileDigest(doc));
+
+  doc.replaceWholeFileString("zero\none\ntwo\nthree\nfour");
+  EXPECT_EQ(doc.contentDigest(), wholeFileDigest(doc));
+
+  srand(3);
+  for (int iter=0; iter < 300; iter++) {
+    TextMCoord start = randomCoord(doc);
+    switch (rand() % 4) {
+      case 0:
+        doc.insertText(start, "ab", ByteCount(1 + rand() % 2));
+        break;
+
+      case 1:
+        doc.deleteTextBytes(start, ByteCount(
+          std::min(1, doc.lineLengthBytes(start.m_line).get() -
+                      start.m_byteIndex.get())));
+        break;
+
+      case 2: {
+        TextMCoord end = randomCoord(doc);
+        if (end < start) {
+          std::swap(start, end);
+        }
+        doc.replaceRange(TextMCoordRange(start, end),
+                         "c\nd", ByteCount(rand() % 4));
+        break;
+      }
+
+      case 3:
+        if (doc.isEmptyLine(start.m_line) && doc.numLines() > 1) {
+          doc.deleteLine(start.m_line);
+        }
+        else {
+          doc.insertLine(start.m_line);
+        }
+        break;
+    }
+
+    // Not checking every time lets changes accumulate.
+    if (iter % 3 == 0) {
+      EXPECT_EQ(doc.contentDigest(), wholeFileDigest(doc));
+      fullSelfCheck(doc);
+    }
+  }
+  EXPECT_EQ(doc.contentDigest(), wholeFileDigest(doc));
+
+  // A copy made by reading the contents has the same digest, and
+  // diverges and converges with the original.
+  TextDocumentCore copy;
+  copy.replaceWholeFileString(doc.getWholeFileString());
+  EXPECT_EQ(copy.contentDigest(), doc.contentDigest());
+  xassert(op_eq(copy, doc));
+
+  copy.insertText(TextMCoord(LineIndex(0), ByteIndex(0)), "x", ByteCount(1));
+  xassert(copy.contentDigest() != doc.contentDigest());
+  xassert(!op_eq(copy, doc));
+
+  copy.deleteTextBytes(TextMCoord(LineIndex(0), ByteIndex(0)), ByteCount(1));
+  EXPECT_EQ(copy.contentDigest(), doc.contentDigest());
+  xassert(op_eq(copy, doc));
+
+  // Repeated queries do not change the answer.
+  EXPECT_EQ(copy.contentDigest(), doc.contentDigest());
+
+  doc.clear();
+  EXPECT_EQ(doc.contentDigest(), TextDocumentCore().contentDigest());
+}
+
+
 void test_getWholeLineStringOrRangeErrorMessage()
 {
   TextDocumentCore doc;
@@ -773,22 +1549,77 @@ void test_getWholeLineStringOrRangeErrorMessage()
 }
 
 
+void test_getLineBytes()
+{
+  TextDocumentCore doc;
+  doc.replaceWholeFileString("zero\none\n\nthree\n");
+
+  ArrayStack<char> scratch;
+  auto lineBytes = [&](int i) -> std::string {
+    LineIndex line(i);
+    char const *p = doc.getLineBytes(line, scratch);
+    return std::string(p, doc.lineLengthBytes(line).get());
+  };
+
+  EXPECT_EQ(lineBytes(0), "zero");
+  EXPECT_EQ(lineBytes(1), "one");
+  EXPECT_EQ(lineBytes(2), "");
+  EXPECT_EQ(lineBytes(3), "three");
+
+  // Not copied for an ordinary line.
+  EXPECT_EQ(scratch.length(), 0);
+
+  // Make line 1 the recent line, which must be copied.
+  doc.insertText(TextMCoord(LineIndex(1), ByteIndex(3)), "!!", ByteCount(2));
+  EXPECT_EQ(lineBytes(1), "one!!");
+  EXPECT_EQ(scratch.length(), 5);
+  EXPECT_EQ(lineBytes(0), "zero");
+}
+
+
 CLOSE_ANONYMOUS_NAMESPACE
 
 
 // Called from unit-tests.cc.
 void test_td_core(CmdlineArgsSpan args)
 {
-  testReadTwice();
-  testReadSourceCode();
-  testAtomicRead();
-  testVarious();
-  testWalkCoordBytes();
-  test_adjustMCoord();
-  test_wholeFileString();
-  test_replaceMultilineRange();
-  test_equals();
-  test_getWholeLineStringOrRangeErrorMessage();
+  if (!args.empty() && 0==std::strcmp(args[0], "load")) {
+    perfLoadFiles(args.subspan(1));
+    return;
+  }
+  if (!args.empty() && 0==std::strcmp(args[0], "spine")) {
+    perfSpineKinds(args.subspan(1));
+    return;
+  }
+
+  // Run everything against each kind of line spine.
+  LineSpineKind origDefault = TextDocumentCore::s_defaultSpineKind;
+  FOR_EACH_LINE_SPINE_KIND(kind) {
+    DIAG("td-core tests with " << toString(kind));
+    TextDocumentCore::s_defaultSpineKind = kind;
+
+    testReadTwice();
+    testReadSourceCode();
+    testAtomicRead();
+    testVarious();
+    testWalkCoordBytes();
+    test_byteOffsets();
+    test_adjustMCoord();
+    test_wholeFileString();
+    test_replaceWholeFile();
+    test_maxLineLengthBytes();
+    test_compactLineStorage();
+    test_compactLineStorageSlice();
+    test_replaceWithMappedFile();
+    test_provisionalLineIndex();
+    test_replaceMultilineRange();
+    test_replaceRange();
+    test_equals();
+    test_contentDigest();
+    test_getWholeLineStringOrRangeErrorMessage();
+    test_getLineBytes();
+  }
+  TextDocumentCore::s_defaultSpineKind = origDefault;
 }
 
 
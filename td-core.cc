@@ -5,14 +5,17 @@
 
 #include "byte-count.h"                // sizeBC, memchrBC, memcpyBC
 #include "byte-difference.h"           // ByteDifference
-#include "gap-gdvalue.h"               // toGDValue(LineGapArray)
-#include "history.h"                   // HE_text
+#include "content-digest.h"            // lineContentHash
+#include "line-difference.h"           // LineDifference
 #include "line-number.h"               // LineNumber
+#include "mapped-file.h"               // MappedFile
+#include "td-snapshot.h"               // TextDocumentSnapshot
 #include "wrapped-integer.h"           // WrappedInteger::getAs
 
 // smbase
 #include "smbase/array.h"              // Array
 #include "smbase/codepoint.h"          // isSpaceOrTab
+#include "smbase/gdvalue-map.h"        // gdv::GDValue(std::map)
 #include "smbase/gdvalue-optional.h"   // gdv::GDValue(std::optional)
 #include "smbase/gdvalue.h"            // gdv::GDValue
 #include "smbase/objcount.h"           // CheckObjectCount
@@ -25,6 +28,16 @@
 #include "smbase/syserr.h"             // xsyserror
 #include "smbase/xassert.h"            // xassert
 
+// libc++
+#include <algorithm>                   // std::{max, min}
+#include <cstddef>                     // std::ptrdiff_t, std::size_t
+#include <cstring>                     // std::memchr
+#include <map>                         // std::map
+#include <memory>                      // std::shared_ptr
+#include <string>                      // std::string
+#include <utility>                     // std::move
+#include <vector>                      // std::vector
+
 // libc
 #include <assert.h>                    // assert
 #include <ctype.h>                     // isalnum, isspace
@@ -37,11 +50,62 @@ using namespace smbase;
 INIT_TRACE("td-core");
 
 
+// Line lengths below this are tallied in an array, rather than in
+// `m_lineLengthCounts` directly, by `replaceWholeFile`.
+static int const SHORT_LINE_LENGTH_LIMIT = 256;
+
+
+// Number of lines that `walkCoordBytes` and `countBytesInRange` will
+// traverse one at a time before switching to `m_lineOffsets`.
+static int const WALK_LINES_DIRECTLY = 16;
+
+
+// Size of the slices in which `completeLineIndex` extends the index,
+// which keeps the text passed to observers well within `ByteCount`.
+static std::size_t const MAPPED_INDEX_COMPLETION_SLICE_BYTES = 0x4000000;
+
+
+// Return the offset in the `size` bytes at `data` just past the first
+// newline at or after `start + maxBytes - 1`, or `size` if there is
+// none.  That is where a line index slice of about `maxBytes` bytes
+// beginning at `start` ends.
+static std::size_t mappedIndexSliceEnd(
+  char const *data, std::size_t size, std::size_t start, std::size_t maxBytes)
+{
+  if (maxBytes >= size - start) {
+    return size;
+  }
+
+  char const *p = data + start + std::max(maxBytes, (std::size_t)1) - 1;
+  char const *nl = (char const *)std::memchr(p, '\n', data + size - p);
+  return nl? (nl+1 - data) : size;
+}
+
+
 // ---------------------- TextDocumentCore --------------------------
+LineSpineKind TextDocumentCore::s_defaultSpineKind =
+  LineSpineKind::LSK_GAP_ARRAY;
+
+std::size_t TextDocumentCore::s_mappedIndexInitialBytes = 0x400000;
+
+
 TextDocumentCore::TextDocumentCore()
-  : m_lines(),               // Momentarily empty sequence of lines.
+  : TextDocumentCore(s_defaultSpineKind)
+{}
+
+
+TextDocumentCore::TextDocumentCore(LineSpineKind spineKind)
+  : m_compactionNextLine(0),
+    m_lines(spineKind),      // Momentarily empty sequence of lines.
+    m_mappedFile(),
+    m_mappedIndexedBytes(0),
     m_recentIndex(),
-    m_longestLengthSoFar(0),
+    m_lineLengthCounts(),
+    m_lineOffsets(),
+    m_lineHashes(),
+    m_lastSnapshot(),
+    m_snapshotSamePrefix(0),
+    m_snapshotSameSuffix(0),
     m_recentLine(),
     m_versionNumber(1),
     m_observers(),
@@ -49,6 +113,9 @@ TextDocumentCore::TextDocumentCore()
 {
   // There is always at least one line.
   m_lines.insert(LineIndex(0) /*line*/, TextDocumentLine() /*value*/);
+  m_lineOffsets.insertLine(LineIndex(0), 1 /*weight*/);
+  m_lineHashes.insertLine(LineIndex(0));
+  addLineLength(ByteCount(0));
 
   selfCheck();
 }
@@ -74,16 +141,85 @@ TextDocumentCore::~TextDocumentCore()
 
   assert(m_iteratorCount == 0);
 
-  // Deallocate the non-null lines.
+  deallocateLineStorage();
+}
+
+
+TextDocumentLine TextDocumentCore::makeLine(
+  char const *src, ByteCount len)
+{
+  if (len.isZero()) {
+    return TextDocumentLine();
+  }
+
+  char *p = m_lineBytes.allocate(len);
+  memcpyBC(p, src, len);
+  return TextDocumentLine(p, len);
+}
+
+
+void TextDocumentCore::freeLine(TextDocumentLine const &tdl)
+{
+  if (!tdl.isEmpty()) {
+    m_lineBytes.deallocate(tdl.m_bytes, tdl.length());
+  }
+}
+
+
+void TextDocumentCore::deallocateLineStorage()
+{
+  // Releasing the arena's chunks frees every line at once.
   FOR_EACH_LINE_INDEX_IN(i, *this) {
-    TextDocumentLine &tdl = m_lines.eltRef(i);
-    if (tdl.m_bytes) {
-      delete[] tdl.m_bytes;
+    setMLine(i, TextDocumentLine());
+  }
+  m_lineBytes.clear();
+  m_mappedFile.reset();
+  m_mappedIndexedBytes = 0;
+
+  m_recentLine.clear();
+  m_recentIndex.reset();
+}
 
-      // Just for safety; should not be necessary.
-      tdl.m_bytes = nullptr;
+
+void TextDocumentCore::promoteMappedLines()
+{
+  if (!m_mappedFile) {
+    return;
+  }
+
+  // Copying moves the line contents, which would invalidate an
+  // iterator's pointer into the line.
+  xassert(m_iteratorCount == 0);
+
+  // The edit about to be made was specified in terms of the lines
+  // found so far, which the rest of the file only follows.
+  completeLineIndex();
+
+  TRACE1("promoteMappedLines: copying " << numLines() <<
+         " lines of " << doubleQuote(m_mappedFile->fname()));
+
+  FOR_EACH_LINE_INDEX_IN(i, *this) {
+    TextDocumentLine const &tdl = getMLine(i);
+    if (!tdl.isEmpty()) {
+      setMLine(i, makeLine(tdl.m_bytes, tdl.length()));
     }
   }
+
+  m_mappedFile.reset();
+  m_mappedIndexedBytes = 0;
+}
+
+
+bool TextDocumentCore::detachMappedFile()
+{
+  if (m_mappedFile && !m_mappedFile->isUnchanged()) {
+    TRACE1("detachMappedFile: " << doubleQuote(m_mappedFile->fname()) <<
+           " has changed");
+    return false;
+  }
+
+  promoteMappedLines();
+  return true;
 }
 
 
@@ -96,12 +232,53 @@ void TextDocumentCore::selfCheck() const
     xassert(m_recentLine.length() == 0);
   }
 
+  std::map<ByteCount, int> lengthCounts;
   FOR_EACH_LINE_INDEX_IN(i, *this) {
     TextDocumentLine const &tdl = m_lines.get(i);
     tdl.selfCheck();
+    ++lengthCounts[lineLengthBytes(i)];
   }
 
-  xassert(m_longestLengthSoFar >= 0);
+  xassert(lengthCounts == m_lineLengthCounts);
+
+  m_lines.selfCheck();
+
+  m_lineOffsets.selfCheck();
+  xassert(m_lineOffsets.numLines() == numLines());
+
+  m_lineHashes.selfCheck();
+  xassert(m_lineHashes.numLines() == numLines());
+
+  if (m_mappedFile) {
+    xassert(m_mappedIndexedBytes <= m_mappedFile->size());
+    if (lineIndexIsProvisional()) {
+      xassert(m_mappedFile->data()[m_mappedIndexedBytes-1] == '\n');
+      xassert(isEmptyLine(lastLineIndex()));
+    }
+  }
+  else {
+    xassert(m_mappedIndexedBytes == 0);
+  }
+
+  if (std::shared_ptr<TextDocumentSnapshot const> snap =
+        m_lastSnapshot.lock()) {
+    int const n = numLines().get();
+    int const snapN = snap->numLines().get();
+    int const prefix = m_snapshotSamePrefix.get();
+    int const suffix = m_snapshotSameSuffix.get();
+    xassert(prefix + suffix <= std::min(n, snapN) ||
+            (prefix == n && suffix == n && n == snapN));
+
+    // The lines claimed to be unchanged really are.
+    for (int i=0; i < prefix; ++i) {
+      xassert(snap->getWholeLineString(LineIndex(i)) ==
+              getWholeLineString(LineIndex(i)));
+    }
+    for (int i=1; i <= suffix; ++i) {
+      xassert(snap->getWholeLineString(LineIndex(snapN - i)) ==
+              getWholeLineString(LineIndex(n - i)));
+    }
+  }
 }
 
 
@@ -156,6 +333,13 @@ bool TextDocumentCore::operator==(TextDocumentCore const &obj) const
     return false;
   }
 
+  // If both digests are cheap to get, they can quickly show that the
+  // contents differ.  Equal digests still need confirmation.
+  if (m_lineHashes.sumIsValid() && obj.m_lineHashes.sumIsValid() &&
+      contentDigest() != obj.contentDigest()) {
+    return false;
+  }
+
   FOR_EACH_LINE_INDEX_IN(i, *this) {
     if (!equalLineAt(i, obj)) {
       return false;
@@ -166,6 +350,54 @@ bool TextDocumentCore::operator==(TextDocumentCore const &obj) const
 }
 
 
+std::uint64_t TextDocumentCore::contentDigest() const
+{
+  ArrayStack<char> scratch;
+  return m_lineHashes.digest(
+    [this, &scratch](LineIndex i) -> std::uint64_t {
+      char const *bytes = this->getLineBytes(i, scratch);
+      return lineContentHash(bytes, this->lineLengthBytes(i).get());
+    });
+}
+
+
+void TextDocumentCore::snapshotLinesChanged(
+  LineIndex first, LineCount count)
+{
+  int const numAfter = numLines().get() - first.get() - count.get();
+  xassert(numAfter >= 0);
+
+  m_snapshotSamePrefix =
+    LineCount(std::min(m_snapshotSamePrefix.get(), first.get()));
+  m_snapshotSameSuffix =
+    LineCount(std::min(m_snapshotSameSuffix.get(), numAfter));
+}
+
+
+std::shared_ptr<TextDocumentSnapshot const>
+TextDocumentCore::snapshot() const
+{
+  std::shared_ptr<TextDocumentSnapshot const> prev =
+    m_lastSnapshot.lock();
+  if (prev &&
+      prev->numLines() == numLines() &&
+      m_snapshotSamePrefix.get() == numLines().get()) {
+    // Nothing has changed.
+    return prev;
+  }
+
+  std::shared_ptr<TextDocumentSnapshot const> ret =
+    TextDocumentSnapshot::fromDocument(*this, prev.get(),
+      m_snapshotSamePrefix, m_snapshotSameSuffix);
+
+  m_lastSnapshot = ret;
+  m_snapshotSamePrefix = LineCount(numLines().get());
+  m_snapshotSameSuffix = LineCount(numLines().get());
+
+  return ret;
+}
+
+
 TextDocumentCore::operator gdv::GDValue() const
 {
   GDValue m(GDVK_TAGGED_ORDERED_MAP, "TextDocumentCore"_sym);
@@ -195,7 +427,7 @@ gdv::GDValue TextDocumentCore::dumpInternals() const
 
   GDV_WRITE_MEMBER_SYM(m_lines);
   GDV_WRITE_MEMBER_SYM(m_recentIndex);
-  GDV_WRITE_MEMBER_SYM(m_longestLengthSoFar);
+  GDV_WRITE_MEMBER_SYM(m_lineLengthCounts);
   GDV_WRITE_MEMBER_SYM(m_recentLine);
   GDV_WRITE_MEMBER_SYM(m_versionNumber);
 
@@ -220,7 +452,7 @@ void TextDocumentCore::detachRecent()
   // copy 'recentLine' into lines[recent]
   ByteCount len = m_recentLine.length();
   if (len) {
-    char *p = new char[len.get()];
+    char *p = m_lineBytes.allocate(len);
     m_recentLine.writeIntoArray(p, len);
 
     setMLine(*m_recentIndex, TextDocumentLine(p, len));
@@ -248,7 +480,7 @@ void TextDocumentCore::attachRecent(TextMCoord tc, ByteCount insLength)
       tdl.m_bytes, len, tc.m_byteIndex, insLength);
 
     // deallocate the source
-    delete[] tdl.m_bytes;
+    freeLine(tdl);
     setMLine(tc.m_line, TextDocumentLine());
   }
   else {
@@ -358,6 +590,13 @@ TextMCoord TextDocumentCore::lineEndCoord(LineIndex line) const
 // Interestingly, this is *not* what "wc -l" returns.  Instead, wc -l
 // returns a count of the newline characters.  But that seems like a bug
 // in 'wc' to me.
+ByteCount TextDocumentCore::maxLineLengthBytes() const
+{
+  // There is always at least one line, so the map is never empty.
+  return m_lineLengthCounts.rbegin()->first;
+}
+
+
 LineCount TextDocumentCore::numLinesExcludingFinalEmpty() const
 {
   LineIndex lastIndex = lastLineIndex();
@@ -375,34 +614,60 @@ bool TextDocumentCore::walkCoordBytes(
 {
   xassert(this->validCoord(tc));
 
-  for (; len > 0; len--) {
-    if (tc.m_byteIndex == this->lineLengthByteIndex(tc.m_line)) {
+  // Walk a line at a time while that remains cheap, since short walks
+  // are the common case and do not need `m_lineOffsets`.
+  for (int n = 0; n < WALK_LINES_DIRECTLY; n++) {
+    if (len >= 0) {
+      ByteDifference avail =
+        this->lineLengthByteIndex(tc.m_line) - tc.m_byteIndex;
+      if (len <= avail) {
+        tc.m_byteIndex += len;
+        return true;
+      }
+
       // cycle to next line
+      len -= avail + ByteDifference(1);
       ++tc.m_line;
       if (!validLine(tc.m_line)) {
-        return false;      // beyond EOF
+        // beyond EOF; leave the byte index where it was on the last
+        // line, as the byte-at-a-time walk did
+        tc.m_byteIndex = this->lineLengthByteIndex(tc.m_line.pred());
+        return false;
       }
       tc.m_byteIndex.set(0);
     }
     else {
-      ++tc.m_byteIndex;
-    }
-  }
+      ByteDifference avail(tc.m_byteIndex);
+      if (-len <= avail) {
+        tc.m_byteIndex += len;
+        return true;
+      }
 
-  for (; len < 0; len++) {
-    if (tc.m_byteIndex == 0) {
       // cycle up to end of preceding line
       if (tc.m_line.isZero()) {
+        tc.m_byteIndex.set(0);
         return false;      // before BOF
       }
+      len += avail + ByteDifference(1);
       --tc.m_line;
       tc.m_byteIndex = this->lineLengthByteIndex(tc.m_line);
     }
-    else {
-      tc.m_byteIndex--;
-    }
   }
 
+  // Long walk: go through the absolute byte offset.
+  std::ptrdiff_t target =
+    (std::ptrdiff_t)byteOffsetOf(tc).get() + len.get();
+  if (target < 0) {
+    tc = beginCoord();
+    return false;          // before BOF
+  }
+  if (target > (std::ptrdiff_t)totalBytes().get()) {
+    tc = TextMCoord(LineIndex(numLines()),
+                    this->lineLengthByteIndex(lastLineIndex()));
+    return false;          // beyond EOF
+  }
+
+  tc = coordAtByteOffset(ByteCount(target));
   return true;
 }
 
@@ -420,10 +685,15 @@ void TextDocumentCore::walkCoordBytesValid(
 // three mutator functions.
 void TextDocumentCore::insertLine(LineIndex const line)
 {
+  promoteMappedLines();
   bumpVersionNumber();
 
   // insert a blank line
   m_lines.insert(line, TextDocumentLine() /*value*/);
+  m_lineOffsets.insertLine(line, 1 /*weight*/);
+  m_lineHashes.insertLine(line);
+  snapshotLinesChanged(line, LineCount(1));
+  addLineLength(ByteCount(0));
 
   // adjust which line is 'recent'
   if (m_recentIndex.has_value() && *m_recentIndex >= line) {
@@ -438,6 +708,7 @@ void TextDocumentCore::insertLine(LineIndex const line)
 
 void TextDocumentCore::deleteLine(LineIndex const line)
 {
+  promoteMappedLines();
   bumpVersionNumber();
 
   if (line == m_recentIndex) {
@@ -453,6 +724,10 @@ void TextDocumentCore::deleteLine(LineIndex const line)
 
   // remove the line
   m_lines.remove(line);
+  m_lineOffsets.deleteLine(line);
+  m_lineHashes.deleteLine(line);
+  snapshotLinesChanged(line, LineCount(0));
+  removeLineLength(ByteCount(0));
 
   // adjust which line is 'recent'
   if (m_recentIndex.has_value() && *m_recentIndex > line) {
@@ -478,26 +753,29 @@ void TextDocumentCore::insertText(TextMCoord const tc,
     return;
   }
 
+  promoteMappedLines();
   bumpVersionNumber();
 
+  ByteCount const oldLength = lineLengthBytes(tc.m_line);
+
   if (tc.m_byteIndex == 0 &&
-      isEmptyLine(tc.m_line) &&
+      oldLength.isZero() &&
       tc.m_line != m_recentIndex) {
     // Inserting an entirely new line, can leave recent alone.
-    char *p = new char[length.get()];
-    memcpyBC(p, text, length);
-    setMLine(tc.m_line, TextDocumentLine(p, length));
-
-    seenLineLength(length);
+    setMLine(tc.m_line, makeLine(text, length));
   }
   else {
     // use recent
     attachRecent(tc, length);
     m_recentLine.insertMany(tc.m_byteIndex, text, length);
-
-    seenLineLength(m_recentLine.length());
   }
 
+  changeLineLength(oldLength, oldLength + length);
+
+  m_lineOffsets.adjustWeight(tc.m_line, length.get());
+  m_lineHashes.lineChanged(tc.m_line);
+  snapshotLinesChanged(tc.m_line, LineCount(1));
+
   FOREACH_RCSERFLIST_NC(TextDocumentObserver, m_observers, iter) {
     iter.data()->observeInsertText(*this, tc, text, length);
   }
@@ -521,16 +799,16 @@ void TextDocumentCore::deleteTextBytes(
     return;
   }
 
+  promoteMappedLines();
   bumpVersionNumber();
 
+  ByteCount const oldLength = lineLengthBytes(tc.m_line);
+
   if (tc.m_byteIndex == 0 &&
-      length == lineLengthBytes(tc.m_line) &&
+      length == oldLength &&
       tc.m_line != m_recentIndex) {
     // removing entire line, no need to move 'recent'
-    TextDocumentLine const &tdl = getMLine(tc.m_line);
-    if (!tdl.isEmpty()) {
-      delete[] tdl.m_bytes;
-    }
+    freeLine(getMLine(tc.m_line));
     setMLine(tc.m_line, TextDocumentLine());
   }
   else {
@@ -539,53 +817,159 @@ void TextDocumentCore::deleteTextBytes(
     m_recentLine.removeMany(tc.m_byteIndex, length);
   }
 
+  changeLineLength(oldLength, ByteCount(oldLength - length));
+  m_lineOffsets.adjustWeight(tc.m_line, -length.get());
+  m_lineHashes.lineChanged(tc.m_line);
+  snapshotLinesChanged(tc.m_line, LineCount(1));
+
   FOREACH_RCSERFLIST_NC(TextDocumentObserver, m_observers, iter) {
     iter.data()->observeDeleteText(*this, tc, length);
   }
 }
 
 
-void TextDocumentCore::replaceMultilineRange(
-  TextMCoordRange const &range, std::string const &text)
+void TextDocumentCore::replaceRange(
+  TextMCoordRange const &range, char const *text, ByteCount lengthBytes)
 {
   xassertPrecondition(validRange(range));
 
-  if (ByteCount deletionByteCount = countBytesInRange(range)) {
-    // This is what `TextDocument::deleteAt` does, in essence.
-    HE_text elt(range.m_start,
-                false /*insertion*/,
-                NULL /*text*/, ByteCount(0) /*textLen*/);
+  TextMCoord const start = range.m_start;
+  TextMCoord const end = range.m_end;
+
+  if (start.m_line == end.m_line &&
+      memchrBC(text, '\n', lengthBytes) == nullptr) {
+    // Within one line, the single-line primitives do the job, and
+    // observers see the same notifications as for typing.
+    deleteTextBytes(start,
+      ByteCount(end.m_byteIndex - start.m_byteIndex));
+    insertText(start, text, lengthBytes);
+    return;
+  }
+
+  promoteMappedLines();
+  bumpVersionNumber();
 
-    // This step is a bit wasteful because we make a copy of the text we
-    // are about to delete (since `HE_text` is part of the undo/redo
-    // mechanism), when all we really need is the count.  (But we cannot
-    // skip this call because the `apply` call gets its byte count from
-    // the copy made here.)
-    elt.computeText(*this, deletionByteCount);
+  // Put the recent line back into `m_lines` so the loops below can
+  // work on `m_lines` alone.
+  detachRecent();
 
-    elt.apply(*this, false /*reverse*/);
+  // Copy the parts of the first and last lines that are outside
+  // `range`, since those lines are about to be freed.
+  std::string prefix;
+  {
+    TextDocumentLine const &tdl = getMLine(start.m_line);
+    prefix.assign(tdl.m_bytes, start.m_byteIndex.get());
+  }
+  std::string suffix;
+  {
+    TextDocumentLine const &tdl = getMLine(end.m_line);
+    suffix.assign(tdl.m_bytes + end.m_byteIndex.get(),
+                  tdl.length().get() - end.m_byteIndex.get());
+  }
+
+  // Start of each newline-separated segment of `text`.  New line `i`
+  // consists of segment `i`, preceded by `prefix` if it is the first,
+  // and followed by `suffix` if it is the last.
+  char const *textEnd = text + lengthBytes;
+  std::vector<char const *> segStarts(1, text);
+  for (char const *p = text; p < textEnd; p++) {
+    if (*p == '\n') {
+      segStarts.push_back(p+1);
+    }
   }
 
-  if (ByteCount insertionByteCount = sizeBC(text)) {
-    // This is what `TextDocument::insertAt` does.
-    HE_text elt(range.m_start,
-                true /*insertion*/,
-                text.data(), insertionByteCount);
-    elt.apply(*this, false /*reverse*/);
+  int const oldCount = (end.m_line - start.m_line).get() + 1;
+  int const newCount = (int)segStarts.size();
+  int const commonCount = std::min(oldCount, newCount);
+
+  // Free the old lines, remembering their lengths.
+  std::vector<ByteCount> oldLengths;
+  oldLengths.reserve(oldCount);
+  for (int i=0; i < oldCount; i++) {
+    LineIndex const line = start.m_line + LineDifference(i);
+    TextDocumentLine const tdl = getMLine(line);
+    oldLengths.push_back(tdl.length());
+    removeLineLength(tdl.length());
+    freeLine(tdl);
+    setMLine(line, TextDocumentLine());
+    m_lineHashes.lineChanged(line);
+  }
+
+  // Remove or insert the difference all at one place.  The inserted
+  // lines start out empty, and their weights are adjusted below like
+  // those of the others.
+  LineIndex const splice = start.m_line + LineDifference(commonCount);
+  for (int i = newCount; i < oldCount; i++) {
+    m_lines.remove(splice);
+    m_lineOffsets.deleteLine(splice);
+    m_lineHashes.deleteLine(splice);
+  }
+  for (int i = oldCount; i < newCount; i++) {
+    m_lines.insert(splice, TextDocumentLine() /*value*/);
+    m_lineOffsets.insertLine(splice, 1 /*weight*/);
+    m_lineHashes.insertLine(splice);
+  }
+  snapshotLinesChanged(start.m_line, LineCount(newCount));
+
+  // Fill in the new lines.
+  ByteCount lastSegmentLength(0);
+  for (int i=0; i < newCount; i++) {
+    LineIndex const line = start.m_line + LineDifference(i);
+
+    char const *segStart = segStarts[i];
+    char const *segEnd = (i+1 < newCount)? segStarts[i+1]-1 : textEnd;
+    ByteCount const segLength(segEnd - segStart);
+    lastSegmentLength = segLength;
+
+    ByteCount const headLength = (i == 0)? sizeBC(prefix) : ByteCount(0);
+    ByteCount const tailLength =
+      (i+1 == newCount)? sizeBC(suffix) : ByteCount(0);
+    ByteCount const len = headLength + segLength + tailLength;
+
+    if (len > 0) {
+      char *p = m_lineBytes.allocate(len);
+      memcpyBC(p, prefix.data(), headLength);
+      memcpyBC(p + headLength, segStart, segLength);
+      memcpyBC(p + headLength + segLength, suffix.data(), tailLength);
+      setMLine(line, TextDocumentLine(p, len));
+    }
+    addLineLength(len);
+
+    ByteCount const oldLength =
+      (i < commonCount)? oldLengths[i] : ByteCount(0);
+    m_lineOffsets.adjustWeight(line, len.get() - oldLength.get());
+  }
+
+  TextMCoord const newEnd(
+    start.m_line + LineDifference(newCount-1),
+    newCount == 1?
+      start.m_byteIndex + lastSegmentLength :
+      ByteIndex(lastSegmentLength));
+
+  FOREACH_RCSERFLIST_NC(TextDocumentObserver, m_observers, iter) {
+    iter.data()->observeReplaceRange(*this, range, newEnd,
+                                     text, lengthBytes);
   }
 }
 
 
+void TextDocumentCore::replaceMultilineRange(
+  TextMCoordRange const &range, std::string const &text)
+{
+  replaceRange(range, text.data(), sizeBC(text));
+}
+
+
 void TextDocumentCore::dumpRepresentation() const
 {
   printf("-- td-core --\n");
 
   // lines
-  int L, G, R;
-  m_lines.getInternals(L, G, R);
-  printf("  lines: L=%d G=%d R=%d, num=%d\n", L,G,R, numLines().get());
+  printf("  lines: %s, num=%d\n",
+         m_lines.internalsString().c_str(), numLines().get());
 
   // recent
+  int L, G, R;
   m_recentLine.getInternals(L, G, R);
   printf("  recent=%d: L=%d G=%d R=%d, L+R=%d\n",
     (m_recentIndex? m_recentIndex->get() : -1),
@@ -607,49 +991,121 @@ void TextDocumentCore::dumpRepresentation() const
 void TextDocumentCore::printMemStats() const
 {
   // lines
-  int L, G, R;
-  m_lines.getInternals(L, G, R);
-  int linesBytes = (L+G+R) * sizeof(char*);
-  printf("  lines: L=%d G=%d R=%d, L+R=%d, bytes=%d\n", L,G,R, L+R, linesBytes);
+  std::size_t linesBytes = m_lines.allocatedBytes();
+  printf("  lines: %s, num=%d, bytes=%zu\n",
+         m_lines.internalsString().c_str(), numLines().get(), linesBytes);
 
   // recent
+  int L, G, R;
   m_recentLine.getInternals(L, G, R);
   int recentBytes = (L+G+R) * sizeof(char);
   printf("  recentLine: L=%d G=%d R=%d, bytes=%d\n", L,G,R, recentBytes);
 
   // line contents
-  int textBytes = 0;
-  int intFragBytes = 0;
-  int overheadBytes = 0;
+  LineByteArenaStats stats = m_lineBytes.getStats();
+  printf("  lineBytes: chunks=%zu chunkBytes=%zu\n",
+         stats.m_numChunks, stats.m_chunkBytes);
+  printf("    live=%zu dead=%zu unused=%zu overhead=%zu\n",
+         stats.m_liveBytes, stats.m_deadBytes,
+         stats.m_unusedBytes, stats.m_overheadBytes);
+  printf("    fragmentation=%.1f%%\n", stats.fragmentation() * 100.0);
+
+  // Mapped bytes are not counted in the total since they are backed by
+  // the file rather than the heap.
+  if (m_mappedFile) {
+    printf("  mappedFile: bytes=%zu indexed=%zu\n",
+           m_mappedFile->size(), m_mappedIndexedBytes);
+  }
+
+  // line offsets
+  std::size_t offsetsBytes = m_lineOffsets.allocatedBytes();
+  printf("  lineOffsets: built=%d bytes=%zu\n",
+         (int)m_lineOffsets.isBuilt(), offsetsBytes);
+
+  printf("total: %zu\n",
+         linesBytes + recentBytes + stats.totalBytes() + offsetsBytes);
+}
 
-  FOR_EACH_LINE_INDEX_IN(i, *this) {
-    TextDocumentLine const &tdl = getMLine(i);
 
-    textBytes += tdl.length().get();
+bool TextDocumentCore::lineStorageNeedsCompaction() const
+{
+  return m_lineBytes.isCompacting() || m_lineBytes.shouldCompact();
+}
 
-    int alloc = 0;
-    if (!tdl.isEmpty()) {
-      alloc = tdl.length().get() + 1;        // +1 for '\n'
-      overheadBytes += sizeof(size_t);  // malloc's internal 'size' field
+
+void TextDocumentCore::compactLineStorage()
+{
+  while (!compactLineStorageSlice(numLines())) {
+    // Keep going.
+  }
+}
+
+
+bool TextDocumentCore::compactLineStorageSlice(LineCount maxLines)
+{
+  // Relocation would invalidate an iterator's pointer into the line.
+  xassert(m_iteratorCount == 0);
+
+  if (m_mappedFile) {
+    // The lines are in the mapping, not the arena.  Mapping a file
+    // clears the arena, which abandons any pass in progress.
+    return true;
+  }
+
+  if (!m_lineBytes.isCompacting()) {
+    int retiring = m_lineBytes.beginCompaction();
+    TRACE1("compactLineStorage: retiring " << retiring << " chunks");
+    m_compactionNextLine = 0;
+
+    if (retiring == 0) {
+      m_lineBytes.endCompaction();
+      return true;
     }
-    int sst = sizeof(size_t);
-    intFragBytes = (alloc%sst)? (sst - alloc%sst) : 0;    // bytes to round up
   }
 
-  PVAL(textBytes);
-  PVAL(intFragBytes);
-  PVAL(overheadBytes);
+  int const end = std::min(numLines().get(),
+                           m_compactionNextLine + maxLines.get());
+  for (int i = m_compactionNextLine; i < end; i++) {
+    TextDocumentLine const &tdl = getMLine(LineIndex(i));
+    if (!tdl.isEmpty() && m_lineBytes.inRetiringChunk(tdl.m_bytes)) {
+      TextDocumentLine moved = makeLine(tdl.m_bytes, tdl.length());
+      freeLine(tdl);
+      setMLine(LineIndex(i), moved);
+    }
+  }
+  m_compactionNextLine = end;
+
+  if (end < numLines().get()) {
+    return false;
+  }
+
+  int kept = m_lineBytes.endCompaction();
+  TRACE1("compactLineStorage: kept " << kept << " chunks");
+  return true;
+}
+
+
+void TextDocumentCore::addLineLength(ByteCount len)
+{
+  ++m_lineLengthCounts[len];
+}
+
 
-  printf("total: %d\n",
-         linesBytes + recentBytes +
-         textBytes + intFragBytes + overheadBytes);
+void TextDocumentCore::removeLineLength(ByteCount len)
+{
+  auto it = m_lineLengthCounts.find(len);
+  xassert(it != m_lineLengthCounts.end());
+  if (--(it->second) == 0) {
+    m_lineLengthCounts.erase(it);
+  }
 }
 
 
-void TextDocumentCore::seenLineLength(ByteCount len)
+void TextDocumentCore::changeLineLength(ByteCount oldLen, ByteCount newLen)
 {
-  if (len > m_longestLengthSoFar) {
-    m_longestLengthSoFar = len;
+  if (oldLen != newLen) {
+    removeLineLength(oldLen);
+    addLineLength(newLen);
   }
 }
 
@@ -689,40 +1145,212 @@ void TextDocumentCore::bumpVersionNumber()
 }
 
 
+void TextDocumentCore::installLines(
+  char const *data, std::size_t size, bool copyBytes)
+{
+  // New lines, accumulated here so the spine can be installed with a
+  // single copy at the end.
+  std::vector<TextDocumentLine> newLines;
+
+  // Histogram of the new line lengths.  Most lines are short, so
+  // count those in an array, and only use the map for the rest.
+  std::vector<int> shortLengthCounts(SHORT_LINE_LENGTH_LIMIT, 0);
+  m_lineLengthCounts.clear();
+
+  char const *p = data;
+  char const *end = p + size;
+  while (true) {
+    // Find next newline, or end of the input.
+    char const *nl = (char const *)std::memchr(p, '\n', end - p);
+    char const *lineEnd = nl? nl : end;
+
+    ByteCount numBytes(lineEnd - p);
+    if (copyBytes) {
+      newLines.push_back(makeLine(p, numBytes));
+    }
+    else if (numBytes.isZero()) {
+      newLines.push_back(TextDocumentLine());
+    }
+    else {
+      // The line refers to read-only memory, but `promoteMappedLines`
+      // ensures nothing writes through this pointer.
+      newLines.push_back(TextDocumentLine(const_cast<char*>(p), numBytes));
+    }
+
+    if (numBytes < SHORT_LINE_LENGTH_LIMIT) {
+      shortLengthCounts[numBytes.get()]++;
+    }
+    else {
+      addLineLength(numBytes);
+    }
+
+    if (!nl) {
+      break;
+    }
+    p = nl+1;
+  }
+
+  // The final line never has a newline, so there is always at least
+  // one line, as required.
+  xassert(!newLines.empty());
+
+  // Put the gap at the end since appending is the most likely next
+  // modification, for example when a process is writing output.
+  LineCount numNewLines(safeToInt(newLines.size()));
+  m_lines.fillFromArray(newLines.data(), numNewLines,
+                        LineIndex(numNewLines) /*gap location*/);
+  m_lineOffsets.reset(numNewLines);
+  m_lineHashes.reset(numNewLines);
+
+  // Nothing can be shared with an earlier snapshot.
+  m_lastSnapshot.reset();
+  m_snapshotSamePrefix = LineCount(0);
+  m_snapshotSameSuffix = LineCount(0);
+
+  for (int len=0; len < SHORT_LINE_LENGTH_LIMIT; len++) {
+    if (int count = shortLengthCounts[len]) {
+      m_lineLengthCounts.emplace(ByteCount(len), count);
+    }
+  }
+}
+
+
 void TextDocumentCore::replaceWholeFile(
   std::vector<unsigned char> const &bytes)
 {
-  this->clear();
+  // Replacing the contents line by line through `insertText` and
+  // `insertLine` costs a version bump, a trip through the recent line,
+  // and a notification to every observer for each line, which makes
+  // loading a very large file slow.  Instead, build the new spine
+  // directly, then announce it all at once.
+  bumpVersionNumber();
 
-  // Location of the end of the document as it is being built.
-  TextMCoord tc = beginCoord();
+  deallocateLineStorage();
 
-  char const *p = (char const *)bytes.data();
-  char const *end = p + bytes.size();
-  while (p < end) {
-    // Find next newline, or end of the input.
-    char const *nl = p;
-    while (nl < end && *nl!='\n') {
-      nl++;
+  installLines((char const *)bytes.data(), bytes.size(),
+               true /*copyBytes*/);
+
+  this->notifyTotalChange();
+}
+
+
+void TextDocumentCore::replaceWithMappedFile(std::string const &fname)
+{
+  // Map first so that a failure leaves the document unchanged.
+  std::shared_ptr<MappedFile> mappedFile(new MappedFile(fname));
+
+  bumpVersionNumber();
+
+  deallocateLineStorage();
+
+  // Finding the line boundaries touches every page once, in order.
+  // Unless the slice ends the file, it ends with a newline, so
+  // `installLines` makes the empty placeholder line after it.
+  mappedFile->adviseSequential();
+  std::size_t const indexed = mappedIndexSliceEnd(
+    mappedFile->data(), mappedFile->size(), 0, s_mappedIndexInitialBytes);
+  installLines(mappedFile->data(), indexed, false /*copyBytes*/);
+
+  m_mappedFile = std::move(mappedFile);
+  m_mappedIndexedBytes = indexed;
+  if (!lineIndexIsProvisional()) {
+    m_mappedFile->adviseRandom();
+  }
+
+  TRACE1("replaceWithMappedFile: mapped " << numLines() <<
+         " lines in " << indexed << " of " << m_mappedFile->size() <<
+         " bytes of " << doubleQuote(fname));
+
+  this->notifyTotalChange();
+}
+
+
+bool TextDocumentCore::lineIndexIsProvisional() const
+{
+  return m_mappedFile && m_mappedIndexedBytes < m_mappedFile->size();
+}
+
+
+bool TextDocumentCore::extendLineIndex(std::size_t maxBytes)
+{
+  if (!lineIndexIsProvisional()) {
+    return true;
+  }
+
+  bumpVersionNumber();
+
+  // Nothing has been edited, so no line is held in `m_recentLine`.
+  xassert(!m_recentIndex.has_value());
+
+  char const *data = m_mappedFile->data();
+  std::size_t const start = m_mappedIndexedBytes;
+  std::size_t const end = mappedIndexSliceEnd(
+    data, m_mappedFile->size(), start, maxBytes);
+
+  // The first new line replaces the empty placeholder, and the rest
+  // are appended after it.  Like `installLines`, if the slice ends with
+  // a newline, the last of them is an empty placeholder.
+  LineIndex const first = lastLineIndex();
+  LineIndex line = first;
+  char const *p = data + start;
+  char const *const sliceEnd = data + end;
+  while (true) {
+    char const *nl = (char const *)std::memchr(p, '\n', sliceEnd - p);
+    char const *lineEnd = nl? nl : sliceEnd;
+
+    ByteCount numBytes(safeToInt(lineEnd - p));
+    TextDocumentLine tdl;
+    if (!numBytes.isZero()) {
+      tdl = TextDocumentLine(const_cast<char*>(p), numBytes);
     }
 
-    // insert this line fragment
-    ByteCount numBytes(nl - p);
-    this->insertText(tc, p, numBytes);
-    tc.m_byteIndex += numBytes;
+    if (line == first) {
+      setMLine(line, tdl);
+      changeLineLength(ByteCount(0), numBytes);
+      m_lineOffsets.adjustWeight(line, numBytes.get());
+      m_lineHashes.lineChanged(line);
+    }
+    else {
+      m_lines.insert(line, tdl);
+      m_lineOffsets.insertLine(line, numBytes.get() + 1 /*weight*/);
+      m_lineHashes.insertLine(line);
+      addLineLength(numBytes);
+    }
 
-    if (nl < end) {
-      // skip newline
-      ++nl;
-      ++tc.m_line;
-      this->insertLine(tc.m_line);
-      tc.m_byteIndex.set(0);
+    if (!nl) {
+      break;
     }
-    p = nl;
+    p = nl+1;
+    ++line;
   }
-  xassert(p == end);
+  snapshotLinesChanged(first, LineCount((line - first).get() + 1));
 
-  this->notifyTotalChange();
+  m_mappedIndexedBytes = end;
+  bool const complete = !lineIndexIsProvisional();
+  if (complete) {
+    m_mappedFile->adviseRandom();
+  }
+
+  TRACE2("extendLineIndex: indexed " << end << " of " <<
+         m_mappedFile->size() << " bytes");
+
+  TextMCoord const oldEnd(first, ByteIndex(0));
+  TextMCoord const newEnd(line, lineLengthByteIndex(line));
+  FOREACH_RCSERFLIST_NC(TextDocumentObserver, m_observers, iter) {
+    iter.data()->observeReplaceRange(*this,
+      TextMCoordRange(oldEnd, oldEnd), newEnd,
+      data + start, ByteCount(safeToInt(end - start)));
+  }
+
+  return complete;
+}
+
+
+void TextDocumentCore::completeLineIndex()
+{
+  while (!extendLineIndex(MAPPED_INDEX_COMPLETION_SLICE_BYTES)) {
+    // Keep going.
+  }
 }
 
 
@@ -786,10 +1414,73 @@ bool TextDocumentCore::getTextSpanningLines(
 
 ByteCount TextDocumentCore::countBytesInRange(TextMCoordRange const &range) const
 {
-  // TODO: Inefficient!
-  ArrayStack<char> arr;
-  this->getTextForRange(range, arr);
-  return ByteCount(arr.length());
+  xassert(validRange(range));
+
+  if (range.m_start.m_line == range.m_end.m_line) {
+    return ByteCount(range.m_end.m_byteIndex - range.m_start.m_byteIndex);
+  }
+
+  if (range.m_end.m_line - range.m_start.m_line <=
+        LineDifference(WALK_LINES_DIRECTLY)) {
+    // Sum the line lengths directly.
+    ByteCount ret(this->lineLengthByteIndex(range.m_start.m_line) -
+                  range.m_start.m_byteIndex);
+    for (LineIndex i = range.m_start.m_line.succ();
+         i < range.m_end.m_line; ++i) {
+      ret += ByteDifference(1) + this->lineLengthBytes(i);
+    }
+    ret += ByteDifference(1) + range.m_end.m_byteIndex;
+    return ret;
+  }
+
+  return ByteCount(byteOffsetOf(range.m_end) -
+                   byteOffsetOf(range.m_start));
+}
+
+
+void TextDocumentCore::validateLineOffsets() const
+{
+  m_lineOffsets.validate(
+    [this](LineIndex i) -> std::ptrdiff_t {
+      // Each line is followed by a newline separator, except the last,
+      // but the last line's weight is never used to find an offset.
+      return this->lineLengthBytes(i).get() + 1;
+    });
+}
+
+
+ByteCount TextDocumentCore::totalBytes() const
+{
+  return byteOffsetOf(endCoord());
+}
+
+
+ByteCount TextDocumentCore::byteOffsetOf(TextMCoord tc) const
+{
+  bctc(tc);
+
+  LineCount precedingLines(tc.m_line);
+  validateLineOffsets();
+
+  // The sum is computed in `std::ptrdiff_t`, but `ByteCount` is an
+  // `int`, so a document over 2 GiB must not silently wrap.
+  return ByteCount(safeToInt(m_lineOffsets.prefixSum(precedingLines) +
+                             tc.m_byteIndex.get()));
+}
+
+
+TextMCoord TextDocumentCore::coordAtByteOffset(ByteCount offset) const
+{
+  validateLineOffsets();
+
+  // The sum of all weights is one more than the total size, because
+  // of the phantom newline after the last line.
+  xassertPrecondition(
+    offset.get() < m_lineOffsets.prefixSum(numLines()));
+
+  std::ptrdiff_t remainder;
+  LineIndex line = m_lineOffsets.findLine(offset.get(), remainder /*OUT*/);
+  return TextMCoord(line, ByteIndex(remainder));
 }
 
 
@@ -887,6 +1578,48 @@ string TextDocumentCore::getWholeLineString(LineIndex line) const
 }
 
 
+char const *TextDocumentCore::getLineBytes(LineIndex line,
+  ArrayStack<char> /*OUT*/ &scratch) const
+{
+  bc(line);
+
+  if (line == m_recentIndex) {
+    // The recent line is stored in a gap array, so it has to be
+    // copied to be contiguous.
+    scratch.clear();
+    this->getWholeLine(line, scratch);
+    return scratch.getArray();
+  }
+  else {
+    return getMLine(line).m_bytes;
+  }
+}
+
+
+char const *TextDocumentCore::getLineBytesAndBlock(
+  LineIndex line,
+  ArrayStack<char> /*OUT*/ &scratch,
+  std::shared_ptr<char const> /*OUT*/ &block) const
+{
+  char const *bytes = getLineBytes(line, scratch);
+
+  // The recent line was just copied to `scratch`, so it cannot be
+  // shared.
+  if (line == m_recentIndex || bytes == nullptr) {
+    block.reset();
+  }
+  else if (m_mappedFile) {
+    // The bytes stay mapped as long as the `MappedFile` exists.
+    block = std::shared_ptr<char const>(m_mappedFile, m_mappedFile->data());
+  }
+  else {
+    block = m_lineBytes.blockContaining(bytes);
+  }
+
+  return bytes;
+}
+
+
 std::string TextDocumentCore::getWholeLineStringOrRangeErrorMessage(
   LineIndex lineIndex,
   std::string const &fname) const
@@ -895,15 +1628,24 @@ std::string TextDocumentCore::getWholeLineStringOrRangeErrorMessage(
     return getWholeLineString(lineIndex);
   }
   else {
-    return stringb(
-      "<Line number " << lineIndex.toLineNumber() <<
-      " is out of range for " << doubleQuote(fname) <<
-      ", which has " << numLines() <<
-      " lines.>");
+    return lineRangeErrorMessage(lineIndex, fname, numLines());
   }
 }
 
 
+/*static*/ std::string TextDocumentCore::lineRangeErrorMessage(
+  LineIndex lineIndex,
+  std::string const &fname,
+  LineCount numLines)
+{
+  return stringb(
+    "<Line number " << lineIndex.toLineNumber() <<
+    " is out of range for " << doubleQuote(fname) <<
+    ", which has " << numLines <<
+    " lines.>");
+}
+
+
 ByteCount TextDocumentCore::countLeadingSpacesTabs(LineIndex line) const
 {
   ByteCount ret(0);
@@ -1064,6 +1806,11 @@ void TextDocumentObserver::observeDeleteText(TextDocumentCore const &, TextMCoor
 void TextDocumentObserver::observeTotalChange(TextDocumentCore const &doc) NOEXCEPT
 {}
 
+void TextDocumentObserver::observeReplaceRange(TextDocumentCore const &doc, TextMCoordRange const &, TextMCoord, char const *, ByteCount) NOEXCEPT
+{
+  observeTotalChange(doc);
+}
+
 void TextDocumentObserver::observeMetadataChange(TextDocumentCore const &) NOEXCEPT
 {}
 
@@ -10,12 +10,17 @@
 #include "byte-count.h"                // ByteCount
 #include "byte-gap-array.h"            // ByteGapArray
 #include "byte-index.h"                // ByteIndex
+#include "line-byte-arena.h"           // LineByteArena
 #include "line-count.h"                // LineCount
-#include "line-gap-array.h"            // LineGapArray
+#include "line-hash-index.h"           // LineHashIndex
 #include "line-index.h"                // LineIndex
+#include "line-offset-index.h"         // LineOffsetIndex
+#include "line-spine.h"                // LineSpine, LineSpineKind
+#include "mapped-file-fwd.h"           // MappedFile [n]
 #include "positive-line-count.h"       // PositiveLineCount
 #include "td-fwd.h"                    // TextDocument [n]
 #include "td-line.h"                   // TextDocumentLine
+#include "td-snapshot-fwd.h"           // TextDocumentSnapshot [n]
 #include "td-version-number.h"         // TD_VersionNumber
 #include "textmcoord.h"                // TextMCoord
 
@@ -30,6 +35,10 @@
 #include "smbase/std-vector-fwd.h"     // std::vector [n]
 
 // libc++
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint64_t
+#include <map>                         // std::map
+#include <memory>                      // std::shared_ptr, std::weak_ptr
 #include <optional>                    // std::optional
 
 
@@ -60,21 +69,78 @@
 // (declared in td.h).
 //
 class TextDocumentCore : public SerfRefCount {
+public:      // class data
+  // Kind of line spine used by the default constructor.  This is
+  // initially `LSK_GAP_ARRAY`.
+  static LineSpineKind s_defaultSpineKind;
+
+  // Approximate number of bytes of a mapped file whose lines
+  // `replaceWithMappedFile` finds before returning.  The rest are found
+  // by `extendLineIndex`.
+  static std::size_t s_mappedIndexInitialBytes;
+
 private:     // instance data
+  // Storage for the bytes of the non-empty elements of `m_lines`.
+  LineByteArena m_lineBytes;
+
+  // While `m_lineBytes.isCompacting()`, the index of the next line that
+  // `compactLineStorageSlice` will examine.
+  int m_compactionNextLine;
+
   // This array is the spine of the document.  Every element is either
   // empty, meaning a blank line, or is a non-empty sequence of bytes
-  // that represent the line's contents.
-  LineGapArray<TextDocumentLine> m_lines;
+  // that represent the line's contents, allocated from `m_lineBytes`,
+  // or, when `m_mappedFile` is not null, pointing into its mapping.
+  LineSpine m_lines;
+
+  // If not null, the file whose mapped contents the lines of `m_lines`
+  // point into, as set up by `replaceWithMappedFile`.  Those bytes are
+  // never written; any edit first copies them into `m_lineBytes` and
+  // drops the mapping.  Snapshots share it so they can refer to the
+  // mapped lines rather than copying them.
+  std::shared_ptr<MappedFile> m_mappedFile;
+
+  // When `m_mappedFile` is not null, the number of its bytes whose
+  // lines are in `m_lines`.  If that is less than the file size, the
+  // index is provisional: the bytes end with a newline, and the last
+  // element of `m_lines` is an empty placeholder for the lines after
+  // them.  Otherwise 0.
+  std::size_t m_mappedIndexedBytes;
 
   // The most-recently edited line number, or `nullopt` to mean that no
   // line's contents are stored.
   std::optional<LineIndex> m_recentIndex;
 
-  // Length of the longest line this file has ever had, in bytes, not
-  // counting any newline separator.  This is my poor-man's substitute
-  // for a proper interval map, etc., to be able to answer the
-  // 'maxLineLength()' query.
-  ByteCount m_longestLengthSoFar;
+  // Map from a line length, in bytes, not counting any newline
+  // separator, to the number of lines that have that length.  Lengths
+  // with no lines are removed, so the greatest key is the length of
+  // the longest line, which answers the `maxLineLengthBytes()` query.
+  std::map<ByteCount, int> m_lineLengthCounts;
+
+  // Byte offset of the start of each line, counting newline
+  // separators.  This is only built, lazily, by the queries that need
+  // it, hence `mutable`, and after that is maintained incrementally by
+  // the mutators.
+  mutable LineOffsetIndex m_lineOffsets;
+
+  // Hash of each line and the digest of the whole document, which are
+  // likewise maintained incrementally but computed lazily.
+  mutable LineHashIndex m_lineHashes;
+
+  // The snapshot most recently returned by `snapshot()`.  Only a weak
+  // reference is kept, so a document whose snapshots have all been
+  // released does not keep the storage of its old line contents
+  // alive.
+  mutable std::weak_ptr<TextDocumentSnapshot const> m_lastSnapshot;
+
+  // Number of leading and trailing lines, respectively, known to be
+  // the same as those of `m_lastSnapshot`.  Both are the number of
+  // lines right after the snapshot is taken, and after any change,
+  // their sum is at most the number of lines in either.  These are
+  // maintained by the mutators so that `snapshot()` can share the
+  // unchanged parts.
+  mutable LineCount m_snapshotSamePrefix;
+  mutable LineCount m_snapshotSameSuffix;
 
   // If `m_recentIndex.has_value()`, then this holds the contents of
   // that line, and `m_lines[*m_recentIndex]` is empty.  Otherwise, this
@@ -92,7 +158,7 @@ private:     // instance data
   //   - if recent>=0, lines[recent] == NULL
   //   - if recent<0, recentLine.length() == 0
   //   - every lines[n] is NULL or valid and not empty
-  //   - longestLengthSoFar >= 0
+  //   - lineLengthCounts is the histogram of the line lengths
 
   // List of observers.  This is mutable because the highlighter wants
   // to declare, through its signature, that it does not modify the
@@ -137,15 +203,58 @@ private:     // funcs
   // postcondition: recent==-1
   void detachRecent();
 
-  // update 'longestLineSoFar', given the existence of a line
-  // that is 'len' long
-  void seenLineLength(ByteCount len);
+  // Update `m_lineLengthCounts` to reflect a line that is `len` long
+  // being added or removed.
+  void addLineLength(ByteCount len);
+  void removeLineLength(ByteCount len);
+
+  // Update `m_lineLengthCounts` for a line whose length changed.
+  void changeLineLength(ByteCount oldLen, ByteCount newLen);
+
+  // Allocate a copy of `len` bytes at `src` from `m_lineBytes` and
+  // return a line that refers to it.
+  TextDocumentLine makeLine(char const *src, ByteCount len);
+
+  // Return the storage of `tdl` to `m_lineBytes`.
+  void freeLine(TextDocumentLine const &tdl);
+
+  // Deallocate the byte arrays of every line in `m_lines`, empty the
+  // recent line, and drop any mapping.  Afterward, the elements of
+  // `m_lines` are dangling and must be discarded or overwritten by the
+  // caller.
+  void deallocateLineStorage();
+
+  // Split the `size` bytes at `data` into lines and install them as
+  // the new contents of `m_lines`, `m_lineOffsets`, `m_lineHashes`,
+  // and `m_lineLengthCounts`.  If `copyBytes`, the line contents are copied
+  // into `m_lineBytes`; otherwise the lines point directly into `data`.
+  //
+  // Requires: The line storage has been deallocated.
+  void installLines(char const *data, std::size_t size, bool copyBytes);
+
+  // If the lines point into `m_mappedFile`, complete the line index,
+  // then copy them into `m_lineBytes` and drop the mapping.  Apart from
+  // completing the index, this does not change the logical contents.
+  void promoteMappedLines();
 
   // Notify all observers of a total change to the document.
   void notifyTotalChange();
 
+  // Make the byte offsets of the lines available in `m_lineOffsets`.
+  void validateLineOffsets() const;
+
+  // Record that lines [first,first+count) may differ from those of
+  // `m_lastSnapshot`, while the lines before and after them are the
+  // same, although the latter may have moved.
+  void snapshotLinesChanged(LineIndex first, LineCount count);
+
 public:    // funcs
-  TextDocumentCore();        // one empty line
+  // One empty line, with the spine of kind `s_defaultSpineKind`.
+  TextDocumentCore();
+
+  // One empty line, with the given spine kind.
+  explicit TextDocumentCore(LineSpineKind spineKind);
+
   ~TextDocumentCore();
 
   // Check internal invariants, throwing assertion if broken.
@@ -158,6 +267,26 @@ public:    // funcs
   bool operator!=(TextDocumentCore const &obj) const
     { return !operator==(obj); }
 
+  // Digest of the contents, equal to `textContentDigest` applied to
+  // `getWholeFile()`.  Documents with equal contents have equal
+  // digests, and documents with different contents almost certainly
+  // (with probability about 1 - 2^-64) have different ones.
+  //
+  // The digest is maintained incrementally.  After any edit, including
+  // inserting or deleting lines, this only hashes the lines that were
+  // inserted or whose contents changed, and finding each of them costs
+  // O(log n).  Repeated calls with no intervening change are O(1).
+  std::uint64_t contentDigest() const;
+
+  // Return an immutable snapshot of the current contents.  The
+  // snapshot refers to the document's line storage rather than copying
+  // it.  If the previous snapshot is still held by someone, then its
+  // chunks of lines that have not changed since are shared with the new
+  // one, and if nothing has changed, the previous snapshot itself is
+  // returned.  The cost is proportional to the number of chunks plus
+  // the lines of the chunks that have to be rebuilt.
+  std::shared_ptr<TextDocumentSnapshot const> snapshot() const;
+
   // ------------------------- GDValue export --------------------------
   // Logically, this object represents a versioned sequence of strings,
   // so this operator returns an ordered map with `version` and `lines`
@@ -170,6 +299,9 @@ public:    // funcs
   // Dump internals for test/debug.
   gdv::GDValue dumpInternals() const;
 
+  // Data structure used to hold the lines.
+  LineSpineKind lineSpineKind() const { return m_lines.kind(); }
+
   // ---------------------- document shape ------------------------
   // # of lines stored; always at least 1
   PositiveLineCount numLines() const
@@ -215,11 +347,9 @@ public:    // funcs
   TextMCoord lineEndCoord(LineIndex line) const;
 
   // Maximum length of a line, not including any newline separator.
-  //
-  // TODO: Implement this properly (right now it just uses the length of
-  // the longest line ever seen, even if that line is subsequently
-  // deleted).
-  ByteCount maxLineLengthBytes() const { return m_longestLengthSoFar; }
+  // This is exact: it decreases when the longest line is shortened or
+  // removed.
+  ByteCount maxLineLengthBytes() const;
 
   // Number of lines in the file as a user would typically view it: if
   // the last line is empty, meaning the on-disk file ends in a newline,
@@ -250,6 +380,30 @@ public:    // funcs
   // newline separators the range spans.
   ByteCount countBytesInRange(TextMCoordRange const &range) const;
 
+  // --------------------------- byte offsets --------------------------
+  // Number of bytes in the document, counting one for each newline
+  // separator.  This is the size of `getWholeFile()`.
+  //
+  // Throws `XOverflow` if that does not fit in a `ByteCount`.
+  ByteCount totalBytes() const;
+
+  // Byte offset of `tc` from the start of the document, counting one
+  // for each newline separator, i.e., the position in `getWholeFile()`
+  // corresponding to `tc`.
+  //
+  // This is O(log n), except that the first query after the contents
+  // are replaced wholesale builds the offset index in O(n).
+  //
+  // Throws `XOverflow` if the offset does not fit in a `ByteCount`.
+  //
+  // Requires: validCoord(tc)
+  ByteCount byteOffsetOf(TextMCoord tc) const;
+
+  // Inverse of `byteOffsetOf`.
+  //
+  // Requires: 0 <= offset <= totalBytes()
+  TextMCoord coordAtByteOffset(ByteCount offset) const;
+
   // If `tc` is not valid, adjust it to the nearest coordinate that is.
   // Specifically, if the line is too large, set `tc` to `endCoord()`.
   // (Due to the `LineIndex` constraint, it cannot be negative.)  If the
@@ -294,6 +448,28 @@ public:    // funcs
   // Same, but returning the line as a string.
   std::string getWholeLineString(LineIndex line) const;
 
+  // Return a pointer to the `lineLengthBytes(line)` bytes of `line`,
+  // without a newline or NUL.  Usually this points directly into the
+  // document's storage, so nothing is copied; but if `line` is the one
+  // most recently edited, its bytes are copied into `scratch` (which is
+  // cleared first) and the pointer refers to that.  The pointer is
+  // invalidated by any change to the document or to `scratch`.  It may
+  // be null if the line is empty.
+  char const *getLineBytes(LineIndex line,
+                           ArrayStack<char> /*OUT*/ &scratch) const;
+
+  // Same as `getLineBytes`, and if the returned bytes are in the line
+  // byte arena, also set `block` to the arena block that contains them
+  // (see `LineByteArena::blockContaining`), or if they are in the
+  // mapping of a file, to a pointer that shares ownership of the
+  // mapping, so they remain valid while `block` is held.  Otherwise,
+  // set `block` to null.  This is how `TextDocumentSnapshot` shares the
+  // line contents.
+  char const *getLineBytesAndBlock(
+    LineIndex line,
+    ArrayStack<char> /*OUT*/ &scratch,
+    std::shared_ptr<char const> /*OUT*/ &block) const;
+
   // If `validLine(lineIndex)`, return `getWholeLineString(lineIndex)`.
   // Otherwise, return a string describing the out-of-range error, which
   // refers to the file as having `fname`.
@@ -301,6 +477,14 @@ public:    // funcs
     LineIndex lineIndex,
     std::string const &fname) const;
 
+  // The message used above, for a file called `fname` that has
+  // `numLines` lines.  This is also used when the lines come from
+  // somewhere other than a document.
+  static std::string lineRangeErrorMessage(
+    LineIndex lineIndex,
+    std::string const &fname,
+    LineCount numLines);
+
   // Return the number of consecutive spaces and tabs at the start of
   // the given line, as a byte count.
   ByteCount countLeadingSpacesTabs(LineIndex line) const;
@@ -340,8 +524,18 @@ public:    // funcs
   // function.
 
   // Replace the text in `range` (which must have valid coordinates with
-  // start <= end) with `text`.  The range can span multiple lines, and
-  // `text` can have newlines in it.
+  // start <= end) with the `lengthBytes` bytes of `text`.  The range
+  // can span multiple lines, and `text` can have newlines in it.
+  //
+  // If both the range and `text` are confined to a single line, this
+  // is done with `deleteTextBytes` and `insertText`, and observers see
+  // those.  Otherwise, the affected lines are spliced in one step: the
+  // version number is incremented once, and observers receive a single
+  // `observeReplaceRange`.
+  void replaceRange(TextMCoordRange const &range,
+                    char const *text, ByteCount lengthBytes);
+
+  // Same, using a `std::string`.
   void replaceMultilineRange(
     TextMCoordRange const &range, std::string const &text);
 
@@ -353,12 +547,69 @@ public:    // funcs
   std::vector<unsigned char> getWholeFile() const;
 
   // Replace the file contents with those from 'bytes'.
+  //
+  // This builds the new sequence of lines directly, in one pass over
+  // `bytes`, rather than going through the incremental manipulation
+  // interface.  Consequently, the version number is incremented once,
+  // and observers receive only `observeTotalChange`.
   void replaceWholeFile(std::vector<unsigned char> const &bytes);
 
   // Same, but using `string`.
   std::string getWholeFileString() const;
   void replaceWholeFileString(std::string const &str);
 
+  // Replace the file contents with those of the file `fname`, which is
+  // mapped into memory rather than read.  The line index is built by
+  // one pass over the mapping, but the line contents are not copied,
+  // so the pages of a huge file are only resident while the OS sees
+  // fit.  Otherwise this behaves like `replaceWholeFile`.
+  //
+  // The first modification of the contents copies them into ordinary
+  // line storage, after which the document no longer depends on the
+  // file.  Until then, if another process rewrites the file in place,
+  // the lines show whatever it has now, split where the old contents
+  // had newlines, and if it truncates the file, the missing lines read
+  // as zeroes.  A client that learns the file has changed must
+  // therefore replace the contents.
+  //
+  // Finding the lines means reading the entire file, so only about
+  // `s_mappedIndexInitialBytes` are indexed here, and the document
+  // consists of the lines found so far, which must then be extended
+  // with `extendLineIndex` or `completeLineIndex`.
+  //
+  // Throws `XSysError` if the file cannot be mapped, in which case the
+  // document is unchanged.
+  void replaceWithMappedFile(std::string const &fname);
+
+  // True if the contents are mapped but only the lines at the start of
+  // the file have been found so far.  Until the index is complete,
+  // `numLines()` is provisional: the document has the lines found so
+  // far, followed by an empty last line.
+  bool lineIndexIsProvisional() const;
+
+  // If the line index is provisional, find the lines in about
+  // `maxBytes` more of the file, or up to the end of the next line if
+  // that is longer, and append them to the document.  Observers see
+  // this as the replacement of the empty range at the start of the
+  // empty last line with the new text.  Return true if the index is
+  // now complete.
+  bool extendLineIndex(std::size_t maxBytes);
+
+  // Extend the line index until it is complete.
+  void completeLineIndex();
+
+  // True if the contents are those of a file mapped by
+  // `replaceWithMappedFile` that have not been modified since.
+  bool isMapped() const { return m_mappedFile != nullptr; }
+
+  // If the contents are mapped, stop depending on the file.  If the
+  // file is unchanged since it was mapped (see
+  // `MappedFile::isUnchanged`), complete the line index and copy the
+  // mapped bytes into ordinary line storage, and return true.  Otherwise the line boundaries may no longer match
+  // the bytes, so leave the mapping alone and return false; the caller
+  // must then replace the contents.  Returns true if not mapped.
+  bool detachMappedFile();
+
   // Get the current version number.
   //
   // When a change happens, the version number is incremented *before*
@@ -386,6 +637,26 @@ public:    // funcs
   // Send the 'observeMetadataChange' message to all observers.
   void notifyMetadataChange() const;
 
+  // ------------------------ line storage ----------------------------
+  // True if enough line storage has been freed in a fragmented way that
+  // `compactLineStorage` would be worthwhile, or a compaction pass
+  // started by `compactLineStorageSlice` is unfinished.  This is O(1).
+  bool lineStorageNeedsCompaction() const;
+
+  // Move lines out of sparsely occupied storage chunks so those chunks
+  // can be released.  This does not change the logical contents, so it
+  // does not bump the version or notify observers.  However, it must
+  // not be called while there are outstanding iterators.
+  void compactLineStorage();
+
+  // Do part of a compaction pass, beginning one if none is in
+  // progress, examining at most `maxLines` lines.  Return true if that
+  // finished the pass.  The document can be edited between slices; a
+  // line that the pass misses because lines were inserted or deleted
+  // meanwhile is just left where it is.  The same restriction on
+  // iterators applies.
+  bool compactLineStorageSlice(LineCount maxLines);
+
   // ---------------------- debugging ---------------------------
   // print internal rep
   void dumpRepresentation() const;
@@ -493,6 +764,14 @@ public:      // funcs
   // allow for incremental updates.  Observers must refresh completely.
   virtual void observeTotalChange(TextDocumentCore const &doc) NOEXCEPT;
 
+  // The text in `oldRange` was replaced by the `lengthBytes` bytes of
+  // `text`, which now occupy [oldRange.m_start, newEnd).  This is sent
+  // by `TextDocumentCore::replaceRange` when the change spans lines,
+  // in place of the equivalent sequence of the four notifications
+  // above.  The default implementation calls `observeTotalChange`, so
+  // observers that track lines incrementally must override it.
+  virtual void observeReplaceRange(TextDocumentCore const &doc, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount lengthBytes) NOEXCEPT;
+
   /* This notification is sent to observers if some data in one of the
      higher-level document classes changed (or might have changed), and
      that change should trigger a redraw of a widget showing this
@@ -497,6 +497,11 @@ void TextDocumentDiagnostics::deleteLineBytes(TextMCoord tc, ByteCount lengthByt
   m_rangeToDiagIndex.deleteLineBytes(tc, lengthBytes);
 }
 
+void TextDocumentDiagnostics::replaceRange(TextMCoordRange const &oldRange, TextMCoord newEnd)
+{
+  m_rangeToDiagIndex.replaceRange(oldRange, newEnd);
+}
+
 
 TextDocumentDiagnostics::operator gdv::GDValue() const
 {
@@ -530,6 +535,10 @@ void TextDocumentDiagnostics::applyDocumentChange(
       this->clearEverything(totalChange->m_numLines);
     }
 
+    ASTNEXTC(TDC_ReplaceRange, replaceRange) {
+      this->replaceRange(replaceRange->m_range, replaceRange->newEnd());
+    }
+
     ASTENDCASEC
   }
 }
@@ -623,5 +632,12 @@ void TextDocumentDiagnosticsUpdater::observeTotalChange(TextDocumentCore const &
   GENERIC_CATCH_END
 }
 
+void TextDocumentDiagnosticsUpdater::observeReplaceRange(TextDocumentCore const &doc, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount lengthBytes) noexcept
+{
+  GENERIC_CATCH_BEGIN
+  m_diagnostics->replaceRange(oldRange, newEnd);
+  GENERIC_CATCH_END
+}
+
 
 // EOF
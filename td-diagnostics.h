@@ -299,6 +299,7 @@ public:      // methods
   void deleteLines(LineIndex line, LineCount count);
   void insertLineBytes(TextMCoord tc, ByteCount lengthBytes);
   void deleteLineBytes(TextMCoord tc, ByteCount lengthBytes);
+  void replaceRange(TextMCoordRange const &oldRange, TextMCoord newEnd);
 
   // Equivalent to `toGDValue(getAllEntries())`.
   operator gdv::GDValue() const;
@@ -358,6 +359,7 @@ public:      // TextDocumentObserver methods
   virtual void observeDeleteLine(TextDocumentCore const &doc, LineIndex line) noexcept override;
   virtual void observeInsertText(TextDocumentCore const &doc, TextMCoord tc, char const *text, ByteCount lengthBytes) noexcept override;
   virtual void observeDeleteText(TextDocumentCore const &doc, TextMCoord tc, ByteCount lengthBytes) noexcept override;
+  virtual void observeReplaceRange(TextDocumentCore const &doc, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount lengthBytes) noexcept override;
 
   // This clears the diagnostics and resets the number of lines to match
   // `doc`.
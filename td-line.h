@@ -46,7 +46,8 @@ private:     // data
   int m_length;
 
   // If 'm_length' is not zero, pointer to array of bytes in the line,
-  // allocated with 'new[]'.  This is nominally an owner pointer, except
+  // allocated from the `LineByteArena` of the containing
+  // `TextDocumentCore`.  This is nominally an owner pointer, except
   // when this instance is an inactive element in a GapArray.  Again,
   // the class that contains the GapArray does memory management.
   char *m_bytes;
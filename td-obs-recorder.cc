@@ -372,4 +372,17 @@ void TextDocumentObservationRecorder::observeTotalChange(
 }
 
 
+void TextDocumentObservationRecorder::observeReplaceRange(
+  TextDocumentCore const &doc, TextMCoordRange const &oldRange,
+  TextMCoord newEnd, char const *text, ByteCount lengthBytes) noexcept
+{
+  GENERIC_CATCH_BEGIN
+  if (trackingSomething()) {
+    addObservation(std::make_unique<TDC_ReplaceRange>(
+      oldRange, text, lengthBytes));
+  }
+  GENERIC_CATCH_END
+}
+
+
 // EOF
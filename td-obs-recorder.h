@@ -201,6 +201,7 @@ public:      // methods
   virtual void observeInsertText(TextDocumentCore const &doc, TextMCoord tc, char const *text, ByteCount lengthBytes) noexcept override;
   virtual void observeDeleteText(TextDocumentCore const &doc, TextMCoord tc, ByteCount lengthBytes) noexcept override;
   virtual void observeTotalChange(TextDocumentCore const &doc) noexcept override;
+  virtual void observeReplaceRange(TextDocumentCore const &doc, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount lengthBytes) noexcept override;
 };
 
 
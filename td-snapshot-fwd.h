@@ -0,0 +1,11 @@
+// td-snapshot-fwd.h
+// Forward decls for `td-snapshot.h`.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_TD_SNAPSHOT_FWD_H
+#define EDITOR_TD_SNAPSHOT_FWD_H
+
+class TextDocumentSnapshot;
+
+#endif // EDITOR_TD_SNAPSHOT_FWD_H
@@ -0,0 +1,339 @@
+// td-snapshot-test.cc
+// Tests for `td-snapshot` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "td-snapshot.h"               // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "td-core.h"                   // TextDocumentCore
+
+#include "smbase/autofile.h"           // AutoFILE
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, EXPECT_TRUE
+#include "smbase/stringb.h"            // stringb
+#include "smbase/xassert.h"            // xassert
+
+#include <algorithm>                   // std::min
+#include <memory>                      // std::shared_ptr
+#include <string>                      // std::string
+#include <utility>                     // std::swap
+#include <vector>                      // std::vector
+
+#include <stdio.h>                     // fputs, remove
+#include <stdlib.h>                    // rand, srand
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+typedef std::shared_ptr<TextDocumentSnapshot const> SnapshotPtr;
+
+
+// Check that `snap` has the same contents as `doc`.
+void checkSameContents(SnapshotPtr const &snap, TextDocumentCore const &doc)
+{
+  snap->selfCheck();
+  EXPECT_EQ(snap->numLines(), doc.numLines());
+  EXPECT_EQ(snap->getWholeFileString(), doc.getWholeFileString());
+  EXPECT_EQ(snap->contentDigest(), doc.contentDigest());
+
+  FOR_EACH_LINE_INDEX_IN(i, doc) {
+    EXPECT_EQ(snap->lineLengthBytes(i), doc.lineLengthBytes(i));
+    EXPECT_EQ(snap->getWholeLineString(i), doc.getWholeLineString(i));
+  }
+}
+
+
+// Make a document with `n` lines, "line 0" through "line n-1".
+void fillLines(TextDocumentCore &doc, int n)
+{
+  std::string text;
+  for (int i=0; i < n; ++i) {
+    if (i > 0) {
+      text += '\n';
+    }
+    text += stringb("line " << i);
+  }
+  doc.replaceWholeFileString(text);
+}
+
+
+void testBasics()
+{
+  TextDocumentCore doc;
+  SnapshotPtr s1 = doc.snapshot();
+  checkSameContents(s1, doc);
+
+  // With no change in between, the same snapshot is returned.
+  EXPECT_TRUE(doc.snapshot() == s1);
+
+  doc.replaceWholeFileString("zero\none\n\nthree");
+  SnapshotPtr s2 = doc.snapshot();
+  checkSameContents(s2, doc);
+
+  // The earlier snapshot is unaffected.
+  EXPECT_EQ(s1->getWholeFileString(), "");
+
+  std::string const fname("the-fname");
+  EXPECT_EQ(
+    s2->getWholeLineStringOrRangeErrorMessage(LineIndex(3), fname),
+    "three");
+  EXPECT_EQ(
+    s2->getWholeLineStringOrRangeErrorMessage(LineIndex(4), fname),
+    TextDocumentCore::lineRangeErrorMessage(
+      LineIndex(4), fname, LineCount(4)));
+}
+
+
+void testSharing()
+{
+  int const N = TextDocumentSnapshot::LINES_PER_CHUNK;
+
+  TextDocumentCore doc;
+  fillLines(doc, N*10);
+  SnapshotPtr s1 = doc.snapshot();
+  checkSameContents(s1, doc);
+  EXPECT_EQ(s1->numChunks(), 10);
+
+  // Typing in one line only copies its chunk.
+  doc.insertString(TextMCoord(LineIndex(N*4 + 3), ByteIndex(2)), "xyz");
+  doc.insertString(TextMCoord(LineIndex(N*4 + 5), ByteIndex(0)), "abc");
+  SnapshotPtr s2 = doc.snapshot();
+  checkSameContents(s2, doc);
+  EXPECT_EQ(s2->numChunks(), 10);
+  EXPECT_EQ(s2->numChunksSharedWith(*s1), 9);
+  EXPECT_EQ(s1->getWholeLineString(LineIndex(N*4 + 3)),
+            stringb("line " << (N*4 + 3)));
+
+  // Inserting lines at a chunk boundary shares all of the chunks, with
+  // a new one in between.
+  doc.insertLine(LineIndex(N*2));
+  doc.insertLine(LineIndex(N*2));
+  SnapshotPtr s3 = doc.snapshot();
+  checkSameContents(s3, doc);
+  EXPECT_EQ(s3->numChunks(), 11);
+  EXPECT_EQ(s3->numChunksSharedWith(*s2), 10);
+
+  // Edits far apart only share the chunks outside both, which here is
+  // just the last one.
+  doc.insertString(TextMCoord(LineIndex(1), ByteIndex(0)), "a");
+  doc.insertString(TextMCoord(LineIndex(N*9), ByteIndex(0)), "b");
+  SnapshotPtr s4 = doc.snapshot();
+  checkSameContents(s4, doc);
+  EXPECT_EQ(s4->numChunksSharedWith(*s3), 1);
+
+  // A multi-line replacement.
+  doc.replaceMultilineRange(
+    TextMCoordRange(TextMCoord(LineIndex(N*6), ByteIndex(1)),
+                    TextMCoord(LineIndex(N*6 + 2), ByteIndex(3))),
+    "one\ntwo\nthree\nfour");
+  SnapshotPtr s5 = doc.snapshot();
+  checkSameContents(s5, doc);
+  EXPECT_EQ(s5->numChunksSharedWith(*s4), s4->numChunks() - 1);
+
+  // Replacing the whole file shares nothing.
+  doc.replaceWholeFileString(s5->getWholeFileString());
+  SnapshotPtr s6 = doc.snapshot();
+  checkSameContents(s6, doc);
+  EXPECT_EQ(s6->numChunksSharedWith(*s5), 0);
+}
+
+
+void testReleased()
+{
+  TextDocumentCore doc;
+  fillLines(doc, 200);
+
+  SnapshotPtr s1 = doc.snapshot();
+  s1.reset();
+
+  // With the earlier snapshot gone, a new one is built from scratch.
+  doc.insertString(TextMCoord(LineIndex(50), ByteIndex(0)), "x");
+  doc.selfCheck();
+  SnapshotPtr s2 = doc.snapshot();
+  checkSameContents(s2, doc);
+  EXPECT_EQ(s2->getWholeLineString(LineIndex(50)), "xline 50");
+  doc.selfCheck();
+}
+
+
+void testWithLineReplaced()
+{
+  int const N = TextDocumentSnapshot::LINES_PER_CHUNK;
+
+  TextDocumentCore doc;
+  fillLines(doc, N*3);
+  SnapshotPtr s1 = doc.snapshot();
+
+  LineIndex const line(N + 7);
+  SnapshotPtr s2 = s1->withLineReplaced(line, "replaced");
+  s2->selfCheck();
+  EXPECT_EQ(s2->numChunksSharedWith(*s1), 2);
+  EXPECT_EQ(s2->getWholeLineString(line), "replaced");
+  EXPECT_EQ(s1->getWholeLineString(line), stringb("line " << line.get()));
+
+  // The digest agrees with a document having the same contents.
+  doc.deleteTextBytes(TextMCoord(line, ByteIndex(0)),
+                      doc.lineLengthBytes(line));
+  doc.insertString(TextMCoord(line, ByteIndex(0)), "replaced");
+  checkSameContents(s2, doc);
+}
+
+
+void testNoCopy()
+{
+  TextDocumentCore doc;
+  fillLines(doc, 1000);
+
+  // The lines are referenced, not copied.
+  SnapshotPtr s1 = doc.snapshot();
+  checkSameContents(s1, doc);
+  EXPECT_EQ(s1->numCopiedBytes(), (std::size_t)0);
+
+  // The line being edited is copied, since the document is not done
+  // with its storage.
+  doc.insertString(TextMCoord(LineIndex(500), ByteIndex(0)), "abc");
+  SnapshotPtr s2 = doc.snapshot();
+  checkSameContents(s2, doc);
+  EXPECT_EQ(s2->numCopiedBytes(),
+            (std::size_t)doc.lineLengthBytes(LineIndex(500)).get());
+
+  // Lines freed by the document stay valid in the snapshots.
+  doc.replaceWholeFileString("other");
+  EXPECT_EQ(s1->getWholeLineString(LineIndex(500)), "line 500");
+  EXPECT_EQ(s2->getWholeLineString(LineIndex(500)), "abcline 500");
+  EXPECT_EQ(s2->getWholeLineString(LineIndex(999)), "line 999");
+  s1->selfCheck();
+  s2->selfCheck();
+}
+
+
+// A snapshot of a mapped file shares the mapping.
+void testMappedNoCopy()
+{
+  {
+    TextDocumentCore doc;
+    fillLines(doc, 1000);
+    AutoFILE fp("td-snapshot.tmp", "wb");
+    fputs(doc.getWholeFileString().c_str(), fp);
+  }
+
+  TextDocumentCore doc;
+  doc.replaceWithMappedFile("td-snapshot.tmp");
+  doc.completeLineIndex();
+  xassert(doc.isMapped());
+
+  SnapshotPtr s1 = doc.snapshot();
+  checkSameContents(s1, doc);
+  EXPECT_EQ(s1->numCopiedBytes(), (std::size_t)0);
+
+  // The mapping outlives the document's use of it.
+  doc.replaceWholeFileString("other");
+  xassert(!doc.isMapped());
+  EXPECT_EQ(s1->getWholeLineString(LineIndex(500)), "line 500");
+  EXPECT_EQ(s1->getWholeLineString(LineIndex(999)), "line 999");
+  s1->selfCheck();
+
+  s1.reset();
+  remove("td-snapshot.tmp");
+}
+
+
+// Random coordinate in `doc`.
+TextMCoord randomCoord(TextDocumentCore const &doc)
+{
+  LineIndex line(rand() % doc.numLines().get());
+  return TextMCoord(line,
+    ByteIndex(rand() % (doc.lineLengthBytes(line).get() + 1)));
+}
+
+
+// Random edits, with snapshots taken now and then, each of which must
+// keep its contents.
+void testRandom()
+{
+  TextDocumentCore doc;
+  fillLines(doc, 300);
+
+  std::vector<SnapshotPtr> snapshots;
+  std::vector<std::string> expect;
+
+  srand(5);
+  for (int iter=0; iter < 1000; iter++) {
+    TextMCoord start = randomCoord(doc);
+    switch (rand() % 5) {
+      case 0:
+        doc.insertString(start, "ab");
+        break;
+
+      case 1:
+        doc.deleteTextBytes(start, ByteCount(
+          std::min(1, doc.lineLengthBytes(start.m_line).get() -
+                      start.m_byteIndex.get())));
+        break;
+
+      case 2: {
+        TextMCoord end = randomCoord(doc);
+        if (end < start) {
+          std::swap(start, end);
+        }
+        doc.replaceRange(TextMCoordRange(start, end),
+                         "c\nd\ne", ByteCount(rand() % 6));
+        break;
+      }
+
+      case 3:
+        if (doc.isEmptyLine(start.m_line) && doc.numLines() > 1) {
+          doc.deleteLine(start.m_line);
+        }
+        else {
+          doc.insertLine(start.m_line);
+        }
+        break;
+
+      case 4:
+        if (iter % 7 == 0) {
+          // Sometimes release the most recent snapshot.
+          if (!snapshots.empty()) {
+            snapshots.pop_back();
+            expect.pop_back();
+          }
+        }
+        else {
+          snapshots.push_back(doc.snapshot());
+          expect.push_back(doc.getWholeFileString());
+          checkSameContents(snapshots.back(), doc);
+          doc.selfCheck();
+        }
+        break;
+    }
+  }
+
+  for (std::size_t i=0; i < snapshots.size(); ++i) {
+    snapshots[i]->selfCheck();
+    EXPECT_EQ(snapshots[i]->getWholeFileString(), expect[i]);
+  }
+
+  checkSameContents(doc.snapshot(), doc);
+  doc.selfCheck();
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_td_snapshot(CmdlineArgsSpan args)
+{
+  testBasics();
+  testSharing();
+  testReleased();
+  testWithLineReplaced();
+  testNoCopy();
+  testMappedNoCopy();
+  testRandom();
+}
+
+
+// EOF
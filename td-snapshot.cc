@@ -0,0 +1,430 @@
+// td-snapshot.cc
+// Code for `td-snapshot` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "td-snapshot.h"               // this module
+
+#include "content-digest.h"            // lineContentHash, digestPower, finishContentDigest
+#include "td-core.h"                   // TextDocumentCore
+
+#include "smbase/array.h"              // ArrayStack
+#include "smbase/overflow.h"           // safeToInt
+#include "smbase/xassert.h"            // xassert, xassertPrecondition
+
+#include <algorithm>                   // std::min, std::upper_bound
+#include <set>                         // std::set
+#include <utility>                     // std::move, std::make_pair
+
+
+// ------------------------------ Chunk --------------------------------
+class TextDocumentSnapshot::Chunk {
+  NO_OBJECT_COPIES(Chunk);
+
+public:      // data
+  // For each line, the address of its first byte.  That is either in
+  // one of `m_blocks` or in `m_ownBytes`.
+  std::vector<char const *> m_lineStarts;
+
+  // For each line, its length in bytes.
+  std::vector<std::size_t> m_lineLengths;
+
+  // Blocks of the document's `LineByteArena`, or the mapping of a
+  // mapped file, that lines point into.  Holding them keeps those bytes
+  // valid after the document frees them.
+  std::vector<std::shared_ptr<char const>> m_blocks;
+
+  // Contents of the lines that are not in any of `m_blocks`, which is
+  // just the line being edited.
+  std::string m_ownBytes;
+
+  // While the chunk is being built, the lines whose contents are in
+  // `m_ownBytes`, with their offsets in it.  `finish` turns these into
+  // addresses, since `m_ownBytes` may move while it grows.
+  std::vector<std::pair<int, std::size_t>> m_pendingOwnLines;
+
+  // Sum of `lineContentHash(line j) * digestPower(j)`, where `j` is the
+  // line's index within this chunk.
+  std::uint64_t m_hashSum;
+
+public:      // methods
+  Chunk()
+    : m_lineStarts(),
+      m_lineLengths(),
+      m_blocks(),
+      m_ownBytes(),
+      m_pendingOwnLines(),
+      m_hashSum(0)
+  {}
+
+  int numLines() const
+    { return (int)m_lineStarts.size(); }
+
+  std::size_t lineLength(int i) const
+    { return m_lineLengths[i]; }
+
+  char const *lineBytes(int i) const
+    { return m_lineStarts[i]; }
+
+  // Total bytes in the lines.
+  std::size_t totalBytes() const
+  {
+    std::size_t ret = 0;
+    for (std::size_t len : m_lineLengths) {
+      ret += len;
+    }
+    return ret;
+  }
+
+  // Append a line with the `len` bytes at `bytes`.  If `block` is not
+  // null, the bytes are in it, and it is held instead of copying them.
+  void appendLine(char const *bytes, std::size_t len,
+                  std::shared_ptr<char const> block)
+  {
+    m_hashSum += lineContentHash(bytes, len) * digestPower(numLines());
+
+    if (block) {
+      // Consecutive lines are usually in the same block.
+      if (m_blocks.empty() || m_blocks.back() != block) {
+        m_blocks.push_back(std::move(block));
+      }
+      m_lineStarts.push_back(bytes);
+    }
+    else {
+      m_pendingOwnLines.push_back(
+        std::make_pair(numLines(), m_ownBytes.size()));
+      if (len > 0) {
+        m_ownBytes.append(bytes, len);
+      }
+      m_lineStarts.push_back(nullptr);
+    }
+    m_lineLengths.push_back(len);
+  }
+
+  // Called after the last `appendLine`.
+  void finish()
+  {
+    for (auto const &lineAndOffset : m_pendingOwnLines) {
+      m_lineStarts[lineAndOffset.first] =
+        m_ownBytes.data() + lineAndOffset.second;
+    }
+    m_pendingOwnLines.clear();
+    m_pendingOwnLines.shrink_to_fit();
+  }
+};
+
+
+// ----------------------- TextDocumentSnapshot ------------------------
+TextDocumentSnapshot::TextDocumentSnapshot()
+  : m_chunks(),
+    m_numLines(0),
+    m_contentDigest(0)
+{}
+
+
+TextDocumentSnapshot::~TextDocumentSnapshot()
+{}
+
+
+void TextDocumentSnapshot::appendChunk(std::shared_ptr<Chunk const> chunk)
+{
+  int const n = chunk->numLines();
+  m_chunks.push_back(ChunkRef{std::move(chunk), m_numLines});
+  m_numLines += n;
+}
+
+
+void TextDocumentSnapshot::appendChunksOf(
+  TextDocumentSnapshot const &src, int begin, int end)
+{
+  for (int i=begin; i < end; ++i) {
+    appendChunk(src.m_chunks[i].m_chunk);
+  }
+}
+
+
+void TextDocumentSnapshot::appendLine(
+  std::shared_ptr<Chunk> &pending, char const *bytes, std::size_t len,
+  std::shared_ptr<char const> block)
+{
+  if (pending && pending->numLines() == LINES_PER_CHUNK) {
+    flushChunk(pending);
+  }
+  if (!pending) {
+    pending.reset(new Chunk);
+  }
+  pending->appendLine(bytes, len, std::move(block));
+}
+
+
+void TextDocumentSnapshot::flushChunk(std::shared_ptr<Chunk> &pending)
+{
+  if (pending) {
+    pending->finish();
+    appendChunk(std::move(pending));
+    pending.reset();
+  }
+}
+
+
+void TextDocumentSnapshot::computeDigest()
+{
+  std::uint64_t sum = 0;
+  for (ChunkRef const &ref : m_chunks) {
+    sum += ref.m_chunk->m_hashSum * digestPower(ref.m_firstLine);
+  }
+  m_contentDigest = finishContentDigest(sum, m_numLines);
+}
+
+
+int TextDocumentSnapshot::chunkIndexOf(LineIndex line) const
+{
+  xassertPrecondition(validLine(line));
+
+  // Find the first chunk that starts after `line`; the one before it
+  // contains `line`.
+  auto it = std::upper_bound(m_chunks.begin(), m_chunks.end(), line.get(),
+    [](int l, ChunkRef const &ref) -> bool {
+      return l < ref.m_firstLine;
+    });
+  xassert(it != m_chunks.begin());
+  return (int)(it - m_chunks.begin()) - 1;
+}
+
+
+TextDocumentSnapshot::Chunk const &TextDocumentSnapshot::chunkFor(
+  LineIndex line, int &indexInChunk) const
+{
+  ChunkRef const &ref = m_chunks[chunkIndexOf(line)];
+  indexInChunk = line.get() - ref.m_firstLine;
+  return *ref.m_chunk;
+}
+
+
+/*static*/ std::shared_ptr<TextDocumentSnapshot const>
+TextDocumentSnapshot::fromDocument(
+  TextDocumentCore const &doc,
+  TextDocumentSnapshot const *prev,
+  LineCount samePrefix,
+  LineCount sameSuffix)
+{
+  int const newNumLines = doc.numLines().get();
+  std::shared_ptr<TextDocumentSnapshot> ret(new TextDocumentSnapshot);
+
+  // The chunks of `prev` in [0,frontChunks) hold its first
+  // `frontLines` lines, and those in [backChunk,numChunks) hold its
+  // last `backLines`.  Those are shared.
+  int frontChunks = 0;
+  int frontLines = 0;
+  int backChunk = 0;
+  int backLines = 0;
+  if (prev) {
+    xassertPrecondition(samePrefix.get() + sameSuffix.get() <=
+                        std::min(newNumLines, prev->m_numLines));
+
+    std::vector<ChunkRef> const &prevChunks = prev->m_chunks;
+    int const numPrevChunks = (int)prevChunks.size();
+
+    while (frontChunks < numPrevChunks) {
+      int const n = prevChunks[frontChunks].m_chunk->numLines();
+      if (frontLines + n > samePrefix.get()) {
+        break;
+      }
+      frontLines += n;
+      ++frontChunks;
+    }
+
+    int const suffixStart = prev->m_numLines - sameSuffix.get();
+    backChunk = numPrevChunks;
+    while (backChunk > frontChunks &&
+           prevChunks[backChunk-1].m_firstLine >= suffixStart) {
+      --backChunk;
+      backLines += prevChunks[backChunk].m_chunk->numLines();
+    }
+
+    ret->appendChunksOf(*prev, 0, frontChunks);
+  }
+
+  // Get the lines in between from `doc`.  Where possible, they refer
+  // to the document's storage rather than copying it.
+  ArrayStack<char> scratch;
+  std::shared_ptr<Chunk> pending;
+  for (int i = frontLines; i < newNumLines - backLines; ++i) {
+    std::shared_ptr<char const> block;
+    char const *bytes =
+      doc.getLineBytesAndBlock(LineIndex(i), scratch, block /*OUT*/);
+    ret->appendLine(pending, bytes,
+                    doc.lineLengthBytes(LineIndex(i)).get(),
+                    std::move(block));
+  }
+  ret->flushChunk(pending);
+
+  if (prev) {
+    ret->appendChunksOf(*prev, backChunk, prev->numChunks());
+  }
+
+  xassert(ret->m_numLines == newNumLines);
+  ret->computeDigest();
+  return ret;
+}
+
+
+/*static*/ std::shared_ptr<TextDocumentSnapshot const>
+TextDocumentSnapshot::fromDocument(TextDocumentCore const &doc)
+{
+  return fromDocument(doc, nullptr, LineCount(0), LineCount(0));
+}
+
+
+std::shared_ptr<TextDocumentSnapshot const>
+TextDocumentSnapshot::withLineReplaced(
+  LineIndex line, std::string const &newContents) const
+{
+  xassertPrecondition(validLine(line));
+  xassertPrecondition(newContents.find('\n') == std::string::npos);
+
+  int const chunkIndex = chunkIndexOf(line);
+  ChunkRef const &ref = m_chunks[chunkIndex];
+
+  std::shared_ptr<TextDocumentSnapshot> ret(new TextDocumentSnapshot);
+  ret->appendChunksOf(*this, 0, chunkIndex);
+
+  // The other lines of the chunk are copied, which is simpler than
+  // working out which of them could be shared.
+  std::shared_ptr<Chunk> pending;
+  for (int i=0; i < ref.m_chunk->numLines(); ++i) {
+    if (ref.m_firstLine + i == line.get()) {
+      ret->appendLine(pending, newContents.data(), newContents.size(),
+                      nullptr);
+    }
+    else {
+      ret->appendLine(pending, ref.m_chunk->lineBytes(i),
+                      ref.m_chunk->lineLength(i), nullptr);
+    }
+  }
+  ret->flushChunk(pending);
+
+  ret->appendChunksOf(*this, chunkIndex+1, numChunks());
+
+  ret->computeDigest();
+  return ret;
+}
+
+
+void TextDocumentSnapshot::selfCheck() const
+{
+  xassert(!m_chunks.empty());
+
+  int firstLine = 0;
+  for (ChunkRef const &ref : m_chunks) {
+    xassert(ref.m_chunk != nullptr);
+    xassert(ref.m_firstLine == firstLine);
+
+    Chunk const &chunk = *ref.m_chunk;
+    int const n = chunk.numLines();
+    xassert(0 < n && n <= LINES_PER_CHUNK);
+    xassert(chunk.m_lineLengths.size() == chunk.m_lineStarts.size());
+    xassert(chunk.m_pendingOwnLines.empty());
+    for (int i=0; i < n; ++i) {
+      xassert(chunk.lineBytes(i) != nullptr);
+    }
+
+    firstLine += n;
+  }
+  xassert(firstLine == m_numLines);
+}
+
+
+ByteCount TextDocumentSnapshot::lineLengthBytes(LineIndex line) const
+{
+  int i;
+  Chunk const &chunk = chunkFor(line, i /*OUT*/);
+  return ByteCount(safeToInt(chunk.lineLength(i)));
+}
+
+
+std::string TextDocumentSnapshot::getWholeLineString(LineIndex line) const
+{
+  int i;
+  Chunk const &chunk = chunkFor(line, i /*OUT*/);
+  return std::string(chunk.lineBytes(i), chunk.lineLength(i));
+}
+
+
+char const *TextDocumentSnapshot::lineBytes(
+  LineIndex line, std::size_t &length) const
+{
+  int i;
+  Chunk const &chunk = chunkFor(line, i /*OUT*/);
+  length = chunk.lineLength(i);
+  return chunk.lineBytes(i);
+}
+
+
+std::string TextDocumentSnapshot::getWholeLineStringOrRangeErrorMessage(
+  LineIndex lineIndex,
+  std::string const &fname) const
+{
+  if (validLine(lineIndex)) {
+    return getWholeLineString(lineIndex);
+  }
+  else {
+    return TextDocumentCore::lineRangeErrorMessage(
+      lineIndex, fname, numLines());
+  }
+}
+
+
+std::string TextDocumentSnapshot::getWholeFileString() const
+{
+  std::size_t size = m_numLines - 1;
+  for (ChunkRef const &ref : m_chunks) {
+    size += ref.m_chunk->totalBytes();
+  }
+
+  std::string ret;
+  ret.reserve(size);
+  bool first = true;
+  for (ChunkRef const &ref : m_chunks) {
+    Chunk const &chunk = *ref.m_chunk;
+    for (int i=0; i < chunk.numLines(); ++i) {
+      if (!first) {
+        ret += '\n';
+      }
+      first = false;
+      ret.append(chunk.lineBytes(i), chunk.lineLength(i));
+    }
+  }
+  return ret;
+}
+
+
+int TextDocumentSnapshot::numChunksSharedWith(
+  TextDocumentSnapshot const &other) const
+{
+  std::set<Chunk const *> otherChunks;
+  for (ChunkRef const &ref : other.m_chunks) {
+    otherChunks.insert(ref.m_chunk.get());
+  }
+
+  int ret = 0;
+  for (ChunkRef const &ref : m_chunks) {
+    if (otherChunks.count(ref.m_chunk.get())) {
+      ++ret;
+    }
+  }
+  return ret;
+}
+
+
+std::size_t TextDocumentSnapshot::numCopiedBytes() const
+{
+  std::size_t ret = 0;
+  for (ChunkRef const &ref : m_chunks) {
+    ret += ref.m_chunk->m_ownBytes.size();
+  }
+  return ret;
+}
+
+
+// EOF
@@ -0,0 +1,215 @@
+// td-snapshot.h
+// `TextDocumentSnapshot`, an immutable copy of document contents.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_TD_SNAPSHOT_H
+#define EDITOR_TD_SNAPSHOT_H
+
+#include "td-snapshot-fwd.h"           // fwds for this module
+
+#include "byte-count.h"                // ByteCount
+#include "line-count.h"                // LineCount
+#include "line-index.h"                // LineIndex
+#include "positive-line-count.h"       // PositiveLineCount
+#include "td-core-fwd.h"               // TextDocumentCore [n]
+
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint64_t
+#include <memory>                      // std::shared_ptr
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+/* The sequence of lines of a `TextDocumentCore` at some moment.
+
+   A snapshot is created by `TextDocumentCore::snapshot()` and is never
+   modified afterward, so it can be held by any number of clients, such
+   as the LSP client recording what it last sent to the server, and
+   read from other threads, while the document continues to be edited.
+   Snapshots are always handled through
+   `std::shared_ptr<TextDocumentSnapshot const>`.
+
+   A snapshot does not copy the line contents.  The document never
+   modifies the bytes of a line in place, but allocates new storage for
+   the new contents, so a snapshot just points at the storage of each
+   line and holds the `LineByteArena` blocks containing it, which keeps
+   those bytes valid after the document frees them (see
+   `LineByteArena::blockContaining`).  Likewise, the lines of a mapped
+   file (see `TextDocumentCore::replaceWithMappedFile`) point into the
+   mapping, which the snapshot shares.  Only the line being edited is
+   copied.  Thus a snapshot costs about two words per line, plus
+   whatever storage of edited lines or mappings it keeps alive.
+
+   The lines are grouped into chunks of up to `LINES_PER_CHUNK` lines,
+   and a chunk is itself immutable and shared.  When a document takes
+   a new snapshot, the chunks of its previous one that lie entirely
+   before the first line edited since then, or entirely after the last
+   one, are shared rather than rebuilt.  Hence, after typing within a
+   few nearby lines, a new snapshot costs one copy of the chunk
+   pointers plus rebuilding a chunk or two.
+
+   Each chunk also carries its part of the sum from which the content
+   digest (see `content-digest.h`) is computed, so the digest of a
+   snapshot is available without hashing the shared chunks again.
+*/
+class TextDocumentSnapshot {
+  NO_OBJECT_COPIES(TextDocumentSnapshot);
+
+public:      // class data
+  // Maximum number of lines in one chunk.
+  static int const LINES_PER_CHUNK = 64;
+
+private:     // types
+  // A run of consecutive lines.  Defined in `td-snapshot.cc`.
+  class Chunk;
+
+  // A chunk and where it goes in this snapshot.
+  struct ChunkRef {
+    // Never null.
+    std::shared_ptr<Chunk const> m_chunk;
+
+    // Index of the chunk's first line in this snapshot.
+    int m_firstLine;
+  };
+
+private:     // data
+  // The chunks, in order.  Their lines, concatenated, are the lines of
+  // the snapshot.  Never empty, and no chunk is empty.
+  std::vector<ChunkRef> m_chunks;
+
+  // Total number of lines.
+  int m_numLines;
+
+  // `textContentDigest` of the contents.
+  std::uint64_t m_contentDigest;
+
+private:     // funcs
+  // Empty, to be filled in by the factory functions.
+  TextDocumentSnapshot();
+
+  // Append `chunk` to `m_chunks`.
+  void appendChunk(std::shared_ptr<Chunk const> chunk);
+
+  // Append the `len` bytes at `bytes` as a line of `pending`, first
+  // moving `pending` to `m_chunks` if it is full.  If `pending` is
+  // null, start a new chunk.  If `block` is not null, it contains the
+  // bytes, which are then referenced rather than copied.
+  void appendLine(std::shared_ptr<Chunk> &pending /*INOUT*/,
+                  char const *bytes, std::size_t len,
+                  std::shared_ptr<char const> block);
+
+  // If `pending` is not null, move it to `m_chunks`.
+  void flushChunk(std::shared_ptr<Chunk> &pending /*INOUT*/);
+
+  // Append the chunks of `src` in [begin,end).
+  void appendChunksOf(TextDocumentSnapshot const &src, int begin, int end);
+
+  // Set `m_contentDigest` from the chunks.
+  void computeDigest();
+
+  // Index into `m_chunks` of the chunk containing `line`.
+  //
+  // Requires: validLine(line)
+  int chunkIndexOf(LineIndex line) const;
+
+  // Return the chunk containing `line`, and set `indexInChunk` to the
+  // line's position within it.
+  //
+  // Requires: validLine(line)
+  Chunk const &chunkFor(LineIndex line, int &indexInChunk /*OUT*/) const;
+
+public:      // funcs
+  ~TextDocumentSnapshot();
+
+  // Return a snapshot of the contents of `doc`.
+  //
+  // If `prev` is not null, it is an earlier snapshot of the same
+  // document, and the caller promises that the first `samePrefix`
+  // lines and the last `sameSuffix` lines of `doc` are the same as
+  // those of `prev`.  Chunks of `prev` that lie entirely within those
+  // lines are shared with the result.
+  //
+  // Requires: samePrefix + sameSuffix <= min(doc.numLines(),
+  //                                          prev->numLines())
+  static std::shared_ptr<TextDocumentSnapshot const> fromDocument(
+    TextDocumentCore const &doc,
+    TextDocumentSnapshot const *prev,
+    LineCount samePrefix,
+    LineCount sameSuffix);
+
+  // Same, without a previous snapshot.
+  static std::shared_ptr<TextDocumentSnapshot const> fromDocument(
+    TextDocumentCore const &doc);
+
+  // Return a snapshot that is the same as this one except that line
+  // `line` has `newContents`, which must not contain a newline.  All
+  // chunks except the one containing `line` are shared.
+  //
+  // Requires: validLine(line)
+  std::shared_ptr<TextDocumentSnapshot const> withLineReplaced(
+    LineIndex line, std::string const &newContents) const;
+
+  // Assert invariants.
+  void selfCheck() const;
+
+  // Number of lines, always at least 1.
+  PositiveLineCount numLines() const
+    { return PositiveLineCount(m_numLines); }
+
+  // True if `line` is within range.
+  bool validLine(LineIndex line) const
+    { return line.get() < m_numLines; }
+
+  // Length of `line` in bytes, not including any newline.
+  //
+  // Requires: validLine(line)
+  ByteCount lineLengthBytes(LineIndex line) const;
+
+  // Contents of `line`, not including any newline.
+  //
+  // Requires: validLine(line)
+  std::string getWholeLineString(LineIndex line) const;
+
+  // Bytes of `line`, not including any newline and not NUL-terminated,
+  // and set `length` to their number.  They remain valid as long as
+  // the snapshot does, so they can be read in place, for example by a
+  // search running on another thread.
+  //
+  // Requires: validLine(line)
+  char const *lineBytes(LineIndex line, std::size_t &length /*OUT*/) const;
+
+  // If `validLine(lineIndex)`, return `getWholeLineString(lineIndex)`.
+  // Otherwise, return the message from
+  // `TextDocumentCore::lineRangeErrorMessage`.
+  std::string getWholeLineStringOrRangeErrorMessage(
+    LineIndex lineIndex,
+    std::string const &fname) const;
+
+  // The lines joined with newline separators, as in
+  // `TextDocumentCore::getWholeFileString()`.
+  std::string getWholeFileString() const;
+
+  // Equal to `TextDocumentCore::contentDigest()` for a document with
+  // the same contents.  This is O(1).
+  std::uint64_t contentDigest() const
+    { return m_contentDigest; }
+
+  // Number of chunks, for testing.
+  int numChunks() const
+    { return (int)m_chunks.size(); }
+
+  // Number of chunks of this snapshot that are also chunks of `other`,
+  // for testing.
+  int numChunksSharedWith(TextDocumentSnapshot const &other) const;
+
+  // Number of bytes of line contents that were copied into this
+  // snapshot rather than referring to the document's storage, for
+  // testing.
+  std::size_t numCopiedBytes() const;
+};
+
+
+#endif // EDITOR_TD_SNAPSHOT_H
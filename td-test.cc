@@ -13,6 +13,9 @@
 #include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
 #include "smbase/sm-test.h"            // EXPECT_EQ
 
+#include <cstring>                     // std::strlen
+#include <vector>                      // std::vector
+
 using namespace gdv;
 
 
@@ -134,6 +137,72 @@ void test_applyRangeTextReplacement()
 }
 
 
+// Counts the whole-document changes it sees.
+class TotalChangeCounter : public TextDocumentObserver {
+public:      // data
+  int m_totalChanges = 0;
+
+public:      // methods
+  virtual void observeTotalChange(TextDocumentCore const &) NOEXCEPT override
+  {
+    ++m_totalChanges;
+  }
+};
+
+
+void testOne_updateWholeFile(
+  char const *oldText,
+  char const *newText,
+  int expectHistorySteps)
+{
+  TEST_CASE_EXPRS("testOne_updateWholeFile", oldText, newText);
+
+  TextDocument doc;
+  doc.replaceWholeFileString(oldText);
+  EXPECT_EQ(doc.historyLength(), 0);
+
+  TotalChangeCounter counter;
+  doc.addObserver(&counter);
+
+  doc.updateWholeFile(
+    std::vector<unsigned char>(newText, newText + std::strlen(newText)));
+  EXPECT_EQ(doc.getWholeFileString(), newText);
+  EXPECT_EQ(counter.m_totalChanges, 0);
+  EXPECT_EQ(doc.unsavedChanges(), false);
+
+  // The whole update is one undo step.
+  EXPECT_EQ(doc.historyLength(), expectHistorySteps);
+  if (expectHistorySteps) {
+    doc.undo();
+    EXPECT_EQ(doc.getWholeFileString(), oldText);
+    EXPECT_EQ(doc.unsavedChanges(), true);
+    doc.redo();
+    EXPECT_EQ(doc.getWholeFileString(), newText);
+    EXPECT_EQ(doc.unsavedChanges(), false);
+  }
+
+  doc.removeObserver(&counter);
+}
+
+
+void test_updateWholeFile()
+{
+  testOne_updateWholeFile("", "", 0);
+  testOne_updateWholeFile("a\nb\n", "a\nb\n", 0);
+  testOne_updateWholeFile("", "x\n", 1);
+  testOne_updateWholeFile("x\n", "", 1);
+  testOne_updateWholeFile("a", "b", 1);
+  testOne_updateWholeFile("a\nb\nc\n", "a\nB\nc\n", 1);
+  testOne_updateWholeFile("b\nc\n", "a\nb\nc\n", 1);
+  testOne_updateWholeFile("a\nb\nc\n", "a\nc\n", 1);
+  testOne_updateWholeFile("a\nb", "a\nb\nc", 1);
+  testOne_updateWholeFile("a\nb\nc", "a", 1);
+  testOne_updateWholeFile("a\nb\nc", "a\nb\nc\n", 1);
+  testOne_updateWholeFile("a\nb\nc\n", "a\nb\nc", 1);
+  testOne_updateWholeFile("1\n2\n3\n4\n5\n6\n", "0\n1\n3\n4\nx\n6\n7", 1);
+}
+
+
 CLOSE_ANONYMOUS_NAMESPACE
 
 
@@ -142,6 +211,7 @@ void test_td(CmdlineArgsSpan args)
 {
   test_replaceMultilineRange();
   test_applyRangeTextReplacement();
+  test_updateWholeFile();
 }
 
 
@@ -6,6 +6,7 @@
 #include "byte-count.h"                // strlenBC, sizeBC
 #include "history.h"                   // HE_text
 #include "range-text-repl.h"           // RangeTextReplacement
+#include "text-diff.h"                 // diffLines, splitTextLines
 
 // smbase
 #include "smbase/chained-cond.h"       // smbase::cc::{le_le, z_le_le}
@@ -13,10 +14,15 @@
 #include "smbase/gdvalue.h"            // gdv::GDValue
 #include "smbase/mysig.h"              // printSegfaultAddrs
 #include "smbase/objcount.h"           // CHECK_OBJECT_COUNT
+#include "smbase/overflow.h"           // safeToInt
 #include "smbase/sm-macros.h"          // DEFINE_ENUMERATION_TO_STRING_OR
 #include "smbase/string-util.h"        // stringToVectorOfUChar
 #include "smbase/trace.h"              // TRACE
 
+// libc++
+#include <string>                      // std::string
+#include <string_view>                 // std::string_view
+
 using namespace gdv;
 using namespace smbase;
 
@@ -73,6 +79,7 @@ TextDocument::~TextDocument()
 void TextDocument::selfCheck() const
 {
   m_core.selfCheck();
+  m_history.selfCheck();
 
   xassert(cc::z_le_le(m_historyIndex, m_history.seqLength()));
 
@@ -98,7 +105,7 @@ void TextDocument::clearHistory()
 {
   m_historyIndex = 0;
   m_savedHistoryIndex = -1;     // no historyIndex is known to correspond to on-disk
-  m_history.truncate(m_historyIndex);
+  m_history.clear();
   m_groupStack.clear();
 
   this->m_core.notifyMetadataChange();
@@ -185,6 +192,109 @@ void TextDocument::replaceWholeFileString(std::string const &str)
 }
 
 
+// Largest number of inserted plus deleted lines for which
+// `updateWholeFile` searches for a minimal set of edits.  Beyond this,
+// the changed region is replaced as a block, which is still better
+// than replacing the whole document.
+static std::size_t const UPDATE_MAX_EDIT_DISTANCE = 2000;
+
+// Approximate number of search steps `updateWholeFile` will spend on
+// the UI thread.  The search time is the edit distance times the size
+// of the changed region, so for a large region this lowers the edit
+// distance limit, keeping the cost to tens of milliseconds rather than
+// letting it grow quadratically on files that are mostly different.
+static std::size_t const UPDATE_MAX_DIFF_WORK = 20000000;
+
+
+void TextDocument::updateWholeFile(std::vector<unsigned char> const &bytes)
+{
+  if (m_core.isMapped()) {
+    replaceWholeFile(bytes);
+    return;
+  }
+
+  std::string_view newText(
+    reinterpret_cast<char const *>(bytes.data()), bytes.size());
+  std::vector<std::string_view> newLines = splitTextLines(newText);
+
+  std::size_t const oldNumLines = m_core.numLines().get();
+  std::vector<TextDiffHunk> hunks;
+  {
+    // Only the most recently edited line gets copied into `scratch`,
+    // so the other views remain valid while we collect them.
+    ArrayStack<char> scratch;
+    std::vector<std::string_view> oldLines;
+    oldLines.reserve(oldNumLines);
+    FOR_EACH_LINE_INDEX_IN(line, m_core) {
+      oldLines.push_back(std::string_view(
+        m_core.getLineBytes(line, scratch),
+        m_core.lineLengthBytes(line).get()));
+    }
+
+    hunks = diffLines(oldLines, newLines, UPDATE_MAX_EDIT_DISTANCE,
+                      UPDATE_MAX_DIFF_WORK);
+  }
+
+  // Byte offset in `bytes` of the start of new line `i`, where the
+  // line after the last is regarded as starting after a newline.
+  auto newLineStart = [&](std::size_t i) -> std::size_t {
+    return i < newLines.size()?
+             static_cast<std::size_t>(newLines[i].data() - newText.data()) :
+             bytes.size() + 1;
+  };
+
+  if (!hunks.empty()) {
+    TextDocumentHistoryGrouper grouper(*this);
+
+    // Go from the bottom up so the line numbers of the hunks not yet
+    // applied are unaffected.
+    for (auto it = hunks.rbegin(); it != hunks.rend(); ++it) {
+      TextDiffHunk const &hunk = *it;
+      LineIndex const oldStart(safeToInt(hunk.m_oldStart));
+      std::size_t const oldEnd = hunk.m_oldStart + hunk.m_oldCount;
+      std::size_t const newEnd = hunk.m_newStart + hunk.m_newCount;
+
+      if (oldEnd < oldNumLines) {
+        // Replace whole lines, including their newlines.  There are
+        // unchanged lines after this hunk, so `newEnd` is a line.
+        LineIndex const oldEndLine(safeToInt(oldEnd));
+        std::size_t const begin = newLineStart(hunk.m_newStart);
+        replaceMultilineRange(
+          TextMCoordRange(lineBeginCoord(oldStart),
+                          lineBeginCoord(oldEndLine)),
+          std::string(newText.substr(begin, newLineStart(newEnd) - begin)));
+      }
+      else if (hunk.m_oldStart > 0) {
+        // The hunk extends to the end, so there is no newline after it
+        // to replace.  Instead, replace the one before it, which is
+        // the same in both texts.
+        std::size_t const begin = newLineStart(hunk.m_newStart) - 1;
+        replaceMultilineRange(
+          TextMCoordRange(lineEndCoord(oldStart.pred()), endCoord()),
+          std::string(newText.substr(begin)));
+      }
+      else {
+        // Everything changed.
+        replaceMultilineRange(
+          TextMCoordRange(beginCoord(), endCoord()),
+          std::string(newText));
+      }
+    }
+  }
+
+  this->noUnsavedChanges();
+}
+
+
+void TextDocument::replaceWithMappedFile(std::string const &fname)
+{
+  this->m_core.replaceWithMappedFile(fname);
+
+  this->clearHistory();
+  this->noUnsavedChanges();
+}
+
+
 void TextDocument::setDocumentProcessStatus(DocumentProcessStatus status)
 {
   xassert(m_groupStack.isEmpty());
@@ -8,7 +8,8 @@
 
 // editor
 #include "byte-count.h"                // ByteCount
-#include "history.h"                   // HE_group
+#include "history.h"                   // HE_group, HistoryStats
+#include "history-store.h"             // HistoryStore
 #include "line-count.h"                // LineCount
 #include "line-index.h"                // LineIndex
 #include "positive-line-count.h"       // PositiveLineCount
@@ -25,6 +26,7 @@
 #include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
 
 // libc++
+#include <cstddef>                     // std::size_t
 #include <vector>                      // std::vector
 
 
@@ -64,8 +66,9 @@ private:      // data
   // The sequence of text lines without any history information.
   TextDocumentCore m_core;
 
-  // modification history
-  HE_group m_history;
+  // modification history, with older elements compressed or
+  // spilled to disk to stay within a memory budget
+  HistoryStore m_history;
 
   // where are we in that history?  usually,
   // historyIndex==history.seqLength(), meaning we're at the end of the
@@ -163,6 +166,9 @@ public:      // funcs
   LineCount numLinesExcludingFinalEmpty() const              { return m_core.numLinesExcludingFinalEmpty(); }
   bool walkCoordBytes(TextMCoord &tc, ByteDifference distance) const { return m_core.walkCoordBytes(tc, distance); }
   ByteCount countBytesInRange(TextMCoordRange const &range) const { return m_core.countBytesInRange(range); }
+  ByteCount totalBytes() const                               { return m_core.totalBytes(); }
+  ByteCount byteOffsetOf(TextMCoord tc) const                { return m_core.byteOffsetOf(tc); }
+  TextMCoord coordAtByteOffset(ByteCount offset) const       { return m_core.coordAtByteOffset(offset); }
   bool adjustMCoord(TextMCoord /*INOUT*/ &tc) const          { return m_core.adjustMCoord(tc); }
   bool adjustMCoordRange(TextMCoordRange /*INOUT*/ &range) const { return m_core.adjustMCoordRange(range); }
   void getPartialLine(TextMCoord tc, ArrayStack<char> /*INOUT*/ &dest, ByteCount numBytes) const { return m_core.getPartialLine(tc, dest, numBytes); }
@@ -176,6 +182,19 @@ public:      // funcs
   // This is a modification of sorts, but does not need undo/redo.
   void bumpVersionNumber()                                   { m_core.bumpVersionNumber(); }
 
+  // Likewise, these only change the internal representation.
+  void compactLineStorage()                                  { m_core.compactLineStorage(); }
+  bool compactLineStorageSlice(LineCount maxLines)           { return m_core.compactLineStorageSlice(maxLines); }
+
+  bool isMapped() const                                      { return m_core.isMapped(); }
+  bool detachMappedFile()                                    { return m_core.detachMappedFile(); }
+
+  // Extending the line index of a mapped file appends lines that were
+  // in the file all along, so it is not recorded in the history.
+  bool lineIndexIsProvisional() const                        { return m_core.lineIndexIsProvisional(); }
+  bool extendLineIndex(std::size_t maxBytes)                 { return m_core.extendLineIndex(maxBytes); }
+  void completeLineIndex()                                   { m_core.completeLineIndex(); }
+
   // ---------------------- extra attributes ----------------------
   DocumentProcessStatus documentProcessStatus() const
     { return m_documentProcessStatus; }
@@ -203,7 +222,23 @@ public:      // funcs
   std::string getWholeFileString() const;
   void replaceWholeFileString(std::string const &str);
 
-  // Change the 'm_documentProcessStatus' setting.  Setting it to a
+  // Change the file contents to `bytes` by editing only the lines that
+  // differ, as computed by `diffLines`.  Unlike `replaceWholeFile`,
+  // observers see ordinary edits, so whatever they have computed about
+  // the unchanged lines remains valid, and the change is one step in
+  // the undo history.  Afterward, the contents are regarded as those
+  // on disk, as with `noUnsavedChanges`.
+  //
+  // If the document is mapped, this just does `replaceWholeFile`,
+  // since the mapped file may have changed underneath it.
+  void updateWholeFile(std::vector<unsigned char> const &bytes);
+
+  // Replace the file contents with those of the file `fname`, mapped
+  // into memory.  See `TextDocumentCore::replaceWithMappedFile`.  This
+  // clears the history like `replaceWholeFile`.
+  void replaceWithMappedFile(std::string const &fname);
+
+  // Change the 'm_documentProcessStatus'' setting.  Setting it to a
   // value DPS_RUNNING will set the document as read-only and
   // immediately discard all undo/redo history.  There must not be any
   // open history groups.
@@ -303,6 +338,10 @@ public:      // funcs
     { m_history.stats(stats); }
   void printHistoryStats() const;
 
+  // Set the memory budget for the history.  0 means unlimited.
+  void setHistoryMemoryBudget(std::size_t bytes)
+    { m_history.setMemoryBudget(bytes); }
+
   // ---------------------- iterator ----------------------------
 public:      // types
   // Iterate over the bytes in a line.
@@ -0,0 +1,251 @@
+// text-diff-test.cc
+// Tests for `text-diff` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "text-diff.h"                 // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/nonport.h"            // getMilliseconds
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, DIAG
+#include "smbase/stringb.h"            // stringb
+#include "smbase/xassert.h"            // xassert
+
+#include <algorithm>                   // std::max
+#include <cstdlib>                     // std::rand, std::srand
+#include <string>                      // std::string
+#include <string_view>                 // std::string_view
+#include <vector>                      // std::vector
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+std::vector<std::string_view> views(std::vector<std::string> const &v)
+{
+  return std::vector<std::string_view>(v.begin(), v.end());
+}
+
+
+// Render `hunks` like "[1,2,1,0][5,0,4,1]" for comparison.
+std::string hunksString(std::vector<TextDiffHunk> const &hunks)
+{
+  std::string ret;
+  for (TextDiffHunk const &h : hunks) {
+    ret += stringb("[" << h.m_oldStart << "," << h.m_oldCount << "," <<
+                   h.m_newStart << "," << h.m_newCount << "]");
+  }
+  return ret;
+}
+
+
+// Check that applying `hunks` to `oldLines` yields `newLines`, and that
+// the hunks satisfy the other guarantees of `diffLines`.
+void checkHunks(std::vector<std::string> const &oldLines,
+                std::vector<std::string> const &newLines,
+                std::vector<TextDiffHunk> const &hunks)
+{
+  std::vector<std::string> result;
+  std::size_t oldIndex = 0;
+  for (TextDiffHunk const &h : hunks) {
+    xassert(h.m_oldCount + h.m_newCount > 0);
+
+    // Unchanged lines are equal and aligned.
+    if (oldIndex > 0) {
+      xassert(h.m_oldStart > oldIndex);
+    }
+    xassert(h.m_oldStart - oldIndex == h.m_newStart - result.size());
+    for (; oldIndex < h.m_oldStart; ++oldIndex) {
+      xassert(oldLines.at(oldIndex) == newLines.at(result.size()));
+      result.push_back(oldLines.at(oldIndex));
+    }
+
+    for (std::size_t i=0; i < h.m_newCount; ++i) {
+      result.push_back(newLines.at(h.m_newStart + i));
+    }
+    oldIndex += h.m_oldCount;
+  }
+  for (; oldIndex < oldLines.size(); ++oldIndex) {
+    result.push_back(oldLines.at(oldIndex));
+  }
+
+  xassert(result == newLines);
+}
+
+
+void testOne(std::vector<std::string> const &oldLines,
+             std::vector<std::string> const &newLines,
+             char const *expect)
+{
+  std::vector<TextDiffHunk> hunks =
+    diffLines(views(oldLines), views(newLines), 100);
+  checkHunks(oldLines, newLines, hunks);
+  EXPECT_EQ(hunksString(hunks), std::string(expect));
+}
+
+
+void testSimple()
+{
+  testOne({}, {}, "");
+  testOne({"a"}, {"a"}, "");
+  testOne({}, {"a"}, "[0,0,0,1]");
+  testOne({"a"}, {}, "[0,1,0,0]");
+  testOne({"a", "b", "c"}, {"a", "B", "c"}, "[1,1,1,1]");
+  testOne({"a", "b", "c"}, {"a", "c"}, "[1,1,1,0]");
+  testOne({"a", "c"}, {"a", "b", "c"}, "[1,0,1,1]");
+  testOne({"a", "b", "c", "d", "e"}, {"x", "b", "c", "d", "y"},
+          "[0,1,0,1][4,1,4,1]");
+
+  // A line moved from the front to the back.
+  testOne({"a", "b", "c", "d"}, {"b", "c", "d", "a"},
+          "[0,1,0,0][4,0,3,1]");
+}
+
+
+// When the distance limit is exceeded, the middle becomes one hunk.
+void testLimit()
+{
+  std::vector<std::string> oldLines{"p", "a", "b", "c", "d", "s"};
+  std::vector<std::string> newLines{"p", "a", "X", "c", "Y", "s"};
+
+  std::vector<TextDiffHunk> hunks =
+    diffLines(views(oldLines), views(newLines), 100);
+  EXPECT_EQ(hunksString(hunks), std::string("[2,1,2,1][4,1,4,1]"));
+
+  hunks = diffLines(views(oldLines), views(newLines), 3);
+  checkHunks(oldLines, newLines, hunks);
+  EXPECT_EQ(hunksString(hunks), std::string("[2,3,2,3]"));
+
+  // The work limit scales the distance limit by the size of the
+  // middle, here 3+3 lines, whose edit distance is 4.
+  hunks = diffLines(views(oldLines), views(newLines), 100, 6*4);
+  EXPECT_EQ(hunksString(hunks), std::string("[2,1,2,1][4,1,4,1]"));
+
+  hunks = diffLines(views(oldLines), views(newLines), 100, 6*4 - 1);
+  checkHunks(oldLines, newLines, hunks);
+  EXPECT_EQ(hunksString(hunks), std::string("[2,3,2,3]"));
+}
+
+
+// Minimal number of inserted plus deleted lines, by dynamic
+// programming over the longest common subsequence.
+std::size_t editDistance(std::vector<std::string> const &oldLines,
+                         std::vector<std::string> const &newLines)
+{
+  std::size_t const n = oldLines.size();
+  std::size_t const m = newLines.size();
+  std::vector<std::vector<std::size_t>> lcs(
+    n+1, std::vector<std::size_t>(m+1, 0));
+  for (std::size_t i=1; i <= n; ++i) {
+    for (std::size_t j=1; j <= m; ++j) {
+      lcs[i][j] = (oldLines[i-1] == newLines[j-1])?
+                    lcs[i-1][j-1] + 1 :
+                    std::max(lcs[i-1][j], lcs[i][j-1]);
+    }
+  }
+  return n + m - 2*lcs[n][m];
+}
+
+
+// Total number of lines removed and added by `hunks`.
+std::size_t hunksEdits(std::vector<TextDiffHunk> const &hunks)
+{
+  std::size_t ret = 0;
+  for (TextDiffHunk const &h : hunks) {
+    ret += h.m_oldCount + h.m_newCount;
+  }
+  return ret;
+}
+
+
+// Compare random sequences over a small alphabet, which have many
+// coincidental matches.
+void testRandom()
+{
+  std::srand(1);
+  for (int iter=0; iter < 2000; ++iter) {
+    std::vector<std::string> oldLines, newLines;
+    int oldSize = std::rand() % 15;
+    int newSize = std::rand() % 15;
+    for (int i=0; i < oldSize; ++i) {
+      oldLines.push_back(std::string(1, 'a' + std::rand() % 3));
+    }
+    for (int i=0; i < newSize; ++i) {
+      newLines.push_back(std::string(1, 'a' + std::rand() % 3));
+    }
+
+    std::size_t maxEditDistance = (iter % 3 == 0)? 4 : 100;
+    std::vector<TextDiffHunk> hunks =
+      diffLines(views(oldLines), views(newLines), maxEditDistance);
+    checkHunks(oldLines, newLines, hunks);
+
+    // Without the limit, the result is minimal.
+    if (maxEditDistance == 100) {
+      EXPECT_EQ(hunksEdits(hunks), editDistance(oldLines, newLines));
+    }
+  }
+}
+
+
+// A couple of small changes in a large text should be fast.
+void testLarge()
+{
+  std::vector<std::string> oldLines;
+  for (int i=0; i < 200000; ++i) {
+    oldLines.push_back(stringb("line " << i));
+  }
+  std::vector<std::string> newLines(oldLines);
+  newLines.at(100000) = "changed";
+  newLines.insert(newLines.begin() + 5000, "inserted");
+
+  long start = getMilliseconds();
+  std::vector<TextDiffHunk> hunks =
+    diffLines(views(oldLines), views(newLines), 2000);
+  DIAG("diff of 200000 lines took " << (getMilliseconds() - start) << " ms");
+
+  checkHunks(oldLines, newLines, hunks);
+  EXPECT_EQ(hunksString(hunks),
+            std::string("[5000,0,5000,1][100000,1,100001,1]"));
+
+  // When every line changes, the work limit stops the search early.
+  for (std::string &line : newLines) {
+    line += "x";
+  }
+  start = getMilliseconds();
+  hunks = diffLines(views(oldLines), views(newLines), 2000, 20000000);
+  DIAG("diff of 200000 changed lines took " <<
+       (getMilliseconds() - start) << " ms");
+  EXPECT_EQ(hunksString(hunks), std::string("[0,200000,0,200001]"));
+}
+
+
+void testSplitTextLines()
+{
+  EXPECT_EQ(splitTextLines("").size(), 1);
+  EXPECT_EQ(splitTextLines("a").size(), 1);
+
+  std::vector<std::string_view> lines = splitTextLines("a\n\nbc\n");
+  EXPECT_EQ(lines.size(), 4);
+  EXPECT_EQ(std::string(lines.at(0)), "a");
+  EXPECT_EQ(std::string(lines.at(1)), "");
+  EXPECT_EQ(std::string(lines.at(2)), "bc");
+  EXPECT_EQ(std::string(lines.at(3)), "");
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_text_diff(CmdlineArgsSpan args)
+{
+  testSimple();
+  testLimit();
+  testRandom();
+  testLarge();
+  testSplitTextLines();
+}
+
+
+// EOF
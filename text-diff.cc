@@ -0,0 +1,330 @@
+// text-diff.cc
+// Code for `text-diff` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "text-diff.h"                 // this module
+
+#include "smbase/xassert.h"            // xassert, xfailure
+
+#include <algorithm>                   // std::min
+#include <unordered_map>               // std::unordered_map
+
+
+bool TextDiffHunk::operator==(TextDiffHunk const &obj) const
+{
+  return m_oldStart == obj.m_oldStart &&
+         m_oldCount == obj.m_oldCount &&
+         m_newStart == obj.m_newStart &&
+         m_newCount == obj.m_newCount;
+}
+
+
+// Searches for the minimal edit script between `a` and `b`, whose
+// elements are line identifiers, using the linear-space refinement of
+// section 4b of the paper: find the "middle snake" of an optimal path
+// by searching forward from the start and backward from the end at the
+// same time, then recursively solve the two halves on either side of
+// it.  Memory is O(N+M) rather than the O(D^2) needed to record the
+// whole search, and the time is O((N+M)D).
+class MyersSearch {
+private:     // data
+  // Sequences being compared.
+  std::vector<int> const &m_a;
+  std::vector<int> const &m_b;
+
+  // Furthest reaching points of the forward and reverse searches, as
+  // the array V of the paper, indexed by diagonal plus `m_offset`.
+  // The reverse array records distances from the end of the box.
+  std::vector<long> m_forward;
+  std::vector<long> m_reverse;
+  long m_offset;
+
+  // Output, the edit script: 'M' for a line common to both, 'D' for a
+  // line deleted from `a`, and 'I' for a line inserted from `b`.
+  std::vector<char> &m_script;
+
+private:     // funcs
+  // Find the middle snake of an optimal path through the box from
+  // (`aLo`,`bLo`) to (`aHi`,`bHi`), which must be non-empty in both
+  // dimensions.  Set the snake to run from (`x`,`y`) to (`u`,`v`) and
+  // return the number of edits on the whole path, or return -1 if that
+  // would exceed `maxD`.
+  long middleSnake(long aLo, long aHi, long bLo, long bHi, long maxD,
+                   long &x /*OUT*/, long &y /*OUT*/,
+                   long &u /*OUT*/, long &v /*OUT*/);
+
+  // Append the steps of a minimal path through the box to `m_script`,
+  // or return false if that path has more than `maxD` edits.
+  bool solve(long aLo, long aHi, long bLo, long bHi, long maxD);
+
+public:      // funcs
+  MyersSearch(std::vector<int> const &a, std::vector<int> const &b,
+              std::vector<char> &script);
+
+  // Fill in the script, or return false, leaving it unspecified, if
+  // more than `maxEditDistance` insertions and deletions are required.
+  bool run(std::size_t maxEditDistance);
+};
+
+
+MyersSearch::MyersSearch(std::vector<int> const &a,
+                         std::vector<int> const &b,
+                         std::vector<char> &script)
+  : m_a(a),
+    m_b(b),
+    m_forward(a.size() + b.size() + 5, 0),
+    m_reverse(a.size() + b.size() + 5, 0),
+    m_offset(static_cast<long>((a.size() + b.size()) / 2 + 2)),
+    m_script(script)
+{}
+
+
+long MyersSearch::middleSnake(long aLo, long aHi, long bLo, long bHi,
+                              long maxD,
+                              long &x /*OUT*/, long &y /*OUT*/,
+                              long &u /*OUT*/, long &v /*OUT*/)
+{
+  long const n = aHi - aLo;
+  long const m = bHi - bLo;
+
+  // Forward diagonal `k` meets reverse diagonal `delta - k`.
+  long const delta = n - m;
+  bool const odd = (delta % 2) != 0;
+
+  long *const fwd = m_forward.data() + m_offset;
+  long *const rev = m_reverse.data() + m_offset;
+  fwd[1] = 0;
+  rev[1] = 0;
+
+  for (long d = 0; d <= (n + m + 1) / 2; ++d) {
+    // Forward step `d`; a meeting here makes a path of `2d-1` edits.
+    if (2*d - 1 > maxD) {
+      return -1;
+    }
+    for (long k = -d; k <= d; k += 2) {
+      long px = (k == -d || (k != d && fwd[k-1] < fwd[k+1]))?
+                  fwd[k+1] : fwd[k-1] + 1;
+      long py = px - k;
+      long sx = px;
+      long sy = py;
+      while (px < n && py < m && m_a[aLo+px] == m_b[bLo+py]) {
+        ++px;
+        ++py;
+      }
+      fwd[k] = px;
+
+      long const rk = delta - k;
+      if (odd && -(d-1) <= rk && rk <= d-1 && px + rev[rk] >= n) {
+        x = aLo + sx;
+        y = bLo + sy;
+        u = aLo + px;
+        v = bLo + py;
+        return 2*d - 1;
+      }
+    }
+
+    // Reverse step `d`; a meeting here makes a path of `2d` edits.
+    if (2*d > maxD) {
+      return -1;
+    }
+    for (long k = -d; k <= d; k += 2) {
+      long px = (k == -d || (k != d && rev[k-1] < rev[k+1]))?
+                  rev[k+1] : rev[k-1] + 1;
+      long py = px - k;
+      long sx = px;
+      long sy = py;
+      while (px < n && py < m &&
+             m_a[aHi-1-px] == m_b[bHi-1-py]) {
+        ++px;
+        ++py;
+      }
+      rev[k] = px;
+
+      long const fk = delta - k;
+      if (!odd && -d <= fk && fk <= d && fwd[fk] + px >= n) {
+        x = aHi - px;
+        y = bHi - py;
+        u = aHi - sx;
+        v = bHi - sy;
+        return 2*d;
+      }
+    }
+  }
+
+  // Some path of at most `n+m` edits always exists.
+  xfailure("middleSnake: search did not meet");
+  return -1;
+}
+
+
+bool MyersSearch::solve(long aLo, long aHi, long bLo, long bHi,
+                        long maxD)
+{
+  // Common lines at the start and end can be matched immediately.
+  // Afterward, if both ranges are non-empty, the path needs at least
+  // two edits, so each half around the middle snake needs fewer edits
+  // than the whole, and the recursion terminates.
+  long prefix = 0;
+  while (aLo < aHi && bLo < bHi && m_a[aLo] == m_b[bLo]) {
+    ++aLo;
+    ++bLo;
+    ++prefix;
+  }
+  long suffix = 0;
+  while (aLo < aHi && bLo < bHi && m_a[aHi-1] == m_b[bHi-1]) {
+    --aHi;
+    --bHi;
+    ++suffix;
+  }
+
+  m_script.insert(m_script.end(), prefix, 'M');
+  if (aLo == aHi || bLo == bHi) {
+    // Only insertions or only deletions remain.
+    if ((aHi-aLo) + (bHi-bLo) > maxD) {
+      return false;
+    }
+    m_script.insert(m_script.end(), aHi - aLo, 'D');
+    m_script.insert(m_script.end(), bHi - bLo, 'I');
+  }
+  else {
+    long x, y, u, v;
+    long d = middleSnake(aLo, aHi, bLo, bHi, maxD, x, y, u, v);
+    if (d < 0) {
+      return false;
+    }
+    xassert(d >= 2);
+
+    // The halves are on the optimal path, so they cannot exceed the
+    // limit that the whole path satisfies.
+    solve(aLo, x, bLo, y, d);
+    m_script.insert(m_script.end(), u - x, 'M');
+    solve(u, aHi, v, bHi, d);
+  }
+  m_script.insert(m_script.end(), suffix, 'M');
+  return true;
+}
+
+
+bool MyersSearch::run(std::size_t maxEditDistance)
+{
+  long const n = static_cast<long>(m_a.size());
+  long const m = static_cast<long>(m_b.size());
+  m_script.clear();
+  return solve(0, n, 0, m,
+               std::min(static_cast<long>(maxEditDistance), n + m));
+}
+
+
+std::vector<TextDiffHunk> diffLines(
+  std::vector<std::string_view> const &oldLines,
+  std::vector<std::string_view> const &newLines,
+  std::size_t maxEditDistance,
+  std::size_t maxWork)
+{
+  std::size_t const oldSize = oldLines.size();
+  std::size_t const newSize = newLines.size();
+
+  std::size_t prefix = 0;
+  while (prefix < oldSize && prefix < newSize &&
+         oldLines[prefix] == newLines[prefix]) {
+    ++prefix;
+  }
+
+  std::size_t suffix = 0;
+  while (suffix < oldSize - prefix && suffix < newSize - prefix &&
+         oldLines[oldSize-1-suffix] == newLines[newSize-1-suffix]) {
+    ++suffix;
+  }
+
+  std::size_t const oldMid = oldSize - prefix - suffix;
+  std::size_t const newMid = newSize - prefix - suffix;
+
+  std::vector<TextDiffHunk> hunks;
+  if (oldMid == 0 && newMid == 0) {
+    return hunks;
+  }
+
+  // Replace each line in the middle with a small integer identifying
+  // its contents, so the search compares integers instead of strings.
+  std::vector<int> a, b;
+  {
+    std::unordered_map<std::string_view, int> ids;
+    auto idOf = [&ids](std::string_view line) -> int {
+      auto res = ids.insert({line, static_cast<int>(ids.size())});
+      return res.first->second;
+    };
+
+    a.reserve(oldMid);
+    for (std::size_t i=0; i < oldMid; ++i) {
+      a.push_back(idOf(oldLines[prefix+i]));
+    }
+    b.reserve(newMid);
+    for (std::size_t i=0; i < newMid; ++i) {
+      b.push_back(idOf(newLines[prefix+i]));
+    }
+  }
+
+  // Bound the edit distance so the search, which takes time
+  // proportional to the product of the distance and the size of the
+  // middle, does at most about `maxWork` steps.
+  std::size_t const maxD =
+    std::min(maxEditDistance, maxWork / (oldMid + newMid));
+
+  std::vector<char> script;
+  if (oldMid == 0 || newMid == 0 ||
+      !MyersSearch(a, b, script).run(maxD)) {
+    hunks.push_back(TextDiffHunk(prefix, oldMid, prefix, newMid));
+    return hunks;
+  }
+
+  // Gather consecutive edits into hunks.
+  std::size_t i = prefix;
+  std::size_t j = prefix;
+  std::size_t s = 0;
+  while (s < script.size()) {
+    if (script[s] == 'M') {
+      ++i;
+      ++j;
+      ++s;
+      continue;
+    }
+
+    TextDiffHunk hunk(i, 0, j, 0);
+    for (; s < script.size() && script[s] != 'M'; ++s) {
+      if (script[s] == 'D') {
+        ++hunk.m_oldCount;
+        ++i;
+      }
+      else {
+        ++hunk.m_newCount;
+        ++j;
+      }
+    }
+    hunks.push_back(hunk);
+  }
+  xassert(i == oldSize - suffix);
+  xassert(j == newSize - suffix);
+
+  return hunks;
+}
+
+
+std::vector<std::string_view> splitTextLines(std::string_view text)
+{
+  std::vector<std::string_view> lines;
+
+  std::size_t start = 0;
+  while (true) {
+    std::size_t nl = text.find('\n', start);
+    if (nl == std::string_view::npos) {
+      lines.push_back(text.substr(start));
+      return lines;
+    }
+    lines.push_back(text.substr(start, nl - start));
+    start = nl+1;
+  }
+}
+
+
+// EOF
@@ -0,0 +1,77 @@
+// text-diff.h
+// `diffLines`, a line-level difference between two texts.
+
+// See license.txt for copyright and terms of use.
+
+// This module exists so that a document can be updated to match new
+// file contents by editing only the lines that changed, rather than
+// replacing everything.  It uses the O(ND) algorithm of Myers, "An
+// O(ND) Difference Algorithm and Its Variations" (1986), in its
+// linear-space form, after first stripping any common prefix and
+// suffix, which for the typical case of a small change to a large file
+// is where nearly all of the lines go.
+
+#ifndef EDITOR_TEXT_DIFF_H
+#define EDITOR_TEXT_DIFF_H
+
+#include <cstddef>                     // std::size_t
+#include <limits>                      // std::numeric_limits
+#include <string_view>                 // std::string_view
+#include <vector>                      // std::vector
+
+
+// A run of consecutive old lines that is replaced by a run of
+// consecutive new lines.  Either run can be empty, but not both.
+class TextDiffHunk {
+public:      // data
+  // Index of the first old line, and number of old lines.
+  std::size_t m_oldStart;
+  std::size_t m_oldCount;
+
+  // Likewise for the new lines.
+  std::size_t m_newStart;
+  std::size_t m_newCount;
+
+public:      // methods
+  TextDiffHunk(std::size_t oldStart, std::size_t oldCount,
+               std::size_t newStart, std::size_t newCount)
+    : m_oldStart(oldStart),
+      m_oldCount(oldCount),
+      m_newStart(newStart),
+      m_newCount(newCount)
+  {}
+
+  bool operator==(TextDiffHunk const &obj) const;
+  bool operator!=(TextDiffHunk const &obj) const
+    { return !operator==(obj); }
+};
+
+
+// Compute the hunks that turn `oldLines` into `newLines`.  The hunks
+// are in increasing order, do not touch each other (there is at least
+// one unchanged line between any two of them), and the lines not in
+// any hunk correspond one-to-one in order.  Every such unchanged line
+// is equal in the two sequences.
+//
+// If the minimal number of inserted plus deleted lines exceeds
+// `maxEditDistance`, the search for a minimal difference is abandoned,
+// and the result is a single hunk spanning everything between the
+// common prefix and suffix.  The search takes time proportional to
+// that distance times the number of lines between the prefix and
+// suffix, so the distance is further limited to keep that product
+// below about `maxWork`.  Memory is linear in the number of lines.
+std::vector<TextDiffHunk> diffLines(
+  std::vector<std::string_view> const &oldLines,
+  std::vector<std::string_view> const &newLines,
+  std::size_t maxEditDistance,
+  std::size_t maxWork = std::numeric_limits<std::size_t>::max());
+
+
+// Split `text` at newline characters.  There is always one more
+// element than there are newlines, so a text ending in a newline ends
+// with an empty element, matching how `TextDocumentCore` represents
+// lines.  The elements point into `text`.
+std::vector<std::string_view> splitTextLines(std::string_view text);
+
+
+#endif // EDITOR_TEXT_DIFF_H
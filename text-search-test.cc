@@ -7,12 +7,16 @@
 
 // editor
 #include "td-editor.h"                 // TextDocumentAndEditor
+#include "td-snapshot.h"               // TextDocumentSnapshot
 
 // smbase
 #include "smbase/nonport.h"            // getMilliseconds, GetMillisecondsAccumulator
 #include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
 #include "smbase/sm-test.h"            // DIAG, EXPECT_EQ, VPVAL, [TIMED_]TEST_FUNC
 
+// libc++
+#include <memory>                      // std::shared_ptr
+
 
 OPEN_ANONYMOUS_NAMESPACE
 
@@ -380,6 +384,64 @@ void testRegex()
 }
 
 
+// Regex matching works on UTF-8 bytes and can span lines.
+void testRegexMultiLine()
+{
+  TEST_FUNC();
+
+  TextDocumentAndEditor tde;
+  TextSearch ts(tde.getDocumentCore());
+  tde.insertNulTermText(
+    "\xC3\xA9t\xC3\xA9 one\n"   // 0: U+00E9 is two bytes.
+    "two\n"                      // 1
+    "three one\n"                // 2
+    "two"                        // 3: No newline.
+  );
+
+  // Offsets are in bytes.
+  ts.setSearchStringAndFlags("one", TextSearch::SS_REGEX);
+  xassert(!ts.matchesCanSpanLines());
+  expectMatches(ts,
+    "0:[6,3]\n"
+    "2:[6,3]\n"
+  );
+
+  // A match that spans lines is recorded on the line where it starts,
+  // and its length counts the line break.
+  ts.setSearchString("one\\ntwo");
+  xassert(ts.matchesCanSpanLines());
+  expectMatches(ts,
+    "0:[6,7]\n"
+    "2:[6,7]\n"
+  );
+
+  // It can be found and recognized as a selection.
+  TextMCoordRange range(TextMCoord(LineIndex(0), ByteIndex(0)),
+                        TextMCoord(LineIndex(0), ByteIndex(0)));
+  xassert(ts.nextMatch(false /*reverse*/, range));
+  EXPECT_EQ(range.m_start, TextMCoord(LineIndex(0), ByteIndex(6)));
+  EXPECT_EQ(range.m_end, TextMCoord(LineIndex(1), ByteIndex(3)));
+  xassert(ts.rangeIsMatch(range.m_start, range.m_end));
+  xassert(!ts.rangeIsMatch(range.m_start,
+                           TextMCoord(LineIndex(1), ByteIndex(2))));
+
+  // Editing a later line of a match updates the line it starts on.
+  tde.setCursor(TextLCoord(LineIndex(3), ColumnIndex(0)));
+  tde.insertNulTermText("x");
+  expectMatches(ts, "0:[6,7]\n");
+
+  // So does inserting a line in the middle of it.
+  tde.setCursor(TextLCoord(LineIndex(1), ColumnIndex(0)));
+  tde.insertNulTermText("\n");
+  expectMatches(ts, "");
+
+  // And deleting that line.
+  tde.setCursor(TextLCoord(LineIndex(1), ColumnIndex(0)));
+  tde.deleteTextBytes(ByteCount(1));
+  expectMatches(ts, "0:[6,7]\n");
+}
+
+
 void expectGRT(TextSearch const &ts,
   string const &existing,
   string const &replaceSpec,
@@ -435,7 +497,7 @@ void testPerformance()
   TextSearch ts(tde.getDocumentCore());
   ts.setSearchString("roam");
 
-  int const NUM_LINES = 1000;      // Right at match limit.
+  int const NUM_LINES = 1000;
   populateDocument(tde, NUM_LINES);
 
   // Default takes ~0.5s without optimization.
@@ -564,6 +626,182 @@ void testPerf3()
 }
 
 
+// Merge background results until the scan is done.
+void finishScan(TextSearch &ts)
+{
+  while (ts.isScanning()) {
+    ts.mergeBackgroundResults();
+  }
+}
+
+
+// Expect 'ts' to have found the same matches as searching its document
+// synchronously would.
+void expectSameAsSync(TextSearch const &ts)
+{
+  TextSearch sync(ts.document());
+  sync.setMatchCountLimit(ts.matchCountLimit());
+  sync.setSearchStringAndFlags(ts.searchString(), ts.searchStringFlags());
+  expectMatches(ts, dumpMatches(sync));
+}
+
+
+void testBackgroundScan()
+{
+  TEST_FUNC();
+
+  int const NUM_LINES = 20000;
+
+  TextDocumentAndEditor tde;
+  populateDocument(tde, NUM_LINES);
+
+  TextSearch ts(tde.getDocumentCore());
+  ts.setMatchCountLimit(NUM_LINES * 2);
+  ts.setBackgroundScanLineThreshold(1000);
+
+  ts.setSearchString("roam");
+  xassert(ts.isScanning());
+  xassert(ts.hasIncompleteMatches());
+  finishScan(ts);
+  xassert(!ts.hasIncompleteMatches());
+  expectTotalMatches(ts, NUM_LINES);
+
+  // Changing the search abandons the scan in progress.
+  ts.setSearchString("ROADS");
+  ts.setSearchStringFlags(TextSearch::SS_CASE_INSENSITIVE);
+  finishScan(ts);
+  expectTotalMatches(ts, NUM_LINES);
+  expectSameAsSync(ts);
+
+  // The scans read a snapshot of the document, which the search keeps
+  // while the document is unchanged so the next scan can reuse it.
+  {
+    std::shared_ptr<TextDocumentSnapshot const> snap =
+      tde.getDocumentCore().snapshot();
+    EXPECT_EQ(snap.use_count(), 2);
+    ts.setSearchString("roads");
+    finishScan(ts);
+    EXPECT_EQ(snap.use_count(), 2);
+    expectSameAsSync(ts);
+
+    // An edit releases it.
+    tde.setCursor(TextLCoord(LineIndex(3), ColumnIndex(0)));
+    tde.insertString("x");
+    EXPECT_EQ(snap.use_count(), 1);
+  }
+
+  // Edit while scanning.  The results for edited lines come from
+  // recomputing them, and the rest are shifted to their new lines.
+  ts.setSearchString("animals");
+  tde.setCursor(TextLCoord(LineIndex(5), ColumnIndex(0)));
+  tde.insertString("Animals\nmore\n");
+  tde.setCursor(TextLCoord(LineIndex(15000), ColumnIndex(0)));
+  tde.deleteTextBytes(ByteCount(10));
+  tde.setCursor(TextLCoord(LineIndex(100), ColumnIndex(0)));
+  tde.deleteTextBytes(
+    ByteCount(tde.getWholeLineString(LineIndex(100)).length() + 1));
+  finishScan(ts);
+  expectSameAsSync(ts);
+
+  // Regex.
+  ts.setSearchStringAndFlags("r[a-z]+m", TextSearch::SS_REGEX);
+  finishScan(ts);
+  expectSameAsSync(ts);
+
+  // Regex spanning lines, edited while scanning.
+  ts.setSearchStringAndFlags("\\)\\.\\n1[0-9]*\\. A", TextSearch::SS_REGEX);
+  tde.setCursor(TextLCoord(LineIndex(10), ColumnIndex(0)));
+  tde.insertString("x");
+  tde.setCursor(TextLCoord(LineIndex(12000), ColumnIndex(0)));
+  tde.insertString("\n");
+  finishScan(ts);
+  expectSameAsSync(ts);
+
+  // Hitting the match limit ends the scan early.
+  ts.setMatchCountLimit(100);
+  ts.setSearchStringAndFlags("roam", TextSearch::SS_NONE);
+  finishScan(ts);
+  xassert(ts.hasIncompleteMatches());
+  xassert(100 < ts.countAllMatches() &&
+                ts.countAllMatches() < NUM_LINES);
+
+  // Below the threshold, the search is immediate.
+  ts.setBackgroundScanLineThreshold(NUM_LINES * 2);
+  ts.setMatchCountLimit(NUM_LINES * 2);
+  ts.setSearchString("room");
+  xassert(!ts.isScanning());
+  expectSameAsSync(ts);
+}
+
+
+// More matches than the former default limit of 1000, maintained
+// across edits scattered through the document.
+void testManyMatches()
+{
+  TEST_FUNC();
+
+  int const NUM_LINES = 2000;
+
+  TextDocumentAndEditor tde;
+  populateDocument(tde, NUM_LINES);
+
+  TextSearch ts(tde.getDocumentCore());
+  ts.setSearchString("o");
+  xassert(!ts.hasIncompleteMatches());
+  int const perLine = ts.countLineMatches(LineIndex(0));
+  xassert(perLine > 1);
+  expectTotalMatches(ts, NUM_LINES * perLine);
+  EXPECT_EQ(ts.countMatchesAbove(LineIndex(1500)), 1500 * perLine);
+  EXPECT_EQ(ts.countMatchesBelow(LineIndex(1500)), 499 * perLine);
+
+  // Alternately add and remove matches and lines, jumping around so
+  // the edits are not adjacent.
+  for (int i=0; i < 60; i++) {
+    LineIndex line((i * 797) % (NUM_LINES - 10));
+    tde.setCursor(TextLCoord(line, ColumnIndex(0)));
+    switch (i % 4) {
+      case 0:
+        tde.insertString("ooo");
+        break;
+
+      case 1:
+        tde.deleteTextBytes(ByteCount(12));
+        break;
+
+      case 2:
+        tde.insertString("foo\nbar\n");
+        break;
+
+      case 3:
+        tde.deleteTextBytes(
+          ByteCount(tde.getWholeLineString(line).length() + 1));
+        break;
+    }
+    ts.selfCheck();
+  }
+  expectSameAsSync(ts);
+
+  // Walking forward visits every match.
+  int const total = ts.countAllMatches();
+  TextMCoordRange range;
+  int visited = 0;
+  while (ts.nextMatch(false /*reverse*/, range)) {
+    xassert(ts.rangeIsMatch(range.m_start, range.m_end));
+    visited++;
+  }
+  EXPECT_EQ(visited, total);
+
+  // And so does walking backward.
+  TextMCoord end = tde.getDocumentCore()->endCoord();
+  range = TextMCoordRange(end, end);
+  visited = 0;
+  while (ts.nextMatch(true /*reverse*/, range)) {
+    visited++;
+  }
+  EXPECT_EQ(visited, total);
+}
+
+
 CLOSE_ANONYMOUS_NAMESPACE
 
 
@@ -592,9 +830,12 @@ void test_text_search(CmdlineArgsSpan args)
   testSimple();
   testCaseInsensitive();
   testRegex();
+  testRegexMultiLine();
   testGetReplacementText();
   testPerformance();
   testRegexPerf2(false /*nolimit*/);
+  testBackgroundScan();
+  testManyMatches();
 }
 
 
@@ -4,12 +4,13 @@
 #include "text-search.h"               // this module
 
 // editor
+#include "byte-search.h"               // findBytes
 #include "debug-values.h"              // DEBUG_VALUES
 #include "fasttime.h"                  // fastTimeMilliseconds
+#include "gap.h"                       // GapArray
 #include "line-difference.h"           // LineDifference
-
-// smqtutil
-#include "smqtutil/qtutil.h"           // toQString(QString), operator<<(QString)
+#include "td-snapshot.h"               // TextDocumentSnapshot
+#include "utf8-regex.h"                // UTF8Regex, UTF8RegexMatcher
 
 // smbase
 #include "smbase/dev-warning.h"        // DEV_WARNING
@@ -21,12 +22,17 @@
 #include "smbase/strutil.h"            // stringTolower
 #include "smbase/trace.h"              // TRACE
 
-// Qt
-#include <QRegularExpression>
-#include <QString>
-
-// libc
-#include <string.h>                    // strstr
+// libc++
+#include <algorithm>                   // std::min, std::max
+#include <atomic>                      // std::atomic
+#include <cstddef>                     // std::size_t, std::ptrdiff_t
+#include <memory>                      // std::shared_ptr
+#include <mutex>                       // std::mutex, std::lock_guard
+#include <optional>                    // std::optional
+#include <sstream>                     // std::ostringstream
+#include <thread>                      // std::thread
+#include <utility>                     // std::move
+#include <vector>                      // std::vector
 
 
 // ------------------------- MatchExtent ---------------------------
@@ -69,6 +75,647 @@ void TextSearch::MatchExtent::insertOstream(std::ostream &os) const
 }
 
 
+// ----------------------- findLineMatches -------------------------
+// Append to 'lineMatches' the matches that start in one line, whose
+// 'lineLength' bytes are at 'buffer'.  The buffer does not need to be
+// NUL-terminated, and is not modified, so it can point directly into
+// document storage.  If the search is case insensitive, 'searchString'
+// must already be lowercase.
+//
+// 'matcher' is NULL unless searching by regex.  In that case, the
+// regex can examine 'windowLength' bytes at 'buffer', which is more
+// than 'lineLength' when matches can span lines; the window then
+// continues with the following lines, separated by newlines.
+static void findLineMatches(
+  ArrayStack<TextSearch::MatchExtent> &lineMatches,
+  char const *buffer,
+  int lineLength,
+  int windowLength,
+  string const &searchString,
+  TextSearch::SearchStringFlags flags,
+  UTF8RegexMatcher *matcher)
+{
+  typedef TextSearch::MatchExtent MatchExtent;
+
+  ByteCount searchStringLength(searchString.length());
+
+  if (matcher) {
+    // Case insensitivity is handled by the regex options.  Offsets
+    // are in bytes since the regex matches the UTF-8 directly.
+    matcher->start(buffer, windowLength, lineLength /*startLimit*/);
+    while (matcher->next()) {
+      lineMatches.push(MatchExtent(
+        ByteIndex(matcher->matchStart()),
+        ByteCount(matcher->matchEnd() - matcher->matchStart())));
+    }
+  }
+  else {
+    bool caseInsensitive = (flags & TextSearch::SS_CASE_INSENSITIVE);
+
+    // Byte offset within the line to begin the next search.
+    ByteIndex offset(0);
+
+    while (offset+searchStringLength <= lineLength) {
+      std::ptrdiff_t found = findBytes(
+        buffer + offset.get(), lineLength - offset.get(),
+        searchString.data(), searchString.length(),
+        caseInsensitive);
+      if (found >= 0) {
+        // Offset where we found the match.
+        offset += ByteCount(found);
+
+        // Record the match.
+        lineMatches.push(MatchExtent(offset, searchStringLength));
+
+        // Move one past the match so that subsequent matches are not
+        // adjacent, since the UI would show adjacent matches as if they
+        // were one long match.
+        //
+        // Note: With the regex engine, I can get both adjacent and
+        // zero-width matches.  The handling in EditorWidget isn't
+        // great, but it is not catastrophic.
+        offset += searchStringLength.succ();
+      }
+      else {
+        break;
+      }
+    }
+  }
+}
+
+
+// -------------------------- MatchStore ---------------------------
+// The matches are stored column-wise in gap arrays ordered by line,
+// plus an index from each line to its first match.  That costs eight
+// bytes per match and four per line, without any per-line allocation,
+// so millions of matches are affordable.  Finding the matches on a
+// line, or counting those in a range of lines, takes constant time.
+class TextSearch::MatchStore {
+  NO_OBJECT_COPIES(MatchStore);
+
+private:     // data
+  // Byte offset of the start of each match within its line.  Matches
+  // are ordered by line, then start, then length.
+  GapArray<int> m_startBytes;
+
+  // Length in bytes of each match, parallel to 'm_startBytes'.
+  GapArray<int> m_lengthBytes;
+
+  // Element L is the index in the match arrays of the first match on
+  // line L.  There is one extra element at the end, whose value is the
+  // total number of matches.
+  //
+  // Changing the number of matches on a line changes the value for
+  // every line after it.  Rather than updating them all, the elements
+  // after 'm_stepLine' are stored without 'm_stepDelta' added.  When a
+  // different line changes, the step is moved there, which only
+  // touches the elements in between.  Since edits tend to be close
+  // together, this is usually cheap.
+  GapArray<int> m_lineFirstMatch;
+
+  // Last element of 'm_lineFirstMatch' that is stored with its true
+  // value.  In [-1, numLines()].
+  int m_stepLine;
+
+  // Amount to add to elements after 'm_stepLine'.
+  int m_stepDelta;
+
+private:     // funcs
+  // Move 'm_stepLine' to 'line', adjusting the elements it passes.
+  void moveStepTo(int line);
+
+  // Add 'delta' to the first match index of every line after 'line'.
+  void addToLinesAfter(int line, int delta);
+
+public:      // funcs
+  MatchStore();
+
+  // Check the invariants that can be checked in constant time.
+  void selfCheck() const;
+
+  int numLines() const { return m_lineFirstMatch.length() - 1; }
+  int numMatches() const { return m_startBytes.length(); }
+
+  // Index of the first match on 'line', which is in [0,numLines()].
+  // If there are none, this is the index of the first match on a
+  // later line, or 'numMatches()'.
+  int lineFirstMatch(int line) const;
+
+  int lineMatchCount(int line) const
+    { return lineFirstMatch(line+1) - lineFirstMatch(line); }
+
+  // Line containing the match at 'index'.  Takes logarithmic time.
+  int matchLine(int index) const;
+
+  MatchExtent getMatch(int index) const;
+
+  // Index of the first match on 'line' that starts at or after 'byte',
+  // or after it if 'strict'.  If there is none, return the index just
+  // past the matches on 'line'.  Takes logarithmic time.
+  int lineMatchAfter(int line, ByteIndex byte, bool strict) const;
+
+  // Replace 'dest' with the matches on 'line'.
+  void getLineMatches(int line, ArrayStack<MatchExtent> &dest) const;
+
+  // Replace the matches on 'line' with the 'count' at 'matches'.
+  void setLineMatches(int line, MatchExtent const *matches, int count);
+
+  // Insert a line without matches before 'line', which is in
+  // [0,numLines()].
+  void insertLine(int line);
+
+  // Remove 'line' and its matches.
+  void deleteLine(int line);
+
+  // Discard all matches and set the number of lines.
+  void reset(int numLines);
+};
+
+
+TextSearch::MatchStore::MatchStore()
+  : m_startBytes(),
+    m_lengthBytes(),
+    m_lineFirstMatch(),
+    m_stepLine(-1),
+    m_stepDelta(0)
+{
+  this->reset(0);
+}
+
+
+void TextSearch::MatchStore::selfCheck() const
+{
+  xassert(m_lengthBytes.length() == m_startBytes.length());
+  xassert(m_lineFirstMatch.length() >= 1);
+  xassert(-1 <= m_stepLine && m_stepLine <= numLines());
+  xassert(lineFirstMatch(0) == 0);
+  xassert(lineFirstMatch(numLines()) == numMatches());
+}
+
+
+void TextSearch::MatchStore::moveStepTo(int line)
+{
+  if (m_stepDelta == 0) {
+    // Nothing is pending, so the step can go anywhere.
+    m_stepLine = line;
+    return;
+  }
+
+  while (m_stepLine < line) {
+    m_stepLine++;
+    m_lineFirstMatch.eltRef(m_stepLine) += m_stepDelta;
+  }
+  while (m_stepLine > line) {
+    m_lineFirstMatch.eltRef(m_stepLine) -= m_stepDelta;
+    m_stepLine--;
+  }
+
+  if (m_stepLine == numLines()) {
+    // Every element has its true value.
+    m_stepDelta = 0;
+  }
+}
+
+
+void TextSearch::MatchStore::addToLinesAfter(int line, int delta)
+{
+  this->moveStepTo(line);
+  m_stepDelta += delta;
+}
+
+
+int TextSearch::MatchStore::lineFirstMatch(int line) const
+{
+  int ret = m_lineFirstMatch.get(line);
+  if (line > m_stepLine) {
+    ret += m_stepDelta;
+  }
+  return ret;
+}
+
+
+int TextSearch::MatchStore::matchLine(int index) const
+{
+  xassert(0 <= index && index < numMatches());
+
+  // Find the last line whose first match is at or before 'index'.
+  // Lines without matches share their value with the next line, so
+  // this is the line that actually contains it.
+  int lo = 0;
+  int hi = numLines() - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo + 1) / 2;
+    if (lineFirstMatch(mid) <= index) {
+      lo = mid;
+    }
+    else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+
+TextSearch::MatchExtent TextSearch::MatchStore::getMatch(int index) const
+{
+  return MatchExtent(ByteIndex(m_startBytes.get(index)),
+                     ByteCount(m_lengthBytes.get(index)));
+}
+
+
+int TextSearch::MatchStore::lineMatchAfter(
+  int line, ByteIndex byte, bool strict) const
+{
+  int lo = lineFirstMatch(line);
+  int hi = lineFirstMatch(line+1);
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int start = m_startBytes.get(mid);
+    if (strict? start <= byte.get() : start < byte.get()) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+void TextSearch::MatchStore::getLineMatches(
+  int line, ArrayStack<MatchExtent> &dest) const
+{
+  dest.clear();
+  int end = lineFirstMatch(line+1);
+  for (int i = lineFirstMatch(line); i < end; i++) {
+    dest.push(getMatch(i));
+  }
+}
+
+
+void TextSearch::MatchStore::setLineMatches(
+  int line, MatchExtent const *matches, int count)
+{
+  int first = lineFirstMatch(line);
+  int oldCount = lineFirstMatch(line+1) - first;
+
+  // Overwrite the existing entries in place.  When the matches on the
+  // line have not changed, which is common, this is all that happens.
+  int common = std::min(oldCount, count);
+  for (int i=0; i < common; i++) {
+    m_startBytes.set(first+i, matches[i].m_startByte.get());
+    m_lengthBytes.set(first+i, matches[i].m_lengthBytes.get());
+  }
+
+  if (count > oldCount) {
+    for (int i=common; i < count; i++) {
+      m_startBytes.insert(first+i, matches[i].m_startByte.get());
+      m_lengthBytes.insert(first+i, matches[i].m_lengthBytes.get());
+    }
+  }
+  else if (count < oldCount) {
+    m_startBytes.removeMany(first+count, oldCount-count);
+    m_lengthBytes.removeMany(first+count, oldCount-count);
+  }
+
+  if (count != oldCount) {
+    this->addToLinesAfter(line, count - oldCount);
+  }
+}
+
+
+void TextSearch::MatchStore::insertLine(int line)
+{
+  // The new line has no matches, so its first match is the same as
+  // that of the line currently at 'line'.
+  int value = lineFirstMatch(line);
+
+  if (line <= m_stepLine) {
+    m_lineFirstMatch.insert(line, value);
+    m_stepLine++;
+  }
+  else {
+    m_lineFirstMatch.insert(line, value - m_stepDelta);
+  }
+}
+
+
+void TextSearch::MatchStore::deleteLine(int line)
+{
+  this->setLineMatches(line, nullptr, 0);
+
+  // Having no matches, the line's value equals its successor's, so
+  // removing it leaves the others correct.
+  m_lineFirstMatch.remove(line);
+  if (line <= m_stepLine) {
+    m_stepLine--;
+  }
+}
+
+
+void TextSearch::MatchStore::reset(int numLines)
+{
+  m_startBytes.clear();
+  m_lengthBytes.clear();
+  m_lineFirstMatch.clear();
+  m_lineFirstMatch.insertManyZeroes(0, numLines+1);
+  m_stepLine = -1;
+  m_stepDelta = 0;
+}
+
+
+// ------------------------ BackgroundScan -------------------------
+class TextSearch::BackgroundScan {
+  NO_OBJECT_COPIES(BackgroundScan);
+
+public:      // types
+  // Results for one chunk of lines.
+  class ChunkResult {
+  public:
+    // True once a worker has finished the chunk.
+    bool m_ready;
+
+    // Snapshot lines in the chunk with at least one match, in order.
+    std::vector<int> m_lines;
+
+    // Element 'i' is the index in 'm_matches' just past the matches
+    // for 'm_lines[i]'.
+    std::vector<int> m_lineEnds;
+
+    // The matches on all of those lines, in order.
+    std::vector<MatchExtent> m_matches;
+
+  public:
+    ChunkResult() : m_ready(false), m_lines(), m_lineEnds(), m_matches() {}
+
+    void swapWith(ChunkResult &obj);
+  };
+
+  // Kinds of document changes made after the snapshot was taken.
+  enum EditKind {
+    EK_INSERT_LINE,
+    EK_DELETE_LINE,
+    EK_CHANGE_LINE,
+  };
+
+  // A document change, in the coordinates of the document at the time
+  // it happened.  It affects 'm_count' lines starting at 'm_line'.
+  class Edit {
+  public:
+    EditKind m_kind;
+    LineIndex m_line;
+    int m_count;
+
+  public:
+    Edit(EditKind kind, LineIndex line, int count = 1)
+      : m_kind(kind), m_line(line), m_count(count) {}
+  };
+
+public:      // class data
+  // Number of lines in each unit of work handed to a worker.
+  static int const CHUNK_LINES = 4096;
+
+public:      // data
+  // ---- Immutable after construction; read by the workers. ----
+  // Contents of the document when the scan began.  The workers read
+  // its lines in place.  Never null.
+  std::shared_ptr<TextDocumentSnapshot const> const m_snapshot;
+
+  // Search string, lowercased if case insensitive.
+  string const m_searchString;
+
+  SearchStringFlags const m_flags;
+
+  // If searching by regex, a copy of the regex, shared by the workers,
+  // each of which has its own matcher.  It is a copy because the
+  // TextSearch replaces its own when the search string changes, which
+  // happens before the scan is cancelled.
+  std::unique_ptr<UTF8Regex> const m_regex;
+
+  // Number of elements in 'm_chunks'.
+  int m_numChunks;
+
+  // ---- Shared with the workers. ----
+  // Set to make the workers stop early.
+  std::atomic<bool> m_cancelled;
+
+  // Next chunk for a worker to take.
+  std::atomic<int> m_nextChunk;
+
+  // Protects 'm_chunks'.
+  std::mutex m_mutex;
+
+  // Per-chunk results.
+  std::vector<ChunkResult> m_chunks;
+
+  // ---- Used only by the client thread. ----
+  // Next chunk whose results 'mergeBackgroundResults' will merge.
+  int m_nextChunkToMerge;
+
+  // Number of matches merged so far.
+  int m_matchesMerged;
+
+  // Changes to the document since the snapshot, in order.
+  std::vector<Edit> m_edits;
+
+  // The workers.
+  std::vector<std::thread> m_threads;
+
+public:      // methods
+  BackgroundScan(std::shared_ptr<TextDocumentSnapshot const> snapshot,
+                 string const &searchString,
+                 SearchStringFlags flags,
+                 UTF8Regex const *regex);
+
+  // Cancels the scan and waits for the workers to stop.
+  ~BackgroundScan();
+
+  int numLines() const { return m_snapshot->numLines().get(); }
+
+  // Body of each worker thread.
+  void workerMain();
+
+  // Map a snapshot line to a line in the current document, accounting
+  // for 'm_edits'.  Return nullopt if the line was deleted or its
+  // contents changed, in which case the scan's results for it do not
+  // apply.
+  std::optional<LineIndex> mapLine(LineIndex line) const;
+
+  // True if all chunks have been merged.
+  bool allMerged() const { return m_nextChunkToMerge == m_numChunks; }
+};
+
+
+void TextSearch::BackgroundScan::ChunkResult::swapWith(ChunkResult &obj)
+{
+  swap(m_ready, obj.m_ready);
+  m_lines.swap(obj.m_lines);
+  m_lineEnds.swap(obj.m_lineEnds);
+  m_matches.swap(obj.m_matches);
+}
+
+
+TextSearch::BackgroundScan::BackgroundScan(
+  std::shared_ptr<TextDocumentSnapshot const> snapshot,
+  string const &searchString,
+  SearchStringFlags flags,
+  UTF8Regex const *regex)
+  : m_snapshot(std::move(snapshot)),
+    m_searchString(searchString),
+    m_flags(flags),
+    m_regex(regex?
+      new UTF8Regex(regex->pattern(), flags & SS_CASE_INSENSITIVE) :
+      nullptr),
+    m_numChunks(0),
+    m_cancelled(false),
+    m_nextChunk(0),
+    m_mutex(),
+    m_chunks(),
+    m_nextChunkToMerge(0),
+    m_matchesMerged(0),
+    m_edits(),
+    m_threads()
+{
+  m_numChunks = (numLines() + CHUNK_LINES - 1) / CHUNK_LINES;
+  m_chunks.resize(m_numChunks);
+
+  int numThreads = std::min<int>(m_numChunks,
+    std::max(1u, std::thread::hardware_concurrency()));
+  TRACE("TextSearch", "background scan of " << numLines() <<
+    " lines in " << m_numChunks << " chunks on " << numThreads <<
+    " threads");
+  for (int i=0; i < numThreads; i++) {
+    m_threads.emplace_back(&BackgroundScan::workerMain, this);
+  }
+}
+
+
+TextSearch::BackgroundScan::~BackgroundScan()
+{
+  m_cancelled = true;
+  for (std::thread &t : m_threads) {
+    t.join();
+  }
+}
+
+
+void TextSearch::BackgroundScan::workerMain()
+{
+  std::unique_ptr<UTF8RegexMatcher> matcher;
+  if (m_regex) {
+    matcher.reset(new UTF8RegexMatcher(*m_regex));
+  }
+
+  // Matches on the current line.
+  ArrayStack<MatchExtent> lineMatches;
+
+  // When matches can span lines, the lines that matches starting in
+  // the current chunk can examine, each followed by a newline, and the
+  // offset of each in 'window' plus one for the end, as in
+  // 'recomputeLineRange'.
+  bool const multiLine = m_regex && m_regex->canMatchNewline();
+  std::vector<char> window;
+  std::vector<int> windowLineStarts;
+
+  while (!m_cancelled) {
+    int chunk = m_nextChunk++;
+    if (chunk >= m_numChunks) {
+      break;
+    }
+
+    ChunkResult found;
+    int const startLine = chunk * CHUNK_LINES;
+    int const endLine = std::min(numLines(), startLine + CHUNK_LINES);
+
+    int numWindowLines = 0;
+    if (multiLine) {
+      window.clear();
+      windowLineStarts.clear();
+      int windowEndLine =
+        std::min(endLine + MAX_MATCH_LINES - 1, numLines());
+      for (int i = startLine; i < windowEndLine; i++) {
+        windowLineStarts.push_back((int)window.size());
+        std::size_t len;
+        char const *bytes = m_snapshot->lineBytes(LineIndex(i), len);
+        window.insert(window.end(), bytes, bytes + len);
+        window.push_back('\n');
+      }
+      windowLineStarts.push_back((int)window.size());
+      numWindowLines = (int)windowLineStarts.size() - 1;
+    }
+
+    for (int line = startLine;
+         line < endLine && !m_cancelled;
+         line++) {
+      char const *lineBytes;
+      int lineLength;
+      int windowLength;
+      if (multiLine) {
+        int i = line - startLine;
+        int last = std::min(i + MAX_MATCH_LINES, numWindowLines) - 1;
+        lineBytes = window.data() + windowLineStarts[i];
+        lineLength = windowLineStarts[i+1] - 1 - windowLineStarts[i];
+        windowLength = windowLineStarts[last+1] - 1 - windowLineStarts[i];
+      }
+      else {
+        // Search the snapshot in place.
+        std::size_t len;
+        lineBytes = m_snapshot->lineBytes(LineIndex(line), len);
+        lineLength = windowLength = (int)len;
+      }
+
+      lineMatches.clear();
+      findLineMatches(lineMatches, lineBytes, lineLength, windowLength,
+                      m_searchString, m_flags, matcher.get());
+      if (lineMatches.length() > 0) {
+        found.m_lines.push_back(line);
+        found.m_matches.insert(found.m_matches.end(),
+          lineMatches.getArray(), lineMatches.getArray() + lineMatches.length());
+        found.m_lineEnds.push_back((int)found.m_matches.size());
+      }
+    }
+
+    found.m_ready = true;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_chunks[chunk].swapWith(found);
+  }
+}
+
+
+std::optional<LineIndex> TextSearch::BackgroundScan::mapLine(
+  LineIndex line) const
+{
+  for (Edit const &e : m_edits) {
+    switch (e.m_kind) {
+      case EK_INSERT_LINE:
+        if (line >= e.m_line) {
+          line += LineDifference(e.m_count);
+        }
+        break;
+
+      case EK_DELETE_LINE:
+        if (line >= e.m_line + LineDifference(e.m_count)) {
+          line -= LineDifference(e.m_count);
+        }
+        else if (line >= e.m_line) {
+          return std::nullopt;
+        }
+        break;
+
+      case EK_CHANGE_LINE:
+        if (line >= e.m_line &&
+            line < e.m_line + LineDifference(e.m_count)) {
+          // The line was already recomputed from its new contents.
+          return std::nullopt;
+        }
+        break;
+    }
+  }
+
+  return line;
+}
+
+
 // -------------------------- TextSearch ---------------------------
 int TextSearch::s_objectCount = 0;
 
@@ -77,30 +724,115 @@ CHECK_OBJECT_COUNT(TextSearch);
 
 void TextSearch::recomputeMatches()
 {
+  // Any scan in progress is for old parameters or contents.
+  m_scan.reset();
+
   // Since we are going to recompute everything, reset this flag.
   m_incompleteMatches = false;
 
-  // Adjust sizes to match.
-  while (m_lineToMatches.length() < m_document->numLines()) {
-    m_lineToMatches.insert(m_lineToMatches.length(), NULL);
+  // Start with no matches.  If the scan is done in the background,
+  // they appear as it progresses.
+  m_matches->reset(m_document->numLines().get());
+
+  if (this->shouldScanInBackground()) {
+    this->startBackgroundScan();
   }
-  while (m_lineToMatches.length() > m_document->numLines()) {
-    m_lineToMatches.deleteElt(m_lineToMatches.length()-1);
+  else {
+    this->recomputeLineRange(LineIndex(0), LineIndex(m_document->numLines()));
   }
+}
+
 
-  this->recomputeLineRange(LineIndex(0), LineIndex(m_document->numLines()));
+bool TextSearch::shouldScanInBackground() const
+{
+  return m_backgroundScanLineThreshold > 0 &&
+         m_document->numLines().get() >= m_backgroundScanLineThreshold &&
+         !m_searchString.empty() &&
+         this->searchStringIsValid();
+}
+
+
+void TextSearch::startBackgroundScan()
+{
+  string searchString(m_searchString);
+  if (m_searchStringFlags & TextSearch::SS_CASE_INSENSITIVE) {
+    searchString = stringTolower(searchString);
+  }
+
+  // Reuse the snapshot of the previous scan if the document has not
+  // changed since, as when the search string is being typed.
+  if (!m_scanSnapshot) {
+    m_scanSnapshot = m_document->snapshot();
+  }
+
+  m_scan.reset(new BackgroundScan(m_scanSnapshot, searchString,
+                                  m_searchStringFlags, m_regex.get()));
+}
+
+
+bool TextSearch::mergeBackgroundResults()
+{
+  if (!m_scan) {
+    return false;
+  }
+
+  bool added = false;
+  bool hitLimit = false;
+  while (!hitLimit && !m_scan->allMerged()) {
+    // Take the next chunk's results if they are ready.
+    BackgroundScan::ChunkResult result;
+    {
+      std::lock_guard<std::mutex> lock(m_scan->m_mutex);
+      BackgroundScan::ChunkResult &chunk =
+        m_scan->m_chunks[m_scan->m_nextChunkToMerge];
+      if (!chunk.m_ready) {
+        break;
+      }
+      result.swapWith(chunk);
+    }
+    m_scan->m_nextChunkToMerge++;
+
+    for (std::size_t i=0; i < result.m_lines.size(); i++) {
+      std::optional<LineIndex> line =
+        m_scan->mapLine(LineIndex(result.m_lines[i]));
+      if (!line) {
+        continue;
+      }
+
+      int begin = (i==0? 0 : result.m_lineEnds[i-1]);
+      int count = result.m_lineEnds[i] - begin;
+      m_matches->setLineMatches(line->get(),
+        result.m_matches.data() + begin, count);
+      added = true;
+
+      m_scan->m_matchesMerged += count;
+      if (m_scan->m_matchesMerged > m_matchCountLimit) {
+        m_incompleteMatches = true;
+        hitLimit = true;
+        TRACE("TextSearch", "hit match limit of " << m_matchCountLimit);
+        break;
+      }
+    }
+  }
+
+  if (hitLimit || m_scan->allMerged()) {
+    TRACE("TextSearch", "background scan finished; merged " <<
+      m_scan->m_matchesMerged << " matches");
+    m_scan.reset();
+  }
+
+  return added;
 }
 
 
 void TextSearch::recomputeLineRange(LineIndex startLine, LineIndex endLinePlusOne)
 {
-  this->selfCheck();
+  xassert(documentLines() == m_document->numLines());
   xassert(startLine <= endLinePlusOne &&
                        endLinePlusOne <= m_document->numLines());
 
   // Performance measurement.
   unsigned startTime = fastTimeMilliseconds;
-  unsigned totalDeletionTime = 0;
 
   // Count of matches during this recomputation.
   int matchesFound = 0;
@@ -111,18 +843,42 @@ void TextSearch::recomputeLineRange(LineIndex startLine, LineIndex endLinePlusOn
     searchStringCopy = stringTolower(searchStringCopy);
   }
 
-  // Get search string info into locals.
-  char const *searchString = searchStringCopy.c_str();
-  ByteCount searchStringLength(searchStringCopy.length());
-
   // Treat an invalid regex like an empty search string.
+  bool searching = !searchStringCopy.empty();
   if (m_regex.get() && !m_regex->isValid()) {
-    searchStringLength.set(0);
+    searching = false;
   }
 
-  // Temporary array into which we copy line contents.
+  // Temporary array into which the recently edited line is copied.
   ArrayStack<char> contents;
 
+  // Regex matcher, reused for every line.
+  std::unique_ptr<UTF8RegexMatcher> matcher;
+  if (searching && m_regex) {
+    matcher.reset(new UTF8RegexMatcher(*m_regex));
+  }
+
+  // When matches can span lines, one that starts on a line in the
+  // range can extend into the lines that follow it, so copy all of
+  // those lines into 'window', each followed by a newline.  Element
+  // 'i' of 'windowLineStarts' is the offset of line 'startLine+i', and
+  // there is one more element for the end.
+  bool const multiLine = searching && this->matchesCanSpanLines();
+  ArrayStack<char> window;
+  std::vector<int> windowLineStarts;
+  if (multiLine) {
+    int windowEndLine = std::min(
+      endLinePlusOne.get() + MAX_MATCH_LINES - 1,
+      m_document->numLines().get());
+    for (int i = startLine.get(); i < windowEndLine; i++) {
+      windowLineStarts.push_back(window.length());
+      m_document->getWholeLine(LineIndex(i), window);
+      window.push('\n');
+    }
+    windowLineStarts.push_back(window.length());
+  }
+  int const numWindowLines = (int)windowLineStarts.size() - 1;
+
   // Temporary array of extents for search hits.  This is rebuilt for
   // each line, but only rarely reallocated.
   ArrayStack<MatchExtent> lineMatches;
@@ -132,80 +888,33 @@ void TextSearch::recomputeLineRange(LineIndex startLine, LineIndex endLinePlusOn
     lineMatches.clear();
 
     // Scan the line for matches.
-    if (searchStringLength == 0) {
+    if (!searching) {
       // Empty string never matches anything.
     }
     else {
-      // Get the line of text.
-      contents.clear();
-      m_document->getWholeLine(line, contents);
-      int lineLength = contents.length();
-
-      // Add a NUL byte so 'strstr' can work on it.  This byte is
-      // not included in 'lineLength'.
-      contents.push(0);
-
-      char *buffer = contents.getArrayNC();
-
-      // Optionally lowercase the string to search in.
-      if (m_searchStringFlags & TextSearch::SS_CASE_INSENSITIVE) {
-        for (int i=0; i<lineLength; i++) {
-          if ('A' <= buffer[i] && buffer[i] <= 'Z') {
-            buffer[i] += ('a' - 'A');
-          }
-        }
-      }
-
-      if (m_regex.get()) {
-        // TODO: Converting every line from UTF-8 to UTF-16 is
-        // inefficient!  It seems I can't even avoid the memory
-        // allocation; there is almost a fast-path with
-        // QTextDecoder::toUnicode(Qtring*), but it does not quite go all
-        // the way.
-        //
-        // I probably need to find a different regex engine, ideally
-        // something that can operate on UTF-8 directly.
-        QString lineQString(QString::fromUtf8(buffer, lineLength));
-
-        QRegularExpressionMatchIterator iter(m_regex->globalMatch(lineQString));
-        while (iter.hasNext()) {
-          QRegularExpressionMatch match(iter.next());
-
-          // TODO UTF-8: This incorrectly equates UTF-16 code units with
-          // UTF-8 octets.
-          lineMatches.push(MatchExtent(
-            ByteIndex(match.capturedStart()),
-            ByteCount(match.capturedLength())));
-        }
+      char const *lineBytes;
+      int lineLength;
+      int windowLength;
+      if (multiLine) {
+        // Window from this line through the last one a match starting
+        // here can reach, excluding the final newline.
+        int i = line.get() - startLine.get();
+        int last = std::min(i + MAX_MATCH_LINES, numWindowLines) - 1;
+        lineBytes = window.getArray() + windowLineStarts[i];
+        lineLength = windowLineStarts[i+1] - 1 - windowLineStarts[i];
+        windowLength = windowLineStarts[last+1] - 1 - windowLineStarts[i];
       }
       else {
-        // Byte offset within the line to begin the next search.
-        ByteIndex offset(0);
-
-        while (offset+searchStringLength <= lineLength) {
-          char *nextMatch = strstr(buffer+offset, searchString);
-          if (nextMatch) {
-            // Offset where we found the match.
-            offset = ByteIndex(nextMatch - buffer);
-
-            // Record the match.
-            lineMatches.push(MatchExtent(offset, searchStringLength));
-
-            // Move one past the match so that subsequent matches are not
-            // adjacent, since the UI would show adjacent matches as if they
-            // were one long match.
-            //
-            // Note: With the regex engine, I can get both adjacent and
-            // zero-width matches.  The handling in EditorWidget isn't
-            // great, but it is not catastrophic.
-            offset += searchStringLength.succ();
-          }
-          else {
-            break;
-          }
-        }
+        // Get the line of text, usually without copying it.
+        lineBytes = m_document->getLineBytes(line, contents);
+        lineLength = m_document->lineLengthBytes(line).get();
+        windowLength = lineLength;
       }
 
+      findLineMatches(lineMatches, lineBytes, lineLength, windowLength,
+                      searchStringCopy, m_searchStringFlags,
+                      matcher.get());
+
       // Check the match limit.
       matchesFound += lineMatches.length();
       if (matchesFound > m_matchCountLimit) {
@@ -214,52 +923,40 @@ void TextSearch::recomputeLineRange(LineIndex startLine, LineIndex endLinePlusOn
 
         // Skip all remaining matches, but do continue iterating through
         // the file in order to discard previous matches.
-        searchStringLength.set(0);
+        searching = false;
       }
     }
 
-    // Replace the corresponding element of 'm_lineToMatches' if it is
-    // different from what we just computed.  This algorithm tries to
-    // minimize allocator traffic in the common case that the matches
-    // from a previous run are similar or identical to those now.
-    ArrayStack<MatchExtent> *existing = m_lineToMatches.get(line.get());
-    if (lineMatches.length() == 0) {
-      if (existing == NULL) {
-        // Both empty.
-      }
-      else {
-        // Remove and deallocate.
-        FastTimeAccumulator acc(totalDeletionTime);
-        delete m_lineToMatches.replace(line.get(), NULL);
-      }
-    }
-    else {
-      if (existing == NULL) {
-        // Install copy of new array.
-        m_lineToMatches.replace(line.get(),
-          new ArrayStack<MatchExtent>(lineMatches));
-      }
-      else if (lineMatches == *existing) {
-        // Same contents.
-      }
-      else {
-        // Copy contents.
-        *existing = lineMatches;
-      }
-    }
+    // Replace the matches for this line.  When the number of matches
+    // is unchanged, this just overwrites them in place.
+    m_matches->setLineMatches(line.get(),
+      lineMatches.getArray(), lineMatches.length());
   } // for(line)
 
   unsigned elapsed = fastTimeMilliseconds - startTime;
   if (elapsed > 100) {
-    TRACE("TextSearch", "recomputeLineRange took " << elapsed <<
-      " ms; totalDeletionTime=" << totalDeletionTime);
+    TRACE("TextSearch", "recomputeLineRange took " << elapsed << " ms");
   }
 }
 
 
-void TextSearch::recomputeLine(LineIndex line)
+void TextSearch::recomputeLines(LineIndex line, LineIndex lastLine)
 {
-  recomputeLineRange(line, line.succ());
+  // A match that starts on one of the preceding lines can reach these
+  // if matches can span lines.
+  LineIndex firstLine = line;
+  if (this->matchesCanSpanLines()) {
+    firstLine = LineIndex(std::max(0, line.get() - (MAX_MATCH_LINES-1)));
+  }
+
+  recomputeLineRange(firstLine, lastLine.succ());
+
+  if (m_scan) {
+    // Results from the snapshot are now stale for these lines.
+    m_scan->m_edits.push_back(
+      BackgroundScan::Edit(BackgroundScan::EK_CHANGE_LINE, firstLine,
+                           (lastLine - firstLine).get() + 1));
+  }
 }
 
 
@@ -267,8 +964,19 @@ void TextSearch::observeInsertLine(TextDocumentCore const &doc, LineIndex line)
 {
   GENERIC_CATCH_BEGIN
   xassert(&doc == m_document);
-  m_lineToMatches.insert(line.get(), NULL);
+  m_scanSnapshot.reset();
+  m_matches->insertLine(line.get());
+  if (m_scan) {
+    m_scan->m_edits.push_back(
+      BackgroundScan::Edit(BackgroundScan::EK_INSERT_LINE, line));
+  }
   this->selfCheck();
+
+  // The new line is empty, so it only matters to matches that span
+  // lines, which can now reach it from the preceding lines.
+  if (this->matchesCanSpanLines()) {
+    this->recomputeLine(line);
+  }
   GENERIC_CATCH_END
 }
 
@@ -277,8 +985,19 @@ void TextSearch::observeDeleteLine(TextDocumentCore const &doc, LineIndex line)
 {
   GENERIC_CATCH_BEGIN
   xassert(&doc == m_document);
-  m_lineToMatches.deleteElt(line.get());
+  m_scanSnapshot.reset();
+  m_matches->deleteLine(line.get());
+  if (m_scan) {
+    m_scan->m_edits.push_back(
+      BackgroundScan::Edit(BackgroundScan::EK_DELETE_LINE, line));
+  }
   this->selfCheck();
+
+  // Similarly, matches spanning lines that reached the deleted line
+  // now reach the one after it.
+  if (this->matchesCanSpanLines() && line.get() > 0) {
+    this->recomputeLine(line.pred());
+  }
   GENERIC_CATCH_END
 }
 
@@ -287,6 +1006,7 @@ void TextSearch::observeInsertText(TextDocumentCore const &doc, TextMCoord tc, c
 {
   GENERIC_CATCH_BEGIN
   xassert(&doc == m_document);
+  m_scanSnapshot.reset();
   this->recomputeLine(tc.m_line);
   GENERIC_CATCH_END
 }
@@ -296,6 +1016,7 @@ void TextSearch::observeDeleteText(TextDocumentCore const &doc, TextMCoord tc, B
 {
   GENERIC_CATCH_BEGIN
   xassert(&doc == m_document);
+  m_scanSnapshot.reset();
   this->recomputeLine(tc.m_line);
   GENERIC_CATCH_END
 }
@@ -305,20 +1026,61 @@ void TextSearch::observeTotalChange(TextDocumentCore const &doc) NOEXCEPT
 {
   GENERIC_CATCH_BEGIN
   xassert(&doc == m_document);
+  m_scanSnapshot.reset();
   this->recomputeMatches();
   GENERIC_CATCH_END
 }
 
 
+void TextSearch::observeReplaceRange(TextDocumentCore const &doc, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount length) NOEXCEPT
+{
+  GENERIC_CATCH_BEGIN
+  xassert(&doc == m_document);
+  m_scanSnapshot.reset();
+
+  // The lines after the first one of the range were replaced by the
+  // lines after the first one of the new text.  Account for any
+  // difference in their number just below the first line; all of them
+  // are recomputed below anyway.
+  LineIndex const first = oldRange.m_start.m_line;
+  int const oldExtra = (oldRange.m_end.m_line - first).get();
+  int const newExtra = (newEnd.m_line - first).get();
+  LineIndex const splice = first.succ();
+  for (int i = newExtra; i < oldExtra; i++) {
+    m_matches->deleteLine(splice.get());
+  }
+  for (int i = oldExtra; i < newExtra; i++) {
+    m_matches->insertLine(splice.get());
+  }
+  if (m_scan && oldExtra != newExtra) {
+    m_scan->m_edits.push_back(
+      oldExtra > newExtra?
+        BackgroundScan::Edit(BackgroundScan::EK_DELETE_LINE,
+                             splice, oldExtra - newExtra) :
+        BackgroundScan::Edit(BackgroundScan::EK_INSERT_LINE,
+                             splice, newExtra - oldExtra));
+  }
+  this->selfCheck();
+
+  // One pass recomputes every line whose contents changed.
+  this->recomputeLines(first, newEnd.m_line);
+  GENERIC_CATCH_END
+}
+
+
 TextSearch::TextSearch(TextDocumentCore const *document)
   : TextDocumentObserver(),
     m_document(document),
     m_searchString(""),
     m_searchStringFlags(SS_NONE),
-    m_matchCountLimit(1000),
+    m_matchCountLimit(DEFAULT_MATCH_COUNT_LIMIT),
     m_incompleteMatches(false),
     m_regex(NULL),
-    m_lineToMatches()
+    m_matches(new MatchStore),
+    m_lineMatchesForClient(),
+    m_backgroundScanLineThreshold(0),
+    m_scan(),
+    m_scanSnapshot()
 {
   this->recomputeMatches();
 
@@ -340,7 +1102,14 @@ TextSearch::~TextSearch()
 
 void TextSearch::selfCheck() const
 {
-  xassert(m_lineToMatches.length() == m_document->numLines());
+  m_matches->selfCheck();
+  xassert(documentLines() == m_document->numLines());
+}
+
+
+LineCount TextSearch::documentLines() const
+{
+  return LineCount(m_matches->numLines());
 }
 
 
@@ -372,10 +1141,8 @@ void TextSearch::setSearchStringAndFlags(string const &s, SearchStringFlags f)
 void TextSearch::computeRegex()
 {
   if (m_searchStringFlags & SS_REGEX) {
-    m_regex = new QRegularExpression(toQString(m_searchString),
-      (m_searchStringFlags & SS_CASE_INSENSITIVE)?
-        QRegularExpression::CaseInsensitiveOption :
-        QRegularExpression::NoPatternOption);
+    m_regex = new UTF8Regex(m_searchString,
+      m_searchStringFlags & SS_CASE_INSENSITIVE);
   }
   else {
     m_regex.del();
@@ -397,7 +1164,7 @@ bool TextSearch::searchStringIsValid() const
 string TextSearch::searchStringSyntaxError() const
 {
   if (m_regex && !m_regex->isValid()) {
-    return toString(m_regex->errorString());
+    return m_regex->errorMessage();
   }
   else {
     return "";
@@ -408,7 +1175,7 @@ string TextSearch::searchStringSyntaxError() const
 int TextSearch::searchStringErrorOffset() const
 {
   if (m_regex && !m_regex->isValid()) {
-    return m_regex->patternErrorOffset();
+    return m_regex->errorOffset();
   }
   else {
     return -1;
@@ -423,129 +1190,98 @@ bool TextSearch::searchStringEndsWithEOL() const
 }
 
 
-int TextSearch::countRangeMatches(LineIndex startLine, LineIndex endPlusOneLine) const
+bool TextSearch::matchesCanSpanLines() const
 {
-  int ret = 0;
+  return m_regex && m_regex->canMatchNewline();
+}
 
-  for (LineIndex line=startLine; line < endPlusOneLine; ++line) {
-    if (line < documentLines()) {
-      ArrayStack<MatchExtent> const *matches = m_lineToMatches.getC(line.get());
-      if (matches) {
-        ret += matches->length();
-      }
-    }
+
+int TextSearch::countRangeMatches(LineIndex startLine, LineIndex endPlusOneLine) const
+{
+  int numLines = m_matches->numLines();
+  int start = std::min(startLine.get(), numLines);
+  int end = std::min(endPlusOneLine.get(), numLines);
+  if (start >= end) {
+    return 0;
   }
 
-  return ret;
+  return m_matches->lineFirstMatch(end) - m_matches->lineFirstMatch(start);
 }
 
 
 ArrayStack<TextSearch::MatchExtent> const &TextSearch::getLineMatches(LineIndex line) const
 {
   xassert(line < documentLines());
-  ArrayStack<MatchExtent> const *matches = m_lineToMatches.getC(line.get());
-  xassert(matches);
-  return *matches;
+  xassert(m_matches->lineMatchCount(line.get()) > 0);
+  m_matches->getLineMatches(line.get(), m_lineMatchesForClient);
+  return m_lineMatchesForClient;
 }
 
 
-template <class T>
-static bool reversibleLT(bool reverse, T const &a, T const &b)
+int TextSearch::matchIndexAfter(TextMCoord const &tc, bool strict) const
 {
-  return (reverse? b<a : a<b);
+  if (tc.m_line >= documentLines()) {
+    return m_matches->numMatches();
+  }
+  return m_matches->lineMatchAfter(tc.m_line.get(), tc.m_byteIndex, strict);
 }
 
-template <class T>
-static bool reversibleLTE(bool reverse, T const &a, T const &b)
+
+TextMCoordRange TextSearch::matchRange(int index) const
 {
-  return (reverse? b<=a : a<=b);
+  MatchExtent m = m_matches->getMatch(index);
+  TextMCoord start(LineIndex(m_matches->matchLine(index)), m.m_startByte);
+  TextMCoord end(start);
+  m_document->walkCoordBytesValid(end, +m.m_lengthBytes);
+  return TextMCoordRange(start, end);
 }
 
+
 bool TextSearch::nextMatch(bool reverse, TextMCoordRange &range /*INOUT*/) const
 {
   // Normalize coordinates.
   range.rectify();
 
-  // Direction of travel.  (This is applied to both lines and bytes, so
-  // it is not a `LineDifference`.)
-  int inc = (reverse? -1 : +1);
-
-  // Consider line with range start.
-  if (countLineMatches(range.m_start.m_line)) {
-    ArrayStack<MatchExtent> const &matches =
-      this->getLineMatches(range.m_start.m_line);
-
-    // Nominally walk forward.
-    int begin = 0;
-    int end = matches.length()-1;
-
-    // But maybe reverse.
-    if (reverse) {
-      swap(begin, end);
-    }
-
-    // Walk the matches in 'inc' direction.
-    for (int i=begin; reversibleLTE(reverse, i, end); i += inc) {
-      MatchExtent const &m = matches[i];
-      if (reversibleLT(reverse, m.m_startByte, range.m_start.m_byteIndex)) {
-        // This match occurs before 'range.start'.
+  if (!reverse) {
+    // Walk forward from the first match that starts at or after
+    // 'range.start'.
+    int numMatches = m_matches->numMatches();
+    for (int i = this->matchIndexAfter(range.m_start, false /*strict*/);
+         i < numMatches;
+         i++) {
+      TextMCoordRange m = this->matchRange(i);
+      if (m.m_start == range.m_start && m.m_end <= range.m_end) {
+        // The match end is less than or equal to my current mark.  I
+        // regard that as being the match we are on or already past,
+        // so keep going.
         continue;
       }
 
-      // Where does this match end?
-      TextMCoord matchEnd(range.m_start.m_line, m.m_startByte);
-      m_document->walkCoordBytesValid(matchEnd, +m.m_lengthBytes);
-
-      // Now, how does its start compare to 'range.start'?
-      if (m.m_startByte == range.m_start.m_byteIndex) {
-        // How does the end compare to 'range.end'?
-        if (reversibleLTE(reverse, matchEnd, range.m_end)) {
-          // The match end is less than or equal to my current mark.  I
-          // regard that as being the match we are on or already past,
-          // so keep going.
-          continue;
-        }
-        else {
-          // The match end is further than mark.  We will return this
-          // one, effectively extending the selection to get it.  (If
-          // 'reverse', we are actually shrinking the match.)
-          range.m_end = matchEnd;
-          return true;
-        }
-      }
-      else {
-        // This is the first match after the range start.
-        range.m_start.m_byteIndex = m.m_startByte;
-        range.m_end = matchEnd;
-        return true;
-      }
+      // Either this is the first match after the range start, or it
+      // starts at the same place but ends further, effectively
+      // extending the selection to get it.
+      range = m;
+      return true;
     }
   }
+  else {
+    // Walk backward from the last match that starts at or before
+    // 'range.start'.
+    for (int i = this->matchIndexAfter(range.m_start, true /*strict*/) - 1;
+         i >= 0;
+         i--) {
+      TextMCoordRange m = this->matchRange(i);
+      if (m.m_start == range.m_start && range.m_end <= m.m_end) {
+        // Same as above, in reverse.
+        continue;
+      }
 
-  // Consider other lines.
-  if (!range.m_start.m_line.tryIncrease(LineDifference(inc))) {
-    return false;
-  }
-  while (reverse? true /*tryIncrease does the check*/ :
-                  range.m_start.m_line < this->documentLines()) {
-    if (countLineMatches(range.m_start.m_line)) {
-      // Grab the extreme match on this line.
-      ArrayStack<MatchExtent> const &matches =
-        this->getLineMatches(range.m_start.m_line);
-      int i = (reverse? matches.length()-1 : 0);
-      MatchExtent const &m = matches[i];
-
-      // Found first match after 'range.start' on another line.
-      range.m_start.m_byteIndex = m.m_startByte;
-      range.m_end = range.m_start;
-      m_document->walkCoordBytesValid(range.m_end, +m.m_lengthBytes);
+      // Either this is the first match before the range start, or it
+      // starts at the same place and ends sooner, shrinking the
+      // selection.
+      range = m;
       return true;
     }
-
-    // Keep looking on subsequent lines.
-    if (!range.m_start.m_line.tryIncrease(LineDifference(inc))) {
-      return false;
-    }
   }
 
   return false;
@@ -560,21 +1296,21 @@ bool TextSearch::rangeIsMatch(TextMCoord const &a0, TextMCoord const &b0) const
     swap(a,b);
   }
 
-  if (a.m_line != b.m_line) {
-    // Currently we never match across line boundaries.
+  if (a.m_line != b.m_line && !matchesCanSpanLines()) {
     return false;
   }
 
-  if (countLineMatches(a.m_line)) {
-    ArrayStack<MatchExtent> const &matches =
-      this->getLineMatches(a.m_line);
-
-    for (int i=0; i < matches.length(); i++) {
-      MatchExtent const &m = matches[i];
-      if (m.m_startByte == a.m_byteIndex &&
-          m.m_lengthBytes == (b.m_byteIndex - a.m_byteIndex)) {
-        return true;
-      }
+  // Check the matches that start at 'a'.
+  int numMatches = m_matches->numMatches();
+  for (int i = this->matchIndexAfter(a, false /*strict*/);
+       i < numMatches;
+       i++) {
+    TextMCoordRange m = this->matchRange(i);
+    if (m.m_start != a) {
+      break;
+    }
+    if (m.m_end == b) {
+      return true;
     }
   }
 
@@ -587,8 +1323,12 @@ string TextSearch::getReplacementText(string const &existing,
 {
   if (m_regex) {
     // Match the regular expression so we can get the capture groups.
-    QRegularExpressionMatch match = m_regex->match(toQString(existing));
-    if (!match.hasMatch()) {
+    std::unique_ptr<UTF8RegexMatcher> matcher;
+    if (m_regex->isValid()) {
+      matcher.reset(new UTF8RegexMatcher(*m_regex));
+      matcher->start(existing.data(), existing.size());
+    }
+    if (!matcher || !matcher->next()) {
       DEV_WARNING("TextSearch::getReplacementText failed to match regex; " <<
         DEBUG_VALUES4(m_searchString, m_regex->pattern(), existing, replaceSpec));
       return existing;
@@ -611,8 +1351,10 @@ string TextSearch::getReplacementText(string const &existing,
         else if ('0' <= *p && *p <= '9') {
           // Numbered capture group.
           int digit = (*p - '0');
-          QString capture = match.captured(digit);
-          sb << toString(capture);
+          std::size_t start, end;
+          if (matcher->captureGroup(digit, start, end)) {
+            sb << existing.substr(start, end-start);
+          }
         }
         else if (*p == 'n') {
           sb << '\n';
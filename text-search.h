@@ -8,8 +8,8 @@
 #include "byte-index.h"                // ByteIndex
 #include "line-count.h"                // LineCount
 #include "line-index.h"                // LineIndex
-#include "ogap.h"                      // OGapArray
 #include "td-core.h"                   // TextDocumentCore
+#include "td-snapshot-fwd.h"           // TextDocumentSnapshot [n]
 
 // smbase
 #include "smbase/array.h"              // ArrayStack
@@ -21,7 +21,10 @@
 #include "smbase/sm-override.h"        // OVERRIDE
 #include "smbase/str.h"                // string
 
-class QRegularExpression;
+// libc++
+#include <memory>                      // std::unique_ptr, std::shared_ptr
+
+class UTF8Regex;
 
 
 // This class computes a set of search hits within a TextDocumentCore,
@@ -40,15 +43,16 @@ public:      // types
     SS_ALL                   = 0x03
   };
 
-  // Describes a match within a given line of text.
-  //
-  // TODO UTF-8: Review and revise.
+  // Describes a match that starts on a given line of text.
   class MatchExtent {
   public:
     // Byte offset of the start of the match.
     ByteIndex m_startByte;
 
-    // Length of the match, in bytes.
+    // Length of the match, in bytes.  If the match spans lines (see
+    // 'matchesCanSpanLines'), this extends past the end of the line,
+    // counting one byte for each line break, as in
+    // 'TextDocumentCore::walkCoordBytes'.
     ByteCount m_lengthBytes;
 
   public:
@@ -64,9 +68,26 @@ public:      // types
     void insertOstream(ostream &os) const;
   };
 
+private:     // types
+  // The matches for the whole document, stored compactly.  Defined in
+  // text-search.cc.
+  class MatchStore;
+
+  // A scan for matches running on worker threads against a snapshot of
+  // the document.  Defined in text-search.cc.
+  class BackgroundScan;
+
 public:      // class data
   static int s_objectCount;
 
+  // When matches can span lines, a match that starts on line L must
+  // end by the end of line L+MAX_MATCH_LINES-1.  This bounds the work
+  // needed to update the matches after an edit.
+  static int const MAX_MATCH_LINES = 32;
+
+  // Initial value of 'm_matchCountLimit'.
+  static int const DEFAULT_MATCH_COUNT_LIMIT = 10000000;
+
 private:     // instance data
   // The document in which we are searching.  We also act as an
   // observer of this document in order to maintain the matches
@@ -84,7 +105,9 @@ private:     // instance data
   // Maximum number of hits to find in a single invocation of
   // 'recomputeLineRange'.  If this is exceeded, 'm_incompleteMatches'
   // is set to true and recomputation stops, except that old matches
-  // are still always cleared.  Initially 1000.
+  // are still always cleared.  Initially 'DEFAULT_MATCH_COUNT_LIMIT',
+  // which is only meant to bound memory usage for pathological
+  // searches, like a regex that matches every character.
   //
   // Note that this is not a precise limit.  The point at which it is
   // hit can vary depending on how matches are arranged on lines and
@@ -96,32 +119,69 @@ private:     // instance data
   bool m_incompleteMatches;
 
   // Regular expression object for SS_REGEX.  May be NULL.
-  Owner<QRegularExpression> m_regex;
+  Owner<UTF8Regex> m_regex;
 
-  // Map from line number to matches for that line.  If there are no
-  // matches on the line, stores NULL.
-  //
-  // The matches for a line are sorted by 'm_start', then by 'm_length'.
-  // There are no duplicates.
+  // All of the matches, organized by line.  The matches for a line
+  // are sorted by 'm_start', then by 'm_length'.  There are no
+  // duplicates.  Never NULL.
   //
   // This is kept up to date as we observe changes to 'm_document', or
   // the values of 'm_searchString' or 'm_searchStringFlags' are set by
   // the client.
-  OGapArray<ArrayStack<MatchExtent> > m_lineToMatches;
+  std::unique_ptr<MatchStore> m_matches;
+
+  // Storage for the array returned by 'getLineMatches'.
+  mutable ArrayStack<MatchExtent> m_lineMatchesForClient;
+
+  // When recomputing all matches in a document with at least this many
+  // lines, do the work on worker threads rather than immediately.  0
+  // means never.  Initially 0.
+  int m_backgroundScanLineThreshold;
+
+  // The background scan in progress, if any.  While it runs,
+  // 'm_matches' holds the results merged so far, plus the
+  // matches on lines edited since it started.
+  std::unique_ptr<BackgroundScan> m_scan;
+
+  // The snapshot most recently given to a background scan, kept until
+  // the document changes so that a scan for new search parameters can
+  // reuse it.  It is released on any change rather than kept longer
+  // because it keeps the document's freed line storage from being
+  // reused.  May be null.
+  std::shared_ptr<TextDocumentSnapshot const> m_scanSnapshot;
 
 private:     // funcs
   // Recompute the set of matches from scratch.
   void recomputeMatches();
 
+  // True if 'recomputeMatches' should use a background scan.
+  bool shouldScanInBackground() const;
+
+  // Discard all matches and start a background scan to find them.
+  void startBackgroundScan();
+
   // Recompute a given range.  The document sizes have to be right.
   void recomputeLineRange(LineIndex startLine, LineIndex endLinePlusOne);
 
-  // Recompute a single line.
-  void recomputeLine(LineIndex line);
+  // Recompute the matches that could be affected by a change to the
+  // lines in ['line', 'lastLine'], which includes matches on preceding
+  // lines if matches can span lines.
+  void recomputeLines(LineIndex line, LineIndex lastLine);
+
+  // Same, for just 'line'.
+  void recomputeLine(LineIndex line) { recomputeLines(line, line); }
 
   // Compute 'm_regex' from the search string and flags.
   void computeRegex();
 
+  // Index in 'm_matches' of the first match that starts at or after
+  // 'tc', or strictly after it if 'strict'.  If there is none, return
+  // the total number of matches.
+  int matchIndexAfter(TextMCoord const &tc, bool strict) const;
+
+  // Get the document range covered by the match at 'index'.
+  TextMCoordRange matchRange(int index) const;
+
 public:      // funcs
   TextSearch(TextDocumentCore const *document);
   ~TextSearch();
@@ -136,8 +196,7 @@ public:      // funcs
 
   // Number of lines in the document, which establishes the range from
   // which 'countRangeMatches' can yield useful data.
-  LineCount documentLines() const
-    { return LineCount(m_lineToMatches.length()); }
+  LineCount documentLines() const;
 
   // True if we have an active search string.
   bool hasSearchString() const { return !m_searchString.empty(); }
@@ -174,15 +233,43 @@ public:      // funcs
   // True if we are searching by regex, and the regex ends with "$".
   bool searchStringEndsWithEOL() const;
 
+  // True if we are searching by regex, and the regex explicitly
+  // matches a line break (for example, with "\n"), in which case a
+  // match can span up to 'MAX_MATCH_LINES' lines.
+  bool matchesCanSpanLines() const;
+
   // Set/get limit on matches.
   int matchCountLimit() const { return m_matchCountLimit; }
   void setMatchCountLimit(int limit) { m_matchCountLimit = limit; }
 
-  // True if the set of matches is incomplete.
-  bool hasIncompleteMatches() const { return m_incompleteMatches; }
+  // True if the set of matches is incomplete, either because the limit
+  // was hit or because a background scan is still running.
+  bool hasIncompleteMatches() const
+    { return m_incompleteMatches || isScanning(); }
+
+  // Set/get the line count at which recomputing all matches is done in
+  // the background.  See 'm_backgroundScanLineThreshold'.
+  int backgroundScanLineThreshold() const
+    { return m_backgroundScanLineThreshold; }
+  void setBackgroundScanLineThreshold(int lines)
+    { m_backgroundScanLineThreshold = lines; }
+
+  // True if a background scan is running.  Its results only become
+  // visible through calls to 'mergeBackgroundResults'.
+  bool isScanning() const { return m_scan != nullptr; }
+
+  // Incorporate the results that the background scan has produced
+  // since the last call, in document order.  When it has all been
+  // incorporated, or the match limit is hit, the scan ends.  Return
+  // true if any matches were added.
+  //
+  // This must be called periodically by the client while 'isScanning()'
+  // is true.
+  bool mergeBackgroundResults();
 
   // Count the matches within a given range of lines.  Lines beyond
-  // the document's current contents silently yield a 0 count.
+  // the document's current contents silently yield a 0 count.  This
+  // takes constant time, as do the other counting functions below.
   int countRangeMatches(LineIndex startLine, LineIndex endPlusOneLine) const;
 
   // Count the matches above a line.
@@ -218,10 +305,13 @@ public:      // funcs
   //
   // If the return value is false, the output value of 'range' is
   // unspecified.
+  //
+  // This takes time logarithmic in the number of matches.
   bool nextMatch(bool reverse, TextMCoordRange &range /*INOUT*/) const;
 
   // Return true if there is a match starting at 'a' and going up to
   // but not including 'b'; or one from 'b' to 'a' in the same manner.
+  // Both must be valid coordinates.
   bool rangeIsMatch(TextMCoord const &a, TextMCoord const &b) const;
 
   // Compute the replacement text for 'existing', given 'replaceSpec',
@@ -235,6 +325,7 @@ public:      // funcs
   virtual void observeInsertText(TextDocumentCore const &buf, TextMCoord tc, char const *text, ByteCount length) NOEXCEPT OVERRIDE;
   virtual void observeDeleteText(TextDocumentCore const &buf, TextMCoord tc, ByteCount length) NOEXCEPT OVERRIDE;
   virtual void observeTotalChange(TextDocumentCore const &doc) NOEXCEPT OVERRIDE;
+  virtual void observeReplaceRange(TextDocumentCore const &doc, TextMCoordRange const &oldRange, TextMCoord newEnd, char const *text, ByteCount length) NOEXCEPT OVERRIDE;
 };
 
 
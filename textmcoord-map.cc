@@ -1206,6 +1206,69 @@ void TextMCoordMap::deleteLineBytes(TextMCoord tc, ByteCount lengthBytes)
 }
 
 
+void TextMCoordMap::collapseLineAfter(TextMCoord tc)
+{
+  if (LineData *lineData = getLineData(tc.m_line)) {
+    if (std::optional<ByteIndex> largest = lineData->largestByteIndex()) {
+      if (*largest > tc.m_byteIndex) {
+        lineData->deleteBytes(tc.m_byteIndex,
+          ByteCount(*largest - tc.m_byteIndex));
+      }
+    }
+  }
+}
+
+
+void TextMCoordMap::replaceRange(
+  TextMCoordRange const &oldRange, TextMCoord newEnd)
+{
+  xassert(canTrackUpdates());
+
+  TextMCoord const start = oldRange.m_start;
+  TextMCoord const end = oldRange.m_end;
+
+  // Remove the old text.
+  if (start.m_line == end.m_line) {
+    deleteLineBytes(start,
+      ByteCount(end.m_byteIndex - start.m_byteIndex));
+  }
+  else {
+    LineCount const removedLines(end.m_line - start.m_line);
+
+    deleteLineBytes(TextMCoord(end.m_line, ByteIndex(0)),
+                    ByteCount(end.m_byteIndex));
+
+    if (start.m_byteIndex.isZero()) {
+      // The lines before `end` go away entirely, and what remains of
+      // the `end` line moves up into their place.
+      deleteLines(start.m_line, removedLines);
+    }
+    else {
+      // The tail of the first line is deleted, and the remainder of the
+      // `end` line is spliced onto it.  Like the piecewise edits, this
+      // does not carry boundaries along with the spliced text.
+      collapseLineAfter(start);
+      deleteLines(start.m_line.succ(), removedLines);
+    }
+  }
+
+  // Insert the new text.
+  if (start.m_line == newEnd.m_line) {
+    insertLineBytes(start,
+      ByteCount(newEnd.m_byteIndex - start.m_byteIndex));
+  }
+  else {
+    // Boundaries after `start` stay on the first line.  The piecewise
+    // edits would leave them after that line's part of the inserted
+    // text, but we only know where the text ends, so they go to
+    // `start`.
+    collapseLineAfter(start);
+    insertLines(start.m_line.succ(),
+                LineCount(newEnd.m_line - start.m_line));
+  }
+}
+
+
 bool TextMCoordMap::empty() const
 {
   return m_values.empty();
@@ -392,6 +392,10 @@ private:     // methods
   // Build a coordinate from a `LineAndBoundary`.
   static TextMCoord labToTMC(LineAndBoundary lab);
 
+  // Move every boundary on `tc.m_line` that is after `tc` to `tc`, as
+  // if the rest of the line had been deleted.
+  void collapseLineAfter(TextMCoord tc);
+
 public:      // methods
   ~TextMCoordMap();
 
@@ -466,6 +470,13 @@ public:      // methods
   // left, and boundaries within the deleted region to `tc`.
   void deleteLineBytes(TextMCoord tc, ByteCount lengthBytes);
 
+  // Replace `oldRange` with text that ends at `newEnd`, which is what
+  // `TextDocumentObserver::observeReplaceRange` reports.  The result
+  // is essentially the same as for the sequence of line and byte
+  // insertions and deletions that would make that change one piece at
+  // a time.
+  void replaceRange(TextMCoordRange const &oldRange, TextMCoord newEnd);
+
 
   // ---- Query the mapping ----
   // True if `numEntries()` is zero.
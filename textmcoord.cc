@@ -3,6 +3,7 @@
 
 #include "textmcoord.h"                // this module
 
+#include "byte-count.h"                // ByteCount
 #include "byte-difference.h"           // ByteDifference
 #include "line-number.h"               // LineNumber
 
@@ -44,6 +45,23 @@ TextMCoord TextMCoord::plusBytes(ByteDifference n) const
 }
 
 
+TextMCoord TextMCoord::plusText(char const *text, ByteCount len) const
+{
+  TextMCoord ret(*this);
+  char const *end = text + len;
+  char const *lineStart = text;
+  for (char const *p = text; p < end; p++) {
+    if (*p == '\n') {
+      ++ret.m_line;
+      ret.m_byteIndex.set(0);
+      lineStart = p+1;
+    }
+  }
+  ret.m_byteIndex += ByteCount(end - lineStart);
+  return ret;
+}
+
+
 void TextMCoord::insert(std::ostream &os) const
 {
   os << this->m_line << ':' << this->m_byteIndex;
@@ -6,6 +6,7 @@
 
 #include "textmcoord-fwd.h"            // fwds for this module
 
+#include "byte-count-fwd.h"            // ByteCount [n]
 #include "byte-difference-fwd.h"       // ByteDifference [n]
 #include "byte-index.h"                // ByteIndex
 #include "line-index.h"                // LineIndex
@@ -58,6 +59,10 @@ public:      // funcs
   // Return `*this` except with `m_byteIndex` increased by `n`.
   TextMCoord plusBytes(ByteDifference n) const;
 
+  // Return the coordinate just past the `len` bytes of `text` if they
+  // were inserted at `*this`.  `text` can contain newlines.
+  TextMCoord plusText(char const *text, ByteCount len) const;
+
   // Insert as "<line>:<byteIndex>".
   void insert(std::ostream &os) const;
 
@@ -0,0 +1,239 @@
+// tree-array-test.cc
+// Tests for `tree-array` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "tree-array.h"                // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, verbose
+#include "smbase/xassert.h"            // xassert
+
+#include <iostream>                    // std::cout
+#include <vector>                      // std::vector
+
+#include <stdlib.h>                    // rand, srand
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Check that `arr` and `ref` have the same contents.
+void checkSame(TreeArray<int> const &arr, std::vector<int> const &ref)
+{
+  arr.selfCheck();
+  EXPECT_EQ(arr.length(), (int)ref.size());
+  for (int i=0; i < arr.length(); i++) {
+    EXPECT_EQ(arr.get(i), ref[i]);
+  }
+}
+
+
+// Apply random operations to both a `TreeArray` and a reference
+// `vector`, alternating between phases that mostly grow and mostly
+// shrink the sequence so that nodes are both split and merged.
+void testRandom()
+{
+  TreeArray<int> arr;
+  std::vector<int> ref;
+
+  srand(1);
+  for (int iter=0; iter < 60000; iter++) {
+    bool growing = (iter / 10000) % 2 == 0;
+    int choice = rand() % 100;
+    int n = (int)ref.size();
+
+    if (choice < (growing? 60 : 35) || n == 0) {
+      int elt = rand() % (n+1);
+      int value = rand();
+      arr.insert(elt, value);
+      ref.insert(ref.begin()+elt, value);
+    }
+    else if (choice < 90) {
+      int elt = rand() % n;
+      EXPECT_EQ(arr.remove(elt), ref[elt]);
+      ref.erase(ref.begin()+elt);
+    }
+    else {
+      int elt = rand() % n;
+      int value = rand();
+      arr.set(elt, value);
+      ref[elt] = value;
+    }
+
+    if (iter % 2000 == 0) {
+      checkSame(arr, ref);
+    }
+  }
+
+  checkSame(arr, ref);
+  if (verbose) {
+    std::cout << "length=" << arr.length()
+              << " height=" << arr.height() << std::endl;
+  }
+}
+
+
+// Bulk construction, then removal of everything.
+void testFillFromArray()
+{
+  for (int n : {0, 1, 63, 64, 65, 2047, 2048, 2049, 70000}) {
+    std::vector<int> ref;
+    for (int i=0; i < n; i++) {
+      ref.push_back(i);
+    }
+
+    TreeArray<int> arr;
+    arr.fillFromArray(ref.data(), n);
+    checkSame(arr, ref);
+
+    while (!ref.empty()) {
+      int elt = rand() % (int)ref.size();
+      arr.remove(elt);
+      ref.erase(ref.begin()+elt);
+      if (ref.size() % 97 == 0) {
+        checkSame(arr, ref);
+      }
+    }
+    checkSame(arr, ref);
+    EXPECT_EQ(arr.height(), 0);
+  }
+}
+
+
+// Summaries that record the sum of the elements and the position of
+// the first zero, which is not commutative.
+struct SumAndZero {
+  struct Summary {
+    long m_sum;
+    int m_length;
+    int m_firstZero;       // -1 if none
+
+    bool operator==(Summary const &obj) const
+    {
+      return m_sum == obj.m_sum &&
+             m_length == obj.m_length &&
+             m_firstZero == obj.m_firstZero;
+    }
+  };
+
+  static Summary identity()
+    { return Summary{0, 0, -1}; }
+
+  static Summary ofElement(int t)
+    { return Summary{t, 1, t==0? 0 : -1}; }
+
+  static Summary combine(Summary const &a, Summary const &b)
+  {
+    return Summary{
+      a.m_sum + b.m_sum,
+      a.m_length + b.m_length,
+      a.m_firstZero >= 0? a.m_firstZero :
+      b.m_firstZero >= 0? a.m_length + b.m_firstZero : -1
+    };
+  }
+};
+
+typedef TreeArray<int, SumAndZero> SummedArray;
+
+
+// Check the summaries of `arr` against `ref`.
+void checkSummaries(SummedArray const &arr, std::vector<int> const &ref)
+{
+  arr.selfCheck();
+  EXPECT_EQ(arr.length(), (int)ref.size());
+
+  SumAndZero::Summary expect = SumAndZero::identity();
+  for (int i=0; i <= (int)ref.size(); i++) {
+    xassert(arr.prefixSummary(i) == expect);
+
+    if (i < (int)ref.size()) {
+      EXPECT_EQ(arr.get(i), ref[i]);
+
+      // The first element whose inclusion makes the sum exceed that of
+      // the prefix before it is `i` when `ref[i]` is positive.
+      if (ref[i] > 0) {
+        long const limit = expect.m_sum;
+        SumAndZero::Summary before;
+        int k = arr.findFirst(
+          [limit](SumAndZero::Summary const &s) -> bool {
+            return s.m_sum > limit;
+          },
+          before /*OUT*/);
+        EXPECT_EQ(k, i);
+        xassert(before == expect);
+      }
+
+      expect = SumAndZero::combine(expect, SumAndZero::ofElement(ref[i]));
+    }
+  }
+  xassert(arr.totalSummary() == expect);
+
+  // A predicate that never becomes true.
+  SumAndZero::Summary before;
+  EXPECT_EQ(arr.findFirst(
+              [](SumAndZero::Summary const &) -> bool { return false; },
+              before /*OUT*/),
+            arr.length());
+  xassert(before == expect);
+}
+
+
+// Random edits of a sequence of small non-negative numbers with
+// summaries.
+void testSummaries()
+{
+  SummedArray arr;
+  std::vector<int> ref;
+
+  srand(2);
+  for (int iter=0; iter < 20000; iter++) {
+    bool growing = (iter / 5000) % 2 == 0;
+    int choice = rand() % 100;
+    int n = (int)ref.size();
+
+    if (choice < (growing? 60 : 35) || n == 0) {
+      int elt = rand() % (n+1);
+      int value = rand() % 5;
+      arr.insert(elt, value);
+      ref.insert(ref.begin()+elt, value);
+    }
+    else if (choice < 90) {
+      int elt = rand() % n;
+      EXPECT_EQ(arr.remove(elt), ref[elt]);
+      ref.erase(ref.begin()+elt);
+    }
+    else {
+      int elt = rand() % n;
+      int value = rand() % 5;
+      arr.set(elt, value);
+      ref[elt] = value;
+    }
+
+    if (iter % 2500 == 0) {
+      checkSummaries(arr, ref);
+    }
+  }
+  checkSummaries(arr, ref);
+
+  // Bulk construction computes the summaries too.
+  SummedArray filled;
+  filled.fillFromArray(ref.data(), (int)ref.size());
+  checkSummaries(filled, ref);
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_tree_array(CmdlineArgsSpan args)
+{
+  testRandom();
+  testFillFromArray();
+  testSummaries();
+}
+
+
+// EOF
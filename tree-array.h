@@ -0,0 +1,931 @@
+// tree-array.h
+// `TreeArray`, a sequence stored as a balanced tree of small arrays.
+
+// See license.txt for copyright and terms of use.
+
+#ifndef EDITOR_TREE_ARRAY_H
+#define EDITOR_TREE_ARRAY_H
+
+// smbase
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES, STATICDEF
+#include "smbase/xassert.h"            // xassert
+
+// libc++
+#include <cstddef>                     // std::size_t
+#include <vector>                      // std::vector
+
+// libc
+#include <string.h>                    // memcpy, memmove
+
+
+/* Sequence of `T`, with an interface resembling that of `GapArray`.
+   It is stored as a B+ tree whose leaves are arrays of up to
+   `LEAF_CAPACITY` elements, and whose interior nodes ("branches")
+   record the number of elements under each child.
+
+   Inserting or removing an element anywhere costs O(log n) and moves
+   at most one node's worth of entries.  By contrast, `GapArray` must
+   move every element between the previous edit point and the new one,
+   which makes edits scattered across a long sequence expensive.  The
+   price is that element access is O(log n) rather than O(1).
+
+   All leaves are at the same depth, and every node other than the root
+   has at least a quarter of its capacity in use.
+
+   As with `GapArray`, `T` must be copyable with `memcpy`, and must not
+   have a nontrivial destructor.
+
+   Optionally, each branch also records a "summary" of the elements
+   under each child, such as their sum, which lets `prefixSummary` and
+   `findFirst` answer questions about a prefix of the sequence in
+   O(log n) time while insertion and removal remain O(log n).
+   `Summarizer` defines the summaries; it must provide:
+
+     // Type of a summary.  Copyable with `memcpy`, with `==`.
+     typedef ... Summary;
+
+     // Summary of the empty sequence.
+     static Summary identity();
+
+     // Summary of a sequence containing only `t`.
+     static Summary ofElement(T const &t);
+
+     // Summary of the concatenation of a sequence summarized by `a`
+     // followed by one summarized by `b`.  Must be associative, but
+     // need not be commutative.
+     static Summary combine(Summary const &a, Summary const &b);
+
+   The default, `TreeArrayNoSummary`, records nothing.
+*/
+template <class T>
+struct TreeArrayNoSummary {
+  struct Summary {
+    bool operator==(Summary const &obj) const { return true; }
+  };
+
+  static Summary identity()
+    { return Summary(); }
+  static Summary ofElement(T const &t)
+    { return Summary(); }
+  static Summary combine(Summary const &a, Summary const &b)
+    { return Summary(); }
+};
+
+
+template <class T, class Summarizer = TreeArrayNoSummary<T> >
+class TreeArray {
+  NO_OBJECT_COPIES(TreeArray);
+
+public:      // types
+  typedef typename Summarizer::Summary Summary;
+
+public:      // constants
+  // Maximum number of elements in a leaf.
+  static constexpr int LEAF_CAPACITY = 64;
+
+  // Maximum number of children of a branch.
+  static constexpr int BRANCH_CAPACITY = 32;
+
+private:     // types
+  // Common prefix of `Leaf` and `Branch`.  Nodes are deleted through
+  // pointers to the derived class, so no virtual destructor is needed.
+  struct Node {
+    // True if this is a `Leaf`.
+    bool m_isLeaf;
+
+    // Number of elements (leaf) or children (branch) in use.
+    int m_count;
+
+    explicit Node(bool isLeaf)
+      : m_isLeaf(isLeaf),
+        m_count(0)
+    {}
+  };
+
+  struct Leaf : Node {
+    // Elements [0,m_count-1] are in use.
+    T m_elts[LEAF_CAPACITY];
+
+    Leaf() : Node(true /*isLeaf*/) {}
+  };
+
+  struct Branch : Node {
+    // Children [0,m_count-1] are in use, and are owner pointers.
+    Node *m_children[BRANCH_CAPACITY];
+
+    // `m_sizes[i]` is the number of elements under `m_children[i]`.
+    int m_sizes[BRANCH_CAPACITY];
+
+    // `m_sums[i]` is the summary of the elements under
+    // `m_children[i]`.
+    Summary m_sums[BRANCH_CAPACITY];
+
+    Branch() : Node(false /*isLeaf*/) {}
+  };
+
+private:     // data
+  // Root of the tree, or null if the sequence is empty.
+  Node *m_root;
+
+  // Number of elements in the sequence.
+  int m_length;
+
+  // Number of levels in the tree: 0 when empty, 1 when the root is a
+  // leaf.
+  int m_height;
+
+private:     // funcs
+  static Leaf *asLeaf(Node *node)
+    { return static_cast<Leaf*>(node); }
+  static Leaf const *asLeafC(Node const *node)
+    { return static_cast<Leaf const*>(node); }
+  static Branch *asBranch(Node *node)
+    { return static_cast<Branch*>(node); }
+  static Branch const *asBranchC(Node const *node)
+    { return static_cast<Branch const*>(node); }
+
+  // Fewest entries a non-root node may have.
+  static int minCount(Node const *node)
+    { return (node->m_isLeaf? LEAF_CAPACITY : BRANCH_CAPACITY) / 4; }
+
+  // Number of elements under `node`.
+  static int nodeSize(Node const *node);
+
+  // Summary of the elements under `node`.
+  static Summary nodeSummary(Node const *node);
+
+  // Deallocate `node` and everything under it.
+  static void freeTree(Node *node);
+
+  // Insert `value` into `arr`, which has `count` entries in use, at
+  // `index`, shifting later entries up.
+  template <class E>
+  static void arrayInsert(E *arr, int count, int index, E const &value);
+
+  // Remove the entry at `index` from `arr`.
+  template <class E>
+  static void arrayRemove(E *arr, int count, int index);
+
+  // Move the last `n` entries of `left` to the front of `right`, which
+  // is its sibling at the same level.
+  static void shiftRight(Node *left, Node *right, int n);
+
+  // Move the first `n` entries of `right` to the end of `left`.
+  static void shiftLeft(Node *left, Node *right, int n);
+
+  // Insert into the subtree at `node`.  If `node` had to be split,
+  // return the new right half, which the caller must add to the parent.
+  static Node *insertRec(Node *node, int elt, T const &value);
+
+  // Remove from the subtree at `node`.
+  static T removeRec(Node *node, int elt);
+
+  // Set an element in the subtree at `node`.
+  static void setRec(Node *node, int elt, T const &value);
+
+  // Child `i` of `branch` has too few entries; merge it with, or take
+  // entries from, an adjacent sibling.
+  static void fixUnderflow(Branch *branch, int i);
+
+  // Check the subtree at `node`, which is at `depth` (1 for the root),
+  // and return its size.
+  int selfCheckRec(Node const *node, int depth) const;
+
+  // Count the nodes in the subtree at `node`.
+  static void countNodes(Node const *node,
+                         int &leaves /*INOUT*/, int &branches /*INOUT*/);
+
+public:      // funcs
+  TreeArray();               // empty sequence
+  ~TreeArray();              // release storage
+
+  // Check invariants, throwing on failure.
+  void selfCheck() const;
+
+  // Number of elements in the sequence.
+  int length() const { return m_length; }
+
+  // Number of levels in the tree.
+  int height() const { return m_height; }
+
+  // Get/set an element; `elt` must be in [0,length()-1].
+  T const &get(int elt) const       { return eltRefC(elt); }
+  void set(int elt, T const &value);
+
+  // Element reference.  Modifying an element through `eltRef` does not
+  // update the summaries, so when they are in use, call `set` instead.
+  T const &eltRefC(int elt) const;
+  T &eltRef(int elt);
+
+  // Summary of the elements in [0,count-1].  `count` must be in
+  // [0,length()].
+  Summary prefixSummary(int count) const;
+
+  // Summary of all elements.
+  Summary totalSummary() const;
+
+  // Return the smallest `k` such that `pred(prefixSummary(k+1))` is
+  // true, and set `before` to `prefixSummary(k)`.  If there is no such
+  // `k`, return `length()` and set `before` to `totalSummary()`.
+  //
+  // `pred` must be monotone: if it is true for some prefix, it must be
+  // true for every longer one.
+  template <class Pred>
+  int findFirst(Pred const &pred, Summary &before /*OUT*/) const;
+
+  // Insert a single element at `elt`, which must be in [0,length()].
+  void insert(int elt, T const &value);
+
+  // Remove and return the element at `elt`.
+  T remove(int elt);
+
+  // Remove all elements and release the storage.
+  void clear();
+
+  // Replace the contents with `srcLen` elements copied from `src`.
+  // This builds the tree bottom-up in linear time.
+  void fillFromArray(T const *src, int srcLen);
+
+  // Get the number of leaf and branch nodes.
+  void getNodeCounts(int &leaves /*OUT*/, int &branches /*OUT*/) const;
+
+  // Total bytes allocated for nodes.
+  std::size_t allocatedBytes() const;
+};
+
+
+template <class T, class Summarizer>
+TreeArray<T, Summarizer>::TreeArray()
+  : m_root(nullptr),
+    m_length(0),
+    m_height(0)
+{}
+
+
+template <class T, class Summarizer>
+TreeArray<T, Summarizer>::~TreeArray()
+{
+  clear();
+}
+
+
+template <class T, class Summarizer>
+STATICDEF int TreeArray<T, Summarizer>::nodeSize(Node const *node)
+{
+  if (node->m_isLeaf) {
+    return node->m_count;
+  }
+
+  Branch const *branch = asBranchC(node);
+  int size = 0;
+  for (int i=0; i < branch->m_count; i++) {
+    size += branch->m_sizes[i];
+  }
+  return size;
+}
+
+
+template <class T, class Summarizer>
+STATICDEF typename TreeArray<T, Summarizer>::Summary
+TreeArray<T, Summarizer>::nodeSummary(Node const *node)
+{
+  Summary sum = Summarizer::identity();
+
+  if (node->m_isLeaf) {
+    Leaf const *leaf = asLeafC(node);
+    for (int i=0; i < leaf->m_count; i++) {
+      sum = Summarizer::combine(sum, Summarizer::ofElement(leaf->m_elts[i]));
+    }
+  }
+  else {
+    Branch const *branch = asBranchC(node);
+    for (int i=0; i < branch->m_count; i++) {
+      sum = Summarizer::combine(sum, branch->m_sums[i]);
+    }
+  }
+
+  return sum;
+}
+
+
+template <class T, class Summarizer>
+STATICDEF void TreeArray<T, Summarizer>::freeTree(Node *node)
+{
+  if (node->m_isLeaf) {
+    delete asLeaf(node);
+  }
+  else {
+    Branch *branch = asBranch(node);
+    for (int i=0; i < branch->m_count; i++) {
+      freeTree(branch->m_children[i]);
+    }
+    delete branch;
+  }
+}
+
+
+template <class T, class Summarizer>
+template <class E>
+STATICDEF void TreeArray<T, Summarizer>::arrayInsert(
+  E *arr, int count, int index, E const &value)
+{
+  memmove(arr+index+1, arr+index, (count-index) * sizeof(E));
+  arr[index] = value;
+}
+
+
+template <class T, class Summarizer>
+template <class E>
+STATICDEF void TreeArray<T, Summarizer>::arrayRemove(
+  E *arr, int count, int index)
+{
+  memmove(arr+index, arr+index+1, (count-index-1) * sizeof(E));
+}
+
+
+template <class T, class Summarizer>
+STATICDEF void TreeArray<T, Summarizer>::shiftRight(
+  Node *left, Node *right, int n)
+{
+  int const leftKeep = left->m_count - n;
+
+  if (left->m_isLeaf) {
+    Leaf *l = asLeaf(left);
+    Leaf *r = asLeaf(right);
+    memmove(r->m_elts+n, r->m_elts, r->m_count * sizeof(T));
+    memcpy(r->m_elts, l->m_elts+leftKeep, n * sizeof(T));
+  }
+  else {
+    Branch *l = asBranch(left);
+    Branch *r = asBranch(right);
+    memmove(r->m_children+n, r->m_children, r->m_count * sizeof(Node*));
+    memmove(r->m_sizes+n, r->m_sizes, r->m_count * sizeof(int));
+    memmove(r->m_sums+n, r->m_sums, r->m_count * sizeof(Summary));
+    memcpy(r->m_children, l->m_children+leftKeep, n * sizeof(Node*));
+    memcpy(r->m_sizes, l->m_sizes+leftKeep, n * sizeof(int));
+    memcpy(r->m_sums, l->m_sums+leftKeep, n * sizeof(Summary));
+  }
+
+  left->m_count -= n;
+  right->m_count += n;
+}
+
+
+template <class T, class Summarizer>
+STATICDEF void TreeArray<T, Summarizer>::shiftLeft(
+  Node *left, Node *right, int n)
+{
+  int const rightKeep = right->m_count - n;
+
+  if (left->m_isLeaf) {
+    Leaf *l = asLeaf(left);
+    Leaf *r = asLeaf(right);
+    memcpy(l->m_elts+l->m_count, r->m_elts, n * sizeof(T));
+    memmove(r->m_elts, r->m_elts+n, rightKeep * sizeof(T));
+  }
+  else {
+    Branch *l = asBranch(left);
+    Branch *r = asBranch(right);
+    memcpy(l->m_children+l->m_count, r->m_children, n * sizeof(Node*));
+    memcpy(l->m_sizes+l->m_count, r->m_sizes, n * sizeof(int));
+    memcpy(l->m_sums+l->m_count, r->m_sums, n * sizeof(Summary));
+    memmove(r->m_children, r->m_children+n, rightKeep * sizeof(Node*));
+    memmove(r->m_sizes, r->m_sizes+n, rightKeep * sizeof(int));
+    memmove(r->m_sums, r->m_sums+n, rightKeep * sizeof(Summary));
+  }
+
+  left->m_count += n;
+  right->m_count -= n;
+}
+
+
+template <class T, class Summarizer>
+T const &TreeArray<T, Summarizer>::eltRefC(int elt) const
+{
+  xassert(0 <= elt && elt < m_length);
+
+  Node const *node = m_root;
+  while (!node->m_isLeaf) {
+    Branch const *branch = asBranchC(node);
+    int i = 0;
+    while (elt >= branch->m_sizes[i]) {
+      elt -= branch->m_sizes[i];
+      i++;
+    }
+    node = branch->m_children[i];
+  }
+
+  return asLeafC(node)->m_elts[elt];
+}
+
+
+template <class T, class Summarizer>
+T &TreeArray<T, Summarizer>::eltRef(int elt)
+{
+  return const_cast<T&>(eltRefC(elt));
+}
+
+
+template <class T, class Summarizer>
+STATICDEF void TreeArray<T, Summarizer>::setRec(
+  Node *node, int elt, T const &value)
+{
+  if (node->m_isLeaf) {
+    asLeaf(node)->m_elts[elt] = value;
+    return;
+  }
+
+  Branch *branch = asBranch(node);
+  int i = 0;
+  while (elt >= branch->m_sizes[i]) {
+    elt -= branch->m_sizes[i];
+    i++;
+  }
+
+  setRec(branch->m_children[i], elt, value);
+  branch->m_sums[i] = nodeSummary(branch->m_children[i]);
+}
+
+
+template <class T, class Summarizer>
+void TreeArray<T, Summarizer>::set(int elt, T const &value)
+{
+  xassert(0 <= elt && elt < m_length);
+  setRec(m_root, elt, value);
+}
+
+
+template <class T, class Summarizer>
+typename TreeArray<T, Summarizer>::Summary
+TreeArray<T, Summarizer>::prefixSummary(int count) const
+{
+  xassert(0 <= count && count <= m_length);
+
+  Summary sum = Summarizer::identity();
+  Node const *node = m_root;
+  if (!node) {
+    return sum;
+  }
+
+  // Add the summaries of the children entirely within the prefix, then
+  // descend into the one it ends in, if any.
+  while (!node->m_isLeaf) {
+    Branch const *branch = asBranchC(node);
+    int i = 0;
+    while (i < branch->m_count && count >= branch->m_sizes[i]) {
+      sum = Summarizer::combine(sum, branch->m_sums[i]);
+      count -= branch->m_sizes[i];
+      i++;
+    }
+    if (count == 0) {
+      return sum;
+    }
+    node = branch->m_children[i];
+  }
+
+  Leaf const *leaf = asLeafC(node);
+  for (int i=0; i < count; i++) {
+    sum = Summarizer::combine(sum, Summarizer::ofElement(leaf->m_elts[i]));
+  }
+  return sum;
+}
+
+
+template <class T, class Summarizer>
+typename TreeArray<T, Summarizer>::Summary
+TreeArray<T, Summarizer>::totalSummary() const
+{
+  return m_root? nodeSummary(m_root) : Summarizer::identity();
+}
+
+
+template <class T, class Summarizer>
+template <class Pred>
+int TreeArray<T, Summarizer>::findFirst(
+  Pred const &pred, Summary &before /*OUT*/) const
+{
+  Summary sum = Summarizer::identity();
+  int index = 0;
+
+  Node const *node = m_root;
+  if (!node) {
+    before = sum;
+    return 0;
+  }
+
+  // Skip the children whose inclusion leaves `pred` false, and descend
+  // into the first one that makes it true.
+  while (!node->m_isLeaf) {
+    Branch const *branch = asBranchC(node);
+    int i = 0;
+    for (; i < branch->m_count; i++) {
+      Summary next = Summarizer::combine(sum, branch->m_sums[i]);
+      if (pred(next)) {
+        break;
+      }
+      sum = next;
+      index += branch->m_sizes[i];
+    }
+    if (i == branch->m_count) {
+      before = sum;
+      return index;
+    }
+    node = branch->m_children[i];
+  }
+
+  Leaf const *leaf = asLeafC(node);
+  for (int i=0; i < leaf->m_count; i++) {
+    Summary next =
+      Summarizer::combine(sum, Summarizer::ofElement(leaf->m_elts[i]));
+    if (pred(next)) {
+      before = sum;
+      return index + i;
+    }
+    sum = next;
+  }
+
+  // Only reachable at the root leaf, since a child is only entered
+  // when its last element makes `pred` true.
+  before = sum;
+  return index + leaf->m_count;
+}
+
+
+template <class T, class Summarizer>
+STATICDEF typename TreeArray<T, Summarizer>::Node *
+TreeArray<T, Summarizer>::insertRec(
+  Node *node, int elt, T const &value)
+{
+  if (node->m_isLeaf) {
+    Leaf *leaf = asLeaf(node);
+    if (leaf->m_count < LEAF_CAPACITY) {
+      arrayInsert(leaf->m_elts, leaf->m_count, elt, value);
+      leaf->m_count++;
+      return nullptr;
+    }
+
+    // Split the full leaf in half, then insert into the proper half.
+    Leaf *right = new Leaf;
+    int const half = LEAF_CAPACITY / 2;
+    shiftRight(leaf, right, LEAF_CAPACITY - half);
+    if (elt <= half) {
+      arrayInsert(leaf->m_elts, leaf->m_count, elt, value);
+      leaf->m_count++;
+    }
+    else {
+      arrayInsert(right->m_elts, right->m_count, elt - half, value);
+      right->m_count++;
+    }
+    return right;
+  }
+
+  Branch *branch = asBranch(node);
+
+  // Find the child to insert into.  An index at the boundary between
+  // two children goes at the end of the first.
+  int i = 0;
+  while (i < branch->m_count-1 && elt > branch->m_sizes[i]) {
+    elt -= branch->m_sizes[i];
+    i++;
+  }
+
+  Node *newChild = insertRec(branch->m_children[i], elt, value);
+  if (!newChild) {
+    branch->m_sizes[i]++;
+    branch->m_sums[i] = nodeSummary(branch->m_children[i]);
+    return nullptr;
+  }
+
+  // The child split, so the new half must be added after it.
+  branch->m_sizes[i] = nodeSize(branch->m_children[i]);
+  branch->m_sums[i] = nodeSummary(branch->m_children[i]);
+  int const newChildSize = nodeSize(newChild);
+  Summary const newChildSum = nodeSummary(newChild);
+
+  if (branch->m_count < BRANCH_CAPACITY) {
+    arrayInsert(branch->m_children, branch->m_count, i+1, newChild);
+    arrayInsert(branch->m_sizes, branch->m_count, i+1, newChildSize);
+    arrayInsert(branch->m_sums, branch->m_count, i+1, newChildSum);
+    branch->m_count++;
+    return nullptr;
+  }
+
+  // Split this branch too.
+  Branch *right = new Branch;
+  int const half = BRANCH_CAPACITY / 2;
+  shiftRight(branch, right, BRANCH_CAPACITY - half);
+  Branch *dest = branch;
+  int destIndex = i+1;
+  if (destIndex > half) {
+    dest = right;
+    destIndex -= half;
+  }
+  arrayInsert(dest->m_children, dest->m_count, destIndex, newChild);
+  arrayInsert(dest->m_sizes, dest->m_count, destIndex, newChildSize);
+  arrayInsert(dest->m_sums, dest->m_count, destIndex, newChildSum);
+  dest->m_count++;
+  return right;
+}
+
+
+template <class T, class Summarizer>
+void TreeArray<T, Summarizer>::insert(int elt, T const &value)
+{
+  xassert(0 <= elt && elt <= m_length);
+
+  if (!m_root) {
+    m_root = new Leaf;
+    m_height = 1;
+  }
+
+  if (Node *newSibling = insertRec(m_root, elt, value)) {
+    // The root split, so the tree grows a level.
+    Branch *newRoot = new Branch;
+    newRoot->m_children[0] = m_root;
+    newRoot->m_sizes[0] = nodeSize(m_root);
+    newRoot->m_sums[0] = nodeSummary(m_root);
+    newRoot->m_children[1] = newSibling;
+    newRoot->m_sizes[1] = nodeSize(newSibling);
+    newRoot->m_sums[1] = nodeSummary(newSibling);
+    newRoot->m_count = 2;
+    m_root = newRoot;
+    m_height++;
+  }
+
+  m_length++;
+}
+
+
+template <class T, class Summarizer>
+STATICDEF void TreeArray<T, Summarizer>::fixUnderflow(Branch *branch, int i)
+{
+  if (branch->m_count < 2) {
+    // No sibling.  This only happens at the root, which the caller
+    // will collapse.
+    return;
+  }
+
+  // Pair the child with its left sibling if it has one, else its right.
+  int const li = (i > 0)? i-1 : i;
+  int const ri = li+1;
+  Node *left = branch->m_children[li];
+  Node *right = branch->m_children[ri];
+
+  int const total = left->m_count + right->m_count;
+  int const capacity =
+    left->m_isLeaf? LEAF_CAPACITY : BRANCH_CAPACITY;
+
+  if (total <= capacity) {
+    // Merge `right` into `left`.
+    shiftLeft(left, right, right->m_count);
+    branch->m_sizes[li] += branch->m_sizes[ri];
+    branch->m_sums[li] =
+      Summarizer::combine(branch->m_sums[li], branch->m_sums[ri]);
+    freeTree(right);      // Now has no entries.
+    arrayRemove(branch->m_children, branch->m_count, ri);
+    arrayRemove(branch->m_sizes, branch->m_count, ri);
+    arrayRemove(branch->m_sums, branch->m_count, ri);
+    branch->m_count--;
+  }
+  else {
+    // Divide the entries evenly between them.
+    int const target = total / 2;
+    if (left->m_count > target) {
+      shiftRight(left, right, left->m_count - target);
+    }
+    else {
+      shiftLeft(left, right, target - left->m_count);
+    }
+    branch->m_sizes[li] = nodeSize(left);
+    branch->m_sizes[ri] = nodeSize(right);
+    branch->m_sums[li] = nodeSummary(left);
+    branch->m_sums[ri] = nodeSummary(right);
+  }
+}
+
+
+template <class T, class Summarizer>
+STATICDEF T TreeArray<T, Summarizer>::removeRec(Node *node, int elt)
+{
+  if (node->m_isLeaf) {
+    Leaf *leaf = asLeaf(node);
+    T ret = leaf->m_elts[elt];
+    arrayRemove(leaf->m_elts, leaf->m_count, elt);
+    leaf->m_count--;
+    return ret;
+  }
+
+  Branch *branch = asBranch(node);
+  int i = 0;
+  while (elt >= branch->m_sizes[i]) {
+    elt -= branch->m_sizes[i];
+    i++;
+  }
+
+  Node *child = branch->m_children[i];
+  T ret = removeRec(child, elt);
+  branch->m_sizes[i]--;
+  branch->m_sums[i] = nodeSummary(child);
+
+  if (child->m_count < minCount(child)) {
+    fixUnderflow(branch, i);
+  }
+
+  return ret;
+}
+
+
+template <class T, class Summarizer>
+T TreeArray<T, Summarizer>::remove(int elt)
+{
+  xassert(0 <= elt && elt < m_length);
+
+  T ret = removeRec(m_root, elt);
+  m_length--;
+
+  // Remove levels that have only one child.
+  while (!m_root->m_isLeaf && m_root->m_count == 1) {
+    Branch *oldRoot = asBranch(m_root);
+    m_root = oldRoot->m_children[0];
+    delete oldRoot;
+    m_height--;
+  }
+
+  if (m_length == 0) {
+    clear();
+  }
+
+  return ret;
+}
+
+
+template <class T, class Summarizer>
+void TreeArray<T, Summarizer>::clear()
+{
+  if (m_root) {
+    freeTree(m_root);
+    m_root = nullptr;
+  }
+  m_length = 0;
+  m_height = 0;
+}
+
+
+template <class T, class Summarizer>
+void TreeArray<T, Summarizer>::fillFromArray(T const *src, int srcLen)
+{
+  xassert(srcLen >= 0);
+
+  clear();
+  if (srcLen == 0) {
+    return;
+  }
+
+  // Current level of nodes being built, and their sizes and summaries.
+  std::vector<Node*> level;
+  std::vector<int> sizes;
+  std::vector<Summary> sums;
+
+  // Build the leaves, spreading the elements evenly so that each is at
+  // least half full when there is more than one.
+  int const numLeaves = (srcLen + LEAF_CAPACITY-1) / LEAF_CAPACITY;
+  level.reserve(numLeaves);
+  sizes.reserve(numLeaves);
+  sums.reserve(numLeaves);
+  int pos = 0;
+  for (int k=0; k < numLeaves; k++) {
+    int count = srcLen/numLeaves + (k < srcLen%numLeaves? 1 : 0);
+    Leaf *leaf = new Leaf;
+    memcpy(leaf->m_elts, src+pos, count * sizeof(T));
+    leaf->m_count = count;
+    pos += count;
+    level.push_back(leaf);
+    sizes.push_back(count);
+    sums.push_back(nodeSummary(leaf));
+  }
+  xassert(pos == srcLen);
+  m_height = 1;
+
+  // Build branches over them, likewise, until one node remains.
+  while (level.size() > 1) {
+    int const numNodes = (int)level.size();
+    int const numBranches =
+      (numNodes + BRANCH_CAPACITY-1) / BRANCH_CAPACITY;
+
+    std::vector<Node*> nextLevel;
+    std::vector<int> nextSizes;
+    std::vector<Summary> nextSums;
+    nextLevel.reserve(numBranches);
+    nextSizes.reserve(numBranches);
+    nextSums.reserve(numBranches);
+
+    int nodePos = 0;
+    for (int k=0; k < numBranches; k++) {
+      int count = numNodes/numBranches + (k < numNodes%numBranches? 1 : 0);
+      Branch *branch = new Branch;
+      int size = 0;
+      for (int j=0; j < count; j++) {
+        branch->m_children[j] = level[nodePos+j];
+        branch->m_sizes[j] = sizes[nodePos+j];
+        branch->m_sums[j] = sums[nodePos+j];
+        size += sizes[nodePos+j];
+      }
+      branch->m_count = count;
+      nodePos += count;
+      nextLevel.push_back(branch);
+      nextSizes.push_back(size);
+      nextSums.push_back(nodeSummary(branch));
+    }
+
+    level.swap(nextLevel);
+    sizes.swap(nextSizes);
+    sums.swap(nextSums);
+    m_height++;
+  }
+
+  m_root = level[0];
+  m_length = srcLen;
+}
+
+
+template <class T, class Summarizer>
+int TreeArray<T, Summarizer>::selfCheckRec(Node const *node, int depth) const
+{
+  if (node != m_root) {
+    xassert(node->m_count >= minCount(node));
+  }
+
+  if (node->m_isLeaf) {
+    xassert(depth == m_height);
+    xassert(0 < node->m_count && node->m_count <= LEAF_CAPACITY);
+    return node->m_count;
+  }
+
+  Branch const *branch = asBranchC(node);
+  xassert(0 < branch->m_count && branch->m_count <= BRANCH_CAPACITY);
+  if (node == m_root) {
+    xassert(branch->m_count >= 2);
+  }
+
+  int size = 0;
+  for (int i=0; i < branch->m_count; i++) {
+    int childSize = selfCheckRec(branch->m_children[i], depth+1);
+    xassert(childSize == branch->m_sizes[i]);
+    xassert(nodeSummary(branch->m_children[i]) == branch->m_sums[i]);
+    size += childSize;
+  }
+  return size;
+}
+
+
+template <class T, class Summarizer>
+void TreeArray<T, Summarizer>::selfCheck() const
+{
+  if (!m_root) {
+    xassert(m_length == 0);
+    xassert(m_height == 0);
+    return;
+  }
+
+  xassert(selfCheckRec(m_root, 1 /*depth*/) == m_length);
+}
+
+
+template <class T, class Summarizer>
+STATICDEF void TreeArray<T, Summarizer>::countNodes(
+  Node const *node, int &leaves /*INOUT*/, int &branches /*INOUT*/)
+{
+  if (node->m_isLeaf) {
+    leaves++;
+  }
+  else {
+    branches++;
+    Branch const *branch = asBranchC(node);
+    for (int i=0; i < branch->m_count; i++) {
+      countNodes(branch->m_children[i], leaves, branches);
+    }
+  }
+}
+
+
+template <class T, class Summarizer>
+void TreeArray<T, Summarizer>::getNodeCounts(
+  int &leaves /*OUT*/, int &branches /*OUT*/) const
+{
+  leaves = branches = 0;
+  if (m_root) {
+    countNodes(m_root, leaves, branches);
+  }
+}
+
+
+template <class T, class Summarizer>
+std::size_t TreeArray<T, Summarizer>::allocatedBytes() const
+{
+  int leaves, branches;
+  getNodeCounts(leaves, branches);
+  return leaves * sizeof(Leaf) + branches * sizeof(Branch);
+}
+
+
+#endif // EDITOR_TREE_ARRAY_H
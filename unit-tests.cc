@@ -79,7 +79,9 @@ static void entry(int argc, char **argv)
   RUN_TEST(td_line);                   // deps: (none)
   RUN_TEST(textcategory);              // deps: (none)
   RUN_TEST(textmcoord);
+  RUN_TEST(tree_array);                // deps: (none)
   RUN_TEST(uri_util);                  // deps: (none)
+  RUN_TEST(utf8_regex);                // deps: (none)
 
   // Wrapped integers.
   RUN_TEST(wrapped_integer);
@@ -89,7 +91,17 @@ static void entry(int argc, char **argv)
   RUN_TEST(positive_line_count);       // deps: wrapped-integer, line-count, line-difference
   RUN_TEST(byte_count);
   RUN_TEST(byte_index);
+  RUN_TEST(line_byte_arena);           // deps: byte-count
+  RUN_TEST(line_offset_index);         // deps: line-count, line-index
+  RUN_TEST(content_digest);            // deps: (none)
+  RUN_TEST(line_hash_index);           // deps: content-digest, line-count, line-index
+  RUN_TEST(mapped_file);               // deps: (none)
+  RUN_TEST(vfs_compress);              // deps: (none)
+  RUN_TEST(buffer_flatten);            // deps: (none)
+  RUN_TEST(byte_search);               // deps: (none)
+  RUN_TEST(text_diff);                 // deps: (none)
   RUN_TEST(td_version_number);         // deps: wrapped-integer
+  RUN_TEST(line_render_cache);         // deps: line-index, td-version-number, textcategory
   RUN_TEST(lsp_version_number);        // deps: wrapped-integer, td-version-number
   RUN_TEST(column_count);
   RUN_TEST(column_difference);
@@ -102,9 +114,11 @@ static void entry(int argc, char **argv)
   RUN_TEST(lsp_client_scope);
   RUN_TEST(rle_inf_sequence);
 
-  // SCC: history, td, td-core
-  RUN_TEST(td_core);                   // deps: gap-gdvalue, history, line-index, td, td-line, textmcoord
-  RUN_TEST(td);                        // deps: history, line-index, range-text-repl, td-core, textmcoord
+  // SCC: history, td, td-core, td-snapshot
+  RUN_TEST(td_core);                   // deps: content-digest, gap-gdvalue, history, line-hash-index, line-index, line-spine, td, td-line, td-snapshot, textmcoord
+  RUN_TEST(td_snapshot);               // deps: content-digest, line-index, td-core
+  RUN_TEST(td);                        // deps: history, line-index, range-text-repl, td-core, text-diff, textmcoord
+  RUN_TEST(history_store);             // deps: history, td, td-core, textmcoord
 
   RUN_TEST(td_change);                 // deps: line-index, range-text-repl, td-core, textmcoord
 
@@ -126,7 +140,7 @@ static void entry(int argc, char **argv)
   RUN_TEST(editor_fs_server);          // deps: editor-version, vfs-local
 
   // SCC: lsp-conv, lsp-data, lsp-client, named-td, td-diagnostics, td-obs-recorder
-  RUN_TEST(lsp_conv);                  // deps: lsp-data, lsp-client, named-td, range-text-repl, td-change, td-change-seq, td-core, td-diagnostics, td-obs-recorder, textmcoord, uri-util
+  RUN_TEST(lsp_conv);                  // deps: lsp-data, lsp-client, named-td, range-text-repl, td-change, td-change-seq, td-core, td-diagnostics, td-obs-recorder, td-snapshot, textmcoord, uri-util
   RUN_TEST(lsp_data);                  // deps: line-index, lsp-conv, named-td, td-diagnostics, uri-util
   RUN_TEST(td_diagnostics);            // deps: line-index, named-td, td-change, td-change-seq, td-core, textmcoord-map
   RUN_TEST(td_obs_recorder);           // deps: named-td, td-change, td-change-seq, td-core, td-diagnostics
@@ -142,6 +156,8 @@ static void entry(int argc, char **argv)
 
   RUN_TEST(vfs_connections);           // deps: host-name, vfs-msg, vfs-query
 
+  RUN_TEST(doc_file_watcher);          // deps: named-td-list, vfs-connections
+
   // This depends on `lsp_client`, but only in a fairly simple way, and
   // this test should be much faster.
   RUN_TEST(lsp_get_code_lines);
@@ -151,7 +167,7 @@ static void entry(int argc, char **argv)
   RUN_TEST(command_runner);            // deps: (none)
 
   RUN_TEST(json_rpc_client);           // deps: command-runner, uri-util
-  RUN_TEST(lsp_client);                // deps: command-runner, line-index, json-rpc-client, lsp-conv, lsp-data, lsp-symbol-request-kind, td-core, td-diagnostics, td-obs-recorder, textmcoord, uri-util
+  RUN_TEST(lsp_client);                // deps: command-runner, line-index, json-rpc-client, lsp-conv, lsp-data, lsp-symbol-request-kind, td-core, td-diagnostics, td-obs-recorder, td-snapshot, textmcoord, uri-util
   RUN_TEST(lsp_client_manager);
 
   #undef RUN_TEST
@@ -17,23 +17,32 @@ typedef smbase::Span<char const * const> CmdlineArgsSpan;
 // Prototypes of tests defined in various *-test.cc files.
 void test_byte_count(CmdlineArgsSpan args);
 void test_byte_index(CmdlineArgsSpan args);
+void test_byte_search(CmdlineArgsSpan args);
+void test_buffer_flatten(CmdlineArgsSpan args);
 void test_bufferlinesource(CmdlineArgsSpan args);
 void test_c_hilite(CmdlineArgsSpan args);
 void test_column_count(CmdlineArgsSpan args);
 void test_column_difference(CmdlineArgsSpan args);
 void test_column_index(CmdlineArgsSpan args);
 void test_command_runner(CmdlineArgsSpan args);
+void test_content_digest(CmdlineArgsSpan args);
+void test_doc_file_watcher(CmdlineArgsSpan args);
 void test_doc_type_detect(CmdlineArgsSpan args);
 void test_editor_fs_server(CmdlineArgsSpan args);
 void test_editor_strutil(CmdlineArgsSpan args);
 void test_gap(CmdlineArgsSpan args);
 void test_hashcomment_hilite(CmdlineArgsSpan args);
+void test_history_store(CmdlineArgsSpan args);
 void test_host_file_and_line_opt(CmdlineArgsSpan args);
 void test_json_rpc_client(CmdlineArgsSpan args);
 void test_justify(CmdlineArgsSpan args);
+void test_line_byte_arena(CmdlineArgsSpan args);
 void test_line_count(CmdlineArgsSpan args);
 void test_line_difference(CmdlineArgsSpan args);
+void test_line_hash_index(CmdlineArgsSpan args);
 void test_line_index(CmdlineArgsSpan args);
+void test_line_offset_index(CmdlineArgsSpan args);
+void test_line_render_cache(CmdlineArgsSpan args);
 void test_lsp_client(CmdlineArgsSpan args);
 void test_lsp_client_manager(CmdlineArgsSpan args);
 void test_lsp_client_scope(CmdlineArgsSpan args);
@@ -42,6 +51,7 @@ void test_lsp_data(CmdlineArgsSpan args);
 void test_lsp_get_code_lines(CmdlineArgsSpan args);
 void test_lsp_version_number(CmdlineArgsSpan args);
 void test_makefile_hilite(CmdlineArgsSpan args);
+void test_mapped_file(CmdlineArgsSpan args);
 void test_named_td(CmdlineArgsSpan args);
 void test_named_td_editor(CmdlineArgsSpan args);
 void test_named_td_list(CmdlineArgsSpan args);
@@ -59,13 +69,18 @@ void test_td_diagnostics(CmdlineArgsSpan args);
 void test_td_editor(CmdlineArgsSpan args);
 void test_td_line(CmdlineArgsSpan args);
 void test_td_obs_recorder(CmdlineArgsSpan args);
+void test_td_snapshot(CmdlineArgsSpan args);
 void test_td_version_number(CmdlineArgsSpan args);
 void test_tdd_proposed_fix(CmdlineArgsSpan args);
+void test_text_diff(CmdlineArgsSpan args);
 void test_text_search(CmdlineArgsSpan args);
 void test_textcategory(CmdlineArgsSpan args);
 void test_textmcoord(CmdlineArgsSpan args);
 void test_textmcoord_map(CmdlineArgsSpan args);
+void test_tree_array(CmdlineArgsSpan args);
 void test_uri_util(CmdlineArgsSpan args);
+void test_utf8_regex(CmdlineArgsSpan args);
+void test_vfs_compress(CmdlineArgsSpan args);
 void test_vfs_connections(CmdlineArgsSpan args);
 void test_wrapped_integer(CmdlineArgsSpan args);
 
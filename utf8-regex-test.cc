@@ -0,0 +1,181 @@
+// utf8-regex-test.cc
+// Tests for `utf8-regex` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "utf8-regex.h"                // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, DIAG, VPVAL
+#include "smbase/xassert.h"            // xassert
+
+#include <sstream>                     // std::ostringstream
+#include <string>                      // std::string
+
+using namespace smbase;
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Return all matches of `pattern` in `subject` as a sequence of
+// "[start,end]".
+std::string allMatches(std::string const &pattern,
+                       std::string const &subject,
+                       bool caseInsensitive = false)
+{
+  UTF8Regex regex(pattern, caseInsensitive);
+  xassert(regex.isValid());
+
+  UTF8RegexMatcher matcher(regex);
+  matcher.start(subject.data(), subject.size());
+
+  std::ostringstream oss;
+  while (matcher.next()) {
+    oss << '[' << matcher.matchStart() << ',' << matcher.matchEnd() << ']';
+  }
+  return oss.str();
+}
+
+
+void testBasic()
+{
+  EXPECT_EQ(allMatches("b+", "abbcb"), "[1,3][4,5]");
+  EXPECT_EQ(allMatches("x", "abc"), "");
+  EXPECT_EQ(allMatches("B", "abcb"), "");
+  EXPECT_EQ(allMatches("B", "abcb", true /*ci*/), "[1,2][3,4]");
+
+  // Empty matches advance one character at a time, and a non-empty
+  // match is preferred at the position of a preceding empty one.
+  EXPECT_EQ(allMatches("a*", "baaac"), "[0,0][1,4][4,4][5,5]");
+  EXPECT_EQ(allMatches("", ""), "[0,0]");
+
+  // Anchors match at line boundaries.
+  EXPECT_EQ(allMatches("^a|a$", "aba"), "[0,1][2,3]");
+}
+
+
+// Offsets are in bytes, not characters or UTF-16 code units.
+void testUTF8Offsets()
+{
+  // U+00E9 is two bytes, U+1F600 is four bytes.
+  std::string const subject = "\xC3\xA9x\xF0\x9F\x98\x80x";
+  EXPECT_EQ(allMatches("x", subject), "[2,3][7,8]");
+
+  // `.` consumes a whole character.
+  EXPECT_EQ(allMatches(".x", subject), "[0,3][3,8]");
+
+  // Empty matches do not land inside a character.
+  EXPECT_EQ(allMatches("(?=x)|$", subject), "[2,2][7,7][8,8]");
+
+  // Case folding applies beyond ASCII.
+  EXPECT_EQ(allMatches("\xC3\x89", subject, true /*ci*/), "[0,2]");
+
+  // Invalid UTF-8 in the subject does not prevent matching elsewhere.
+  EXPECT_EQ(allMatches("x", "\xFFx\xC3x"), "[1,2][3,4]");
+}
+
+
+void testSyntaxError()
+{
+  UTF8Regex regex("a[", false);
+  xassert(!regex.isValid());
+  EXPECT_EQ(regex.errorOffset(), 2);
+  VPVAL(regex.errorMessage());
+
+  // The offset is in characters.
+  UTF8Regex regex2("\xC3\xA9(", false);
+  xassert(!regex2.isValid());
+  EXPECT_EQ(regex2.errorOffset(), 2);
+
+  UTF8Regex ok("a", false);
+  EXPECT_EQ(ok.errorOffset(), -1);
+  EXPECT_EQ(ok.errorMessage(), "");
+}
+
+
+void testMultiLine()
+{
+  EXPECT_EQ(UTF8Regex("a.b", false).canMatchNewline(), false);
+  EXPECT_EQ(UTF8Regex("a\\nb", false).canMatchNewline(), true);
+  EXPECT_EQ(UTF8Regex("a\nb", false).canMatchNewline(), true);
+
+  EXPECT_EQ(allMatches("b$\\n^c", "ab\nc\nb\ncd"), "[1,4][5,8]");
+
+  // With a start limit, only the matches starting on the first line
+  // are reported, but they can extend beyond it.
+  UTF8Regex regex("b\\nc", false);
+  UTF8RegexMatcher matcher(regex);
+  std::string const subject = "abb\nc\nb\nc";
+  matcher.start(subject.data(), subject.size(), 3 /*startLimit*/);
+  xassert(matcher.next());
+  EXPECT_EQ(matcher.matchStart(), 2u);
+  EXPECT_EQ(matcher.matchEnd(), 5u);
+  xassert(!matcher.next());
+
+  // Same without the offset-limit optimization.
+  UTF8Regex regex2("b", false);
+  UTF8RegexMatcher matcher2(regex2);
+  matcher2.start(subject.data(), subject.size(), 3 /*startLimit*/);
+  xassert(matcher2.next());
+  xassert(matcher2.next());
+  xassert(!matcher2.next());
+}
+
+
+void testCaptureGroups()
+{
+  UTF8Regex regex("(a+)(x)?(b+)", false);
+  UTF8RegexMatcher matcher(regex);
+  std::string const subject = "zaabbb";
+  matcher.start(subject.data(), subject.size());
+  xassert(matcher.next());
+
+  std::size_t start=0, end=0;
+  xassert(matcher.captureGroup(0, start, end));
+  EXPECT_EQ(subject.substr(start, end-start), "aabbb");
+  xassert(matcher.captureGroup(1, start, end));
+  EXPECT_EQ(subject.substr(start, end-start), "aa");
+  xassert(!matcher.captureGroup(2, start, end));
+  xassert(matcher.captureGroup(3, start, end));
+  EXPECT_EQ(subject.substr(start, end-start), "bbb");
+  xassert(!matcher.captureGroup(4, start, end));
+}
+
+
+// The matcher can be reused for many subjects.
+void testReuse()
+{
+  UTF8Regex regex("[0-9]+", false);
+  UTF8RegexMatcher matcher(regex);
+
+  for (int i=0; i < 100; i++) {
+    std::string subject = "n=" + std::to_string(i) + ";";
+    matcher.start(subject.data(), subject.size());
+    xassert(matcher.next());
+    EXPECT_EQ(matcher.matchStart(), 2u);
+    EXPECT_EQ(matcher.matchEnd(), subject.size()-1);
+    xassert(!matcher.next());
+  }
+
+  DIAG("JIT compiled: " << regex.isJitCompiled());
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_utf8_regex(CmdlineArgsSpan args)
+{
+  testBasic();
+  testUTF8Offsets();
+  testSyntaxError();
+  testMultiLine();
+  testCaptureGroups();
+  testReuse();
+}
+
+
+// EOF
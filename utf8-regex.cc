@@ -0,0 +1,246 @@
+// utf8-regex.cc
+// Code for `utf8-regex` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "utf8-regex.h"                // this module
+
+#include "smbase/xassert.h"            // xassert, xassertPrecondition
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>                     // pcre2_*
+
+#include <algorithm>                   // std::max
+#include <cstdint>                     // std::uint32_t
+
+
+// True if `c` is a UTF-8 continuation byte.
+static bool isContinuationByte(char c)
+{
+  return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+
+// Number of characters in the first `byteOffset` bytes of `s`.
+static int characterOffset(std::string const &s, std::size_t byteOffset)
+{
+  int ret = 0;
+  for (std::size_t i=0; i < byteOffset && i < s.size(); i++) {
+    if (!isContinuationByte(s[i])) {
+      ret++;
+    }
+  }
+  return ret;
+}
+
+
+// ----------------------------- UTF8Regex -------------------------------
+UTF8Regex::UTF8Regex(std::string const &pattern, bool caseInsensitive)
+  : m_pattern(pattern),
+    m_code(nullptr),
+    m_errorMessage(),
+    m_errorOffset(-1),
+    m_canMatchNewline(false),
+    m_usesOffsetLimit(false),
+    m_jitCompiled(false)
+{
+  unsigned options = PCRE2_MULTILINE;
+  if (caseInsensitive) {
+    options |= PCRE2_CASELESS;
+  }
+
+  #ifdef PCRE2_MATCH_INVALID_UTF
+    // Documents are not guaranteed to be valid UTF-8, so this option
+    // (available since PCRE2 10.34) is needed to use UTF mode safely.
+    // Without it, the pattern and subject are treated as bytes.
+    options |= PCRE2_UTF | PCRE2_MATCH_INVALID_UTF;
+  #endif
+
+  this->compile(options);
+  if (!m_code) {
+    return;
+  }
+
+  std::uint32_t hasCRorLF = 0;
+  pcre2_pattern_info(m_code, PCRE2_INFO_HASCRORLF, &hasCRorLF);
+  m_canMatchNewline = (hasCRorLF != 0);
+
+  if (m_canMatchNewline) {
+    // Clients will search multi-line windows but only want the matches
+    // that start on the first line.  The offset limit lets PCRE2 stop
+    // looking at that point, but it has a small cost otherwise, so it
+    // is only enabled for these patterns.
+    pcre2_code_free(m_code);
+    this->compile(options | PCRE2_USE_OFFSET_LIMIT);
+    xassert(m_code);
+    m_usesOffsetLimit = true;
+  }
+
+  // JIT compilation can fail for unusual patterns, in which case
+  // `pcre2_match` uses the interpreter.
+  m_jitCompiled = (pcre2_jit_compile(m_code, PCRE2_JIT_COMPLETE) == 0);
+}
+
+
+UTF8Regex::~UTF8Regex()
+{
+  if (m_code) {
+    pcre2_code_free(m_code);
+  }
+}
+
+
+void UTF8Regex::compile(unsigned options)
+{
+  int errorCode = 0;
+  PCRE2_SIZE errorOffset = 0;
+  m_code = pcre2_compile(
+    (PCRE2_SPTR)m_pattern.data(), m_pattern.size(),
+    options, &errorCode, &errorOffset, nullptr /*context*/);
+
+  if (!m_code) {
+    PCRE2_UCHAR buffer[256];
+    pcre2_get_error_message(errorCode, buffer, sizeof(buffer));
+    m_errorMessage = (char const *)buffer;
+    m_errorOffset = characterOffset(m_pattern, errorOffset);
+  }
+}
+
+
+// -------------------------- UTF8RegexMatcher ---------------------------
+UTF8RegexMatcher::UTF8RegexMatcher(UTF8Regex const &regex)
+  : m_regex(regex),
+    m_matchData(nullptr),
+    m_matchContext(nullptr),
+    m_jitStack(nullptr),
+    m_subject(nullptr),
+    m_subjectLength(0),
+    m_startLimit(0),
+    m_nextOffset(0),
+    m_lastWasEmpty(false),
+    m_done(true)
+{
+  xassertPrecondition(regex.isValid());
+
+  m_matchData = pcre2_match_data_create_from_pattern(regex.m_code, nullptr);
+  m_matchContext = pcre2_match_context_create(nullptr);
+  xassert(m_matchData && m_matchContext);
+
+  if (regex.m_jitCompiled) {
+    // The default JIT stack is 32 KiB, which some patterns with a lot
+    // of backtracking exceed.  Allow it to grow to 1 MiB.
+    m_jitStack = pcre2_jit_stack_create(32*1024, 1024*1024, nullptr);
+    xassert(m_jitStack);
+    pcre2_jit_stack_assign(m_matchContext, nullptr, m_jitStack);
+  }
+}
+
+
+UTF8RegexMatcher::~UTF8RegexMatcher()
+{
+  if (m_jitStack) {
+    pcre2_jit_stack_free(m_jitStack);
+  }
+  pcre2_match_context_free(m_matchContext);
+  pcre2_match_data_free(m_matchData);
+}
+
+
+void UTF8RegexMatcher::start(char const *subject, std::size_t length,
+                             std::size_t startLimit)
+{
+  m_subject = subject;
+  m_subjectLength = length;
+  m_startLimit = startLimit;
+  m_nextOffset = 0;
+  m_lastWasEmpty = false;
+  m_done = false;
+
+  if (m_regex.m_usesOffsetLimit) {
+    pcre2_set_offset_limit(m_matchContext, startLimit);
+  }
+}
+
+
+bool UTF8RegexMatcher::next()
+{
+  while (!m_done &&
+         m_nextOffset <= m_subjectLength &&
+         m_nextOffset <= m_startLimit) {
+    // After an empty match, first try for a non-empty match at the
+    // same position, as Perl does.
+    std::uint32_t options = 0;
+    if (m_lastWasEmpty) {
+      options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
+    }
+
+    int rc = pcre2_match(m_regex.m_code,
+      (PCRE2_SPTR)m_subject, m_subjectLength, m_nextOffset,
+      options, m_matchData, m_matchContext);
+
+    if (rc < 0) {
+      if (rc == PCRE2_ERROR_NOMATCH && m_lastWasEmpty) {
+        // Move ahead one character and resume normal searching.
+        m_lastWasEmpty = false;
+        m_nextOffset++;
+        while (m_nextOffset < m_subjectLength &&
+               isContinuationByte(m_subject[m_nextOffset])) {
+          m_nextOffset++;
+        }
+        continue;
+      }
+
+      // Either there are no more matches, or matching failed due to
+      // a resource limit.  Either way, stop.
+      break;
+    }
+
+    PCRE2_SIZE const *ovector = pcre2_get_ovector_pointer(m_matchData);
+    if (ovector[0] > m_startLimit) {
+      break;
+    }
+
+    m_lastWasEmpty = (ovector[1] <= ovector[0]);
+    m_nextOffset = std::max(ovector[0], ovector[1]);
+    return true;
+  }
+
+  m_done = true;
+  return false;
+}
+
+
+std::size_t UTF8RegexMatcher::matchStart() const
+{
+  return pcre2_get_ovector_pointer(m_matchData)[0];
+}
+
+
+std::size_t UTF8RegexMatcher::matchEnd() const
+{
+  // With `\K`, the end can precede the start; treat that as empty.
+  PCRE2_SIZE const *ovector = pcre2_get_ovector_pointer(m_matchData);
+  return std::max(ovector[0], ovector[1]);
+}
+
+
+bool UTF8RegexMatcher::captureGroup(int n, std::size_t &start,
+                                    std::size_t &end) const
+{
+  if (n < 0 ||
+      (std::uint32_t)n >= pcre2_get_ovector_count(m_matchData)) {
+    return false;
+  }
+
+  PCRE2_SIZE const *ovector = pcre2_get_ovector_pointer(m_matchData);
+  if (ovector[2*n] == PCRE2_UNSET) {
+    return false;
+  }
+
+  start = ovector[2*n];
+  end = std::max(ovector[2*n], ovector[2*n+1]);
+  return true;
+}
+
+
+// EOF
@@ -0,0 +1,162 @@
+// utf8-regex.h
+// `UTF8Regex`, a Perl-syntax regular expression that matches UTF-8
+// text in place.
+
+// See license.txt for copyright and terms of use.
+
+// This is a thin wrapper around the 8-bit PCRE2 library.  Unlike
+// `QRegularExpression`, which only matches UTF-16 `QString`s, it can
+// match the bytes of a document line directly, and it reports match
+// positions as byte offsets.
+//
+// A `UTF8Regex` is immutable after construction and can be shared by
+// multiple threads.  Each thread that matches with it needs its own
+// `UTF8RegexMatcher`, which holds the per-match scratch memory so it
+// can be reused across many subjects.
+
+#ifndef EDITOR_UTF8_REGEX_H
+#define EDITOR_UTF8_REGEX_H
+
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+
+#include <cstddef>                     // std::size_t
+#include <string>                      // std::string
+
+// PCRE2 types, declared here so clients do not need pcre2.h.
+struct pcre2_real_code_8;
+struct pcre2_real_match_data_8;
+struct pcre2_real_match_context_8;
+struct pcre2_real_jit_stack_8;
+
+
+// A compiled regular expression.
+class UTF8Regex {
+  NO_OBJECT_COPIES(UTF8Regex);
+
+private:     // data
+  // The pattern as supplied to the constructor.
+  std::string const m_pattern;
+
+  // The compiled pattern, or NULL if it has a syntax error.
+  pcre2_real_code_8 *m_code;
+
+  // If `m_code` is NULL, a description of the syntax error.
+  std::string m_errorMessage;
+
+  // If `m_code` is NULL, the character offset in `m_pattern` where the
+  // error was detected.  Otherwise -1.
+  int m_errorOffset;
+
+  // True if the pattern explicitly matches a CR or LF character, which
+  // means it is meant to match across line boundaries.
+  bool m_canMatchNewline;
+
+  // True if the pattern was compiled with support for a limit on the
+  // match start offset.  See `UTF8RegexMatcher::start`.
+  bool m_usesOffsetLimit;
+
+  // True if PCRE2 JIT-compiled the pattern to machine code.
+  bool m_jitCompiled;
+
+private:     // funcs
+  // Compile `m_pattern` with `options`, setting the error fields if
+  // that fails.
+  void compile(unsigned options);
+
+public:      // funcs
+  // Compile `pattern`.  If it has a syntax error, the object is
+  // created anyway, but `!isValid()`.
+  //
+  // In the compiled pattern, `^` and `$` match at the start and end of
+  // each line, like Perl's `/m` modifier.
+  UTF8Regex(std::string const &pattern, bool caseInsensitive);
+
+  ~UTF8Regex();
+
+  // False if the pattern has a syntax error, in which case it matches
+  // nothing.
+  bool isValid() const { return m_code != nullptr; }
+
+  std::string const &pattern() const { return m_pattern; }
+
+  // When `!isValid()`, the error message and the character offset of
+  // the error.  Otherwise, "" and -1.
+  std::string const &errorMessage() const { return m_errorMessage; }
+  int errorOffset() const { return m_errorOffset; }
+
+  bool canMatchNewline() const { return m_canMatchNewline; }
+  bool isJitCompiled() const { return m_jitCompiled; }
+
+  friend class UTF8RegexMatcher;
+};
+
+
+// Iterates over the matches of a `UTF8Regex` in a subject string.
+class UTF8RegexMatcher {
+  NO_OBJECT_COPIES(UTF8RegexMatcher);
+
+private:     // data
+  // The regex to match.  Must be valid.
+  UTF8Regex const &m_regex;
+
+  // PCRE2 scratch space and results, reused for each match.
+  pcre2_real_match_data_8 *m_matchData;
+
+  // Match parameters, which carry the offset limit and JIT stack.
+  pcre2_real_match_context_8 *m_matchContext;
+
+  // Stack for JIT-compiled matching, or NULL if not JIT-compiled.
+  pcre2_real_jit_stack_8 *m_jitStack;
+
+  // The subject set by `start`.
+  char const *m_subject;
+  std::size_t m_subjectLength;
+
+  // Matches must start at or before this offset.
+  std::size_t m_startLimit;
+
+  // Where to look for the next match.
+  std::size_t m_nextOffset;
+
+  // True if the most recent match was empty, in which case the next
+  // match must not be empty at the same position.
+  bool m_lastWasEmpty;
+
+  // True after `next` has returned false.
+  bool m_done;
+
+public:      // funcs
+  explicit UTF8RegexMatcher(UTF8Regex const &regex);
+  ~UTF8RegexMatcher();
+
+  // Begin iterating over the matches in the `length` bytes at
+  // `subject`, which must remain valid while iterating.  Matches that
+  // start after `startLimit` are not reported.  This is how a client
+  // can give the regex a multi-line window of context while only
+  // finding the matches that start on its first line.
+  void start(char const *subject, std::size_t length,
+             std::size_t startLimit);
+
+  // Same, without a start limit.
+  void start(char const *subject, std::size_t length)
+    { start(subject, length, length); }
+
+  // Find the next match, returning false if there are none left.
+  // Matches do not overlap.  After an empty match, the next match is
+  // sought one character further along.
+  bool next();
+
+  // Byte offsets in the subject of the current match, which is the one
+  // found by the last call to `next` that returned true.
+  std::size_t matchStart() const;
+  std::size_t matchEnd() const;
+
+  // Get the extent of capture group `n` of the current match, where 0
+  // is the whole match.  Return false if there is no such group or it
+  // did not participate in the match.
+  bool captureGroup(int n, std::size_t &start /*OUT*/,
+                    std::size_t &end /*OUT*/) const;
+};
+
+
+#endif // EDITOR_UTF8_REGEX_H
@@ -0,0 +1,178 @@
+// vfs-compress-test.cc
+// Tests for `vfs-compress` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "vfs-compress.h"              // module under test
+#include "unit-tests.h"                // decl for my entry point
+
+#include "smbase/exc.h"                // smbase::XFormat
+#include "smbase/sm-macros.h"          // OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/sm-test.h"            // EXPECT_EQ, DIAG
+#include "smbase/xassert.h"            // xassert, xfailure
+
+#include <cstddef>                     // std::size_t
+#include <string>                      // std::string
+
+#include <stdlib.h>                    // rand
+
+using namespace smbase;
+
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Compress and decompress `data`, checking that it round-trips.
+// Return the compressed size.
+std::size_t roundTrip(std::string const &data)
+{
+  std::string compressed = vfsLZCompress(data.data(), data.size());
+  std::string decompressed =
+    vfsLZDecompress(compressed.data(), compressed.size(), data.size());
+  EXPECT_EQ(decompressed, data);
+
+  std::string encoded = vfsEncodeMessageBody(VFS_CC_LZ, data);
+  EXPECT_EQ(vfsDecodeMessageBody(encoded.data(), encoded.size()), data);
+
+  return compressed.size();
+}
+
+
+std::string randomBytes(std::size_t n)
+{
+  std::string ret;
+  for (std::size_t i=0; i < n; ++i) {
+    ret.push_back(static_cast<char>(rand() & 0xFF));
+  }
+  return ret;
+}
+
+
+void testRoundTrip()
+{
+  roundTrip("");
+  roundTrip("a");
+  roundTrip("abc");
+  roundTrip("abcd");
+  roundTrip("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+
+  // Long runs exercise the length extension bytes.
+  roundTrip(std::string(100000, 'x'));
+
+  std::string text;
+  for (int i=0; i < 2000; ++i) {
+    text += "  for (int i=0; i < n; ++i) {\n";
+    text += "    sum += array[i] * " + std::to_string(i) + ";\n";
+    text += "  }\n";
+  }
+  std::size_t textSize = roundTrip(text);
+  DIAG("text: " << text.size() << " -> " << textSize);
+  xassert(textSize < text.size() / 4);
+
+  // Random data should not grow by much.
+  std::string random = randomBytes(100000);
+  std::size_t randomSize = roundTrip(random);
+  DIAG("random: " << random.size() << " -> " << randomSize);
+  xassert(randomSize < random.size() + random.size()/100);
+
+  // Mixtures of the two, so literal runs alternate with matches.
+  for (int i=0; i < 20; ++i) {
+    roundTrip(randomBytes(rand() % 300) + text.substr(0, rand() % 3000) +
+              randomBytes(rand() % 300));
+  }
+}
+
+
+void testEnvelope()
+{
+  // Small bodies are sent as-is.
+  std::string small("hello");
+  std::string encoded = vfsEncodeMessageBody(VFS_CC_LZ, small);
+  EXPECT_EQ(encoded, std::string(1, '\0') + small);
+
+  // Nothing is compressed when the codec is `VFS_CC_NONE`.
+  std::string big(1000, 'z');
+  encoded = vfsEncodeMessageBody(VFS_CC_NONE, big);
+  EXPECT_EQ(encoded.size(), big.size() + 1);
+
+  encoded = vfsEncodeMessageBody(VFS_CC_LZ, big);
+  xassert(encoded.size() < 100);
+  EXPECT_EQ((int)encoded[0], (int)VFS_CC_LZ);
+  EXPECT_EQ(vfsDecodeMessageBody(encoded.data(), encoded.size()), big);
+
+  // The view decoder only copies when it has to decompress.
+  std::string scratch;
+  std::size_t bodyLen = 0;
+  char const *body =
+    vfsDecodeMessageBodyView(encoded.data(), encoded.size(), scratch, bodyLen);
+  EXPECT_EQ(std::string(body, bodyLen), big);
+  xassert(body == scratch.data());
+
+  encoded = vfsEncodeMessageBody(VFS_CC_NONE, big);
+  body =
+    vfsDecodeMessageBodyView(encoded.data(), encoded.size(), scratch, bodyLen);
+  xassert(body == encoded.data()+1);
+  EXPECT_EQ(bodyLen, big.size());
+}
+
+
+// Decoding `encoded` should throw XFormat.
+void expectDecodeFailure(std::string const &encoded)
+{
+  try {
+    vfsDecodeMessageBody(encoded.data(), encoded.size());
+    xfailure("should have failed");
+  }
+  catch (XFormat &x) {
+    DIAG("as expected: " << x.why());
+  }
+}
+
+
+void testMalformed()
+{
+  expectDecodeFailure("");
+  expectDecodeFailure(std::string(1, '\x07'));
+  expectDecodeFailure(std::string("\x01\x00\x00", 3));
+
+  std::string encoded =
+    vfsEncodeMessageBody(VFS_CC_LZ, std::string(1000, 'q'));
+
+  // Truncation.
+  expectDecodeFailure(encoded.substr(0, encoded.size()-1));
+
+  // Wrong declared length.
+  {
+    std::string bad(encoded);
+    bad[4] = static_cast<char>(bad[4] + 1);
+    expectDecodeFailure(bad);
+  }
+
+  // A match that refers to before the start of the output.
+  expectDecodeFailure(std::string("\x01\x00\x00\x00\x08\x00\x05\x00", 8));
+}
+
+
+void testNegotiate()
+{
+  EXPECT_EQ(vfsNegotiateCodec(-1), VFS_CC_NONE);
+  EXPECT_EQ(vfsNegotiateCodec(VFS_CC_NONE), VFS_CC_NONE);
+  EXPECT_EQ(vfsNegotiateCodec(VFS_CC_LZ), VFS_CC_LZ);
+  EXPECT_EQ((int)vfsNegotiateCodec(1000), NUM_VFS_COMPRESSION_CODECS-1);
+}
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+// Called from unit-tests.cc.
+void test_vfs_compress(CmdlineArgsSpan args)
+{
+  testRoundTrip();
+  testEnvelope();
+  testMalformed();
+  testNegotiate();
+}
+
+
+// EOF
@@ -0,0 +1,364 @@
+// vfs-compress.cc
+// Code for vfs-compress.h.
+
+#include "vfs-compress.h"                        // this module
+
+// smbase
+#include "smbase/exc.h"                          // smbase::xformatsb
+#include "smbase/flatten.h"                      // de/serializeIntNBO
+#include "smbase/overflow.h"                     // writeConvertedNumber
+#include "smbase/sm-macros.h"                    // DEFINE_ENUMERATION_TO_STRING, OPEN_ANONYMOUS_NAMESPACE
+#include "smbase/xassert.h"                      // xassert
+
+// libc++
+#include <algorithm>                             // std::min
+#include <vector>                                // std::vector
+
+// libc
+#include <string.h>                              // memcpy
+
+using namespace smbase;
+
+
+DEFINE_ENUMERATION_TO_STRING(
+  VFS_CompressionCodec,
+  NUM_VFS_COMPRESSION_CODECS,
+  (
+    "VFS_CC_NONE",
+    "VFS_CC_LZ",
+  )
+)
+
+
+VFS_CompressionCodec vfsNegotiateCodec(int32_t requested)
+{
+  if (requested <= VFS_CC_NONE) {
+    return VFS_CC_NONE;
+  }
+  if (requested >= NUM_VFS_COMPRESSION_CODECS) {
+    return static_cast<VFS_CompressionCodec>(NUM_VFS_COMPRESSION_CODECS-1);
+  }
+  return static_cast<VFS_CompressionCodec>(requested);
+}
+
+
+/* The LZ codec format is a sequence of "sequences", each of which is:
+
+     token       1 byte: high nibble is the literal count, low nibble is
+                 the match length minus 4
+     litExt      if the literal nibble is 15, extension bytes
+     literals    that many bytes, copied to the output
+     offset      2 bytes, little endian, distance back to the match
+     matchExt    if the match nibble is 15, extension bytes
+
+   Extension bytes are added to the nibble value; each 255 byte means
+   another follows.  The final sequence ends after its literals, which
+   is how the decoder knows to stop.  This is essentially the LZ4 block
+   format, which is simple to decode safely.
+*/
+
+OPEN_ANONYMOUS_NAMESPACE
+
+
+// Shortest match worth encoding.
+int const MIN_MATCH = 4;
+
+// Largest distance back to a match.
+std::size_t const MAX_OFFSET = 0xFFFF;
+
+// Log2 of the number of hash table entries.
+int const HASH_BITS = 14;
+
+// Marks an empty hash table entry.
+uint32_t const NO_POSITION = 0xFFFFFFFF;
+
+
+uint32_t read32(unsigned char const *p)
+{
+  uint32_t ret;
+  memcpy(&ret, p, 4);
+  return ret;
+}
+
+
+uint32_t hash32(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+// Append the extension bytes for a length whose nibble was 15.
+void appendLengthExtension(std::string &dest, std::size_t n)
+{
+  while (n >= 255) {
+    dest.push_back(static_cast<char>(255));
+    n -= 255;
+  }
+  dest.push_back(static_cast<char>(n));
+}
+
+
+// Append one sequence.  If `matchLen` is 0, this is the final,
+// literal-only sequence.
+void appendSequence(std::string &dest,
+                    unsigned char const *literals, std::size_t numLiterals,
+                    std::size_t offset, std::size_t matchLen)
+{
+  std::size_t litNibble = std::min(numLiterals, (std::size_t)15);
+  std::size_t matchNibble =
+    matchLen? std::min(matchLen - MIN_MATCH, (std::size_t)15) : 0;
+  dest.push_back(static_cast<char>((litNibble << 4) | matchNibble));
+
+  if (litNibble == 15) {
+    appendLengthExtension(dest, numLiterals - 15);
+  }
+  dest.append(reinterpret_cast<char const *>(literals), numLiterals);
+
+  if (matchLen) {
+    xassert(0 < offset && offset <= MAX_OFFSET);
+    dest.push_back(static_cast<char>(offset & 0xFF));
+    dest.push_back(static_cast<char>(offset >> 8));
+    if (matchNibble == 15) {
+      appendLengthExtension(dest, matchLen - MIN_MATCH - 15);
+    }
+  }
+}
+
+
+// Decoder's view of the input.
+class LZReader {
+public:      // data
+  unsigned char const *m_cur;
+  unsigned char const *m_end;
+
+public:      // methods
+  LZReader(char const *src, std::size_t len)
+    : m_cur(reinterpret_cast<unsigned char const *>(src)),
+      m_end(m_cur + len)
+  {}
+
+  bool atEnd() const { return m_cur == m_end; }
+
+  std::size_t remaining() const { return m_end - m_cur; }
+
+  unsigned char readByte()
+  {
+    if (atEnd()) {
+      xformatsb("LZ data is truncated.");
+    }
+    return *(m_cur++);
+  }
+
+  // Read the extension bytes following a nibble of 15.
+  std::size_t readLengthExtension(std::size_t n)
+  {
+    unsigned char b;
+    do {
+      b = readByte();
+      n += b;
+    } while (b == 255);
+    return n;
+  }
+};
+
+
+CLOSE_ANONYMOUS_NAMESPACE
+
+
+std::string vfsLZCompress(char const *srcChars, std::size_t len)
+{
+  unsigned char const *src =
+    reinterpret_cast<unsigned char const *>(srcChars);
+
+  std::string dest;
+  dest.reserve(len/2 + 16);
+
+  // Map from hash of four bytes to the most recent position where they
+  // were seen.
+  std::vector<uint32_t> table(std::size_t(1) << HASH_BITS, NO_POSITION);
+
+  // Start of literals not yet emitted.
+  std::size_t anchor = 0;
+
+  std::size_t i = 0;
+  while (i + MIN_MATCH <= len) {
+    uint32_t here = read32(src+i);
+    uint32_t h = hash32(here);
+    uint32_t cand = table[h];
+    table[h] = static_cast<uint32_t>(i);
+
+    if (cand != NO_POSITION &&
+        i - cand <= MAX_OFFSET &&
+        read32(src+cand) == here) {
+      std::size_t matchLen = MIN_MATCH;
+      while (i + matchLen < len && src[cand+matchLen] == src[i+matchLen]) {
+        ++matchLen;
+      }
+
+      appendSequence(dest, src+anchor, i-anchor, i-cand, matchLen);
+      i += matchLen;
+      anchor = i;
+    }
+    else {
+      // Skip ahead faster through data that is not compressing, so
+      // incompressible input costs little time.
+      i += 1 + ((i - anchor) >> 6);
+    }
+  }
+
+  if (anchor < len || len == 0) {
+    appendSequence(dest, src+anchor, len-anchor, 0, 0);
+  }
+
+  return dest;
+}
+
+
+std::string vfsLZDecompress(char const *src, std::size_t len,
+                            std::size_t expectedLen)
+{
+  std::string dest;
+  // Do not trust `expectedLen` too far before the data bears it out.
+  dest.reserve(std::min(expectedLen, len * 255));
+
+  LZReader reader(src, len);
+  while (!reader.atEnd()) {
+    unsigned char token = reader.readByte();
+
+    std::size_t numLiterals = token >> 4;
+    if (numLiterals == 15) {
+      numLiterals = reader.readLengthExtension(numLiterals);
+    }
+    if (numLiterals > reader.remaining() ||
+        numLiterals > expectedLen - dest.size()) {
+      xformatsb("LZ literal run of " << numLiterals <<
+                " bytes overruns the data.");
+    }
+    dest.append(reinterpret_cast<char const *>(reader.m_cur), numLiterals);
+    reader.m_cur += numLiterals;
+
+    if (reader.atEnd()) {
+      break;
+    }
+
+    std::size_t offset = reader.readByte();
+    offset |= std::size_t(reader.readByte()) << 8;
+    if (offset == 0 || offset > dest.size()) {
+      xformatsb("LZ match offset " << offset << " is invalid at " <<
+                "output position " << dest.size() << ".");
+    }
+
+    std::size_t matchLen = token & 0xF;
+    if (matchLen == 15) {
+      matchLen = reader.readLengthExtension(matchLen);
+    }
+    matchLen += MIN_MATCH;
+    if (matchLen > expectedLen - dest.size()) {
+      xformatsb("LZ match of " << matchLen <<
+                " bytes overruns the expected length.");
+    }
+
+    // The match can overlap the bytes it produces, so copy one byte at
+    // a time.
+    std::size_t from = dest.size() - offset;
+    for (std::size_t k=0; k < matchLen; ++k) {
+      dest.push_back(dest[from+k]);
+    }
+  }
+
+  if (dest.size() != expectedLen) {
+    xformatsb("LZ data decompressed to " << dest.size() <<
+              " bytes, but " << expectedLen << " were expected.");
+  }
+
+  return dest;
+}
+
+
+bool vfsCompressMessageBody(VFS_CompressionCodec codec,
+                            char const *body, std::size_t len,
+                            std::string &compressed /*OUT*/)
+{
+  if (codec == VFS_CC_LZ && len >= VFS_minCompressedBodySize) {
+    compressed = vfsLZCompress(body, len);
+    if (compressed.size() + 4 < len) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+std::string vfsEncodeMessageBody(VFS_CompressionCodec codec,
+                                 std::string const &body)
+{
+  std::string compressed;
+  if (vfsCompressMessageBody(codec, body.data(), body.size(), compressed)) {
+    uint32_t rawLen;
+    writeConvertedNumber(rawLen, body.size());
+    unsigned char lenBuf[4];
+    serializeIntNBO(lenBuf, rawLen);
+
+    std::string ret;
+    ret.reserve(1 + 4 + compressed.size());
+    ret.push_back(static_cast<char>(VFS_CC_LZ));
+    ret.append(reinterpret_cast<char const *>(lenBuf), 4);
+    ret.append(compressed);
+    return ret;
+  }
+
+  std::string ret;
+  ret.reserve(1 + body.size());
+  ret.push_back(static_cast<char>(VFS_CC_NONE));
+  ret.append(body);
+  return ret;
+}
+
+
+char const *vfsDecodeMessageBodyView(char const *data, std::size_t len,
+                                     std::string &scratch /*OUT*/,
+                                     std::size_t &bodyLen /*OUT*/)
+{
+  if (len < 1) {
+    xformatsb("Message body is missing its codec byte.");
+  }
+
+  switch (static_cast<unsigned char>(data[0])) {
+    case VFS_CC_NONE:
+      bodyLen = len-1;
+      return data+1;
+
+    case VFS_CC_LZ: {
+      if (len < 5) {
+        xformatsb("LZ message body is missing its length.");
+      }
+      uint32_t rawLen;
+      deserializeIntNBO(reinterpret_cast<unsigned char const *>(data+1),
+                        rawLen);
+      scratch = vfsLZDecompress(data+5, len-5, rawLen);
+      bodyLen = scratch.size();
+      return scratch.data();
+    }
+
+    default:
+      xformatsb("Unknown message codec byte " <<
+                (int)static_cast<unsigned char>(data[0]) << ".");
+  }
+
+  return nullptr;     // Not reached.
+}
+
+
+std::string vfsDecodeMessageBody(char const *data, std::size_t len)
+{
+  std::string scratch;
+  std::size_t bodyLen;
+  char const *body = vfsDecodeMessageBodyView(data, len, scratch, bodyLen);
+  if (body == scratch.data()) {
+    return scratch;
+  }
+  return std::string(body, bodyLen);
+}
+
+
+// EOF
@@ -0,0 +1,95 @@
+// vfs-compress.h
+// Per-message compression for the VFS wire protocol.
+
+// This module is used by both the editor and `editor-fs-server`, so it
+// must not depend on Qt.
+
+#ifndef EDITOR_VFS_COMPRESS_H
+#define EDITOR_VFS_COMPRESS_H
+
+// libc++
+#include <cstddef>                               // std::size_t
+#include <string>                                // std::string
+
+// libc
+#include <stdint.h>                              // int32_t
+
+
+// Codecs that can be negotiated for a connection.  They are numbered in
+// increasing order of preference, and every implementation of the
+// protocol supports all codecs up to the one it names in
+// `VFS_GetVersion::m_compressionCodec`, so negotiation just takes the
+// minimum of what the two sides offer.
+enum VFS_CompressionCodec : int32_t {
+  // No compression.  Always available, and the fallback if the other
+  // side does not understand what was requested.
+  VFS_CC_NONE,
+
+  // Built-in byte-oriented LZ77 codec (see `vfsLZCompress`).  It is
+  // fast and moderately effective on source text, which is most of
+  // what crosses the wire.
+  VFS_CC_LZ,
+
+  NUM_VFS_COMPRESSION_CODECS
+};
+
+// Return a string like "VFS_CC_LZ".
+char const *toString(VFS_CompressionCodec codec);
+
+// Return the codec to use when the peer asked for `requested`.  Values
+// beyond what this side understands are clamped to the best codec we
+// have, and negative values become `VFS_CC_NONE`.
+VFS_CompressionCodec vfsNegotiateCodec(int32_t requested);
+
+
+// Compress `len` bytes at `src` with the LZ codec.  The result can be
+// larger than the input if the input is not compressible.
+std::string vfsLZCompress(char const *src, std::size_t len);
+
+// Decompress `len` bytes at `src`, which must be the output of
+// `vfsLZCompress` for an input of `expectedLen` bytes.  Throws
+// `XFormat` if the data is malformed.
+std::string vfsLZDecompress(char const *src, std::size_t len,
+                            std::size_t expectedLen);
+
+
+// Message bodies shorter than this are never compressed, since the
+// envelope overhead would consume any savings.
+std::size_t const VFS_minCompressedBodySize = 128;
+
+// Encode the serialized message `body` for transmission on a
+// connection that negotiated `codec`.  The result begins with one byte
+// naming the codec actually applied, which is `VFS_CC_NONE` if `body`
+// is small or compression did not make it smaller.  For `VFS_CC_LZ`,
+// that is followed by the 4-byte NBO uncompressed length and then the
+// compressed bytes.
+std::string vfsEncodeMessageBody(VFS_CompressionCodec codec,
+                                 std::string const &body);
+
+// Reverse `vfsEncodeMessageBody`.  Throws `XFormat` on malformed
+// input, including an unknown codec byte.
+std::string vfsDecodeMessageBody(char const *data, std::size_t len);
+
+
+// The pieces of `vfsEncodeMessageBody`, for callers that want to avoid
+// copying the body into a new string.
+//
+// If `codec` calls for compression and it would make the `len` bytes at
+// `body` smaller, set `compressed` to the LZ data and return true.  The
+// encoded body is then the `VFS_CC_LZ` byte, the 4-byte NBO value of
+// `len`, and `compressed`.  Otherwise return false, and the encoded body
+// is the `VFS_CC_NONE` byte followed by `body` itself.
+bool vfsCompressMessageBody(VFS_CompressionCodec codec,
+                            char const *body, std::size_t len,
+                            std::string &compressed /*OUT*/);
+
+// Like `vfsDecodeMessageBody`, but when the body was not compressed,
+// return a pointer into `data` rather than copying it.  Otherwise, the
+// body is decompressed into `scratch` and the return value points
+// there.  Either way, the decoded length is stored in `bodyLen`.
+char const *vfsDecodeMessageBodyView(char const *data, std::size_t len,
+                                     std::string &scratch /*OUT*/,
+                                     std::size_t &bodyLen /*OUT*/);
+
+
+#endif // EDITOR_VFS_COMPRESS_H
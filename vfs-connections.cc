@@ -4,12 +4,12 @@
 #include "vfs-connections.h"           // this module
 
 // editor
-#include "vfs-query.h"                 // VFS_FileSystemQuery
+#include "vfs-query.h"                 // VFS_FileSystemQuery, VFS_TransferStats
 
 // smbase
 #include "smbase/container-util.h"     // smbase::contains
 #include "smbase/exc.h"                // GENERIC_CATCH_BEGIN/END
-#include "smbase/map-util.h"           // mapInsertUniqueMove, keySet
+#include "smbase/map-util.h"           // mapInsertUnique[Move], keySet
 #include "smbase/ordered-map.h"        // smbase::OrderedMap
 #include "smbase/sm-file-util.h"       // SMFileUtil
 #include "smbase/trace.h"              // TRACE
@@ -23,6 +23,12 @@
 using namespace smbase;
 
 
+// Maximum number of requests to have outstanding on one connection.
+// Beyond this, the server would be unlikely to process them any faster,
+// and queueing them here keeps cancellation cheap.
+static int const MAX_REQUESTS_IN_FLIGHT = 8;
+
+
 // ---------------------- VFS_AbstractConnections ----------------------
 VFS_AbstractConnections::~VFS_AbstractConnections()
 {}
@@ -106,7 +112,7 @@ VFS_Connections::Connection::Connection(VFS_Connections *connections,
     m_fsQuery(new VFS_FileSystemQuery),
     m_haveStartingDirectory(false),
     m_startingDirectory(),
-    m_currentRequestID(0),
+    m_inFlightRequests(),
     m_queuedRequests()
 {
   xassertPrecondition(connections != nullptr);
@@ -288,6 +294,20 @@ string VFS_Connections::getStartingDirectory(HostName const &hostName) const
 }
 
 
+VFS_CompressionCodec VFS_Connections::connectionCodec(
+  HostName const &hostName) const
+{
+  return connC(hostName)->m_fsQuery->codec();
+}
+
+
+VFS_TransferStats VFS_Connections::transferStats(
+  HostName const &hostName) const
+{
+  return connC(hostName)->m_fsQuery->transferStats();
+}
+
+
 void VFS_Connections::shutdown(HostName const &hostName)
 {
   TRACE("VFS_Connections", "shutdown(" << hostName << ")");
@@ -333,14 +353,16 @@ void VFS_Connections::Connection::issueRequest(
     " type=" << toString(req->messageType()));
 
   m_queuedRequests.push_front(QueuedRequest(requestID, std::move(req)));
-  issueQueuedRequest();
+  issueQueuedRequests();
 }
 
 
 bool VFS_Connections::Connection::requestIsOutstanding(RequestID requestID) const
 {
-  if (m_currentRequestID == requestID) {
-    return true;
+  for (auto const &kv : m_inFlightRequests) {
+    if (kv.second == requestID) {
+      return true;
+    }
   }
 
   for (QueuedRequest const &qr : m_queuedRequests) {
@@ -366,39 +388,48 @@ bool VFS_Connections::requestIsOutstanding(RequestID requestID) const
 }
 
 
-void VFS_Connections::Connection::issueQueuedRequest()
+int VFS_Connections::Connection::maxRequestsInFlight() const
 {
-  if (!m_queuedRequests.empty()) {
-    if (m_fsQuery->isReady()) {
-      xassert(m_currentRequestID == 0);
+  return m_haveStartingDirectory? MAX_REQUESTS_IN_FLIGHT : 1;
+}
 
-      QueuedRequest const &qr = m_queuedRequests.back();
-      m_currentRequestID = qr.m_requestID;
-      TRACE("VFS_Connections",
-        "sending: requestID=" << m_currentRequestID <<
-        " host=" << m_hostName <<
-        " " << qr.m_requestObject->description());
-      m_fsQuery->sendRequest(*(qr.m_requestObject));
-      m_queuedRequests.pop_back();
-    }
-    else {
-      TRACE("VFS_Connections",
-        "issueQueuedRequest(" << m_hostName << "): connection not ready");
-    }
+
+void VFS_Connections::Connection::issueQueuedRequests()
+{
+  if (m_queuedRequests.empty()) {
+    TRACE("VFS_Connections",
+      "issueQueuedRequests(" << m_hostName << "): no queued requests");
+    return;
   }
-  else {
+
+  if (!m_fsQuery->canSendRequest()) {
+    TRACE("VFS_Connections",
+      "issueQueuedRequests(" << m_hostName << "): connection not ready");
+    return;
+  }
+
+  while (!m_queuedRequests.empty() &&
+         (int)m_inFlightRequests.size() < maxRequestsInFlight()) {
+    QueuedRequest const &qr = m_queuedRequests.back();
     TRACE("VFS_Connections",
-      "issueQueuedRequest(" << m_hostName << "): no queued requests");
+      "sending: requestID=" << qr.m_requestID <<
+      " host=" << m_hostName <<
+      " " << qr.m_requestObject->description());
+    VFS_WireID wireID = m_fsQuery->sendRequest(*(qr.m_requestObject));
+    mapInsertUnique(m_inFlightRequests, wireID, qr.m_requestID);
+    m_queuedRequests.pop_back();
   }
 }
 
 
 bool VFS_Connections::Connection::cancelRequest(RequestID requestID)
 {
-  if (m_currentRequestID == requestID) {
-    // This will signal for 'on_vfsReplyAvailable' to discard it.
-    m_currentRequestID = 0;
-    return true;
+  for (auto &kv : m_inFlightRequests) {
+    if (kv.second == requestID) {
+      // This will signal for 'on_vfsReplyAvailable' to discard it.
+      kv.second = 0;
+      return true;
+    }
   }
 
   // Remove a queued request.  This is checked last because it could be
@@ -451,8 +482,10 @@ int VFS_Connections::Connection::numOutstandingRequests() const
 {
   int ret = 0;
 
-  if (m_currentRequestID != 0) {
-    ret++;
+  for (auto const &kv : m_inFlightRequests) {
+    if (kv.second != 0) {
+      ret++;
+    }
   }
 
   ret += (int)(m_queuedRequests.size());
@@ -492,7 +525,7 @@ void VFS_Connections::on_vfsConnected() NOEXCEPT
   if (Connection *c = signalRecipientConnection()) {
     // Trigger sending the first request, which should be the query for
     // the starting directory.
-    c->issueQueuedRequest();
+    c->issueQueuedRequests();
     return;
   }
 
@@ -509,69 +542,111 @@ void VFS_Connections::on_vfsReplyAvailable() NOEXCEPT
   GENERIC_CATCH_BEGIN
 
   if (Connection *c = signalRecipientConnection()) {
-    RequestID requestID = c->m_currentRequestID;
+    // IDs of replies to announce once all have been collected.
+    std::vector<RequestID> arrived;
 
-    if (requestID == 0) {
-      // The request was canceled while in flight.
-      c->m_fsQuery->takeReply();
-    }
+    // File changes the server pushed, likewise.
+    std::vector<VFS_FileChangeNotification> fileChanges;
 
-    else if (!c->m_haveStartingDirectory) {
-      // This is supposed to be the reply for the initial directory
-      // request.
-      xassert(c->connectionState() == CS_CONNECTING);
+    // One signal can announce several replies.
+    while (c->m_fsQuery->hasReply()) {
+      VFS_WireID wireID = c->m_fsQuery->nextReplyID();
       std::unique_ptr<VFS_Message> genericReply(c->m_fsQuery->takeReply());
-      TRACE("VFS_Connections",
-        "  for host " << c->m_hostName <<
-        ", got starting directory reply: " << genericReply->description());
-
-      if (VFS_FileStatusReply const *reply =
-            genericReply->asFileStatusReplyC()) {
-        if (reply->m_success) {
-          if (reply->m_dirExists) {
-            SMFileUtil sfu;
-
-            c->m_haveStartingDirectory = true;
-            c->m_startingDirectory =
-              sfu.normalizePathSeparators(reply->m_dirName);
-            c->m_currentRequestID = 0;
-            xassert(c->connectionState() == CS_READY);
-
-            // Only now do we regard this as "connected" from the client
-            // perspective.
-            Q_EMIT signal_vfsConnected(c->m_hostName);
+
+      if (wireID == VFS_notificationWireID) {
+        if (VFS_FileChangeNotification const *fcn =
+              genericReply->ifFileChangeNotificationC()) {
+          fileChanges.push_back(*fcn);
+        }
+        else {
+          c->m_fsQuery->markAsFailed(stringb(
+            "Unexpected notification type: " <<
+            genericReply->messageType()));
+          break;
+        }
+        continue;
+      }
+
+      auto it = c->m_inFlightRequests.find(wireID);
+      if (it == c->m_inFlightRequests.end()) {
+        // VFS_FileSystemQuery checks that the ID was outstanding, so
+        // this should not happen.
+        c->m_fsQuery->markAsFailed(stringb(
+          "Reply for wire ID " << wireID << " has no request."));
+        break;
+      }
+      RequestID requestID = it->second;
+      c->m_inFlightRequests.erase(it);
+
+      if (requestID == 0) {
+        // The request was canceled while in flight.
+      }
+
+      else if (!c->m_haveStartingDirectory) {
+        // This is supposed to be the reply for the initial directory
+        // request.
+        xassert(c->connectionState() == CS_CONNECTING);
+        TRACE("VFS_Connections",
+          "  for host " << c->m_hostName <<
+          ", got starting directory reply: " << genericReply->description());
+
+        if (VFS_FileStatusReply const *reply =
+              genericReply->asFileStatusReplyC()) {
+          if (reply->m_success) {
+            if (reply->m_dirExists) {
+              SMFileUtil sfu;
+
+              c->m_haveStartingDirectory = true;
+              c->m_startingDirectory =
+                sfu.normalizePathSeparators(reply->m_dirName);
+              xassert(c->connectionState() == CS_READY);
+
+              // Only now do we regard this as "connected" from the
+              // client perspective.
+              Q_EMIT signal_vfsConnected(c->m_hostName);
+            }
+            else {
+              c->m_fsQuery->markAsFailed(
+                "The initial directory query reply had m_dirExists=false.");
+            }
           }
           else {
             c->m_fsQuery->markAsFailed(
-              "The initial directory query reply had m_dirExists=false.");
+              "The initial directory query reply had m_success=false.");
           }
         }
         else {
-          c->m_fsQuery->markAsFailed(
-            "The initial directory query reply had m_success=false.");
+          c->m_fsQuery->markAsFailed(stringb(
+            "The initial directory query reply had the wrong type: " <<
+            genericReply->messageType()));
         }
       }
+
       else {
-        c->m_fsQuery->markAsFailed(stringb(
-          "The initial directory query reply had the wrong type: " <<
-          genericReply->messageType()));
+        // Save the reply for the client who presents the right ID.
+        mapInsertUniqueMove(m_availableReplies,
+          requestID, std::move(genericReply));
+        arrived.push_back(requestID);
       }
     }
 
-    else {
-      // Save the reply for the client who presents the right ID.
-      mapInsertUniqueMove(m_availableReplies,
-        requestID, c->m_fsQuery->takeReply());
-
-      // Clear the ID member so we know no request is outstanding.
-      c->m_currentRequestID = 0;
+    // Send more requests, if there are any.
+    c->issueQueuedRequests();
 
-      // Notify clients.
-      Q_EMIT signal_vfsReplyAvailable(requestID);
+    // Notify clients.  This is done last since a receiver could shut
+    // down the connection, destroying `c`.
+    HostName hostName = c->m_hostName;
+    for (RequestID requestID : arrived) {
+      if (replyIsAvailable(requestID)) {
+        Q_EMIT signal_vfsReplyAvailable(requestID);
+      }
+    }
+    for (VFS_FileChangeNotification const &fcn : fileChanges) {
+      TRACE("VFS_Connections",
+        "  for host " << hostName << ", " << fcn.description());
+      Q_EMIT signal_vfsFileChanged(hostName, fcn.m_path,
+        fcn.m_fileKind, fcn.m_fileModificationTime);
     }
-
-    // Send the next request, if there is one.
-    c->issueQueuedRequest();
 
     return;
   }
@@ -590,7 +665,7 @@ void VFS_Connections::on_vfsFailureAvailable() NOEXCEPT
 
   if (Connection *c = signalRecipientConnection()) {
     string reason = c->m_fsQuery->getFailureReason();
-    c->m_currentRequestID = 0;
+    c->m_inFlightRequests.clear();
     xassert(connectionFailed(c->m_hostName));
 
     Q_EMIT signal_vfsFailed(c->m_hostName, reason);
@@ -9,19 +9,21 @@
 
 // editor
 #include "host-name.h"                 // HostName
-#include "vfs-msg.h"                   // VFS_Message
-#include "vfs-query-fwd.h"             // VFS_FileSystemQuery
+#include "vfs-compress.h"              // VFS_CompressionCodec
+#include "vfs-msg.h"                   // VFS_Message, VFS_WireID
+#include "vfs-query-fwd.h"             // VFS_FileSystemQuery, VFS_TransferStats
 
 // smbase
 #include "smbase/ordered-map-iface.h"  // smbase::OrderedMap
 #include "smbase/refct-serf.h"         // SerfRefCount
+#include "smbase/sm-file-util.h"       // SMFileUtil
 #include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
 
 // qt
 #include <QObject>
 
 // libc++
-#include <cstdint>                     // std::uint64_t
+#include <cstdint>                     // std::{int64_t, uint64_t}
 #include <list>                        // std::list
 #include <map>                         // std::map
 #include <memory>                      // std::unique_ptr
@@ -214,6 +216,13 @@ Q_SIGNALS:
 
   // Emitted when 'connectionFailed' becomes true.
   void signal_vfsFailed(HostName hostName, std::string reason);
+
+  // Emitted when the server for 'hostName' reports that 'path', which
+  // was watched with a VFS_WatchFileRequest, now has 'fileKind' and
+  // 'modificationTime'.  This is not associated with any request.
+  void signal_vfsFileChanged(HostName hostName, std::string path,
+                             SMFileUtil::FileKind fileKind,
+                             std::int64_t modificationTime);
 };
 
 
@@ -271,13 +280,15 @@ private:     // types
     // separators.
     std::string m_startingDirectory;
 
-    // ID of the request currently being serviced by 'm_fsQuery', or 0
-    // if none is.
-    RequestID m_currentRequestID;
+    // Map from the wire ID of each request that has been sent on
+    // 'm_fsQuery' but not answered, to the client's ID for it.  The
+    // client ID is 0 if the request was canceled while in flight, in
+    // which case the reply will be discarded.
+    std::map<VFS_WireID, RequestID> m_inFlightRequests;
 
-    // Sequence of queued requests to send.  VFS_FileSystemQuery only
-    // allows one request at a time, so while a request is in flight,
-    // additional requests are queued here.
+    // Sequence of queued requests to send.  At most
+    // 'maxRequestsInFlight()' requests are sent at once, and the rest
+    // wait here.
     std::list<QueuedRequest> m_queuedRequests;
 
   public:      // methods
@@ -301,9 +312,14 @@ private:     // types
     // True if 'requestID' has not received its reply.
     bool requestIsOutstanding(RequestID requestID) const;
 
-    // If 'm_fsQuery' is ready, and there are queued requests, send the
-    // next one.
-    void issueQueuedRequest();
+    // Number of requests that may be in flight at once.  Until the
+    // starting directory is known, this is 1, since the first reply is
+    // interpreted specially.
+    int maxRequestsInFlight() const;
+
+    // If 'm_fsQuery' is ready, and there are queued requests, send as
+    // many as 'maxRequestsInFlight()' allows.
+    void issueQueuedRequests();
 
     // Cancel issuing and/or delivering reply for 'requestID'.  Return
     // true if the ID was found and canceled.
@@ -377,6 +393,17 @@ public:      // methods
   // Requires: isOrWasConnected(hostName)
   std::string getStartingDirectory(HostName const &hostName) const;
 
+  // Codec negotiated for the connection to `hostName`, which is
+  // `VFS_CC_NONE` while connecting.
+  //
+  // Requires: isValid(hostName)
+  VFS_CompressionCodec connectionCodec(HostName const &hostName) const;
+
+  // Traffic totals for the connection to `hostName`.
+  //
+  // Requires: isValid(hostName)
+  VFS_TransferStats transferStats(HostName const &hostName) const;
+
   // Shut down connection to 'hostName' and remove it from the set of
   // valid hosts.
   //
@@ -3,12 +3,33 @@
 
 #include "vfs-local.h"                           // this module
 
+#include "content-digest.h"                      // TextContentDigester
+
 // smbase
-#include "smbase/exc.h"                          // smbase::XBase
+#include "smbase/exc.h"                          // smbase::{XBase, xformatsb}
 #include "smbase/nonport.h"                      // getFileModificationTime
 #include "smbase/portable-error-code.h"          // smbase::PortableErrorCode
 #include "smbase/sm-file-util.h"                 // SMFileUtil
-#include "smbase/syserr.h"                       // smbase::XSysError
+#include "smbase/string-util.h"                  // beginsWith
+#include "smbase/syserr.h"                       // smbase::{XSysError, xsyserror}
+
+// libc++
+#include <algorithm>                             // std::{min, sort, unique, lower_bound}
+#include <memory>                                // std::unique_ptr
+#include <vector>                                // std::vector
+
+// libc
+#include <stdio.h>                               // FILE, fopen, fdopen, fread, fwrite, fseeko, ftello, remove
+#include <stdlib.h>                              // realpath, mkstemp, free
+#include <string.h>                              // memchr
+
+#ifndef __WIN32__
+#  include <sys/stat.h>                          // stat, fstat, fchmod, umask
+#  include <unistd.h>                            // fchown, close
+#endif
+#ifdef __linux__
+#  include <sys/xattr.h>                         // getxattr
+#endif
 
 using namespace smbase;
 
@@ -146,4 +167,456 @@ VFS_MakeDirectoryReply VFS_LocalImpl::makeDirectory(
 }
 
 
+// Owner of an open `FILE`.
+typedef std::unique_ptr<FILE, int(*)(FILE*)> FILEOwner;
+
+
+// Open `path` with `mode`, throwing `XSysError` on failure.
+static FILEOwner openFile(string const &path, char const *mode)
+{
+  FILEOwner fp(fopen(path.c_str(), mode), &fclose);
+  if (!fp) {
+    xsyserror("open", path);
+  }
+  return fp;
+}
+
+
+// Seek `fp` to absolute `offset`, or to the end if `offset` is
+// negative, and return the resulting position.
+static int64_t seekFile(FILE *fp, int64_t offset, string const &path)
+{
+  int whence = (offset < 0)? SEEK_END : SEEK_SET;
+  if (offset < 0) {
+    offset = 0;
+  }
+
+#ifdef __WIN32__
+  if (_fseeki64(fp, offset, whence) != 0) {
+    xsyserror("seek", path);
+  }
+  return _ftelli64(fp);
+#else
+  if (fseeko(fp, (off_t)offset, whence) != 0) {
+    xsyserror("seek", path);
+  }
+  return (int64_t)ftello(fp);
+#endif
+}
+
+
+VFS_ReadFileRangeReply VFS_LocalImpl::readFileRange(
+  VFS_ReadFileRangeRequest const &req)
+{
+  SMFileUtil sfu;
+
+  VFS_ReadFileRangeReply reply;
+  reply.m_offset = req.m_offset;
+
+  try {
+    if (req.m_offset < 0 || req.m_maxLength < 0) {
+      xformatsb("Invalid range: offset=" << req.m_offset <<
+                " maxLength=" << req.m_maxLength);
+    }
+
+    FILEOwner fp(openFile(req.m_path, "rb"));
+    reply.m_fileSize = seekFile(fp.get(), -1 /*end*/, req.m_path);
+
+    if (req.m_offset < reply.m_fileSize) {
+      int64_t len = std::min(req.m_maxLength, VFS_maxRangeLength);
+      len = std::min(len, reply.m_fileSize - req.m_offset);
+
+      // Read directly into the reply rather than an intermediate.
+      seekFile(fp.get(), req.m_offset, req.m_path);
+      reply.m_contents.resize((size_t)len);
+      size_t res = fread(reply.m_contents.data(), 1, (size_t)len, fp.get());
+      if (ferror(fp.get())) {
+        xsyserror("read", req.m_path);
+      }
+
+      // The file may have been truncated since we got its size.
+      reply.m_contents.resize(res);
+    }
+
+    (void)getFileModificationTime(req.m_path.c_str(),
+                                  reply.m_fileModificationTime);
+
+    reply.m_readOnly = sfu.isReadOnly(req.m_path);
+  }
+  PATH_REQUEST_CATCH_BLOCK
+
+  return reply;
+}
+
+
+// Size of the buffer that `fileAbsentOrHasDigest` reads through.
+static size_t const DIGEST_READ_BUFFER_SIZE = 0x10000;   // 64 KiB
+
+
+// True if `path` does not exist or its contents have `digest`.  The
+// file is read in fixed-size pieces rather than loaded whole, since
+// this happens on every save.
+static bool fileAbsentOrHasDigest(string const &path, uint64_t digest)
+{
+  SMFileUtil sfu;
+  if (!sfu.pathExists(path)) {
+    return true;
+  }
+
+  FILEOwner fp(openFile(path, "rb"));
+  TextContentDigester digester;
+  std::vector<char> buf(DIGEST_READ_BUFFER_SIZE);
+  while (true) {
+    size_t len = fread(buf.data(), 1, buf.size(), fp.get());
+    if (len == 0) {
+      if (ferror(fp.get())) {
+        xsyserror("read", path);
+      }
+      break;
+    }
+    digester.add(buf.data(), len);
+  }
+
+  return digester.digest() == digest;
+}
+
+
+// Path of the file that writing `path` replaces: `path` with symbolic
+// links resolved if it exists, and otherwise `path` itself.  Renaming
+// over a symbolic link would replace the link rather than the file.
+static string resolveWriteTarget(string const &path)
+{
+#ifndef __WIN32__
+  if (char *resolved = realpath(path.c_str(), nullptr)) {
+    string ret(resolved);
+    free(resolved);
+    return ret;
+  }
+#endif
+  return path;
+}
+
+
+// Create a new temporary file whose path begins with `prefix`, set
+// `tempPath` to that path, and return it open for writing.  Each call
+// makes a different file, so concurrent transfers do not collide.
+static FILEOwner createTempFile(string const &prefix,
+                                string &tempPath /*OUT*/)
+{
+#ifndef __WIN32__
+  string templ = prefix + "XXXXXX";
+  int fd = mkstemp(&templ[0]);
+  if (fd < 0) {
+    xsyserror("mkstemp", templ);
+  }
+  tempPath = templ;
+
+  FILEOwner fp(fdopen(fd, "wb"), &fclose);
+  if (!fp) {
+    close(fd);
+    xsyserror("fdopen", tempPath);
+  }
+  return fp;
+#else
+  tempPath = prefix + "0";
+  return openFile(tempPath, "wb");
+#endif
+}
+
+
+// Give the temporary file open as `fd` the attributes `target` has,
+// so renaming it over `target` changes only the contents.  Return
+// false if that is not possible, in which case `target` should be
+// overwritten in place instead: it has other hard links, which a
+// rename would separate from it, or an access control list, or an
+// owner or group that we cannot give to a new file.
+static bool prepareToReplace(int fd, string const &tempPath,
+                             string const &target)
+{
+#ifndef __WIN32__
+  struct stat targetStat;
+  if (stat(target.c_str(), &targetStat) != 0) {
+    // New file.  `mkstemp` made the temporary file private, so give it
+    // the permissions a newly created file would have.  Writes are
+    // processed one at a time, so briefly changing the mask does not
+    // affect any other file creation.
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fchmod(fd, 0666 & ~mask) != 0) {
+      xsyserror("chmod", tempPath);
+    }
+    return true;
+  }
+
+  if (targetStat.st_nlink > 1) {
+    return false;
+  }
+
+#ifdef __linux__
+  if (getxattr(target.c_str(), "system.posix_acl_access", nullptr, 0) > 0) {
+    return false;
+  }
+#endif
+
+  struct stat tempStat;
+  if (fstat(fd, &tempStat) != 0) {
+    xsyserror("stat", tempPath);
+  }
+  if ((tempStat.st_uid != targetStat.st_uid ||
+       tempStat.st_gid != targetStat.st_gid) &&
+      fchown(fd, targetStat.st_uid, targetStat.st_gid) != 0) {
+    return false;
+  }
+
+  // After `fchown`, which can clear the set-ID bits.
+  if (fchmod(fd, targetStat.st_mode & 07777) != 0) {
+    xsyserror("chmod", tempPath);
+  }
+#endif
+  return true;
+}
+
+
+// Size of the buffer that `copyFileContents` copies through.
+static size_t const FILE_COPY_BUFFER_SIZE = 0x10000;     // 64 KiB
+
+
+// Overwrite the contents of `dest`, keeping the file itself, with
+// those of `src`.
+static void copyFileContents(string const &src, string const &dest)
+{
+  FILEOwner in(openFile(src, "rb"));
+  FILEOwner out(openFile(dest, "wb"));
+
+  std::vector<char> buf(FILE_COPY_BUFFER_SIZE);
+  while (true) {
+    size_t len = fread(buf.data(), 1, buf.size(), in.get());
+    if (len == 0) {
+      if (ferror(in.get())) {
+        xsyserror("read", src);
+      }
+      break;
+    }
+    if (fwrite(buf.data(), 1, len, out.get()) != len) {
+      xsyserror("write", dest);
+    }
+  }
+
+  if (fclose(out.release()) != 0) {
+    xsyserror("close", dest);
+  }
+}
+
+
+VFS_WriteFileRangeReply VFS_LocalImpl::writeFileRange(
+  VFS_WriteFileRangeRequest const &req)
+{
+  SMFileUtil sfu;
+
+  VFS_WriteFileRangeReply reply;
+
+  // The ranges accumulate in `tempPath`, and the target is only
+  // replaced once the last one has been written.
+  string const target(resolveWriteTarget(req.m_path));
+  string const tempPrefix(VFS_rangeWriteTempPrefix(target));
+  string tempPath;
+
+  try {
+    FILEOwner fp(nullptr, &fclose);
+
+    if (req.m_offset == 0) {
+      // Check before starting to replace it.
+      if (req.m_checkDigest &&
+          !fileAbsentOrHasDigest(target, req.m_expectedDigest)) {
+        reply.m_digestMismatch = true;
+        xformatsb("The file has changed since it was last read or "
+                  "written.");
+      }
+
+      // Renaming over the target does not require permission to write
+      // it, so check that it could be written in place.
+      if (sfu.pathExists(target)) {
+        (void)openFile(target, "r+b");
+      }
+
+      fp = createTempFile(tempPrefix, tempPath);
+    }
+    else {
+      // Only continue with a temporary file made for this target, so
+      // a request cannot rename some other file over it.
+      if (!beginsWith(req.m_tempPath, tempPrefix) ||
+          req.m_tempPath.find('/', tempPrefix.size()) != string::npos) {
+        xformatsb("Invalid temporary file \"" << req.m_tempPath <<
+                  "\" for \"" << target << "\".");
+      }
+      tempPath = req.m_tempPath;
+      fp = openFile(tempPath, "r+b");
+
+      // Do not allow a write to leave a hole.
+      int64_t fileSize = seekFile(fp.get(), -1 /*end*/, tempPath);
+      if (req.m_offset < 0 || req.m_offset > fileSize) {
+        xformatsb("Invalid offset " << req.m_offset <<
+                  " for file of size " << fileSize);
+      }
+      seekFile(fp.get(), req.m_offset, tempPath);
+    }
+    reply.m_tempPath = tempPath;
+
+    size_t len = req.m_contents.size();
+    if (fwrite(req.m_contents.data(), 1, len, fp.get()) != len) {
+      xsyserror("write", tempPath);
+    }
+    if (fflush(fp.get()) != 0) {
+      xsyserror("write", tempPath);
+    }
+
+    bool inPlace = false;
+    if (req.m_lastRange) {
+      inPlace = !prepareToReplace(fileno(fp.get()), tempPath, target);
+    }
+
+    // Close before renaming and getting the time, so the data is
+    // flushed and the time reflects the write.
+    if (fclose(fp.release()) != 0) {
+      xsyserror("close", tempPath);
+    }
+
+    if (req.m_lastRange) {
+      if (inPlace) {
+        copyFileContents(tempPath, target);
+        (void)remove(tempPath.c_str());
+      }
+      else {
+        sfu.atomicallyRenameFile(tempPath, target);
+      }
+    }
+
+    (void)getFileModificationTime(
+      (req.m_lastRange? target : tempPath).c_str(),
+      reply.m_fileModificationTime);
+  }
+  PATH_REQUEST_CATCH_BLOCK
+
+  if (!reply.m_success && !tempPath.empty()) {
+    // The transfer cannot continue, so do not leave the partial
+    // contents behind.
+    (void)remove(tempPath.c_str());
+  }
+
+  return reply;
+}
+
+
+// Size of the buffer that `scanFileLines` reads through.
+static size_t const LINE_SCAN_BUFFER_SIZE = 0x10000;     // 64 KiB
+
+
+// Read from `fp` the lines that `req` asks for, putting them into
+// `reply`.  This reads the file in fixed-size pieces, only keeping the
+// bytes of requested lines, and stops after the last requested line.
+static void scanFileLines(
+  FILE *fp,
+  VFS_ReadFileLinesRequest::FileLines const &req,
+  VFS_ReadFileLinesReply::FileLines &reply)
+{
+  // Requested indices in increasing order, without duplicates.
+  std::vector<int32_t> wanted(req.m_lineIndices);
+  std::sort(wanted.begin(), wanted.end());
+  wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+  if (!wanted.empty() && wanted.front() < 0) {
+    xformatsb("Invalid line index: " << wanted.front());
+  }
+
+  // Text of each line in `wanted`.
+  std::vector<string> found(wanted.size());
+
+  // Element of `wanted` we are looking for next.
+  size_t next = 0;
+
+  // Index of the line containing the next byte to scan.
+  int32_t line = 0;
+
+  std::vector<char> buf(LINE_SCAN_BUFFER_SIZE);
+  while (next < wanted.size()) {
+    size_t len = fread(buf.data(), 1, buf.size(), fp);
+    if (len == 0) {
+      if (ferror(fp)) {
+        xsyserror("read", req.m_path);
+      }
+      break;
+    }
+
+    char const *p = buf.data();
+    char const *end = p + len;
+    while (p < end && next < wanted.size()) {
+      char const *nl = static_cast<char const *>(memchr(p, '\n', end-p));
+      char const *segEnd = nl? nl : end;
+
+      if (line == wanted[next]) {
+        found[next].append(p, segEnd - p);
+      }
+
+      if (!nl) {
+        // The line continues in the next piece.
+        break;
+      }
+
+      if (line == wanted[next]) {
+        ++next;
+      }
+      ++line;
+      p = nl+1;
+    }
+  }
+
+  if (next < wanted.size()) {
+    // We reached the end of the file, so `line` is the last line.
+    if (wanted[next] == line) {
+      ++next;
+    }
+    if (next < wanted.size()) {
+      // The remaining requested lines do not exist.
+      reply.m_numLines = line + 1;
+    }
+  }
+
+  // Answer in the order of the request.
+  reply.m_lines.reserve(req.m_lineIndices.size());
+  for (int32_t index : req.m_lineIndices) {
+    auto it = std::lower_bound(wanted.begin(), wanted.end(), index);
+    reply.m_lines.push_back(found[it - wanted.begin()]);
+  }
+}
+
+
+// Read the lines that `req` asks for from one file.
+static VFS_ReadFileLinesReply::FileLines readLinesOfOneFile(
+  VFS_ReadFileLinesRequest::FileLines const &req)
+{
+  VFS_ReadFileLinesReply::FileLines reply;
+
+  try {
+    FILEOwner fp(openFile(req.m_path, "rb"));
+    scanFileLines(fp.get(), req, reply);
+  }
+  PATH_REQUEST_CATCH_BLOCK
+
+  return reply;
+}
+
+
+VFS_ReadFileLinesReply VFS_LocalImpl::readFileLines(
+  VFS_ReadFileLinesRequest const &req)
+{
+  VFS_ReadFileLinesReply reply;
+
+  reply.m_files.reserve(req.m_files.size());
+  for (VFS_ReadFileLinesRequest::FileLines const &fileReq : req.m_files) {
+    reply.m_files.push_back(readLinesOfOneFile(fileReq));
+  }
+
+  return reply;
+}
+
+
 // EOF
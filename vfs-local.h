@@ -13,7 +13,9 @@
 
 // Local implementation of virtual file system.
 //
-// This class synchronously turns requests into replies.
+// This class synchronously turns requests into replies.  It has no
+// state, so its methods can be called concurrently from multiple
+// threads.
 class VFS_LocalImpl {
 public:      // methods
   VFS_FileStatusReply    queryPath    (VFS_FileStatusRequest    const &req);
@@ -22,6 +24,11 @@ public:      // methods
   VFS_DeleteFileReply    deleteFile   (VFS_DeleteFileRequest    const &req);
   VFS_GetDirEntriesReply getDirEntries(VFS_GetDirEntriesRequest const &req);
   VFS_MakeDirectoryReply makeDirectory(VFS_MakeDirectoryRequest const &req);
+
+  VFS_ReadFileRangeReply  readFileRange (VFS_ReadFileRangeRequest  const &req);
+  VFS_WriteFileRangeReply writeFileRange(VFS_WriteFileRangeRequest const &req);
+
+  VFS_ReadFileLinesReply  readFileLines (VFS_ReadFileLinesRequest  const &req);
 };
 
 
@@ -27,6 +27,17 @@ class VFS_PathReply;
   macro(GetDirEntriesReply)              \
   macro(MakeDirectoryRequest)            \
   macro(MakeDirectoryReply)              \
+  macro(ReadFileRangeRequest)            \
+  macro(ReadFileRangeReply)              \
+  macro(WriteFileRangeRequest)           \
+  macro(WriteFileRangeReply)             \
+  macro(ReadFileLinesRequest)            \
+  macro(ReadFileLinesReply)              \
+  macro(WatchFileRequest)                \
+  macro(WatchFileReply)                  \
+  macro(UnwatchFileRequest)              \
+  macro(UnwatchFileReply)                \
+  macro(FileChangeNotification)          \
   /*nothing*/
 
 #define FORWARD_DECLARE_VFS_CLASS(type) class VFS_##type;
@@ -3,6 +3,9 @@
 
 #include "vfs-msg.h"                   // this module
 
+// editor
+#include "vfs-compress.h"              // VFS_CC_NONE
+
 // smbase
 #include "smbase/exc.h"                // xformatdb, smbase::XSysError
 #include "smbase/flatutil.h"           // xferEnum, Flatten, xferVectorBytewise
@@ -10,6 +13,21 @@
 using namespace smbase;
 
 
+// Transfer the number of elements in `vec`, resizing it when reading.
+template <class T>
+static void xferVectorLength(Flatten &flat, std::vector<T> &vec)
+{
+  int32_t len = (int32_t)vec.size();
+  flat.xfer_int32_t(len);
+  if (flat.reading()) {
+    if (len < 0) {
+      xformatsb("Invalid vector length: " << len);
+    }
+    vec.resize((size_t)len);
+  }
+}
+
+
 #define STRINGIZE_VFS_MT(type) #type,
 
 DEFINE_ENUMERATION_TO_STRING(VFS_MessageType, NUM_VFS_MESSAGE_TYPES,
@@ -18,6 +36,12 @@ DEFINE_ENUMERATION_TO_STRING(VFS_MessageType, NUM_VFS_MESSAGE_TYPES,
 #undef STRINGIZE_VFS_MT
 
 
+string VFS_rangeWriteTempPrefix(string const &path)
+{
+  return path + ".vfs-partial.";
+}
+
+
 // --------------------------- VFS_Message -----------------------------
 VFS_Message::VFS_Message()
 {}
@@ -53,7 +77,7 @@ void VFS_Message::serialize(Flatten &flat) const
 {
   xassert(flat.reading());
 
-  static_assert(NUM_VFS_MESSAGE_TYPES == 14,
+  static_assert(NUM_VFS_MESSAGE_TYPES == 25,
     "Bump protocol version when number of message types changes.");
 
   // Read message type.
@@ -109,7 +133,8 @@ FOR_EACH_VFS_MESSAGE_TYPE(VFS_DEFINE_DOWNCASTS)
 // ------------------------- VFS_GetVersion ----------------------------
 VFS_GetVersion::VFS_GetVersion()
   : VFS_Message(),
-    m_version(VFS_currentVersion)
+    m_version(VFS_currentVersion),
+    m_compressionCodec(VFS_CC_NONE)
 {}
 
 
@@ -120,6 +145,7 @@ VFS_GetVersion::~VFS_GetVersion()
 void VFS_GetVersion::xfer(Flatten &flat)
 {
   flat.xfer_int32_t(m_version);
+  flat.xfer_int32_t(m_compressionCodec);
 }
 
 
@@ -327,7 +353,9 @@ void VFS_WriteFileRequest::xfer(Flatten &flat)
 // ------------------------ VFS_WriteFileReply -------------------------
 VFS_WriteFileReply::VFS_WriteFileReply()
   : VFS_PathReply(),
-    m_fileModificationTime(0)
+    m_fileModificationTime(0),
+    m_digestMismatch(false),
+    m_tempPath()
 {}
 
 
@@ -340,6 +368,8 @@ void VFS_WriteFileReply::xfer(Flatten &flat)
   VFS_PathReply::xfer(flat);
 
   flat.xfer_int64_t(m_fileModificationTime);
+  flat.xferBool(m_digestMismatch);
+  stringXfer(m_tempPath, flat);
 }
 
 
@@ -423,4 +453,353 @@ VFS_MakeDirectoryReply::~VFS_MakeDirectoryReply()
 {}
 
 
+// --------------------- VFS_ReadFileRangeRequest ----------------------
+VFS_ReadFileRangeRequest::VFS_ReadFileRangeRequest()
+  : VFS_PathRequest(),
+    m_offset(0),
+    m_maxLength(0)
+{}
+
+
+VFS_ReadFileRangeRequest::~VFS_ReadFileRangeRequest()
+{}
+
+
+string VFS_ReadFileRangeRequest::description() const
+{
+  return stringb(VFS_PathRequest::description() <<
+                 " at " << m_offset);
+}
+
+
+void VFS_ReadFileRangeRequest::xfer(Flatten &flat)
+{
+  VFS_PathRequest::xfer(flat);
+
+  flat.xfer_int64_t(m_offset);
+  flat.xfer_int64_t(m_maxLength);
+}
+
+
+// ---------------------- VFS_ReadFileRangeReply -----------------------
+VFS_ReadFileRangeReply::VFS_ReadFileRangeReply()
+  : VFS_PathReply(),
+    m_offset(0),
+    m_contents(),
+    m_fileSize(0),
+    m_fileModificationTime(0),
+    m_readOnly(false)
+{}
+
+
+VFS_ReadFileRangeReply::~VFS_ReadFileRangeReply()
+{}
+
+
+string VFS_ReadFileRangeReply::description() const
+{
+  std::ostringstream sb;
+  sb << VFS_PathReply::description()
+     << " offset=" << m_offset
+     << " size=" << m_contents.size()
+     << " fileSize=" << m_fileSize
+     << " modTime=" << m_fileModificationTime
+     << " readOnly=" << m_readOnly;
+  return sb.str();
+}
+
+
+void VFS_ReadFileRangeReply::xfer(Flatten &flat)
+{
+  VFS_PathReply::xfer(flat);
+
+  flat.xfer_int64_t(m_offset);
+  xferVectorBytewise(flat, m_contents);
+  flat.xfer_int64_t(m_fileSize);
+  flat.xfer_int64_t(m_fileModificationTime);
+  flat.xferBool(m_readOnly);
+}
+
+
+// --------------------- VFS_WriteFileRangeRequest ---------------------
+VFS_WriteFileRangeRequest::VFS_WriteFileRangeRequest()
+  : VFS_PathRequest(),
+    m_offset(0),
+    m_contents(),
+    m_tempPath(),
+    m_checkDigest(false),
+    m_expectedDigest(0),
+    m_lastRange(false)
+{}
+
+
+VFS_WriteFileRangeRequest::~VFS_WriteFileRangeRequest()
+{}
+
+
+string VFS_WriteFileRangeRequest::description() const
+{
+  std::ostringstream sb;
+  sb << VFS_PathRequest::description() << " at " << m_offset;
+  if (m_offset != 0) {
+    sb << " tempPath=\"" << m_tempPath << "\"";
+  }
+  if (m_checkDigest) {
+    sb << " expectedDigest=" << m_expectedDigest;
+  }
+  if (m_lastRange) {
+    sb << " last";
+  }
+  return sb.str();
+}
+
+
+void VFS_WriteFileRangeRequest::xfer(Flatten &flat)
+{
+  VFS_PathRequest::xfer(flat);
+
+  flat.xfer_int64_t(m_offset);
+  xferVectorBytewise(flat, m_contents);
+  stringXfer(m_tempPath, flat);
+  flat.xferBool(m_checkDigest);
+
+  // The flattener has no unsigned 64-bit transfer, but the bits are
+  // the same.
+  int64_t digest = static_cast<int64_t>(m_expectedDigest);
+  flat.xfer_int64_t(digest);
+  m_expectedDigest = static_cast<uint64_t>(digest);
+
+  flat.xferBool(m_lastRange);
+}
+
+
+// ---------------------- VFS_WriteFileRangeReply ----------------------
+VFS_WriteFileRangeReply::VFS_WriteFileRangeReply()
+  : VFS_PathReply(),
+    m_fileModificationTime(0),
+    m_digestMismatch(false)
+{}
+
+
+VFS_WriteFileRangeReply::~VFS_WriteFileRangeReply()
+{}
+
+
+void VFS_WriteFileRangeReply::xfer(Flatten &flat)
+{
+  VFS_PathReply::xfer(flat);
+
+  flat.xfer_int64_t(m_fileModificationTime);
+  flat.xferBool(m_digestMismatch);
+}
+
+
+// -------------------- VFS_ReadFileLinesRequest -----------------------
+VFS_ReadFileLinesRequest::FileLines::FileLines()
+  : m_path(),
+    m_lineIndices()
+{}
+
+
+VFS_ReadFileLinesRequest::FileLines::~FileLines()
+{}
+
+
+void VFS_ReadFileLinesRequest::FileLines::xfer(Flatten &flat)
+{
+  stringXfer(m_path, flat);
+
+  xferVectorLength(flat, m_lineIndices);
+  for (int32_t &index : m_lineIndices) {
+    flat.xfer_int32_t(index);
+  }
+}
+
+
+VFS_ReadFileLinesRequest::VFS_ReadFileLinesRequest()
+  : VFS_Message(),
+    m_files()
+{}
+
+
+VFS_ReadFileLinesRequest::~VFS_ReadFileLinesRequest()
+{}
+
+
+string VFS_ReadFileLinesRequest::description() const
+{
+  return stringb(toString(messageType()) <<
+                 " for " << m_files.size() << " files");
+}
+
+
+void VFS_ReadFileLinesRequest::xfer(Flatten &flat)
+{
+  xferVectorLength(flat, m_files);
+  for (FileLines &fl : m_files) {
+    fl.xfer(flat);
+  }
+}
+
+
+// --------------------- VFS_ReadFileLinesReply ------------------------
+VFS_ReadFileLinesReply::FileLines::FileLines()
+  : m_success(true),
+    m_failureReasonCode(PortableErrorCode::PEC_NO_ERROR),
+    m_failureReasonString(),
+    m_lines(),
+    m_numLines(-1)
+{}
+
+
+VFS_ReadFileLinesReply::FileLines::~FileLines()
+{}
+
+
+void VFS_ReadFileLinesReply::FileLines::setFailureReason(
+  PortableErrorCode reasonCode, string const &reasonString)
+{
+  m_success = false;
+  m_failureReasonCode = reasonCode;
+  m_failureReasonString = reasonString;
+}
+
+
+void VFS_ReadFileLinesReply::FileLines::xfer(Flatten &flat)
+{
+  flat.xferBool(m_success);
+  xferEnum(flat, m_failureReasonCode);
+  stringXfer(m_failureReasonString, flat);
+
+  xferVectorLength(flat, m_lines);
+  for (string &line : m_lines) {
+    stringXfer(line, flat);
+  }
+
+  flat.xfer_int32_t(m_numLines);
+}
+
+
+VFS_ReadFileLinesReply::VFS_ReadFileLinesReply()
+  : VFS_Message(),
+    m_files()
+{}
+
+
+VFS_ReadFileLinesReply::~VFS_ReadFileLinesReply()
+{}
+
+
+string VFS_ReadFileLinesReply::description() const
+{
+  int failures = 0;
+  for (FileLines const &fl : m_files) {
+    if (!fl.m_success) {
+      ++failures;
+    }
+  }
+  return stringb(toString(messageType()) << ": " <<
+                 m_files.size() << " files, " <<
+                 failures << " failures");
+}
+
+
+void VFS_ReadFileLinesReply::xfer(Flatten &flat)
+{
+  xferVectorLength(flat, m_files);
+  for (FileLines &fl : m_files) {
+    fl.xfer(flat);
+  }
+}
+
+
+// ---------------------- VFS_WatchFileRequest -------------------------
+VFS_WatchFileRequest::VFS_WatchFileRequest()
+  : VFS_PathRequest()
+{}
+
+
+VFS_WatchFileRequest::~VFS_WatchFileRequest()
+{}
+
+
+// ----------------------- VFS_WatchFileReply --------------------------
+VFS_WatchFileReply::VFS_WatchFileReply()
+  : VFS_PathReply(),
+    m_fileKind(SMFileUtil::FK_NONE),
+    m_fileModificationTime(0)
+{}
+
+
+VFS_WatchFileReply::~VFS_WatchFileReply()
+{}
+
+
+string VFS_WatchFileReply::description() const
+{
+  return stringb(VFS_PathReply::description() <<
+                 " fileKind=" << toString(m_fileKind) <<
+                 " modTime=" << m_fileModificationTime);
+}
+
+
+void VFS_WatchFileReply::xfer(Flatten &flat)
+{
+  VFS_PathReply::xfer(flat);
+
+  xferEnum(flat, m_fileKind);
+  flat.xfer_int64_t(m_fileModificationTime);
+}
+
+
+// --------------------- VFS_UnwatchFileRequest ------------------------
+VFS_UnwatchFileRequest::VFS_UnwatchFileRequest()
+  : VFS_PathRequest()
+{}
+
+
+VFS_UnwatchFileRequest::~VFS_UnwatchFileRequest()
+{}
+
+
+// ---------------------- VFS_UnwatchFileReply -------------------------
+VFS_UnwatchFileReply::VFS_UnwatchFileReply()
+  : VFS_PathReply()
+{}
+
+
+VFS_UnwatchFileReply::~VFS_UnwatchFileReply()
+{}
+
+
+// ------------------- VFS_FileChangeNotification ----------------------
+VFS_FileChangeNotification::VFS_FileChangeNotification()
+  : VFS_Message(),
+    m_path(),
+    m_fileKind(SMFileUtil::FK_NONE),
+    m_fileModificationTime(0)
+{}
+
+
+VFS_FileChangeNotification::~VFS_FileChangeNotification()
+{}
+
+
+string VFS_FileChangeNotification::description() const
+{
+  return stringb(toString(messageType()) <<
+                 " for \"" << m_path << "\"" <<
+                 " fileKind=" << toString(m_fileKind) <<
+                 " modTime=" << m_fileModificationTime);
+}
+
+
+void VFS_FileChangeNotification::xfer(Flatten &flat)
+{
+  stringXfer(m_path, flat);
+  xferEnum(flat, m_fileKind);
+  flat.xfer_int64_t(m_fileModificationTime);
+}
+
+
 // EOF
@@ -20,7 +20,7 @@
 #include <vector>                                // std::vector
 
 // libc
-#include <stdint.h>                              // int64_t, int32_t
+#include <stdint.h>                              // int64_t, int32_t, uint32_t, uint64_t
 
 
 // Protocol version described in this file.
@@ -39,8 +39,45 @@
 //    5: Add VFS_PathReply::m_failureReasonCode.
 //    6: Modify set of PortableErrorCodes.
 //    7: Add MakeDirectory{Request,Reply}.
+//    8: Add {Read,Write}FileRange{Request,Reply}.
+//    9: Add VFS_GetVersion::m_compressionCodec, and after the version
+//       exchange, prefix every message body with a codec byte.
+//   10: After the version exchange, prefix every message with a
+//       VFS_WireID, and allow replies to arrive out of order.
+//   11: Add ReadFileLines{Request,Reply}.
+//   12: Add {Watch,Unwatch}File{Request,Reply} and
+//       FileChangeNotification, the first message the server sends
+//       without a request.
+//   13: Add VFS_WriteFileRangeRequest::m_{check,expected}Digest and
+//       VFS_WriteFile{,Range}Reply::m_digestMismatch.
+//   14: Add VFS_WriteFileRangeRequest::m_lastRange, and write ranges
+//       to a temporary file that replaces the target at the end.
+//   15: Add VFS_WriteFileRange{Request,Reply}::m_tempPath, and give
+//       each transfer its own uniquely named temporary file.
 //
-int32_t const VFS_currentVersion = 7;
+int32_t const VFS_currentVersion = 15;
+
+
+// Identifier that associates a reply with its request on the wire.  The
+// client chooses it and the server copies it into the reply.  Never
+// zero for a valid request.
+typedef uint32_t VFS_WireID;
+
+// Wire ID carried by messages the server sends on its own initiative,
+// which do not answer any request.
+VFS_WireID const VFS_notificationWireID = 0;
+
+
+// Maximum number of bytes the server will transfer in one
+// `VFS_ReadFileRangeReply`.  Larger requests are truncated to this.
+int64_t const VFS_maxRangeLength = 0x1000000;    // 16 MiB
+
+// Prefix of the path of each temporary file to which the server
+// writes the ranges of `VFS_WriteFileRangeRequest`s for `path` until
+// the last one arrives.  The server appends characters to make the
+// path unique.  `path` should have symbolic links resolved, so the
+// temporary file is in the same directory as the file it replaces.
+string VFS_rangeWriteTempPrefix(string const &path);
 
 
 // Possible kinds of VFS messages.
@@ -104,6 +141,17 @@ public:
   // the reply, it is what the server understands.
   int32_t m_version;
 
+  // In the request, the best `VFS_CompressionCodec` the client would
+  // like to use.  In the reply, the codec the server chose, which is
+  // never better than what was requested.  All subsequent messages in
+  // both directions use the envelope of `vfsEncodeMessageBody` with
+  // this codec.
+  //
+  // This is an `int32_t` rather than the enumeration so that an
+  // unknown value can be received and then clamped by
+  // `vfsNegotiateCodec`.
+  int32_t m_compressionCodec;
+
 public:
   VFS_GetVersion();
   virtual ~VFS_GetVersion() override;
@@ -288,6 +336,10 @@ public:      // data
   // the file's contents.
   int64_t m_fileModificationTime;
 
+  // True if the write failed because the existing file did not have
+  // the expected digest.  See `VFS_WriteFileRangeRequest`.
+  bool m_digestMismatch;
+
 public:      // methods
   VFS_WriteFileReply();
   virtual ~VFS_WriteFileReply() override;
@@ -380,4 +432,337 @@ public:      // methods
 };
 
 
+// Request to read part of the contents of a file.
+//
+// Reading a large file as a sequence of ranges allows other requests
+// on the same connection to be serviced in between, and allows the
+// client to report progress.
+class VFS_ReadFileRangeRequest : public VFS_PathRequest {
+public:      // data
+  // Offset of the first byte to read.  Must be non-negative.
+  int64_t m_offset;
+
+  // Maximum number of bytes to read.  Must be non-negative.  The
+  // server caps this at `VFS_maxRangeLength`.
+  int64_t m_maxLength;
+
+public:      // methods
+  VFS_ReadFileRangeRequest();
+  virtual ~VFS_ReadFileRangeRequest() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_ReadFileRangeRequest; }
+  virtual string description() const override;
+  virtual void xfer(Flatten &flat) override;
+};
+
+
+// Reply with part of the contents of a file.
+class VFS_ReadFileRangeReply : public VFS_PathReply {
+public:      // data
+  // Offset of the first byte in `m_contents`, as requested.
+  int64_t m_offset;
+
+  // Bytes read.  This is shorter than requested only if the end of the
+  // file was reached.
+  std::vector<unsigned char> m_contents;
+
+  // Size of the entire file at the time of the read.  The client can
+  // compare this and `m_fileModificationTime` across replies to detect
+  // the file changing during a multi-range read.
+  int64_t m_fileSize;
+
+  // Modification time as reported by the file system.
+  int64_t m_fileModificationTime;
+
+  // True if the file is marked read-only.
+  bool m_readOnly;
+
+public:      // methods
+  VFS_ReadFileRangeReply();
+  virtual ~VFS_ReadFileRangeReply() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_ReadFileRangeReply; }
+  virtual string description() const override;
+  virtual void xfer(Flatten &flat) override;
+};
+
+
+// Request to write part of the contents of a file.
+//
+// A file is written as a sequence of these with increasing offsets.
+// The first, with `m_offset` zero, creates or truncates the file.
+class VFS_WriteFileRangeRequest : public VFS_PathRequest {
+public:      // data
+  // Offset at which to write `m_contents`.
+  //
+  // The ranges are not written to `m_path` itself, but to a temporary
+  // file next to it (see `VFS_rangeWriteTempPrefix`), which replaces
+  // `m_path` when the range with `m_lastRange` arrives.  Thus, if the
+  // transfer fails or is abandoned partway, the target is unchanged.
+  //
+  // If the offset is zero, a new temporary file is created first.
+  // Otherwise, it must not exceed the temporary file's size.
+  int64_t m_offset;
+
+  // When `m_offset` is not zero, the `m_tempPath` of the reply to the
+  // first range of this transfer.  Ignored for the first range.
+  string m_tempPath;
+
+  // Bytes to write.
+  std::vector<unsigned char> m_contents;
+
+  // If true, and `m_offset` is zero, then the file is only written if
+  // it does not exist or if `textContentDigest` of its current
+  // contents is `m_expectedDigest`.  Otherwise the reply reports
+  // failure with `m_digestMismatch` set.  This lets the client avoid
+  // overwriting changes made by someone else since it last read or
+  // wrote the file.
+  bool m_checkDigest;
+  uint64_t m_expectedDigest;
+
+  // If true, this is the final range, so after writing it, the
+  // temporary file is renamed over `m_path`.
+  //
+  // If `m_path` is a symbolic link, the file it refers to is the one
+  // replaced, and the replacement gets that file's owner and group.
+  // If the file has other hard links, or its owner and group cannot be
+  // given to the replacement, its contents are instead overwritten in
+  // place, and the temporary file is removed.
+  bool m_lastRange;
+
+public:      // methods
+  VFS_WriteFileRangeRequest();
+  virtual ~VFS_WriteFileRangeRequest() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_WriteFileRangeRequest; }
+  virtual string description() const override;
+  virtual void xfer(Flatten &flat) override;
+};
+
+
+// Reply to VFS_WriteFileRangeRequest.
+class VFS_WriteFileRangeReply : public VFS_PathReply {
+public:      // data
+  // Modification time as reported by the file system after writing
+  // the range.
+  int64_t m_fileModificationTime;
+
+  // True if nothing was written because the file did not have the
+  // expected digest.
+  bool m_digestMismatch;
+
+  // Temporary file holding the ranges written so far, which the
+  // client passes back in the request for each later range.
+  string m_tempPath;
+
+public:      // methods
+  VFS_WriteFileRangeReply();
+  virtual ~VFS_WriteFileRangeReply() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_WriteFileRangeReply; }
+  virtual void xfer(Flatten &flat) override;
+};
+
+
+// Request to read selected lines from each of several files.
+//
+// This is for showing a few lines from each of many files, such as a
+// list of references to a symbol.  It needs only one round trip, and
+// the server only scans the files as far as the last requested line,
+// without holding any whole file in memory.
+class VFS_ReadFileLinesRequest : public VFS_Message {
+public:      // types
+  // Lines requested from one file.
+  class FileLines {
+  public:    // data
+    // Path to the file.
+    string m_path;
+
+    // 0-based indices of the lines to read, in any order.  Duplicates
+    // are allowed.  Must be non-negative.
+    std::vector<int32_t> m_lineIndices;
+
+  public:    // methods
+    FileLines();
+    ~FileLines();
+
+    void xfer(Flatten &flat);
+  };
+
+public:      // data
+  // Files to read, in any order.
+  std::vector<FileLines> m_files;
+
+public:      // methods
+  VFS_ReadFileLinesRequest();
+  virtual ~VFS_ReadFileLinesRequest() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_ReadFileLinesRequest; }
+  virtual string description() const override;
+  virtual void xfer(Flatten &flat) override;
+};
+
+
+// Reply to VFS_ReadFileLinesRequest.
+class VFS_ReadFileLinesReply : public VFS_Message {
+public:      // types
+  // Result for one file.  The fields for failure are like those of
+  // `VFS_PathReply`.
+  class FileLines {
+  public:    // data
+    // True if the file could be read.  Initially true.
+    bool m_success;
+
+    // If '!m_success', the reason for the failure.
+    smbase::PortableErrorCode m_failureReasonCode;
+    string m_failureReasonString;
+
+    // Parallel to the request's `m_lineIndices`: the text of each
+    // line, without its line terminator.  An entry for an index that
+    // is not within the file is empty.
+    std::vector<string> m_lines;
+
+    // If any requested index is not within the file, the number of
+    // lines in the file, counted like `TextDocumentCore::numLines()`
+    // (one more than the number of newlines).  Otherwise -1, since
+    // the scan stops after the last requested line.
+    int32_t m_numLines;
+
+  public:    // methods
+    FileLines();
+    ~FileLines();
+
+    // Set the failure reason, and set 'm_success' to false.
+    void setFailureReason(smbase::PortableErrorCode reasonCode,
+                          string const &reasonString);
+
+    // True if line `index` (one of the requested indices) exists.
+    bool hasLine(int32_t index) const
+      { return m_numLines < 0 || index < m_numLines; }
+
+    void xfer(Flatten &flat);
+  };
+
+public:      // data
+  // Parallel to the request's `m_files`.
+  std::vector<FileLines> m_files;
+
+public:      // methods
+  VFS_ReadFileLinesReply();
+  virtual ~VFS_ReadFileLinesReply() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_ReadFileLinesReply; }
+  virtual string description() const override;
+  virtual void xfer(Flatten &flat) override;
+};
+
+
+// Request to be told when the file at 'm_path' changes.
+//
+// After a successful reply, the server sends a
+// VFS_FileChangeNotification whenever the file is modified, replaced,
+// created, or deleted, until the path is unwatched or the connection
+// closes.  Watching a path that is already watched has no additional
+// effect.  Servers that cannot watch files reply with a failure, in
+// which case the client has to poll with VFS_FileStatusRequest.
+class VFS_WatchFileRequest : public VFS_PathRequest {
+public:      // methods
+  VFS_WatchFileRequest();
+  virtual ~VFS_WatchFileRequest() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_WatchFileRequest; }
+};
+
+
+// Reply to VFS_WatchFileRequest.
+//
+// A file that does not exist can be watched; its creation is then
+// reported.
+class VFS_WatchFileReply : public VFS_PathReply {
+public:      // data
+  // Existence and kind of the file when the watch was established.
+  SMFileUtil::FileKind m_fileKind;
+
+  // If the file exists, its unix modification time when the watch was
+  // established.  Changes before this point are not reported, so the
+  // client should compare this to what it last saw.
+  int64_t m_fileModificationTime;
+
+public:      // methods
+  VFS_WatchFileReply();
+  virtual ~VFS_WatchFileReply() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_WatchFileReply; }
+  virtual string description() const override;
+  virtual void xfer(Flatten &flat) override;
+};
+
+
+// Request to stop watching 'm_path'.  It is not an error if it was not
+// being watched.
+class VFS_UnwatchFileRequest : public VFS_PathRequest {
+public:      // methods
+  VFS_UnwatchFileRequest();
+  virtual ~VFS_UnwatchFileRequest() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_UnwatchFileRequest; }
+};
+
+
+// Reply to VFS_UnwatchFileRequest.
+class VFS_UnwatchFileReply : public VFS_PathReply {
+public:      // methods
+  VFS_UnwatchFileReply();
+  virtual ~VFS_UnwatchFileReply() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_UnwatchFileReply; }
+};
+
+
+// Sent by the server, with 'VFS_notificationWireID', when a watched
+// file changes.  Several changes in quick succession may be reported
+// by one notification.
+class VFS_FileChangeNotification : public VFS_Message {
+public:      // data
+  // The path exactly as it appeared in the VFS_WatchFileRequest.
+  string m_path;
+
+  // Existence and kind of the file after the change.
+  SMFileUtil::FileKind m_fileKind;
+
+  // If the file exists, its unix modification time after the change.
+  int64_t m_fileModificationTime;
+
+public:      // methods
+  VFS_FileChangeNotification();
+  virtual ~VFS_FileChangeNotification() override;
+
+  // VFS_Message methods.
+  virtual VFS_MessageType messageType() const override
+    { return VFS_MT_FileChangeNotification; }
+  virtual string description() const override;
+  virtual void xfer(Flatten &flat) override;
+};
+
+
 #endif // EDITOR_VFS_MSG_H
@@ -5,5 +5,6 @@
 #define EDITOR_VFS_QUERY_FWD_H
 
 class VFS_FileSystemQuery;
+class VFS_TransferStats;
 
 #endif // EDITOR_VFS_QUERY_FWD_H
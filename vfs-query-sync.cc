@@ -13,7 +13,7 @@
 // smbase
 #include "smbase/sm-macros.h"          // IMEMBFP
 #include "smbase/trace.h"              // TRACE
-#include "smbase/xassert.h"            // xassert
+#include "smbase/xassert.h"            // xassert, xassertPrecondition
 
 // qt
 #include <QCursor>
@@ -21,6 +21,10 @@
 #include <QProgressDialog>
 
 // libc++
+#include <algorithm>                   // std::min
+#include <cstdint>                     // int64_t, std::uint64_t
+#include <deque>                       // std::deque
+#include <optional>                    // std::optional
 #include <utility>                     // std::move
 
 
@@ -31,7 +35,8 @@ VFS_QuerySync::VFS_QuerySync(
     m_requestID(0),
     m_hostName(HostName::asLocal()),
     m_reply(),
-    m_connLostMessage()
+    m_connLostMessage(),
+    m_unwaitedRequests()
 {
   QObject::connect(
     m_vfsConnections, &VFS_AbstractConnections::signal_vfsReplyAvailable,
@@ -45,6 +50,11 @@ VFS_QuerySync::VFS_QuerySync(
 
 VFS_QuerySync::~VFS_QuerySync()
 {
+  // Nobody will take these replies.
+  for (auto const &kv : m_unwaitedRequests) {
+    m_vfsConnections->cancelRequest(kv.first);
+  }
+
   // See doc/signals-and-dtors.txt.
   QObject::disconnect(m_vfsConnections, nullptr, this, nullptr);
 }
@@ -55,59 +65,102 @@ bool VFS_QuerySync::issueRequestSynchronously(
   std::unique_ptr<VFS_Message> request,
   std::unique_ptr<VFS_Message> /*OUT*/ &reply,
   string /*OUT*/ &connLostMessage)
+{
+  RequestID requestID =
+    issueRequestWithoutWaiting(hostName, std::move(request));
+  return waitForReply(requestID, reply, connLostMessage);
+}
+
+
+VFS_QuerySync::RequestID VFS_QuerySync::issueRequestWithoutWaiting(
+  HostName const &hostName,
+  std::unique_ptr<VFS_Message> request)
 {
   xassert(!m_requestID);
+  xassertPrecondition(m_unwaitedRequests.empty() ||
+                      hostName == m_hostName);
   m_hostName = hostName;
 
   string requestDescription = request->description();
-  m_vfsConnections->issueRequest(m_requestID /*OUT*/,
+  RequestID requestID = 0;
+  m_vfsConnections->issueRequest(requestID /*OUT*/,
     m_hostName, std::move(request));
-  RequestID origRequestID = m_requestID;
 
   TRACE("VFS_QuerySync",
-    "request " << origRequestID << ": issued: " << requestDescription);
+    "request " << requestID << ": issued: " << requestDescription);
 
-  // Inform the test infrastructure that we are awaiting IPC.
-  IncDecWaitingCounter idwc;
+  m_unwaitedRequests.emplace(requestID, requestDescription);
+  return requestID;
+}
 
-  auto doneCondition = [this]() -> bool {
-    // When the correct reply arrives, or a failure happens, we reset
-    // this to zero.
-    return this->m_requestID == 0;
-  };
 
-  bool completed = m_waiter.waitUntil(
-    doneCondition,
-    500 /*msec*/,
-    "Waiting for VFS query",
-    requestDescription);
+bool VFS_QuerySync::waitForReply(
+  RequestID requestID,
+  std::unique_ptr<VFS_Message> /*OUT*/ &reply,
+  string /*OUT*/ &connLostMessage)
+{
+  xassert(!m_requestID);
 
-  if (!completed) {
-    TRACE("VFS_QuerySync",
-      "request " << origRequestID << ": canceled");
-    m_requestID = 0;
-    return false;
+  auto it = m_unwaitedRequests.find(requestID);
+  xassertPrecondition(it != m_unwaitedRequests.end());
+  string requestDescription = it->second;
+  m_unwaitedRequests.erase(it);
+
+  if (m_vfsConnections->replyIsAvailable(requestID)) {
+    // It arrived while we were waiting for another one.
+    m_reply = m_vfsConnections->takeReply(requestID);
+  }
+  else if (m_connLostMessage.empty()) {
+    m_requestID = requestID;
+
+    // Inform the test infrastructure that we are awaiting IPC.
+    IncDecWaitingCounter idwc;
+
+    auto doneCondition = [this]() -> bool {
+      // When the correct reply arrives, or a failure happens, we reset
+      // this to zero.
+      return this->m_requestID == 0;
+    };
+
+    bool completed = m_waiter.waitUntil(
+      doneCondition,
+      500 /*msec*/,
+      "Waiting for VFS query",
+      requestDescription);
+
+    if (!completed) {
+      TRACE("VFS_QuerySync",
+        "request " << requestID << ": canceled");
+      m_vfsConnections->cancelRequest(requestID);
+      m_requestID = 0;
+      return false;
+    }
   }
 
   if (m_reply) {
     TRACE("VFS_QuerySync",
-      "request " << origRequestID <<
+      "request " << requestID <<
       ": got reply: " << m_reply->description());
     reply = std::move(m_reply);
     return true;
   }
   else if (!m_connLostMessage.empty()) {
     TRACE("VFS_QuerySync",
-      "request " << origRequestID <<
+      "request " << requestID <<
       ": conn lost: " << m_connLostMessage);
     connLostMessage = m_connLostMessage;
-    m_connLostMessage = "";
+
+    // Keep the message if other requests were also on the lost
+    // connection.
+    if (m_unwaitedRequests.empty()) {
+      m_connLostMessage = "";
+    }
     return true;
   }
   else {
     // Should not happen.
     TRACE("VFS_QuerySync",
-      "request " << origRequestID << ": what happened?");
+      "request " << requestID << ": what happened?");
     DEV_WARNING("VFS_QuerySync: not canceled, succeeded, nor failed?");
     return false;
   }
@@ -156,25 +209,216 @@ void VFS_QuerySync::on_vfsReplyAvailable(RequestID requestID) NOEXCEPT
 void VFS_QuerySync::on_vfsFailed(
   HostName hostName, string reason) NOEXCEPT
 {
-  if (m_requestID != 0 && hostName == m_hostName) {
+  if ((m_requestID != 0 || !m_unwaitedRequests.empty()) &&
+      hostName == m_hostName) {
     m_connLostMessage = reason;
     m_requestID = 0;
   }
 }
 
 
+// Number of bytes to request in each range of a file transfer.  This
+// is small enough that other requests are not delayed much, and large
+// enough that the per-request overhead is negligible.
+static int64_t const TRANSFER_CHUNK_SIZE = 0x100000;     // 1 MiB
+
+// Maximum number of ranges `readFileSynchronously` has requested but
+// not yet received.  Keeping several in flight means the server can
+// read the next range while the previous one is in transit.
+static int const MAX_RANGES_IN_FLIGHT = 4;
+
+// Number of times `readFileSynchronously` will start over because the
+// file changed while it was being read.
+static int const MAX_READ_RESTARTS = 3;
+
+
 smbase::Either<std::unique_ptr<VFS_ReadFileReply>, std::string>
 readFileSynchronously(
   VFS_AbstractConnections *vfsConnections,
   SynchronousWaiter &waiter,
   HostAndResourceName const &harn)
 {
-  std::unique_ptr<VFS_ReadFileRequest> req(new VFS_ReadFileRequest);
-  req->m_path = harn.resourceName();
+  if (!vfsConnections->isValid(harn.hostName())) {
+    return stringb("Host " << harn.hostName() << " is invalid.");
+  }
+
+  // The ranges are accumulated here.
+  std::unique_ptr<VFS_ReadFileReply> ret(new VFS_ReadFileReply);
+
+  int restarts = 0;
+  while (true) {
+    // A new query object for each attempt, so that when one is
+    // abandoned, its remaining requests get canceled.
+    VFS_QuerySync querySync(vfsConnections, waiter);
+
+    // Requests issued but not yet waited for, in offset order.
+    std::deque<VFS_QuerySync::RequestID> inFlight;
+
+    // Offset of the next range to request.
+    int64_t nextOffset = 0;
+
+    auto requestNextRange = [&]() -> void {
+      std::unique_ptr<VFS_ReadFileRangeRequest> req(
+        new VFS_ReadFileRangeRequest);
+      req->m_path = harn.resourceName();
+      req->m_offset = nextOffset;
+      req->m_maxLength = TRANSFER_CHUNK_SIZE;
+      nextOffset += TRANSFER_CHUNK_SIZE;
+
+      inFlight.push_back(querySync.issueRequestWithoutWaiting(
+        harn.hostName(), std::move(req)));
+    };
+
+    // True once we have the first range, whose size and time the
+    // subsequent ranges must match.  Until then, we do not know how
+    // many ranges to ask for.
+    bool haveFirstRange = false;
+    int64_t fileSize = 0;
+    ret->m_contents.clear();
+
+    requestNextRange();
+    while (true) {
+      xassert(!inFlight.empty());
+      auto replyOrError(
+        querySync.waitForTypedReply<VFS_ReadFileRangeReply>(
+          inFlight.front()));
+      inFlight.pop_front();
+      if (replyOrError.isRight()) {
+        return replyOrError.right();
+      }
+
+      std::unique_ptr<VFS_ReadFileRangeReply> &range = replyOrError.left();
+      if (!range) {
+        // Canceled.
+        return std::unique_ptr<VFS_ReadFileReply>();
+      }
+
+      if (!range->m_success) {
+        ret->m_contents.clear();
+        ret->setFailureReason(range->m_failureReasonCode,
+                              range->m_failureReasonString);
+        return ret;
+      }
+
+      if (!haveFirstRange) {
+        haveFirstRange = true;
+        fileSize = range->m_fileSize;
+        ret->m_fileModificationTime = range->m_fileModificationTime;
+        ret->m_readOnly = range->m_readOnly;
+        ret->m_contents.reserve((size_t)fileSize);
+      }
+
+      // Since later ranges were requested before this one arrived,
+      // each must be exactly where and as long as expected.  Otherwise
+      // the file changed.
+      int64_t const offset = (int64_t)ret->m_contents.size();
+      if (range->m_fileSize != fileSize ||
+          range->m_fileModificationTime != ret->m_fileModificationTime ||
+          range->m_offset != offset ||
+          (int64_t)range->m_contents.size() !=
+            std::min(TRANSFER_CHUNK_SIZE, fileSize - offset)) {
+        break;
+      }
+
+      ret->m_contents.insert(ret->m_contents.end(),
+        range->m_contents.begin(), range->m_contents.end());
+
+      if ((int64_t)ret->m_contents.size() == fileSize) {
+        return ret;
+      }
+
+      // Keep the pipeline full, up to the end of the file.
+      while ((int)inFlight.size() < MAX_RANGES_IN_FLIGHT &&
+             nextOffset < fileSize) {
+        requestNextRange();
+      }
+    }
+
+    TRACE("VFS_QuerySync",
+      "readFileSynchronously: " << harn << " changed during read");
+    if (++restarts > MAX_READ_RESTARTS) {
+      return stringb(
+        "File " << harn << " kept changing while being read.");
+    }
+  }
+}
 
+
+smbase::Either<std::unique_ptr<VFS_WriteFileReply>, std::string>
+writeFileSynchronously(
+  VFS_AbstractConnections *vfsConnections,
+  SynchronousWaiter &waiter,
+  HostAndResourceName const &harn,
+  std::vector<unsigned char> const &contents,
+  std::optional<std::uint64_t> expectedDigest)
+{
   VFS_QuerySync querySync(vfsConnections, waiter);
-  return querySync.issueTypedRequestSynchronously<VFS_ReadFileReply>(
-    harn.hostName(), std::move(req));
+
+  std::unique_ptr<VFS_WriteFileReply> ret(new VFS_WriteFileReply);
+
+  // Always send at least one range, since the last one is what
+  // replaces the file.
+  int64_t const total = (int64_t)contents.size();
+  int64_t offset = 0;
+
+  // Temporary file the server is accumulating the ranges in.
+  std::string tempPath;
+
+  do {
+    int64_t len = std::min(total - offset, TRANSFER_CHUNK_SIZE);
+
+    std::unique_ptr<VFS_WriteFileRangeRequest> req(
+      new VFS_WriteFileRangeRequest);
+    req->m_path = harn.resourceName();
+    req->m_offset = offset;
+    req->m_tempPath = tempPath;
+    req->m_contents.assign(contents.begin() + offset,
+                           contents.begin() + offset + len);
+    if (offset == 0 && expectedDigest) {
+      req->m_checkDigest = true;
+      req->m_expectedDigest = *expectedDigest;
+    }
+    req->m_lastRange = (offset + len == total);
+
+    auto replyOrError(
+      querySync.issueTypedRequestSynchronously<VFS_WriteFileRangeReply>(
+        harn.hostName(), std::move(req)));
+    if (replyOrError.isRight()) {
+      return replyOrError.right();
+    }
+
+    std::unique_ptr<VFS_WriteFileRangeReply> &range = replyOrError.left();
+    if (!range) {
+      // Canceled.
+      return std::unique_ptr<VFS_WriteFileReply>();
+    }
+
+    if (!range->m_success) {
+      ret->setFailureReason(range->m_failureReasonCode,
+                            range->m_failureReasonString);
+      ret->m_digestMismatch = range->m_digestMismatch;
+      return ret;
+    }
+
+    ret->m_fileModificationTime = range->m_fileModificationTime;
+    tempPath = range->m_tempPath;
+    offset += len;
+  } while (offset < total);
+
+  return ret;
+}
+
+
+smbase::Either<std::unique_ptr<VFS_ReadFileLinesReply>, std::string>
+readFileLinesSynchronously(
+  VFS_AbstractConnections *vfsConnections,
+  SynchronousWaiter &waiter,
+  HostName const &hostName,
+  std::unique_ptr<VFS_ReadFileLinesRequest> request)
+{
+  VFS_QuerySync querySync(vfsConnections, waiter);
+  return querySync.issueTypedRequestSynchronously<VFS_ReadFileLinesReply>(
+    hostName, std::move(request));
 }
 
 
@@ -16,8 +16,11 @@
 
 #include <QObject>
 
+#include <cstdint>                     // std::uint64_t
+#include <map>                         // std::map
 #include <optional>                    // std::optional
 #include <string>                      // std::string
+#include <vector>                      // std::vector
 
 
 // Like VFS_FileSystemQuery, but with a synchronous interface and an
@@ -50,6 +53,11 @@ private:     // data
   // Connection lost message, or empty string.
   string m_connLostMessage;
 
+  // Requests issued by `issueRequestWithoutWaiting` that have not yet
+  // been passed to `waitForReply`, mapped to their descriptions.  The
+  // destructor cancels any that remain.
+  std::map<RequestID, string> m_unwaitedRequests;
+
 public:      // instance methods
   // Create an object to issue queries via `vfsConnections`.  Use
   // `waiter` to wait, which can (e.g.) pop up a modal window.
@@ -68,6 +76,26 @@ public:      // instance methods
     std::unique_ptr<VFS_Message> /*OUT*/ &reply,
     string /*OUT*/ &connLostMessage);
 
+  // Issue `request` to `hostName` and return its ID without waiting
+  // for the reply.  Any number of requests can be outstanding this
+  // way, which lets the server work on the next while the reply to the
+  // previous is in transit.  Each is then waited for with
+  // `waitForReply` or `waitForTypedReply`.
+  //
+  // Requires: isValid(hostName)
+  // Requires: all such outstanding requests are to `hostName`
+  RequestID issueRequestWithoutWaiting(
+    HostName const &hostName,
+    std::unique_ptr<VFS_Message> request);
+
+  // Wait for the reply to `requestID`, which was returned by
+  // `issueRequestWithoutWaiting` and not yet waited for.  The outputs
+  // and return value are as for `issueRequestSynchronously`.
+  bool waitForReply(
+    RequestID requestID,
+    std::unique_ptr<VFS_Message> /*OUT*/ &reply,
+    string /*OUT*/ &connLostMessage);
+
   // Issue 'request' synchronously, expecting to get 'REPLY_TYPE' in the
   // left alternative.  Note that it could be a failure reply.
   //
@@ -83,6 +111,12 @@ public:      // instance methods
     HostName const &hostName,
     std::unique_ptr<VFS_Message> request);
 
+  // Wait for `requestID` like `waitForReply`, returning the result as
+  // for `issueTypedRequestSynchronously`.
+  template <class REPLY_TYPE>
+  smbase::Either<std::unique_ptr<REPLY_TYPE>, std::string>
+  waitForTypedReply(RequestID requestID);
+
   // Pop up a modal error dialog, returning when it is dismissed.
   void complain(string message);
 
@@ -102,18 +136,26 @@ VFS_QuerySync::issueTypedRequestSynchronously(
   HostName const &hostName,
   std::unique_ptr<VFS_Message> request)
 {
-  // Initially empty pointer, used for error returns.
-  std::unique_ptr<REPLY_TYPE> typedReply;
-
   if (!m_vfsConnections->isValid(hostName)) {
     return stringb("Host " << hostName << " is invalid.");
   }
 
-  // Issue the request.
+  return waitForTypedReply<REPLY_TYPE>(
+    issueRequestWithoutWaiting(hostName, std::move(request)));
+}
+
+
+template <class REPLY_TYPE>
+smbase::Either<std::unique_ptr<REPLY_TYPE>, std::string>
+VFS_QuerySync::waitForTypedReply(RequestID requestID)
+{
+  // Initially empty pointer, used for error returns.
+  std::unique_ptr<REPLY_TYPE> typedReply;
+
+  // Wait for the reply.
   std::unique_ptr<VFS_Message> genericReply;
   string connLostMessage;
-  if (!issueRequestSynchronously(
-         hostName, std::move(request), genericReply, connLostMessage)) {
+  if (!waitForReply(requestID, genericReply, connLostMessage)) {
     // Request was canceled.
     return typedReply;
   }
@@ -187,6 +229,12 @@ FailReasonOpt getROEErrorMessage(
 
    The `getROEErrorMessage` function above can be used to combine the
    handling of the error cases (2 and 4).
+
+   The file is transferred as a sequence of `VFS_ReadFileRangeRequest`s
+   so that other requests to the same host can be serviced in between.
+   Several ranges are requested ahead of the one being waited for, so
+   the transfer is not limited by the round trip time.  If the file
+   changes during the transfer, the read starts over.
 */
 smbase::Either<std::unique_ptr<VFS_ReadFileReply>, std::string>
 readFileSynchronously(
@@ -195,6 +243,42 @@ readFileSynchronously(
   HostAndResourceName const &harn);
 
 
+/* Write `contents` to `harn`, waiting for the reply like
+   `readFileSynchronously`, and with the same return cases.
+
+   Like reading, the contents are sent as a sequence of
+   `VFS_WriteFileRangeRequest`s.  The server writes them to a temporary
+   file that replaces the target when the last range arrives, so if the
+   transfer is canceled or fails partway, the target is unchanged.
+
+   If `expectedDigest` is provided, the server first checks that the
+   file, if it exists, has that `textContentDigest`.  If not, nothing
+   is written, and the failure reply has `m_digestMismatch` set.
+*/
+smbase::Either<std::unique_ptr<VFS_WriteFileReply>, std::string>
+writeFileSynchronously(
+  VFS_AbstractConnections *vfsConnections,
+  SynchronousWaiter &waiter,
+  HostAndResourceName const &harn,
+  std::vector<unsigned char> const &contents,
+  std::optional<std::uint64_t> expectedDigest);
+
+
+/* Issue `request` to `hostName` to read selected lines from several
+   files, waiting like `readFileSynchronously`.
+
+   The return cases are the same as for `readFileSynchronously` except
+   that there is no failure reply as a whole; instead, each element of
+   the reply's `m_files` indicates success or failure for that file.
+*/
+smbase::Either<std::unique_ptr<VFS_ReadFileLinesReply>, std::string>
+readFileLinesSynchronously(
+  VFS_AbstractConnections *vfsConnections,
+  SynchronousWaiter &waiter,
+  HostName const &hostName,
+  std::unique_ptr<VFS_ReadFileLinesRequest> request);
+
+
 // Get timestamp, etc., for 'fname'.
 //
 // This has the same return cases as `readFileSynchronously`.
@@ -4,16 +4,16 @@
 #include "vfs-query.h"                 // this module
 
 // editor
+#include "buffer-flatten.h"            // BufferFlatten
 #include "waiting-counter.h"           // adjWaitingCounter
 
 // smqtutil
 #include "smqtutil/qtutil.h"           // toString(QString), printQByteArray
 
 // smbase
-#include "smbase/bflatten.h"           // StreamFlatten
-#include "smbase/exc.h"                // GENERIC_CATCH_BEGIN/END
+#include "smbase/exc.h"                // GENERIC_CATCH_BEGIN/END, smbase::XFormat
 #include "smbase/flatten.h"            // serializeIntNBO
-#include "smbase/nonport.h"            // getFileModificationTime
+#include "smbase/nonport.h"            // getFileModificationTime, getMilliseconds
 #include "smbase/overflow.h"           // writeConvertedNumber
 #include "smbase/sm-macros.h"          // DEFINE_ENUMERATION_TO_STRING
 #include "smbase/trace.h"              // TRACE
@@ -22,13 +22,46 @@
 #include <QCoreApplication>
 
 // libc++
-#include <sstream>                     // std::i/ostringstream
+#include <algorithm>                   // std::min
+#include <sstream>                     // std::ostringstream
 #include <utility>                     // std::move
 
-// libc
-#include <string.h>                    // memcpy
+using namespace smbase;
 
 
+// ------------------------- VFS_TransferStats -------------------------
+VFS_TransferStats::VFS_TransferStats()
+  : m_messagesSent(0),
+    m_messagesReceived(0),
+    m_rawBytesSent(0),
+    m_rawBytesReceived(0),
+    m_wireBytesSent(0),
+    m_wireBytesReceived(0),
+    m_waitMilliseconds(0)
+{}
+
+
+double VFS_TransferStats::compressionRatio() const
+{
+  int64_t wire = m_wireBytesSent + m_wireBytesReceived;
+  if (wire == 0) {
+    return 1.0;
+  }
+  return (double)(m_rawBytesSent + m_rawBytesReceived) / (double)wire;
+}
+
+
+double VFS_TransferStats::throughputBytesPerSecond() const
+{
+  if (m_waitMilliseconds == 0) {
+    return 0.0;
+  }
+  return (double)(m_rawBytesSent + m_rawBytesReceived) * 1000.0 /
+         (double)m_waitMilliseconds;
+}
+
+
+// ------------------------ VFS_FileSystemQuery ------------------------
 VFS_FileSystemQuery::VFS_FileSystemQuery()
   : QObject(),
     m_state(S_CREATED),
@@ -36,8 +69,16 @@ VFS_FileSystemQuery::VFS_FileSystemQuery()
     m_commandRunner(),
     m_replyBytes(),
     m_errorBytes(),
-    m_replyMessage(),
-    m_failureReason()
+    m_sendBuffer(),
+    m_nextWireID(1),
+    m_outstandingWireIDs(),
+    m_availableReplies(),
+    m_failureReason(),
+    m_requestedCodec(),
+    m_codec(VFS_CC_NONE),
+    m_useEnvelopes(false),
+    m_transferStats(),
+    m_busyStartMillis(0)
 {
   QObject::connect(&m_commandRunner, &CommandRunner::signal_outputDataReady,
                    this, &VFS_FileSystemQuery::on_outputDataReady);
@@ -108,82 +149,197 @@ void VFS_FileSystemQuery::recordFailure(string const &reason)
 
 void VFS_FileSystemQuery::checkForCompleteReply()
 {
-  uint32_t replyBytesSize = m_replyBytes.size();
-  if (replyBytesSize < 4) {
-    return;
-  }
+  bool wasConnecting = (state() == S_CONNECTING);
+  bool gotReplies = false;
+
+  // Several replies can arrive in one chunk of output, so consume as
+  // many complete messages as are present.  They are decoded in place,
+  // and the consumed prefix is removed from `m_replyBytes` once at the
+  // end rather than after each message.
+  uint32_t const replyBytesSize = m_replyBytes.size();
+  uint32_t consumed = 0;
+  bool ok = true;
+  while (replyBytesSize - consumed >= 4) {
+    unsigned char const *msgStart =
+      reinterpret_cast<unsigned char const *>(m_replyBytes.constData()) +
+      consumed;
+    uint32_t replyLen;
+    deserializeIntNBO(msgStart, replyLen);
+
+    if (replyBytesSize - consumed - 4 < replyLen) {
+      break;
+    }
+
+    if (tracingSys("VFS_FileSystemQuery_detail")) {
+      printQByteArray(m_replyBytes.mid(consumed, 4+replyLen),
+                      "reply bytes");
+    }
 
-  unsigned char lenBuf[4];
-  memcpy(lenBuf, m_replyBytes.data(), 4);
-  uint32_t replyLen;
-  deserializeIntNBO(lenBuf, replyLen);
+    consumed += 4+replyLen;
+    m_transferStats.m_messagesReceived++;
+    m_transferStats.m_wireBytesReceived += 4+replyLen;
 
-  if (replyBytesSize < 4+replyLen) {
-    return;
+    if (!processReplyMessage(reinterpret_cast<char const *>(msgStart+4),
+                             replyLen)) {
+      ok = false;
+      break;
+    }
+
+    if (!wasConnecting) {
+      gotReplies = true;
+    }
   }
 
-  if (replyBytesSize > 4+replyLen) {
-    recordFailure(stringb(
-      "Reply has extra bytes.  Its size is " << replyBytesSize <<
-      " but the expected size is " << (4+replyLen) << "."));
+  m_replyBytes.remove(0, consumed);
+  if (!ok) {
     return;
   }
 
-  if (tracingSys("VFS_FileSystemQuery_detail")) {
-    printQByteArray(m_replyBytes, "reply bytes");
+  if (wasConnecting && state() == S_READY) {
+    Q_EMIT signal_vfsConnected();
+  }
+  else if (gotReplies) {
+    Q_EMIT signal_vfsReplyAvailable();
   }
+}
 
-  std::string messageBytes(m_replyBytes.data()+4, replyLen);
-  std::istringstream iss(messageBytes);
-  StreamFlatten flat(&iss);
-  m_replyMessage.reset(VFS_Message::deserialize(flat));
 
-  TRACE("VFS_FileSystemQuery",
-    "received reply: type=" << toString(m_replyMessage->messageType()) <<
-    " len=" << replyLen);
+bool VFS_FileSystemQuery::processReplyMessage(char const *messageBytes,
+                                              std::size_t len)
+{
+  // Strip the envelope.
+  VFS_WireID wireID = 0;
+  char const *body = messageBytes;
+  std::size_t bodyLen = len;
+  std::string decompressed;
+  if (m_useEnvelopes) {
+    if (len < 4) {
+      recordFailure(stringb(
+        "Reply of " << len <<
+        " bytes is too short to have a request ID."));
+      return false;
+    }
+    deserializeIntNBO(
+      reinterpret_cast<unsigned char const *>(messageBytes),
+      wireID);
 
-  // Clear the reply bytes so we are ready for the next one.
-  m_replyBytes.clear();
+    try {
+      body = vfsDecodeMessageBodyView(messageBytes+4, len-4,
+                                      decompressed, bodyLen /*OUT*/);
+    }
+    catch (XFormat &x) {
+      recordFailure(stringb("Malformed reply envelope: " << x.why()));
+      return false;
+    }
+  }
+  m_transferStats.m_rawBytesReceived += bodyLen;
 
-  // Having done all that, if we have error bytes, then regard that as
-  // a protocol violation and switch over to the failure case.
+  BufferFlatten flat(reinterpret_cast<unsigned char const *>(body),
+                     bodyLen);
+  std::unique_ptr<VFS_Message> replyMessage(VFS_Message::deserialize(flat));
+
+  TRACE("VFS_FileSystemQuery",
+    "received reply: type=" << toString(replyMessage->messageType()) <<
+    " id=" << wireID << " len=" << bodyLen);
+
+  // If we have error bytes, then regard that as a protocol violation
+  // and switch over to the failure case.
   if (!m_errorBytes.isEmpty()) {
     recordFailure("Error bytes were present (along with a valid "
                   "reply, now discarded).");
-    return;
+    return false;
   }
 
   if (state() == S_CONNECTING) {
     // Check that the reply is the version message.
-    if (VFS_GetVersion const *getVer = m_replyMessage->ifGetVersionC()) {
+    if (VFS_GetVersion const *getVer = replyMessage->ifGetVersionC()) {
       // Confirm compatibility.
       if (getVer->m_version == VFS_currentVersion) {
-        // Good to go.
-        TRACE("VFS_FileSystemQuery", "confirmed protocol compatibility");
+        // Good to go.  The server should not pick a better codec than
+        // we asked for, but do not depend on that.
+        m_codec = std::min(vfsNegotiateCodec(getVer->m_compressionCodec),
+                           m_requestedCodec.value());
+        m_useEnvelopes = true;
+        TRACE("VFS_FileSystemQuery",
+          "confirmed protocol compatibility, codec=" << toString(m_codec));
         setState(S_READY);
-        m_replyMessage.reset(nullptr);
-        Q_EMIT signal_vfsConnected();
+        return true;
       }
       else {
         recordFailure(stringb(
           "fs-server reports version " << getVer->m_version <<
           " but this client uses version " << VFS_currentVersion <<
           "."));
-        return;
+        return false;
       }
     }
     else {
       recordFailure(stringb(
         "Server replied with invalid message type: " <<
-        m_replyMessage->messageType()));
-      return;
+        replyMessage->messageType()));
+      return false;
+    }
+  }
+
+  else if (canSendRequest()) {
+    if (wireID == VFS_notificationWireID) {
+      // Not a reply to anything we sent.  It is delivered like a reply,
+      // and the recipient tells them apart by the ID.
+      m_availableReplies.push_back(
+        AvailableReply(wireID, std::move(replyMessage)));
+      setStateFromQueues();
+      return true;
+    }
+
+    auto it = m_outstandingWireIDs.find(wireID);
+    if (it == m_outstandingWireIDs.end()) {
+      recordFailure(stringb(
+        "Server replied with unknown request ID " << wireID << "."));
+      return false;
     }
+    m_outstandingWireIDs.erase(it);
+
+    if (m_outstandingWireIDs.empty()) {
+      m_transferStats.m_waitMilliseconds +=
+        getMilliseconds() - m_busyStartMillis;
+    }
+
+    m_availableReplies.push_back(
+      AvailableReply(wireID, std::move(replyMessage)));
+    setStateFromQueues();
+    return true;
   }
 
   else {
+    // We are failed or dead; discard it.
+    TRACE("VFS_FileSystemQuery",
+      "discarding reply received in state " << toString(state()));
+    return false;
+  }
+}
+
+
+void VFS_FileSystemQuery::setStateFromQueues()
+{
+  xassert(canSendRequest());
+
+  if (!m_availableReplies.empty()) {
     setState(S_HAS_REPLY);
-    Q_EMIT signal_vfsReplyAvailable();
   }
+  else if (!m_outstandingWireIDs.empty()) {
+    setState(S_WAITING);
+  }
+  else {
+    setState(S_READY);
+  }
+}
+
+
+bool VFS_FileSystemQuery::canSendRequest() const
+{
+  return state() == S_READY ||
+         state() == S_WAITING ||
+         state() == S_HAS_REPLY;
 }
 
 
@@ -194,6 +350,11 @@ void VFS_FileSystemQuery::connect(HostName const &hostname)
   setState(S_CONNECTING);
   m_hostName = hostname;
 
+  if (!m_requestedCodec) {
+    // Compressing costs more than it saves on a local pipe.
+    m_requestedCodec = m_hostName.isLocal()? VFS_CC_NONE : VFS_CC_LZ;
+  }
+
   if (m_hostName.isLocal()) {
     m_commandRunner.setProgram(
       QCoreApplication::applicationDirPath() + "/editor-fs-server.exe");
@@ -245,9 +406,11 @@ void VFS_FileSystemQuery::connect(HostName const &hostname)
     "starting command: " << toString(m_commandRunner.getCommandLine()));
   m_commandRunner.startAsynchronous();
 
-  // Attempt to establish version compatibility.
+  // Attempt to establish version compatibility, and negotiate the
+  // codec.
   VFS_GetVersion getVer;
-  innerSendRequest(getVer);
+  getVer.m_compressionCodec = *m_requestedCodec;
+  innerSendRequest(getVer, 0 /*wireID*/);
 }
 
 
@@ -257,54 +420,124 @@ HostName VFS_FileSystemQuery::getHostName() const
 }
 
 
-void VFS_FileSystemQuery::innerSendRequest(VFS_Message const &msg)
+void VFS_FileSystemQuery::setRequestedCodec(VFS_CompressionCodec codec)
+{
+  xassert(state() == S_CREATED);
+  m_requestedCodec = codec;
+}
+
+
+void VFS_FileSystemQuery::innerSendRequest(VFS_Message const &msg,
+                                           VFS_WireID wireID)
 {
-  // Serialize the message.
-  std::string serMessage;
+  // Serialize the message directly after space reserved for the
+  // header: the length, and when using envelopes, the request ID (which
+  // the server copies into the reply) and the codec byte.
+  std::size_t const headerLen = m_useEnvelopes? 4+4+1 : 4;
+  std::vector<unsigned char> &buf = m_sendBuffer;
+  buf.clear();
+  buf.resize(headerLen);
   {
-    std::ostringstream oss;
-    StreamFlatten flat(&oss);
+    BufferFlatten flat(buf);
     msg.serialize(flat);
-    serMessage = oss.str();
+  }
+  char const *body = reinterpret_cast<char const *>(buf.data()) + headerLen;
+  std::size_t const bodyLen = buf.size() - headerLen;
+  m_transferStats.m_messagesSent++;
+  m_transferStats.m_rawBytesSent += bodyLen;
+
+  // Compress if that helps, then copy everything once into the
+  // envelope handed to the child process.
+  std::string compressed;
+  QByteArray envelope;
+  if (m_useEnvelopes &&
+      vfsCompressMessageBody(m_codec, body, bodyLen, compressed)) {
+    uint32_t rawLen;
+    writeConvertedNumber(rawLen, bodyLen);
+    buf.resize(headerLen + 4);
+    serializeIntNBO(buf.data() + headerLen, rawLen);
+    buf[headerLen-1] = static_cast<unsigned char>(VFS_CC_LZ);
+
+    envelope.reserve(buf.size() + compressed.size());
+    envelope.append(reinterpret_cast<char const *>(buf.data()), buf.size());
+    envelope.append(compressed.data(), compressed.size());
+  }
+  else {
+    if (m_useEnvelopes) {
+      buf[headerLen-1] = static_cast<unsigned char>(VFS_CC_NONE);
+    }
+    envelope.append(reinterpret_cast<char const *>(buf.data()), buf.size());
   }
 
-  // Get its length.
-  unsigned char lenBuf[4];
+  // Fill in the rest of the header.
   uint32_t serMsgLen;
-  writeConvertedNumber(serMsgLen, serMessage.size());
-  serializeIntNBO(lenBuf, serMsgLen);
+  writeConvertedNumber(serMsgLen, envelope.size() - 4);
+  serializeIntNBO(reinterpret_cast<unsigned char*>(envelope.data()),
+                  serMsgLen);
+  if (m_useEnvelopes) {
+    serializeIntNBO(reinterpret_cast<unsigned char*>(envelope.data()+4),
+                    wireID);
+  }
 
-  // Combine the length and serialized message into an envelope.
-  QByteArray envelope(serMsgLen+4, 0);
-  memcpy(envelope.data(), lenBuf, 4);
-  memcpy(envelope.data()+4, serMessage.data(), serMsgLen);
+  // Do not let one huge request pin its memory for the life of the
+  // connection.
+  if (buf.capacity() > (16 << 20)) {
+    std::vector<unsigned char>().swap(buf);
+  }
 
   // Send that to the child process.
   TRACE("VFS_FileSystemQuery",
     "sending message: type=" << toString(msg.messageType()) <<
-    " len=" << serMsgLen);
+    " id=" << wireID << " len=" << serMsgLen);
   if (tracingSys("VFS_FileSystemQuery_detail")) {
     printQByteArray(envelope, "envelope bytes");
   }
+  m_transferStats.m_wireBytesSent += envelope.size();
   m_commandRunner.putInputData(envelope);
 }
 
 
-void VFS_FileSystemQuery::sendRequest(VFS_Message const &msg)
+VFS_WireID VFS_FileSystemQuery::sendRequest(
+  VFS_Message const &msg)
 {
-  xassert(state() == S_READY);
+  xassert(canSendRequest());
 
-  innerSendRequest(msg);
+  VFS_WireID wireID = m_nextWireID++;
+  if (m_nextWireID == 0) {
+    // Skip zero on wraparound.
+    m_nextWireID = 1;
+  }
+  xassert(m_outstandingWireIDs.count(wireID) == 0);
 
-  setState(S_WAITING);
+  if (m_outstandingWireIDs.empty()) {
+    m_busyStartMillis = getMilliseconds();
+  }
+  m_outstandingWireIDs.insert(wireID);
+
+  innerSendRequest(msg, wireID);
+
+  setStateFromQueues();
+  return wireID;
+}
+
+
+VFS_WireID VFS_FileSystemQuery::nextReplyID() const
+{
+  xassert(state() == S_HAS_REPLY);
+  return m_availableReplies.front().m_wireID;
 }
 
 
 std::unique_ptr<VFS_Message> VFS_FileSystemQuery::takeReply()
 {
   xassert(state() == S_HAS_REPLY);
-  setState(S_READY);
-  return std::move(m_replyMessage);
+
+  std::unique_ptr<VFS_Message> ret(
+    std::move(m_availableReplies.front().m_message));
+  m_availableReplies.pop_front();
+
+  setStateFromQueues();
+  return ret;
 }
 
 
@@ -9,6 +9,7 @@
 // editor
 #include "command-runner.h"            // CommandRunner
 #include "host-name.h"                 // HostName
+#include "vfs-compress.h"              // VFS_CompressionCodec
 #include "vfs-msg.h"                   // VFS_Message
 
 // smbase
@@ -20,16 +21,68 @@
 #include <QObject>
 
 // libc++
+#include <cstddef>                     // std::size_t
+#include <list>                        // std::list
 #include <memory>                      // std::unique_ptr
+#include <optional>                    // std::optional
+#include <set>                         // std::set
+#include <string>                      // std::string
+#include <utility>                     // std::move
+#include <vector>                      // std::vector
 
 // libc
 #include <stdint.h>                    // int64_t
 
 
+// Running totals describing the traffic on one connection.
+class VFS_TransferStats {
+public:      // data
+  // Number of messages sent and received, including the version
+  // exchange.
+  int64_t m_messagesSent;
+  int64_t m_messagesReceived;
+
+  // Bytes of serialized messages, before compression.
+  int64_t m_rawBytesSent;
+  int64_t m_rawBytesReceived;
+
+  // Bytes actually written to or read from the server process,
+  // including the length prefix and codec envelope.
+  int64_t m_wireBytesSent;
+  int64_t m_wireBytesReceived;
+
+  // Total time during which at least one request was outstanding.
+  // Overlapping requests are not double-counted, so this is wall-clock
+  // time spent waiting on the server.
+  int64_t m_waitMilliseconds;
+
+public:      // methods
+  // All zeroes.
+  VFS_TransferStats();
+
+  // Ratio of raw to wire bytes over both directions, or 1 if nothing
+  // has been transferred.
+  double compressionRatio() const;
+
+  // Raw bytes transferred in both directions per second spent waiting
+  // for replies, or 0 if no time has been measured.
+  double throughputBytesPerSecond() const;
+};
+
+
 // Class to issue asynchronous file system queries to a process that
 // implements the VFS protocol.  The process could be locally serving
 // the requests or an SSH process communicating to the real server on
 // another machine.
+//
+// Any number of requests can be outstanding at once.  Each carries a
+// `VFS_WireID` that the server copies into its reply, and the server may
+// reply in a different order than the requests were sent.
+//
+// The server can also send notifications, such as
+// `VFS_FileChangeNotification`, that do not answer any request.  These
+// are delivered along with the replies, in arrival order, and carry
+// `VFS_notificationWireID`.
 class VFS_FileSystemQuery : public QObject {
   Q_OBJECT
   NO_OBJECT_COPIES(VFS_FileSystemQuery);
@@ -37,19 +90,38 @@ class VFS_FileSystemQuery : public QObject {
 public:      // types
   // States that the query object can be in.
   //
-  // See doc/vfs-query-lifecycle.ded.png for the life cycle.
+  // See doc/vfs-query-lifecycle.ded.png for the life cycle.  (The
+  // diagram predates pipelining; it is still accurate if "request" is
+  // read as "the set of outstanding requests".)
   enum State {
     S_CREATED,     // Just created.
     S_CONNECTING,  // Establishing connection.
-    S_READY,       // Ready for requests.
-    S_WAITING,     // Request sent, reply not received.
-    S_HAS_REPLY,   // Reply received and available for client.
+    S_READY,       // Ready for requests, none outstanding.
+    S_WAITING,     // Requests sent, no reply available yet.
+    S_HAS_REPLY,   // At least one reply is available for the client.
     S_FAILED,      // A failure happened.
     S_DEAD,        // Connection was shut down.
 
     NUM_STATES     // Number of valid states.
   };
 
+private:     // types
+  // A reply that has arrived but not been taken.
+  class AvailableReply {
+  public:      // data
+    // ID of the request this answers.
+    VFS_WireID m_wireID;
+
+    // The reply.  Not null.
+    std::unique_ptr<VFS_Message> m_message;
+
+  public:      // methods
+    AvailableReply(VFS_WireID wireID, std::unique_ptr<VFS_Message> message)
+      : m_wireID(wireID),
+        m_message(std::move(message))
+    {}
+  };
+
 private:     // data
   // Current state.
   State m_state;
@@ -66,12 +138,42 @@ private:     // data
   // Bytes of error message received so far.
   QByteArray m_errorBytes;
 
-  // If not empty, the complete reply message that is available.
-  std::unique_ptr<VFS_Message> m_replyMessage;
+  // Requests are serialized here.  It is kept between requests so its
+  // capacity can be reused.
+  std::vector<unsigned char> m_sendBuffer;
+
+  // ID to assign to the next request.
+  VFS_WireID m_nextWireID;
+
+  // IDs of requests that have been sent but whose reply has not
+  // arrived.
+  std::set<VFS_WireID> m_outstandingWireIDs;
+
+  // Replies and notifications that have arrived, in arrival order.
+  std::list<AvailableReply> m_availableReplies;
 
   // Human-readable string explaining the failure.
   string m_failureReason;
 
+  // Codec to ask for during the version exchange.  If absent, `connect`
+  // asks for compression only when the host is remote.
+  std::optional<VFS_CompressionCodec> m_requestedCodec;
+
+  // Codec negotiated with the server.  Meaningful once the connection
+  // is ready.
+  VFS_CompressionCodec m_codec;
+
+  // True once the version exchange has completed, after which all
+  // message bodies are wrapped by `vfsEncodeMessageBody`.
+  bool m_useEnvelopes;
+
+  // Traffic totals for this connection.
+  VFS_TransferStats m_transferStats;
+
+  // Value of `getMilliseconds()` when `m_outstandingWireIDs` last
+  // became non-empty.
+  long m_busyStartMillis;
+
 private:     // methods
   // Set 'm_state'.  This method uses TRACE to record the state
   // transition for debugging purposes.
@@ -84,13 +186,23 @@ private:     // methods
   // signal, unless 'm_failed' is already true.
   void recordFailure(string const &reason);
 
-  // Look at the received data so far and decide if we have received
-  // enough to constitute a reply.  If so, emit signals, etc.
+  // Extract every complete message from the data received so far,
+  // then emit signals as appropriate.
   void checkForCompleteReply();
 
-  // Send 'msg', but without the state() manipulation that the public
-  // 'sendRequest' does.
-  void innerSendRequest(VFS_Message const &msg);
+  // Handle one complete message whose `len` bytes, after the length
+  // prefix, are at `messageBytes`.  They are only valid during the
+  // call.  Return false if this caused a failure.
+  bool processReplyMessage(char const *messageBytes, std::size_t len);
+
+  // Set the state that follows from the sets of outstanding requests
+  // and available replies.
+  void setStateFromQueues();
+
+  // Send 'msg' with 'wireID', but without the state() manipulation
+  // that the public 'sendRequest' does.  'wireID' is ignored before the
+  // version exchange completes, since it is not sent then.
+  void innerSendRequest(VFS_Message const &msg, VFS_WireID wireID);
 
 public:      // methods
   VFS_FileSystemQuery();
@@ -108,6 +220,10 @@ public:      // methods
   bool hasFailed() const { return state() == S_FAILED; }
   bool hasReply() const { return state() == S_HAS_REPLY; }
 
+  // True if the connection is established and working, regardless of
+  // whether requests are outstanding or replies are available.
+  bool canSendRequest() const;
+
   // Establish a connection to the given host, which can be the empty
   // string to indicate to access the local file system.
   //
@@ -121,12 +237,36 @@ public:      // methods
   // Get the host we are connecting to.
   HostName getHostName() const;
 
-  // Send 'msg' to the server for processing.
+  // Override the default choice of codec to request when connecting.
+  //
+  // Requires: state() == S_CREATED
+  void setRequestedCodec(VFS_CompressionCodec codec);
+
+  // Codec in use on this connection.  It is `VFS_CC_NONE` until the
+  // connection is ready.
+  VFS_CompressionCodec codec() const { return m_codec; }
+
+  // Traffic totals so far.
+  VFS_TransferStats const &transferStats() const
+    { return m_transferStats; }
+
+  // Send 'msg' to the server for processing, returning the ID that
+  // its reply will carry.
   //
-  // Requires: state() == S_READY
-  void sendRequest(VFS_Message const &msg);
+  // Requires: canSendRequest()
+  VFS_WireID sendRequest(VFS_Message const &msg);
+
+  // Number of requests sent whose reply has not arrived.
+  int numOutstandingRequests() const
+    { return (int)m_outstandingWireIDs.size(); }
+
+  // ID of the reply that 'takeReply' would return.  This is
+  // 'VFS_notificationWireID' if it is a notification.
+  //
+  // Requires: state() == S_HAS_REPLY
+  VFS_WireID nextReplyID() const;
 
-  // Take the reply object.
+  // Take the earliest-arriving available reply.
   //
   // Requires: state() == S_HAS_REPLY
   std::unique_ptr<VFS_Message> takeReply();
@@ -159,7 +299,9 @@ Q_SIGNALS:
   // Emitted when state() transitions from S_CONNECTING to S_READY.
   void signal_vfsConnected();
 
-  // Emitted when state() becomes S_HAS_REPLY.
+  // Emitted when one or more replies become available.  A single
+  // signal can announce several replies, so the receiver should take
+  // replies while 'hasReply()'.
   void signal_vfsReplyAvailable();
 
   // Emitted when state() becomes S_FAILED.
@@ -3,6 +3,7 @@
 
 #include "vfs-test-connections.h"                // this module
 
+#include "smbase/chained-cond.h"                 // smbase::cc::z_le_lt
 #include "smbase/either.h"                       // smbase::Either
 #include "smbase/map-util.h"                     // smbase::{mapInsertUniqueMove, mapInsertUnique}
 #include "smbase/overflow.h"                     // safeToInt
@@ -12,8 +13,11 @@
 #include "smbase/string-util.h"                  // stringToVectorOfUChar
 #include "smbase/xassert.h"                      // xassert
 
+#include <algorithm>                             // std::min
 #include <memory>                                // std::unique_ptr
+#include <string>                                // std::string
 #include <utility>                               // std::move
+#include <vector>                                // std::vector
 
 using namespace gdv;
 using namespace smbase;
@@ -119,6 +123,41 @@ void VFS_TestConnections::slot_processRequests()
       Q_EMIT signal_vfsReplyAvailable(id);
     }
 
+    else if (auto rfrr =
+               dynamic_cast<VFS_ReadFileRangeRequest const *>(msg.get())) {
+      mapInsertUniqueMove(m_availableReplies, id,
+        std::unique_ptr<VFS_Message>(processRFRR(rfrr).release()));
+
+      TRACE1("emitting signal_vfsReplyAvailable(" << id << ")");
+      Q_EMIT signal_vfsReplyAvailable(id);
+    }
+
+    else if (auto rflr =
+               dynamic_cast<VFS_ReadFileLinesRequest const *>(msg.get())) {
+      mapInsertUniqueMove(m_availableReplies, id,
+        std::unique_ptr<VFS_Message>(processRFLR(rflr).release()));
+
+      TRACE1("emitting signal_vfsReplyAvailable(" << id << ")");
+      Q_EMIT signal_vfsReplyAvailable(id);
+    }
+
+    else if (auto wfr =
+               dynamic_cast<VFS_WatchFileRequest const *>(msg.get())) {
+      mapInsertUniqueMove(m_availableReplies, id,
+        std::unique_ptr<VFS_Message>(processWFR(wfr).release()));
+
+      TRACE1("emitting signal_vfsReplyAvailable(" << id << ")");
+      Q_EMIT signal_vfsReplyAvailable(id);
+    }
+
+    else if (dynamic_cast<VFS_UnwatchFileRequest const *>(msg.get())) {
+      mapInsertUniqueMove(m_availableReplies, id,
+        std::unique_ptr<VFS_Message>(new VFS_UnwatchFileReply));
+
+      TRACE1("emitting signal_vfsReplyAvailable(" << id << ")");
+      Q_EMIT signal_vfsReplyAvailable(id);
+    }
+
     else {
       xfailure("unrecognized message");
     }
@@ -155,4 +194,93 @@ std::unique_ptr<VFS_ReadFileReply> VFS_TestConnections::processRFR(
 }
 
 
+std::unique_ptr<VFS_ReadFileRangeReply> VFS_TestConnections::processRFRR(
+  VFS_ReadFileRangeRequest const *rfrr)
+{
+  VFS_ReadFileRequest rfr;
+  rfr.m_path = rfrr->m_path;
+  std::unique_ptr<VFS_ReadFileReply> whole(processRFR(&rfr));
+
+  std::unique_ptr<VFS_ReadFileRangeReply> reply(new VFS_ReadFileRangeReply);
+  reply->m_offset = rfrr->m_offset;
+
+  if (whole->m_success) {
+    std::vector<unsigned char> const &contents = whole->m_contents;
+    reply->m_fileSize = (int64_t)contents.size();
+
+    int64_t start = std::min(rfrr->m_offset, reply->m_fileSize);
+    int64_t end = std::min(start + rfrr->m_maxLength, reply->m_fileSize);
+    reply->m_contents.assign(contents.begin() + start,
+                             contents.begin() + end);
+  }
+  else {
+    reply->setFailureReason(whole->m_failureReasonCode,
+                            whole->m_failureReasonString);
+  }
+
+  return reply;
+}
+
+
+std::unique_ptr<VFS_ReadFileLinesReply> VFS_TestConnections::processRFLR(
+  VFS_ReadFileLinesRequest const *rflr)
+{
+  std::unique_ptr<VFS_ReadFileLinesReply> reply(new VFS_ReadFileLinesReply);
+
+  for (VFS_ReadFileLinesRequest::FileLines const &fileReq : rflr->m_files) {
+    VFS_ReadFileRequest rfr;
+    rfr.m_path = fileReq.m_path;
+    std::unique_ptr<VFS_ReadFileReply> whole(processRFR(&rfr));
+
+    reply->m_files.push_back(VFS_ReadFileLinesReply::FileLines());
+    VFS_ReadFileLinesReply::FileLines &fileReply = reply->m_files.back();
+
+    if (!whole->m_success) {
+      fileReply.setFailureReason(whole->m_failureReasonCode,
+                                 whole->m_failureReasonString);
+      continue;
+    }
+
+    // Split the contents into lines.
+    std::vector<std::string> lines(1);
+    for (unsigned char c : whole->m_contents) {
+      if (c == '\n') {
+        lines.push_back(std::string());
+      }
+      else {
+        lines.back().push_back((char)c);
+      }
+    }
+
+    // Unlike the real server, always report the number of lines.
+    int32_t const numLines = safeToInt(lines.size());
+    fileReply.m_numLines = numLines;
+    for (int32_t index : fileReq.m_lineIndices) {
+      fileReply.m_lines.push_back(
+        cc::z_le_lt(index, numLines)? lines[index] : std::string());
+    }
+  }
+
+  return reply;
+}
+
+
+std::unique_ptr<VFS_WatchFileReply> VFS_TestConnections::processWFR(
+  VFS_WatchFileRequest const *wfr)
+{
+  std::unique_ptr<VFS_WatchFileReply> reply(new VFS_WatchFileReply);
+
+  // Files with contents exist, with a fixed modification time.  Nothing
+  // ever changes on its own here; tests emit `signal_vfsFileChanged`
+  // directly.
+  if (auto itOpt = mapFindOpt(m_files, wfr->m_path)) {
+    if ((**itOpt).second.isLeft()) {
+      reply->m_fileKind = SMFileUtil::FK_REGULAR;
+    }
+  }
+
+  return reply;
+}
+
+
 // EOF
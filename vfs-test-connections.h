@@ -8,7 +8,7 @@
 
 #include "host-name-fwd.h"                       // HostName [n]
 #include "vfs-connections.h"                     // VFS_AbstractConnections
-#include "vfs-msg-fwd.h"                         // VFS_ReadFile{Request,Reply} [n]
+#include "vfs-msg-fwd.h"                         // VFS_ReadFile[Range,Lines]{Request,Reply}, VFS_WatchFile{Request,Reply} [n]
 
 #include "smbase/either-fwd.h"                   // smbase::Either
 #include "smbase/portable-error-code-fwd.h"      // smbase::PortableErrorCode [n]
@@ -47,6 +47,21 @@ protected Q_SLOTS:
   std::unique_ptr<VFS_ReadFileReply> processRFR(
     VFS_ReadFileRequest const *rfr);
 
+  // Process a read range request by reading the whole file with
+  // `processRFR` and extracting the range.
+  std::unique_ptr<VFS_ReadFileRangeReply> processRFRR(
+    VFS_ReadFileRangeRequest const *rfrr);
+
+  // Process a read lines request by reading each whole file with
+  // `processRFR` and extracting the lines.
+  std::unique_ptr<VFS_ReadFileLinesReply> processRFLR(
+    VFS_ReadFileLinesRequest const *rflr);
+
+  // Process a watch request.  It succeeds for any path, and there are
+  // no notifications unless a test emits them.
+  std::unique_ptr<VFS_WatchFileReply> processWFR(
+    VFS_WatchFileRequest const *wfr);
+
 public:      // methods
   virtual ~VFS_TestConnections() override;
 
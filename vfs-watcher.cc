@@ -0,0 +1,327 @@
+// vfs-watcher.cc
+// Code for vfs-watcher.h.
+
+#include "vfs-watcher.h"                         // this module
+
+// smbase
+#include "smbase/exc.h"                          // smbase::XBase
+#include "smbase/nonport.h"                      // getFileModificationTime
+#include "smbase/portable-error-code.h"          // smbase::PortableErrorCode
+#include "smbase/syserr.h"                       // smbase::{XSysError, xsyserror}
+
+// libc++
+#include <initializer_list>                      // std::initializer_list
+#include <set>                                   // std::set
+#include <utility>                               // std::{move, pair, make_pair}
+#include <vector>                                // std::vector
+
+// libc
+#include <errno.h>                               // errno, EINTR
+#ifdef __linux__
+#  include <poll.h>                              // poll
+#  include <sys/inotify.h>                       // inotify_{init1,add_watch,rm_watch}
+#  include <unistd.h>                            // read, write, close, pipe
+#endif
+
+using namespace smbase;
+
+
+// Catch block for methods that service a PathRequest, like the one in
+// vfs-local.cc.
+#define PATH_REQUEST_CATCH_BLOCK                                     \
+  catch (XSysError &x) {                                             \
+    reply.setFailureReason(x.getPortableErrorCode(), x.why());       \
+  }                                                                  \
+  catch (XBase &x) {                                                 \
+    reply.setFailureReason(PortableErrorCode::PEC_UNKNOWN, x.why()); \
+  }
+
+
+#ifdef __linux__
+// Events that can change the kind or modification time of a file in a
+// watched directory.
+static uint32_t const WATCH_MASK =
+  IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+#endif
+
+
+// Get the current kind and modification time of `path`.  A file that
+// cannot be examined is reported as not existing.
+static void getFileState(
+  std::string const &path,
+  SMFileUtil::FileKind &fileKind /*OUT*/,
+  int64_t &modTime /*OUT*/)
+{
+  fileKind = SMFileUtil::FK_NONE;
+  modTime = 0;
+  try {
+    SMFileUtil sfu;
+    fileKind = sfu.getFileKind(path);
+    if (fileKind != SMFileUtil::FK_NONE) {
+      (void)getFileModificationTime(path.c_str(), modTime);
+    }
+  }
+  catch (XBase &) {
+    fileKind = SMFileUtil::FK_NONE;
+  }
+}
+
+
+VFS_FileWatcher::VFS_FileWatcher(Callback callback)
+  : m_callback(std::move(callback)),
+    m_mutex(),
+    m_dirs(),
+    m_wdToDir(),
+    m_inotifyFD(-1),
+    m_stopPipe{-1, -1},
+    m_thread()
+{}
+
+
+VFS_FileWatcher::~VFS_FileWatcher()
+{
+#ifdef __linux__
+  if (m_thread.joinable()) {
+    char c = 0;
+    while (write(m_stopPipe[1], &c, 1) < 0 && errno == EINTR)
+      {}
+    m_thread.join();
+  }
+
+  for (int fd : { m_inotifyFD, m_stopPipe[0], m_stopPipe[1] }) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+#endif
+}
+
+
+void VFS_FileWatcher::startIfNeeded()
+{
+#ifdef __linux__
+  if (m_inotifyFD >= 0) {
+    return;
+  }
+
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0) {
+    xsyserror("inotify_init1");
+  }
+
+  if (pipe(m_stopPipe) < 0) {
+    int savedErrno = errno;
+    close(fd);
+    errno = savedErrno;
+    xsyserror("pipe");
+  }
+
+  m_inotifyFD = fd;
+  m_thread = std::thread(&VFS_FileWatcher::threadMain, this);
+#endif
+}
+
+
+void VFS_FileWatcher::threadMain()
+{
+#ifdef __linux__
+  // Big enough for many events at once, aligned as the kernel expects.
+  alignas(struct inotify_event) char buf[0x10000];
+
+  while (true) {
+    struct pollfd fds[2];
+    fds[0].fd = m_inotifyFD;
+    fds[0].events = POLLIN;
+    fds[1].fd = m_stopPipe[0];
+    fds[1].events = POLLIN;
+
+    if (poll(fds, 2, -1 /*timeout*/) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    if (fds[1].revents) {
+      // The destructor is running.
+      return;
+    }
+
+    if (fds[0].revents) {
+      ssize_t len = read(m_inotifyFD, buf, sizeof(buf));
+      if (len < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      processEvents(buf, static_cast<std::size_t>(len));
+    }
+  }
+#endif
+}
+
+
+void VFS_FileWatcher::processEvents(char const *buf, std::size_t len)
+{
+#ifdef __linux__
+  std::vector<VFS_FileChangeNotification> notifications;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Files named by the events, as (directory, name) pairs.  A burst
+    // of events for one file is examined only once.
+    std::set<std::pair<std::string, std::string>> touched;
+
+    std::size_t offset = 0;
+    while (offset + sizeof(struct inotify_event) <= len) {
+      struct inotify_event const *ev =
+        reinterpret_cast<struct inotify_event const *>(buf + offset);
+      offset += sizeof(struct inotify_event) + ev->len;
+
+      auto wdIt = m_wdToDir.find(ev->wd);
+      if (wdIt == m_wdToDir.end()) {
+        // Unwatched since the event was queued.
+        continue;
+      }
+      std::string const &dir = wdIt->second;
+      WatchedDir &wdir = m_dirs.at(dir);
+
+      if (ev->mask & IN_IGNORED) {
+        // The directory itself was deleted or unmounted, so every file
+        // in it needs to be checked.  A later watch request for one of
+        // them will try to watch the directory again.
+        for (auto const &kv : wdir.m_files) {
+          touched.insert(std::make_pair(dir, kv.first));
+        }
+        wdir.m_wd = -1;
+        m_wdToDir.erase(wdIt);
+      }
+      else if (ev->len > 0) {
+        // `ev->name` is NUL-terminated, possibly with more padding.
+        std::string name(ev->name);
+        if (wdir.m_files.count(name)) {
+          touched.insert(std::make_pair(dir, name));
+        }
+      }
+    }
+
+    for (auto const &dirAndName : touched) {
+      WatchedFile &file =
+        m_dirs.at(dirAndName.first).m_files.at(dirAndName.second);
+
+      SMFileUtil::FileKind fileKind;
+      int64_t modTime;
+      getFileState(dirAndName.first + dirAndName.second, fileKind, modTime);
+
+      if (fileKind != file.m_fileKind ||
+          modTime != file.m_fileModificationTime) {
+        file.m_fileKind = fileKind;
+        file.m_fileModificationTime = modTime;
+
+        VFS_FileChangeNotification n;
+        n.m_path = file.m_clientPath;
+        n.m_fileKind = fileKind;
+        n.m_fileModificationTime = modTime;
+        notifications.push_back(n);
+      }
+    }
+  }
+
+  for (VFS_FileChangeNotification const &n : notifications) {
+    m_callback(n);
+  }
+#endif
+}
+
+
+VFS_WatchFileReply VFS_FileWatcher::watchFile(
+  VFS_WatchFileRequest const &req)
+{
+  VFS_WatchFileReply reply;
+
+  try {
+#ifdef __linux__
+    SMFileUtil sfu;
+    string pathname = sfu.getAbsolutePath(req.m_path);
+    string dir, name;
+    sfu.splitPath(dir, name, pathname);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    startIfNeeded();
+
+    WatchedDir &wdir = m_dirs[dir];
+    if (wdir.m_wd < 0) {
+      int wd = inotify_add_watch(m_inotifyFD, dir.c_str(), WATCH_MASK);
+      if (wd < 0) {
+        int savedErrno = errno;
+        if (wdir.m_files.empty()) {
+          m_dirs.erase(dir);
+        }
+        errno = savedErrno;
+        xsyserror("inotify_add_watch", dir);
+      }
+      wdir.m_wd = wd;
+      m_wdToDir[wd] = dir;
+    }
+
+    WatchedFile &file = wdir.m_files[name];
+    file.m_clientPath = req.m_path;
+    getFileState(pathname, file.m_fileKind, file.m_fileModificationTime);
+
+    reply.m_fileKind = file.m_fileKind;
+    reply.m_fileModificationTime = file.m_fileModificationTime;
+#else
+    reply.setFailureReason(PortableErrorCode::PEC_UNKNOWN,
+      "File watching is not supported on this platform.");
+#endif
+  }
+  PATH_REQUEST_CATCH_BLOCK
+
+  return reply;
+}
+
+
+VFS_UnwatchFileReply VFS_FileWatcher::unwatchFile(
+  VFS_UnwatchFileRequest const &req)
+{
+  VFS_UnwatchFileReply reply;
+
+  try {
+#ifdef __linux__
+    SMFileUtil sfu;
+    string pathname = sfu.getAbsolutePath(req.m_path);
+    string dir, name;
+    sfu.splitPath(dir, name, pathname);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto dirIt = m_dirs.find(dir);
+    if (dirIt != m_dirs.end()) {
+      WatchedDir &wdir = dirIt->second;
+      wdir.m_files.erase(name);
+
+      if (wdir.m_files.empty()) {
+        if (wdir.m_wd >= 0) {
+          // This queues an IN_IGNORED event, which `processEvents`
+          // discards since the descriptor is no longer mapped.
+          (void)inotify_rm_watch(m_inotifyFD, wdir.m_wd);
+          m_wdToDir.erase(wdir.m_wd);
+        }
+        m_dirs.erase(dirIt);
+      }
+    }
+#else
+    // Nothing is ever watched.
+    (void)req;
+#endif
+  }
+  PATH_REQUEST_CATCH_BLOCK
+
+  return reply;
+}
+
+
+// EOF
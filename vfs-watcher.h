@@ -0,0 +1,137 @@
+// vfs-watcher.h
+// VFS_FileWatcher class.
+
+// Like vfs-local.h, this module does not have any dependencies on Qt
+// because it is part of the file system server program.
+
+#ifndef EDITOR_VFS_WATCHER_H
+#define EDITOR_VFS_WATCHER_H
+
+#include "vfs-msg.h"                   // VFS_{Watch,Unwatch}File{Request,Reply}, VFS_FileChangeNotification
+
+// smbase
+#include "smbase/sm-file-util.h"       // SMFileUtil
+#include "smbase/sm-macros.h"          // NO_OBJECT_COPIES
+
+// libc++
+#include <functional>                  // std::function
+#include <map>                         // std::map
+#include <mutex>                       // std::mutex
+#include <string>                      // std::string
+#include <thread>                      // std::thread
+
+// libc
+#include <stdint.h>                    // int64_t
+
+
+// Watches files on behalf of a client, and reports changes to them as
+// `VFS_FileChangeNotification`s.
+//
+// On Linux this uses inotify.  The directory containing each watched
+// file is watched rather than the file itself, so a file that is
+// replaced by renaming another file over it, as many editors and build
+// tools do, is still seen.  On other platforms every watch request
+// fails, and the client has to poll instead.
+//
+// The methods can be called concurrently from multiple threads.
+class VFS_FileWatcher {
+  NO_OBJECT_COPIES(VFS_FileWatcher);
+
+public:      // types
+  // Receives notifications.  It is called on a thread owned by the
+  // watcher, without holding any of the watcher's locks.
+  typedef std::function<void (VFS_FileChangeNotification const &)>
+    Callback;
+
+private:     // types
+  // One watched file.
+  class WatchedFile {
+  public:      // data
+    // The path as the client gave it, for use in notifications.
+    std::string m_clientPath;
+
+    // Last state reported to the client, or observed when the watch
+    // was established.  One change usually produces several events,
+    // and only those that change this state are reported.
+    SMFileUtil::FileKind m_fileKind;
+    int64_t m_fileModificationTime;
+
+  public:      // methods
+    WatchedFile()
+      : m_clientPath(),
+        m_fileKind(SMFileUtil::FK_NONE),
+        m_fileModificationTime(0)
+    {}
+  };
+
+  // A directory containing watched files.
+  class WatchedDir {
+  public:      // data
+    // inotify watch descriptor, or -1 if the directory is not
+    // currently watched (for example, because it was deleted).
+    int m_wd;
+
+    // Map from final name component to the file.  Not empty.
+    std::map<std::string, WatchedFile> m_files;
+
+  public:      // methods
+    WatchedDir()
+      : m_wd(-1),
+        m_files()
+    {}
+  };
+
+private:     // data
+  // Where notifications go.
+  Callback m_callback;
+
+  // Protects all of the following.
+  std::mutex m_mutex;
+
+  // Map from absolute directory name, ending with a separator, to the
+  // files watched in it.
+  std::map<std::string, WatchedDir> m_dirs;
+
+  // Map from watch descriptor to the key of its entry in `m_dirs`.
+  std::map<int, std::string> m_wdToDir;
+
+  // inotify instance, or -1 until the first watch is established.
+  int m_inotifyFD;
+
+  // Pipe used to tell `m_thread` to exit.  Either end is -1 if not
+  // open.
+  int m_stopPipe[2];
+
+  // Thread that reads events from `m_inotifyFD`, started along with
+  // it.
+  std::thread m_thread;
+
+private:     // methods
+  // Create `m_inotifyFD`, `m_stopPipe`, and `m_thread` if they do not
+  // exist.  Throws XSysError on failure.  Requires that `m_mutex` be
+  // held.
+  void startIfNeeded();
+
+  // Body of `m_thread`.
+  void threadMain();
+
+  // Interpret `len` bytes of inotify events in `buf`, and send
+  // notifications for files whose state changed.
+  void processEvents(char const *buf, std::size_t len);
+
+public:      // methods
+  explicit VFS_FileWatcher(Callback callback);
+
+  // Stops the event thread.  No notifications are sent after this
+  // returns.
+  ~VFS_FileWatcher();
+
+  // Start watching `req.m_path`.
+  VFS_WatchFileReply   watchFile  (VFS_WatchFileRequest   const &req);
+
+  // Stop watching `req.m_path`.
+  VFS_UnwatchFileReply unwatchFile(VFS_UnwatchFileRequest const &req);
+};
+
+
+#endif // EDITOR_VFS_WATCHER_H